@@ -8,12 +8,13 @@
 void usage()
 {
     std::wcout <<
-        L"Usage: ApplicationLoopback <pid> <includetree|excludetree> <outputfilename>\n"
+        L"Usage: ApplicationLoopback <pid> <includetree|excludetree> <outputfilename> [pcm|adpcm]\n"
         L"\n"
         L"<pid> is the process ID to capture or exclude from capture\n"
         L"includetree includes audio from that process and its child processes\n"
         L"excludetree includes audio from all processes except that process and its child processes\n"
         L"<outputfilename> is the WAV file to receive the captured audio (10 seconds)\n"
+        L"pcm writes the audio unchanged (the default); adpcm compresses it 4:1 with IMA ADPCM\n"
         L"\n"
         L"Examples:\n"
         L"\n"
@@ -23,12 +24,27 @@ void usage()
         L"\n"
         L"ApplicationLoopback 1234 excludetree CapturedAudio.wav\n"
         L"\n"
-        L"  Captures audio from all processes except process 1234 and its children.\n";
+        L"  Captures audio from all processes except process 1234 and its children.\n"
+        L"\n"
+        L"ApplicationLoopback 1234 includetree CapturedAudio.wav adpcm\n"
+        L"\n"
+        L"  Captures audio from process 1234 and its children to a compressed WAV file.\n";
+}
+
+void PrintStatistics(const CaptureStatistics& stats)
+{
+    std::wcout << std::dec <<
+        L"Packets captured:     " << stats.Packets << L"\n" <<
+        L"Bytes captured:       " << stats.BytesCaptured << L"\n" <<
+        L"Overruns:             " << stats.Overruns << L" (" << stats.BytesDropped << L" bytes dropped)\n" <<
+        L"Discontinuities:      " << stats.Discontinuities << L"\n" <<
+        L"Ring high water:      " << stats.RingHighWater << L" of " << stats.RingCapacity << L" bytes\n" <<
+        L"File writes:          " << stats.FileWrites << L" (" << stats.BytesWritten << L" bytes)\n";
 }
 
 int wmain(int argc, wchar_t* argv[])
 {
-    if (argc != 4)
+    if (argc != 4 && argc != 5)
     {
         usage();
         return 0;
@@ -58,8 +74,22 @@ int wmain(int argc, wchar_t* argv[])
 
     PCWSTR outputFile = argv[3];
 
+    CaptureFileFormat fileFormat = CaptureFileFormat::Pcm;
+    if (argc == 5)
+    {
+        if (wcscmp(argv[4], L"adpcm") == 0)
+        {
+            fileFormat = CaptureFileFormat::ImaAdpcm;
+        }
+        else if (wcscmp(argv[4], L"pcm") != 0)
+        {
+            usage();
+            return 0;
+        }
+    }
+
     CLoopbackCapture loopbackCapture;
-    HRESULT hr = loopbackCapture.StartCaptureAsync(processId, includeProcessTree, outputFile);
+    HRESULT hr = loopbackCapture.StartCaptureAsync(processId, includeProcessTree, outputFile, fileFormat);
     if (FAILED(hr))
     {
         wil::unique_hlocal_string message;
@@ -75,6 +105,7 @@ int wmain(int argc, wchar_t* argv[])
         loopbackCapture.StopCaptureAsync();
 
         std::wcout << L"Finished.\n";
+        PrintStatistics(loopbackCapture.GetStatistics());
     }
 
     return 0;
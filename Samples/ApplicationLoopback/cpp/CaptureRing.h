@@ -0,0 +1,116 @@
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <memory>
+#include <new>
+
+#include <wil\result.h>
+
+//
+//  CCaptureRing
+//
+//  Byte ring between the capture callback (the only writer) and the file writer
+//  thread (the only reader). Neither side takes a lock: each side owns one position
+//  and publishes it with release/acquire ordering, so the reader never sees bytes
+//  before they are copied in, and the writer never overwrites bytes before they are
+//  copied out.
+//
+//  The size is a power of two and the positions count bytes since the start, so the
+//  amount of data is always WritePos - ReadPos, even when the ring is full.
+//
+class CCaptureRing
+{
+public:
+    CCaptureRing() = default;
+
+    HRESULT Initialize(size_t cbMinimum)
+    {
+        size_t cbSize = 4096;
+        while (cbSize < cbMinimum)
+        {
+            RETURN_HR_IF(E_OUTOFMEMORY, cbSize > (SIZE_MAX / 2));
+            cbSize *= 2;
+        }
+
+        m_Buffer.reset(new (std::nothrow) BYTE[cbSize]);
+        RETURN_IF_NULL_ALLOC(m_Buffer);
+
+        m_cbSize = cbSize;
+        m_WritePos.store(0);
+        m_ReadPos.store(0);
+        return S_OK;
+    }
+
+    //
+    //  Write()
+    //
+    //  Called by the producer. Copies cb bytes into the ring, or zeros if pData is null.
+    //  Returns false, and copies nothing, if there is not room for all of them.
+    //
+    bool Write(const BYTE* pData, size_t cb)
+    {
+        UINT64 writePos = m_WritePos.load(std::memory_order_relaxed);
+        UINT64 readPos = m_ReadPos.load(std::memory_order_acquire);
+
+        if (cb > m_cbSize - static_cast<size_t>(writePos - readPos))
+        {
+            return false;
+        }
+
+        size_t offset = static_cast<size_t>(writePos) & (m_cbSize - 1);
+        size_t cbFirst = min(cb, m_cbSize - offset);
+
+        if (pData != nullptr)
+        {
+            CopyMemory(m_Buffer.get() + offset, pData, cbFirst);
+            CopyMemory(m_Buffer.get(), pData + cbFirst, cb - cbFirst);
+        }
+        else
+        {
+            ZeroMemory(m_Buffer.get() + offset, cbFirst);
+            ZeroMemory(m_Buffer.get(), cb - cbFirst);
+        }
+
+        m_WritePos.store(writePos + cb, std::memory_order_release);
+        return true;
+    }
+
+    //
+    //  Read()
+    //
+    //  Called by the consumer. Copies up to cbMax bytes out of the ring and returns the
+    //  number of bytes copied.
+    //
+    size_t Read(BYTE* pDest, size_t cbMax)
+    {
+        UINT64 readPos = m_ReadPos.load(std::memory_order_relaxed);
+        UINT64 writePos = m_WritePos.load(std::memory_order_acquire);
+
+        size_t cb = min(cbMax, static_cast<size_t>(writePos - readPos));
+        size_t offset = static_cast<size_t>(readPos) & (m_cbSize - 1);
+        size_t cbFirst = min(cb, m_cbSize - offset);
+
+        CopyMemory(pDest, m_Buffer.get() + offset, cbFirst);
+        CopyMemory(pDest + cbFirst, m_Buffer.get(), cb - cbFirst);
+
+        m_ReadPos.store(readPos + cb, std::memory_order_release);
+        return cb;
+    }
+
+    // Can be called from either side. The other side may change the answer at any time.
+    size_t BytesAvailable() const
+    {
+        return static_cast<size_t>(m_WritePos.load(std::memory_order_acquire) - m_ReadPos.load(std::memory_order_acquire));
+    }
+
+    size_t Capacity() const { return m_cbSize; }
+
+private:
+    std::unique_ptr<BYTE[]> m_Buffer;
+    size_t m_cbSize = 0;
+
+    // Each position is on its own cache line, so the two threads do not fight over it.
+    alignas(64) std::atomic<UINT64> m_WritePos{ 0 };
+    alignas(64) std::atomic<UINT64> m_ReadPos{ 0 };
+};
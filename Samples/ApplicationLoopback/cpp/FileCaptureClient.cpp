@@ -0,0 +1,147 @@
+#include <mmreg.h>
+#include <ksmedia.h>
+
+#include <wil\resource.h>
+
+#include "FileCaptureClient.h"
+
+//
+//  RuntimeClassInitialize()
+//
+//  Reads the format and the audio data from a PCM WAV file
+//
+HRESULT CFileCaptureClient::RuntimeClassInitialize(PCWSTR fileName)
+{
+    wil::unique_hfile file(CreateFile(fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    RETURN_LAST_ERROR_IF(!file);
+
+    auto read = [&](void* buffer, DWORD cb) -> HRESULT
+    {
+        DWORD dwBytesRead = 0;
+        RETURN_IF_WIN32_BOOL_FALSE(ReadFile(file.get(), buffer, cb, &dwBytesRead, NULL));
+        RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_HANDLE_EOF), dwBytesRead != cb);
+        return S_OK;
+    };
+
+    DWORD riff[3] = {};
+    RETURN_IF_FAILED(read(riff, sizeof(riff)));
+    RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_BAD_FORMAT), riff[0] != FCC('RIFF') || riff[2] != FCC('WAVE'));
+
+    bool haveFormat = false;
+
+    // Walk the chunks until the data chunk; it must come after the fmt chunk.
+    for (;;)
+    {
+        DWORD chunk[2] = {};
+        RETURN_IF_FAILED(read(chunk, sizeof(chunk)));
+
+        DWORD cbChunk = chunk[1];
+
+        if (chunk[0] == FCC('fmt '))
+        {
+            WAVEFORMATEXTENSIBLE format = {};
+            RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_BAD_FORMAT), cbChunk < sizeof(PCMWAVEFORMAT) || cbChunk > sizeof(format));
+            RETURN_IF_FAILED(read(&format, cbChunk));
+
+            // Only integer PCM, which may be described with WAVE_FORMAT_EXTENSIBLE.
+            bool isPcm = (format.Format.wFormatTag == WAVE_FORMAT_PCM) ||
+                (format.Format.wFormatTag == WAVE_FORMAT_EXTENSIBLE && format.SubFormat == KSDATAFORMAT_SUBTYPE_PCM);
+            RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_BAD_FORMAT), !isPcm || format.Format.nBlockAlign == 0);
+
+            m_Format = format.Format;
+            m_Format.wFormatTag = WAVE_FORMAT_PCM;
+            m_Format.cbSize = 0;
+            haveFormat = true;
+        }
+        else if (chunk[0] == FCC('data'))
+        {
+            RETURN_HR_IF(HRESULT_FROM_WIN32(ERROR_BAD_FORMAT), !haveFormat);
+
+            m_Data.reset(new (std::nothrow) BYTE[cbChunk]);
+            RETURN_IF_NULL_ALLOC(m_Data);
+            RETURN_IF_FAILED(read(m_Data.get(), cbChunk));
+
+            m_TotalFrames = cbChunk / m_Format.nBlockAlign;
+            m_NextFrame = 0;
+            m_FramesPerPacket = max(1u, static_cast<UINT32>(m_Format.nSamplesPerSec / 100));
+            return S_OK;
+        }
+        else
+        {
+            // Skip the chunk, and the pad byte after an odd-sized chunk.
+            LARGE_INTEGER distance = {};
+            distance.QuadPart = (cbChunk + 1) & ~1;
+            RETURN_IF_WIN32_BOOL_FALSE(SetFilePointerEx(file.get(), distance, nullptr, FILE_CURRENT));
+        }
+    }
+}
+
+UINT32 CFileCaptureClient::NextPacketFrames() const
+{
+    if (m_PacketsQueued == 0 || IsEndOfStream())
+    {
+        return 0;
+    }
+    return static_cast<UINT32>(min(static_cast<UINT64>(m_FramesPerPacket), m_TotalFrames - m_NextFrame));
+}
+
+HRESULT CFileCaptureClient::GetNextPacketSize(UINT32* pNumFramesInNextPacket)
+{
+    RETURN_HR_IF_NULL(E_POINTER, pNumFramesInNextPacket);
+
+    *pNumFramesInNextPacket = NextPacketFrames();
+    return S_OK;
+}
+
+HRESULT CFileCaptureClient::GetBuffer(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition)
+{
+    RETURN_HR_IF(E_POINTER, !ppData || !pNumFramesToRead || !pdwFlags);
+    RETURN_HR_IF(AUDCLNT_E_OUT_OF_ORDER, m_BufferHeld);
+
+    UINT32 frames = NextPacketFrames();
+    if (frames == 0)
+    {
+        *ppData = nullptr;
+        *pNumFramesToRead = 0;
+        *pdwFlags = 0;
+        return AUDCLNT_S_BUFFER_EMPTY;
+    }
+
+    *ppData = m_Data.get() + m_NextFrame * m_Format.nBlockAlign;
+    *pNumFramesToRead = frames;
+    *pdwFlags = 0;
+
+    if (pu64DevicePosition)
+    {
+        *pu64DevicePosition = m_NextFrame;
+    }
+    if (pu64QPCPosition)
+    {
+        // In 100-nanosecond units, like the real capture client
+        LARGE_INTEGER qpc, frequency;
+        QueryPerformanceCounter(&qpc);
+        QueryPerformanceFrequency(&frequency);
+        *pu64QPCPosition = static_cast<UINT64>(qpc.QuadPart * 10000000.0 / frequency.QuadPart);
+    }
+
+    m_BufferHeld = true;
+    return S_OK;
+}
+
+HRESULT CFileCaptureClient::ReleaseBuffer(UINT32 NumFramesRead)
+{
+    RETURN_HR_IF(AUDCLNT_E_OUT_OF_ORDER, !m_BufferHeld);
+
+    m_BufferHeld = false;
+
+    // As with the real capture client, the packet is read either completely or not at all.
+    if (NumFramesRead != 0)
+    {
+        RETURN_HR_IF(AUDCLNT_E_INVALID_SIZE, NumFramesRead != NextPacketFrames());
+
+        m_NextFrame += NumFramesRead;
+        m_PacketsQueued--;
+    }
+
+    return S_OK;
+}
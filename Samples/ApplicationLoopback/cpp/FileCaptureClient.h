@@ -0,0 +1,54 @@
+#pragma once
+
+#include <Windows.h>
+#include <AudioClient.h>
+#include <memory>
+
+#include <wrl\implements.h>
+#include <wil\result.h>
+
+using namespace Microsoft::WRL;
+
+//
+//  CFileCaptureClient
+//
+//  Stands in for the IAudioCaptureClient of a real capture stream, so that the path from
+//  the capture callback to the WAV file can be run and measured without an audio device.
+//
+//  The audio comes from a PCM WAV file, which is read into memory up front so that
+//  reading it does not compete with the writer for the disk. Packets are 10
+//  milliseconds long, and only become available when QueuePackets is called, which
+//  stands in for the audio engine running for one period.
+//
+class CFileCaptureClient :
+    public RuntimeClass< RuntimeClassFlags< ClassicCom >, IAudioCaptureClient >
+{
+public:
+    CFileCaptureClient() = default;
+
+    HRESULT RuntimeClassInitialize(PCWSTR fileName);
+
+    const WAVEFORMATEX& Format() const { return m_Format; }
+    UINT64 TotalFrames() const { return m_TotalFrames; }
+    UINT32 FramesPerPacket() const { return m_FramesPerPacket; }
+    bool IsEndOfStream() const { return m_NextFrame >= m_TotalFrames; }
+
+    // Makes another count packets available to GetNextPacketSize and GetBuffer.
+    void QueuePackets(UINT32 count) { m_PacketsQueued += count; }
+
+    // IAudioCaptureClient
+    STDMETHOD(GetBuffer)(BYTE** ppData, UINT32* pNumFramesToRead, DWORD* pdwFlags, UINT64* pu64DevicePosition, UINT64* pu64QPCPosition);
+    STDMETHOD(ReleaseBuffer)(UINT32 NumFramesRead);
+    STDMETHOD(GetNextPacketSize)(UINT32* pNumFramesInNextPacket);
+
+private:
+    UINT32 NextPacketFrames() const;
+
+    WAVEFORMATEX m_Format{};
+    std::unique_ptr<BYTE[]> m_Data;
+    UINT64 m_TotalFrames = 0;
+    UINT64 m_NextFrame = 0;
+    UINT32 m_FramesPerPacket = 0;
+    UINT32 m_PacketsQueued = 0;
+    bool m_BufferHeld = false;
+};
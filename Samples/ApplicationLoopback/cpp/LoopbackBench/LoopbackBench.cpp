@@ -0,0 +1,157 @@
+// LoopbackBench.cpp : Measures the path from the capture callback to the WAV file without an audio device.
+//
+// A CFileCaptureClient plays a WAV file into CWavWriter::DrainCaptureClient one 10 millisecond
+// packet at a time, the same way the loopback capture callback drains the real capture client.
+// The benchmark reports how long the callbacks took and whether the writer thread kept up.
+//
+
+#include <Windows.h>
+#include <iostream>
+
+#include "..\FileCaptureClient.h"
+#include "..\WavWriter.h"
+
+void usage()
+{
+    std::wcout <<
+        L"Usage: LoopbackBench <inputfilename> <outputfilename> [pcm|adpcm] [speed]\n"
+        L"\n"
+        L"<inputfilename> is a PCM WAV file that stands in for the captured audio\n"
+        L"<outputfilename> is the WAV file to write\n"
+        L"pcm writes the audio unchanged (the default); adpcm compresses it with IMA ADPCM\n"
+        L"speed is how many times faster than real time to deliver the packets (default 20);\n"
+        L"  0 delivers them as fast as possible\n"
+        L"\n"
+        L"Example:\n"
+        L"\n"
+        L"LoopbackBench Music.wav Copy.wav adpcm 50\n";
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argc < 3 || argc > 5)
+    {
+        usage();
+        return 0;
+    }
+
+    PCWSTR inputFile = argv[1];
+    PCWSTR outputFile = argv[2];
+
+    CaptureFileFormat fileFormat = CaptureFileFormat::Pcm;
+    if (argc >= 4)
+    {
+        if (wcscmp(argv[3], L"adpcm") == 0)
+        {
+            fileFormat = CaptureFileFormat::ImaAdpcm;
+        }
+        else if (wcscmp(argv[3], L"pcm") != 0)
+        {
+            usage();
+            return 0;
+        }
+    }
+
+    double speed = (argc == 5) ? _wtof(argv[4]) : 20.0;
+    if (speed < 0)
+    {
+        usage();
+        return 0;
+    }
+
+    // Reads the whole input file before the clock starts.
+    ComPtr<CFileCaptureClient> captureClient;
+    HRESULT hr = MakeAndInitialize<CFileCaptureClient>(&captureClient, inputFile);
+    if (FAILED(hr))
+    {
+        std::wcout << L"Failed to read " << inputFile << L"\n0x" << std::hex << hr << L"\n";
+        return 1;
+    }
+
+    const WAVEFORMATEX& format = captureClient->Format();
+
+    CWavWriter wavWriter;
+    hr = wavWriter.Start(outputFile, format, fileFormat);
+    if (FAILED(hr))
+    {
+        std::wcout << L"Failed to create " << outputFile << L"\n0x" << std::hex << hr << L"\n";
+        return 1;
+    }
+
+    LARGE_INTEGER frequency, start, now;
+    QueryPerformanceFrequency(&frequency);
+
+    // QPC ticks between callbacks. The audio engine calls back once per 10 millisecond packet.
+    const double secondsPerPacket = static_cast<double>(captureClient->FramesPerPacket()) / format.nSamplesPerSec;
+    const LONGLONG period = (speed > 0) ? static_cast<LONGLONG>(frequency.QuadPart * secondsPerPacket / speed) : 0;
+
+    UINT64 callbacks = 0;
+    LONGLONG totalCallbackTime = 0;
+    LONGLONG maxCallbackTime = 0;
+
+    QueryPerformanceCounter(&start);
+    LONGLONG due = start.QuadPart;
+
+    while (!captureClient->IsEndOfStream())
+    {
+        // Wait for the next period. If a callback ran late, the next ones catch up.
+        for (;;)
+        {
+            QueryPerformanceCounter(&now);
+            if (now.QuadPart >= due)
+            {
+                break;
+            }
+            SwitchToThread();
+        }
+        due += period;
+
+        captureClient->QueuePackets(1);
+
+        LARGE_INTEGER before, after;
+        QueryPerformanceCounter(&before);
+        hr = wavWriter.DrainCaptureClient(captureClient.Get());
+        QueryPerformanceCounter(&after);
+
+        callbacks++;
+        totalCallbackTime += after.QuadPart - before.QuadPart;
+        maxCallbackTime = max(maxCallbackTime, after.QuadPart - before.QuadPart);
+
+        if (hr != S_OK)
+        {
+            // A failure, or the output file is full
+            break;
+        }
+    }
+
+    QueryPerformanceCounter(&now);
+    HRESULT hrFinish = wavWriter.Finish();
+    if (SUCCEEDED(hr))
+    {
+        hr = hrFinish;
+    }
+
+    const double seconds = static_cast<double>(now.QuadPart - start.QuadPart) / frequency.QuadPart;
+    const double audioSeconds = static_cast<double>(captureClient->TotalFrames()) / format.nSamplesPerSec;
+    const CaptureStatistics& stats = wavWriter.Statistics();
+
+    std::wcout <<
+        L"Audio:                " << audioSeconds << L" seconds, " << format.nChannels << L" channels, " <<
+        format.nSamplesPerSec << L" Hz, " << format.wBitsPerSample << L"-bit\n" <<
+        L"Elapsed:              " << seconds << L" seconds (" << audioSeconds / seconds << L" x real time)\n" <<
+        L"Callbacks:            " << callbacks << L", average " <<
+        (callbacks ? totalCallbackTime * 1e6 / frequency.QuadPart / callbacks : 0) << L" usec, longest " <<
+        maxCallbackTime * 1e6 / frequency.QuadPart << L" usec\n" <<
+        L"Packets captured:     " << stats.Packets << L"\n" <<
+        L"Overruns:             " << stats.Overruns << L" (" << stats.BytesDropped << L" bytes dropped)\n" <<
+        L"Ring high water:      " << stats.RingHighWater << L" of " << stats.RingCapacity << L" bytes\n" <<
+        L"File writes:          " << stats.FileWrites << L" (" << stats.BytesWritten << L" bytes)\n";
+
+    if (FAILED(hr))
+    {
+        std::wcout << L"Failed to write " << outputFile << L"\n0x" << std::hex << hr << L"\n";
+        return 1;
+    }
+
+    return (stats.Overruns == 0) ? 0 : 2;
+}
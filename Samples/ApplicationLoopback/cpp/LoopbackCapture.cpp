@@ -121,8 +121,8 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
             // Tell the system which event handle it should signal when an audio buffer is ready to be processed by the client
             RETURN_IF_FAILED(m_AudioClient->SetEventHandle(m_SampleReadyEvent.get()));
 
-            // Creates the WAV file.
-            RETURN_IF_FAILED(CreateWAVFile());
+            // Creates the WAV file and starts the thread that writes it.
+            RETURN_IF_FAILED(m_WavWriter.Start(m_outputFileName, m_CaptureFormat, m_FileFormat));
 
             // Everything is ready.
             m_DeviceState = DeviceState::Initialized;
@@ -135,77 +135,11 @@ HRESULT CLoopbackCapture::ActivateCompleted(IActivateAudioInterfaceAsyncOperatio
     return S_OK;
 }
 
-//
-//  CreateWAVFile()
-//
-//  Creates a WAV file in music folder
-//
-HRESULT CLoopbackCapture::CreateWAVFile()
-{
-    return SetDeviceStateErrorIfFailed([&]()->HRESULT
-        {
-            m_hFile.reset(CreateFile(m_outputFileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL));
-            RETURN_LAST_ERROR_IF(!m_hFile);
-
-            // Create and write the WAV header
-
-                // 1. RIFF chunk descriptor
-            DWORD header[] = {
-                                FCC('RIFF'),        // RIFF header
-                                0,                  // Total size of WAV (will be filled in later)
-                                FCC('WAVE'),        // WAVE FourCC
-                                FCC('fmt '),        // Start of 'fmt ' chunk
-                                sizeof(m_CaptureFormat) // Size of fmt chunk
-            };
-            DWORD dwBytesWritten = 0;
-            RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), header, sizeof(header), &dwBytesWritten, NULL));
-
-            m_cbHeaderSize += dwBytesWritten;
-
-            // 2. The fmt sub-chunk
-            WI_ASSERT(m_CaptureFormat.cbSize == 0);
-            RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), &m_CaptureFormat, sizeof(m_CaptureFormat), &dwBytesWritten, NULL));
-            m_cbHeaderSize += dwBytesWritten;
-
-            // 3. The data sub-chunk
-            DWORD data[] = { FCC('data'), 0 };  // Start of 'data' chunk
-            RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), data, sizeof(data), &dwBytesWritten, NULL));
-            m_cbHeaderSize += dwBytesWritten;
-
-            return S_OK;
-        }());
-}
-
-
-//
-//  FixWAVHeader()
-//
-//  The size values were not known when we originally wrote the header, so now go through and fix the values
-//
-HRESULT CLoopbackCapture::FixWAVHeader()
-{
-    // Write the size of the 'data' chunk first
-    DWORD dwPtr = SetFilePointer(m_hFile.get(), m_cbHeaderSize - sizeof(DWORD), NULL, FILE_BEGIN);
-    RETURN_LAST_ERROR_IF(INVALID_SET_FILE_POINTER == dwPtr);
-
-    DWORD dwBytesWritten = 0;
-    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), &m_cbDataSize, sizeof(DWORD), &dwBytesWritten, NULL));
-
-    // Write the total file size, minus RIFF chunk and size
-    // sizeof(DWORD) == sizeof(FOURCC)
-    RETURN_LAST_ERROR_IF(INVALID_SET_FILE_POINTER == SetFilePointer(m_hFile.get(), sizeof(DWORD), NULL, FILE_BEGIN));
-
-    DWORD cbTotalSize = m_cbDataSize + m_cbHeaderSize - 8;
-    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), &cbTotalSize, sizeof(DWORD), &dwBytesWritten, NULL));
-
-    RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_hFile.get()));
-
-    return S_OK;
-}
-
-HRESULT CLoopbackCapture::StartCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outputFileName)
+HRESULT CLoopbackCapture::StartCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outputFileName,
+    CaptureFileFormat fileFormat)
 {
     m_outputFileName = outputFileName;
+    m_FileFormat = fileFormat;
     auto resetOutputFileName = wil::scope_exit([&] { m_outputFileName = nullptr; });
 
     RETURN_IF_FAILED(InitializeLoopbackCapture());
@@ -297,12 +231,13 @@ HRESULT CLoopbackCapture::FinishCaptureAsync()
 //  OnFinishCapture()
 //
 //  Because of the asynchronous nature of the MF Work Queues and the DataWriter, there could still be
-//  a sample processing.  So this will get called to finalize the WAV header.
+//  a sample processing.  So this will get called to write out the rest of the audio and finalize
+//  the WAV header.
 //
 HRESULT CLoopbackCapture::OnFinishCapture(IMFAsyncResult* pResult)
 {
-    // FixWAVHeader will set the DeviceStateStopped when all async tasks are complete
-    HRESULT hr = FixWAVHeader();
+    // Finish waits for the writer thread to empty the ring before it fixes the header
+    HRESULT hr = m_WavWriter.Finish();
 
     m_DeviceState = DeviceState::Stopped;
 
@@ -342,13 +277,6 @@ HRESULT CLoopbackCapture::OnSampleReady(IMFAsyncResult* pResult)
 //
 HRESULT CLoopbackCapture::OnAudioSampleRequested()
 {
-    UINT32 FramesAvailable = 0;
-    BYTE* Data = nullptr;
-    DWORD dwCaptureFlags;
-    UINT64 u64DevicePosition = 0;
-    UINT64 u64QPCPosition = 0;
-    DWORD cbBytesToCapture = 0;
-
     auto lock = m_CritSec.lock();
 
     // If this flag is set, we have already queued up the async call to finialize the WAV header
@@ -358,59 +286,15 @@ HRESULT CLoopbackCapture::OnAudioSampleRequested()
         return S_OK;
     }
 
-    // A word on why we have a loop here;
-    // Suppose it has been 10 milliseconds or so since the last time
-    // this routine was invoked, and that we're capturing 48000 samples per second.
-    //
-    // The audio engine can be reasonably expected to have accumulated about that much
-    // audio data - that is, about 480 samples.
-    //
-    // However, the audio engine is free to accumulate this in various ways:
-    // a. as a single packet of 480 samples, OR
-    // b. as a packet of 80 samples plus a packet of 400 samples, OR
-    // c. as 48 packets of 10 samples each.
-    //
-    // In particular, there is no guarantee that this routine will be
-    // run once for each packet.
-    //
-    // So every time this routine runs, we need to read ALL the packets
-    // that are now available;
-    //
-    // We do this by calling IAudioCaptureClient::GetNextPacketSize
-    // over and over again until it indicates there are no more packets remaining.
-    while (SUCCEEDED(m_AudioCaptureClient->GetNextPacketSize(&FramesAvailable)) && FramesAvailable > 0)
-    {
-        cbBytesToCapture = FramesAvailable * m_CaptureFormat.nBlockAlign;
-
-        // WAV files have a 4GB (0xFFFFFFFF) size limit, so likely we have hit that limit when we
-        // overflow here.  Time to stop the capture
-        if ((m_cbDataSize + cbBytesToCapture) < m_cbDataSize)
-        {
-            StopCaptureAsync();
-            break;
-        }
-
-        // Get sample buffer
-        RETURN_IF_FAILED(m_AudioCaptureClient->GetBuffer(&Data, &FramesAvailable, &dwCaptureFlags, &u64DevicePosition, &u64QPCPosition));
+    // Copy the packets to the WAV writer's ring. The writer thread does the disk I/O,
+    // so a slow disk cannot hold up this callback.
+    HRESULT hr = m_WavWriter.DrainCaptureClient(m_AudioCaptureClient.get());
+    RETURN_IF_FAILED(hr);
 
-
-        // Write File
-        if (m_DeviceState != DeviceState::Stopping)
-        {
-            DWORD dwBytesWritten = 0;
-            RETURN_IF_WIN32_BOOL_FALSE(WriteFile(
-                m_hFile.get(),
-                Data,
-                cbBytesToCapture,
-                &dwBytesWritten,
-                NULL));
-        }
-
-        // Release buffer back
-        m_AudioCaptureClient->ReleaseBuffer(FramesAvailable);
-
-        // Increase the size of our 'data' chunk.  m_cbDataSize needs to be accurate
-        m_cbDataSize += cbBytesToCapture;
+    // S_FALSE means the WAV file has reached its 4GB size limit. Time to stop the capture
+    if (hr == S_FALSE)
+    {
+        StopCaptureAsync();
     }
 
     return S_OK;
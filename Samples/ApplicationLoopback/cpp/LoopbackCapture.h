@@ -11,6 +11,7 @@
 #include <wil\result.h>
 
 #include "Common.h"
+#include "WavWriter.h"
 
 using namespace Microsoft::WRL;
 
@@ -21,9 +22,13 @@ public:
     CLoopbackCapture() = default;
     ~CLoopbackCapture();
 
-    HRESULT StartCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outputFileName);
+    HRESULT StartCaptureAsync(DWORD processId, bool includeProcessTree, PCWSTR outputFileName,
+        CaptureFileFormat fileFormat = CaptureFileFormat::Pcm);
     HRESULT StopCaptureAsync();
 
+    // Valid once the capture has stopped.
+    const CaptureStatistics& GetStatistics() const { return m_WavWriter.Statistics(); }
+
     METHODASYNCCALLBACK(CLoopbackCapture, StartCapture, OnStartCapture);
     METHODASYNCCALLBACK(CLoopbackCapture, StopCapture, OnStopCapture);
     METHODASYNCCALLBACK(CLoopbackCapture, SampleReady, OnSampleReady);
@@ -52,8 +57,6 @@ private:
     HRESULT OnSampleReady(IMFAsyncResult* pResult);
 
     HRESULT InitializeLoopbackCapture();
-    HRESULT CreateWAVFile();
-    HRESULT FixWAVHeader();
     HRESULT OnAudioSampleRequested();
 
     HRESULT ActivateAudioInterface(DWORD processId, bool includeProcessTree);
@@ -69,15 +72,14 @@ private:
 
     wil::unique_event_nothrow m_SampleReadyEvent;
     MFWORKITEM_KEY m_SampleReadyKey = 0;
-    wil::unique_hfile m_hFile;
     wil::critical_section m_CritSec;
     DWORD m_dwQueueID = 0;
-    DWORD m_cbHeaderSize = 0;
-    DWORD m_cbDataSize = 0;
+    CWavWriter m_WavWriter;
 
     // These two members are used to communicate between the main thread
     // and the ActivateCompleted callback.
     PCWSTR m_outputFileName = nullptr;
+    CaptureFileFormat m_FileFormat = CaptureFileFormat::Pcm;
     HRESULT m_activateResult = E_UNEXPECTED;
 
     DeviceState m_DeviceState{ DeviceState::Uninitialized };
@@ -0,0 +1,507 @@
+#include "WavWriter.h"
+
+// WAV files have a 4GB (0xFFFFFFFF) size limit.
+#define MAX_WAV_DATA_SIZE (0xFFFFFFFFull - 1024 * 1024)
+
+// IMA ADPCM tables: the quantizer step for each step index, and how each 4-bit code
+// moves the step index.
+static const int c_AdpcmStepTable[89] =
+{
+    7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+    50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+    253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+    1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+    3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442, 11487,
+    12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794, 32767
+};
+
+static const int c_AdpcmIndexTable[16] =
+{
+    -1, -1, -1, -1, 2, 4, 6, 8,
+    -1, -1, -1, -1, 2, 4, 6, 8
+};
+
+CWavWriter::~CWavWriter()
+{
+    // Finish() normally stops the thread, but do not leave it running on a failure path.
+    if (m_hWriterThread)
+    {
+        m_StopWriter = true;
+        m_hDataReady.SetEvent();
+        WaitForSingleObject(m_hWriterThread.get(), INFINITE);
+    }
+}
+
+//
+//  Start()
+//
+//  Creates the file, allocates the ring and starts the writer thread
+//
+HRESULT CWavWriter::Start(PCWSTR fileName, const WAVEFORMATEX& captureFormat, CaptureFileFormat fileFormat)
+{
+    RETURN_HR_IF(E_INVALIDARG, captureFormat.wFormatTag != WAVE_FORMAT_PCM || captureFormat.nBlockAlign == 0);
+    RETURN_HR_IF(E_INVALIDARG, fileFormat == CaptureFileFormat::ImaAdpcm && captureFormat.wBitsPerSample != 16);
+
+    m_CaptureFormat = captureFormat;
+    m_CaptureFormat.cbSize = 0;
+    m_FileFormat = fileFormat;
+    m_Statistics = {};
+
+    RETURN_IF_FAILED(m_Ring.Initialize(static_cast<size_t>(c_RingSeconds) * m_CaptureFormat.nAvgBytesPerSec));
+    m_Statistics.RingCapacity = m_Ring.Capacity();
+
+    m_Staging.reset(new (std::nothrow) BYTE[c_cbWriteSize]);
+    RETURN_IF_NULL_ALLOC(m_Staging);
+
+    if (m_FileFormat == CaptureFileFormat::ImaAdpcm)
+    {
+        // The usual block size: 256 bytes per channel, times 2 or 4 at higher sample rates.
+        UINT32 nChannels = m_CaptureFormat.nChannels;
+        m_AdpcmBlockAlign = static_cast<WORD>(256 * nChannels * max(1u, m_CaptureFormat.nSamplesPerSec / 11025));
+
+        // Each block starts with a 4-byte header per channel, which holds the first sample.
+        m_AdpcmSamplesPerBlock = static_cast<WORD>((m_AdpcmBlockAlign - 4 * nChannels) * 8 / (4 * nChannels) + 1);
+
+        m_AdpcmInput.reset(new (std::nothrow) BYTE[m_AdpcmSamplesPerBlock * m_CaptureFormat.nBlockAlign]);
+        m_AdpcmOutput.reset(new (std::nothrow) BYTE[m_AdpcmBlockAlign]);
+        m_AdpcmPredictor.reset(new (std::nothrow) int[nChannels]());
+        m_AdpcmStepIndex.reset(new (std::nothrow) int[nChannels]());
+        RETURN_IF_NULL_ALLOC(m_AdpcmInput);
+        RETURN_IF_NULL_ALLOC(m_AdpcmOutput);
+        RETURN_IF_NULL_ALLOC(m_AdpcmPredictor);
+        RETURN_IF_NULL_ALLOC(m_AdpcmStepIndex);
+    }
+
+    m_hFile.reset(CreateFile(fileName, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL));
+    RETURN_LAST_ERROR_IF(!m_hFile);
+
+    // The header goes out with the first block of audio.
+    BuildHeader();
+
+    RETURN_IF_FAILED(m_hDataReady.create(wil::EventOptions::None));
+
+    m_StopWriter = false;
+    m_hWriterThread.reset(CreateThread(nullptr, 0, WriterThreadProc, this, 0, nullptr));
+    RETURN_LAST_ERROR_IF(!m_hWriterThread);
+
+    return S_OK;
+}
+
+//
+//  BuildHeader()
+//
+//  Puts the WAV header at the start of the staging buffer. The sizes are not known
+//  yet, so FixHeader fills them in at the end.
+//
+void CWavWriter::BuildHeader()
+{
+    BYTE* p = m_Staging.get();
+
+    auto put = [&](const void* data, DWORD cb)
+    {
+        CopyMemory(p, data, cb);
+        p += cb;
+    };
+    auto putDword = [&](DWORD value)
+    {
+        put(&value, sizeof(value));
+    };
+
+    // 1. RIFF chunk descriptor
+    putDword(FCC('RIFF'));
+    putDword(0);                // Total size of WAV (will be filled in later)
+    putDword(FCC('WAVE'));
+
+    // 2. The fmt sub-chunk
+    putDword(FCC('fmt '));
+    if (m_FileFormat == CaptureFileFormat::ImaAdpcm)
+    {
+        IMAADPCMWAVEFORMAT adpcmFormat = {};
+        adpcmFormat.wfx.wFormatTag = WAVE_FORMAT_IMA_ADPCM;
+        adpcmFormat.wfx.nChannels = m_CaptureFormat.nChannels;
+        adpcmFormat.wfx.nSamplesPerSec = m_CaptureFormat.nSamplesPerSec;
+        adpcmFormat.wfx.nAvgBytesPerSec = MulDiv(m_CaptureFormat.nSamplesPerSec, m_AdpcmBlockAlign, m_AdpcmSamplesPerBlock);
+        adpcmFormat.wfx.nBlockAlign = m_AdpcmBlockAlign;
+        adpcmFormat.wfx.wBitsPerSample = 4;
+        adpcmFormat.wfx.cbSize = sizeof(adpcmFormat) - sizeof(WAVEFORMATEX);
+        adpcmFormat.wSamplesPerBlock = m_AdpcmSamplesPerBlock;
+
+        putDword(sizeof(adpcmFormat));
+        put(&adpcmFormat, sizeof(adpcmFormat));
+
+        // Compressed formats also need a fact chunk with the length in frames.
+        putDword(FCC('fact'));
+        putDword(sizeof(DWORD));
+        m_FactOffset = static_cast<DWORD>(p - m_Staging.get());
+        putDword(0);
+    }
+    else
+    {
+        putDword(sizeof(m_CaptureFormat));
+        put(&m_CaptureFormat, sizeof(m_CaptureFormat));
+    }
+
+    // 3. The data sub-chunk
+    putDword(FCC('data'));
+    m_DataSizeOffset = static_cast<DWORD>(p - m_Staging.get());
+    putDword(0);
+
+    m_cbHeaderSize = static_cast<DWORD>(p - m_Staging.get());
+    m_cbStaged = m_cbHeaderSize;
+    m_cbData = 0;
+}
+
+//
+//  DrainCaptureClient()
+//
+//  Called from the capture callback when the audio engine signals that packets are
+//  ready. Copies every packet into the ring and returns without touching the disk.
+//
+HRESULT CWavWriter::DrainCaptureClient(IAudioCaptureClient* captureClient)
+{
+    UINT32 FramesAvailable = 0;
+    BYTE* Data = nullptr;
+    DWORD dwCaptureFlags = 0;
+    HRESULT hr = S_OK;
+
+    // A word on why we have a loop here;
+    // Suppose it has been 10 milliseconds or so since the last time
+    // this routine was invoked, and that we're capturing 48000 samples per second.
+    //
+    // The audio engine can be reasonably expected to have accumulated about that much
+    // audio data - that is, about 480 samples.
+    //
+    // However, the audio engine is free to accumulate this in various ways:
+    // a. as a single packet of 480 samples, OR
+    // b. as a packet of 80 samples plus a packet of 400 samples, OR
+    // c. as 48 packets of 10 samples each.
+    //
+    // In particular, there is no guarantee that this routine will be
+    // run once for each packet.
+    //
+    // So every time this routine runs, we need to read ALL the packets
+    // that are now available;
+    //
+    // We do this by calling IAudioCaptureClient::GetNextPacketSize
+    // over and over again until it indicates there are no more packets remaining.
+    while (SUCCEEDED(captureClient->GetNextPacketSize(&FramesAvailable)) && FramesAvailable > 0)
+    {
+        size_t cbBytesToCapture = static_cast<size_t>(FramesAvailable) * m_CaptureFormat.nBlockAlign;
+
+        // Likely we have hit the WAV size limit. Time to stop the capture.
+        if (m_Statistics.BytesCaptured + cbBytesToCapture > MAX_WAV_DATA_SIZE)
+        {
+            hr = S_FALSE;
+            break;
+        }
+
+        // Get sample buffer
+        RETURN_IF_FAILED(captureClient->GetBuffer(&Data, &FramesAvailable, &dwCaptureFlags, nullptr, nullptr));
+
+        // A silent packet can hold anything, so write zeros instead.
+        const BYTE* source = WI_IsFlagSet(dwCaptureFlags, AUDCLNT_BUFFERFLAGS_SILENT) ? nullptr : Data;
+
+        if (m_Ring.Write(source, cbBytesToCapture))
+        {
+            m_Statistics.BytesCaptured += cbBytesToCapture;
+        }
+        else
+        {
+            // The writer thread has fallen more than c_RingSeconds behind.
+            m_Statistics.Overruns++;
+            m_Statistics.BytesDropped += cbBytesToCapture;
+        }
+
+        if (WI_IsFlagSet(dwCaptureFlags, AUDCLNT_BUFFERFLAGS_DATA_DISCONTINUITY))
+        {
+            m_Statistics.Discontinuities++;
+        }
+        m_Statistics.Packets++;
+
+        // Release buffer back
+        captureClient->ReleaseBuffer(FramesAvailable);
+    }
+
+    // Wake the writer thread once there is a full block for it.
+    size_t cbWaiting = m_Ring.BytesAvailable();
+    m_Statistics.RingHighWater = max(m_Statistics.RingHighWater, cbWaiting);
+
+    if (cbWaiting >= c_cbWriteSize)
+    {
+        m_hDataReady.SetEvent();
+    }
+
+    return hr;
+}
+
+DWORD WINAPI CWavWriter::WriterThreadProc(LPVOID context)
+{
+    CWavWriter* writer = static_cast<CWavWriter*>(context);
+
+    // The writer runs until Finish is called, or until a write fails.
+    for (;;)
+    {
+        writer->m_hDataReady.wait(c_WriterTimeout);
+
+        bool final = writer->m_StopWriter;
+
+        writer->m_hrWriter = writer->DrainRing(final);
+        if (final || FAILED(writer->m_hrWriter))
+        {
+            break;
+        }
+    }
+
+    return 0;
+}
+
+//
+//  DrainRing()
+//
+//  Called on the writer thread. Moves everything in the ring to the staging buffer,
+//  compressing it if needed, and writes each staging buffer as it fills. On the final
+//  call the partial staging buffer is written as well.
+//
+HRESULT CWavWriter::DrainRing(bool final)
+{
+    if (m_FileFormat == CaptureFileFormat::ImaAdpcm)
+    {
+        const size_t cbBlockInput = static_cast<size_t>(m_AdpcmSamplesPerBlock) * m_CaptureFormat.nBlockAlign;
+
+        for (;;)
+        {
+            m_cbAdpcmInput += m_Ring.Read(m_AdpcmInput.get() + m_cbAdpcmInput, cbBlockInput - m_cbAdpcmInput);
+            if (m_cbAdpcmInput < cbBlockInput)
+            {
+                break;
+            }
+
+            EncodeAdpcmBlock(reinterpret_cast<const short*>(m_AdpcmInput.get()), m_AdpcmOutput.get());
+            RETURN_IF_FAILED(Append(m_AdpcmOutput.get(), m_AdpcmBlockAlign));
+
+            m_AdpcmFrames += m_AdpcmSamplesPerBlock;
+            m_cbAdpcmInput = 0;
+        }
+
+        if (final && m_cbAdpcmInput > 0)
+        {
+            // Pad the last block with silence. The fact chunk holds the real length.
+            m_AdpcmFrames += m_cbAdpcmInput / m_CaptureFormat.nBlockAlign;
+
+            ZeroMemory(m_AdpcmInput.get() + m_cbAdpcmInput, cbBlockInput - m_cbAdpcmInput);
+            EncodeAdpcmBlock(reinterpret_cast<const short*>(m_AdpcmInput.get()), m_AdpcmOutput.get());
+            RETURN_IF_FAILED(Append(m_AdpcmOutput.get(), m_AdpcmBlockAlign));
+
+            m_cbAdpcmInput = 0;
+        }
+    }
+    else
+    {
+        // Read straight into the staging buffer.
+        for (;;)
+        {
+            size_t cbRead = m_Ring.Read(m_Staging.get() + m_cbStaged, c_cbWriteSize - m_cbStaged);
+            m_cbStaged += cbRead;
+            m_cbData += cbRead;
+
+            if (m_cbStaged < c_cbWriteSize)
+            {
+                break;
+            }
+            RETURN_IF_FAILED(FlushStaging());
+        }
+    }
+
+    if (final && m_cbStaged > 0)
+    {
+        RETURN_IF_FAILED(FlushStaging());
+    }
+
+    return S_OK;
+}
+
+//
+//  Append()
+//
+//  Adds data to the staging buffer, writing the buffer each time it fills
+//
+HRESULT CWavWriter::Append(const BYTE* data, size_t cb)
+{
+    m_cbData += cb;
+
+    while (cb > 0)
+    {
+        size_t cbCopy = min(cb, c_cbWriteSize - m_cbStaged);
+        CopyMemory(m_Staging.get() + m_cbStaged, data, cbCopy);
+
+        m_cbStaged += cbCopy;
+        data += cbCopy;
+        cb -= cbCopy;
+
+        if (m_cbStaged == c_cbWriteSize)
+        {
+            RETURN_IF_FAILED(FlushStaging());
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT CWavWriter::FlushStaging()
+{
+    DWORD dwBytesWritten = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), m_Staging.get(), static_cast<DWORD>(m_cbStaged), &dwBytesWritten, NULL));
+
+    m_Statistics.FileWrites++;
+    m_Statistics.BytesWritten += dwBytesWritten;
+    m_cbStaged = 0;
+
+    return S_OK;
+}
+
+//
+//  Finish()
+//
+//  Called after the capture has stopped. Lets the writer thread write out the rest of
+//  the ring, then fixes the header.
+//
+HRESULT CWavWriter::Finish()
+{
+    RETURN_HR_IF(E_NOT_VALID_STATE, !m_hWriterThread);
+
+    m_StopWriter = true;
+    m_hDataReady.SetEvent();
+    WaitForSingleObject(m_hWriterThread.get(), INFINITE);
+    m_hWriterThread.reset();
+
+    RETURN_IF_FAILED(m_hrWriter);
+    RETURN_IF_FAILED(FixHeader());
+
+    m_hFile.reset();
+    return S_OK;
+}
+
+//
+//  FixHeader()
+//
+//  The size values were not known when we originally wrote the header, so now go
+//  through and fix the values
+//
+HRESULT CWavWriter::FixHeader()
+{
+    // Write the size of the 'data' chunk first
+    DWORD cbDataSize = static_cast<DWORD>(m_cbData);
+    RETURN_IF_FAILED(WriteAt(m_DataSizeOffset, &cbDataSize, sizeof(cbDataSize)));
+
+    // Then the length in frames, for compressed formats
+    if (m_FileFormat == CaptureFileFormat::ImaAdpcm)
+    {
+        DWORD dwFrames = static_cast<DWORD>(m_AdpcmFrames);
+        RETURN_IF_FAILED(WriteAt(m_FactOffset, &dwFrames, sizeof(dwFrames)));
+    }
+
+    // Write the total file size, minus RIFF chunk and size
+    // sizeof(DWORD) == sizeof(FOURCC)
+    DWORD cbTotalSize = cbDataSize + m_cbHeaderSize - 8;
+    RETURN_IF_FAILED(WriteAt(sizeof(DWORD), &cbTotalSize, sizeof(cbTotalSize)));
+
+    RETURN_IF_WIN32_BOOL_FALSE(FlushFileBuffers(m_hFile.get()));
+
+    return S_OK;
+}
+
+HRESULT CWavWriter::WriteAt(DWORD offset, const void* data, DWORD cb)
+{
+    RETURN_LAST_ERROR_IF(INVALID_SET_FILE_POINTER == SetFilePointer(m_hFile.get(), offset, NULL, FILE_BEGIN));
+
+    DWORD dwBytesWritten = 0;
+    RETURN_IF_WIN32_BOOL_FALSE(WriteFile(m_hFile.get(), data, cb, &dwBytesWritten, NULL));
+
+    return S_OK;
+}
+
+//
+//  EncodeAdpcmBlock()
+//
+//  Compresses m_AdpcmSamplesPerBlock frames of 16-bit PCM into one IMA ADPCM block.
+//
+//  Each block starts with a header per channel that holds the first sample and the
+//  step index. The rest of the samples follow as 4-bit codes, low nibble first, with
+//  the channels interleaved in groups of 4 bytes (8 samples).
+//
+void CWavWriter::EncodeAdpcmBlock(const short* samples, BYTE* block)
+{
+    const UINT32 nChannels = m_CaptureFormat.nChannels;
+
+    for (UINT32 channel = 0; channel < nChannels; channel++)
+    {
+        short first = samples[channel];
+        m_AdpcmPredictor[channel] = first;
+
+        CopyMemory(block, &first, sizeof(first));
+        block[2] = static_cast<BYTE>(m_AdpcmStepIndex[channel]);
+        block[3] = 0;
+        block += 4;
+    }
+
+    for (UINT32 frame = 1; frame < m_AdpcmSamplesPerBlock; frame += 8)
+    {
+        for (UINT32 channel = 0; channel < nChannels; channel++)
+        {
+            const short* group = samples + frame * nChannels + channel;
+
+            for (UINT32 i = 0; i < 8; i += 2)
+            {
+                BYTE low = EncodeAdpcmSample(channel, group[i * nChannels]);
+                BYTE high = EncodeAdpcmSample(channel, group[(i + 1) * nChannels]);
+                *block++ = static_cast<BYTE>(low | (high << 4));
+            }
+        }
+    }
+}
+
+BYTE CWavWriter::EncodeAdpcmSample(UINT32 channel, int sample)
+{
+    int& predictor = m_AdpcmPredictor[channel];
+    int& stepIndex = m_AdpcmStepIndex[channel];
+
+    int step = c_AdpcmStepTable[stepIndex];
+    int diff = sample - predictor;
+    BYTE code = 0;
+
+    if (diff < 0)
+    {
+        code = 8;
+        diff = -diff;
+    }
+
+    // Quantize the difference the same way the decoder rebuilds it, so the predictor
+    // tracks what the decoder will produce.
+    int delta = step >> 3;
+    if (diff >= step)
+    {
+        code |= 4;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step)
+    {
+        code |= 2;
+        diff -= step;
+        delta += step;
+    }
+    step >>= 1;
+    if (diff >= step)
+    {
+        code |= 1;
+        delta += step;
+    }
+
+    predictor += (code & 8) ? -delta : delta;
+    predictor = min(max(predictor, -32768), 32767);
+
+    stepIndex = min(max(stepIndex + c_AdpcmIndexTable[code], 0), 88);
+
+    return code;
+}
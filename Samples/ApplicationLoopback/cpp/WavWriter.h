@@ -0,0 +1,111 @@
+#pragma once
+
+#include <Windows.h>
+#include <mmreg.h>
+#include <AudioClient.h>
+#include <atomic>
+#include <memory>
+
+#include <wil\resource.h>
+
+#include "CaptureRing.h"
+
+// What the WAV file holds.
+enum class CaptureFileFormat
+{
+    Pcm,        // The captured samples, unchanged.
+    ImaAdpcm,   // IMA ADPCM, 4 bits per sample. Needs 16-bit PCM input.
+};
+
+// Counters for one capture. The capture callback and the writer thread each update
+// their own counters; read them after CWavWriter::Finish.
+struct CaptureStatistics
+{
+    // Updated by the capture callback
+    UINT64 Packets = 0;
+    UINT64 BytesCaptured = 0;       // Bytes queued for the writer thread
+    UINT64 BytesDropped = 0;        // Bytes lost because the ring was full
+    UINT32 Overruns = 0;            // Packets lost because the ring was full
+    UINT32 Discontinuities = 0;     // Glitches reported by the audio engine
+    size_t RingHighWater = 0;       // Most bytes ever waiting in the ring
+    size_t RingCapacity = 0;
+
+    // Updated by the writer thread
+    UINT64 FileWrites = 0;
+    UINT64 BytesWritten = 0;        // Including the header
+};
+
+//
+//  CWavWriter
+//
+//  Writes captured audio to a WAV file without blocking the capture callback.
+//
+//  DrainCaptureClient copies each packet into a preallocated ring and returns; it
+//  never waits for the disk. A writer thread empties the ring, optionally compresses
+//  the audio, and writes the file in large blocks at block-aligned file offsets (the
+//  header is written as part of the first block).
+//
+class CWavWriter
+{
+public:
+    CWavWriter() = default;
+    ~CWavWriter();
+
+    HRESULT Start(PCWSTR fileName, const WAVEFORMATEX& captureFormat, CaptureFileFormat fileFormat);
+
+    // Called by the capture callback. Returns S_FALSE when the file is full.
+    HRESULT DrainCaptureClient(IAudioCaptureClient* captureClient);
+
+    // Stops the writer thread, writes the rest of the audio and fixes the header.
+    HRESULT Finish();
+
+    const CaptureStatistics& Statistics() const { return m_Statistics; }
+
+private:
+    static const size_t c_cbWriteSize = 64 * 1024;  // Size of each WriteFile
+    static const UINT32 c_RingSeconds = 2;          // How much audio the ring can hold
+    static const DWORD c_WriterTimeout = 100;       // Milliseconds between checks for data
+
+    static DWORD WINAPI WriterThreadProc(LPVOID context);
+    HRESULT DrainRing(bool final);
+
+    void BuildHeader();
+    HRESULT FixHeader();
+    HRESULT WriteAt(DWORD offset, const void* data, DWORD cb);
+
+    HRESULT Append(const BYTE* data, size_t cb);
+    HRESULT FlushStaging();
+
+    void EncodeAdpcmBlock(const short* samples, BYTE* block);
+    BYTE EncodeAdpcmSample(UINT32 channel, int sample);
+
+    WAVEFORMATEX m_CaptureFormat{};
+    CaptureFileFormat m_FileFormat = CaptureFileFormat::Pcm;
+
+    CCaptureRing m_Ring;
+    CaptureStatistics m_Statistics;
+
+    wil::unique_hfile m_hFile;
+    wil::unique_handle m_hWriterThread;
+    wil::unique_event_nothrow m_hDataReady;
+    std::atomic<bool> m_StopWriter{ false };
+    HRESULT m_hrWriter = S_OK;
+
+    // Writer thread state. The file is written from m_Staging.
+    std::unique_ptr<BYTE[]> m_Staging;
+    size_t m_cbStaged = 0;
+    DWORD m_cbHeaderSize = 0;
+    DWORD m_DataSizeOffset = 0;     // File offsets of the fields FixHeader fills in
+    DWORD m_FactOffset = 0;
+    UINT64 m_cbData = 0;
+
+    // IMA ADPCM encoder state
+    WORD m_AdpcmBlockAlign = 0;
+    WORD m_AdpcmSamplesPerBlock = 0;
+    std::unique_ptr<BYTE[]> m_AdpcmInput;       // One block of PCM
+    size_t m_cbAdpcmInput = 0;                  // Bytes of it filled so far
+    std::unique_ptr<BYTE[]> m_AdpcmOutput;      // One compressed block
+    std::unique_ptr<int[]> m_AdpcmPredictor;    // Per channel
+    std::unique_ptr<int[]> m_AdpcmStepIndex;    // Per channel
+    UINT64 m_AdpcmFrames = 0;
+};
@@ -7,17 +7,34 @@
 
 #include "stdafx.h"
 
-const size_t c_bufferSize = sizeof(FILE_NOTIFY_INFORMATION) * 100;
+// Size of each of the two notification buffers. A bulk copy into the sync root
+// produces thousands of notifications in a burst, and if they don't fit the
+// system drops all of them and the whole tree has to be rescanned. Buffers
+// larger than 64KB only work for local volumes, which a sync root always is.
+const size_t c_bufferSize = 512 * 1024;
+
+// A path is handed out once it has been quiet for this long...
+const ULONGLONG c_coalesceWindowMs = 250;
+
+// ...or once it has been waiting this long, so a file that keeps changing is
+// still processed.
+const ULONGLONG c_maxDelayMs = 2000;
 
 // Run of the mill directory watcher to signal when user causes things to
-// happen in the client folder sync root
+// happen in the client folder sync root. Notifications for the same path are
+// coalesced and handed to the callback in batches.
 
 void DirectoryWatcher::Initialize(
     _In_ PCWSTR path,
     _In_ std::function<void(std::list<std::wstring>&)> callback)
 {
     _path = path;
-    _notify.reset(reinterpret_cast<FILE_NOTIFY_INFORMATION*>(new char[c_bufferSize]));
+
+    // ReadDirectoryChangesW needs DWORD aligned buffers.
+    for (auto& buffer : _buffers)
+    {
+        buffer.resize(c_bufferSize / sizeof(DWORD));
+    }
 
     _callback = callback;
 
@@ -32,6 +49,13 @@ void DirectoryWatcher::Initialize(
     {
         throw winrt::hresult_error(HRESULT_FROM_WIN32(GetLastError()));
     }
+
+    _event.attach(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+    if (!_event)
+    {
+        throw winrt::hresult_error(HRESULT_FROM_WIN32(GetLastError()));
+    }
+    _overlapped.hEvent = _event.get();
 }
 
 winrt::Windows::Foundation::IAsyncAction DirectoryWatcher::ReadChangesAsync()
@@ -44,23 +68,20 @@ winrt::Windows::Foundation::IAsyncAction DirectoryWatcher::ReadChangesInternalAs
 {
     co_await winrt::resume_background();
 
+    size_t current = 0;
+    IssueRead(current);
+
     while (true)
     {
-        DWORD returned;
-        winrt::check_bool(ReadDirectoryChangesW(
-            _dir.get(),
-            _notify.get(),
-            c_bufferSize,
-            TRUE,
-            FILE_NOTIFY_CHANGE_ATTRIBUTES,
-            &returned,
-            &_overlapped,
-            nullptr));
-
         DWORD transferred;
-        if (!GetOverlappedResult(_dir.get(), &_overlapped, &transferred, TRUE))
+        if (!GetOverlappedResultEx(_dir.get(), &_overlapped, &transferred, GetWaitTimeout(GetTickCount64()), FALSE))
         {
             DWORD error = GetLastError();
+            if ((error == WAIT_TIMEOUT) || (error == ERROR_IO_INCOMPLETE))
+            {
+                DispatchReady(GetTickCount64(), false);
+                continue;
+            }
             if (error != ERROR_OPERATION_ABORTED)
             {
                 throw winrt::hresult_error(HRESULT_FROM_WIN32(error));
@@ -68,28 +89,182 @@ winrt::Windows::Foundation::IAsyncAction DirectoryWatcher::ReadChangesInternalAs
             break;
         }
 
-        std::list<std::wstring> result;
-        FILE_NOTIFY_INFORMATION* next = _notify.get();
-        while (next != nullptr)
+        // Start listening again into the other buffer right away, so nothing
+        // is lost while this batch is parsed and dispatched.
+        size_t completed = current;
+        current = 1 - current;
+        IssueRead(current);
+
+        auto now = GetTickCount64();
+        if (transferred == 0)
         {
-            std::wstring fullPath(_path);
-            fullPath.append(L"\\");
-            fullPath.append(std::wstring_view(next->FileName, next->FileNameLength / sizeof(wchar_t)));
-            result.push_back(fullPath);
+            // The buffer overflowed and the notifications were dropped. The only
+            // way to catch up is to look at everything.
+            _metrics.Overflows++;
+            wprintf(L"Change notifications overflowed, rescanning %s\n", _path.c_str());
+            Rescan(_path, now);
+            PrintMetrics();
+        }
+        else
+        {
+            AddChanges(completed, now);
+        }
 
-            if (next->NextEntryOffset)
-            {
-                next = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(reinterpret_cast<char*>(next) + next->NextEntryOffset);
-            }
-            else
+        DispatchReady(now, false);
+    }
+
+    // Whatever is still waiting is processed before the watcher goes away.
+    DispatchReady(GetTickCount64(), true);
+    PrintMetrics();
+
+    wprintf(L"watcher exiting\n");
+}
+
+void DirectoryWatcher::IssueRead(_In_ size_t buffer)
+{
+    winrt::check_bool(ReadDirectoryChangesW(
+        _dir.get(),
+        _buffers[buffer].data(),
+        static_cast<DWORD>(_buffers[buffer].size() * sizeof(DWORD)),
+        TRUE,
+        FILE_NOTIFY_CHANGE_ATTRIBUTES,
+        nullptr,
+        &_overlapped,
+        nullptr));
+}
+
+void DirectoryWatcher::AddChanges(_In_ size_t buffer, _In_ ULONGLONG now)
+{
+    FILE_NOTIFY_INFORMATION* next = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(_buffers[buffer].data());
+    while (next != nullptr)
+    {
+        std::wstring fullPath(_path);
+        fullPath.append(L"\\");
+        fullPath.append(std::wstring_view(next->FileName, next->FileNameLength / sizeof(wchar_t)));
+        AddChange(fullPath, now);
+
+        if (next->NextEntryOffset)
+        {
+            next = reinterpret_cast<FILE_NOTIFY_INFORMATION*>(reinterpret_cast<char*>(next) + next->NextEntryOffset);
+        }
+        else
+        {
+            next = nullptr;
+        }
+    }
+}
+
+void DirectoryWatcher::AddChange(_In_ const std::wstring& fullPath, _In_ ULONGLONG now)
+{
+    _metrics.EventsReceived++;
+
+    auto it = _pending.find(fullPath);
+    if (it != _pending.end())
+    {
+        it->second.LastSeen = now;
+        _metrics.EventsCoalesced++;
+    }
+    else
+    {
+        _pending.emplace(fullPath, PendingChange{ now, now });
+    }
+}
+
+void DirectoryWatcher::Rescan(_In_ const std::wstring& folder, _In_ ULONGLONG now)
+{
+    std::wstring pattern(folder);
+    pattern.append(L"\\*");
+
+    WIN32_FIND_DATA findData;
+    HANDLE find = FindFirstFileEx(pattern.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, nullptr, FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE)
+    {
+        return;
+    }
+
+    do
+    {
+        if ((wcscmp(findData.cFileName, L".") == 0) || (wcscmp(findData.cFileName, L"..") == 0))
+        {
+            continue;
+        }
+
+        std::wstring fullPath(folder);
+        fullPath.append(L"\\");
+        fullPath.append(findData.cFileName);
+
+        if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        {
+            Rescan(fullPath, now);
+        }
+        else
+        {
+            _metrics.RescannedPaths++;
+            if (_pending.find(fullPath) == _pending.end())
             {
-                next = nullptr;
+                _pending.emplace(fullPath, PendingChange{ now, now });
             }
         }
-        _callback(result);
     }
+    while (FindNextFile(find, &findData));
 
-    wprintf(L"watcher exiting\n");
+    FindClose(find);
+}
+
+void DirectoryWatcher::DispatchReady(_In_ ULONGLONG now, _In_ bool flushAll)
+{
+    std::list<std::wstring> batch;
+
+    for (auto it = _pending.begin(); it != _pending.end(); )
+    {
+        if (flushAll ||
+            (now - it->second.LastSeen >= c_coalesceWindowMs) ||
+            (now - it->second.FirstSeen >= c_maxDelayMs))
+        {
+            batch.push_back(it->first);
+            it = _pending.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    if (!batch.empty())
+    {
+        _metrics.Batches++;
+        _metrics.PathsDispatched += batch.size();
+        _callback(batch);
+    }
+}
+
+DWORD DirectoryWatcher::GetWaitTimeout(_In_ ULONGLONG now) const
+{
+    if (_pending.empty())
+    {
+        return INFINITE;
+    }
+
+    // Wake up when the first pending path becomes ready.
+    ULONGLONG wait = c_coalesceWindowMs;
+    for (auto& pending : _pending)
+    {
+        ULONGLONG readyAt = min(pending.second.LastSeen + c_coalesceWindowMs, pending.second.FirstSeen + c_maxDelayMs);
+        wait = min(wait, (readyAt > now) ? (readyAt - now) : 0);
+    }
+
+    return static_cast<DWORD>(wait);
+}
+
+void DirectoryWatcher::PrintMetrics() const
+{
+    wprintf(L"Watcher: %llu events, %llu coalesced, %llu paths in %llu batches, %llu overflow rescans (%llu paths)\n",
+        _metrics.EventsReceived,
+        _metrics.EventsCoalesced,
+        _metrics.PathsDispatched,
+        _metrics.Batches,
+        _metrics.Overflows,
+        _metrics.RescannedPaths);
 }
 
 void DirectoryWatcher::Cancel()
@@ -102,4 +277,3 @@ void DirectoryWatcher::Cancel()
         Sleep(10);
     }
 }
-
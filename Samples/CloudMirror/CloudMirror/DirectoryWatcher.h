@@ -10,18 +10,52 @@
 class DirectoryWatcher
 {
 public:
+    struct Metrics
+    {
+        ULONGLONG EventsReceived;
+        ULONGLONG EventsCoalesced;
+        ULONGLONG Batches;
+        ULONGLONG PathsDispatched;
+        ULONGLONG Overflows;
+        ULONGLONG RescannedPaths;
+    };
+
     void Initialize(_In_ PCWSTR path, _In_ std::function<void(std::list<std::wstring>&)> callback);
     winrt::Windows::Foundation::IAsyncAction ReadChangesAsync();
     void Cancel();
+    Metrics GetMetrics() const { return _metrics; }
 
 private:
+    struct PendingChange
+    {
+        ULONGLONG FirstSeen;
+        ULONGLONG LastSeen;
+    };
+
+    struct PathLess
+    {
+        bool operator()(const std::wstring& left, const std::wstring& right) const
+        {
+            return _wcsicmp(left.c_str(), right.c_str()) < 0;
+        }
+    };
+
     winrt::Windows::Foundation::IAsyncAction ReadChangesInternalAsync();
+    void IssueRead(_In_ size_t buffer);
+    void AddChanges(_In_ size_t buffer, _In_ ULONGLONG now);
+    void AddChange(_In_ const std::wstring& fullPath, _In_ ULONGLONG now);
+    void Rescan(_In_ const std::wstring& folder, _In_ ULONGLONG now);
+    void DispatchReady(_In_ ULONGLONG now, _In_ bool flushAll);
+    DWORD GetWaitTimeout(_In_ ULONGLONG now) const;
+    void PrintMetrics() const;
 
     winrt::handle _dir;
+    winrt::handle _event;
     std::wstring _path;
-    std::unique_ptr<FILE_NOTIFY_INFORMATION> _notify;
+    std::vector<DWORD> _buffers[2];
     OVERLAPPED _overlapped{};
     winrt::Windows::Foundation::IAsyncAction _readTask;
     std::function<void(std::list<std::wstring>&)> _callback;
+    std::map<std::wstring, PendingChange, PathLess> _pending;
+    Metrics _metrics{};
 };
-
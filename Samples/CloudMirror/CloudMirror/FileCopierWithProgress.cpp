@@ -20,37 +20,26 @@
 //   You can take a look at the code that shows transfer progress, 
 //   that's kinda interesting.
 //
-//   This code is using the overlapped functions for ReadFileEx,
-//   please see this if you are unfamiliar:
-//
-//      https://docs.microsoft.com/en-us/windows/desktop/api/fileapi/nf-fileapi-readfileex
+//   The reading itself is done by the HydrationEngine, which keeps
+//   several large reads in flight per file and hands each chunk
+//   back here as soon as it arrives.
 //
 //===============================================================
 
-// Since this is a local disk to local-disk copy, it would happen really fast.
-// This is the size of each chunk to be copied due to the overlapped approach.
-// I pulled this number out of a hat.
-#define CHUNKSIZE 4096
-// Arbitrary delay per chunk, again, so you can actually see the progress bar
-// move
-#define CHUNKDELAYMS 250
-
 #define FIELD_SIZE( type, field ) ( sizeof( ( (type*)0 )->field ) )
 #define CF_SIZE_OF_OP_PARAM( field )                                           \
     ( FIELD_OFFSET( CF_OPERATION_PARAMETERS, field ) +                         \
       FIELD_SIZE( CF_OPERATION_PARAMETERS, field ) )
 
-struct READ_COMPLETION_CONTEXT 
+// Per-request state shared by the chunk and done callbacks
+struct TRANSFER_CONTEXT
 {
-    OVERLAPPED Overlapped;
     CF_CALLBACK_INFO CallbackInfo;
-    TCHAR FullPath[MAX_PATH];
-    HANDLE Handle;
-    CHAR PriorityHint;
-    LARGE_INTEGER StartOffset;
-    LARGE_INTEGER RemainingLength;
-    ULONG BufferSize;
-    BYTE Buffer[1];
+    std::wstring FullPath;
+    LARGE_INTEGER RequiredFileOffset;
+    LARGE_INTEGER RequiredLength;
+    volatile LONGLONG BytesTransferred;
+    volatile LONG FailureReported;
 };
 
 // This entire class is static
@@ -120,149 +109,29 @@ void FileCopierWithProgress::TransferData(
     winrt::check_hresult(CfExecute(&opInfo, &opParams));
 }
 
-void WINAPI FileCopierWithProgress::OverlappedCompletionRoutine(
-    _In_ DWORD errorCode,
-    _In_ DWORD numberOfBytesTransfered,
-    _Inout_ LPOVERLAPPED overlapped)
+HydrationEngine& FileCopierWithProgress::Engine()
 {
-    READ_COMPLETION_CONTEXT* readContext =
-        CONTAINING_RECORD(overlapped, READ_COMPLETION_CONTEXT, Overlapped);
-
-    // There is the possibility that this code will need to be retried, see end of loop
-    auto keepProcessing{ false };
-
-    do
-    {
-        // Determine how many bytes have been "downloaded"
-        if (errorCode == 0)
-        {
-            if (!GetOverlappedResult(readContext->Handle, overlapped, &numberOfBytesTransfered, TRUE))
-            {
-                errorCode = GetLastError();
-            }
-        }
-
-        //
-        // Fix up bytes transfered for the failure case
-        //
-        if (errorCode != 0)
-        {
-            wprintf(L"[%04x:%04x] - Async read failed for %s, Status %x\n",
-                GetCurrentProcessId(),
-                GetCurrentThreadId(),
-                readContext->FullPath,
-                NTSTATUS_FROM_WIN32(errorCode));
-
-            numberOfBytesTransfered = (ULONG)(min(readContext->BufferSize, readContext->RemainingLength.QuadPart));
-        }
-
-        assert(numberOfBytesTransfered != 0);
-
-        // Simulate passive progress. Note that the completed portion
-        // should be less than the total or we will end up "completing"
-        // the hydration request prematurely.
-        LONGLONG total = readContext->CallbackInfo.FileSize.QuadPart + readContext->BufferSize;
-        LONGLONG completed = readContext->StartOffset.QuadPart + readContext->BufferSize;
-
-        // Update the transfer progress
-        Utilities::ApplyTransferStateToFile(readContext->FullPath, readContext->CallbackInfo, total,  completed);
-
-        // Slow it down so we can see it happening
-        Sleep(CHUNKDELAYMS);
-
-        // Complete whatever range returned
-        wprintf(L"[%04x:%04x] - Executing download for %s, Status %08x, priority %d, offset %08x`%08x length %08x\n",
-            GetCurrentProcessId(),
-            GetCurrentThreadId(),
-            readContext->FullPath,
-            NTSTATUS_FROM_WIN32(errorCode),
-            readContext->PriorityHint,
-            readContext->StartOffset.HighPart,
-            readContext->StartOffset.LowPart,
-            numberOfBytesTransfered);
-
-        // This helper function tells the Cloud File API about the transfer,
-        // which will copy the data to the local syncroot
-        TransferData(
-            readContext->CallbackInfo.ConnectionKey,
-            readContext->CallbackInfo.TransferKey,
-            errorCode == 0 ? readContext->Buffer : NULL,
-            readContext->StartOffset,
-            Utilities::LongLongToLargeInteger(numberOfBytesTransfered),
-            errorCode);
-
-        // Move the values in the read context to the next chunk
-        readContext->StartOffset.QuadPart += numberOfBytesTransfered;
-        readContext->RemainingLength.QuadPart -= numberOfBytesTransfered;
-
-        // See if there is anything left to read
-        if (readContext->RemainingLength.QuadPart > 0)
-        {
-            // Cap it at chunksize
-            DWORD bytesToRead = (DWORD)(min(readContext->RemainingLength.QuadPart, readContext->BufferSize));
-
-            // And call ReadFileEx to start the next chunk read
-            readContext->Overlapped.Offset = readContext->StartOffset.LowPart;
-            readContext->Overlapped.OffsetHigh = readContext->StartOffset.HighPart;
-
-            wprintf(L"[%04x:%04x] - Downloading data for %s, priority %d, offset %08x`%08x length %08x\n",
-                GetCurrentProcessId(),
-                GetCurrentThreadId(),
-                readContext->FullPath,
-                readContext->PriorityHint,
-                readContext->Overlapped.OffsetHigh,
-                readContext->Overlapped.Offset,
-                bytesToRead);
-
-            // In the event of ReadFileEx succeeding, the while loop
-            // will complete, this chunk is done, and whenever the OS
-            // has completed this new ReadFileEx again, then this entire
-            // method will be called again with the new chunk.
-            // In that case, the handle and buffer need to remain intact
-            if (!ReadFileEx(
-                readContext->Handle,
-                readContext->Buffer,
-                bytesToRead,
-                &readContext->Overlapped,
-                OverlappedCompletionRoutine))
-            {
-                // In the event the ReadFileEx failed,
-                // we want to loop through again to try and
-                // process this again
-                errorCode = GetLastError();
-                numberOfBytesTransfered = 0;
-
-                keepProcessing = true;
-            }
-        }
-        else
-        {
-            // Close the read file handle and free the buffer,
-            // because we are done.
-            CloseHandle(readContext->Handle);
-            HeapFree(GetProcessHeap(), 0, readContext);
-        }
-    }
-    while (keepProcessing);
+    static HydrationEngine engine(HydrationEngine::DefaultSettings());
+    return engine;
 }
 
 // In a nutshell, it copies a file from the "server" to the
-// "client" using the overlapped trickery of Windows to
-// chunkatize the copy. This way you don't have to allocate
-// a huge buffer.
+// "client". The engine reads the file in chunks, several at a
+// time, and each chunk is handed to the Cloud File API as soon
+// as it has been read. This way you don't have to allocate
+// a huge buffer, and the disk is never idle while a chunk is
+// being transferred.
 void FileCopierWithProgress::CopyFromServerToClientWorker(
     _In_ CONST CF_CALLBACK_INFO* callbackInfo,
     _In_opt_ CONST CF_PROCESS_INFO* processInfo,
     _In_ LARGE_INTEGER requiredFileOffset,
     _In_ LARGE_INTEGER requiredLength,
-    _In_ LARGE_INTEGER /*optionalFileOffset*/,
-    _In_ LARGE_INTEGER /*optionalLength*/,
+    _In_ LARGE_INTEGER optionalFileOffset,
+    _In_ LARGE_INTEGER optionalLength,
     _In_ CF_CALLBACK_FETCH_DATA_FLAGS /*fetchFlags*/,
     _In_ UCHAR priorityHint,
     _In_ LPCWSTR serverFolder)
 {
-    HANDLE serverFileHandle;
-
     std::wstring fullServerPath(serverFolder);
     fullServerPath.append(L"\\");
     fullServerPath.append(reinterpret_cast<wchar_t const*>(callbackInfo->FileIdentity));
@@ -270,9 +139,6 @@ void FileCopierWithProgress::CopyFromServerToClientWorker(
     std::wstring fullClientPath(callbackInfo->VolumeDosName);
     fullClientPath.append(callbackInfo->NormalizedPath);
 
-    READ_COMPLETION_CONTEXT* readCompletionContext;
-    DWORD chunkBufferSize;
-
     wprintf(L"[%04x:%04x] - Received data request from %s for %s%s, priority %d, offset %08x`%08x length %08x`%08x\n",
         GetCurrentProcessId(),
         GetCurrentThreadId(),
@@ -285,101 +151,117 @@ void FileCopierWithProgress::CopyFromServerToClientWorker(
         requiredLength.HighPart,
         requiredLength.LowPart);
 
-    serverFileHandle = 
-        CreateFile(
-            fullServerPath.c_str(),
-            GENERIC_READ,
-            FILE_SHARE_READ | FILE_SHARE_DELETE,
-            NULL,
-            OPEN_EXISTING,
-            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED,
-            NULL);
-
-    if (serverFileHandle == INVALID_HANDLE_VALUE) 
+    // The platform suggests an optional range around the required one, typically
+    // read-ahead for a sequential reader. Fetching it now saves another round trip
+    // later, as long as it simply extends the required range.
+    LARGE_INTEGER fetchLength = requiredLength;
+    LONGLONG requiredEnd = requiredFileOffset.QuadPart + requiredLength.QuadPart;
+    LONGLONG optionalEnd = optionalFileOffset.QuadPart + optionalLength.QuadPart;
+    if ((optionalLength.QuadPart > 0) &&
+        (optionalFileOffset.QuadPart <= requiredEnd) &&
+        (optionalFileOffset.QuadPart >= requiredFileOffset.QuadPart) &&
+        (optionalEnd > requiredEnd))
     {
-        HRESULT hr = NTSTATUS_FROM_WIN32(GetLastError());
-
-        wprintf(L"[%04x:%04x] - Failed to open %s for read, hr %x\n",
-            GetCurrentProcessId(),
-            GetCurrentThreadId(),
-            fullServerPath.c_str(),
-            hr);
-
-        winrt::check_hresult(hr);
+        fetchLength.QuadPart = optionalEnd - requiredFileOffset.QuadPart;
     }
 
-    // Allocate the buffer used in the overlapped read.
-    chunkBufferSize = (ULONG)min(requiredLength.QuadPart, CHUNKSIZE);
-
-    readCompletionContext = (READ_COMPLETION_CONTEXT*)
-        HeapAlloc(
-            GetProcessHeap(),
-            0,
-            chunkBufferSize + FIELD_OFFSET(READ_COMPLETION_CONTEXT, Buffer));
-
-    if (readCompletionContext == NULL) 
+    // Only the keys and the file size of the callback info are used after the
+    // callback returns; its strings belong to the platform.
+    auto context = std::make_shared<TRANSFER_CONTEXT>();
+    context->CallbackInfo = *callbackInfo;
+    context->FullPath = fullClientPath;
+    context->RequiredFileOffset = requiredFileOffset;
+    context->RequiredLength = requiredLength;
+    context->BytesTransferred = 0;
+    context->FailureReported = 0;
+
+    auto onChunk = [context](LONGLONG offset, ULONG length, const BYTE* data, NTSTATUS status) -> NTSTATUS
     {
-        HRESULT hr = E_OUTOFMEMORY;
-
-        wprintf(L"[%04x:%04x] - Failed to allocate read buffer for %s, hr %x\n",
-            GetCurrentProcessId(),
-            GetCurrentThreadId(),
-            fullServerPath.c_str(),
-            hr);
-
-        CloseHandle(serverFileHandle);
-        winrt::check_hresult(hr);
-    }
+        try
+        {
+            // Complete whatever range returned
+            wprintf(L"[%04x:%04x] - Executing download for %s, Status %08x, offset %08x`%08x length %08x\n",
+                GetCurrentProcessId(),
+                GetCurrentThreadId(),
+                context->FullPath.c_str(),
+                status,
+                (ULONG)(offset >> 32),
+                (ULONG)offset,
+                length);
 
-    // Tell the read completion context where to copy the chunk(s)
-    wcsncpy_s(
-        readCompletionContext->FullPath,
-        fullClientPath.data(),
-        wcslen(fullClientPath.data()));
+            if (status != STATUS_SUCCESS)
+            {
+                InterlockedExchange(&context->FailureReported, 1);
+            }
 
-    // Set up the remainder of the overlapped stuff
-    readCompletionContext->CallbackInfo = *callbackInfo;
-    readCompletionContext->Handle = serverFileHandle;
-    readCompletionContext->PriorityHint = priorityHint;
-    readCompletionContext->Overlapped.Offset = requiredFileOffset.LowPart;
-    readCompletionContext->Overlapped.OffsetHigh = requiredFileOffset.HighPart;
-    readCompletionContext->StartOffset = requiredFileOffset;
-    readCompletionContext->RemainingLength = requiredLength;
-    readCompletionContext->BufferSize = chunkBufferSize;
+            // This helper function tells the Cloud File API about the transfer,
+            // which will copy the data to the local syncroot
+            TransferData(
+                context->CallbackInfo.ConnectionKey,
+                context->CallbackInfo.TransferKey,
+                data,
+                Utilities::LongLongToLargeInteger(offset),
+                Utilities::LongLongToLargeInteger(length),
+                status);
+
+            // Report progress. Note that the completed portion should be less
+            // than the total or we will end up "completing" the hydration
+            // request prematurely.
+            LONGLONG transferred = InterlockedAdd64(&context->BytesTransferred, length);
+            LONGLONG total = context->CallbackInfo.FileSize.QuadPart + 1;
+            LONGLONG completed = min(context->RequiredFileOffset.QuadPart + transferred, total - 1);
+
+            Utilities::ApplyTransferStateToFile(context->FullPath.c_str(), context->CallbackInfo, total, completed);
+        }
+        catch (...)
+        {
+            // The transfer was most likely canceled. Stop reading.
+            return STATUS_UNSUCCESSFUL;
+        }
 
-    wprintf(L"[%04x:%04x] - Downloading data for %s, priority %d, offset %08x`%08x length %08x\n",
-        GetCurrentProcessId(),
-        GetCurrentThreadId(),
-        readCompletionContext->FullPath,
-        priorityHint,
-        requiredFileOffset.HighPart,
-        requiredFileOffset.LowPart,
-        chunkBufferSize);
+        return STATUS_SUCCESS;
+    };
 
-    // Initiate the read for the first chunk. When this async operation
-    // completes (failure or success), it will call the OverlappedCompletionRoutine
-    // above with that chunk. That OverlappedCompletionRoutine is responsible for
-    // subsequent ReadFileEx calls to read subsequent chunks. This is only for the
-    // first one
-    if (!ReadFileEx(
-        serverFileHandle,
-        readCompletionContext->Buffer,
-        chunkBufferSize,
-        &readCompletionContext->Overlapped,
-        OverlappedCompletionRoutine)) 
+    auto onDone = [context](NTSTATUS status)
     {
-        HRESULT hr = NTSTATUS_FROM_WIN32(GetLastError());
-        wprintf(L"[%04x:%04x] - Failed to perform async read for %s, Status %x\n",
+        wprintf(L"[%04x:%04x] - Download for %s done, Status %08x, %lld bytes\n",
             GetCurrentProcessId(),
             GetCurrentThreadId(),
-            fullServerPath.c_str(),
-            hr);
-
-        CloseHandle(serverFileHandle);
-        HeapFree(GetProcessHeap(), 0, readCompletionContext);
+            context->FullPath.c_str(),
+            status,
+            context->BytesTransferred);
+
+        // If the request stopped without a failed chunk having been passed on (for
+        // example because a read buffer could not be allocated), fail the required
+        // range so the platform does not wait for data that will never come.
+        if ((status != STATUS_SUCCESS) &&
+            (status != STATUS_CANCELLED) &&
+            (InterlockedExchange(&context->FailureReported, 1) == 0))
+        {
+            try
+            {
+                TransferData(
+                    context->CallbackInfo.ConnectionKey,
+                    context->CallbackInfo.TransferKey,
+                    NULL,
+                    context->RequiredFileOffset,
+                    context->RequiredLength,
+                    status);
+            }
+            catch (...)
+            {
+            }
+        }
+    };
 
-        winrt::check_hresult(hr);
-    }
+    Engine().Hydrate(
+        fullServerPath.c_str(),
+        requiredFileOffset.QuadPart,
+        fetchLength.QuadPart,
+        priorityHint,
+        callbackInfo->TransferKey.QuadPart,
+        onChunk,
+        onDone);
 }
 
 void FileCopierWithProgress::CancelCopyFromServerToClientWorker(
@@ -388,7 +270,6 @@ void FileCopierWithProgress::CancelCopyFromServerToClientWorker(
     _In_ LARGE_INTEGER liCancelLength,
     _In_ CF_CALLBACK_CANCEL_FLAGS /*dwCancelFlags*/)
 {
-    // Yeah, a whole lotta noting happens here, because sample.
     wprintf(L"[%04x:%04x] - Cancelling read for %s%s, offset %08x`%08x length %08x`%08x\n",
         GetCurrentProcessId(),
         GetCurrentThreadId(),
@@ -398,5 +279,9 @@ void FileCopierWithProgress::CancelCopyFromServerToClientWorker(
         liCancelFileOffset.LowPart,
         liCancelLength.HighPart,
         liCancelLength.LowPart);
+
+    // Stop reading for the canceled request. The cancel may cover only part
+    // of the fetch, but a partial fetch is of no use to anyone.
+    Engine().Cancel(lpCallbackInfo->TransferKey.QuadPart);
 }
 
@@ -37,10 +37,7 @@ private:
         _In_ LARGE_INTEGER cancelLength,
         _In_ CF_CALLBACK_CANCEL_FLAGS cancelFlags);
 
-    static void WINAPI OverlappedCompletionRoutine(
-        _In_ DWORD errorCode,
-        _In_ DWORD numberOfBytesTransfered,
-        _Inout_ LPOVERLAPPED overlapped);
+    static HydrationEngine& Engine();
 
     static void TransferData(
         _In_ CF_CONNECTION_KEY connectionKey,
@@ -0,0 +1,221 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+
+#include "stdafx.h"
+
+//===============================================================
+// HydrationBenchmark
+//
+//   Measures how fast the HydrationEngine can pull a folder of
+//   mixed file sizes off the "server". Run it with
+//
+//      CloudMirror.exe -benchmark [server folder]
+//
+//   It doesn't need a sync root or package identity: every file
+//   is hydrated in full at the same time, as if a user had
+//   opened them all at once, and the chunks are counted instead
+//   of being handed to the Cloud File API. That isolates the
+//   read pipeline from the placeholder and shell updates.
+//
+//===============================================================
+
+struct BENCHMARK_FILE_SET
+{
+    ULONG Count;
+    ULONG Size;
+};
+
+// Lots of small files, some medium ones, and a few big ones.
+static const BENCHMARK_FILE_SET c_fileSets[] =
+{
+    { 512, 16 * 1024 },
+    { 64, 1024 * 1024 },
+    { 8, 32 * 1024 * 1024 },
+};
+
+int HydrationBenchmark::Run(_In_opt_ LPCWSTR serverFolder)
+{
+    std::wstring folder;
+
+    if (serverFolder != nullptr)
+    {
+        folder = serverFolder;
+    }
+    else
+    {
+        wchar_t tempPath[MAX_PATH];
+        if (GetTempPath(ARRAYSIZE(tempPath), tempPath) == 0)
+        {
+            wprintf(L"Could not get the temp folder, error %d\n", GetLastError());
+            return 1;
+        }
+
+        folder = tempPath;
+        folder.append(L"CloudMirrorBenchmark");
+    }
+
+    try
+    {
+        std::vector<std::wstring> files;
+        CreateServerFiles(folder, files);
+
+        // The 4KB, one-read-at-a-time settings match the copier this sample used to have.
+        // Neither traces its reads, so the timings do not include console output.
+        HydrationEngine::Settings serial{ 4096, 4096, 4096, 1, MAXLONG, 50, false };
+        HydrationEngine::Settings engine = HydrationEngine::DefaultSettings();
+        engine.TraceReads = false;
+
+        // Warm up the file cache so that every configuration reads the same way.
+        HydrateAll(L"warm-up", engine, files, false);
+
+        HydrateAll(L"4KB chunks, 1 read per file", serial, files, true);
+        HydrateAll(L"adaptive chunks, 4 reads per file, 16 in total", engine, files, true);
+    }
+    catch (...)
+    {
+        wprintf(L"Benchmark failed, hr %08x\n", static_cast<HRESULT>(winrt::to_hresult()));
+        return 1;
+    }
+
+    return 0;
+}
+
+// Fills the server folder with the file sets above, reusing files from a previous run.
+void HydrationBenchmark::CreateServerFiles(_In_ const std::wstring& serverFolder, _Out_ std::vector<std::wstring>& files)
+{
+    if (!CreateDirectory(serverFolder.c_str(), nullptr) && (GetLastError() != ERROR_ALREADY_EXISTS))
+    {
+        winrt::throw_last_error();
+    }
+
+    std::vector<BYTE> data(1024 * 1024);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = (BYTE)(i * 7 + (i >> 12));
+    }
+
+    files.clear();
+
+    for (auto& fileSet : c_fileSets)
+    {
+        for (ULONG i = 0; i < fileSet.Count; i++)
+        {
+            wchar_t name[64];
+            winrt::check_hresult(StringCchPrintf(name, ARRAYSIZE(name), L"\\%u_%u.bin", fileSet.Size, i));
+
+            std::wstring path(serverFolder);
+            path.append(name);
+            files.push_back(path);
+
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            if (GetFileAttributesEx(path.c_str(), GetFileExInfoStandard, &attributes) &&
+                (attributes.nFileSizeHigh == 0) &&
+                (attributes.nFileSizeLow == fileSet.Size))
+            {
+                continue;
+            }
+
+            winrt::file_handle file(
+                CreateFile(path.c_str(), GENERIC_WRITE, 0, nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr));
+            if (!file)
+            {
+                winrt::throw_last_error();
+            }
+
+            for (ULONG written = 0; written < fileSet.Size; )
+            {
+                DWORD toWrite = min(fileSet.Size - written, (ULONG)data.size());
+                DWORD bytesWritten;
+                winrt::check_bool(WriteFile(file.get(), data.data(), toWrite, &bytesWritten, nullptr));
+                written += bytesWritten;
+            }
+        }
+    }
+}
+
+void HydrationBenchmark::HydrateAll(
+    _In_ LPCWSTR name,
+    _In_ const HydrationEngine::Settings& settings,
+    _In_ const std::vector<std::wstring>& files,
+    _In_ bool report)
+{
+    volatile LONGLONG bytes = 0;
+    volatile LONG remaining = (LONG)files.size();
+    volatile LONG failures = 0;
+    winrt::handle done(CreateEvent(nullptr, TRUE, FALSE, nullptr));
+    winrt::check_bool(static_cast<bool>(done));
+
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER stop;
+    QueryPerformanceFrequency(&frequency);
+
+    HydrationEngine::Stats stats;
+    {
+        HydrationEngine engine(settings);
+
+        QueryPerformanceCounter(&start);
+
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            WIN32_FILE_ATTRIBUTE_DATA attributes;
+            winrt::check_bool(GetFileAttributesEx(files[i].c_str(), GetFileExInfoStandard, &attributes));
+            LONGLONG size = ((LONGLONG)attributes.nFileSizeHigh << 32) | attributes.nFileSizeLow;
+
+            engine.Hydrate(
+                files[i].c_str(),
+                0,
+                size,
+                0,
+                (LONGLONG)i,
+                [&bytes](LONGLONG, ULONG length, const BYTE* data, NTSTATUS status) -> NTSTATUS
+                {
+                    if (data != nullptr)
+                    {
+                        InterlockedAdd64(&bytes, length);
+                    }
+                    return status;
+                },
+                [&remaining, &failures, &done](NTSTATUS status)
+                {
+                    if (status != STATUS_SUCCESS)
+                    {
+                        InterlockedIncrement(&failures);
+                    }
+                    if (InterlockedDecrement(&remaining) == 0)
+                    {
+                        SetEvent(done.get());
+                    }
+                });
+        }
+
+        WaitForSingleObject(done.get(), INFINITE);
+        QueryPerformanceCounter(&stop);
+
+        stats = engine.GetStats();
+    }
+
+    if (report)
+    {
+        double seconds = (double)(stop.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+        wprintf(L"%s: %u files, %.1f MB in %.2f s, %.1f MB/s, %.0f files/s\n",
+            name,
+            (ULONG)files.size(),
+            bytes / (1024.0 * 1024.0),
+            seconds,
+            bytes / (1024.0 * 1024.0) / seconds,
+            files.size() / seconds);
+
+        wprintf(L"    %lld reads, peak %d in flight, %lld deferred by the global limit, final chunk size %u KB, %d failures\n",
+            stats.Reads,
+            stats.PeakReads,
+            stats.Deferrals,
+            stats.ChunkSize / 1024,
+            failures);
+    }
+}
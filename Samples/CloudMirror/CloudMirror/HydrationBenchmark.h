@@ -0,0 +1,23 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+
+#pragma once
+
+class HydrationBenchmark
+{
+public:
+    // Returns the process exit code.
+    static int Run(_In_opt_ LPCWSTR serverFolder);
+
+private:
+    static void CreateServerFiles(_In_ const std::wstring& serverFolder, _Out_ std::vector<std::wstring>& files);
+    static void HydrateAll(
+        _In_ LPCWSTR name,
+        _In_ const HydrationEngine::Settings& settings,
+        _In_ const std::vector<std::wstring>& files,
+        _In_ bool report);
+};
@@ -0,0 +1,491 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+
+#include "stdafx.h"
+
+//===============================================================
+// HydrationEngine
+//
+//   Reads ranges of "server" files on behalf of fetch data
+//   callbacks. Each request is split into chunks, and several
+//   chunks of several files are read at the same time with
+//   thread pool I/O. Chunks are handed to the caller as soon as
+//   they arrive, so the Cloud Files API can copy one chunk into
+//   the placeholder while the next ones are still being read.
+//
+//   The chunk size adapts to how fast the server answers. A
+//   global limit on reads in flight keeps a burst of hydrations
+//   (say, opening a folder of photos) from flooding the server.
+//   Requests that hit the limit wait in a queue and are served
+//   by priority as reads complete.
+//
+// Fakery Factor:
+//
+//   The scheduling is real. The "server" is a local folder, so
+//   you would replace CreateFile/ReadFile with requests to your
+//   service.
+//
+//===============================================================
+
+#define HYDRATION_ALIGNMENT 4096
+
+struct HYDRATION_REQUEST
+{
+    HANDLE Handle;
+    PTP_IO Io;
+    std::wstring ServerPath;
+    LONGLONG CancelKey;
+    UCHAR Priority;
+    HydrationEngine::ChunkCallback OnChunk;
+    HydrationEngine::DoneCallback OnDone;
+
+    // Scheduling state, protected by the engine lock.
+    LONGLONG NextOffset;
+    LONGLONG EndOffset;
+    LONG Outstanding;
+    LONG References;
+    bool Waiting;
+    bool Stopped;
+    NTSTATUS Status;
+};
+
+struct HYDRATION_READ
+{
+    OVERLAPPED Overlapped;
+    HydrationEngine* Engine;
+    HYDRATION_REQUEST* Request;
+    LONGLONG Offset;
+    ULONG Length;
+    LARGE_INTEGER IssueTime;
+    BYTE Buffer[1];
+};
+
+HydrationEngine::Settings HydrationEngine::DefaultSettings()
+{
+    Settings settings;
+
+    settings.MinChunkSize = 64 * 1024;
+    settings.MaxChunkSize = 4 * 1024 * 1024;
+    settings.InitialChunkSize = 256 * 1024;
+    settings.MaxReadsPerFile = 4;
+    settings.MaxGlobalReads = 16;
+    settings.TargetReadLatencyMs = 50;
+    settings.TraceReads = true;
+
+    return settings;
+}
+
+HydrationEngine::HydrationEngine(_In_ const Settings& settings) :
+    _settings(settings)
+{
+    _chunkSize = settings.InitialChunkSize;
+    QueryPerformanceFrequency(&_frequency);
+    InitializeSRWLock(&_lock);
+    InitializeConditionVariable(&_idle);
+}
+
+HydrationEngine::~HydrationEngine()
+{
+    AcquireSRWLockExclusive(&_lock);
+
+    while (!_requests.empty())
+    {
+        SleepConditionVariableSRW(&_idle, &_lock, INFINITE, 0);
+    }
+
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void HydrationEngine::Hydrate(
+    _In_ LPCWSTR serverPath,
+    _In_ LONGLONG offset,
+    _In_ LONGLONG length,
+    _In_ UCHAR priority,
+    _In_ LONGLONG cancelKey,
+    _In_ ChunkCallback onChunk,
+    _In_ DoneCallback onDone)
+{
+    winrt::file_handle serverFileHandle(
+        CreateFile(
+            serverPath,
+            GENERIC_READ,
+            FILE_SHARE_READ | FILE_SHARE_DELETE,
+            NULL,
+            OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+            NULL));
+
+    if (!serverFileHandle)
+    {
+        HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+
+        wprintf(L"[%04x:%04x] - Failed to open %s for read, hr %x\n",
+            GetCurrentProcessId(),
+            GetCurrentThreadId(),
+            serverPath,
+            hr);
+
+        winrt::check_hresult(hr);
+    }
+
+    auto request = std::make_unique<HYDRATION_REQUEST>();
+
+    request->Io = CreateThreadpoolIo(serverFileHandle.get(), IoCompletionCallback, this, nullptr);
+    if (request->Io == nullptr)
+    {
+        winrt::throw_last_error();
+    }
+
+    request->Handle = serverFileHandle.detach();
+    request->ServerPath = serverPath;
+    request->CancelKey = cancelKey;
+    request->Priority = priority;
+    request->OnChunk = std::move(onChunk);
+    request->OnDone = std::move(onDone);
+    request->NextOffset = offset;
+    request->EndOffset = offset + length;
+    request->Outstanding = 0;
+    request->Waiting = false;
+    request->Stopped = false;
+    request->Status = STATUS_SUCCESS;
+
+    // This function holds one reference until it is done scheduling, so that
+    // the request cannot finish underneath it.
+    request->References = 1;
+
+    std::vector<HYDRATION_READ*> reads;
+    std::vector<HYDRATION_REQUEST*> finished;
+
+    AcquireSRWLockExclusive(&_lock);
+    _requests.push_back(request.get());
+    ScheduleLocked(request.get(), reads);
+    ReleaseSRWLockExclusive(&_lock);
+
+    HYDRATION_REQUEST* started = request.release();
+
+    StartReads(reads);
+
+    AcquireSRWLockExclusive(&_lock);
+    ReleaseLocked(started, finished);
+    ReleaseSRWLockExclusive(&_lock);
+
+    FinishRequests(finished);
+}
+
+void HydrationEngine::Cancel(_In_ LONGLONG cancelKey)
+{
+    std::vector<HYDRATION_REQUEST*> finished;
+
+    AcquireSRWLockExclusive(&_lock);
+
+    for (auto request : _requests)
+    {
+        // Requests without references are already being torn down.
+        if ((request->CancelKey == cancelKey) && !request->Stopped && (request->References != 0))
+        {
+            request->Stopped = true;
+            request->Status = STATUS_CANCELLED;
+
+            // Abort the reads in flight. They complete with ERROR_OPERATION_ABORTED
+            // and release their references as usual.
+            CancelIoEx(request->Handle, nullptr);
+
+            if (request->Waiting)
+            {
+                _waiting.remove(request);
+                request->Waiting = false;
+                ReleaseLocked(request, finished);
+            }
+        }
+    }
+
+    ReleaseSRWLockExclusive(&_lock);
+
+    FinishRequests(finished);
+}
+
+HydrationEngine::Stats HydrationEngine::GetStats()
+{
+    Stats stats;
+
+    AcquireSRWLockShared(&_lock);
+    stats.BytesRead = _bytesRead;
+    stats.Reads = _reads;
+    stats.Deferrals = _deferrals;
+    stats.PeakReads = _peakReads;
+    stats.ChunkSize = _chunkSize;
+    ReleaseSRWLockShared(&_lock);
+
+    return stats;
+}
+
+// Carves as many chunks off the request as the per-file and global limits allow.
+// If the global limit is what stopped it, the request goes to the waiting list.
+void HydrationEngine::ScheduleLocked(_In_ HYDRATION_REQUEST* request, _Inout_ std::vector<HYDRATION_READ*>& reads)
+{
+    while (!request->Stopped &&
+           (request->NextOffset < request->EndOffset) &&
+           ((ULONG)request->Outstanding < _settings.MaxReadsPerFile))
+    {
+        if ((ULONG)_activeReads >= _settings.MaxGlobalReads)
+        {
+            if (!request->Waiting)
+            {
+                request->Waiting = true;
+                request->References++;
+                _waiting.push_back(request);
+                _deferrals++;
+            }
+            break;
+        }
+
+        // Split what is left so that a medium sized file still gets several reads in
+        // flight, but never go below the minimum chunk size.
+        LONGLONG remaining = request->EndOffset - request->NextOffset;
+        LONGLONG share = remaining / _settings.MaxReadsPerFile;
+        share = (share + HYDRATION_ALIGNMENT - 1) & ~(LONGLONG)(HYDRATION_ALIGNMENT - 1);
+
+        LONGLONG length = min((LONGLONG)_chunkSize, max(share, (LONGLONG)_settings.MinChunkSize));
+        length = min(length, remaining);
+
+        HYDRATION_READ* read = (HYDRATION_READ*)
+            HeapAlloc(
+                GetProcessHeap(),
+                0,
+                (SIZE_T)length + FIELD_OFFSET(HYDRATION_READ, Buffer));
+
+        if (read == NULL)
+        {
+            // Fail the request rather than wait for memory that may never come.
+            if (request->Outstanding == 0)
+            {
+                request->Stopped = true;
+                request->Status = STATUS_NO_MEMORY;
+            }
+            break;
+        }
+
+        ZeroMemory(&read->Overlapped, sizeof(read->Overlapped));
+        read->Overlapped.Offset = (DWORD)request->NextOffset;
+        read->Overlapped.OffsetHigh = (DWORD)(request->NextOffset >> 32);
+        read->Engine = this;
+        read->Request = request;
+        read->Offset = request->NextOffset;
+        read->Length = (ULONG)length;
+
+        request->NextOffset += length;
+        request->Outstanding++;
+        request->References++;
+
+        _activeReads++;
+        _reads++;
+        _peakReads = max(_peakReads, _activeReads);
+
+        reads.push_back(read);
+    }
+}
+
+// Hands free read slots to the waiting requests, highest priority first.
+void HydrationEngine::PumpWaitingLocked(_Inout_ std::vector<HYDRATION_READ*>& reads, _Inout_ std::vector<HYDRATION_REQUEST*>& finished)
+{
+    while (((ULONG)_activeReads < _settings.MaxGlobalReads) && !_waiting.empty())
+    {
+        auto next = _waiting.begin();
+        for (auto it = _waiting.begin(); it != _waiting.end(); it++)
+        {
+            if ((*it)->Priority > (*next)->Priority)
+            {
+                next = it;
+            }
+        }
+
+        HYDRATION_REQUEST* request = *next;
+        _waiting.erase(next);
+        request->Waiting = false;
+
+        // Schedule before dropping the waiting list's reference, which may be the last one.
+        ScheduleLocked(request, reads);
+        ReleaseLocked(request, finished);
+    }
+}
+
+void HydrationEngine::ReleaseLocked(_In_ HYDRATION_REQUEST* request, _Inout_ std::vector<HYDRATION_REQUEST*>& finished)
+{
+    if (--request->References == 0)
+    {
+        finished.push_back(request);
+    }
+}
+
+void HydrationEngine::AdaptChunkSizeLocked(_In_ ULONG length, _In_ LONGLONG latencyMs)
+{
+    // Only full sized chunks say something about the current chunk size; the tail
+    // of a file is usually shorter.
+    if (length < _chunkSize)
+    {
+        return;
+    }
+
+    if ((latencyMs * 2 < _settings.TargetReadLatencyMs) && (_chunkSize < _settings.MaxChunkSize))
+    {
+        _chunkSize = min(_chunkSize * 2, _settings.MaxChunkSize);
+    }
+    else if ((latencyMs > (LONGLONG)_settings.TargetReadLatencyMs * 2) && (_chunkSize > _settings.MinChunkSize))
+    {
+        _chunkSize = max(_chunkSize / 2, _settings.MinChunkSize);
+    }
+}
+
+void HydrationEngine::StartReads(_In_ std::vector<HYDRATION_READ*>& reads)
+{
+    for (auto read : reads)
+    {
+        if (_settings.TraceReads)
+        {
+            wprintf(L"[%04x:%04x] - Downloading data for %s, priority %d, offset %08x`%08x length %08x\n",
+                GetCurrentProcessId(),
+                GetCurrentThreadId(),
+                read->Request->ServerPath.c_str(),
+                read->Request->Priority,
+                read->Overlapped.OffsetHigh,
+                read->Overlapped.Offset,
+                read->Length);
+        }
+
+        QueryPerformanceCounter(&read->IssueTime);
+
+        // Every read, even one that completes right away, is reported through the
+        // completion callback unless ReadFile fails outright.
+        StartThreadpoolIo(read->Request->Io);
+
+        if (!ReadFile(read->Request->Handle, read->Buffer, read->Length, nullptr, &read->Overlapped))
+        {
+            DWORD errorCode = GetLastError();
+            if (errorCode != ERROR_IO_PENDING)
+            {
+                CancelThreadpoolIo(read->Request->Io);
+                CompleteRead(read, errorCode, 0);
+            }
+        }
+    }
+}
+
+void CALLBACK HydrationEngine::IoCompletionCallback(
+    _Inout_ PTP_CALLBACK_INSTANCE /*instance*/,
+    _Inout_opt_ PVOID context,
+    _Inout_opt_ PVOID overlapped,
+    _In_ ULONG ioResult,
+    _In_ ULONG_PTR numberOfBytesTransferred,
+    _Inout_ PTP_IO /*io*/)
+{
+    HydrationEngine* engine = reinterpret_cast<HydrationEngine*>(context);
+    HYDRATION_READ* read = CONTAINING_RECORD(overlapped, HYDRATION_READ, Overlapped);
+
+    engine->CompleteRead(read, ioResult, (ULONG)numberOfBytesTransferred);
+}
+
+void HydrationEngine::CompleteRead(_In_ HYDRATION_READ* read, _In_ ULONG errorCode, _In_ ULONG bytesRead)
+{
+    HYDRATION_REQUEST* request = read->Request;
+
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    LONGLONG latencyMs = (now.QuadPart - read->IssueTime.QuadPart) * 1000 / _frequency.QuadPart;
+
+    // A short read means the server file shrank since the placeholder was created.
+    NTSTATUS status = STATUS_SUCCESS;
+    if (errorCode != ERROR_SUCCESS)
+    {
+        status = NTSTATUS_FROM_WIN32(errorCode);
+    }
+    else if (bytesRead != read->Length)
+    {
+        status = STATUS_END_OF_FILE;
+    }
+
+    if (status != STATUS_SUCCESS)
+    {
+        wprintf(L"[%04x:%04x] - Async read failed for %s, Status %x\n",
+            GetCurrentProcessId(),
+            GetCurrentThreadId(),
+            request->ServerPath.c_str(),
+            status);
+    }
+
+    // Once a request has stopped, chunks that were still in flight are dropped.
+    // Stopped is only ever set, so a stale read here at worst reports one chunk
+    // that a concurrent Cancel was about to drop.
+    if (!request->Stopped)
+    {
+        NTSTATUS chunkStatus = request->OnChunk(
+            read->Offset,
+            read->Length,
+            (status == STATUS_SUCCESS) ? read->Buffer : nullptr,
+            status);
+
+        if (status == STATUS_SUCCESS)
+        {
+            status = chunkStatus;
+        }
+    }
+
+    std::vector<HYDRATION_READ*> reads;
+    std::vector<HYDRATION_REQUEST*> finished;
+
+    AcquireSRWLockExclusive(&_lock);
+
+    _activeReads--;
+    request->Outstanding--;
+
+    if (status == STATUS_SUCCESS)
+    {
+        _bytesRead += bytesRead;
+        AdaptChunkSizeLocked(read->Length, latencyMs);
+    }
+    else if (!request->Stopped)
+    {
+        request->Stopped = true;
+        request->Status = status;
+    }
+
+    // Let the waiting requests go first, then top this one up again.
+    PumpWaitingLocked(reads, finished);
+    ScheduleLocked(request, reads);
+    ReleaseLocked(request, finished);
+
+    ReleaseSRWLockExclusive(&_lock);
+
+    HeapFree(GetProcessHeap(), 0, read);
+
+    StartReads(reads);
+    FinishRequests(finished);
+}
+
+void HydrationEngine::FinishRequests(_In_ std::vector<HYDRATION_REQUEST*>& finished)
+{
+    for (auto request : finished)
+    {
+        request->OnDone(request->Status);
+
+        // Safe from within the request's own completion callback; the thread pool
+        // releases the I/O object once the callback returns.
+        CloseHandle(request->Handle);
+        CloseThreadpoolIo(request->Io);
+
+        // The request stays on the list until here so that the destructor cannot
+        // return while a request is still being torn down.
+        AcquireSRWLockExclusive(&_lock);
+        _requests.remove(request);
+        if (_requests.empty())
+        {
+            WakeAllConditionVariable(&_idle);
+        }
+        ReleaseSRWLockExclusive(&_lock);
+
+        delete request;
+    }
+}
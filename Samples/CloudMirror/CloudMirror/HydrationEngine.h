@@ -0,0 +1,115 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+
+#pragma once
+
+struct HYDRATION_REQUEST;
+struct HYDRATION_READ;
+
+class HydrationEngine
+{
+public:
+    struct Settings
+    {
+        // Bounds and starting point of the adaptive chunk size. All three must be
+        // multiples of 4KB, because the Cloud Files API only accepts transfers that
+        // start and end on 4KB boundaries (except at the end of the file).
+        ULONG MinChunkSize;
+        ULONG MaxChunkSize;
+        ULONG InitialChunkSize;
+
+        // How many reads one file may have in flight.
+        ULONG MaxReadsPerFile;
+
+        // How many reads all files together may have in flight.
+        ULONG MaxGlobalReads;
+
+        // The chunk size grows while reads finish well within this time and shrinks
+        // when they take much longer.
+        ULONG TargetReadLatencyMs;
+
+        // Prints a line for every read. Off for timing runs, where the console
+        // would cost more than the reads.
+        bool TraceReads;
+    };
+
+    struct Stats
+    {
+        LONGLONG BytesRead;
+        LONGLONG Reads;
+        LONGLONG Deferrals;
+        LONG PeakReads;
+        ULONG ChunkSize;
+    };
+
+    // Called once per chunk, on a thread pool thread, in no particular order. data is
+    // null if the read failed, in which case status says why. Returning a failure
+    // status stops the request.
+    using ChunkCallback = std::function<NTSTATUS(LONGLONG offset, ULONG length, _In_opt_ const BYTE* data, NTSTATUS status)>;
+
+    // Called once per request, after the last chunk callback.
+    using DoneCallback = std::function<void(NTSTATUS status)>;
+
+    static Settings DefaultSettings();
+
+    HydrationEngine(_In_ const Settings& settings);
+
+    // Waits for all requests to finish.
+    ~HydrationEngine();
+
+    // Starts reading a range of a server file. Throws if the file cannot be opened;
+    // once this returns, the callbacks report the outcome.
+    void Hydrate(
+        _In_ LPCWSTR serverPath,
+        _In_ LONGLONG offset,
+        _In_ LONGLONG length,
+        _In_ UCHAR priority,
+        _In_ LONGLONG cancelKey,
+        _In_ ChunkCallback onChunk,
+        _In_ DoneCallback onDone);
+
+    // Stops the requests that were started with this cancel key. Reads in flight are
+    // aborted and no further chunks are reported.
+    void Cancel(_In_ LONGLONG cancelKey);
+
+    Stats GetStats();
+
+private:
+    // The helpers ending in Locked must be called with _lock held exclusively.
+    void ScheduleLocked(_In_ HYDRATION_REQUEST* request, _Inout_ std::vector<HYDRATION_READ*>& reads);
+    void PumpWaitingLocked(_Inout_ std::vector<HYDRATION_READ*>& reads, _Inout_ std::vector<HYDRATION_REQUEST*>& finished);
+    void ReleaseLocked(_In_ HYDRATION_REQUEST* request, _Inout_ std::vector<HYDRATION_REQUEST*>& finished);
+    void AdaptChunkSizeLocked(_In_ ULONG length, _In_ LONGLONG latencyMs);
+
+    void StartReads(_In_ std::vector<HYDRATION_READ*>& reads);
+    void CompleteRead(_In_ HYDRATION_READ* read, _In_ ULONG errorCode, _In_ ULONG bytesRead);
+    void FinishRequests(_In_ std::vector<HYDRATION_REQUEST*>& finished);
+
+    static void CALLBACK IoCompletionCallback(
+        _Inout_ PTP_CALLBACK_INSTANCE instance,
+        _Inout_opt_ PVOID context,
+        _Inout_opt_ PVOID overlapped,
+        _In_ ULONG ioResult,
+        _In_ ULONG_PTR numberOfBytesTransferred,
+        _Inout_ PTP_IO io);
+
+    Settings _settings;
+    LARGE_INTEGER _frequency;
+
+    // Protects everything below, including the scheduling fields of every request.
+    SRWLOCK _lock;
+    CONDITION_VARIABLE _idle;
+    std::list<HYDRATION_REQUEST*> _requests;
+    std::list<HYDRATION_REQUEST*> _waiting;
+    LONG _activeReads{};
+    ULONG _chunkSize{};
+
+    LONGLONG _bytesRead{};
+    LONGLONG _reads{};
+    LONGLONG _deferrals{};
+    LONG _peakReads{};
+};
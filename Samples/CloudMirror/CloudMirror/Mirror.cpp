@@ -9,6 +9,13 @@
 
 int __cdecl wmain( INT argc, PWSTR argv[] )
 {
+    // "CloudMirror.exe -benchmark [server folder]" measures hydration throughput.
+    // It runs without a sync root, so it doesn't need to be launched from the Start menu.
+    if ((argc > 1) && ((_wcsicmp(argv[1], L"-benchmark") == 0) || (_wcsicmp(argv[1], L"/benchmark") == 0)))
+    {
+        return HydrationBenchmark::Run((argc > 2) ? argv[2] : nullptr);
+    }
+
     winrt::init_apartment();
 
     // Detect a common debugging error up front.
@@ -36,6 +36,7 @@
 #include <winrt\windows.storage.provider.h>
 #include <winrt\Windows.Security.Cryptography.h>
 #include <functional>
+#include <map>
 #include <strsafe.h>
 
 namespace winrt {
@@ -51,7 +52,9 @@ namespace winrt {
 
 #include "DirectoryWatcher.h"
 #include "ProviderFolderLocations.h"
+#include "HydrationEngine.h"
 #include "FileCopierWithProgress.h"
+#include "HydrationBenchmark.h"
 #include "CloudProviderRegistrar.h"
 #include "CloudProviderSyncRootWatcher.h"
 #include "Placeholders.h"
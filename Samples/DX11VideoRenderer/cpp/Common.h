@@ -253,10 +253,11 @@ namespace DX11VideoRenderer
     //
     // T: COM interface type.
     //
-    // This class is used by the scheduler.
+    // This class is used by the stream sink.
     //
     // Note: This class uses a critical section to protect the state of the queue.
-    // With a little work, the scheduler could probably use a lock-free queue.
+    // The scheduler keeps its samples in a plain list instead, because every
+    // access to it is already made under the scheduler's critical section.
     //-----------------------------------------------------------------------------
 
     template <class T>
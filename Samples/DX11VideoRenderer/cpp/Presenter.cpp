@@ -436,6 +436,29 @@ HRESULT DX11VideoRenderer::CPresenter::PresentFrame(void)
     return hr;
 }
 
+//+-------------------------------------------------------------------------
+//
+//  Member:     SkipFrame
+//
+//  Synopsis:   Discard the current outstanding frame without presenting it.
+//              The next frame is drawn over it in the back buffer.
+//
+//--------------------------------------------------------------------------
+
+HRESULT DX11VideoRenderer::CPresenter::SkipFrame(void)
+{
+    CAutoLock lock(&m_critSec);
+
+    HRESULT hr = CheckShutdown();
+
+    if (SUCCEEDED(hr))
+    {
+        m_bCanProcessNextSample = TRUE;
+    }
+
+    return hr;
+}
+
 //-------------------------------------------------------------------
 // Name: ProcessFrame
 // Description: Present one media sample.
@@ -48,6 +48,7 @@ namespace DX11VideoRenderer
         HRESULT ProcessFrame(IMFMediaType* pCurrentType, IMFSample* pSample, UINT32* punInterlaceMode, BOOL* pbDeviceChanged, BOOL* pbProcessAgain, IMFSample** ppOutputSample = NULL);
         HRESULT SetCurrentMediaType(IMFMediaType* pMediaType);
         HRESULT Shutdown(void);
+        HRESULT SkipFrame(void);
 
     private:
 
@@ -1,5 +1,10 @@
 #include "Scheduler.h"
 
+// Defined by the Windows 10 SDK, version 1803 and later.
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION 0x00000002
+#endif
+
 //-----------------------------------------------------------------------------
 // Constructor
 //-----------------------------------------------------------------------------
@@ -15,8 +20,20 @@ DX11VideoRenderer::CScheduler::CScheduler(CCritSec& critSec) :
     m_LastSampleTime(0),
     m_PerFrameInterval(0),
     m_PerFrame_1_4th(0),
-    m_keyTimer(0)
+    m_keyTimer(0),
+    m_bWakePending(FALSE),
+    m_dFrameDuration(0.0),
+    m_hnsPresentLead(0),
+    m_hnsDropThreshold(0),
+    m_bTimelineValid(FALSE),
+    m_hnsTimelineOrigin(0),
+    m_llTimelineFrame(0),
+    m_bDropLateFrames(TRUE),
+    m_cConsecutiveDrops(s_MaxConsecutiveDrops),
+    m_dErrorMean(0.0),
+    m_dErrorM2(0.0)
 {
+    ResetStatistics();
 }
 
 
@@ -91,6 +108,17 @@ void DX11VideoRenderer::CScheduler::SetFrameRate(const MFRatio& fps)
 
     // Calculate 1/4th of this value, because we use it frequently.
     m_PerFrame_1_4th = m_PerFrameInterval / 4;
+
+    // Lay out the timeline. The slots are computed from the exact frame rate,
+    // so they do not drift the way a sum of rounded frame durations would. A
+    // frame is handed to the presenter 3/4 of a frame before its slot, and is
+    // dropped once it is more than a whole frame late.
+    m_dFrameDuration = (fps.Numerator != 0) ? (10000000.0 * fps.Denominator / fps.Numerator) : 0.0;
+    m_hnsPresentLead = 3 * m_PerFrame_1_4th;
+    m_hnsDropThreshold = m_PerFrameInterval;
+
+    // Start a new timeline at the next sample.
+    m_bTimelineValid = FALSE;
 }
 
 
@@ -113,11 +141,22 @@ HRESULT DX11VideoRenderer::CScheduler::StartScheduler(IMFClock* pClock)
         m_pClock->AddRef();
     }
 
+    m_bTimelineValid = FALSE;
+    m_cConsecutiveDrops = s_MaxConsecutiveDrops; // Never drop the first frame.
+    ResetStatistics();
+
     // Set a high the timer resolution (ie, short timer period).
     timeBeginPeriod(1);
 
-    // create the waitable timer
-    m_hWaitTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+    // create the waitable timer. A high resolution timer is not rounded to the
+    // timer period, which matters at 120 frames per second and up. It is not
+    // available before Windows 10, version 1803.
+    SafeCloseHandle(m_hWaitTimer);
+    m_hWaitTimer = CreateWaitableTimerExW(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+    if (m_hWaitTimer == NULL)
+    {
+        m_hWaitTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+    }
     if (m_hWaitTimer == NULL)
     {
         hr = HRESULT_FROM_WIN32(GetLastError());
@@ -135,20 +174,34 @@ HRESULT DX11VideoRenderer::CScheduler::StartScheduler(IMFClock* pClock)
 
 HRESULT DX11VideoRenderer::CScheduler::StopScheduler(void)
 {
-    if (m_hWaitTimer != NULL)
     {
-        CloseHandle(m_hWaitTimer);
-        m_hWaitTimer = NULL;
-    }
+        // A work item queued by ScheduleSample cannot be cancelled, so OnTimer
+        // can still run; it takes the same lock.
+        CAutoLock lock(&m_critSec);
 
-    // Discard samples.
-    m_ScheduledSamples.Clear();
+        // Cancel timer callback
+        if (m_keyTimer != 0)
+        {
+            (void)MFCancelWorkItem(m_keyTimer);
+            m_keyTimer = 0;
+            m_bWakePending = FALSE;
+        }
+
+        if (m_hWaitTimer != NULL)
+        {
+            CloseHandle(m_hWaitTimer);
+            m_hWaitTimer = NULL;
+        }
+
+        // Discard samples.
+        m_ScheduledSamples.Clear();
+
+        SafeRelease(m_pClock);
+    }
 
     // Restore the timer resolution.
     timeEndPeriod(1);
 
-    SafeRelease(m_pClock);
-
     return S_OK;
 }
 
@@ -169,13 +222,19 @@ HRESULT DX11VideoRenderer::CScheduler::Flush(void)
     // Flushing: Clear the sample queue and set the event.
     m_ScheduledSamples.Clear();
 
-    // Cancel timer callback
+    // Cancel timer callback. (A work item queued by ScheduleSample cannot be
+    // cancelled; it will find the queue empty.)
     if (m_keyTimer != 0)
     {
         (void)MFCancelWorkItem(m_keyTimer);
         m_keyTimer = 0;
+        m_bWakePending = FALSE;
     }
 
+    // The next sample starts a new timeline, and is not dropped.
+    m_bTimelineValid = FALSE;
+    m_cConsecutiveDrops = s_MaxConsecutiveDrops;
+
     return S_OK;
 }
 
@@ -188,6 +247,8 @@ HRESULT DX11VideoRenderer::CScheduler::Flush(void)
 // pSample:     Pointer to the sample.
 // bPresentNow: If TRUE, the sample is presented immediately. Otherwise, the
 //              sample's time stamp is used to schedule the sample.
+//
+// Note: The caller must hold the critical section.
 //-----------------------------------------------------------------------------
 
 HRESULT DX11VideoRenderer::CScheduler::ScheduleSample(IMFSample* pSample, BOOL bPresentNow)
@@ -202,17 +263,24 @@ HRESULT DX11VideoRenderer::CScheduler::ScheduleSample(IMFSample* pSample, BOOL b
     if (bPresentNow || (m_pClock == NULL))
     {
         // Present the sample immediately.
+        m_Stats.cFramesPresented++;
         hr = m_pCB->PresentFrame();
     }
     else
     {
         // Queue the sample and ask the scheduler thread to wake up.
-        hr = m_ScheduledSamples.Queue(pSample);
+        hr = m_ScheduledSamples.InsertBack(pSample);
 
-        if (SUCCEEDED(hr))
+        // If OnTimer is already queued or waiting for the timer, it will get to
+        // this sample. It cannot be due before the samples ahead of it.
+        if (SUCCEEDED(hr) && !m_bWakePending)
         {
             // process the frame asynchronously
             hr = MFPutWorkItem(MFASYNC_CALLBACK_QUEUE_MULTITHREADED, &m_xOnTimer, nullptr);
+            if (SUCCEEDED(hr))
+            {
+                m_bWakePending = TRUE;
+            }
         }
     }
 
@@ -224,44 +292,38 @@ HRESULT DX11VideoRenderer::CScheduler::ScheduleSample(IMFSample* pSample, BOOL b
 //
 // Processes all the samples in the queue.
 //
-// plNextSleep: Receives the length of time the scheduler thread should sleep
-//              before it calls ProcessSamplesInQueue again.
+// phnsNextWait: Receives the length of time, in 100-nanosecond units, until
+//               the sample at the head of the queue is due, or 0 if the queue
+//               is empty.
 //-----------------------------------------------------------------------------
 
-HRESULT DX11VideoRenderer::CScheduler::ProcessSamplesInQueue(LONG* plNextSleep)
+HRESULT DX11VideoRenderer::CScheduler::ProcessSamplesInQueue(LONGLONG* phnsNextWait)
 {
     HRESULT hr = S_OK;
-    LONG lWait = 0;
+    LONGLONG hnsWait = 0;
     IMFSample* pSample = NULL;
 
     // Process samples until the queue is empty or until the wait time > 0.
 
-    // Note: Dequeue returns S_FALSE when the queue is empty.
+    // Note: GetFront returns E_FAIL when the queue is empty.
 
-    while (m_ScheduledSamples.Dequeue(&pSample) == S_OK)
+    while (SUCCEEDED(m_ScheduledSamples.GetFront(&pSample)))
     {
         // Process the next sample in the queue. If the sample is not ready
-        // for presentation. the value returned in lWait is > 0, which
-        // means the scheduler should sleep for that amount of time.
+        // for presentation, it stays in the queue and the value returned in
+        // hnsWait is > 0, which means the scheduler should sleep for that
+        // amount of time.
 
-        hr = ProcessSample(pSample, &lWait);
+        hr = ProcessSample(pSample, &hnsWait);
         SafeRelease(pSample);
 
-        if (FAILED(hr) || lWait > 0)
+        if (FAILED(hr) || hnsWait > 0)
         {
             break;
         }
     }
 
-    // If the wait time is zero, it means we stopped because the queue is
-    // empty (or an error occurred). Set the wait time to infinite; this will
-    // make the scheduler thread sleep until it gets another thread message.
-    if (lWait == 0)
-    {
-        lWait = INFINITE;
-    }
-
-    *plNextSleep = lWait;
+    *phnsNextWait = hnsWait;
     return hr;
 }
 
@@ -269,13 +331,15 @@ HRESULT DX11VideoRenderer::CScheduler::ProcessSamplesInQueue(LONG* plNextSleep)
 //-----------------------------------------------------------------------------
 // ProcessSample
 //
-// Processes a sample.
+// Processes the sample at the head of the queue. The sample is removed from
+// the queue unless it is not due yet.
 //
-// plNextSleep: Receives the length of time the scheduler thread should sleep.
+// phnsNextWait: Receives the length of time the scheduler should sleep, or 0
+//               if the sample was presented or dropped.
 //-----------------------------------------------------------------------------
 
 
-HRESULT DX11VideoRenderer::CScheduler::ProcessSample(IMFSample* pSample, LONG* plNextSleep)
+HRESULT DX11VideoRenderer::CScheduler::ProcessSample(IMFSample* pSample, LONGLONG* phnsNextWait)
 {
     HRESULT hr = S_OK;
 
@@ -284,25 +348,39 @@ HRESULT DX11VideoRenderer::CScheduler::ProcessSample(IMFSample* pSample, LONG* p
     MFTIME   hnsSystemTime = 0;
     LONGLONG hnsDelta = 0;
 
-    BOOL bPresentNow = TRUE;
-    LONG lNextSleep = 0;
+    BOOL bTimed = FALSE;
+    BOOL bDrop = FALSE;
+    LONGLONG hnsNextWait = 0;
 
-    if (m_pClock)
+    // At rate 0 (scrubbing) the clock does not move, so present right away.
+    if (m_pClock && (m_fRate != 0.0f))
     {
-        // Get the sample's time stamp. It is valid for a sample to
-        // have no time stamp.
-        hr = pSample->GetSampleTime(&hnsPresentationTime);
+        // Find the sample's slot on the timeline. It is valid for a sample to
+        // have no time stamp; it then takes the slot after the previous sample,
+        // which is stamped on the sample so that it keeps the same slot if it
+        // has to wait.
+        if (SUCCEEDED(pSample->GetSampleTime(&hnsPresentationTime)))
+        {
+            hnsPresentationTime = SnapToTimeline(hnsPresentationTime);
+            bTimed = TRUE;
+        }
+        else if (m_bTimelineValid)
+        {
+            m_llTimelineFrame += (m_fRate < 0) ? -1 : 1;
+            hnsPresentationTime = TimelineSlot(m_llTimelineFrame);
+            bTimed = SUCCEEDED(pSample->SetSampleTime(hnsPresentationTime));
+        }
 
-        // Get the clock time. (But if the sample does not have a time stamp,
+        // Get the clock time. (But if the sample does not have a slot,
         // we don't need the clock time.)
-        if (SUCCEEDED(hr))
+        if (bTimed)
         {
-            hr = m_pClock->GetCorrelatedTime(0, &hnsTimeNow, &hnsSystemTime);
+            bTimed = SUCCEEDED(m_pClock->GetCorrelatedTime(0, &hnsTimeNow, &hnsSystemTime));
         }
 
-        if (SUCCEEDED(hr))
+        if (bTimed)
         {
-            // Calculate the time until the sample's presentation time.
+            // Calculate the time until the sample's slot.
             // A negative value means the sample is late.
             hnsDelta = hnsPresentationTime - hnsTimeNow;
             if (m_fRate < 0)
@@ -312,39 +390,152 @@ HRESULT DX11VideoRenderer::CScheduler::ProcessSample(IMFSample* pSample, LONG* p
                 hnsDelta = - hnsDelta;
             }
 
-            if (hnsDelta < - m_PerFrame_1_4th)
+            if (hnsDelta > m_hnsPresentLead)
             {
-                // This sample is late.
-                bPresentNow = TRUE;
+                // This sample is still too early. Sleep until it is due,
+                // adjusting for the clock rate. (The presentation clock runs
+                // at m_fRate, but sleeping uses the system clock.)
+                hnsNextWait = static_cast<LONGLONG>((hnsDelta - m_hnsPresentLead) / fabsf(m_fRate));
+                if (hnsNextWait < 1)
+                {
+                    hnsNextWait = 1;
+                }
             }
-            else if (hnsDelta > (3 * m_PerFrame_1_4th))
+            else if (m_bDropLateFrames &&
+                     (-hnsDelta > m_hnsDropThreshold) &&
+                     (m_cConsecutiveDrops < s_MaxConsecutiveDrops))
             {
-                // This sample is still too early. Go to sleep.
-                lNextSleep = static_cast<LONG>(TicksToMilliseconds(hnsDelta - (3 * m_PerFrame_1_4th)));
+                // This sample is so late that the next one is due already.
+                bDrop = TRUE;
+            }
+        }
+    }
 
-                // Adjust the sleep time for the clock rate. (The presentation clock runs
-                // at m_fRate, but sleeping uses the system clock.)
-                lNextSleep = static_cast<LONG>(lNextSleep / fabsf(m_fRate));
+    if (hnsNextWait == 0)
+    {
+        // Done with the sample. The callback may schedule the next one.
+        (void)m_ScheduledSamples.RemoveFront(NULL);
 
-                // Don't present yet.
-                bPresentNow = FALSE;
+        if (bDrop)
+        {
+            m_cConsecutiveDrops++;
+            m_Stats.cFramesDropped++;
+
+            hr = m_pCB->DropFrame();
+        }
+        else
+        {
+            m_cConsecutiveDrops = 0;
+            m_Stats.cFramesPresented++;
+            if (bTimed)
+            {
+                m_LastSampleTime = hnsPresentationTime;
+                RecordPresent(m_hnsPresentLead - hnsDelta);
             }
+
+            hr = m_pCB->PresentFrame();
         }
     }
 
-    if (bPresentNow)
+    *phnsNextWait = hnsNextWait;
+
+    return hr;
+}
+
+//-----------------------------------------------------------------------------
+// TimelineSlot
+//
+// Returns the time of a frame on the current timeline.
+//-----------------------------------------------------------------------------
+
+LONGLONG DX11VideoRenderer::CScheduler::TimelineSlot(LONGLONG llFrame) const
+{
+    return m_hnsTimelineOrigin + static_cast<LONGLONG>(floor(llFrame * m_dFrameDuration + 0.5));
+}
+
+//-----------------------------------------------------------------------------
+// SnapToTimeline
+//
+// Returns the slot nearest to a sample time. If the sample time is not close
+// to any slot (the first sample, a seek, or a stream with a variable frame
+// rate), a new timeline is started at the sample time.
+//-----------------------------------------------------------------------------
+
+LONGLONG DX11VideoRenderer::CScheduler::SnapToTimeline(LONGLONG hnsSampleTime)
+{
+    if (m_bTimelineValid)
     {
-        hr = m_pCB->PresentFrame();
+        LONGLONG hnsOffset = hnsSampleTime - m_hnsTimelineOrigin;
+        if ((hnsOffset > -s_MaxTimelineSpan) && (hnsOffset < s_MaxTimelineSpan))
+        {
+            LONGLONG llFrame = static_cast<LONGLONG>(floor(hnsOffset / m_dFrameDuration + 0.5));
+            LONGLONG hnsSlot = TimelineSlot(llFrame);
+
+            if ((hnsSlot - hnsSampleTime <= m_PerFrame_1_4th) && (hnsSampleTime - hnsSlot <= m_PerFrame_1_4th))
+            {
+                m_llTimelineFrame = llFrame;
+                return hnsSlot;
+            }
+        }
     }
-    else
+
+    // Without a frame rate there is no timeline, and every sample is presented
+    // at its own time.
+    m_bTimelineValid = (m_dFrameDuration > 0.0);
+    m_hnsTimelineOrigin = hnsSampleTime;
+    m_llTimelineFrame = 0;
+
+    return hnsSampleTime;
+}
+
+//-----------------------------------------------------------------------------
+// RecordPresent
+//
+// Adds the error of a frame presented against the clock to the statistics.
+//-----------------------------------------------------------------------------
+
+void DX11VideoRenderer::CScheduler::RecordPresent(LONGLONG hnsError)
+{
+    ULONGLONG cFrames = ++m_Stats.cFramesTimed;
+
+    if ((cFrames == 1) || (hnsError < m_Stats.hnsMinError))
+    {
+        m_Stats.hnsMinError = hnsError;
+    }
+    if ((cFrames == 1) || (hnsError > m_Stats.hnsMaxError))
     {
-        // The sample is not ready yet. Return it to the queue.
-        hr = m_ScheduledSamples.PutBack(pSample);
+        m_Stats.hnsMaxError = hnsError;
     }
 
-    *plNextSleep = lNextSleep;
+    // Welford's method, which does not lose precision over a long run.
+    double dDelta = hnsError - m_dErrorMean;
+    m_dErrorMean += dDelta / cFrames;
+    m_dErrorM2 += dDelta * (hnsError - m_dErrorMean);
+}
 
-    return hr;
+void DX11VideoRenderer::CScheduler::ResetStatistics(void)
+{
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+    m_dErrorMean = 0.0;
+    m_dErrorM2 = 0.0;
+}
+
+//-----------------------------------------------------------------------------
+// GetStatistics
+//
+// Returns the presentation statistics collected since StartScheduler.
+//-----------------------------------------------------------------------------
+
+void DX11VideoRenderer::CScheduler::GetStatistics(SchedulerStatistics* pStats)
+{
+    CAutoLock lock(&m_critSec);
+
+    *pStats = m_Stats;
+    if (m_Stats.cFramesTimed != 0)
+    {
+        pStats->hnsMeanError = static_cast<LONGLONG>(floor(m_dErrorMean + 0.5));
+        pStats->hnsJitter = static_cast<LONGLONG>(floor(sqrt(m_dErrorM2 / m_Stats.cFramesTimed) + 0.5));
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -357,19 +548,19 @@ HRESULT DX11VideoRenderer::CScheduler::StartProcessSample()
 {
     HRESULT hr = S_OK;
 
-    LONG    lWait = INFINITE;
-    BOOL    bExitThread = FALSE;
+    LONGLONG hnsWait = 0;
     IMFAsyncResult *pAsyncResult = NULL;
 
-    hr = ProcessSamplesInQueue(&lWait);
+    hr = ProcessSamplesInQueue(&hnsWait);
 
     if(SUCCEEDED(hr))
     {
-        if(INFINITE != lWait && 0 < lWait)
+        if(0 < hnsWait)
         {
-            // not time to process the frame yet, wait until the right time
+            // not time to process the frame yet, wait until the right time.
+            // A negative due time is relative, in 100-nanosecond units.
             LARGE_INTEGER llDueTime;
-            llDueTime.QuadPart = -1 * MillisecondsToTicks(lWait);
+            llDueTime.QuadPart = -hnsWait;
             if (SetWaitableTimer(m_hWaitTimer, &llDueTime, 0, NULL, NULL, FALSE) == 0)
             {
                 hr = HRESULT_FROM_WIN32(GetLastError());
@@ -377,12 +568,18 @@ HRESULT DX11VideoRenderer::CScheduler::StartProcessSample()
 
             if(SUCCEEDED(hr))
             {
+                m_Stats.cTimerWaits++;
+
                 // queue a waititem to wait for timer completion
                 hr = MFCreateAsyncResult(nullptr, &m_xOnTimer, nullptr, &pAsyncResult);
                 if(SUCCEEDED(hr))
                 {
                     hr = MFPutWaitingWorkItem(m_hWaitTimer, 0, pAsyncResult, &m_keyTimer);
                 }
+                if(SUCCEEDED(hr))
+                {
+                    m_bWakePending = TRUE;
+                }
             }
         }
     }
@@ -407,6 +604,7 @@ HRESULT DX11VideoRenderer::CScheduler::OnTimer(__RPC__in_opt IMFAsyncResult *pRe
     CAutoLock lock(&m_critSec);
 
     m_keyTimer = 0;
+    m_bWakePending = FALSE;
 
     // if we have a pending frame, process it
     // it's possible that we don't have a frame at this point if the pending frame was cancelled
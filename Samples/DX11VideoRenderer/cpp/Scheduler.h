@@ -7,12 +7,36 @@ namespace DX11VideoRenderer
     //-----------------------------------------------------------------------------
     // SchedulerCallback
     //
-    // Defines the callback method to present samples.
+    // Defines the callback methods to present or drop samples.
     //-----------------------------------------------------------------------------
 
     struct SchedulerCallback
     {
         virtual HRESULT PresentFrame(void) = 0;
+        virtual HRESULT DropFrame(void) = 0;    // The frame is too late; skip it without presenting.
+    };
+
+    //-----------------------------------------------------------------------------
+    // SchedulerStatistics
+    //
+    // Presentation statistics, collected since the scheduler was started.
+    //
+    // The error of a frame is the clock time when it was presented minus the time
+    // it was due (its slot on the timeline, less the present lead). A positive
+    // error means the frame was presented late. Only frames that were presented
+    // against the clock are included in the error statistics.
+    //-----------------------------------------------------------------------------
+
+    struct SchedulerStatistics
+    {
+        ULONGLONG   cFramesPresented;   // All presented frames, including immediate presents.
+        ULONGLONG   cFramesTimed;       // Frames presented against the clock.
+        ULONGLONG   cFramesDropped;     // Late frames that were dropped.
+        ULONGLONG   cTimerWaits;        // Number of times the wait timer was set.
+        LONGLONG    hnsMeanError;       // Mean error.
+        LONGLONG    hnsJitter;          // Standard deviation of the error.
+        LONGLONG    hnsMinError;
+        LONGLONG    hnsMaxError;
     };
 
     //-----------------------------------------------------------------------------
@@ -21,13 +45,19 @@ namespace DX11VideoRenderer
     // Schedules when a sample should be displayed.
     //
     // Note: Presentation of each sample is performed by another object which
-    // must implement SchedulerCallback::PresentSample.
+    // must implement SchedulerCallback::PresentFrame.
     //
     // General design:
     // The scheduler generally receives samples before their presentation time. It
-    // puts the samples on a queue and presents them in FIFO order on a worker
-    // thread. The scheduler communicates with the worker thread by posting thread
-    // messages.
+    // puts the samples on a queue and presents them in FIFO order from a
+    // work queue callback, which a waitable timer wakes up when the next sample is
+    // due.
+    //
+    // SetFrameRate lays out a timeline of frame slots. Each sample is presented in
+    // the slot nearest its time stamp, and a sample without a time stamp takes the
+    // slot after the previous one. A sample that arrives more than one frame after
+    // its slot is dropped, unless dropping is disabled or too many frames in a row
+    // have already been dropped.
     //
     // The caller has the option of presenting samples immediately (for example,
     // for repaints).
@@ -54,6 +84,7 @@ namespace DX11VideoRenderer
 
         void SetFrameRate(const MFRatio& fps);
         void SetClockRate(float fRate) { m_fRate = fRate; }
+        void SetDropLateFrames(BOOL bDrop) { m_bDropLateFrames = bDrop; }
 
         const LONGLONG& LastSampleTime(void) const { return m_LastSampleTime; }
         const LONGLONG& FrameDuration(void) const { return m_PerFrameInterval; }
@@ -62,14 +93,26 @@ namespace DX11VideoRenderer
         HRESULT StopScheduler(void);
 
         HRESULT ScheduleSample(IMFSample* pSample, BOOL bPresentNow);
-        HRESULT ProcessSamplesInQueue(LONG* plNextSleep);
-        HRESULT ProcessSample(IMFSample* pSample, LONG* plNextSleep);
+        HRESULT ProcessSamplesInQueue(LONGLONG* phnsNextWait);
+        HRESULT ProcessSample(IMFSample* pSample, LONGLONG* phnsNextWait);
         HRESULT Flush(void);
 
-        DWORD GetCount(void){ return m_ScheduledSamples.GetCount(); }
+        DWORD GetCount(void){ CAutoLock lock(&m_critSec); return m_ScheduledSamples.GetCount(); }
+        void GetStatistics(SchedulerStatistics* pStats);
 
     private:
 
+        // The first late frame after a gap of this many drops is presented anyway.
+        static const DWORD   s_MaxConsecutiveDrops = 4;
+
+        // A time stamp this far from the timeline starts a new timeline.
+        static const LONGLONG s_MaxTimelineSpan = 36000000000; // 1 hour
+
+        LONGLONG TimelineSlot(LONGLONG llFrame) const;
+        LONGLONG SnapToTimeline(LONGLONG hnsSampleTime);
+        void RecordPresent(LONGLONG hnsError);
+        void ResetStatistics(void);
+
         HRESULT StartProcessSample();
         HRESULT OnTimer(__RPC__in_opt IMFAsyncResult* pResult);
         METHODASYNCCALLBACKEX(OnTimer, CScheduler, 0, MFASYNC_CALLBACK_QUEUE_MULTITHREADED);
@@ -77,7 +120,7 @@ namespace DX11VideoRenderer
         long                        m_nRefCount;
         CCritSec&                   m_critSec;          // critical section for thread safety
         SchedulerCallback*          m_pCB;              // Weak reference; do not delete.
-        ThreadSafeQueue<IMFSample>  m_ScheduledSamples; // Samples waiting to be presented.
+        ComPtrListEx<IMFSample>     m_ScheduledSamples; // Samples waiting to be presented. Protected by m_critSec.
         IMFClock*                   m_pClock;           // Presentation clock. Can be NULL.
         float                       m_fRate;            // Playback rate.
         HANDLE                      m_hWaitTimer;       // Wait Timer after which frame is presented.
@@ -85,5 +128,23 @@ namespace DX11VideoRenderer
         MFTIME                      m_PerFrameInterval; // Duration of each frame.
         LONGLONG                    m_PerFrame_1_4th;   // 1/4th of the frame duration.
         MFWORKITEM_KEY              m_keyTimer;
+        BOOL                        m_bWakePending;     // OnTimer is queued or waiting for the timer.
+
+        // Timeline, laid out by SetFrameRate.
+        double                      m_dFrameDuration;   // Exact duration of each frame.
+        LONGLONG                    m_hnsPresentLead;   // How long before its slot a frame is presented.
+        LONGLONG                    m_hnsDropThreshold; // How late a frame can be and still be presented.
+        BOOL                        m_bTimelineValid;
+        LONGLONG                    m_hnsTimelineOrigin;// Time of frame 0.
+        LONGLONG                    m_llTimelineFrame;  // Frame number of the most recent slot.
+
+        // Late frame policy.
+        BOOL                        m_bDropLateFrames;
+        DWORD                       m_cConsecutiveDrops;
+
+        // Statistics.
+        SchedulerStatistics         m_Stats;
+        double                      m_dErrorMean;       // Running mean and sum of squared
+        double                      m_dErrorM2;         // differences, for the jitter.
     };
 }
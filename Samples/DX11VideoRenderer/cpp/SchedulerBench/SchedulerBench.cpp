@@ -0,0 +1,333 @@
+//-----------------------------------------------------------------------------
+// SchedulerBench
+//
+// Runs the renderer's scheduler against a simulated presentation clock and a
+// callback that does not touch a display, and prints how closely each frame
+// was presented to the time it was due.
+//
+// The main thread plays the part of the stream sink: it schedules one sample,
+// waits until the scheduler presents or drops it, then schedules the next.
+// Optionally the "decoder" stalls now and then, so that frames arrive late
+// and the drop policy can be compared with presenting every frame.
+//
+// Usage: SchedulerBench [seconds per run]
+//-----------------------------------------------------------------------------
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "..\Scheduler.h"
+
+using namespace DX11VideoRenderer;
+
+volatile long DX11VideoRenderer::CBase::s_lObjectCount = 0;
+
+//-----------------------------------------------------------------------------
+// CSimulatedClock
+//
+// Presentation clock that runs from QueryPerformanceCounter at a fixed rate,
+// starting at zero when Start is called.
+//-----------------------------------------------------------------------------
+
+class CSimulatedClock : public IMFClock
+{
+public:
+
+    CSimulatedClock(float fRate) :
+        m_nRefCount(1),
+        m_fRate(fRate)
+    {
+        QueryPerformanceFrequency(&m_Frequency);
+        m_Start.QuadPart = 0;
+    }
+
+    void Start(void)
+    {
+        QueryPerformanceCounter(&m_Start);
+    }
+
+    // IUnknown
+    STDMETHODIMP_(ULONG) AddRef()
+    {
+        return InterlockedIncrement(&m_nRefCount);
+    }
+
+    STDMETHODIMP_(ULONG) Release()
+    {
+        ULONG uCount = InterlockedDecrement(&m_nRefCount);
+        if (uCount == 0)
+        {
+            delete this;
+        }
+        return uCount;
+    }
+
+    STDMETHODIMP QueryInterface(REFIID iid, __RPC__deref_out _Result_nullonfailure_ void** ppv)
+    {
+        if (!ppv)
+        {
+            return E_POINTER;
+        }
+        if (iid == IID_IUnknown || iid == __uuidof(IMFClock))
+        {
+            *ppv = static_cast<IMFClock*>(this);
+        }
+        else
+        {
+            *ppv = NULL;
+            return E_NOINTERFACE;
+        }
+        AddRef();
+        return S_OK;
+    }
+
+    // IMFClock
+    STDMETHODIMP GetClockCharacteristics(__RPC__out DWORD* pdwCharacteristics)
+    {
+        *pdwCharacteristics = MFCLOCK_CHARACTERISTICSF_FREQUENCY_10MHZ;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetCorrelatedTime(DWORD dwReserved, __RPC__out LONGLONG* pllClockTime, __RPC__out MFTIME* phnsSystemTime)
+    {
+        LARGE_INTEGER qpc;
+        QueryPerformanceCounter(&qpc);
+
+        *phnsSystemTime = ToHns(qpc.QuadPart);
+        *pllClockTime = static_cast<LONGLONG>(ToHns(qpc.QuadPart - m_Start.QuadPart) * m_fRate);
+        return S_OK;
+    }
+
+    STDMETHODIMP GetContinuityKey(__RPC__out DWORD* pdwContinuityKey)
+    {
+        *pdwContinuityKey = 0;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetState(DWORD dwReserved, __RPC__out MFCLOCK_STATE* peClockState)
+    {
+        *peClockState = MFCLOCK_STATE_RUNNING;
+        return S_OK;
+    }
+
+    STDMETHODIMP GetProperties(__RPC__out MFCLOCK_PROPERTIES* pClockProperties)
+    {
+        ZeroMemory(pClockProperties, sizeof(*pClockProperties));
+        pClockProperties->qwClockFrequency = MFCLOCK_FREQUENCY_HNS;
+        pClockProperties->dwClockJitter = 1;
+        return S_OK;
+    }
+
+private:
+
+    LONGLONG ToHns(LONGLONG llTicks) const
+    {
+        return static_cast<LONGLONG>(llTicks * 10000000.0 / m_Frequency.QuadPart);
+    }
+
+    long            m_nRefCount;
+    float           m_fRate;
+    LARGE_INTEGER   m_Frequency;
+    LARGE_INTEGER   m_Start;
+};
+
+//-----------------------------------------------------------------------------
+// CBenchCallback
+//
+// Stands in for the stream sink: counts the frames and wakes up the main
+// thread so that it can schedule the next sample.
+//-----------------------------------------------------------------------------
+
+class CBenchCallback : public SchedulerCallback
+{
+public:
+
+    CBenchCallback(HANDLE hFrameDone) :
+        m_hFrameDone(hFrameDone)
+    {
+    }
+
+    HRESULT PresentFrame(void)
+    {
+        SetEvent(m_hFrameDone);
+        return S_OK;
+    }
+
+    HRESULT DropFrame(void)
+    {
+        SetEvent(m_hFrameDone);
+        return S_OK;
+    }
+
+private:
+
+    HANDLE m_hFrameDone;
+};
+
+//-----------------------------------------------------------------------------
+// RunScheduler
+//
+// Plays dwSeconds of video at the given frame rate. Every dwStallEvery frames
+// (if not 0) the decoder stalls for dwStallFrames frame durations.
+//-----------------------------------------------------------------------------
+
+HRESULT RunScheduler(
+    UINT32 unFps,
+    DWORD dwSeconds,
+    DWORD dwStallEvery,
+    DWORD dwStallFrames,
+    BOOL bDropLateFrames,
+    SchedulerStatistics* pStats)
+{
+    HRESULT hr = S_OK;
+    CCritSec critSec;
+    CScheduler* pScheduler = NULL;
+    CSimulatedClock* pClock = NULL;
+    HANDLE hFrameDone = NULL;
+    MFRatio fps = { unFps, 1 };
+    ULONGLONG cFrames = (ULONGLONG)unFps * dwSeconds;
+
+    hFrameDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (hFrameDone == NULL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CBenchCallback callback(hFrameDone);
+
+    pScheduler = new CScheduler(critSec);
+    pClock = new CSimulatedClock(1.0f);
+    if (pScheduler == NULL || pClock == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        pScheduler->SetCallback(&callback);
+        pScheduler->SetFrameRate(fps);
+        pScheduler->SetDropLateFrames(bDropLateFrames);
+
+        hr = pScheduler->StartScheduler(pClock);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Frame 0 is due when the clock starts.
+        pClock->Start();
+    }
+
+    for (ULONGLONG n = 0; SUCCEEDED(hr) && n < cFrames; n++)
+    {
+        IMFSample* pSample = NULL;
+
+        if (dwStallEvery != 0 && n != 0 && (n % dwStallEvery) == 0)
+        {
+            Sleep(dwStallFrames * 1000 / unFps);
+        }
+
+        hr = MFCreateSample(&pSample);
+        if (SUCCEEDED(hr))
+        {
+            // Time stamps rounded to 100 ns, like a decoder's.
+            LONGLONG hnsTime = static_cast<LONGLONG>((n * 10000000 * fps.Denominator + fps.Numerator / 2) / fps.Numerator);
+            hr = pSample->SetSampleTime(hnsTime);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            CAutoLock lock(&critSec);
+            hr = pScheduler->ScheduleSample(pSample, FALSE);
+        }
+
+        SafeRelease(pSample);
+
+        if (SUCCEEDED(hr) && WaitForSingleObject(hFrameDone, 5000) != WAIT_OBJECT_0)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_TIMEOUT);
+        }
+    }
+
+    if (pScheduler != NULL)
+    {
+        pScheduler->GetStatistics(pStats);
+        pScheduler->StopScheduler();
+    }
+
+    SafeRelease(pScheduler);
+    SafeRelease(pClock);
+    CloseHandle(hFrameDone);
+
+    return hr;
+}
+
+void PrintStatistics(UINT32 unFps, const char* pszScenario, const SchedulerStatistics& stats)
+{
+    printf("%4u fps  %-22s %8llu %8llu %8llu %9.1f %9.1f %9.1f %9.1f\n",
+        unFps,
+        pszScenario,
+        stats.cFramesPresented,
+        stats.cFramesDropped,
+        stats.cTimerWaits,
+        stats.hnsMeanError / 10.0,
+        stats.hnsJitter / 10.0,
+        stats.hnsMinError / 10.0,
+        stats.hnsMaxError / 10.0);
+}
+
+int __cdecl main(int argc, char* argv[])
+{
+    DWORD dwSeconds = (argc > 1) ? strtoul(argv[1], NULL, 10) : 5;
+    if (dwSeconds == 0)
+    {
+        printf("Usage: SchedulerBench [seconds per run]\n");
+        return 1;
+    }
+
+    HRESULT hr = MFStartup(MF_VERSION, MFSTARTUP_LITE);
+    if (FAILED(hr))
+    {
+        printf("MFStartup failed, hr = 0x%08X\n", hr);
+        return 1;
+    }
+
+    const UINT32 rgFps[] = { 60, 120, 144, 240 };
+
+    printf("Presentation error in microseconds; positive is late.\n\n");
+    printf("          %-22s %8s %8s %8s %9s %9s %9s %9s\n",
+        "Scenario", "Present", "Drop", "Waits", "Mean", "Jitter", "Min", "Max");
+
+    for (DWORD i = 0; SUCCEEDED(hr) && i < ARRAYSIZE(rgFps); i++)
+    {
+        SchedulerStatistics stats;
+        hr = RunScheduler(rgFps[i], dwSeconds, 0, 0, TRUE, &stats);
+        if (SUCCEEDED(hr))
+        {
+            PrintStatistics(rgFps[i], "steady", stats);
+        }
+    }
+
+    // A 3 frame stall every 50 frames, with and without dropping late frames.
+    for (DWORD i = 1; SUCCEEDED(hr) && i < ARRAYSIZE(rgFps); i++)
+    {
+        SchedulerStatistics stats;
+        hr = RunScheduler(rgFps[i], dwSeconds, 50, 3, TRUE, &stats);
+        if (SUCCEEDED(hr))
+        {
+            PrintStatistics(rgFps[i], "stalls, drop late", stats);
+            hr = RunScheduler(rgFps[i], dwSeconds, 50, 3, FALSE, &stats);
+        }
+        if (SUCCEEDED(hr))
+        {
+            PrintStatistics(rgFps[i], "stalls, present late", stats);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        printf("Failed, hr = 0x%08X\n", hr);
+    }
+
+    MFShutdown();
+
+    return SUCCEEDED(hr) ? 0 : 1;
+}
@@ -979,6 +979,56 @@ HRESULT DX11VideoRenderer::CStreamSink::PresentFrame(void)
     return hr;
 }
 
+//+-------------------------------------------------------------------------
+//
+//  Member:     DropFrame
+//
+//  Synopsis:   Skip the current outstanding frame, which the scheduler found
+//              too late to present, and go on to the next sample
+//
+//--------------------------------------------------------------------------
+
+HRESULT DX11VideoRenderer::CStreamSink::DropFrame(void)
+{
+    HRESULT hr = S_OK;
+
+    if (DropFrames == m_ConsumeData)
+    {
+        return hr;
+    }
+
+    CAutoLock lock(&m_critSec);
+
+    do
+    {
+        hr = CheckShutdown();
+        if (FAILED(hr))
+        {
+            break;
+        }
+
+        hr = m_pPresenter->SkipFrame();
+    }
+    while (FALSE);
+
+    if (SUCCEEDED(hr))
+    {
+        // Unless we are paused/stopped, start an async operation to dispatch the next sample.
+        if (m_state != State_Paused && m_state != State_Stopped)
+        {
+            // Queue the operation.
+            hr = QueueAsyncOperation(OpProcessSample);
+        }
+    }
+    else
+    {
+        // We are in the middle of an asynchronous operation, so if something failed, send an error.
+        hr = QueueEvent(MEError, GUID_NULL, hr, NULL);
+    }
+
+    return hr;
+}
+
 HRESULT DX11VideoRenderer::CStreamSink::GetMaxRate(BOOL fThin, float* pflRate)
 {
     HRESULT hr = S_OK;
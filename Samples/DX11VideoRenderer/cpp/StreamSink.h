@@ -54,6 +54,7 @@ namespace DX11VideoRenderer
 
         // SchedulerCallback
         HRESULT PresentFrame(void);
+        HRESULT DropFrame(void);
 
         HRESULT GetMaxRate(BOOL fThin, float* pflRate);
         HRESULT Initialize(IMFMediaSink* pParent, CPresenter* pPresenter);
@@ -0,0 +1,1438 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+
+#include "ChunkStore.h"
+#include <stdio.h>
+#include <iostream>
+#include <map>
+
+using namespace std;
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#endif
+
+// Repository layout
+const PCWSTR CHUNK_INDEX_FILE_NAME = L"\\chunkIndex.dat";
+const PCWSTR CHUNK_CONTAINERS_FOLDER = L"\\containers";
+const PCWSTR CHUNK_MANIFESTS_FOLDER = L"\\manifests";
+const PCWSTR CHUNK_MANIFEST_PATTERN = L"\\*.manifest";
+const PCWSTR CHUNK_TEMPORARY_EXTENSION = L".tmp";
+
+const DWORD CHUNK_INDEX_SIGNATURE = 0x49434443;       // "CDCI"
+const DWORD CHUNK_MANIFEST_SIGNATURE = 0x4d434443;    // "CDCM"
+const DWORD CHUNK_FORMAT_VERSION = 1;
+
+// A new container is started once the current one grows past this size
+const ULONGLONG CHUNK_CONTAINER_MAX_SIZE = 256 * 1024 * 1024;
+
+// Size of the read buffer used to chunk files, and of the write buffer
+// used for containers and manifests
+const ULONG CHUNK_IO_BUFFER_SIZE = 4 * 1024 * 1024;
+
+// Maximum number of files restored at the same time
+const ULONG CHUNK_RESTORE_MAX_THREADS = 8;
+
+// Attributes that SetFileAttributes accepts
+const DWORD CHUNK_RESTORABLE_ATTRIBUTES =
+    FILE_ATTRIBUTE_READONLY | FILE_ATTRIBUTE_HIDDEN | FILE_ATTRIBUTE_SYSTEM | FILE_ATTRIBUTE_ARCHIVE |
+    FILE_ATTRIBUTE_NOT_CONTENT_INDEXED | FILE_ATTRIBUTE_TEMPORARY;
+
+struct CHUNK_FILE_HEADER
+{
+    DWORD signature;
+    DWORD version;
+};
+
+// Each manifest entry is followed by the path relative to the backup source
+// (pathLength characters, not terminated) and chunkCount chunk hashes.
+// Directories come before their contents.
+struct CHUNK_MANIFEST_ENTRY
+{
+    DWORD attributes;
+    ULONG pathLength;
+    FILETIME creationTime;
+    FILETIME lastWriteTime;
+    ULONGLONG size;
+    ULONGLONG chunkCount;
+};
+
+struct ManifestEntry
+{
+    wstring path;
+    CHUNK_MANIFEST_ENTRY entry;
+    vector<ChunkHash> chunks;
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// File helpers
+//
+/////////////////////////////////////////////////////////////////////
+
+HRESULT CreateDirectoryIfMissing(_In_ const wstring& path)
+{
+    if (!::CreateDirectory(path.c_str(), NULL))
+    {
+        DWORD error = GetLastError();
+        if (error != ERROR_ALREADY_EXISTS)
+        {
+            wcout << L"CreateDirectory(" << path << L") failed with error " << dec << error << endl;
+            return HRESULT_FROM_WIN32(error);
+        }
+    }
+
+    return S_OK;
+}
+
+HRESULT WriteAll(_In_ HANDLE hFile, _In_reads_bytes_(length) const void* data, _In_ ULONG length)
+{
+    DWORD bytesWritten = 0;
+    if (!WriteFile(hFile, data, length, &bytesWritten, NULL))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (bytesWritten != length)
+    {
+        return E_UNEXPECTED;
+    }
+
+    return S_OK;
+}
+
+HRESULT ReadAt(_In_ HANDLE hFile, _In_ ULONGLONG offset, _Out_writes_bytes_(length) void* buffer, _In_ ULONG length)
+{
+    OVERLAPPED overlapped = {};
+    overlapped.Offset = (DWORD)offset;
+    overlapped.OffsetHigh = (DWORD)(offset >> 32);
+
+    DWORD bytesRead = 0;
+    if (!ReadFile(hFile, buffer, length, &bytesRead, &overlapped))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (bytesRead != length)
+    {
+        return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+    }
+
+    return S_OK;
+}
+
+wstring BuildContainerPath(_In_ const wstring& repository, _In_ ULONG containerId)
+{
+    WCHAR name[16];
+    swprintf_s(name, ARRAYSIZE(name), L"\\%08x.dat", containerId);
+
+    wstring path = repository;
+    path.append(CHUNK_CONTAINERS_FOLDER);
+    path.append(name);
+    return path;
+}
+
+/////////////////////////////////////////////////////////////////////
+//
+// Buffered sequential writer for containers and manifests
+//
+/////////////////////////////////////////////////////////////////////
+class CBufferedWriter
+{
+private:
+    HANDLE m_hFile;
+    BYTE* m_buffer;
+    ULONG m_used;
+    ULONGLONG m_written;
+
+public:
+    CBufferedWriter()
+    {
+        m_hFile = INVALID_HANDLE_VALUE;
+        m_buffer = NULL;
+        m_used = 0;
+        m_written = 0;
+    }
+
+    ~CBufferedWriter()
+    {
+        if (m_hFile != INVALID_HANDLE_VALUE)
+        {
+            CloseHandle(m_hFile);
+        }
+
+        delete [] m_buffer;
+    }
+
+    HRESULT Create(_In_ const wstring& path)
+    {
+        if (m_buffer == NULL)
+        {
+            m_buffer = new(nothrow) BYTE[CHUNK_IO_BUFFER_SIZE];
+            if (m_buffer == NULL)
+            {
+                return E_OUTOFMEMORY;
+            }
+        }
+
+        m_hFile = ::CreateFile(
+                        path.c_str(),
+                        GENERIC_WRITE,
+                        0,
+                        NULL,
+                        CREATE_ALWAYS,
+                        FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL);
+        if (m_hFile == INVALID_HANDLE_VALUE)
+        {
+            wcout << L"CreateFile(" << path << L") failed with error " << dec << GetLastError() << endl;
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        m_used = 0;
+        m_written = 0;
+        return S_OK;
+    }
+
+    HRESULT Write(_In_reads_bytes_(length) const void* data, _In_ ULONG length)
+    {
+        HRESULT hr = S_OK;
+
+        if (length > CHUNK_IO_BUFFER_SIZE - m_used)
+        {
+            hr = Flush();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            if (length >= CHUNK_IO_BUFFER_SIZE)
+            {
+                hr = WriteAll(m_hFile, data, length);
+                m_written += length;
+            }
+            else
+            {
+                CopyMemory(m_buffer + m_used, data, length);
+                m_used += length;
+            }
+        }
+
+        return hr;
+    }
+
+    // Writes out the buffer and makes sure the data is on disk before the
+    // chunk index or the manifest refers to it
+    HRESULT Close()
+    {
+        HRESULT hr = Flush();
+
+        if (SUCCEEDED(hr) && !FlushFileBuffers(m_hFile))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        CloseHandle(m_hFile);
+        m_hFile = INVALID_HANDLE_VALUE;
+
+        return hr;
+    }
+
+    bool IsOpen() const
+    {
+        return m_hFile != INVALID_HANDLE_VALUE;
+    }
+
+    ULONGLONG GetSize() const
+    {
+        return m_written + m_used;
+    }
+
+private:
+    HRESULT Flush()
+    {
+        HRESULT hr = S_OK;
+
+        if (m_used > 0)
+        {
+            hr = WriteAll(m_hFile, m_buffer, m_used);
+            m_written += m_used;
+            m_used = 0;
+        }
+
+        return hr;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// Appends new chunks to containers. Every backup starts a new container,
+// so containers referenced by the index are never modified.
+//
+/////////////////////////////////////////////////////////////////////
+class CContainerWriter
+{
+private:
+    wstring m_repository;
+    ULONG m_containerId;
+    CBufferedWriter m_file;
+
+public:
+    CContainerWriter(_In_ const wstring& repository, _In_ ULONG firstContainerId)
+    {
+        m_repository = repository;
+        m_containerId = firstContainerId;
+    }
+
+    HRESULT Append(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length, _Out_ ChunkLocation* location)
+    {
+        HRESULT hr = S_OK;
+
+        if (m_file.IsOpen() && m_file.GetSize() + length > CHUNK_CONTAINER_MAX_SIZE)
+        {
+            hr = m_file.Close();
+            m_containerId++;
+        }
+
+        if (SUCCEEDED(hr) && !m_file.IsOpen())
+        {
+            hr = m_file.Create(BuildContainerPath(m_repository, m_containerId));
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            location->containerId = m_containerId;
+            location->length = length;
+            location->offset = m_file.GetSize();
+
+            hr = m_file.Write(data, length);
+        }
+
+        return hr;
+    }
+
+    HRESULT Close()
+    {
+        return m_file.IsOpen() ? m_file.Close() : S_OK;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// CChunker
+//
+/////////////////////////////////////////////////////////////////////
+
+CChunker::CChunker()
+{
+    // The gear table only has to look random, but it must never change or
+    // boundaries, and with them deduplication, would not match earlier backups
+    UINT64 state = 0x741309a8a42a4830;
+    for (ULONG i = 0; i < ARRAYSIZE(m_gear); i++)
+    {
+        // splitmix64
+        state += 0x9e3779b97f4a7c15;
+        UINT64 value = state;
+        value = (value ^ (value >> 30)) * 0xbf58476d1ce4e5b9;
+        value = (value ^ (value >> 27)) * 0x94d049bb133111eb;
+        m_gear[i] = value ^ (value >> 31);
+    }
+}
+
+ULONG CChunker::FindBoundary(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) const
+{
+    if (length <= CHUNK_MIN_SIZE)
+    {
+        return length;
+    }
+
+    // Every byte shifts the hash left by one, so the top bits depend on the
+    // last 64 bytes only. Testing those makes the boundary depend on local
+    // content, which is what lets chunking resynchronize after an insertion.
+    const UINT64 mask = ((1ULL << CHUNK_BOUNDARY_BITS) - 1) << (64 - CHUNK_BOUNDARY_BITS);
+    const ULONG end = min(length, CHUNK_MAX_SIZE);
+    UINT64 hash = 0;
+
+    for (ULONG i = CHUNK_MIN_SIZE - 64; i < end; i++)
+    {
+        hash = (hash << 1) + m_gear[data[i]];
+        if (i >= CHUNK_MIN_SIZE && (hash & mask) == 0)
+        {
+            return i + 1;
+        }
+    }
+
+    return end;
+}
+
+/////////////////////////////////////////////////////////////////////
+//
+// CChunkHasher
+//
+/////////////////////////////////////////////////////////////////////
+
+CChunkHasher::CChunkHasher()
+{
+    m_algorithm = NULL;
+    m_hash = NULL;
+}
+
+CChunkHasher::~CChunkHasher()
+{
+    if (m_hash != NULL)
+    {
+        BCryptDestroyHash(m_hash);
+    }
+
+    if (m_algorithm != NULL)
+    {
+        BCryptCloseAlgorithmProvider(m_algorithm, 0);
+    }
+}
+
+HRESULT CChunkHasher::Initialize()
+{
+    // A reusable hash object resets itself in BCryptFinishHash, so hashing a
+    // chunk does not create or allocate anything
+    NTSTATUS status = BCryptOpenAlgorithmProvider(&m_algorithm, BCRYPT_SHA256_ALGORITHM, NULL, BCRYPT_HASH_REUSABLE_FLAG);
+    if (!NT_SUCCESS(status))
+    {
+        m_algorithm = NULL;
+        return HRESULT_FROM_NT(status);
+    }
+
+    status = BCryptCreateHash(m_algorithm, &m_hash, NULL, 0, NULL, 0, BCRYPT_HASH_REUSABLE_FLAG);
+    if (!NT_SUCCESS(status))
+    {
+        m_hash = NULL;
+        return HRESULT_FROM_NT(status);
+    }
+
+    return S_OK;
+}
+
+HRESULT CChunkHasher::Compute(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length, _Out_ ChunkHash* hash)
+{
+    NTSTATUS status = BCryptHashData(m_hash, const_cast<PUCHAR>(data), length, 0);
+    if (NT_SUCCESS(status))
+    {
+        status = BCryptFinishHash(m_hash, hash->bytes, CHUNK_HASH_SIZE, 0);
+    }
+
+    return NT_SUCCESS(status) ? S_OK : HRESULT_FROM_NT(status);
+}
+
+/////////////////////////////////////////////////////////////////////
+//
+// CChunkIndex
+//
+/////////////////////////////////////////////////////////////////////
+
+CChunkIndex::CChunkIndex()
+{
+    m_savedRecords = 0;
+    m_nextContainerId = 0;
+}
+
+HRESULT CChunkIndex::Load(_In_ const wstring& path)
+{
+    m_path = path;
+    m_chunks.clear();
+    m_pending.clear();
+    m_savedRecords = 0;
+    m_nextContainerId = 0;
+
+    HANDLE hFile = ::CreateFile(
+                        path.c_str(),
+                        GENERIC_READ,
+                        FILE_SHARE_READ,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        DWORD error = GetLastError();
+        if (error == ERROR_FILE_NOT_FOUND)
+        {
+            // New repository
+            return S_OK;
+        }
+
+        wcout << L"CreateFile(" << path << L") failed with error " << dec << error << endl;
+        return HRESULT_FROM_WIN32(error);
+    }
+
+    HRESULT hr = S_OK;
+    CHUNK_FILE_HEADER header = {};
+    DWORD bytesRead = 0;
+    LARGE_INTEGER fileSize = {};
+
+    if (!ReadFile(hFile, &header, sizeof(header), &bytesRead, NULL) ||
+        bytesRead != sizeof(header) ||
+        header.signature != CHUNK_INDEX_SIGNATURE ||
+        header.version != CHUNK_FORMAT_VERSION ||
+        !GetFileSizeEx(hFile, &fileSize))
+    {
+        wcout << L"Chunk index " << path << L" is not valid" << endl;
+        hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_chunks.reserve((size_t)(fileSize.QuadPart / sizeof(ChunkIndexRecord)));
+
+        // A partial record at the end is left over from an interrupted backup,
+        // it is ignored here and overwritten by the next Save
+        const ULONG batchSize = (ULONG)(CHUNK_IO_BUFFER_SIZE / sizeof(ChunkIndexRecord));
+        vector<ChunkIndexRecord> records(batchSize);
+
+        for (;;)
+        {
+            if (!ReadFile(hFile, &records[0], (DWORD)(batchSize * sizeof(ChunkIndexRecord)), &bytesRead, NULL))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                wcout << L"ReadFile(" << path << L") failed with error " << dec << GetLastError() << endl;
+                break;
+            }
+
+            ULONG count = (ULONG)(bytesRead / sizeof(ChunkIndexRecord));
+            for (ULONG i = 0; i < count; i++)
+            {
+                m_chunks.insert(make_pair(records[i].hash, records[i].location));
+                m_nextContainerId = max(m_nextContainerId, records[i].location.containerId + 1);
+            }
+            m_savedRecords += count;
+
+            if (bytesRead < batchSize * sizeof(ChunkIndexRecord))
+            {
+                break;
+            }
+        }
+    }
+
+    CloseHandle(hFile);
+
+    return hr;
+}
+
+HRESULT CChunkIndex::Save()
+{
+    if (m_pending.empty())
+    {
+        return S_OK;
+    }
+
+    HANDLE hFile = ::CreateFile(
+                        m_path.c_str(),
+                        GENERIC_WRITE,
+                        0,
+                        NULL,
+                        OPEN_ALWAYS,
+                        FILE_ATTRIBUTE_NORMAL,
+                        NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        wcout << L"CreateFile(" << m_path << L") failed with error " << dec << GetLastError() << endl;
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+
+    if (m_savedRecords == 0)
+    {
+        CHUNK_FILE_HEADER header = { CHUNK_INDEX_SIGNATURE, CHUNK_FORMAT_VERSION };
+        hr = WriteAll(hFile, &header, sizeof(header));
+    }
+    else
+    {
+        // Append after the last complete record
+        LARGE_INTEGER position;
+        position.QuadPart = sizeof(CHUNK_FILE_HEADER) + m_savedRecords * sizeof(ChunkIndexRecord);
+        if (!SetFilePointerEx(hFile, position, NULL, FILE_BEGIN))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    const size_t batchSize = CHUNK_IO_BUFFER_SIZE / sizeof(ChunkIndexRecord);
+    for (size_t written = 0; SUCCEEDED(hr) && written < m_pending.size(); written += batchSize)
+    {
+        size_t count = min(batchSize, m_pending.size() - written);
+        hr = WriteAll(hFile, &m_pending[written], (ULONG)(count * sizeof(ChunkIndexRecord)));
+    }
+
+    if (SUCCEEDED(hr) && (!SetEndOfFile(hFile) || !FlushFileBuffers(hFile)))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        m_savedRecords += m_pending.size();
+        m_pending.clear();
+    }
+    else
+    {
+        wcout << L"Writing chunk index " << m_path << L" failed, hr = 0x" << hex << hr << endl;
+    }
+
+    CloseHandle(hFile);
+
+    return hr;
+}
+
+bool CChunkIndex::Find(_In_ const ChunkHash& hash, _Out_ ChunkLocation* location) const
+{
+    auto it = m_chunks.find(hash);
+    if (it == m_chunks.end())
+    {
+        return false;
+    }
+
+    *location = it->second;
+    return true;
+}
+
+void CChunkIndex::Add(_In_ const ChunkHash& hash, _In_ const ChunkLocation& location)
+{
+    if (m_chunks.insert(make_pair(hash, location)).second)
+    {
+        ChunkIndexRecord record = { hash, location };
+        m_pending.push_back(record);
+        m_nextContainerId = max(m_nextContainerId, location.containerId + 1);
+    }
+}
+
+/////////////////////////////////////////////////////////////////////
+//
+// Chunk backup
+//
+/////////////////////////////////////////////////////////////////////
+class CChunkBackup
+{
+private:
+    wstring m_repository;
+    CChunkIndex m_index;
+    CChunker m_chunker;
+    CChunkHasher m_hasher;
+    CBufferedWriter m_manifest;
+    CContainerWriter* m_pContainers;
+    BYTE* m_buffer;
+
+    ULONGLONG m_files;
+    ULONGLONG m_directories;
+    ULONGLONG m_bytes;
+    ULONGLONG m_chunks;
+    ULONGLONG m_newChunks;
+    ULONGLONG m_newBytes;
+
+public:
+    CChunkBackup(_In_ const wstring& repository)
+    {
+        m_repository = repository;
+        m_pContainers = NULL;
+        m_buffer = NULL;
+        m_files = 0;
+        m_directories = 0;
+        m_bytes = 0;
+        m_chunks = 0;
+        m_newChunks = 0;
+        m_newBytes = 0;
+    }
+
+    ~CChunkBackup()
+    {
+        delete m_pContainers;
+        delete [] m_buffer;
+    }
+
+    HRESULT Run(_In_ const wstring& source)
+    {
+        ULONGLONG startTime = GetTickCount64();
+
+        HRESULT hr = CreateDirectoryIfMissing(m_repository);
+        if (SUCCEEDED(hr))
+        {
+            hr = CreateDirectoryIfMissing(m_repository + CHUNK_CONTAINERS_FOLDER);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = CreateDirectoryIfMissing(m_repository + CHUNK_MANIFESTS_FOLDER);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_index.Load(m_repository + CHUNK_INDEX_FILE_NAME);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_hasher.Initialize();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            m_buffer = new(nothrow) BYTE[CHUNK_IO_BUFFER_SIZE];
+            m_pContainers = new(nothrow) CContainerWriter(m_repository, m_index.GetNextContainerId());
+            if (m_buffer == NULL || m_pContainers == NULL)
+            {
+                hr = E_OUTOFMEMORY;
+            }
+        }
+
+        // The manifest is written under a temporary name and only renamed once
+        // the containers and the index are on disk, so an interrupted backup
+        // never leaves a manifest that refers to missing chunks
+        wstring manifestPath = BuildManifestPath();
+        wstring temporaryManifestPath = manifestPath + CHUNK_TEMPORARY_EXTENSION;
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_manifest.Create(temporaryManifestPath);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            CHUNK_FILE_HEADER header = { CHUNK_MANIFEST_SIGNATURE, CHUNK_FORMAT_VERSION };
+            hr = m_manifest.Write(&header, sizeof(header));
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = BackupTree(source);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_pContainers->Close();
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = m_index.Save();
+        }
+
+        if (m_manifest.IsOpen())
+        {
+            HRESULT hrClose = m_manifest.Close();
+            if (SUCCEEDED(hr))
+            {
+                hr = hrClose;
+            }
+        }
+
+        if (SUCCEEDED(hr) && !MoveFileEx(temporaryManifestPath.c_str(), manifestPath.c_str(), MOVEFILE_REPLACE_EXISTING))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (FAILED(hr))
+        {
+            wcout << L"Chunk backup failed, hr = 0x" << hex << hr << endl;
+            DeleteFile(temporaryManifestPath.c_str());
+            return hr;
+        }
+
+        ULONGLONG elapsed = max(GetTickCount64() - startTime, 1ULL);
+
+        wcout << L"Backed up " << dec << m_files << L" files and " << m_directories << L" directories to " << manifestPath << endl;
+        wcout << L"  " << m_bytes << L" bytes in " << m_chunks << L" chunks, " <<
+            m_newChunks << L" new chunks (" << m_newBytes << L" bytes) stored" << endl;
+        wcout << L"  " << m_index.GetCount() << L" chunks in the repository" << endl;
+        wcout << L"  " << elapsed << L" ms, " << (m_bytes * 1000 / elapsed) / (1024 * 1024) << L" MB/s" << endl;
+
+        return hr;
+    }
+
+private:
+    wstring BuildManifestPath()
+    {
+        // Names sort by time, so the last one is the latest backup
+        SYSTEMTIME now;
+        GetSystemTime(&now);
+
+        WCHAR name[64];
+        swprintf_s(name, ARRAYSIZE(name), L"\\backup-%04u%02u%02u-%02u%02u%02u%03u.manifest",
+            now.wYear, now.wMonth, now.wDay, now.wHour, now.wMinute, now.wSecond, now.wMilliseconds);
+
+        wstring path = m_repository;
+        path.append(CHUNK_MANIFESTS_FOLDER);
+        path.append(name);
+        return path;
+    }
+
+    HRESULT BackupTree(_In_ const wstring& source)
+    {
+        HRESULT hr = S_OK;
+        vector<ChunkHash> chunks;
+
+        // Directories still to walk, relative to the source. An explicit stack
+        // instead of recursion so deep trees can't overflow the thread stack.
+        vector<wstring> directories;
+        directories.push_back(L"");
+
+        while (SUCCEEDED(hr) && !directories.empty())
+        {
+            wstring relativeDirectory = directories.back();
+            directories.pop_back();
+
+            WIN32_FIND_DATA findData;
+            wstring pattern = source + relativeDirectory;
+            pattern += L"\\*";
+            HANDLE hFind = FindFirstFileEx(pattern.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+            if (hFind == INVALID_HANDLE_VALUE)
+            {
+                wcout << L"Warning: skipping directory " << source << relativeDirectory << L", error " << dec << GetLastError() << endl;
+                continue;
+            }
+
+            do
+            {
+                if (wcscmp(findData.cFileName, L".") == 0 || wcscmp(findData.cFileName, L"..") == 0)
+                {
+                    continue;
+                }
+
+                wstring relativePath = relativeDirectory;
+                relativePath += L'\\';
+                relativePath += findData.cFileName;
+
+                if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+                {
+                    // Don't follow junctions or directory symbolic links, they
+                    // can point anywhere, including back into this tree
+                    if (findData.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT)
+                    {
+                        continue;
+                    }
+
+                    chunks.clear();
+                    hr = WriteEntry(relativePath, findData, 0, chunks);
+                    m_directories++;
+                    directories.push_back(relativePath);
+                }
+                else
+                {
+                    ULONGLONG size = 0;
+                    chunks.clear();
+                    HRESULT hrFile = BackupFileData(source + relativePath, chunks, &size);
+                    if (FAILED(hrFile))
+                    {
+                        // NOTE: Like BackupDirectoryTree this skips files that can't be read,
+                        // but a backup app might handle it differently
+                        wcout << L"Warning: skipping file " << source << relativePath << L", hr = 0x" << hex << hrFile << endl;
+                        if (hrFile == E_OUTOFMEMORY)
+                        {
+                            hr = hrFile;
+                        }
+                        continue;
+                    }
+
+                    hr = WriteEntry(relativePath, findData, size, chunks);
+                    m_files++;
+                }
+            } while (SUCCEEDED(hr) && FindNextFile(hFind, &findData));
+
+            FindClose(hFind);
+        }
+
+        return hr;
+    }
+
+    HRESULT BackupFileData(_In_ const wstring& path, _Inout_ vector<ChunkHash>& chunks, _Out_ ULONGLONG* size)
+    {
+        *size = 0;
+
+        // Reading a deduplicated file through the file system returns its data,
+        // so the repository does not depend on the dedup store of the source
+        HANDLE hFile = ::CreateFile(
+                            path.c_str(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_BACKUP_SEMANTICS,
+                            NULL);
+        if (hFile == INVALID_HANDLE_VALUE)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        HRESULT hr = S_OK;
+        ULONG start = 0;
+        ULONG end = 0;
+        bool endOfFile = false;
+
+        while (SUCCEEDED(hr))
+        {
+            // Keep at least a maximum sized chunk in the buffer so FindBoundary
+            // only stops early at the end of the file
+            if (!endOfFile && end - start < CHUNK_MAX_SIZE)
+            {
+                MoveMemory(m_buffer, m_buffer + start, end - start);
+                end -= start;
+                start = 0;
+
+                while (!endOfFile && end < CHUNK_IO_BUFFER_SIZE)
+                {
+                    DWORD bytesRead = 0;
+                    if (!ReadFile(hFile, m_buffer + end, CHUNK_IO_BUFFER_SIZE - end, &bytesRead, NULL))
+                    {
+                        hr = HRESULT_FROM_WIN32(GetLastError());
+                        break;
+                    }
+
+                    endOfFile = (bytesRead == 0);
+                    end += bytesRead;
+                }
+            }
+
+            if (FAILED(hr) || start == end)
+            {
+                break;
+            }
+
+            ULONG length = m_chunker.FindBoundary(m_buffer + start, min(end - start, CHUNK_MAX_SIZE));
+            hr = StoreChunk(m_buffer + start, length, chunks);
+
+            start += length;
+            *size += length;
+        }
+
+        CloseHandle(hFile);
+
+        return hr;
+    }
+
+    HRESULT StoreChunk(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length, _Inout_ vector<ChunkHash>& chunks)
+    {
+        ChunkHash hash;
+        HRESULT hr = m_hasher.Compute(data, length, &hash);
+
+        if (SUCCEEDED(hr))
+        {
+            ChunkLocation location;
+            if (!m_index.Find(hash, &location))
+            {
+                hr = m_pContainers->Append(data, length, &location);
+                if (SUCCEEDED(hr))
+                {
+                    m_index.Add(hash, location);
+                    m_newChunks++;
+                    m_newBytes += length;
+                }
+            }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            chunks.push_back(hash);
+            m_chunks++;
+            m_bytes += length;
+        }
+
+        return hr;
+    }
+
+    HRESULT WriteEntry(_In_ const wstring& relativePath, _In_ const WIN32_FIND_DATA& findData, _In_ ULONGLONG size, _In_ const vector<ChunkHash>& chunks)
+    {
+        CHUNK_MANIFEST_ENTRY entry = {};
+        entry.attributes = findData.dwFileAttributes;
+        entry.pathLength = (ULONG)relativePath.length();
+        entry.creationTime = findData.ftCreationTime;
+        entry.lastWriteTime = findData.ftLastWriteTime;
+        entry.size = size;
+        entry.chunkCount = chunks.size();
+
+        HRESULT hr = m_manifest.Write(&entry, sizeof(entry));
+        if (SUCCEEDED(hr))
+        {
+            hr = m_manifest.Write(relativePath.c_str(), (ULONG)(entry.pathLength * sizeof(WCHAR)));
+        }
+
+        for (size_t i = 0; SUCCEEDED(hr) && i < chunks.size(); i++)
+        {
+            hr = m_manifest.Write(&chunks[i], sizeof(ChunkHash));
+        }
+
+        return hr;
+    }
+};
+
+HRESULT ChunkBackup(_In_ const wstring& source, _In_ const wstring& repository)
+{
+    wcout << L"Chunk backup of '" << source << L"' to repository '" << repository << L"'" << endl;
+
+    CChunkBackup backup(repository);
+    return backup.Run(source);
+}
+
+/////////////////////////////////////////////////////////////////////
+//
+// Chunk restore
+//
+/////////////////////////////////////////////////////////////////////
+
+HRESULT FindLatestManifest(_In_ const wstring& repository, _Out_ wstring& manifestPath)
+{
+    manifestPath.clear();
+
+    wstring manifests = repository + CHUNK_MANIFESTS_FOLDER;
+    wstring pattern = manifests + CHUNK_MANIFEST_PATTERN;
+    wstring latest;
+
+    WIN32_FIND_DATA findData;
+    HANDLE hFind = FindFirstFile(pattern.c_str(), &findData);
+    if (hFind != INVALID_HANDLE_VALUE)
+    {
+        do
+        {
+            if (_wcsicmp(findData.cFileName, latest.c_str()) > 0)
+            {
+                latest = findData.cFileName;
+            }
+        } while (FindNextFile(hFind, &findData));
+
+        FindClose(hFind);
+    }
+
+    if (latest.empty())
+    {
+        wcout << L"No backups found in repository " << repository << endl;
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+
+    manifestPath = manifests;
+    manifestPath += L'\\';
+    manifestPath += latest;
+    return S_OK;
+}
+
+HRESULT ReadManifest(_In_ const wstring& manifestPath, _Out_ vector<ManifestEntry>& entries)
+{
+    entries.clear();
+
+    HANDLE hFile = ::CreateFile(
+                        manifestPath.c_str(),
+                        GENERIC_READ,
+                        FILE_SHARE_READ,
+                        NULL,
+                        OPEN_EXISTING,
+                        FILE_FLAG_SEQUENTIAL_SCAN,
+                        NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        wcout << L"CreateFile(" << manifestPath << L") failed with error " << dec << GetLastError() << endl;
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    HRESULT hr = S_OK;
+    LARGE_INTEGER fileSize = {};
+    vector<BYTE> contents;
+
+    if (!GetFileSizeEx(hFile, &fileSize))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+    else if ((ULONGLONG)fileSize.QuadPart < sizeof(CHUNK_FILE_HEADER) || (ULONGLONG)fileSize.QuadPart > (size_t)-1)
+    {
+        hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+    }
+    else
+    {
+        contents.resize((size_t)fileSize.QuadPart);
+        for (size_t offset = 0; SUCCEEDED(hr) && offset < contents.size(); )
+        {
+            DWORD bytesRead = 0;
+            DWORD toRead = (DWORD)min(contents.size() - offset, (size_t)CHUNK_IO_BUFFER_SIZE);
+            if (!ReadFile(hFile, &contents[offset], toRead, &bytesRead, NULL))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            else if (bytesRead == 0)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
+            }
+            offset += bytesRead;
+        }
+    }
+
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr))
+    {
+        const CHUNK_FILE_HEADER* header = reinterpret_cast<const CHUNK_FILE_HEADER*>(&contents[0]);
+        if (header->signature != CHUNK_MANIFEST_SIGNATURE || header->version != CHUNK_FORMAT_VERSION)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        }
+    }
+
+    size_t offset = sizeof(CHUNK_FILE_HEADER);
+    while (SUCCEEDED(hr) && offset < contents.size())
+    {
+        size_t remaining = contents.size() - offset;
+        if (remaining < sizeof(CHUNK_MANIFEST_ENTRY))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+            break;
+        }
+
+        ManifestEntry entry;
+        CopyMemory(&entry.entry, &contents[offset], sizeof(CHUNK_MANIFEST_ENTRY));
+        offset += sizeof(CHUNK_MANIFEST_ENTRY);
+        remaining -= sizeof(CHUNK_MANIFEST_ENTRY);
+
+        size_t pathBytes = (size_t)entry.entry.pathLength * sizeof(WCHAR);
+        if (pathBytes > remaining ||
+            entry.entry.chunkCount > (remaining - pathBytes) / sizeof(ChunkHash))
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+            break;
+        }
+
+        entry.path.assign(reinterpret_cast<const WCHAR*>(&contents[offset]), entry.entry.pathLength);
+        offset += pathBytes;
+
+        entry.chunks.resize((size_t)entry.entry.chunkCount);
+        if (!entry.chunks.empty())
+        {
+            CopyMemory(&entry.chunks[0], &contents[offset], entry.chunks.size() * sizeof(ChunkHash));
+            offset += entry.chunks.size() * sizeof(ChunkHash);
+        }
+
+        entries.push_back(entry);
+    }
+
+    if (FAILED(hr))
+    {
+        wcout << L"Unable to read manifest " << manifestPath << L", hr = 0x" << hex << hr << endl;
+    }
+
+    return hr;
+}
+
+struct ChunkRestoreContext
+{
+    const CChunkIndex* pIndex;
+    wstring repository;
+    wstring destination;
+    vector<ManifestEntry> files;
+    volatile LONG nextFile;
+    volatile LONG failedFiles;
+    volatile LONGLONG bytes;
+};
+
+HRESULT RestoreChunkedFile(
+    _In_ ChunkRestoreContext* pContext,
+    _In_ const ManifestEntry& file,
+    _In_ CChunkHasher& hasher,
+    _Inout_ map<ULONG, HANDLE>& containers,
+    _Out_writes_bytes_(CHUNK_MAX_SIZE) BYTE* buffer)
+{
+    wstring path = pContext->destination + file.path;
+
+    HANDLE hFile = ::CreateFile(
+                        path.c_str(),
+                        GENERIC_WRITE,
+                        0,
+                        NULL,
+                        CREATE_ALWAYS,
+                        FILE_FLAG_SEQUENTIAL_SCAN | FILE_FLAG_BACKUP_SEMANTICS,
+                        NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    // Reserve the space up front so the file system can allocate the file in one piece
+    FILE_ALLOCATION_INFO allocation = {};
+    allocation.AllocationSize.QuadPart = (LONGLONG)file.entry.size;
+    SetFileInformationByHandle(hFile, FileAllocationInfo, &allocation, sizeof(allocation));
+
+    HRESULT hr = S_OK;
+
+    for (size_t i = 0; SUCCEEDED(hr) && i < file.chunks.size(); i++)
+    {
+        ChunkLocation location;
+        if (!pContext->pIndex->Find(file.chunks[i], &location) || location.length > CHUNK_MAX_SIZE)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+            break;
+        }
+
+        HANDLE hContainer = INVALID_HANDLE_VALUE;
+        auto it = containers.find(location.containerId);
+        if (it != containers.end())
+        {
+            hContainer = it->second;
+        }
+        else
+        {
+            hContainer = ::CreateFile(
+                                BuildContainerPath(pContext->repository, location.containerId).c_str(),
+                                GENERIC_READ,
+                                FILE_SHARE_READ,
+                                NULL,
+                                OPEN_EXISTING,
+                                FILE_ATTRIBUTE_NORMAL,
+                                NULL);
+            if (hContainer == INVALID_HANDLE_VALUE)
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                break;
+            }
+            containers[location.containerId] = hContainer;
+        }
+
+        hr = ReadAt(hContainer, location.offset, buffer, location.length);
+
+        // Verify the chunk, a damaged container must not silently produce a damaged file
+        ChunkHash hash = {};
+        if (SUCCEEDED(hr))
+        {
+            hr = hasher.Compute(buffer, location.length, &hash);
+        }
+
+        if (SUCCEEDED(hr) && memcmp(hash.bytes, file.chunks[i].bytes, CHUNK_HASH_SIZE) != 0)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_FILE_CORRUPT);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = WriteAll(hFile, buffer, location.length);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            InterlockedExchangeAdd64(&pContext->bytes, location.length);
+        }
+    }
+
+    if (SUCCEEDED(hr) && !SetFileTime(hFile, &file.entry.creationTime, NULL, &file.entry.lastWriteTime))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(hFile);
+
+    if (SUCCEEDED(hr) && (file.entry.attributes & CHUNK_RESTORABLE_ATTRIBUTES) != 0)
+    {
+        SetFileAttributes(path.c_str(), file.entry.attributes & CHUNK_RESTORABLE_ATTRIBUTES);
+    }
+
+    if (FAILED(hr))
+    {
+        // Don't leave a partially restored file behind
+        DeleteFile(path.c_str());
+    }
+
+    return hr;
+}
+
+DWORD WINAPI ChunkRestoreWorker(_In_ LPVOID parameter)
+{
+    ChunkRestoreContext* pContext = static_cast<ChunkRestoreContext*>(parameter);
+    map<ULONG, HANDLE> containers;
+    CChunkHasher hasher;
+
+    HRESULT hr = hasher.Initialize();
+    BYTE* buffer = new(nothrow) BYTE[CHUNK_MAX_SIZE];
+    if (SUCCEEDED(hr) && buffer == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+    }
+
+    // Each worker takes the next file in manifest order until there are none left
+    for (;;)
+    {
+        LONG index = InterlockedIncrement(&pContext->nextFile) - 1;
+        if ((size_t)index >= pContext->files.size())
+        {
+            break;
+        }
+
+        const ManifestEntry& file = pContext->files[index];
+        HRESULT hrFile = SUCCEEDED(hr) ? RestoreChunkedFile(pContext, file, hasher, containers, buffer) : hr;
+        if (FAILED(hrFile))
+        {
+            // wprintf holds the stream lock for the whole line, unlike wcout
+            wprintf(L"Failed to restore file %s%s, hr = 0x%08x\n", pContext->destination.c_str(), file.path.c_str(), hrFile);
+            InterlockedIncrement(&pContext->failedFiles);
+        }
+    }
+
+    for (auto it = containers.begin(); it != containers.end(); ++it)
+    {
+        CloseHandle(it->second);
+    }
+
+    delete [] buffer;
+
+    return 0;
+}
+
+HRESULT ChunkRestore(_In_ const wstring& source, _In_ const wstring& destination)
+{
+    ULONGLONG startTime = GetTickCount64();
+    HRESULT hr = S_OK;
+    wstring repository;
+    wstring manifestPath;
+
+    // The source is either a repository, to restore its latest backup, or a manifest in it
+    DWORD attributes = GetFileAttributes(source.c_str());
+    if (attributes == INVALID_FILE_ATTRIBUTES)
+    {
+        wcout << L"Cannot find " << source << L", error " << dec << GetLastError() << endl;
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (attributes & FILE_ATTRIBUTE_DIRECTORY)
+    {
+        repository = source;
+        hr = FindLatestManifest(repository, manifestPath);
+    }
+    else
+    {
+        manifestPath = source;
+        repository = source.substr(0, source.rfind(L'\\'));
+        repository = repository.substr(0, repository.rfind(L'\\'));
+    }
+
+    wcout << L"Chunk restore of '" << manifestPath << L"' to '" << destination << L"'" << endl;
+
+    CChunkIndex index;
+    vector<ManifestEntry> entries;
+
+    if (SUCCEEDED(hr))
+    {
+        hr = index.Load(repository + CHUNK_INDEX_FILE_NAME);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = ReadManifest(manifestPath, entries);
+    }
+
+    ChunkRestoreContext* pContext = NULL;
+    if (SUCCEEDED(hr))
+    {
+        pContext = new(nothrow) ChunkRestoreContext;
+        if (pContext == NULL)
+        {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    // Directories are created up front, in manifest order so parents come first,
+    // then the files are restored in parallel
+    ULONGLONG directories = 0;
+    if (SUCCEEDED(hr))
+    {
+        pContext->pIndex = &index;
+        pContext->repository = repository;
+        pContext->destination = destination;
+        pContext->nextFile = 0;
+        pContext->failedFiles = 0;
+        pContext->bytes = 0;
+
+        hr = CreateDirectoryIfMissing(destination);
+
+        for (size_t i = 0; SUCCEEDED(hr) && i < entries.size(); i++)
+        {
+            if (entries[i].entry.attributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                hr = CreateDirectoryIfMissing(destination + entries[i].path);
+                directories++;
+            }
+            else
+            {
+                pContext->files.push_back(move(entries[i]));
+            }
+        }
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        SYSTEM_INFO systemInfo;
+        GetSystemInfo(&systemInfo);
+
+        ULONG threadCount = min(CHUNK_RESTORE_MAX_THREADS, (ULONG)systemInfo.dwNumberOfProcessors);
+        threadCount = max(1UL, min(threadCount, (ULONG)pContext->files.size()));
+
+        HANDLE threads[CHUNK_RESTORE_MAX_THREADS] = {};
+        ULONG started = 0;
+        for ( ; started < threadCount; started++)
+        {
+            threads[started] = CreateThread(NULL, 0, ChunkRestoreWorker, pContext, 0, NULL);
+            if (threads[started] == NULL)
+            {
+                break;
+            }
+        }
+
+        if (started == 0)
+        {
+            // Restore on this thread if no worker could be started
+            ChunkRestoreWorker(pContext);
+        }
+        else
+        {
+            WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+            for (ULONG i = 0; i < started; i++)
+            {
+                CloseHandle(threads[i]);
+            }
+        }
+
+        // Restoring the contents changed the directory times, set them last
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (entries[i].entry.attributes & FILE_ATTRIBUTE_DIRECTORY)
+            {
+                wstring path = destination + entries[i].path;
+                HANDLE hDirectory = ::CreateFile(
+                                        path.c_str(),
+                                        FILE_WRITE_ATTRIBUTES,
+                                        FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+                                        NULL,
+                                        OPEN_EXISTING,
+                                        FILE_FLAG_BACKUP_SEMANTICS,
+                                        NULL);
+                if (hDirectory != INVALID_HANDLE_VALUE)
+                {
+                    SetFileTime(hDirectory, &entries[i].entry.creationTime, NULL, &entries[i].entry.lastWriteTime);
+                    CloseHandle(hDirectory);
+                }
+
+                if ((entries[i].entry.attributes & CHUNK_RESTORABLE_ATTRIBUTES) != 0)
+                {
+                    SetFileAttributes(path.c_str(), entries[i].entry.attributes & CHUNK_RESTORABLE_ATTRIBUTES);
+                }
+            }
+        }
+
+        ULONGLONG elapsed = max(GetTickCount64() - startTime, 1ULL);
+        ULONGLONG bytes = (ULONGLONG)pContext->bytes;
+
+        wcout << L"Restored " << dec << pContext->files.size() - pContext->failedFiles << L" files and " <<
+            directories << L" directories using " << threadCount << L" threads" << endl;
+        wcout << L"  " << bytes << L" bytes in " << elapsed << L" ms, " << (bytes * 1000 / elapsed) / (1024 * 1024) << L" MB/s" << endl;
+
+        if (pContext->failedFiles > 0)
+        {
+            wcout << pContext->failedFiles << L" files could not be restored" << endl;
+            hr = E_FAIL;
+        }
+    }
+
+    delete pContext;
+
+    return hr;
+}
@@ -0,0 +1,148 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+
+/////////////////////////////////////////////////////////////////////
+//
+// Content-defined chunking backup format
+//
+// The optimized backup in DedupBackupRestore.cpp relies on the dedup
+// store of the source volume, so the backup itself is not deduplicated
+// and every full backup stores all of the data again. This format does
+// its own deduplication and works on any directory, on any volume.
+//
+// Files are split into variable sized chunks at positions picked by a
+// rolling hash of the content, so inserting data into a file only
+// changes the chunks around the insertion. Every chunk is identified by
+// its SHA-256 hash and stored only once. A repository looks like this:
+//
+//   <repository>\chunkIndex.dat           chunk hash -> container location
+//   <repository>\containers\NNNNNNNN.dat   packed chunk data
+//   <repository>\manifests\*.manifest      one per backup, files and their chunks
+//
+/////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include <windows.h>
+#include <bcrypt.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+const ULONG CHUNK_HASH_SIZE = 32;
+const ULONG CHUNK_MIN_SIZE = 16 * 1024;
+const ULONG CHUNK_MAX_SIZE = 256 * 1024;
+
+// A boundary is declared when this many bits of the rolling hash are zero,
+// which gives chunks of about 64KB past the minimum size
+const ULONG CHUNK_BOUNDARY_BITS = 16;
+
+struct ChunkHash
+{
+    BYTE bytes[CHUNK_HASH_SIZE];
+};
+
+struct ChunkLocation
+{
+    ULONG containerId;
+    ULONG length;
+    ULONGLONG offset;
+};
+
+// On disk format of the chunk index, after a CHUNK_FILE_HEADER
+struct ChunkIndexRecord
+{
+    ChunkHash hash;
+    ChunkLocation location;
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// Finds content-defined chunk boundaries with a gear rolling hash
+//
+/////////////////////////////////////////////////////////////////////
+class CChunker
+{
+public:
+    CChunker();
+
+    // Returns the length of the chunk that starts at data. The caller must pass
+    // CHUNK_MAX_SIZE bytes, or everything that is left at the end of the file.
+    ULONG FindBoundary(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length) const;
+
+private:
+    UINT64 m_gear[256];
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// Computes chunk IDs. Not thread safe, use one instance per thread.
+//
+/////////////////////////////////////////////////////////////////////
+class CChunkHasher
+{
+public:
+    CChunkHasher();
+    ~CChunkHasher();
+
+    HRESULT Initialize();
+    HRESULT Compute(_In_reads_bytes_(length) const BYTE* data, _In_ ULONG length, _Out_ ChunkHash* hash);
+
+private:
+    BCRYPT_ALG_HANDLE m_algorithm;
+    BCRYPT_HASH_HANDLE m_hash;
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// In memory copy of the chunk index of a repository. Chunks added
+// during a backup are appended to the index file by Save.
+//
+/////////////////////////////////////////////////////////////////////
+class CChunkIndex
+{
+public:
+    CChunkIndex();
+
+    HRESULT Load(_In_ const std::wstring& path);
+    HRESULT Save();
+
+    bool Find(_In_ const ChunkHash& hash, _Out_ ChunkLocation* location) const;
+    void Add(_In_ const ChunkHash& hash, _In_ const ChunkLocation& location);
+
+    size_t GetCount() const { return m_chunks.size(); }
+    ULONG GetNextContainerId() const { return m_nextContainerId; }
+
+private:
+    struct ChunkHashHasher
+    {
+        size_t operator()(_In_ const ChunkHash& hash) const
+        {
+            // The hash is already uniformly distributed, any part of it will do
+            size_t value;
+            memcpy(&value, hash.bytes, sizeof(value));
+            return value;
+        }
+    };
+
+    struct ChunkHashEqual
+    {
+        bool operator()(_In_ const ChunkHash& left, _In_ const ChunkHash& right) const
+        {
+            return memcmp(left.bytes, right.bytes, CHUNK_HASH_SIZE) == 0;
+        }
+    };
+
+    std::wstring m_path;
+    std::unordered_map<ChunkHash, ChunkLocation, ChunkHashHasher, ChunkHashEqual> m_chunks;
+    std::vector<ChunkIndexRecord> m_pending;
+    ULONGLONG m_savedRecords;
+    ULONG m_nextContainerId;
+};
+
+HRESULT ChunkBackup(_In_ const std::wstring& source, _In_ const std::wstring& repository);
+HRESULT ChunkRestore(_In_ const std::wstring& source, _In_ const std::wstring& destination);
@@ -11,6 +11,7 @@
 //   1. Optimized backup
 //   2. Selective restore from optimized backup
 //   3. Full volume restore from optimized backup
+//   4. Content-defined chunking backup and restore (see ChunkStore.h)
 //
 /////////////////////////////////////////////////////////////////////
 
@@ -31,6 +32,7 @@
 #include <comutil.h>
 #include <wbemtime.h>
 #include <winevt.h>
+#include "ChunkStore.h"
 
 using namespace std;
 
@@ -50,6 +52,12 @@ const PCWSTR DEDUP_STORE_FOLDERS[DEDUP_STORE_FOLDERS_COUNT] =
         L"\\State"
     };
 
+// Each copy worker owns two buffers of this size, one being filled while
+// the other one is written. Large sequential transfers keep both the
+// volume and the backup medium busy.
+const DWORD COPY_BUFFER_SIZE = 1024 * 1024;
+const ULONG COPY_WORKER_COUNT = 8;
+
 // WMI constants from Data Deduplication MOF schema
 const PCWSTR CIM_V2_NAMESPACE = L"root\\cimv2";
 const PCWSTR CIM_DEDUP_NAMESPACE = L"root\\Microsoft\\Windows\\Deduplication";
@@ -95,7 +103,9 @@ enum Action
     RestoreDataAction,
     RestoreFileAction,
     RestoreVolumeAction,
-    RestoreFilesAction
+    RestoreFilesAction,
+    ChunkBackupAction,
+    ChunkRestoreAction
 };
 
 HRESULT RestoreVolume(_In_ const wstring& source, _In_ const wstring& destination);
@@ -113,11 +123,13 @@ HRESULT RestoreStub(_In_ const wstring& source, _In_ const wstring& destination)
 HRESULT RestoreData(_In_ const wstring& source, _In_ const wstring& destination);
 HRESULT RestoreFilesData(_In_ const wstring& source, _In_ vector<wstring>& restoredFiles);
 
-HRESULT BackupFile(_In_ const wstring& source, _In_ const wstring& destination);
-HRESULT BackupDirectory(_In_ const wstring& source, _In_ const wstring& destination);
+class CPipelinedCopier;
+
+HRESULT BackupFile(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ CPipelinedCopier* pCopier = NULL);
+HRESULT BackupDirectory(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ CPipelinedCopier* pCopier = NULL);
 void BackupDirectoryTree(_In_ const wstring& source, _In_ const wstring& destination);
-HRESULT RestoreFile(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ bool overWriteExisting = false);
-HRESULT RestoreDirectory(_In_ const wstring& source, _In_ const wstring& destination);
+HRESULT RestoreFile(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ bool overWriteExisting = false, _In_opt_ CPipelinedCopier* pCopier = NULL);
+HRESULT RestoreDirectory(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ CPipelinedCopier* pCopier = NULL);
 HRESULT RestoreDedupStoreDirectories(_In_ const wstring& source, _In_ const wstring& destination);
 HRESULT RestoreDedupStore(_In_ const wstring& source, _In_ const wstring& destination);
 HRESULT RestoreFiles(_In_ const wstring& source, _In_ const wstring& destination, _In_ const bool isVolumeRestore, _Out_opt_ vector<wstring>* pRestoredFiles);
@@ -229,8 +241,7 @@ public:
         if (hFile == INVALID_HANDLE_VALUE)
         {
             hr = HRESULT_FROM_WIN32(GetLastError());
-            wcout << L"Cannot open file " << filePath << 
-                L". Did we back it up? Error: " << GetLastError() << endl;
+            wprintf(L"Cannot open file %s. Did we back it up? Error: %u\n", filePath.c_str(), GetLastError());
         }
         else 
         {
@@ -252,8 +263,7 @@ public:
 
                 if (!ReadFile(hFile, FileBuffer, SizeToRead, ReturnedSize, &overlapped))
                 {
-                    wcout << L"Cannot read from file " << filePath << 
-                        L". Did we back it up? gle= " << GetLastError() << endl;
+                    wprintf(L"Cannot read from file %s. Did we back it up? gle= %u\n", filePath.c_str(), GetLastError());
                     hr = HRESULT_FROM_WIN32(GetLastError());
                 }
             }
@@ -361,8 +371,7 @@ private:
                 if (!ReadFile(hFile, &streamId, FIELD_OFFSET(WIN32_STREAM_ID, cStreamName), &bytesRead, NULL) ||
                     bytesRead != FIELD_OFFSET(WIN32_STREAM_ID, cStreamName))
                 {
-                    wcout << "Cannot find the data stream in file. Did you use something other than BackupRead? Error: " << 
-                        GetLastError() << endl;
+                    wprintf(L"Cannot find the data stream in file. Did you use something other than BackupRead? Error: %u\n", GetLastError());
                     return E_UNEXPECTED;
                 }
             }
@@ -1477,6 +1486,12 @@ int __cdecl _tmain(_In_ int argc, _In_reads_(argc) _TCHAR* argv[])
             case RestoreVolumeAction:
                 hr = RestoreVolume(source, destination);
                 break;
+            case ChunkBackupAction:
+                hr = ChunkBackup(TrimTrailingSeparator(source, L'\\'), TrimTrailingSeparator(destination, L'\\'));
+                break;
+            case ChunkRestoreAction:
+                hr = ChunkRestore(TrimTrailingSeparator(source, L'\\'), TrimTrailingSeparator(destination, L'\\'));
+                break;
             case RestoreFilesAction:
                 vector<wstring> restoredFiles;
                 hr = RestoreFiles(source, destination, false, &restoredFiles);
@@ -1514,85 +1529,694 @@ wstring BuildDedupStorePath(_In_ const wstring& volume)
 
 /////////////////////////////////////////////////////////////////////
 //
-// Backup related methods
+// Pipelined file copy
+//
+// Copies one file between the volume and the backup medium. The medium
+// side uses overlapped I/O on two page aligned buffers, so that while
+// BackupRead or BackupWrite works on one buffer the medium is written
+// or read with the other. Each worker thread owns one copier.
+//
+// The copiers run on several threads at once, so they report errors
+// with a single wprintf call each: the CRT locks the stream for the
+// whole call, and there is no shared formatting state like wcout's hex.
 //
 /////////////////////////////////////////////////////////////////////
-
-HRESULT BackupFile(_In_ const wstring& source, _In_ const wstring& destination)
+class CPipelinedCopier
 {
-    // Open the source file
-    HANDLE hSourceFile = ::CreateFile(
-                        source.c_str(),
-                        GENERIC_READ,
-                        FILE_SHARE_READ,
-                        NULL,
-                        OPEN_EXISTING,
-                        FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
-                        NULL);
-    if (hSourceFile == INVALID_HANDLE_VALUE) 
-    {
-        wcout << L"CreateFile(" << source << L" failed with error " << GetLastError() << endl;
-        return HRESULT_FROM_WIN32(GetLastError());
-    }
-
-    // Open the backup medium
-    // in this example the medium is another file, but it could be tape, network server, etc...
-    HANDLE hDestinationFile = ::CreateFile(
-                        destination.c_str(),
-                        GENERIC_WRITE,
-                        FILE_SHARE_READ,
-                        NULL,
-                        CREATE_ALWAYS,
-                        FILE_FLAG_BACKUP_SEMANTICS,
-                        NULL);
-    if (hDestinationFile == INVALID_HANDLE_VALUE) 
-    {
-        wcout << L"CreateFile(" << destination << L") failed with error " << GetLastError() << endl;
-        return HRESULT_FROM_WIN32(GetLastError());
-    }
-
-    // 4k is the default NTFS cluster size, and small enough to fit into the stack
-    // we could also readk 8k if we can afford the extra stack cost or allocate a heap buffer
-    // and read 64k or more
-    const DWORD DEFAULT_BUFFER_SIZE = 4086;  
-    DWORD bytesRead = 0, bytesWritten = 0;
-    BYTE buffer[DEFAULT_BUFFER_SIZE];
-    LPVOID context = NULL;
-    HRESULT hr = S_OK;
+private:
+    BYTE* m_buffers[2];
+    HANDLE m_event;
+    ULONGLONG m_bytesCopied;
+
+public:
+    CPipelinedCopier()
+    {
+        m_buffers[0] = NULL;
+        m_buffers[1] = NULL;
+        m_event = NULL;
+        m_bytesCopied = 0;
+    }
 
-    // Read 4k at a time. BackupRead will return attributes, security, and reparse point information
-    while (BackupRead(hSourceFile, buffer, DEFAULT_BUFFER_SIZE, &bytesRead, FALSE, TRUE, &context) && bytesRead > 0)
+    ~CPipelinedCopier()
     {
-        // Save the data describing the source file to the destination medium.
-        // we do a write file here, but if this would be a network server you could send on a socket
-        if (!WriteFile(hDestinationFile, buffer, bytesRead, &bytesWritten, NULL))
+        if (m_buffers[0] != NULL)
+        {
+            VirtualFree(m_buffers[0], 0, MEM_RELEASE);
+        }
+
+        if (m_event != NULL)
+        {
+            CloseHandle(m_event);
+        }
+    }
+
+    HRESULT Initialize()
+    {
+        // One allocation for both buffers, VirtualAlloc memory is page aligned
+        m_buffers[0] = (BYTE*)VirtualAlloc(NULL, 2 * COPY_BUFFER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (m_buffers[0] == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+        m_buffers[1] = m_buffers[0] + COPY_BUFFER_SIZE;
+
+        m_event = CreateEvent(NULL, TRUE, FALSE, NULL);
+        if (m_event == NULL)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        return S_OK;
+    }
+
+    ULONGLONG GetBytesCopied() const
+    {
+        return m_bytesCopied;
+    }
+
+    HRESULT Backup(_In_ const wstring& source, _In_ const wstring& destination)
+    {
+        // Open the source file
+        HANDLE hSourceFile = ::CreateFile(
+                            source.c_str(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
+                            NULL);
+        if (hSourceFile == INVALID_HANDLE_VALUE) 
+        {
+            wprintf(L"CreateFile(%s) failed with error %u\n", source.c_str(), GetLastError());
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        // Open the backup medium
+        // in this example the medium is another file, but it could be tape, network server, etc...
+        HANDLE hDestinationFile = ::CreateFile(
+                            destination.c_str(),
+                            GENERIC_WRITE,
+                            FILE_SHARE_READ,
+                            NULL,
+                            CREATE_ALWAYS,
+                            FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL);
+        if (hDestinationFile == INVALID_HANDLE_VALUE) 
+        {
+            wprintf(L"CreateFile(%s) failed with error %u\n", destination.c_str(), GetLastError());
+            HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+            CloseHandle(hSourceFile);
+            return hr;
+        }
+
+        HRESULT hr = S_OK;
+        LPVOID context = NULL;
+        OVERLAPPED overlapped = {};
+        bool writePending = false;
+        DWORD pendingLength = 0;
+        ULONGLONG offset = 0;
+        ULONG current = 0;
+
+        for (;;)
+        {
+            // Fill one buffer while the other one is being written. BackupRead will
+            // return attributes, security, and reparse point information
+            DWORD bytesRead = 0;
+            if (!BackupRead(hSourceFile, m_buffers[current], COPY_BUFFER_SIZE, &bytesRead, FALSE, TRUE, &context))
+            {
+                wprintf(L"BackupRead(%s) failed with error %u\n", source.c_str(), GetLastError());
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            if (writePending)
+            {
+                HRESULT hrWrite = WaitIo(hDestinationFile, &overlapped, pendingLength);
+                if (FAILED(hrWrite) && SUCCEEDED(hr))
+                {
+                    wprintf(L"WriteFile(%s) failed, hr = 0x%x\n", destination.c_str(), hrWrite);
+                    hr = hrWrite;
+                }
+                writePending = false;
+            }
+
+            if (FAILED(hr) || bytesRead == 0)
+            {
+                break;
+            }
+
+            // Save the data describing the source file to the destination medium.
+            // we do a write file here, but if this would be a network server you could send on a socket
+            hr = StartIo(hDestinationFile, true, m_buffers[current], bytesRead, offset, &overlapped);
+            if (FAILED(hr))
+            {
+                wprintf(L"WriteFile(%s) failed, hr = 0x%x\n", destination.c_str(), hr);
+                break;
+            }
+
+            writePending = true;
+            pendingLength = bytesRead;
+            offset += bytesRead;
+            m_bytesCopied += bytesRead;
+            current = 1 - current;
+        }
+
+        // Call BackupRead one more time to clean up the context
+        BackupRead(hSourceFile, NULL, 0, NULL, TRUE, TRUE, &context);
+
+        // Close the source file
+        CloseHandle(hSourceFile);
+
+        // Close the backup medium
+        CloseHandle(hDestinationFile);
+
+        return hr;
+    }
+
+    HRESULT Restore(_In_ const wstring& source, _In_ const wstring& destination, _In_ bool overWriteExisting)
+    {
+        // Create destination dir if it doesn't exist
+        size_t lastSeparator = destination.rfind('\\');
+        if (lastSeparator == wstring::npos) 
+        {
+            wprintf(L"destination is not a file path\n");
+            return E_UNEXPECTED;
+        }
+        wstring destinationLocation = destination.substr(0, lastSeparator);
+        ::CreateDirectory(destinationLocation.c_str(), NULL);
+
+        // Open the backup medium
+        // In this example the medium is another file, but it could be tape, network server, etc...
+        HANDLE hSourceFile = ::CreateFile(
+                            source.c_str(),
+                            GENERIC_READ,
+                            FILE_SHARE_READ,
+                            NULL,
+                            OPEN_EXISTING,
+                            FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS | FILE_FLAG_OVERLAPPED | FILE_FLAG_SEQUENTIAL_SCAN,
+                            NULL);
+        if (hSourceFile == INVALID_HANDLE_VALUE) 
+        {
+            wprintf(L"CreateFile(%s) failed with error %u\n", source.c_str(), GetLastError());
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        // Open the file to be restored
+        HANDLE hDestinationFile = ::CreateFile(
+                            destination.c_str(),
+                            GENERIC_WRITE | WRITE_OWNER | WRITE_DAC,
+                            FILE_SHARE_READ,
+                            NULL,
+                            overWriteExisting ? OPEN_EXISTING : CREATE_ALWAYS,
+                            FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
+                            NULL);
+        if (hDestinationFile == INVALID_HANDLE_VALUE) 
+        {
+            wprintf(L"CreateFile(%s) failed with error %u\n", destination.c_str(), GetLastError());
+            HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+            CloseHandle(hSourceFile);
+            return hr;
+        }
+
+        HRESULT hr = S_OK;
+        LPVOID context = NULL;
+        OVERLAPPED overlapped = {};
+        bool readPending = false;
+        ULONGLONG readOffset = 0;
+        ULONG current = 0;
+
+        // Reads are only issued below the end of the file, so none of them
+        // has to deal with end of file errors
+        LARGE_INTEGER sourceSize = {};
+        if (!GetFileSizeEx(hSourceFile, &sourceSize))
         {
-            wcout << L"WriteFile(" << destination << L") failed with error " << GetLastError() << endl;
             hr = HRESULT_FROM_WIN32(GetLastError());
-            break;
         }
 
-        if (bytesRead != bytesWritten) 
+        if (SUCCEEDED(hr) && sourceSize.QuadPart > 0)
         {
-            wcout << L"WriteFile(" << destination << L") unexpectedly wrote less bytes than expected (expected:" << bytesRead << L" written:" << bytesWritten << L")" << endl;
-            hr = E_UNEXPECTED;
-            break;
+            DWORD length = (DWORD)min((ULONGLONG)sourceSize.QuadPart, (ULONGLONG)COPY_BUFFER_SIZE);
+            hr = StartIo(hSourceFile, false, m_buffers[current], length, readOffset, &overlapped);
+            readPending = SUCCEEDED(hr);
+            readOffset += length;
+        }
+
+        while (SUCCEEDED(hr) && readPending)
+        {
+            DWORD bytesRead = 0;
+            readPending = false;
+            hr = WaitIo(hSourceFile, &overlapped, 0, &bytesRead);
+            if (FAILED(hr) || bytesRead == 0)
+            {
+                break;
+            }
+
+            // Read the next part of the backup medium while this one is restored
+            if (readOffset < (ULONGLONG)sourceSize.QuadPart)
+            {
+                DWORD length = (DWORD)min((ULONGLONG)sourceSize.QuadPart - readOffset, (ULONGLONG)COPY_BUFFER_SIZE);
+                hr = StartIo(hSourceFile, false, m_buffers[1 - current], length, readOffset, &overlapped);
+                readPending = SUCCEEDED(hr);
+                readOffset += length;
+            }
+
+            // Call BackupWrite to restore the file, including security, attributes and reparse point
+            DWORD bytesWritten = 0;
+            if (SUCCEEDED(hr) && !BackupWrite(hDestinationFile, m_buffers[current], bytesRead, &bytesWritten, FALSE, TRUE, &context))
+            {
+                wprintf(L"BackupWrite(%s) failed with error %u\n", destination.c_str(), GetLastError());
+                hr = HRESULT_FROM_WIN32(GetLastError());
+            }
+            else if (SUCCEEDED(hr) && bytesRead != bytesWritten) 
+            {
+                wprintf(L"BackupWrite(%s) unexpectedly wrote less bytes than expected (expected:%u written:%u)\n", destination.c_str(), bytesRead, bytesWritten);
+                hr = E_UNEXPECTED;
+            }
+
+            m_bytesCopied += bytesRead;
+            current = 1 - current;
         }
+
+        if (FAILED(hr))
+        {
+            wprintf(L"Restoring %s failed, hr = 0x%x\n", destination.c_str(), hr);
+        }
+
+        if (readPending)
+        {
+            // The read still owns the buffer, wait for it before it can be reused
+            CancelIoEx(hSourceFile, &overlapped);
+            DWORD ignored = 0;
+            GetOverlappedResult(hSourceFile, &overlapped, &ignored, TRUE);
+        }
+
+        // Call BackupWrite one more time to clean up the context
+        BackupWrite(hDestinationFile, NULL, 0, NULL, TRUE, TRUE, &context);
+
+        // Close the backup medium
+        CloseHandle(hSourceFile);
+
+        // Close the destination file
+        CloseHandle(hDestinationFile);
+
+        return hr;
     }
 
-    // Call BackupRead one more time to clean up the context
-    BackupRead(hSourceFile, NULL, 0, NULL, TRUE, TRUE, &context);
+private:
+    HRESULT StartIo(_In_ HANDLE hFile, _In_ bool write, _In_ BYTE* buffer, _In_ DWORD length, _In_ ULONGLONG offset, _Out_ OVERLAPPED* pOverlapped)
+    {
+        ZeroMemory(pOverlapped, sizeof(OVERLAPPED));
+        pOverlapped->Offset = (DWORD)offset;
+        pOverlapped->OffsetHigh = (DWORD)(offset >> 32);
+        pOverlapped->hEvent = m_event;
+
+        BOOL result = write ?
+            WriteFile(hFile, buffer, length, NULL, pOverlapped) :
+            ReadFile(hFile, buffer, length, NULL, pOverlapped);
+        if (!result && GetLastError() != ERROR_IO_PENDING)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
 
-    // Close the source file
-    CloseHandle(hSourceFile);
+        return S_OK;
+    }
 
-    // Close the backup medium
-    CloseHandle(hDestinationFile);
+    HRESULT WaitIo(_In_ HANDLE hFile, _In_ OVERLAPPED* pOverlapped, _In_ DWORD expectedLength, _Out_opt_ DWORD* pTransferred = NULL)
+    {
+        DWORD transferred = 0;
+        if (!GetOverlappedResult(hFile, pOverlapped, &transferred, TRUE))
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        if (pTransferred != NULL)
+        {
+            *pTransferred = transferred;
+        }
+        else if (transferred != expectedLength)
+        {
+            // Writes must complete in full
+            return E_UNEXPECTED;
+        }
+
+        return S_OK;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// Parallel tree copy
+//
+// Backs up or restores a directory tree with a bounded pool of worker
+// threads taking directories and files from a shared queue. A directory
+// is created, and its metadata copied, before its contents are queued,
+// so nothing is ever copied into a directory that doesn't exist yet.
+// Run returns only when the whole tree is done, which keeps the ordering
+// callers rely on: the dedup store is restored before any file, and all
+// stubs are restored before RestoreFilesData restores their data.
+//
+/////////////////////////////////////////////////////////////////////
+class CParallelTreeCopy
+{
+private:
+    struct WorkItem
+    {
+        wstring source;
+        wstring destination;
+    };
+
+    bool m_isRestore;
+    const vector<wstring>* m_pExcludePaths;
+    vector<wstring>* m_pRestoredFiles;
+
+    CRITICAL_SECTION m_lock;
+    CONDITION_VARIABLE m_workChanged;
+    vector<WorkItem> m_files;
+    vector<WorkItem> m_directories;
+    ULONG m_activeWorkers;
+    HRESULT m_hr;
+
+    ULONGLONG m_fileCount;
+    ULONGLONG m_directoryCount;
+    ULONGLONG m_bytesCopied;
+
+public:
+    CParallelTreeCopy(_In_ bool isRestore, _In_opt_ const vector<wstring>* pExcludePaths, _Inout_opt_ vector<wstring>* pRestoredFiles)
+    {
+        m_isRestore = isRestore;
+        m_pExcludePaths = pExcludePaths;
+        m_pRestoredFiles = pRestoredFiles;
+        m_activeWorkers = 0;
+        m_hr = S_OK;
+        m_fileCount = 0;
+        m_directoryCount = 0;
+        m_bytesCopied = 0;
+
+        InitializeCriticalSection(&m_lock);
+        InitializeConditionVariable(&m_workChanged);
+    }
+
+    ~CParallelTreeCopy()
+    {
+        DeleteCriticalSection(&m_lock);
+    }
+
+    HRESULT Run(_In_ const wstring& source, _In_ const wstring& destination)
+    {
+        ULONGLONG startTime = GetTickCount64();
+
+        WorkItem root = { source, destination };
+        m_directories.push_back(root);
+
+        HANDLE threads[COPY_WORKER_COUNT];
+        ULONG started = 0;
+        for ( ; started < COPY_WORKER_COUNT; started++)
+        {
+            threads[started] = CreateThread(NULL, 0, WorkerThread, this, 0, NULL);
+            if (threads[started] == NULL)
+            {
+                break;
+            }
+        }
+
+        if (started == 0)
+        {
+            // Copy on this thread if no worker could be started
+            Worker();
+        }
+        else
+        {
+            WaitForMultipleObjects(started, threads, TRUE, INFINITE);
+            for (ULONG i = 0; i < started; i++)
+            {
+                CloseHandle(threads[i]);
+            }
+        }
+
+        ULONGLONG elapsed = max(GetTickCount64() - startTime, 1ULL);
+        wcout << (m_isRestore ? L"Restored " : L"Backed up ") << dec << m_fileCount << L" files and " <<
+            m_directoryCount << L" directories from " << source << endl;
+        wcout << L"  " << m_bytesCopied / (1024 * 1024) << L" MB in " << elapsed << L" ms, " <<
+            m_fileCount * 1000 / elapsed << L" files/s, " <<
+            (m_bytesCopied * 1000 / elapsed) / (1024 * 1024) << L" MB/s" << endl;
+
+        return m_hr;
+    }
+
+private:
+    static DWORD WINAPI WorkerThread(_In_ LPVOID parameter)
+    {
+        static_cast<CParallelTreeCopy*>(parameter)->Worker();
+        return 0;
+    }
+
+    void Worker()
+    {
+        CPipelinedCopier copier;
+        HRESULT hr = copier.Initialize();
+
+        WorkItem item;
+        bool isDirectory = false;
+        vector<WorkItem> files;
+        vector<WorkItem> directories;
+
+        while (SUCCEEDED(hr) && TakeWork(&item, &isDirectory))
+        {
+            files.clear();
+            directories.clear();
+
+            HRESULT hrItem = isDirectory ?
+                CopyDirectoryItem(item, copier, files, directories) :
+                CopyFileItem(item, copier);
+
+            FinishWork(files, directories, isDirectory, hrItem);
+        }
+
+        EnterCriticalSection(&m_lock);
+        if (FAILED(hr) && SUCCEEDED(m_hr))
+        {
+            m_hr = hr;
+            WakeAllConditionVariable(&m_workChanged);
+        }
+        m_bytesCopied += copier.GetBytesCopied();
+        LeaveCriticalSection(&m_lock);
+    }
+
+    bool TakeWork(_Out_ WorkItem* pItem, _Out_ bool* pIsDirectory)
+    {
+        EnterCriticalSection(&m_lock);
+
+        // Wait while other workers may still queue more work
+        while (SUCCEEDED(m_hr) && m_files.empty() && m_directories.empty() && m_activeWorkers > 0)
+        {
+            SleepConditionVariableCS(&m_workChanged, &m_lock, INFINITE);
+        }
+
+        bool haveWork = SUCCEEDED(m_hr) && (!m_files.empty() || !m_directories.empty());
+        if (haveWork)
+        {
+            // Files first, so the queue stays short while directories keep feeding it
+            *pIsDirectory = m_files.empty();
+            vector<WorkItem>& queue = *pIsDirectory ? m_directories : m_files;
+            *pItem = queue.back();
+            queue.pop_back();
+            m_activeWorkers++;
+        }
+        else
+        {
+            // Done or failed, let the other workers see it too
+            WakeAllConditionVariable(&m_workChanged);
+        }
+
+        LeaveCriticalSection(&m_lock);
+
+        return haveWork;
+    }
+
+    void FinishWork(_In_ const vector<WorkItem>& files, _In_ const vector<WorkItem>& directories, _In_ bool isDirectory, _In_ HRESULT hr)
+    {
+        EnterCriticalSection(&m_lock);
+
+        m_files.insert(m_files.end(), files.begin(), files.end());
+        m_directories.insert(m_directories.end(), directories.begin(), directories.end());
+        m_activeWorkers--;
+
+        if (hr == S_OK)
+        {
+            if (isDirectory)
+            {
+                m_directoryCount++;
+            }
+            else
+            {
+                m_fileCount++;
+            }
+        }
+        else if (FAILED(hr) && SUCCEEDED(m_hr))
+        {
+            m_hr = hr;
+        }
+
+        if (!files.empty() || !directories.empty() || m_activeWorkers == 0 || FAILED(m_hr))
+        {
+            WakeAllConditionVariable(&m_workChanged);
+        }
+
+        LeaveCriticalSection(&m_lock);
+    }
+
+    // Returns S_FALSE for a directory that was skipped
+    HRESULT CopyDirectoryItem(_In_ const WorkItem& item, _In_ CPipelinedCopier& copier, _Inout_ vector<WorkItem>& files, _Inout_ vector<WorkItem>& directories)
+    {
+        HRESULT hr = S_OK;
+
+        if (m_isRestore)
+        {
+            // Check for exclusion
+            for (size_t index = 0; m_pExcludePaths != NULL && index < m_pExcludePaths->size(); index++)
+            {
+                if (wcscmp(item.source.c_str(), (*m_pExcludePaths)[index].c_str()) == 0)
+                {
+                    return S_FALSE;
+                }
+            }
+
+            // Restore the directory
+            hr = RestoreDirectory(item.source, item.destination, &copier);
+            if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_FILE_EXISTS) && hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED))
+            {
+                return hr;
+            }
+            hr = S_OK;
+        }
+        else
+        {
+            // Backup the directory, its contents can't be backed up without it
+            hr = BackupDirectory(item.source, item.destination, &copier);
+            if (FAILED(hr))
+            {
+                return S_FALSE;
+            }
+        }
+
+        wstring trimmedSource = TrimTrailingSeparator(item.source, L'\\');
+
+        // Walk through all the files and subdirectories
+        WIN32_FIND_DATA findData;
+        wstring pattern = trimmedSource;
+        pattern += L"\\*";
+        HANDLE hFind = FindFirstFileEx(pattern.c_str(), FindExInfoBasic, &findData, FindExSearchNameMatch, NULL, FIND_FIRST_EX_LARGE_FETCH);
+        if (hFind != INVALID_HANDLE_VALUE)
+        {
+            do 
+            {
+                // If not . or ..
+                if (wcscmp(findData.cFileName, L".") == 0 || wcscmp(findData.cFileName, L"..") == 0)
+                {
+                    continue;
+                }
+
+                WorkItem child;
+                child.source = trimmedSource;
+                child.source += '\\';
+                child.source += findData.cFileName;
+                child.destination = item.destination;
+                child.destination += '\\';
+                child.destination += findData.cFileName;
+
+                if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) 
+                {
+                    directories.push_back(child);
+                }
+                else if (m_isRestore &&
+                         ((_wcsicmp(findData.cFileName, DIRECTORY_BACKUP_FILE) == 0) ||
+                          (_wcsicmp(findData.cFileName, BACKUP_METADATA_FILE_NAME) == 0)))
+                {
+                    // This file is backup metadata, not original volume data
+                    continue;
+                }
+                else
+                {
+                    files.push_back(child);
+                }
+            } while (FindNextFile(hFind, &findData));
+
+            FindClose(hFind);
+        }
+
+        return hr;
+    }
+
+    // Returns S_FALSE for a file that was skipped
+    HRESULT CopyFileItem(_In_ const WorkItem& item, _In_ CPipelinedCopier& copier)
+    {
+        if (!m_isRestore)
+        {
+            // Do BackupRead and backup the file
+            HRESULT hr = BackupFile(item.source, item.destination, &copier);
+            if (FAILED(hr))
+            {
+                // NOTE: This code ignores BackupFile errors,
+                // but a backup app might handle it differently
+                wprintf(L"BackupFile failed, hr = 0x%x\n", hr);
+                return S_FALSE;
+            }
+
+            return S_OK;
+        }
+
+        // Restore the file
+        HRESULT hr = RestoreFile(item.source, item.destination, false, &copier);
+        if (FAILED(hr))
+        {
+            if (hr == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) || hr == HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION))
+            {
+                // Some files may be in busy, protected by a filter, etc.
+                // An online restore may not be able to replace every file
+                wprintf(L"Warning: continuing restore after RestoreFile failed, hr = 0x%x\n", hr);
+                hr = S_FALSE;
+            }
+            else
+            {
+                wprintf(L"RestoreFile failed, hr = 0x%x\n", hr);
+                return hr;
+            }
+        }
+
+        if (m_pRestoredFiles != NULL)
+        {
+            EnterCriticalSection(&m_lock);
+            m_pRestoredFiles->push_back(item.destination);
+            LeaveCriticalSection(&m_lock);
+        }
+
+        return hr;
+    }
+};
+
+/////////////////////////////////////////////////////////////////////
+//
+// Backup related methods
+//
+/////////////////////////////////////////////////////////////////////
+
+HRESULT BackupFile(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ CPipelinedCopier* pCopier)
+{
+    if (pCopier != NULL)
+    {
+        return pCopier->Backup(source, destination);
+    }
+
+    CPipelinedCopier copier;
+    HRESULT hr = copier.Initialize();
+    if (SUCCEEDED(hr))
+    {
+        hr = copier.Backup(source, destination);
+    }
 
     return hr;
 }
 
-HRESULT BackupDirectory(_In_ const wstring& source, _In_ const wstring& destination)
+HRESULT BackupDirectory(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ CPipelinedCopier* pCopier)
 {
     HRESULT hr = S_OK;
 
@@ -1602,7 +2226,7 @@ HRESULT BackupDirectory(_In_ const wstring& source, _In_ const wstring& destinat
         DWORD error = GetLastError();
         if (error != ERROR_ALREADY_EXISTS)
         {
-            wcout << L"CreateDirectory(" << destination << L") failed with error " << GetLastError() << endl;
+            wprintf(L"CreateDirectory(%s) failed with error %u\n", destination.c_str(), error);
             hr =  HRESULT_FROM_WIN32(error);
         }
     }
@@ -1614,7 +2238,7 @@ HRESULT BackupDirectory(_In_ const wstring& source, _In_ const wstring& destinat
         directoryBackupPath.append(L"\\");
         directoryBackupPath.append(DIRECTORY_BACKUP_FILE);
 
-        hr = BackupFile(source, directoryBackupPath);
+        hr = BackupFile(source, directoryBackupPath, pCopier);
     }
 
     return hr;
@@ -1622,54 +2246,11 @@ HRESULT BackupDirectory(_In_ const wstring& source, _In_ const wstring& destinat
 
 void BackupDirectoryTree(_In_ const wstring& source, _In_ const wstring& destination)
 {
-    // Backup the directory
-    HRESULT hr = BackupDirectory(source, destination);
-    if (FAILED(hr))
-    {
-        return;
-    }
-    
-    // Walk through all the files and subdirectories
-    WIN32_FIND_DATA findData;
-    wstring pattern = source;
-    pattern += L"\\*";
-    HANDLE hFind = FindFirstFile(pattern.c_str(), &findData);
-    if (hFind != INVALID_HANDLE_VALUE)
-    {
-        do 
-        {
-            // If not . or ..
-            if (findData.cFileName[0] != '.')
-            {
-                wstring newSource = source;
-                newSource += '\\';
-                newSource += findData.cFileName;
-                wstring newDestination = destination;
-                newDestination += '\\';
-                newDestination += findData.cFileName;
-                // Backup the source file or directory
-                if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) 
-                {
-                    // NOTE: This code is using recursion for simplicity, however a real backup application
-                    // should avoid recursion since it will overflow the stack for a deep directory tree
-                    BackupDirectoryTree(newSource, newDestination);
-                }
-                else 
-                {
-                    // Do BackupRead and backup the file
-                    hr = BackupFile(newSource, newDestination);
-                    if (FAILED(hr))
-                    {
-                        // NOTE: This code ignores BackupFile errors,
-                        // but a backup app might handle it differently
-                        wcout << L"BackupFile failed, hr = 0x" << hex << hr << endl;
-                    }
-                }
-            }
-        } while (FindNextFile(hFind, &findData));
-
-        FindClose(hFind);
-    }
+    // Backup the directory and everything below it on the copy workers
+    // NOTE: errors are reported by the workers and otherwise ignored,
+    // but a backup app might handle them differently
+    CParallelTreeCopy treeCopy(false, NULL, NULL);
+    treeCopy.Run(source, destination);
 }
 
 HRESULT VolumeHasDedupMetadata(_In_ const wstring& volumeGuidName, _Out_ bool& hasDedupMetadata, _Out_ wstring& chunkStoreId)
@@ -1774,87 +2355,24 @@ HRESULT ReadBackupMetadata(_In_ const wstring& source, _Out_ wstring& chunkStore
 //
 /////////////////////////////////////////////////////////////////////
 
-HRESULT RestoreFile(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ bool overWriteExisting)
+HRESULT RestoreFile(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ bool overWriteExisting, _In_opt_ CPipelinedCopier* pCopier)
 {
-    // Create destination dir if it doesn't exist
-    size_t lastSeparator = destination.rfind('\\');
-    if (lastSeparator == wstring::npos) 
+    if (pCopier != NULL)
     {
-        wcout << L"destination is not a file path" << endl;
-        return E_UNEXPECTED;
+        return pCopier->Restore(source, destination, overWriteExisting);
     }
-    wstring destinationLocation = destination.substr(0, lastSeparator);
-    ::CreateDirectory(destinationLocation.c_str(), NULL);
-
-    // Open the backup medium
-    // In this example the medium is another file, but it could be tape, network server, etc...
-    HANDLE hSourceFile = ::CreateFile(
-                        source.c_str(),
-                        GENERIC_READ,
-                        FILE_SHARE_READ,
-                        NULL,
-                        OPEN_EXISTING,
-                        FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
-                        NULL);
-    if (hSourceFile == INVALID_HANDLE_VALUE) 
-    {
-        wcout << L"CreateFile(" << source << L") failed with error " << GetLastError() << endl;
-        return HRESULT_FROM_WIN32(GetLastError());
-    }
-
-    // Open the file to be restored
-    HANDLE hDestinationFile = ::CreateFile(
-                        destination.c_str(),
-                        GENERIC_WRITE | WRITE_OWNER | WRITE_DAC,
-                        FILE_SHARE_READ,
-                        NULL,
-                        overWriteExisting ? OPEN_EXISTING : CREATE_ALWAYS,
-                        FILE_FLAG_OPEN_REPARSE_POINT | FILE_FLAG_BACKUP_SEMANTICS,
-                        NULL);
-    if (hDestinationFile == INVALID_HANDLE_VALUE) 
-    {
-        wcout << L"CreateFile(" << destination << L") failed with error " << GetLastError() << endl;
-        return HRESULT_FROM_WIN32(GetLastError());
-    }
-
-    const DWORD DEFAULT_BUFFER_SIZE = 4086;
-    DWORD bytesRead, bytesWritten;
-    BYTE buffer[DEFAULT_BUFFER_SIZE];
-    LPVOID context = NULL;
-    HRESULT hr = S_OK;
 
-    // Read 4k at a time from the backup medium. BackupRead will return attributes, security, and reparse point information
-    while (ReadFile(hSourceFile, buffer, DEFAULT_BUFFER_SIZE, &bytesRead, NULL) && bytesRead > 0)
+    CPipelinedCopier copier;
+    HRESULT hr = copier.Initialize();
+    if (SUCCEEDED(hr))
     {
-        // Call BackupWrite to restore the file, including security, attributes and reparse point
-        if (!BackupWrite(hDestinationFile, buffer, bytesRead, &bytesWritten, FALSE, TRUE, &context))
-        {
-            wcout << L"BackupWrite(" << destination << L") failed with error " << GetLastError() << endl;
-            hr = HRESULT_FROM_WIN32(GetLastError());
-            break;
-        }
-
-        if (bytesRead != bytesWritten) 
-        {
-            wcout << L"BackupWrite(" << destination << L") unexpectedly wrote less bytes than expected (expected:" << bytesRead << L" written:" << bytesWritten << L")" << endl;
-            hr = E_UNEXPECTED;
-            break;
-        }
+        hr = copier.Restore(source, destination, overWriteExisting);
     }
 
-    // Call BackupWrite one more time to clean up the context
-    BackupWrite(hDestinationFile, NULL, 0, NULL, TRUE, TRUE, &context);
-
-    // Close the backup medium
-    CloseHandle(hSourceFile);
-
-    // Close the destination file
-    CloseHandle(hDestinationFile);
-
     return hr;
 }
 
-HRESULT RestoreDirectory(_In_ const wstring& source, _In_ const wstring& destination)
+HRESULT RestoreDirectory(_In_ const wstring& source, _In_ const wstring& destination, _In_opt_ CPipelinedCopier* pCopier)
 {
     HRESULT hr = S_OK;
     
@@ -1871,7 +2389,7 @@ HRESULT RestoreDirectory(_In_ const wstring& source, _In_ const wstring& destina
         // A real backup application may handle this condition differently
         if (error != ERROR_ALREADY_EXISTS && error != ERROR_ACCESS_DENIED)
         {
-            wcout << L"CreateDirectory(" << destination << L") failed with error " << GetLastError() << endl;
+            wprintf(L"CreateDirectory(%s) failed with error %u\n", destination.c_str(), error);
             hr =  HRESULT_FROM_WIN32(error);
         }
     }
@@ -1879,7 +2397,7 @@ HRESULT RestoreDirectory(_In_ const wstring& source, _In_ const wstring& destina
     if (SUCCEEDED(hr))
     {
         // Restore the directory
-        RestoreFile(directorySourcePath, destination, true);
+        RestoreFile(directorySourcePath, destination, true, pCopier);
     }
     
     return hr;
@@ -1943,8 +2461,6 @@ HRESULT DeleteDirectoryTree(_In_ const wstring& directory)
 
 HRESULT RestoreDirectoryTree(_In_ const wstring& source, _In_ const wstring& destination, _In_ const vector<wstring>& sourceExcludePaths, _Out_opt_ vector<wstring>* pRestoredFiles)
 {
-    HRESULT hr = S_OK;
-
     if (pRestoredFiles != NULL)
     {
         pRestoredFiles->clear();
@@ -1953,90 +2469,15 @@ HRESULT RestoreDirectoryTree(_In_ const wstring& source, _In_ const wstring& des
     // Check for exclusion
     for (size_t index = 0; index < sourceExcludePaths.size(); index++)
     {
-        wstring excludePath = sourceExcludePaths[index];
-        if (wcscmp(source.c_str(), excludePath.c_str()) == 0)
+        if (wcscmp(source.c_str(), sourceExcludePaths[index].c_str()) == 0)
         {
-            return hr = S_FALSE;
+            return S_FALSE;
         }
     }
 
-    // Restore the directory
-    hr = RestoreDirectory(source, destination);
-    if (FAILED(hr) && hr != HRESULT_FROM_WIN32(ERROR_FILE_EXISTS) && hr != HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED))
-    {
-        return hr;
-    }
-    hr = S_OK;
-    
-    wstring trimmedSource = TrimTrailingSeparator(source, L'\\');
-    
-    // Walk through all the files and subdirectories
-    WIN32_FIND_DATA findData;
-    wstring pattern = trimmedSource;
-    pattern += L"\\*";
-    HANDLE hFind = FindFirstFile(pattern.c_str(), &findData);
-    if (hFind != INVALID_HANDLE_VALUE)
-    {
-        do 
-        {
-            // If not . or ..
-            if (findData.cFileName[0] != '.')
-            {
-                wstring newSource = trimmedSource;
-                newSource += '\\';
-                newSource += findData.cFileName;
-                wstring newDestination = destination;
-                newDestination += '\\';
-                newDestination += findData.cFileName;
-                // Restore the file or directory
-                if (findData.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) 
-                {
-
-                    // NOTE: This code is using recursion for simplicity, however a real backup application
-                    // should avoid recursion since it will overflow the stack for a deep directory tree
-                    hr = RestoreDirectoryTree(newSource, newDestination, sourceExcludePaths, pRestoredFiles);
-                    if (FAILED(hr))
-                    {
-                        break;
-                    }
-                }
-                else if ((_wcsicmp(findData.cFileName, DIRECTORY_BACKUP_FILE) == 0) ||
-                         (_wcsicmp(findData.cFileName, BACKUP_METADATA_FILE_NAME) == 0))
-                {
-                    // This file is backup metadata, not original volume data
-                    continue;
-                }
-                else 
-                {
-                    // Restore the file
-                    hr = RestoreFile(newSource, newDestination);
-                    if (FAILED(hr))
-                    {
-                        if (hr == HRESULT_FROM_WIN32(ERROR_ACCESS_DENIED) || hr == HRESULT_FROM_WIN32(ERROR_SHARING_VIOLATION))
-                        {
-                            // Some files may be in busy, protected by a filter, etc.
-                            // An online restore may not be able to replace every file
-                            wcout << L"Warning: continuing restore after RestoreFile failed, hr = 0x" << hex << hr << endl;
-                            hr = S_OK;
-                        }
-                        else
-                        {
-                            wcout << L"RestoreFile failed, hr = 0x" << hex << hr << endl;
-                            break;
-                        }
-                    }
-                    if (pRestoredFiles)
-                    {
-                        pRestoredFiles->push_back(newDestination);
-                    }
-                }
-            }
-        } while (FindNextFile(hFind, &findData));
-
-        FindClose(hFind);
-    }
-
-    return hr;
+    // Restore the directory and everything below it on the copy workers
+    CParallelTreeCopy treeCopy(true, &sourceExcludePaths, pRestoredFiles);
+    return treeCopy.Run(source, destination);
 }
 
 /////////////////////////////////////////////////////////////////////
@@ -2503,6 +2944,14 @@ void PrintUsage(_In_ LPCWSTR programName)
     wcout << L"Restore the entire volume to the destination:" << endl <<
              L"\t" << programName << L" -restorevolume <backup-directory-path> -destination <volume-path>" << endl << endl;
     wcout << L"EXAMPLE: " << programName << L" -restorevolume f:\\mydirectorybackup -destination d:\\" << endl;
+
+    wcout << endl << L"CHUNK BACKUP" << endl;
+    wcout << L"Back up a directory to a content-defined chunking repository, storing only new chunks:" << endl <<
+             L"\t" << programName << L" -chunkbackup <directory-or-volume-path> -destination <repository-path>" << endl << endl;
+    wcout << L"Restore the latest backup in a repository, or the backup in a given manifest:" << endl <<
+             L"\t" << programName << L" -chunkrestore <repository-or-manifest-path> -destination <directory-path>" << endl << endl;
+    wcout << L"EXAMPLE: " << programName << L" -chunkbackup d:\\mydirectory -destination f:\\myrepository" << endl;
+    wcout << L"EXAMPLE: " << programName << L" -chunkrestore f:\\myrepository -destination d:\\mydirectory" << endl;
 }
 
 bool ParseCommandLine(_In_ int argc,  _In_reads_(argc) _TCHAR* argv[], _Out_ Action *action, _Out_ wstring* source, _Out_ wstring* destination)
@@ -2546,6 +2995,14 @@ bool ParseCommandLine(_In_ int argc,  _In_reads_(argc) _TCHAR* argv[], _Out_ Act
     {
         *action = RestoreFilesAction;
     }
+    else if (actionString == L"-chunkbackup")
+    {
+        *action = ChunkBackupAction;
+    }
+    else if (actionString == L"-chunkrestore")
+    {
+        *action = ChunkRestoreAction;
+    }
     else
     {
         return false;
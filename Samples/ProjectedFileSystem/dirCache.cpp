@@ -0,0 +1,349 @@
+#include "stdafx.h"
+
+using namespace regfs;
+
+//////////////////////////////////////////////////////////////////////////
+// See dirCache.h for descriptions of the routines in this module.
+//////////////////////////////////////////////////////////////////////////
+
+DirCache::DirCache(size_t maxEntries) :
+    _maxEntries(maxEntries),
+    _useClock(0),
+    _lookups(0),
+    _hits(0),
+    _misses(0),
+    _invalidations(0),
+    _evictions(0),
+    _hitMicroseconds(0),
+    _missMicroseconds(0)
+{
+    InitializeSRWLock(&_lock);
+    QueryPerformanceFrequency(&_frequency);
+}
+
+DirCache::~DirCache()
+{
+    for (auto& it : _entries)
+    {
+        ReleaseEntry(it.second.get());
+    }
+}
+
+HRESULT DirCache::GetListing(
+    const std::wstring& relativePath,
+    RegOps& regOps,
+    std::shared_ptr<const DirListing>& listing
+)
+{
+    const std::wstring path = NormalizePath(relativePath);
+    LARGE_INTEGER start;
+    QueryPerformanceCounter(&start);
+
+    listing.reset();
+    InterlockedIncrement64(&_lookups);
+
+    // Most lookups are hits, and hits only need the shared lock.
+    AcquireSRWLockShared(&_lock);
+
+    auto it = _entries.find(path);
+    if ((it != _entries.end()) && (it->second->Stale == 0))
+    {
+        listing = it->second->Listing;
+        InterlockedExchange64(&it->second->LastUsed, InterlockedIncrement64(&_useClock));
+    }
+
+    ReleaseSRWLockShared(&_lock);
+
+    if (listing != nullptr)
+    {
+        InterlockedIncrement64(&_hits);
+        InterlockedExchangeAdd64(&_hitMicroseconds, ElapsedMicroseconds(start));
+        return S_OK;
+    }
+
+    // Enumerate the key without holding the lock, so that a slow key does not hold up lookups of
+    // other keys.  If two threads miss on the same key at the same time both enumerate it and the
+    // second one to finish replaces the first one's entry.
+    std::unique_ptr<CacheEntry> newEntry;
+    HRESULT hr = BuildEntry(path, regOps, newEntry);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    listing = newEntry->Listing;
+    newEntry->LastUsed = InterlockedIncrement64(&_useClock);
+
+    // Entries that leave the map are released after the lock is dropped, because releasing an entry
+    // waits for its notification callback to finish.
+    std::unique_ptr<CacheEntry> oldEntry;
+    std::unique_ptr<CacheEntry> evictedEntry;
+
+    AcquireSRWLockExclusive(&_lock);
+
+    auto& slot = _entries[path];
+    oldEntry = std::move(slot);
+    slot = std::move(newEntry);
+
+    if (_entries.size() > _maxEntries)
+    {
+        // Evict the least recently used entry.  This is a linear scan, but it only happens once the
+        // cache is full and is cheap next to enumerating a registry key.
+        auto victim = _entries.end();
+        for (auto entry = _entries.begin(); entry != _entries.end(); entry++)
+        {
+            if ((_wcsicmp(entry->first.c_str(), path.c_str()) != 0) &&
+                ((victim == _entries.end()) || (entry->second->LastUsed < victim->second->LastUsed)))
+            {
+                victim = entry;
+            }
+        }
+
+        evictedEntry = std::move(victim->second);
+        _entries.erase(victim);
+        InterlockedIncrement64(&_evictions);
+    }
+
+    ReleaseSRWLockExclusive(&_lock);
+
+    ReleaseEntry(oldEntry.get());
+    ReleaseEntry(evictedEntry.get());
+
+    InterlockedIncrement64(&_misses);
+    InterlockedExchangeAdd64(&_missMicroseconds, ElapsedMicroseconds(start));
+
+    return S_OK;
+}
+
+std::shared_ptr<const DirListing> DirCache::Peek(const std::wstring& relativePath)
+{
+    const std::wstring path = NormalizePath(relativePath);
+    std::shared_ptr<const DirListing> listing;
+
+    AcquireSRWLockShared(&_lock);
+
+    auto it = _entries.find(path);
+    if ((it != _entries.end()) && (it->second->Stale == 0))
+    {
+        listing = it->second->Listing;
+    }
+
+    ReleaseSRWLockShared(&_lock);
+
+    return listing;
+}
+
+const DirEntry* DirCache::FindEntry(const DirListing& listing, const std::wstring& name)
+{
+    DirEntry probe = { name, false, 0 };
+    auto range = std::equal_range(listing.begin(),
+                                  listing.end(),
+                                  probe,
+                                  FileNameLessThan);
+
+    const DirEntry* found = nullptr;
+    for (auto it = range.first; it != range.second; it++)
+    {
+        if ((found == nullptr) || it->IsDirectory)
+        {
+            found = &*it;
+        }
+    }
+
+    return found;
+}
+
+HRESULT DirCache::BuildEntry(
+    const std::wstring& path,
+    RegOps& regOps,
+    std::unique_ptr<CacheEntry>& entry
+)
+{
+    HRESULT hr = S_OK;
+
+    entry = std::make_unique<CacheEntry>();
+    entry->Owner = this;
+    entry->Key = nullptr;
+    entry->ChangeEvent = nullptr;
+    entry->WaitHandle = nullptr;
+    entry->Stale = 0;
+    entry->LastUsed = 0;
+
+    if (!PathUtils::IsVirtualizationRoot(path.c_str()))
+    {
+        hr = regOps.OpenKeyForNotification(path, entry->Key);
+        if (FAILED(hr))
+        {
+            entry.reset();
+            return hr;
+        }
+
+        entry->ChangeEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        if (entry->ChangeEvent == nullptr)
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            ReleaseEntry(entry.get());
+            entry.reset();
+            return hr;
+        }
+
+        // Watch for subkeys being added or removed and for values being written.  The notification
+        // is not tied to this thread, which may be a ProjFS thread pool thread that exits at any time.
+        LONG res = RegNotifyChangeKeyValue(entry->Key,
+                                           FALSE,
+                                           REG_NOTIFY_CHANGE_NAME |
+                                           REG_NOTIFY_CHANGE_LAST_SET |
+                                           REG_NOTIFY_THREAD_AGNOSTIC,
+                                           entry->ChangeEvent,
+                                           TRUE);
+
+        if (res != ERROR_SUCCESS)
+        {
+            wprintf(L"%hs: RegNotifyChangeKeyValue [%s]: %d\n",
+                    __FUNCTION__, path.c_str(), res);
+            ReleaseEntry(entry.get());
+            entry.reset();
+            return HRESULT_FROM_WIN32(res);
+        }
+
+        if (!RegisterWaitForSingleObject(&entry->WaitHandle,
+                                         entry->ChangeEvent,
+                                         OnKeyChanged,
+                                         entry.get(),
+                                         INFINITE,
+                                         WT_EXECUTEONLYONCE))
+        {
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            entry->WaitHandle = nullptr;
+            ReleaseEntry(entry.get());
+            entry.reset();
+            return hr;
+        }
+    }
+
+    RegEntries regEntries;
+    hr = regOps.EnumerateKey(path, regEntries);
+    if (FAILED(hr))
+    {
+        ReleaseEntry(entry.get());
+        entry.reset();
+        return hr;
+    }
+
+    auto listing = std::make_shared<DirListing>();
+    listing->reserve(regEntries.SubKeys.size() + regEntries.Values.size());
+
+    // Registry keys become directories and values become files.  Names DirInfo would not accept are
+    // left out here as well.
+    for (const auto& subKey : regEntries.SubKeys)
+    {
+        if (subKey.Name.length() <= MAX_PATH)
+        {
+            listing->push_back({ subKey.Name, true, 0 });
+        }
+    }
+
+    for (const auto& val : regEntries.Values)
+    {
+        if (val.Name.length() <= MAX_PATH)
+        {
+            listing->push_back({ val.Name, false, val.Size });
+        }
+    }
+
+    // Sort once, the way the file system expects, so that enumeration sessions only have to filter.
+    std::sort(listing->begin(),
+              listing->end(),
+              FileNameLessThan);
+
+    entry->Listing = std::move(listing);
+
+    return S_OK;
+}
+
+void DirCache::ReleaseEntry(CacheEntry* entry)
+{
+    if (entry == nullptr)
+    {
+        return;
+    }
+
+    // Wait for a running OnKeyChanged callback to finish before the entry goes away.
+    if (entry->WaitHandle != nullptr)
+    {
+        UnregisterWaitEx(entry->WaitHandle, INVALID_HANDLE_VALUE);
+        entry->WaitHandle = nullptr;
+    }
+
+    // Closing the key also cancels a pending change notification.
+    if (entry->Key != nullptr)
+    {
+        RegCloseKey(entry->Key);
+        entry->Key = nullptr;
+    }
+
+    if (entry->ChangeEvent != nullptr)
+    {
+        CloseHandle(entry->ChangeEvent);
+        entry->ChangeEvent = nullptr;
+    }
+}
+
+VOID CALLBACK DirCache::OnKeyChanged(PVOID context, BOOLEAN timedOut)
+{
+    UNREFERENCED_PARAMETER(timedOut);
+
+    CacheEntry* entry = reinterpret_cast<CacheEntry*>(context);
+
+    // A notification only fires once, so the entry stays stale until a lookup replaces it.
+    if (InterlockedExchange(&entry->Stale, 1) == 0)
+    {
+        InterlockedIncrement64(&entry->Owner->_invalidations);
+    }
+}
+
+std::wstring DirCache::NormalizePath(const std::wstring& path)
+{
+    return PathUtils::IsVirtualizationRoot(path.c_str()) ? std::wstring() : path;
+}
+
+LONG64 DirCache::ElapsedMicroseconds(const LARGE_INTEGER& start)
+{
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+
+    return (now.QuadPart - start.QuadPart) * 1000000 / _frequency.QuadPart;
+}
+
+DirCacheStats DirCache::GetStats()
+{
+    DirCacheStats stats;
+
+    stats.Lookups = _lookups;
+    stats.Hits = _hits;
+    stats.Misses = _misses;
+    stats.Invalidations = _invalidations;
+    stats.Evictions = _evictions;
+    stats.HitMicroseconds = _hitMicroseconds;
+    stats.MissMicroseconds = _missMicroseconds;
+
+    return stats;
+}
+
+void DirCache::PrintStats()
+{
+    DirCacheStats stats = GetStats();
+
+    wprintf(L"Directory cache: %lld lookups, %lld hits, %lld misses (%.1f%% hit rate), "
+            L"%lld invalidations, %lld evictions\n",
+            stats.Lookups,
+            stats.Hits,
+            stats.Misses,
+            (stats.Lookups != 0) ? (100.0 * stats.Hits / stats.Lookups) : 0.0,
+            stats.Invalidations,
+            stats.Evictions);
+
+    wprintf(L"Directory cache: average latency %.1f us per hit, %.1f us per miss\n",
+            (stats.Hits != 0) ? ((double)stats.HitMicroseconds / stats.Hits) : 0.0,
+            (stats.Misses != 0) ? ((double)stats.MissMicroseconds / stats.Misses) : 0.0);
+}
@@ -0,0 +1,131 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    dirCache.h
+
+Abstract:
+
+    A cache of sorted directory listings that is shared by all enumeration sessions.
+
+    Tools like 'dir /s' enumerate the same directories over and over.  Without a cache every
+    enumeration session re-enumerates the registry key and re-sorts the result.  DirCache keeps one
+    sorted, unfiltered listing per registry key and asks the registry to tell it when the key changes,
+    so a listing is only rebuilt after a subkey or value under that key was added, removed or written.
+
+--*/
+
+#pragma once
+
+namespace regfs {
+
+// The sorted contents of one registry key.  Listings are immutable once they are in the cache, so
+// an enumeration session can keep using its listing after the cache has replaced it.
+typedef std::vector<DirEntry> DirListing;
+
+// A snapshot of the cache counters.
+struct DirCacheStats {
+    LONG64 Lookups;
+    LONG64 Hits;
+    LONG64 Misses;
+    LONG64 Invalidations;
+    LONG64 Evictions;
+
+    // Total time spent answering lookups, split by whether the listing came from the cache or had to
+    // be enumerated and sorted.
+    LONG64 HitMicroseconds;
+    LONG64 MissMicroseconds;
+};
+
+class DirCache {
+
+public:
+
+    static const size_t DefaultMaxEntries = 4096;
+
+    DirCache(size_t maxEntries = DefaultMaxEntries);
+
+    ~DirCache();
+
+    // Returns the sorted listing for the registry key at the given path, enumerating the key if the
+    // cache has no current listing for it.
+    HRESULT GetListing(const std::wstring& path,
+                       RegOps& regOps,
+                       std::shared_ptr<const DirListing>& listing);
+
+    // Returns the current listing for the given path if the cache has one, without enumerating the
+    // key.  Returns nullptr if the key is not cached or changed since it was cached.
+    std::shared_ptr<const DirListing> Peek(const std::wstring& path);
+
+    // Looks up a name in a sorted listing.  If a key and a value have the same name the key is
+    // returned, the same way RegfsProvider::GetPlaceholderInfo resolves such names.  Returns nullptr
+    // if the listing has no entry with that name.
+    static const DirEntry* FindEntry(const DirListing& listing, const std::wstring& name);
+
+    // Returns a copy of the cache counters.
+    DirCacheStats GetStats();
+
+    // Prints the cache counters, the hit rate and the average lookup latency.
+    void PrintStats();
+
+private:
+
+    struct CacheEntry {
+        DirCache* Owner;
+
+        std::shared_ptr<const DirListing> Listing;
+
+        // The key handle, event and wait registration used to find out when the key changes.  The
+        // virtualization root is not a registry key and has none of these; its listing never changes.
+        HKEY Key;
+        HANDLE ChangeEvent;
+        HANDLE WaitHandle;
+
+        // Set by the thread pool when the key changed.  A stale entry is rebuilt by the next lookup.
+        volatile LONG Stale;
+
+        // The value of _useClock when the entry was last used.  Used to pick an entry to evict.
+        volatile LONG64 LastUsed;
+    };
+
+    // Builds a new cache entry by enumerating and sorting the given key.  The change notification is
+    // armed before the key is enumerated so that a change that races with the enumeration is not lost.
+    HRESULT BuildEntry(const std::wstring& path,
+                       RegOps& regOps,
+                       std::unique_ptr<CacheEntry>& entry);
+
+    // Cancels the change notification of an entry.  Must not be called with _lock held.
+    static void ReleaseEntry(CacheEntry* entry);
+
+    // Thread pool callback for the change event of an entry.
+    static VOID CALLBACK OnKeyChanged(PVOID context, BOOLEAN timedOut);
+
+    LONG64 ElapsedMicroseconds(const LARGE_INTEGER& start);
+
+    // The virtualization root can be named "" or "\\".  Both map to the same cache entry.
+    static std::wstring NormalizePath(const std::wstring& path);
+
+    size_t _maxEntries;
+
+    LARGE_INTEGER _frequency;
+
+    // Protects _entries.  Entries themselves are only freed after they were removed from the map.
+    SRWLOCK _lock;
+
+    std::map<std::wstring, std::unique_ptr<CacheEntry>, PathComparer> _entries;
+
+    volatile LONG64 _useClock;
+
+    // Counters, updated with interlocked operations.
+    volatile LONG64 _lookups;
+    volatile LONG64 _hits;
+    volatile LONG64 _misses;
+    volatile LONG64 _invalidations;
+    volatile LONG64 _evictions;
+    volatile LONG64 _hitMicroseconds;
+    volatile LONG64 _missMicroseconds;
+};
+
+}
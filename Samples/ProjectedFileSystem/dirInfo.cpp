@@ -6,9 +6,7 @@ using namespace regfs;
 // See dirInfo.h for descriptions of the routines in this module.
 //////////////////////////////////////////////////////////////////////////
 
-// A comparison routine for std::sort that wraps PrjFileNameCompare() so that we can sort our DirInfo
-// the same way the file system would.
-bool FileNameLessThan(DirEntry entry1, DirEntry entry2)
+bool regfs::FileNameLessThan(const DirEntry& entry1, const DirEntry& entry2)
 {
     return PrjFileNameCompare(entry1.FileName.c_str(), entry2.FileName.c_str()) < 0;
 }
@@ -94,4 +92,9 @@ void DirInfo::SortEntriesAndMarkFilled()
     std::sort(_entries.begin(),
               _entries.end(),
               FileNameLessThan);
+}
+
+void DirInfo::MarkFilled()
+{
+    _entriesFilled = true;
 }
\ No newline at end of file
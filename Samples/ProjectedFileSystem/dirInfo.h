@@ -29,6 +29,10 @@ struct DirEntry {
     INT64 FileSize;
 };
 
+// A comparison routine for std::sort that wraps PrjFileNameCompare() so that entries can be sorted the
+// same way the file system would.
+bool FileNameLessThan(const DirEntry& entry1, const DirEntry& entry2);
+
 // RegFS uses a DirInfo object to hold directory entries.  When RegFS receives enumeration callbacks
 // it populates the DirInfo with a vector of DirEntry structs, one for each key and value in the
 // registry key being enumerated.
@@ -51,6 +55,10 @@ public:
     // Sorts the entries in the DirInfo object and marks the object as being fully populated.
     void SortEntriesAndMarkFilled();
 
+    // Marks the object as being fully populated without sorting it.  Use this when the entries were
+    // added in sorted order.
+    void MarkFilled();
+
     // Returns true if the DirInfo object has been populated with entries.
     bool EntriesFilled();
 
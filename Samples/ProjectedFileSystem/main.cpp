@@ -22,7 +22,7 @@ int __cdecl wmain(int argc, const WCHAR **argv)
     if (argc <= 1)
     {
         wprintf(L"Usage: \n");
-        wprintf(L"> regfs.exe <Virtualization Root Path> \n");
+        wprintf(L"> regfs.exe <Virtualization Root Path> [-prefetch]\n");
 
         return -1;
     }
@@ -47,6 +47,14 @@ int __cdecl wmain(int argc, const WCHAR **argv)
 
     // Start the provider using the options we set up.
     RegfsProvider provider;
+
+    // With -prefetch, RegFS answers metadata requests from its directory cache and reads the contents
+    // of sibling files ahead of time.
+    if ((argc > 2) && (_wcsicmp(argv[2], L"-prefetch") == 0))
+    {
+        provider.EnablePrefetch();
+    }
+
     auto hr = provider.Start(rootPath.c_str(), &opts);
     if (FAILED(hr))
     {
@@ -61,5 +69,7 @@ int __cdecl wmain(int argc, const WCHAR **argv)
 
     provider.Stop();
 
+    provider.PrintCacheStats();
+
     return 0;
 };
@@ -16,6 +16,14 @@ Abstract:
 
 namespace regfs {
 
+// Orders paths case-insensitively, the way both the file system and the registry compare names.
+struct PathComparer {
+    bool operator()(const std::wstring& Left, const std::wstring& Right) const
+    {
+        return _wcsicmp(Left.c_str(), Right.c_str()) < 0;
+    }
+};
+
 class PathUtils {
 
 public:
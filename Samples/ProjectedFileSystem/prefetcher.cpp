@@ -0,0 +1,240 @@
+#include "stdafx.h"
+
+using namespace regfs;
+
+//////////////////////////////////////////////////////////////////////////
+// See prefetcher.h for descriptions of the routines in this module.
+//////////////////////////////////////////////////////////////////////////
+
+Prefetcher::Prefetcher(RegOps& regOps) :
+    _regOps(regOps),
+    _useClock(0),
+    _outstanding(0),
+    _directoriesPrefetched(0),
+    _batches(0),
+    _valuesRead(0),
+    _bytesRead(0),
+    _hits(0),
+    _droppedBatches(0)
+{
+    InitializeSRWLock(&_lock);
+    InitializeConditionVariable(&_idle);
+}
+
+Prefetcher::~Prefetcher()
+{
+    AcquireSRWLockExclusive(&_lock);
+
+    while (_outstanding != 0)
+    {
+        SleepConditionVariableSRW(&_idle, &_lock, INFINITE, 0);
+    }
+
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+void Prefetcher::PrefetchSiblings(
+    const std::wstring& keyPath,
+    const std::shared_ptr<const DirListing>& listing,
+    const std::wstring& skipName
+)
+{
+    std::vector<std::wstring> valueNames;
+
+    AcquireSRWLockExclusive(&_lock);
+
+    // Only predict once per listing.  A new listing means the key changed, and the old prediction is
+    // thrown away with the data it read.
+    auto it = _directories.find(keyPath);
+    if ((it != _directories.end()) && (it->second.Listing == listing))
+    {
+        ReleaseSRWLockExclusive(&_lock);
+        return;
+    }
+
+    auto& directory = _directories[keyPath];
+    directory.Listing = listing;
+    directory.Values.clear();
+    directory.LastUsed = ++_useClock;
+
+    if (_directories.size() > MaxDirectories)
+    {
+        EvictDirectory();
+    }
+
+    for (const auto& entry : *listing)
+    {
+        if (valueNames.size() >= MaxValuesPerDirectory)
+        {
+            break;
+        }
+
+        if (!entry.IsDirectory &&
+            (entry.FileSize > 0) &&
+            (entry.FileSize <= MaxValueSize) &&
+            (_wcsicmp(entry.FileName.c_str(), skipName.c_str()) != 0))
+        {
+            valueNames.push_back(entry.FileName);
+        }
+    }
+
+    InterlockedIncrement64(&_directoriesPrefetched);
+
+    // Split the values into batches so that several thread pool threads can read one large key.
+    for (size_t first = 0; first < valueNames.size(); first += BatchSize)
+    {
+        if (_outstanding >= MaxOutstandingBatches)
+        {
+            InterlockedIncrement64(&_droppedBatches);
+            continue;
+        }
+
+        size_t last = min(first + BatchSize, valueNames.size());
+
+        auto batch = std::make_unique<Batch>();
+        batch->Owner = this;
+        batch->KeyPath = keyPath;
+        batch->Listing = listing;
+        batch->ValueNames.assign(valueNames.begin() + first, valueNames.begin() + last);
+
+        if (!TrySubmitThreadpoolCallback(RunBatch, batch.get(), nullptr))
+        {
+            wprintf(L"%hs: TrySubmitThreadpoolCallback: %d\n",
+                    __FUNCTION__, GetLastError());
+            break;
+        }
+
+        // The work item owns the batch now.
+        batch.release();
+        _outstanding++;
+        InterlockedIncrement64(&_batches);
+    }
+
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+VOID CALLBACK Prefetcher::RunBatch(PTP_CALLBACK_INSTANCE instance, PVOID context)
+{
+    UNREFERENCED_PARAMETER(instance);
+
+    std::unique_ptr<Batch> batch(reinterpret_cast<Batch*>(context));
+    std::vector<std::vector<BYTE>> data;
+
+    // A failure just means the values will be read on demand.
+    batch->Owner->_regOps.ReadValues(batch->KeyPath, batch->ValueNames, data);
+
+    batch->Owner->CompleteBatch(batch.get(), data);
+}
+
+void Prefetcher::CompleteBatch(Batch* batch, std::vector<std::vector<BYTE>>& data)
+{
+    AcquireSRWLockExclusive(&_lock);
+
+    auto it = _directories.find(batch->KeyPath);
+    if ((it != _directories.end()) && (it->second.Listing == batch->Listing))
+    {
+        for (size_t i = 0; i < data.size(); i++)
+        {
+            if (!data[i].empty())
+            {
+                InterlockedIncrement64(&_valuesRead);
+                InterlockedExchangeAdd64(&_bytesRead, data[i].size());
+                it->second.Values[batch->ValueNames[i]] = std::move(data[i]);
+            }
+        }
+    }
+
+    if (--_outstanding == 0)
+    {
+        WakeAllConditionVariable(&_idle);
+    }
+
+    ReleaseSRWLockExclusive(&_lock);
+}
+
+bool Prefetcher::TryTakeValue(
+    const std::wstring& keyPath,
+    const std::wstring& valueName,
+    const std::shared_ptr<const DirListing>& listing,
+    PBYTE data,
+    UINT32 length
+)
+{
+    bool found = false;
+
+    AcquireSRWLockExclusive(&_lock);
+
+    auto it = _directories.find(keyPath);
+    if (it != _directories.end())
+    {
+        if (it->second.Listing != listing)
+        {
+            // The key changed since the values were read.
+            _directories.erase(it);
+        }
+        else
+        {
+            it->second.LastUsed = ++_useClock;
+
+            auto value = it->second.Values.find(valueName);
+            if ((value != it->second.Values.end()) && (value->second.size() == length))
+            {
+                CopyMemory(data, value->second.data(), length);
+                it->second.Values.erase(value);
+                found = true;
+            }
+        }
+    }
+
+    ReleaseSRWLockExclusive(&_lock);
+
+    if (found)
+    {
+        InterlockedIncrement64(&_hits);
+    }
+
+    return found;
+}
+
+void Prefetcher::EvictDirectory()
+{
+    auto victim = _directories.begin();
+    for (auto it = _directories.begin(); it != _directories.end(); it++)
+    {
+        if (it->second.LastUsed < victim->second.LastUsed)
+        {
+            victim = it;
+        }
+    }
+
+    _directories.erase(victim);
+}
+
+PrefetchStats Prefetcher::GetStats()
+{
+    PrefetchStats stats;
+
+    stats.Directories = _directoriesPrefetched;
+    stats.Batches = _batches;
+    stats.ValuesRead = _valuesRead;
+    stats.BytesRead = _bytesRead;
+    stats.Hits = _hits;
+    stats.DroppedBatches = _droppedBatches;
+
+    return stats;
+}
+
+void Prefetcher::PrintStats()
+{
+    PrefetchStats stats = GetStats();
+
+    wprintf(L"Prefetch: %lld directories, %lld batches (%lld dropped), %lld values (%lld bytes) read, "
+            L"%lld used (%.1f%%)\n",
+            stats.Directories,
+            stats.Batches,
+            stats.DroppedBatches,
+            stats.ValuesRead,
+            stats.BytesRead,
+            stats.Hits,
+            (stats.ValuesRead != 0) ? (100.0 * stats.Hits / stats.ValuesRead) : 0.0);
+}
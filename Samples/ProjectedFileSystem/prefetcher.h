@@ -0,0 +1,133 @@
+/*++
+
+Copyright (c) Microsoft Corporation.  All rights reserved.
+
+Module Name:
+
+    prefetcher.h
+
+Abstract:
+
+    Reads the contents of registry values ahead of the GetFileData callbacks that will ask for them.
+
+    A tool that walks a projected tree (a search, a backup, 'type *') usually reads every file in a
+    directory right after enumerating it.  When the first file of a recently enumerated directory is
+    hydrated, the prefetcher queues the remaining values of that registry key to the thread pool.  Each
+    work item opens the key once and reads a batch of values, so the GetFileData callbacks for the
+    siblings are answered from memory instead of opening the key and querying the value one at a time.
+
+    Prefetched data is tied to the directory listing it was predicted from.  When the key changes the
+    directory cache replaces the listing and the prefetched data for the old listing is discarded.
+
+--*/
+
+#pragma once
+
+namespace regfs {
+
+// A snapshot of the prefetcher counters.
+struct PrefetchStats {
+    LONG64 Directories;
+    LONG64 Batches;
+    LONG64 ValuesRead;
+    LONG64 BytesRead;
+    LONG64 Hits;
+    LONG64 DroppedBatches;
+};
+
+class Prefetcher {
+
+public:
+
+    // Number of values read by one work item.
+    static const size_t BatchSize = 32;
+
+    // Values larger than this are left to be read on demand.
+    static const INT64 MaxValueSize = 64 * 1024;
+
+    // At most this many values are prefetched from one key.
+    static const size_t MaxValuesPerDirectory = 1024;
+
+    // Number of directories whose prefetched data is kept.
+    static const size_t MaxDirectories = 64;
+
+    // Number of batches that may be queued to the thread pool at once.  Prefetching is only a guess, so
+    // when this many are outstanding further batches are dropped rather than queued.
+    static const LONG MaxOutstandingBatches = 16;
+
+    Prefetcher(RegOps& regOps);
+
+    // Waits for all outstanding batches to finish.
+    ~Prefetcher();
+
+    // Queues reads of the values in the given listing of keyPath, except skipName, unless they were
+    // already queued for the same listing.
+    void PrefetchSiblings(const std::wstring& keyPath,
+                          const std::shared_ptr<const DirListing>& listing,
+                          const std::wstring& skipName);
+
+    // Copies the prefetched contents of a value into data.  Returns false if the value was not
+    // prefetched for the given listing or its size is not length.  A value can only be taken once,
+    // because ProjFS does not ask again for the data of a hydrated placeholder.
+    bool TryTakeValue(const std::wstring& keyPath,
+                      const std::wstring& valueName,
+                      const std::shared_ptr<const DirListing>& listing,
+                      PBYTE data,
+                      UINT32 length);
+
+    // Returns a copy of the prefetcher counters.
+    PrefetchStats GetStats();
+
+    // Prints the prefetcher counters.
+    void PrintStats();
+
+private:
+
+    // Prefetched values of one registry key.
+    struct DirectoryData {
+        std::shared_ptr<const DirListing> Listing;
+        std::map<std::wstring, std::vector<BYTE>, PathComparer> Values;
+        LONG64 LastUsed;
+    };
+
+    // One work item: a set of values of one key to read.
+    struct Batch {
+        Prefetcher* Owner;
+        std::wstring KeyPath;
+        std::shared_ptr<const DirListing> Listing;
+        std::vector<std::wstring> ValueNames;
+    };
+
+    // Thread pool callback that reads a batch and stores the results.
+    static VOID CALLBACK RunBatch(PTP_CALLBACK_INSTANCE instance, PVOID context);
+
+    // Stores the values read by a batch, unless the listing they were read for has been replaced.
+    void CompleteBatch(Batch* batch, std::vector<std::vector<BYTE>>& data);
+
+    // Removes the least recently used directory.  Must be called with _lock held exclusively.
+    void EvictDirectory();
+
+    RegOps& _regOps;
+
+    // Protects _directories, _useClock and _outstanding.
+    SRWLOCK _lock;
+
+    // Signaled when _outstanding drops to zero.
+    CONDITION_VARIABLE _idle;
+
+    std::map<std::wstring, DirectoryData, PathComparer> _directories;
+
+    LONG64 _useClock;
+
+    LONG _outstanding;
+
+    // Counters, updated with interlocked operations.
+    volatile LONG64 _directoriesPrefetched;
+    volatile LONG64 _batches;
+    volatile LONG64 _valuesRead;
+    volatile LONG64 _bytesRead;
+    volatile LONG64 _hits;
+    volatile LONG64 _droppedBatches;
+};
+
+}
@@ -118,6 +118,57 @@ public:
         return true;
     }
 
+    // Reads several values of the same key, opening the key only once.  On return data has one
+    // element per name; a value that could not be read is left empty.
+    HRESULT ReadValues(const std::wstring& keyPath,
+                       const std::vector<std::wstring>& valueNames,
+                       std::vector<std::vector<BYTE>>& data)
+    {
+        data.clear();
+        data.resize(valueNames.size());
+
+        HKEY subkey = nullptr;
+        HRESULT hr = OpenKeyByPath(keyPath, subkey);
+        if (subkey == nullptr)
+        {
+            return FAILED(hr) ? hr : HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND);
+        }
+
+        for (size_t i = 0; i < valueNames.size(); i++)
+        {
+            DWORD size = 0;
+            DWORD ret = RegQueryValueEx(subkey,
+                                        valueNames[i].c_str(),
+                                        0,
+                                        nullptr,
+                                        nullptr,
+                                        &size);
+
+            if ((ret != ERROR_SUCCESS) || (size == 0))
+            {
+                continue;
+            }
+
+            data[i].resize(size);
+            ret = RegQueryValueEx(subkey,
+                                  valueNames[i].c_str(),
+                                  0,
+                                  nullptr,
+                                  data[i].data(),
+                                  &size);
+
+            // The value may have changed size between the two calls.  Leave it to be read on demand.
+            if ((ret != ERROR_SUCCESS) || (size != data[i].size()))
+            {
+                data[i].clear();
+            }
+        }
+
+        RegCloseKey(subkey);
+
+        return S_OK;
+    }
+
     // Returns true if the given path corresponds to a key that exists in the registry.
     bool DoesKeyExist(const std::wstring& path)
     {
@@ -178,6 +229,41 @@ public:
         return true;
     }
 
+    // Opens a registry key so that changes to it can be watched with RegNotifyChangeKeyValue.  Unlike
+    // OpenKeyByPath this also opens a new handle for the predefined keys, so the caller always owns
+    // the handle and must close it.
+    HRESULT OpenKeyForNotification(const std::wstring& path, HKEY& hKey)
+    {
+        hKey = nullptr;
+
+        auto pos = path.find(L"\\");
+        auto rootKeyStr = (pos == std::wstring::npos) ? path : path.substr(0, pos);
+
+        auto rootIt = _regRootKeyMap.find(rootKeyStr);
+        if (rootIt == _regRootKeyMap.end())
+        {
+            wprintf(L"%hs: root key [%s] doesn't exist\n",
+                    __FUNCTION__, rootKeyStr.c_str());
+            return HRESULT_FROM_WIN32(ERROR_PATH_NOT_FOUND);
+        }
+
+        DWORD res = RegOpenKeyEx(rootIt->second,
+                                 (pos == std::wstring::npos) ? nullptr : path.c_str() + pos + 1,
+                                 0,
+                                 KEY_NOTIFY | KEY_READ,
+                                 &hKey);
+
+        if (res != ERROR_SUCCESS)
+        {
+            wprintf(L"%hs: failed to open key [%s]: %d\n",
+                    __FUNCTION__, path.c_str(), res);
+            hKey = nullptr;
+            return HRESULT_FROM_WIN32(res);
+        }
+
+        return S_OK;
+    }
+
 private:
 
     // Gets the HKEY for a registry key given the path, if it exists.
@@ -2,12 +2,18 @@
 
 using namespace regfs;
 
-RegfsProvider::RegfsProvider()
+RegfsProvider::RegfsProvider() :
+    _prefetcher(_regOps)
 {
     // Record that this class implements the optional Notify callback.
     this->SetOptionalMethods(OptionalMethods::Notify);
 }
 
+void RegfsProvider::EnablePrefetch()
+{
+    _prefetchEnabled = true;
+}
+
 /*++
 
 Description:
@@ -81,9 +87,30 @@ HRESULT RegfsProvider::GetPlaceholderInfo(
 
     bool isKey;
     INT64 valSize = 0;
+    DirEntry cachedEntry;
+    HRESULT cacheResult = S_FALSE;
+
+    // In prefetch mode, answer from the cached listing of the parent key if there is one.  A tool that
+    // walks a tree enumerates a directory before opening its children, so the parent is usually cached.
+    if (_prefetchEnabled)
+    {
+        cacheResult = GetCachedMetadata(CallbackData->FilePathName, cachedEntry);
+        InterlockedIncrement64((cacheResult == S_FALSE) ? &_metadataMisses : &_metadataHits);
+    }
 
     // Find out whether the specified path exists in the registry, and whether it is a key or a value.
-    if (_regOps.DoesKeyExist(CallbackData->FilePathName))
+    if (cacheResult == S_OK)
+    {
+        isKey = cachedEntry.IsDirectory;
+        valSize = cachedEntry.FileSize;
+    }
+    else if (cacheResult == HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND))
+    {
+        wprintf(L"<---- %hs: return 0x%08x\n",
+                __FUNCTION__, ERROR_FILE_NOT_FOUND);
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+    else if (_regOps.DoesKeyExist(CallbackData->FilePathName))
     {
         isKey = true;
     }
@@ -245,9 +272,9 @@ HRESULT RegfsProvider::GetDirEnum(
     if (!dirInfo->EntriesFilled())
     {
         // The DirInfo associated with the current session hasn't been initialized yet.  This method
-        // will enumerate the subkeys and values in the registry key corresponding to CallbackData->FilePathName.
-        // For each one that matches SearchExpression it will create an entry to return to ProjFS
-        // and store it in the DirInfo object.
+        // will get the subkeys and values in the registry key corresponding to CallbackData->FilePathName
+        // from the directory cache.  For each one that matches SearchExpression it will create an
+        // entry to return to ProjFS and store it in the DirInfo object.
         HRESULT hr = PopulateDirInfoForPath(CallbackData->FilePathName,
                                             dirInfo.get(),
                                             SearchExpression);
@@ -259,8 +286,9 @@ HRESULT RegfsProvider::GetDirEnum(
             return hr;
         }
 
-        // This will ensure the entries in the DirInfo are sorted the way the file system expects.
-        dirInfo->SortEntriesAndMarkFilled();
+        // The cached listing is already sorted the way the file system expects, and filtering it
+        // keeps it sorted.
+        dirInfo->MarkFilled();
     }
 
     // Return our directory entries to ProjFS.
@@ -295,10 +323,11 @@ HRESULT RegfsProvider::PopulateDirInfoForPath (
     _In_     std::wstring                       searchExpression
 )
 {
-    RegEntries entries;
+    std::shared_ptr<const DirListing> listing;
 
-    // Get a list of the registry keys and values under the given key.
-    HRESULT hr = _regOps.EnumerateKey(relativePath.c_str(), entries);
+    // Get the sorted list of the registry keys and values under the given key.  The cache only
+    // enumerates the key if it has not seen it before or the key changed since.
+    HRESULT hr = _dirCache.GetListing(relativePath, _regOps, listing);
     if (FAILED(hr))
     {
         wprintf(L"%hs: Could not enumerate key: 0x%08x",
@@ -306,25 +335,62 @@ HRESULT RegfsProvider::PopulateDirInfoForPath (
         return hr;
     }
 
-    // Store each registry key that matches searchExpression as a directory entry.
-    for (auto subKey : entries.SubKeys)
+    // Store each registry key that matches searchExpression as a directory entry, and each registry
+    // value that matches it as a file entry.
+    for (const auto& entry : *listing)
     {
-        if (PrjFileNameMatch(subKey.Name.c_str(), searchExpression.c_str()))
+        if (PrjFileNameMatch(entry.FileName.c_str(), searchExpression.c_str()))
         {
-            dirInfo->FillDirEntry(subKey.Name.c_str());
+            if (entry.IsDirectory)
+            {
+                dirInfo->FillDirEntry(entry.FileName.c_str());
+            }
+            else
+            {
+                dirInfo->FillFileEntry(entry.FileName.c_str(), entry.FileSize);
+            }
         }
     }
 
-    // Store each registry value that matches searchExpression as a file entry.
-    for (auto val : entries.Values)
+    return hr;
+}
+
+HRESULT RegfsProvider::GetCachedMetadata (
+    _In_     PCWSTR                             relativePath,
+    _Out_    DirEntry&                          entry
+)
+{
+    std::wstring parentPath;
+    std::wstring fileName = PathUtils::GetLastComponent(relativePath, parentPath);
+
+    auto listing = _dirCache.Peek(parentPath);
+    if (listing == nullptr)
     {
-        if (PrjFileNameMatch(val.Name.c_str(), searchExpression.c_str()))
-        {
-            dirInfo->FillFileEntry(val.Name.c_str(), val.Size);
-        }
+        return S_FALSE;
     }
 
-    return hr;
+    const DirEntry* found = DirCache::FindEntry(*listing, fileName);
+    if (found == nullptr)
+    {
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+
+    entry = *found;
+    return S_OK;
+}
+
+void RegfsProvider::PrintCacheStats()
+{
+    _dirCache.PrintStats();
+
+    if (_prefetchEnabled)
+    {
+        wprintf(L"Metadata cache: %lld placeholders from cached listings, %lld from the registry\n",
+                _metadataHits,
+                _metadataMisses);
+
+        _prefetcher.PrintStats();
+    }
 }
 
 /*++
@@ -392,8 +458,35 @@ HRESULT RegfsProvider::GetFileData(
         return E_OUTOFMEMORY;
     }
 
+    bool prefetched = false;
+
+    if (_prefetchEnabled)
+    {
+        // If the parent key was enumerated recently, a tool is probably reading the files of the
+        // directory one after another.  Take this file from the prefetched data if it is there, and
+        // make sure its siblings are being read ahead.
+        std::wstring parentPath;
+        std::wstring valueName = PathUtils::GetLastComponent(CallbackData->FilePathName, parentPath);
+
+        auto listing = _dirCache.Peek(parentPath);
+        if (listing != nullptr)
+        {
+            if (ByteOffset == 0)
+            {
+                prefetched = _prefetcher.TryTakeValue(parentPath,
+                                                      valueName,
+                                                      listing,
+                                                      reinterpret_cast<PBYTE>(writeBuffer),
+                                                      Length);
+            }
+
+            _prefetcher.PrefetchSiblings(parentPath, listing, valueName);
+        }
+    }
+
     // Read the data out of the registry.
-    if (!_regOps.ReadValue(CallbackData->FilePathName, reinterpret_cast<PBYTE>(writeBuffer), Length))
+    if (!prefetched &&
+        !_regOps.ReadValue(CallbackData->FilePathName, reinterpret_cast<PBYTE>(writeBuffer), Length))
     {
         hr = HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
 
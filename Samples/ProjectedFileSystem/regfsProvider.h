@@ -26,6 +26,14 @@ public:
 
     RegfsProvider();
 
+    // Turns on prefetch mode, in which GetPlaceholderInfo is answered from cached directory listings
+    // and hydrating a file reads its siblings ahead of time.  Must be called before Start.
+    void EnablePrefetch();
+
+    // Prints the counters of the directory listing cache, and in prefetch mode of the metadata cache
+    // and the prefetcher.
+    void PrintCacheStats();
+
 private:
 
     ///////////////////////////////////////////////////////////////////////////////////////////////
@@ -77,8 +85,30 @@ private:
         _In_     std::wstring                    searchExpression
     );
 
+    // Looks up a path in the cached listing of its parent key.  Returns S_OK and fills in the entry if
+    // the path exists, HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND) if the listing shows that it does
+    // not exist, and S_FALSE if the parent key is not cached.
+    HRESULT GetCachedMetadata (
+        _In_     PCWSTR                          relativePath,
+        _Out_    DirEntry&                       entry
+    );
+
     RegOps _regOps;
 
+    // Sorted listings of the registry keys that have been enumerated, shared by all enumeration
+    // sessions and refreshed when the registry reports a change to the key.
+    DirCache _dirCache;
+
+    // If this flag is set to true, RegFS answers GetPlaceholderInfo from _dirCache when it can, and
+    // reads the siblings of a hydrated file ahead of time with _prefetcher.
+    bool _prefetchEnabled = false;
+
+    Prefetcher _prefetcher;
+
+    // Number of GetPlaceholderInfo callbacks answered from and not from _dirCache in prefetch mode.
+    volatile LONG64 _metadataHits = 0;
+    volatile LONG64 _metadataMisses = 0;
+
     // If this flag is set to true, RegFS will block the following namespace-altering operations
     // that take place under virtualization root:
     // 1) file or directory deletion
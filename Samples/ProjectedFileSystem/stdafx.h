@@ -23,4 +23,6 @@
 #include "virtualizationInstance.h"
 #include "pathUtils.h"
 #include "RegOps.h"
+#include "dirCache.h"
+#include "prefetcher.h"
 #include "regfsProvider.h"
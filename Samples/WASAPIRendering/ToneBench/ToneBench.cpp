@@ -0,0 +1,207 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+//
+// ToneBench.cpp : Measures how many samples per second the tone generator produces.
+//
+// Each sample format is generated with every instruction set the processor supports, one 10ms
+// buffer at a time, and compared with the scalar output.  A sin() per frame generator, the way
+// the sample used to build its tone, is timed as well for comparison.
+//
+
+#include "..\pch.h"
+#include <math.h>
+#include <stdio.h>
+#include "..\ToneGen.h"
+
+namespace
+{
+    const DWORD Frequency = 440;
+    const DWORD DurationInSec = 60;
+    const int Repeats = 3;
+
+    //
+    //  sin() per frame in double precision, converted and copied to each channel one sample at a time.
+    //
+    template <typename T>
+    void GenerateSineSamplesWithSin(BYTE* Buffer, UINT32 FrameCount, WORD ChannelCount, DWORD SamplesPerSecond, double* Theta)
+    {
+        double sampleIncrement = (Frequency * (3.14159265358979323846 * 2)) / SamplesPerSecond;
+        T* dataBuffer = reinterpret_cast<T*>(Buffer);
+
+        for (UINT32 i = 0; i < FrameCount * ChannelCount; i += ChannelCount)
+        {
+            double sinValue = sin(*Theta);
+            for (WORD j = 0; j < ChannelCount; j++)
+            {
+                dataBuffer[i + j] = (sizeof(T) == sizeof(float)) ? static_cast<T>(sinValue) : static_cast<T>(sinValue * 32767);
+            }
+            *Theta += sampleIncrement;
+        }
+    }
+
+    double Seconds(const LARGE_INTEGER& Start, const LARGE_INTEGER& End)
+    {
+        LARGE_INTEGER frequency;
+        QueryPerformanceFrequency(&frequency);
+        return static_cast<double>(End.QuadPart - Start.QuadPart) / frequency.QuadPart;
+    }
+
+    //
+    //  Runs Generate over DurationInSec seconds of buffers and returns the fastest time of several runs.
+    //
+    template <typename Fn>
+    double Time(Fn Generate, BYTE* Buffer, UINT32 FramesPerBuffer, UINT32 FrameSize, DWORD SamplesPerSecond)
+    {
+        double best = 0;
+        UINT32 bufferCount = (SamplesPerSecond * DurationInSec) / FramesPerBuffer;
+
+        for (int repeat = 0; repeat < Repeats; repeat++)
+        {
+            LARGE_INTEGER start, end;
+            QueryPerformanceCounter(&start);
+            for (UINT32 i = 0; i < bufferCount; i++)
+            {
+                // Cycle through one second of output so the buffers stay in the cache, as the render buffers do.
+                Generate(Buffer + (i % 100) * FramesPerBuffer * FrameSize, FramesPerBuffer);
+            }
+            QueryPerformanceCounter(&end);
+
+            double seconds = Seconds(start, end);
+            best = (repeat == 0 || seconds < best) ? seconds : best;
+        }
+        return best;
+    }
+
+    void Report(const char* Name, double Seconds, WORD ChannelCount, DWORD SamplesPerSecond, double Baseline)
+    {
+        double samples = static_cast<double>(SamplesPerSecond) * DurationInSec * ChannelCount;
+        printf("  %-14s %8.1f Msamples/s  %8.0fx real time", Name, samples / Seconds / 1e6, DurationInSec / Seconds);
+        if (Baseline > 0)
+        {
+            printf("  %5.1fx faster than sin()", Baseline / Seconds);
+        }
+        printf("\n");
+    }
+}
+
+int wmain(int argc, wchar_t* argv[])
+{
+    if (argc > 3)
+    {
+        printf("Usage: ToneBench [channels] [samples per second]\n");
+        return 0;
+    }
+
+    WORD channelCount = static_cast<WORD>((argc >= 2) ? _wtoi(argv[1]) : 2);
+    DWORD samplesPerSecond = (argc >= 3) ? _wtoi(argv[2]) : 48000;
+    if (channelCount == 0 || samplesPerSecond < 100)
+    {
+        printf("Usage: ToneBench [channels] [samples per second]\n");
+        return 0;
+    }
+
+    struct
+    {
+        CToneGenerator::SampleFormat Format;
+        const char* Name;
+    } formats[] =
+    {
+        { CToneGenerator::SampleFormat::Float, "float" },
+        { CToneGenerator::SampleFormat::Pcm16Bit, "16-bit PCM" },
+        { CToneGenerator::SampleFormat::Pcm24Bit, "24-bit PCM" },
+    };
+
+    struct
+    {
+        CToneGenerator::Isa Isa;
+        const char* Name;
+    } isas[] =
+    {
+        { CToneGenerator::Isa::Scalar, "scalar" },
+        { CToneGenerator::Isa::Sse2, "SSE2" },
+        { CToneGenerator::Isa::Avx2, "AVX2" },
+    };
+
+    CToneGenerator::Isa bestIsa = CToneGenerator::BestIsa();
+    UINT32 framesPerBuffer = samplesPerSecond / 100;
+
+    printf("%u Hz tone, %u channels, %u samples per second, %u frames per buffer\n\n",
+        Frequency, channelCount, samplesPerSecond, framesPerBuffer);
+
+    bool mismatch = false;
+
+    for (const auto& format : formats)
+    {
+        CToneGenerator toneGenerator;
+        toneGenerator.Initialize(Frequency, channelCount, samplesPerSecond, format.Format);
+        UINT32 frameSize = toneGenerator.FrameSize();
+
+        // One second of output, and a copy of the scalar output to compare with.
+        size_t bufferLength = static_cast<size_t>(100) * framesPerBuffer * frameSize;
+        std::unique_ptr<BYTE[]> buffer(new BYTE[bufferLength]);
+        std::unique_ptr<BYTE[]> reference(new BYTE[bufferLength]);
+
+        printf("%s\n", format.Name);
+
+        double baseline = 0;
+        if (format.Format != CToneGenerator::SampleFormat::Pcm24Bit)
+        {
+            double theta = 0;
+            bool isFloat = (format.Format == CToneGenerator::SampleFormat::Float);
+            baseline = Time([&](BYTE* Buffer, UINT32 FrameCount)
+                {
+                    if (isFloat)
+                    {
+                        GenerateSineSamplesWithSin<float>(Buffer, FrameCount, channelCount, samplesPerSecond, &theta);
+                    }
+                    else
+                    {
+                        GenerateSineSamplesWithSin<short>(Buffer, FrameCount, channelCount, samplesPerSecond, &theta);
+                    }
+                }, buffer.get(), framesPerBuffer, frameSize, samplesPerSecond);
+            Report("sin()", baseline, channelCount, samplesPerSecond, 0);
+        }
+
+        for (const auto& isa : isas)
+        {
+            if (isa.Isa > bestIsa)
+            {
+                printf("  %-14s not supported\n", isa.Name);
+                continue;
+            }
+
+            toneGenerator.Initialize(Frequency, channelCount, samplesPerSecond, format.Format);
+            toneGenerator.SetIsa(isa.Isa);
+            double seconds = Time([&](BYTE* Buffer, UINT32 FrameCount)
+                {
+                    toneGenerator.Generate(Buffer, FrameCount);
+                }, buffer.get(), framesPerBuffer, frameSize, samplesPerSecond);
+            Report(isa.Name, seconds, channelCount, samplesPerSecond, baseline);
+
+            // Every instruction set must produce the same samples as the scalar code.
+            toneGenerator.Initialize(Frequency, channelCount, samplesPerSecond, format.Format);
+            toneGenerator.SetIsa(isa.Isa);
+            toneGenerator.Generate(buffer.get(), 100 * framesPerBuffer);
+            if (isa.Isa == CToneGenerator::Isa::Scalar)
+            {
+                CopyMemory(reference.get(), buffer.get(), bufferLength);
+            }
+            else if (memcmp(reference.get(), buffer.get(), bufferLength) != 0)
+            {
+                printf("  %-14s output differs from the scalar output\n", isa.Name);
+                mismatch = true;
+            }
+        }
+        printf("\n");
+    }
+
+    return mismatch ? 1 : 0;
+}
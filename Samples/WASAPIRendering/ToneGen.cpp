@@ -0,0 +1,426 @@
+//*********************************************************
+//
+// Copyright (c) Microsoft. All rights reserved.
+// This code is licensed under the MIT License (MIT).
+// THIS CODE IS PROVIDED *AS IS* WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESS OR IMPLIED, INCLUDING ANY
+// IMPLIED WARRANTIES OF FITNESS FOR A PARTICULAR
+// PURPOSE, MERCHANTABILITY, OR NON-INFRINGEMENT.
+//
+//*********************************************************
+
+#include "pch.h"
+#include <math.h>
+#include <intrin.h>
+#include <emmintrin.h>
+#include "ToneGen.h"
+
+#if (_MSC_VER >= 1700)
+#include <immintrin.h>
+#define TONEGEN_AVX2
+#endif
+
+namespace
+{
+    using SampleFormat = CToneGenerator::SampleFormat;
+
+    // Converts the phase, read as a signed number, to [-0.5 .. +0.5) cycles.
+    const float c_PhaseToCycles = 1.0f / 4294967296.0f;
+
+    // sin(2 * pi * x) = x * (c1 + x^2 * (c3 + x^2 * (c5 + ...))) for x in [-0.25 .. +0.25] cycles.
+    // These are the Taylor coefficients (2 * pi)^n / n!; with float rounding the error is under 2e-7,
+    // about one step of a 24-bit sample.
+    const float c_Sin1  =   6.28318531f;
+    const float c_Sin3  = -41.3417022f;
+    const float c_Sin5  =  81.6052493f;
+    const float c_Sin7  = -76.7058598f;
+    const float c_Sin9  =  42.0586940f;
+    const float c_Sin11 = -15.0946426f;
+
+    // Full scale for the integer formats.  Values are clamped to [-1.0 .. +1.0] first.
+    const float c_Pcm16Scale = 32767.0f;
+    const float c_Pcm24Scale = 8388607.0f;
+
+    //
+    //  The scalar functions below do exactly the same operations as the vector ones, in the same
+    //  order, so that the tail of a buffer matches the rest of it and every instruction set
+    //  produces the same output.
+    //
+    inline float SineOfPhase(UINT32 Phase)
+    {
+        float x = static_cast<float>(static_cast<INT32>(Phase)) * c_PhaseToCycles;
+
+        // Fold [0.25 .. 0.5] onto [0.25 .. 0] (and the same for negative x); sin(pi - a) = sin(a).
+        float a = fabsf(x);
+        float b = 0.5f - a;
+        x = copysignf((a < b) ? a : b, x);
+
+        float x2 = x * x;
+        return x * (c_Sin1 + x2 * (c_Sin3 + x2 * (c_Sin5 + x2 * (c_Sin7 + x2 * (c_Sin9 + x2 * c_Sin11)))));
+    }
+
+    inline int ToInteger(float Value, float Scale)
+    {
+        Value = (Value > -1.0f) ? Value : -1.0f;
+        Value = (Value < 1.0f) ? Value : 1.0f;
+        return static_cast<int>(lrintf(Value * Scale));
+    }
+
+    inline void StorePcm24Frame(BYTE*& Output, int Sample, WORD ChannelCount)
+    {
+        for (WORD channel = 0; channel < ChannelCount; channel++)
+        {
+            Output[0] = static_cast<BYTE>(Sample);
+            Output[1] = static_cast<BYTE>(Sample >> 8);
+            Output[2] = static_cast<BYTE>(Sample >> 16);
+            Output += 3;
+        }
+    }
+
+    //
+    //  Writes one sample to every channel of the frame at Output and moves Output to the next frame.
+    //
+    template <SampleFormat Format>
+    inline void StoreFrame(BYTE*& Output, float Value, WORD ChannelCount)
+    {
+        if constexpr (Format == SampleFormat::Float)
+        {
+            float* output = reinterpret_cast<float*>(Output);
+            for (WORD channel = 0; channel < ChannelCount; channel++)
+            {
+                output[channel] = Value;
+            }
+            Output += ChannelCount * sizeof(float);
+        }
+        else if constexpr (Format == SampleFormat::Pcm16Bit)
+        {
+            short sample = static_cast<short>(ToInteger(Value, c_Pcm16Scale));
+            short* output = reinterpret_cast<short*>(Output);
+            for (WORD channel = 0; channel < ChannelCount; channel++)
+            {
+                output[channel] = sample;
+            }
+            Output += ChannelCount * sizeof(short);
+        }
+        else
+        {
+            StorePcm24Frame(Output, ToInteger(Value, c_Pcm24Scale), ChannelCount);
+        }
+    }
+
+    template <SampleFormat Format>
+    void GenerateScalar(BYTE* Output, UINT32 FrameCount, WORD ChannelCount, UINT32 Phase, UINT32 PhaseIncrement)
+    {
+        for (UINT32 i = 0; i < FrameCount; i++)
+        {
+            StoreFrame<Format>(Output, SineOfPhase(Phase), ChannelCount);
+            Phase += PhaseIncrement;
+        }
+    }
+
+    //
+    //  SSE2: four frames at a time.
+    //
+    inline __m128 Sine4(__m128i Phase)
+    {
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+
+        __m128 x = _mm_mul_ps(_mm_cvtepi32_ps(Phase), _mm_set1_ps(c_PhaseToCycles));
+        __m128 sign = _mm_and_ps(x, signMask);
+        __m128 a = _mm_andnot_ps(signMask, x);
+        __m128 b = _mm_sub_ps(_mm_set1_ps(0.5f), a);
+        x = _mm_or_ps(_mm_min_ps(a, b), sign);
+
+        __m128 x2 = _mm_mul_ps(x, x);
+        __m128 p = _mm_add_ps(_mm_set1_ps(c_Sin9), _mm_mul_ps(x2, _mm_set1_ps(c_Sin11)));
+        p = _mm_add_ps(_mm_set1_ps(c_Sin7), _mm_mul_ps(x2, p));
+        p = _mm_add_ps(_mm_set1_ps(c_Sin5), _mm_mul_ps(x2, p));
+        p = _mm_add_ps(_mm_set1_ps(c_Sin3), _mm_mul_ps(x2, p));
+        p = _mm_add_ps(_mm_set1_ps(c_Sin1), _mm_mul_ps(x2, p));
+        return _mm_mul_ps(x, p);
+    }
+
+    inline __m128i ToInteger4(__m128 Value, float Scale)
+    {
+        Value = _mm_max_ps(Value, _mm_set1_ps(-1.0f));
+        Value = _mm_min_ps(Value, _mm_set1_ps(1.0f));
+        return _mm_cvtps_epi32(_mm_mul_ps(Value, _mm_set1_ps(Scale)));
+    }
+
+    template <SampleFormat Format>
+    inline void Store4Frames(BYTE*& Output, __m128 Value, WORD ChannelCount)
+    {
+        if constexpr (Format == SampleFormat::Float)
+        {
+            if (ChannelCount == 2)
+            {
+                _mm_storeu_ps(reinterpret_cast<float*>(Output), _mm_unpacklo_ps(Value, Value));
+                _mm_storeu_ps(reinterpret_cast<float*>(Output) + 4, _mm_unpackhi_ps(Value, Value));
+                Output += 8 * sizeof(float);
+                return;
+            }
+            if (ChannelCount == 1)
+            {
+                _mm_storeu_ps(reinterpret_cast<float*>(Output), Value);
+                Output += 4 * sizeof(float);
+                return;
+            }
+        }
+        else if constexpr (Format == SampleFormat::Pcm16Bit)
+        {
+            __m128i samples = ToInteger4(Value, c_Pcm16Scale);
+            samples = _mm_packs_epi32(samples, samples);
+            if (ChannelCount == 2)
+            {
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(Output), _mm_unpacklo_epi16(samples, samples));
+                Output += 8 * sizeof(short);
+                return;
+            }
+            if (ChannelCount == 1)
+            {
+                _mm_storel_epi64(reinterpret_cast<__m128i*>(Output), samples);
+                Output += 4 * sizeof(short);
+                return;
+            }
+        }
+        else
+        {
+            // There is no packed 24-bit store, so only the conversion is vectorized.
+            alignas(16) int samples[4];
+            _mm_store_si128(reinterpret_cast<__m128i*>(samples), ToInteger4(Value, c_Pcm24Scale));
+            for (int i = 0; i < 4; i++)
+            {
+                StorePcm24Frame(Output, samples[i], ChannelCount);
+            }
+            return;
+        }
+
+        // The other channel counts are written a frame at a time.
+        alignas(16) float values[4];
+        _mm_store_ps(values, Value);
+        for (int i = 0; i < 4; i++)
+        {
+            StoreFrame<Format>(Output, values[i], ChannelCount);
+        }
+    }
+
+    template <SampleFormat Format>
+    void GenerateSse2(BYTE* Output, UINT32 FrameCount, WORD ChannelCount, UINT32 Phase, UINT32 PhaseIncrement)
+    {
+        __m128i phase = _mm_add_epi32(_mm_set1_epi32(static_cast<int>(Phase)),
+            _mm_setr_epi32(0, static_cast<int>(PhaseIncrement), static_cast<int>(PhaseIncrement * 2), static_cast<int>(PhaseIncrement * 3)));
+        const __m128i step = _mm_set1_epi32(static_cast<int>(PhaseIncrement * 4));
+
+        UINT32 i = 0;
+        for (; i + 4 <= FrameCount; i += 4)
+        {
+            Store4Frames<Format>(Output, Sine4(phase), ChannelCount);
+            phase = _mm_add_epi32(phase, step);
+        }
+
+        if (i < FrameCount)
+        {
+            alignas(16) float values[4];
+            _mm_store_ps(values, Sine4(phase));
+            for (UINT32 j = 0; i < FrameCount; i++, j++)
+            {
+                StoreFrame<Format>(Output, values[j], ChannelCount);
+            }
+        }
+    }
+
+#ifdef TONEGEN_AVX2
+    //
+    //  AVX2: eight frames at a time.
+    //
+    inline __m256 Sine8(__m256i Phase)
+    {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+
+        __m256 x = _mm256_mul_ps(_mm256_cvtepi32_ps(Phase), _mm256_set1_ps(c_PhaseToCycles));
+        __m256 sign = _mm256_and_ps(x, signMask);
+        __m256 a = _mm256_andnot_ps(signMask, x);
+        __m256 b = _mm256_sub_ps(_mm256_set1_ps(0.5f), a);
+        x = _mm256_or_ps(_mm256_min_ps(a, b), sign);
+
+        __m256 x2 = _mm256_mul_ps(x, x);
+        __m256 p = _mm256_add_ps(_mm256_set1_ps(c_Sin9), _mm256_mul_ps(x2, _mm256_set1_ps(c_Sin11)));
+        p = _mm256_add_ps(_mm256_set1_ps(c_Sin7), _mm256_mul_ps(x2, p));
+        p = _mm256_add_ps(_mm256_set1_ps(c_Sin5), _mm256_mul_ps(x2, p));
+        p = _mm256_add_ps(_mm256_set1_ps(c_Sin3), _mm256_mul_ps(x2, p));
+        p = _mm256_add_ps(_mm256_set1_ps(c_Sin1), _mm256_mul_ps(x2, p));
+        return _mm256_mul_ps(x, p);
+    }
+
+    template <SampleFormat Format>
+    inline void Store8Frames(BYTE*& Output, __m256 Value, WORD ChannelCount)
+    {
+        if constexpr (Format == SampleFormat::Float)
+        {
+            if (ChannelCount == 2)
+            {
+                // unpacklo/hi work within each 128-bit half, so put the halves back in order.
+                __m256 low = _mm256_unpacklo_ps(Value, Value);
+                __m256 high = _mm256_unpackhi_ps(Value, Value);
+                _mm256_storeu_ps(reinterpret_cast<float*>(Output), _mm256_permute2f128_ps(low, high, 0x20));
+                _mm256_storeu_ps(reinterpret_cast<float*>(Output) + 8, _mm256_permute2f128_ps(low, high, 0x31));
+                Output += 16 * sizeof(float);
+                return;
+            }
+            if (ChannelCount == 1)
+            {
+                _mm256_storeu_ps(reinterpret_cast<float*>(Output), Value);
+                Output += 8 * sizeof(float);
+                return;
+            }
+        }
+        else if constexpr (Format == SampleFormat::Pcm16Bit)
+        {
+            Value = _mm256_max_ps(Value, _mm256_set1_ps(-1.0f));
+            Value = _mm256_min_ps(Value, _mm256_set1_ps(1.0f));
+            __m256i samples = _mm256_cvtps_epi32(_mm256_mul_ps(Value, _mm256_set1_ps(c_Pcm16Scale)));
+
+            // Frames 0-3 and 4-7 end up in the low 64 bits of each half.
+            samples = _mm256_packs_epi32(samples, samples);
+            if (ChannelCount == 2)
+            {
+                _mm256_storeu_si256(reinterpret_cast<__m256i*>(Output), _mm256_unpacklo_epi16(samples, samples));
+                Output += 16 * sizeof(short);
+                return;
+            }
+            if (ChannelCount == 1)
+            {
+                samples = _mm256_permute4x64_epi64(samples, _MM_SHUFFLE(3, 1, 2, 0));
+                _mm_storeu_si128(reinterpret_cast<__m128i*>(Output), _mm256_castsi256_si128(samples));
+                Output += 8 * sizeof(short);
+                return;
+            }
+        }
+        else
+        {
+            Value = _mm256_max_ps(Value, _mm256_set1_ps(-1.0f));
+            Value = _mm256_min_ps(Value, _mm256_set1_ps(1.0f));
+
+            alignas(32) int samples[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(samples), _mm256_cvtps_epi32(_mm256_mul_ps(Value, _mm256_set1_ps(c_Pcm24Scale))));
+            for (int i = 0; i < 8; i++)
+            {
+                StorePcm24Frame(Output, samples[i], ChannelCount);
+            }
+            return;
+        }
+
+        alignas(32) float values[8];
+        _mm256_store_ps(values, Value);
+        for (int i = 0; i < 8; i++)
+        {
+            StoreFrame<Format>(Output, values[i], ChannelCount);
+        }
+    }
+
+    template <SampleFormat Format>
+    void GenerateAvx2(BYTE* Output, UINT32 FrameCount, WORD ChannelCount, UINT32 Phase, UINT32 PhaseIncrement)
+    {
+        __m256i phase = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(Phase)),
+            _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(static_cast<int>(PhaseIncrement))));
+        const __m256i step = _mm256_set1_epi32(static_cast<int>(PhaseIncrement * 8));
+
+        UINT32 i = 0;
+        for (; i + 8 <= FrameCount; i += 8)
+        {
+            Store8Frames<Format>(Output, Sine8(phase), ChannelCount);
+            phase = _mm256_add_epi32(phase, step);
+        }
+
+        if (i < FrameCount)
+        {
+            alignas(32) float values[8];
+            _mm256_store_ps(values, Sine8(phase));
+            for (UINT32 j = 0; i < FrameCount; i++, j++)
+            {
+                StoreFrame<Format>(Output, values[j], ChannelCount);
+            }
+        }
+
+        _mm256_zeroupper();
+    }
+#endif
+
+    template <SampleFormat Format>
+    void GenerateTone(CToneGenerator::Isa InstructionSet, BYTE* Output, UINT32 FrameCount, WORD ChannelCount, UINT32 Phase, UINT32 PhaseIncrement)
+    {
+        switch (InstructionSet)
+        {
+#ifdef TONEGEN_AVX2
+        case CToneGenerator::Isa::Avx2:
+            GenerateAvx2<Format>(Output, FrameCount, ChannelCount, Phase, PhaseIncrement);
+            break;
+#endif
+        case CToneGenerator::Isa::Sse2:
+            GenerateSse2<Format>(Output, FrameCount, ChannelCount, Phase, PhaseIncrement);
+            break;
+        default:
+            GenerateScalar<Format>(Output, FrameCount, ChannelCount, Phase, PhaseIncrement);
+            break;
+        }
+    }
+}
+
+CToneGenerator::Isa CToneGenerator::BestIsa()
+{
+    int info[4];
+
+    __cpuid(info, 0);
+    int idCount = info[0];
+
+    __cpuid(info, 1);
+    bool sse2 = (info[3] & (1 << 26)) != 0;
+
+#ifdef TONEGEN_AVX2
+    bool osxsave = (info[2] & (1 << 27)) != 0;
+    bool avx = (info[2] & (1 << 28)) != 0;
+
+    if (idCount >= 7 && osxsave && avx && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+        {
+            return Isa::Avx2;
+        }
+    }
+#endif
+
+    return sse2 ? Isa::Sse2 : Isa::Scalar;
+}
+
+void CToneGenerator::Initialize(DWORD Frequency, WORD ChannelCount, DWORD SamplesPerSecond, SampleFormat Format)
+{
+    // Cycles per sample, as a 32-bit fraction.
+    _phaseIncrement = static_cast<UINT32>((static_cast<double>(Frequency) * 4294967296.0) / SamplesPerSecond + 0.5);
+    _phase = 0;
+    _channelCount = ChannelCount;
+    _format = Format;
+    _isa = BestIsa();
+
+    UINT32 bytesPerSample = (Format == SampleFormat::Pcm16Bit) ? 2 : (Format == SampleFormat::Pcm24Bit) ? 3 : 4;
+    _frameSize = bytesPerSample * ChannelCount;
+}
+
+void CToneGenerator::Generate(BYTE* Buffer, UINT32 FrameCount)
+{
+    switch (_format)
+    {
+    case SampleFormat::Float:
+        GenerateTone<SampleFormat::Float>(_isa, Buffer, FrameCount, _channelCount, _phase, _phaseIncrement);
+        break;
+    case SampleFormat::Pcm16Bit:
+        GenerateTone<SampleFormat::Pcm16Bit>(_isa, Buffer, FrameCount, _channelCount, _phase, _phaseIncrement);
+        break;
+    case SampleFormat::Pcm24Bit:
+        GenerateTone<SampleFormat::Pcm24Bit>(_isa, Buffer, FrameCount, _channelCount, _phase, _phaseIncrement);
+        break;
+    }
+
+    // The phase wraps at one cycle.
+    _phase += _phaseIncrement * FrameCount;
+}
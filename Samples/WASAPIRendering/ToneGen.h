@@ -12,61 +12,64 @@
 //
 //  Sine tone generator.
 //
-#include "pch.h"
+#pragma once
 
-#define _USE_MATH_DEFINES
-#include <math.h>
-#include <limits>
+#include <windows.h>
 
-// Convert from [-1.0...+1.0] to sample format.
-template<typename T>
-T Convert(double Value)
+//
+//  Generates a full scale sine wave, the same on every channel, directly in the render format.
+//
+//  The phase is a 32-bit fixed point fraction of a cycle, so it wraps exactly and never drifts,
+//  and the sine is a polynomial instead of a call to sin().  Several frames are computed at once
+//  with SSE2 or AVX2, converted to the sample format and interleaved into the output in the same
+//  pass.  Every instruction set produces exactly the same samples.
+//
+class CToneGenerator
 {
-    using limits = std::numeric_limits<T>;
-    if constexpr (limits::is_integer)
+public:
+    enum class SampleFormat
     {
-        // Scale to [-limits::max() .. +limits::max() ]
-        static_assert(limits::is_signed);
-        return static_cast<T>(Value * (limits::max)());
-    }
-    else
+        Float,
+        Pcm16Bit,
+        Pcm24Bit,       // Packed, 3 bytes per sample.
+    };
+
+    enum class Isa
     {
-        // Floating point types all use the range [-1.0 .. +1.0]
-        return static_cast<T>(Value);
-    }
-}
+        Scalar,
+        Sse2,
+        Avx2,
+    };
 
+    //  Returns the fastest instruction set that this processor and compiler support.
+    static Isa BestIsa();
 
+    CToneGenerator() = default;
 
-//
-//  Generate samples which represent a sine wave that fits into the specified buffer.  
-//
-//  T:  Type of data holding the sample (short, int, byte, float)
-//  Buffer - Buffer to hold the samples
-//  BufferLength - Length of the buffer.
-//  ChannelCount - Number of channels per audio frame.
-//  SamplesPerSecond - Samples/Second for the output data.
-//  InitialTheta - Initial theta value - start at 0, modified in this function.
-//
-template <typename T>
-void GenerateSineSamples(BYTE* Buffer, size_t BufferLength, DWORD Frequency, WORD ChannelCount, DWORD SamplesPerSecond, double* InitialTheta)
-{
-    double sampleIncrement = (Frequency * (M_PI * 2)) / (double)SamplesPerSecond;
-    T* dataBuffer = reinterpret_cast<T*>(Buffer);
-    double theta = (InitialTheta != NULL ? *InitialTheta : 0);
+    //
+    //  Frequency - Frequency of the tone (Hz).
+    //  ChannelCount - Number of channels per audio frame.
+    //  SamplesPerSecond - Samples/Second for the output data.
+    //  Format - Sample format of the output data.
+    //
+    void Initialize(DWORD Frequency, WORD ChannelCount, DWORD SamplesPerSecond, SampleFormat Format);
 
-    for (size_t i = 0; i < BufferLength / sizeof(T); i += ChannelCount)
-    {
-        double sinValue = sin(theta);
-        for (size_t j = 0; j < ChannelCount; j++)
-        {
-            dataBuffer[i + j] = Convert<T>(sinValue);
-        }
-        theta += sampleIncrement;
-    }
+    //  Only needed to compare the instruction sets; Initialize picks the best one.
+    void SetIsa(Isa InstructionSet) { _isa = InstructionSet; }
 
-    if (InitialTheta != NULL)
-    {
-        *InitialTheta = theta;
-    }
-}
+    //
+    //  Writes the next FrameCount frames of the tone to Buffer.  The tone continues where the
+    //  previous call left off.
+    //
+    void Generate(BYTE* Buffer, UINT32 FrameCount);
+
+    UINT32 FrameSize() const { return _frameSize; }
+
+private:
+    UINT32       _phase          = 0;   // Fraction of a cycle, 2^32 is one cycle.
+    UINT32       _phaseIncrement = 0;
+    WORD         _channelCount   = 0;
+    UINT32       _frameSize      = 0;
+    SampleFormat _format         = SampleFormat::Float;
+    Isa          _isa            = Isa::Scalar;
+};
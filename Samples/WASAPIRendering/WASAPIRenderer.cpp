@@ -124,6 +124,10 @@ HRESULT CWASAPIRenderer::CalculateMixFormatType()
         {
             _renderSampleType = RenderSampleType::Pcm16Bit;
         }
+        else if (_mixFormat->wBitsPerSample == 24)
+        {
+            _renderSampleType = RenderSampleType::Pcm24Bit;
+        }
         else
         {
             printf("Unknown PCM integer sample type\n");
@@ -214,38 +218,49 @@ void CWASAPIRenderer::Shutdown()
 
 
 //
-//  Start rendering - Create the render thread and start rendering the buffer.
+//  Start rendering - Create the render thread and start rendering the audio from Source.
 //
-HRESULT CWASAPIRenderer::Start(std::forward_list<RenderBuffer>&& RenderBufferQueue)
+HRESULT CWASAPIRenderer::Start(RenderSource&& Source)
 {
-    _renderBufferQueue = std::move(RenderBufferQueue);
+    _renderSource = std::move(Source);
 
     //
-    //  We want to pre-roll the first buffer's worth of data into the pipeline.  That way the audio engine won't glitch on startup.  
+    //  Allocate the buffer pool.  Each buffer holds one device period of audio.
     //
-    {
-        BYTE* pData;
+    UINT32 bufferLength = BufferSizePerPeriod() * _frameSize;
+    RETURN_HR_IF(E_UNEXPECTED, bufferLength == 0);
 
-        if (_renderBufferQueue.empty())
+    try
+    {
+        _renderBuffers.clear();
+        _renderBuffers.reserve(RenderBufferCount);
+        for (size_t i = 0; i < RenderBufferCount; i += 1)
         {
-            RETURN_IF_FAILED(_renderClient->GetBuffer(_bufferSize, &pData));
-            RETURN_IF_FAILED(_renderClient->ReleaseBuffer(_bufferSize, AUDCLNT_BUFFERFLAGS_SILENT));
+            _renderBuffers.emplace_back(bufferLength);
         }
-        else
-        {
-            //
-            //  Remove the buffer from the queue.
-            //
-            std::forward_list<RenderBuffer> head;
-            head.splice_after(head.before_begin(), _renderBufferQueue, _renderBufferQueue.before_begin());
-            RenderBuffer& renderBuffer = head.front();
-            DWORD bufferLengthInFrames = renderBuffer._bufferLength / _frameSize;
+    }
+    CATCH_RETURN();
 
-            RETURN_IF_FAILED(_renderClient->GetBuffer(bufferLengthInFrames, &pData));
+    _nextRenderBuffer = 0;
+    _renderBuffersQueued = 0;
+    while (_renderBuffersQueued < _renderBuffers.size() && FillRenderBuffer(_renderBuffers[_renderBuffersQueued]))
+    {
+        _renderBuffersQueued += 1;
+    }
 
-            CopyMemory(pData, renderBuffer._buffer.get(), renderBuffer._bufferLength);
-            RETURN_IF_FAILED(_renderClient->ReleaseBuffer(bufferLengthInFrames, 0));
-        }
+    //
+    //  We want to pre-roll the first buffer's worth of data into the pipeline.  That way the audio engine won't glitch on startup.  
+    //
+    if (_renderBuffersQueued == 0)
+    {
+        BYTE* pData;
+
+        RETURN_IF_FAILED(_renderClient->GetBuffer(_bufferSize, &pData));
+        RETURN_IF_FAILED(_renderClient->ReleaseBuffer(_bufferSize, AUDCLNT_BUFFERFLAGS_SILENT));
+    }
+    else
+    {
+        RETURN_IF_FAILED(RenderNextBuffer());
     }
 
     //
@@ -288,9 +303,11 @@ void CWASAPIRenderer::Stop()
     }
 
     //
-    //  Drain the buffers in the render buffer queue.
+    //  Release the buffer pool and the source.
     //
-    _renderBufferQueue.clear();
+    _renderBuffers.clear();
+    _renderBuffersQueued = 0;
+    _renderSource = nullptr;
 }
 
 
@@ -366,7 +383,7 @@ HRESULT CWASAPIRenderer::ProduceAudioFrames()
     //
     // Stop if we have nothing more to render.
     //
-    if (_renderBufferQueue.empty())
+    if (_renderBuffersQueued == 0)
     {
         return HRESULT_FROM_WIN32(ERROR_HANDLE_EOF);
     }
@@ -375,17 +392,35 @@ HRESULT CWASAPIRenderer::ProduceAudioFrames()
     //  If the buffer at the head of the render buffer queue does not fit in the frames available,
     //  then skip this pass. We will have more room on the next pass.
     //
-    if (_renderBufferQueue.front()._bufferLength > (framesAvailable * _frameSize))
+    if (_renderBuffers[_nextRenderBuffer]._bufferLength > (framesAvailable * _frameSize))
     {
         return S_OK;
     }
 
-    //
-    //  Remove the first buffer from the head of the queue.
-    //
-    std::forward_list<RenderBuffer> head;
-    head.splice_after(head.before_begin(), _renderBufferQueue, _renderBufferQueue.before_begin());
-    RenderBuffer& renderBuffer = head.front();
+    return RenderNextBuffer();
+}
+
+//
+//  Fill a buffer from the render source.  Once the source runs out, it is not called again.
+//
+bool CWASAPIRenderer::FillRenderBuffer(RenderBuffer& Buffer)
+{
+    if (_renderSource && !_renderSource(Buffer._buffer.get(), Buffer._bufferLength / _frameSize))
+    {
+        _renderSource = nullptr;
+    }
+    return static_cast<bool>(_renderSource);
+}
+
+//
+//  Copy the buffer at the head of the render buffer queue to the audio engine, then refill it.
+//
+//  The refilled buffer goes to the tail of the queue, so the audio for the next periods is generated
+//  right after this one is handed over instead of while the audio engine is waiting for it.
+//
+HRESULT CWASAPIRenderer::RenderNextBuffer()
+{
+    RenderBuffer& renderBuffer = _renderBuffers[_nextRenderBuffer];
 
     //
     //  Copy data from the render buffer to the output buffer and bump our render pointer.
@@ -396,6 +431,18 @@ HRESULT CWASAPIRenderer::ProduceAudioFrames()
     CopyMemory(pData, renderBuffer._buffer.get(), framesToWrite * _frameSize);
     RETURN_IF_FAILED(_renderClient->ReleaseBuffer(framesToWrite, 0));
 
+    _nextRenderBuffer = (_nextRenderBuffer + 1) % _renderBuffers.size();
+    _renderBuffersQueued -= 1;
+
+    //
+    //  While the source has more audio the pool is full, so the buffer we just rendered is the
+    //  one after the tail.
+    //
+    if (FillRenderBuffer(renderBuffer))
+    {
+        _renderBuffersQueued += 1;
+    }
+
     return S_OK;
 }
 
@@ -40,14 +40,21 @@ public:
     {
         Float,
         Pcm16Bit,
+        Pcm24Bit,
     };
 
+    //
+    //  Fills Buffer with the next FrameCount frames of audio in the mix format.  Returns false when
+    //  there is no more audio.  Called on the render thread.
+    //
+    using RenderSource = std::function<bool(BYTE* Buffer, UINT32 FrameCount)>;
+
     CWASAPIRenderer() = default;
     ~CWASAPIRenderer(void);
     void SetUp(IMMDevice* Endpoint, bool EnableStreamSwitch, ERole EndpointRole, bool EnableAudioViewManagerService);
     HRESULT Initialize(UINT32 EngineLatency);
     void Shutdown();
-    HRESULT Start(std::forward_list<RenderBuffer>&& RenderBufferQueue);
+    HRESULT Start(RenderSource&& Source);
     void Stop();
     WORD ChannelCount() { return _mixFormat->nChannels; }
     UINT32 SamplesPerSecond() { return _mixFormat->nSamplesPerSec; }
@@ -78,7 +85,18 @@ private:
     //
     //  Render buffer management.
     //
-    std::forward_list<RenderBuffer> _renderBufferQueue;
+    //  A small pool of buffers, used as a ring.  While the source has more audio, every buffer
+    //  holds audio that is ready to render: as soon as the buffer at the head has been copied to
+    //  the audio engine, it is refilled and becomes the tail.
+    //
+    static const size_t RenderBufferCount = 2;
+    std::vector<RenderBuffer> _renderBuffers;
+    size_t                    _nextRenderBuffer    = 0;
+    size_t                    _renderBuffersQueued = 0;
+    RenderSource              _renderSource;
+
+    bool FillRenderBuffer(RenderBuffer& Buffer);
+    HRESULT RenderNextBuffer();
 
     static DWORD __stdcall WASAPIRenderThread(LPVOID Context);
     DWORD DoRenderThread();
@@ -253,56 +253,50 @@ int wmain(int argc, wchar_t* argv[])
     {
         //
         //  We've initialized the renderer.  Once we've done that, we know some information about the
-        //  mix format and we can allocate the buffer that we're going to render.
+        //  mix format and we can set up the tone generator to produce samples in that format.
         //
-        //  The buffer is going to contain "TargetDuration" seconds worth of PCM data.  That means
-        //  we're going to have TargetDuration*samples/second frames multiplied by the frame size.
-        //
-        UINT32 renderBufferSizeInBytes = (renderer.BufferSizePerPeriod() * renderer.FrameSize());
-        size_t renderDataLength = (renderer.SamplesPerSecond() * TargetDurationInSec * renderer.FrameSize()) + (renderBufferSizeInBytes - 1);
-        size_t renderBufferCount = renderDataLength / (renderBufferSizeInBytes);
+        CToneGenerator::SampleFormat sampleFormat = CToneGenerator::SampleFormat::Float;
+        switch (renderer.SampleType())
+        {
+        case CWASAPIRenderer::RenderSampleType::Float:
+            sampleFormat = CToneGenerator::SampleFormat::Float;
+            break;
+        case CWASAPIRenderer::RenderSampleType::Pcm16Bit:
+            sampleFormat = CToneGenerator::SampleFormat::Pcm16Bit;
+            break;
+        case CWASAPIRenderer::RenderSampleType::Pcm24Bit:
+            sampleFormat = CToneGenerator::SampleFormat::Pcm24Bit;
+            break;
+        }
+
+        CToneGenerator toneGenerator;
+        toneGenerator.Initialize(TargetFrequency, renderer.ChannelCount(), renderer.SamplesPerSecond(), sampleFormat);
 
         //
-        //  Build the render buffer queue.
+        //  The renderer asks for one device period of samples at a time.  We're going to give it
+        //  TargetDuration seconds of tone, rounded up to a whole number of periods.
         //
-        std::forward_list<RenderBuffer> renderQueue;
-        // Keep an iterator to the tail of the list so we can append elements.
-        auto renderQueueTail = renderQueue.before_begin();
-
-        double theta = 0;
+        UINT32 framesPerPeriod = renderer.BufferSizePerPeriod();
+        size_t renderDataLength = (static_cast<size_t>(renderer.SamplesPerSecond()) * TargetDurationInSec) + (framesPerPeriod - 1);
+        size_t renderBufferCount = (framesPerPeriod != 0) ? renderDataLength / framesPerPeriod : 0;
 
-        for (size_t i = 0; i < renderBufferCount; i += 1)
+        //
+        //  The samples are generated just before the renderer needs them, into the renderer's own
+        //  small pool of buffers, instead of building the whole tone up front.
+        //
+        auto toneSource = [&toneGenerator, renderBufferCount](BYTE* Buffer, UINT32 FrameCount) mutable
         {
-            try
-            {
-                // Append another buffer to the queue.
-                renderQueueTail = renderQueue.emplace_after(renderQueueTail, renderBufferSizeInBytes);
-            }
-            catch (std::bad_alloc const&)
+            if (renderBufferCount == 0)
             {
-                printf("Unable to allocate render buffer\n");
-                return -1;
+                return false;
             }
+            renderBufferCount -= 1;
 
-            RenderBuffer& renderBuffer = *renderQueueTail;
-
-            //
-            //  Generate tone data in the buffer.
-            //
-            switch (renderer.SampleType())
-            {
-            case CWASAPIRenderer::RenderSampleType::Float:
-                GenerateSineSamples<float>(renderBuffer._buffer.get(), renderBuffer._bufferLength, TargetFrequency,
-                    renderer.ChannelCount(), renderer.SamplesPerSecond(), &theta);
-                break;
-            case CWASAPIRenderer::RenderSampleType::Pcm16Bit:
-                GenerateSineSamples<short>(renderBuffer._buffer.get(), renderBuffer._bufferLength, TargetFrequency,
-                    renderer.ChannelCount(), renderer.SamplesPerSecond(), &theta);
-                break;
-            }
-        }
+            toneGenerator.Generate(Buffer, FrameCount);
+            return true;
+        };
 
-        if (SUCCEEDED(renderer.Start(std::move(renderQueue))))
+        if (SUCCEEDED(renderer.Start(toneSource)))
         {
             do
             {
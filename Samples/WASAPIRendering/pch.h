@@ -20,5 +20,6 @@
 #endif
 
 #include <new>
-#include <forward_list>
+#include <functional>
+#include <vector>
 #include <memory>
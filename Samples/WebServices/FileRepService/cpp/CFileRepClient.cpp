@@ -86,9 +86,13 @@ HRESULT CFileRepClient::ProcessMessage(
 // - If the request is asynchronous send back a confirmation immediately
 // - We send a request for file information to the server service. A discovery request is denoted by a chunk position of -1.
 // - We get the file information
-// - We request the individual chunks sequentially one by one from the server.
-// Chunks are identified by their position within the file. This could be optimized by asynchronously requesting
-// multiple chunks. However, that is beyond the scope of this version of the sample.
+// - If delta sync is enabled and the destination file already exists, we send the signatures of its blocks
+// and get back a delta that only contains the data we do not have yet. If that is not possible we fall back
+// to requesting the whole file.
+// - We request the individual chunks from the server. Chunks are identified by their position within the file.
+// By default they are requested sequentially one by one. With a transfer window of more than one, that many
+// channels each keep a chunk request in flight and write the chunks they receive at their position in the file.
+// This keeps high-latency links busy.
 // - Repeat until the file transfer is completed or a failure occured
 // - If the request is synchronous send success or failure message to the command line tool.
 // For the individual data structures associated with each message, see common.h.
@@ -115,6 +119,9 @@ HRESULT CFileRepClient::ProcessUserRequest(
     LONGLONG fileLength = 0;
     long chunkSize = -1;
     LONGLONG transferTime = 0;
+    LONGLONG literalBytes = -1;
+    long channelCount = 1;
+    ChunkTransfer transfer;
     LARGE_INTEGER size;
     size.QuadPart = 0;
     WS_MESSAGE_PROPERTY heapProperty;
@@ -202,33 +209,61 @@ HRESULT CFileRepClient::ProcessUserRequest(
         EXIT_FUNCTION
     }
 
-    // For simplicity reasons we do not read alternate data streams.
-    file = CreateFileW(destinationPath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    transferTime = GetTickCount64();
 
-    if (INVALID_HANDLE_VALUE == file)
+    if (deltaSync)
     {
-        PrintInfo(L"Failed to create file");
-
-        if (SYNC_REQUEST == requestType)
+        // Any failure here just means we have to transfer the whole file.
+        if (S_OK != TransferFileDelta(sourcePath, destinationPath, fileLength, serverRequestMessage,
+            serverReplyMessage, serverChannel, error, &literalBytes))
         {
-            hr = request->SendFault(FAILED_TO_CREATE_FILE);
+            PrintInfo(L"Delta transfer not possible. Transferring the whole file.");
+            literalBytes = -1;
         }
-        EXIT_FUNCTION
     }
 
-    IfFailedExit(ExtendFile(file, fileLength));
+    if (-1 == literalBytes)
+    {
+        // For simplicity reasons we do not read alternate data streams.
+        file = CreateFileW(destinationPath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
 
-    transferTime = GetTickCount64();
+        if (INVALID_HANDLE_VALUE == file)
+        {
+            PrintInfo(L"Failed to create file");
+
+            if (SYNC_REQUEST == requestType)
+            {
+                hr = request->SendFault(FAILED_TO_CREATE_FILE);
+            }
+            EXIT_FUNCTION
+        }
 
-    // This loop could be further optimized by asychronously requesting the individual chunks in
-    // parallel and then assembling them later. We chose to draw the line regarding perf optimizations
-    // for this version of the code here to avoid the complexity of doing asynchronous file assembly.
+        IfFailedExit(ExtendFile(file, fileLength));
 
-    fileRequest.filePosition = 0;
-    while (fileRequest.filePosition < fileLength)
-    {
-        IfFailedExit(ProcessChunk(chunkSize , file, fileLength, serverRequestMessage,
-            serverReplyMessage, serverChannel, error, &fileRequest));
+        if (1 < transferWindow && chunkSize < fileLength)
+        {
+            transfer.client = this;
+            transfer.sourcePath = sourcePath;
+            transfer.serverUri = serverUri;
+            transfer.transportMode = transportMode;
+            transfer.securityMode = securityMode;
+            transfer.encoding = encoding;
+            transfer.file = file;
+            transfer.fileLength = fileLength;
+            transfer.chunkSize = chunkSize;
+
+            IfFailedExit(TransferChunksParallel(&transfer, serverChannel, serverRequestMessage, serverReplyMessage, error));
+            channelCount = transfer.openChannels;
+        }
+        else
+        {
+            fileRequest.filePosition = 0;
+            while (fileRequest.filePosition < fileLength)
+            {
+                IfFailedExit(ProcessChunk(chunkSize , file, fileLength, serverRequestMessage,
+                    serverReplyMessage, serverChannel, error, &fileRequest));
+            }
+        }
     }
 
     transferTime = GetTickCount64() - transferTime;
@@ -242,9 +277,20 @@ HRESULT CFileRepClient::ProcessUserRequest(
     // This assumes that we did not use more than 4 billion chunks, a pretty reasonable assumption.
     DWORD totalChunks = (DWORD)(fileLength/chunkSize) + 1;
 
+    // Throughput in KB/s. Transfers faster than the tick resolution are counted as one millisecond.
+    LONGLONG throughput = size.QuadPart * 1000 / 1024 / (transferTime > 0 ? transferTime : 1);
+
     // Again failures are ignored since it is just a status message.
-    StringCchPrintfW(perf, CountOf(perf), L"Transferred %I64d bytes via %u chunks in %I64d milliseconds.",
-       size.QuadPart, totalChunks, transferTime);
+    if (-1 == literalBytes)
+    {
+        StringCchPrintfW(perf, CountOf(perf), L"Transferred %I64d bytes via %u chunks over %d channels in %I64d milliseconds (%I64d KB/s).",
+           size.QuadPart, totalChunks, channelCount, transferTime, throughput);
+    }
+    else
+    {
+        StringCchPrintfW(perf, CountOf(perf), L"Transferred %I64d bytes via delta with %I64d bytes of new data in %I64d milliseconds (%I64d KB/s).",
+           size.QuadPart, literalBytes, transferTime, throughput);
+    }
 
     // StringCchPrintf ensures that the buffer is nullterminated even if the function failed.
     PrintInfo(perf);
@@ -371,8 +417,8 @@ HRESULT CFileRepClient::CreateServerChannel(
 }
 
 // Extend the file to the total size needed for performance reasons.
-// For a synchronous write such as this this is not a big deal, but if this code
-// would be made async then it would be. And even now this is more performant.
+// For a synchronous write such as this this is not a big deal, but when chunks arrive out of order
+// on multiple channels it is. And even for sequential transfers this is more performant.
 HRESULT CFileRepClient::ExtendFile(
     _In_ HANDLE file,
     _In_ LONGLONG length)
@@ -460,7 +506,7 @@ HRESULT CFileRepClient::ProcessChunk(
         EXIT_FUNCTION
     }
 
-    IfFailedExit(DeserializeAndWriteMessage(replyMessage, chunkSize, &chunkPosition, &contentLength, file));
+    IfFailedExit(DeserializeAndWriteMessage(replyMessage, chunkSize, pos, &chunkPosition, &contentLength, file));
 
     // Read end of message.
     IfFailedExit(WsReadMessageEnd(channel, replyMessage, NULL, error));
@@ -488,6 +534,179 @@ HRESULT CFileRepClient::ProcessChunk(
     return hr;
 }
 
+// Requests chunks on one channel until there are no chunks left or any channel failed.
+HRESULT CFileRepClient::TransferChunks(
+    _In_ ChunkTransfer* transfer,
+    _In_ WS_CHANNEL* channel,
+    _In_ WS_MESSAGE* requestMessage,
+    _In_ WS_MESSAGE* replyMessage,
+    _In_opt_ WS_ERROR* error)
+{
+    PrintVerbose(L"Entering CFileRepClient::TransferChunks");
+
+    HRESULT hr = S_OK;
+    FileRequest fileRequest;
+    fileRequest.fileName = transfer->sourcePath;
+
+    while (SUCCEEDED(transfer->result))
+    {
+        // Claim the next chunk. Every channel gets a different one.
+        fileRequest.filePosition = InterlockedExchangeAdd64(&transfer->nextPosition, transfer->chunkSize);
+        if (fileRequest.filePosition >= transfer->fileLength)
+        {
+            break;
+        }
+
+        hr = ProcessChunk(transfer->chunkSize, transfer->file, transfer->fileLength, requestMessage,
+            replyMessage, channel, error, &fileRequest);
+
+        if (FAILED(hr))
+        {
+            // Stop the other channels as well. Only the first failure is kept.
+            InterlockedCompareExchange(&transfer->result, hr, S_OK);
+            break;
+        }
+    }
+
+    PrintVerbose(L"Leaving CFileRepClient::TransferChunks");
+
+    return hr;
+}
+
+// Transfers the file over up to transferWindow channels with one outstanding chunk request each.
+// The calling thread drives the channel that is already open. The others are opened on work items.
+HRESULT CFileRepClient::TransferChunksParallel(
+    _In_ ChunkTransfer* transfer,
+    _In_ WS_CHANNEL* channel,
+    _In_ WS_MESSAGE* requestMessage,
+    _In_ WS_MESSAGE* replyMessage,
+    _In_opt_ WS_ERROR* error)
+{
+    PrintVerbose(L"Entering CFileRepClient::TransferChunksParallel");
+
+    HRESULT hr = S_OK;
+
+    // There is no point in opening more channels than there are chunks.
+    LONGLONG chunkCount = (transfer->fileLength + transfer->chunkSize - 1) / transfer->chunkSize;
+    long additionalChannels = transferWindow - 1;
+    if (chunkCount - 1 < additionalChannels)
+    {
+        additionalChannels = (long)(chunkCount - 1);
+    }
+
+    transfer->nextPosition = 0;
+    transfer->result = S_OK;
+    transfer->activeWorkers = additionalChannels;
+    transfer->openChannels = 1;
+    transfer->workersDone = CreateEventW(NULL, TRUE, 0 == additionalChannels, NULL);
+    if (NULL == transfer->workersDone)
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        PrintVerbose(L"Leaving CFileRepClient::TransferChunksParallel");
+        return hr;
+    }
+
+    for (long i = 0; i < additionalChannels; i++)
+    {
+        if (!::QueueUserWorkItem(CFileRepClient::TransferChunksWorkItem, transfer, WT_EXECUTELONGFUNCTION))
+        {
+            // Not fatal. The channels we do have pick up the remaining chunks.
+            PrintInfo(L"Unable to start an additional transfer channel.");
+
+            if (0 == InterlockedDecrement(&transfer->activeWorkers))
+            {
+                SetEvent(transfer->workersDone);
+            }
+        }
+    }
+
+    hr = TransferChunks(transfer, channel, requestMessage, replyMessage, error);
+
+    // The other channels still write into the file, so we have to wait for them even if we failed.
+    WaitForSingleObject(transfer->workersDone, INFINITE);
+    CloseHandle(transfer->workersDone);
+    transfer->workersDone = NULL;
+
+    if (SUCCEEDED(hr))
+    {
+        hr = transfer->result;
+    }
+
+    PrintVerbose(L"Leaving CFileRepClient::TransferChunksParallel");
+
+    return hr;
+}
+
+ULONG WINAPI CFileRepClient::TransferChunksWorkItem(
+    _In_ void* state)
+{
+    ChunkTransfer* transfer = (ChunkTransfer*)state;
+    transfer->client->RunTransferChunksWorkItem(transfer);
+    return 0;
+}
+
+// Opens an additional channel to the server and requests chunks on it.
+void CFileRepClient::RunTransferChunksWorkItem(
+    _In_ ChunkTransfer* transfer)
+{
+    PrintVerbose(L"Entering CFileRepClient::RunTransferChunksWorkItem");
+
+    HRESULT hr = S_OK;
+    WS_ERROR* error = NULL;
+    WS_CHANNEL* channel = NULL;
+    WS_MESSAGE* requestMessage = NULL;
+    WS_MESSAGE* replyMessage = NULL;
+    WS_MESSAGE_PROPERTY heapProperty = CFileRepClient::CreateHeapProperty();
+    WS_ENDPOINT_ADDRESS address = {};
+
+    IfFailedExit(WsCreateError(NULL, 0, &error));
+    IfFailedExit(CreateServerChannel(transfer->encoding, transfer->transportMode, transfer->securityMode, error, &channel));
+    IfFailedExit(WsCreateMessageForChannel(channel, NULL, 0, &requestMessage, error));
+    IfFailedExit(WsCreateMessageForChannel(channel, &heapProperty, 1, &replyMessage, error));
+
+    address.url.chars = transfer->serverUri;
+    IfFailedExit(SizeTToULong(::wcslen(address.url.chars), &address.url.length));
+    IfFailedExit(WsOpenChannel(channel, &address, NULL, error));
+    InterlockedIncrement(&transfer->openChannels);
+
+    // Failures from here on are recorded in the transfer and fail the whole request.
+    TransferChunks(transfer, channel, requestMessage, replyMessage, error);
+
+    EXIT
+
+    if (FAILED(hr))
+    {
+        // We could not set up this channel. That only costs throughput as the other channels keep going.
+        PrintError(L"CFileRepClient::RunTransferChunksWorkItem", false);
+        PrintError(hr, error, false);
+    }
+
+    if (NULL != requestMessage)
+    {
+        WsFreeMessage(requestMessage);
+    }
+
+    if (NULL != replyMessage)
+    {
+        WsFreeMessage(replyMessage);
+    }
+
+    CleanupChannel(channel);
+
+    if (NULL != error)
+    {
+        WsFreeError(error);
+    }
+
+    PrintVerbose(L"Leaving CFileRepClient::RunTransferChunksWorkItem");
+
+    // This has to be the last access to the transfer. The thread that waits for us owns it.
+    if (0 == InterlockedDecrement(&transfer->activeWorkers))
+    {
+        SetEvent(transfer->workersDone);
+    }
+}
+
 // It is more efficient to manually read this message instead of using the serializer since otherwise the
 // byte array would have to be copied around memory multiple times while here we can stream it directly into the file.
 // Since the message is simple this is relatively easy to do and makes the perf gain worth the extra effort. In general,
@@ -496,6 +715,7 @@ HRESULT CFileRepClient::ProcessChunk(
 HRESULT CFileRepClient::DeserializeAndWriteMessage(
     _In_ WS_MESSAGE* message,
     _In_ long chunkSize,
+    _In_ LONGLONG expectedPosition,
     _Out_ LONGLONG* chunkPosition,
     _Out_ long* contentLength,
     _In_ HANDLE file)
@@ -547,6 +767,14 @@ HRESULT CFileRepClient::DeserializeAndWriteMessage(
     // Read chunk position end element
     IfFailedExit(WsReadEndElement(reader, NULL));
 
+    // Chunks are written at the position they claim to belong to, so make sure that is the one we asked for
+    // before writing anything. An error reply has position -1 and no content; its error text is read below.
+    if (*chunkPosition != expectedPosition && -1 != *chunkPosition)
+    {
+        hr = E_FAIL;
+        EXIT_FUNCTION
+    }
+
     // Read to file content element
     IfFailedExit(WsReadToStartElement(reader, &fileContentLocalName, &fileChunkNamespace, NULL, NULL));
 
@@ -572,11 +800,33 @@ HRESULT CFileRepClient::DeserializeAndWriteMessage(
             break;
         }
 
+        if (-1 == *chunkPosition)
+        {
+            PrintError(L"Error reply carries file data.", true);
+            hr = E_FAIL;
+            EXIT_FUNCTION
+        }
+
+        if (length + bytesRead > (ULONG)chunkSize)
+        {
+            PrintError(L"Chunk exceeds the chunk size.", true);
+            hr = E_FAIL;
+            EXIT_FUNCTION
+        }
+
+        // This is a positional write so that chunks received on different channels can be written
+        // in any order without sharing a file pointer.
+        OVERLAPPED overlapped = {};
+        LARGE_INTEGER offset;
+        offset.QuadPart = *chunkPosition + length;
+        overlapped.Offset = offset.LowPart;
+        overlapped.OffsetHigh = offset.HighPart;
+
         length+=bytesRead;
 
         ULONG count = 0;
 
-        if (!WriteFile(file, buf, bytesRead, &count, NULL))
+        if (!WriteFile(file, buf, bytesRead, &count, &overlapped))
         {
             PrintError(L"File write error.", true);
             hr = HRESULT_FROM_WIN32(GetLastError());
@@ -685,4 +935,512 @@ HRESULT CFileRepClient::SendUserResponse(
     return hr;
 }
 
+// Reads a simple element containing a 64 bit integer.
+static HRESULT ReadInt64Element(
+    _In_ WS_XML_READER* reader,
+    _In_ const WS_XML_STRING* localName,
+    _In_ const WS_XML_STRING* ns,
+    _Out_ LONGLONG* value)
+{
+    HRESULT hr = S_OK;
+
+    IfFailedExit(WsReadToStartElement(reader, localName, ns, NULL, NULL));
+    IfFailedExit(WsReadStartElement(reader, NULL));
+    IfFailedExit(WsReadValue(reader, WS_INT64_VALUE_TYPE, value, sizeof(*value), NULL));
+    IfFailedExit(WsReadEndElement(reader, NULL));
+
+    EXIT
+
+    return hr;
+}
+
+// Brings the existing destination file up to date by only transferring the parts that changed.
+// The new file is assembled next to the existing one since the delta refers to data in the old version.
+// Like the chunked transfer, the delta is requested one bounded part at a time. Every request carries the
+// signatures again since the server does not keep state between requests.
+// Returns S_FALSE if there is nothing to base a delta on, in which case the caller transfers the whole file.
+HRESULT CFileRepClient::TransferFileDelta(
+    _In_z_ const LPWSTR sourcePath,
+    _In_z_ const LPWSTR destinationPath,
+    _In_ LONGLONG fileLength,
+    _In_ WS_MESSAGE* requestMessage,
+    _In_ WS_MESSAGE* replyMessage,
+    _In_ WS_CHANNEL* channel,
+    _In_opt_ WS_ERROR* error,
+    _Out_ LONGLONG* literalBytes)
+{
+    PrintVerbose(L"Entering CFileRepClient::TransferFileDelta");
+
+    HRESULT hr = S_OK;
+    HANDLE basisFile = INVALID_HANDLE_VALUE;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    WCHAR tempPath[MAX_PATH + 16];
+    LARGE_INTEGER basisLength;
+    DeltaRequest deltaRequest = {};
+    LONGLONG filePosition = 0;
+    LONGLONG newBytes = 0;
+
+    *literalBytes = -1;
+    tempPath[0] = L'\0';
+
+    basisFile = CreateFileW(destinationPath, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (INVALID_HANDLE_VALUE == basisFile)
+    {
+        PrintInfo(L"No existing destination file to base a delta on.");
+        hr = S_FALSE;
+        EXIT_FUNCTION
+    }
+
+    if (!GetFileSizeEx(basisFile, &basisLength))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        EXIT_FUNCTION
+    }
+
+    if (0 == basisLength.QuadPart)
+    {
+        hr = S_FALSE;
+        EXIT_FUNCTION
+    }
+
+    deltaRequest.fileName = sourcePath;
+    deltaRequest.basisLength = basisLength.QuadPart;
+    deltaRequest.blockSize = ChooseDeltaBlockSize(basisLength.QuadPart);
+
+    IfFailedExit(ComputeSignatures(basisFile, basisLength.QuadPart, deltaRequest.blockSize, &deltaRequest.signatures));
+
+    // The destination path length was checked by the caller, so this does not truncate.
+    IfFailedExit(StringCchPrintfW(tempPath, CountOf(tempPath), L"%s.filerep", destinationPath));
+
+    file = CreateFileW(tempPath, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        PrintInfo(L"Failed to create temporary file");
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        EXIT_FUNCTION
+    }
+
+    IfFailedExit(ExtendFile(file, fileLength));
+
+    WS_MESSAGE_DESCRIPTION deltaRequestMessageDescription;
+    deltaRequestMessageDescription.action = &deltaRequestAction;
+    deltaRequestMessageDescription.bodyElementDescription = &deltaRequestElement;
+
+    // An empty file still takes one request, which confirms its length.
+    do
+    {
+        deltaRequest.deltaPosition = filePosition;
+
+        IfFailedExit(WsResetMessage(requestMessage, error));
+        IfFailedExit(WsResetMessage(replyMessage, error));
+
+        IfFailedExit(WsSendMessage(
+            channel,
+            requestMessage,
+            &deltaRequestMessageDescription,
+            WS_WRITE_REQUIRED_VALUE,
+            &deltaRequest,
+            sizeof(deltaRequest),
+            NULL,
+            error));
+
+        // Receive start of message (headers).
+        IfFailedExit(WsReadMessageStart(channel, replyMessage, NULL, error));
+
+        // Get action value.
+        WS_XML_STRING* receivedAction = NULL;
+        IfFailedExit(WsGetHeader(
+            replyMessage,
+            WS_ACTION_HEADER,
+            WS_XML_STRING_TYPE,
+            WS_READ_REQUIRED_POINTER,
+            NULL,
+            &receivedAction,
+            sizeof(receivedAction),
+            error));
+
+        // Make sure action is what we expect.
+        if (WsXmlStringEquals(receivedAction, &deltaReplyAction, error) != S_OK)
+        {
+            hr = WS_E_ENDPOINT_ACTION_NOT_SUPPORTED;
+            PrintInfo(L"Received unexpected message.\n");
+
+            EXIT_FUNCTION
+        }
+
+        IfFailedExit(DeserializeAndApplyDelta(replyMessage, basisFile, basisLength.QuadPart, file, fileLength,
+            &filePosition, &newBytes));
+
+        // Read end of message.
+        IfFailedExit(WsReadMessageEnd(channel, replyMessage, NULL, error));
+    } while (filePosition < fileLength);
+
+    *literalBytes = newBytes;
+
+    // Both files have to be closed before the new version can replace the old one.
+    CloseHandle(basisFile);
+    basisFile = INVALID_HANDLE_VALUE;
+
+    if (!CloseHandle(file))
+    {
+        file = INVALID_HANDLE_VALUE;
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        EXIT_FUNCTION
+    }
+
+    file = INVALID_HANDLE_VALUE;
+
+    if (!MoveFileExW(tempPath, destinationPath, MOVEFILE_REPLACE_EXISTING))
+    {
+        PrintError(L"Unable to replace destination file.", true);
+        hr = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    EXIT
+
+    if (INVALID_HANDLE_VALUE != basisFile)
+    {
+        CloseHandle(basisFile);
+    }
+
+    if (INVALID_HANDLE_VALUE != file)
+    {
+        CloseHandle(file);
+    }
+
+    if (NULL != deltaRequest.signatures.bytes)
+    {
+        HeapFree(GetProcessHeap(), 0, deltaRequest.signatures.bytes);
+    }
+
+    if (S_OK != hr)
+    {
+        *literalBytes = -1;
+
+        if (L'\0' != tempPath[0])
+        {
+            DeleteFileW(tempPath);
+        }
+    }
+
+    if (FAILED(hr))
+    {
+        PrintError(L"CFileRepClient::TransferFileDelta", true);
+        PrintError(hr, error, true);
+    }
+
+    PrintVerbose(L"Leaving CFileRepClient::TransferFileDelta");
+
+    return hr;
+}
+
+// Computes the weak and strong hash of every full block of the existing file.
+// The signatures buffer is allocated from the process heap and owned by the caller.
+HRESULT CFileRepClient::ComputeSignatures(
+    _In_ HANDLE basisFile,
+    _In_ LONGLONG basisLength,
+    _In_ DWORD blockSize,
+    _Out_ WS_BYTES* signatures)
+{
+    PrintVerbose(L"Entering CFileRepClient::ComputeSignatures");
+
+    HRESULT hr = S_OK;
+    BYTE* buf = NULL;
+    BlockSignature* signature = NULL;
+    CRollingChecksum checksum;
+    CStrongHash strongHash;
+
+    // ChooseDeltaBlockSize guarantees that this fits.
+    ULONG signatureCount = (ULONG)(basisLength / blockSize);
+
+    signatures->bytes = NULL;
+    signatures->length = 0;
+
+    IfFailedExit(strongHash.Initialize());
+
+    buf = (BYTE*)HeapAlloc(GetProcessHeap(), 0, blockSize);
+    IfNullExit(buf);
+
+    // Allocate at least one signature so that an empty array is not a special case.
+    signature = (BlockSignature*)HeapAlloc(GetProcessHeap(), 0, (signatureCount + 1) * sizeof(BlockSignature));
+    IfNullExit(signature);
+
+    signatures->bytes = (BYTE*)signature;
+    signatures->length = signatureCount * sizeof(BlockSignature);
+
+    for (ULONG block = 0; block < signatureCount; block++)
+    {
+        ULONG length = 0;
+
+        while (length < blockSize)
+        {
+            ULONG bytesRead = 0;
+
+            if (!ReadFile(basisFile, &buf[length], blockSize - length, &bytesRead, NULL))
+            {
+                PrintError(L"File read error.", true);
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                EXIT_FUNCTION
+            }
+
+            if (0 == bytesRead)
+            {
+                // The file got shorter since we determined its length.
+                hr = E_FAIL;
+                EXIT_FUNCTION
+            }
+
+            length += bytesRead;
+        }
+
+        checksum.Reset(buf, blockSize);
+        signature[block].weakHash = checksum.GetValue();
+        IfFailedExit(strongHash.Compute(buf, blockSize, signature[block].strongHash));
+    }
+
+    EXIT
+
+    if (NULL != buf)
+    {
+        HeapFree(GetProcessHeap(), 0, buf);
+    }
+
+    if (FAILED(hr) && NULL != signatures->bytes)
+    {
+        HeapFree(GetProcessHeap(), 0, signatures->bytes);
+        signatures->bytes = NULL;
+        signatures->length = 0;
+    }
+
+    PrintVerbose(L"Leaving CFileRepClient::ComputeSignatures");
+
+    return hr;
+}
+
+// Appends one part of the delta to the file. Like DeserializeAndWriteMessage this reads the message manually
+// so that literal data can be streamed directly into the file. Segments referring to the existing file are
+// copied from it. On success filePosition is moved to the end of the part and the new data is added to
+// literalBytes.
+HRESULT CFileRepClient::DeserializeAndApplyDelta(
+    _In_ WS_MESSAGE* message,
+    _In_ HANDLE basisFile,
+    _In_ LONGLONG basisLength,
+    _In_ HANDLE file,
+    _In_ LONGLONG fileLength,
+    _Inout_ LONGLONG* filePosition,
+    _Inout_ LONGLONG* literalBytes)
+{
+    PrintVerbose(L"Entering CFileRepClient::DeserializeAndApplyDelta");
+    WS_XML_READER* reader = NULL;
+    HRESULT hr = S_OK;
+    LPWSTR errorString = NULL;
+    WS_HEAP* heap = NULL;
+    BYTE* buf = NULL;
+    LONGLONG deltaLength = 0;
+    LONGLONG length = *filePosition;
+
+    // Create a description for the error text field that we read later.
+    WS_ELEMENT_DESCRIPTION errorDescription = {&deltaErrorLocalName, &fileDeltaNamespace, WS_WSZ_TYPE, NULL};
+
+    IfFailedExit(WsGetMessageProperty(message, WS_MESSAGE_PROPERTY_BODY_READER, &reader, sizeof(reader), NULL));
+
+    // Read to FileDelta element
+    IfFailedExit(WsReadToStartElement(reader, &fileDeltaLocalName, &fileDeltaNamespace, NULL, NULL));
+
+    // Read FileDelta start element
+    IfFailedExit(WsReadStartElement(reader, NULL));
+
+    IfFailedExit(ReadInt64Element(reader, &deltaFileLengthLocalName, &fileDeltaNamespace, &deltaLength));
+
+    // The file may have changed since we asked for its length. In that case we start over with a full transfer.
+    // A length of -1 denotes an error, which is reported by the error element below.
+    if (-1 != deltaLength && deltaLength != fileLength)
+    {
+        PrintInfo(L"File changed on the server during the transfer.");
+        hr = E_FAIL;
+        EXIT_FUNCTION
+    }
+
+    buf = (BYTE*)HeapAlloc(GetProcessHeap(), 0, FILE_CHUNK);
+    IfNullExit(buf);
+
+    for (;;)
+    {
+        BOOL found = FALSE;
+        LONGLONG sourcePosition = 0;
+        LONGLONG segmentLength = 0;
+        LONGLONG segmentWritten = 0;
+
+        IfFailedExit(WsReadToStartElement(reader, &deltaSegmentLocalName, &fileDeltaNamespace, &found, NULL));
+        if (!found)
+        {
+            // The next element is the error element.
+            break;
+        }
+
+        // Read DeltaSegment start element
+        IfFailedExit(WsReadStartElement(reader, NULL));
+
+        IfFailedExit(ReadInt64Element(reader, &sourcePositionLocalName, &fileDeltaNamespace, &sourcePosition));
+        IfFailedExit(ReadInt64Element(reader, &segmentLengthLocalName, &fileDeltaNamespace, &segmentLength));
+
+        if (segmentLength < 0 || length + segmentLength > fileLength)
+        {
+            hr = E_FAIL;
+            EXIT_FUNCTION
+        }
+
+        // Read to data element and read its start element
+        IfFailedExit(WsReadToStartElement(reader, &segmentDataLocalName, &fileDeltaNamespace, NULL, NULL));
+        IfFailedExit(WsReadStartElement(reader, NULL));
+
+        if (DELTA_LITERAL_SEGMENT == sourcePosition)
+        {
+            // New data. Stream it from the message into the file.
+            for (;;)
+            {
+                ULONG bytesRead = 0;
+                IfFailedExit(WsReadBytes(reader, buf, FILE_CHUNK, &bytesRead, NULL));
+
+                if (0 == bytesRead)
+                {
+                    break;
+                }
+
+                segmentWritten += bytesRead;
+                if (segmentWritten > segmentLength)
+                {
+                    hr = E_FAIL;
+                    EXIT_FUNCTION
+                }
+
+                ULONG count = 0;
+
+                if (!WriteFile(file, buf, bytesRead, &count, NULL) || count != bytesRead)
+                {
+                    PrintError(L"File write error.", true);
+                    hr = E_FAIL;
+                    EXIT_FUNCTION
+                }
+            }
+
+            *literalBytes += segmentWritten;
+        }
+        else
+        {
+            // Data we already have. Copy it from the existing file.
+            if (sourcePosition < 0 || sourcePosition + segmentLength > basisLength)
+            {
+                hr = E_FAIL;
+                EXIT_FUNCTION
+            }
+
+            LARGE_INTEGER pos;
+            pos.QuadPart = sourcePosition;
+
+            if (!SetFilePointerEx(basisFile, pos, NULL, FILE_BEGIN))
+            {
+                hr = HRESULT_FROM_WIN32(GetLastError());
+                EXIT_FUNCTION
+            }
+
+            while (segmentWritten < segmentLength)
+            {
+                ULONG bytesToRead = FILE_CHUNK;
+                if (segmentLength - segmentWritten < bytesToRead)
+                {
+                    bytesToRead = (ULONG)(segmentLength - segmentWritten);
+                }
+
+                ULONG bytesRead = 0;
+                if (!ReadFile(basisFile, buf, bytesToRead, &bytesRead, NULL) || bytesRead != bytesToRead)
+                {
+                    PrintError(L"File read error.", true);
+                    hr = E_FAIL;
+                    EXIT_FUNCTION
+                }
+
+                ULONG count = 0;
+
+                if (!WriteFile(file, buf, bytesRead, &count, NULL) || count != bytesRead)
+                {
+                    PrintError(L"File write error.", true);
+                    hr = E_FAIL;
+                    EXIT_FUNCTION
+                }
+
+                segmentWritten += bytesRead;
+            }
+        }
+
+        if (segmentWritten != segmentLength)
+        {
+            hr = E_FAIL;
+            EXIT_FUNCTION
+        }
+
+        length += segmentLength;
+
+        // Read data end element
+        IfFailedExit(WsReadEndElement(reader, NULL));
+
+        // Read DeltaSegment end element
+        IfFailedExit(WsReadEndElement(reader, NULL));
+    }
+
+     // Read the error string and write it to a heap.
+    IfFailedExit(WsCreateHeap(/*maxSize*/ 1024, /*trimSize*/ 1024, NULL, 0, &heap, NULL));
+
+    IfFailedExit(WsReadElement(reader, &errorDescription, WS_READ_REQUIRED_POINTER, heap,
+        &errorString, sizeof(errorString), NULL));
+
+    // Read FileDelta end element
+    IfFailedExit(WsReadEndElement(reader, NULL));
+
+    if (lstrcmpW(errorString, &GlobalStrings::noError[0]))
+    {
+        PrintInfo(L"Delta transfer failed");
+        if (errorString)
+        {
+            PrintInfo(errorString);
+        }
+        hr = E_FAIL;
+    }
+    else if (length == *filePosition && length < fileLength)
+    {
+        // Every part has to make progress, or the transfer would never end.
+        PrintError(L"Delta message was corrupted.", true);
+        hr = E_FAIL;
+    }
+    else
+    {
+        *filePosition = length;
+    }
+
+    EXIT
+
+    if (NULL != buf)
+    {
+        HeapFree(GetProcessHeap(), 0, buf);
+    }
+
+    if (heap)
+    {
+        // Clean up errorString.
+        WsResetHeap(heap, NULL);
+        WsFreeHeap(heap);
+    }
+
+    if (FAILED(hr))
+    {
+        hr = WS_E_INVALID_FORMAT;
+    }
+
+    PrintVerbose(L"Leaving CFileRepClient::DeserializeAndApplyDelta");
+
+    return hr;
+}
 
@@ -19,12 +19,26 @@ HRESULT CFileRepServer::ProcessMessage(
 
     HRESULT hr = S_OK;
     FileRequest* fileRequest = NULL;
+    DeltaRequest* deltaRequest = NULL;
     WS_MESSAGE* requestMessage = request->GetRequestMessage();
     WS_CHANNEL* channel = request->GetChannel();
     WS_ERROR* error = request->GetError();
 
     // Make sure action is what we expect
-    if (WsXmlStringEquals(receivedAction, &fileRequestAction, error) != S_OK)
+    if (WsXmlStringEquals(receivedAction, &deltaRequestAction, error) == S_OK)
+    {
+        // Read delta request. The signature array is allocated on the message heap.
+
+        WS_HEAP* heap;
+        IfFailedExit(WsGetMessageProperty(requestMessage, WS_MESSAGE_PROPERTY_HEAP, &heap, sizeof(heap), error));
+
+        IfFailedExit(WsReadBody(requestMessage, &deltaRequestElement, WS_READ_REQUIRED_POINTER,
+            heap, &deltaRequest, sizeof(deltaRequest), error));
+        IfFailedExit(WsReadMessageEnd(channel, requestMessage, NULL, error));
+
+        IfFailedExit(ReadAndSendDelta(request, deltaRequest, error));
+    }
+    else if (WsXmlStringEquals(receivedAction, &fileRequestAction, error) != S_OK)
     {
         PrintInfo(L"Illegal action");
 
@@ -408,5 +422,458 @@ HRESULT CFileRepServer::SendError(
     return hr;
 }
 
+// Answers a delta request. The file is mapped into memory since the rolling checksum needs to look at
+// both ends of the block-sized window at every byte offset, which is awkward with buffered reads.
+// Like ReadAndSendFile this does not keep any state between requests.
+HRESULT CFileRepServer::ReadAndSendDelta(
+    _In_ CRequest* request,
+    _In_ DeltaRequest* deltaRequest,
+    _In_opt_ WS_ERROR* error)
+{
+    PrintVerbose(L"Entering CFileRepServer::ReadAndSendDelta");
+
+    HRESULT hr = S_OK;
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+    const BYTE* fileData = NULL;
+    LARGE_INTEGER len;
+    len.QuadPart = 0;
+
+    // Sanity check the request. The signature count must match the number of full blocks of the client file.
+    if (deltaRequest->blockSize < DELTA_MIN_BLOCK_SIZE ||
+        deltaRequest->blockSize > MAXMESSAGESIZE ||
+        deltaRequest->basisLength < 0 ||
+        deltaRequest->deltaPosition < 0 ||
+        deltaRequest->signatures.length % sizeof(BlockSignature) != 0 ||
+        deltaRequest->signatures.length / sizeof(BlockSignature) > DELTA_MAX_BLOCKS ||
+        deltaRequest->signatures.length / sizeof(BlockSignature) != (ULONGLONG)(deltaRequest->basisLength / deltaRequest->blockSize))
+    {
+        PrintInfo(L"Invalid delta request");
+        hr = SendDeltaError(request, GlobalStrings::invalidRequest);
+
+        PrintVerbose(L"Leaving CFileRepServer::ReadAndSendDelta");
+        return hr;
+    }
+
+    file = CreateFileW(deltaRequest->fileName, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+        FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (INVALID_HANDLE_VALUE == file)
+    {
+        PrintInfo(L"Invalid file name");
+        hr = SendDeltaError(request, GlobalStrings::invalidFileName);
+
+        PrintVerbose(L"Leaving CFileRepServer::ReadAndSendDelta");
+        return hr;
+    }
+
+    if (!GetFileSizeEx(file, &len))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        PrintError(L"Unable to determine file length", true);
+
+        // Ignore return value as we already have a failure.
+        SendDeltaError(request, GlobalStrings::unableToDetermineFileLength);
+        EXIT_FUNCTION
+    }
+
+    // The file may have shrunk since the client started the transfer.
+    if (deltaRequest->deltaPosition > len.QuadPart)
+    {
+        PrintInfo(L"Delta position out of range");
+        hr = SendDeltaError(request, GlobalStrings::outOfRange);
+        EXIT_FUNCTION
+    }
+
+    // Empty files cannot be mapped. They simply produce a delta without segments.
+    if (0 != len.QuadPart)
+    {
+        mapping = CreateFileMappingW(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (NULL != mapping)
+        {
+            fileData = (const BYTE*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        }
+
+        if (NULL == fileData)
+        {
+            // This can happen for files that do not fit into the address space of a 32 bit process.
+            // The client falls back to a regular transfer in that case.
+            hr = HRESULT_FROM_WIN32(GetLastError());
+            PrintError(L"Unable to map file", true);
+
+            // Ignore return value as we already have a failure.
+            SendDeltaError(request, GlobalStrings::unableToMapFile);
+            EXIT_FUNCTION
+        }
+    }
+
+    hr = SendDelta(request, deltaRequest, fileData, len.QuadPart);
+
+    EXIT
+
+    if (FAILED(hr))
+    {
+        PrintError(L"CFileRepServer::ReadAndSendDelta\n", true);
+        PrintError(hr, error, true);
+    }
+
+    if (NULL != fileData)
+    {
+        UnmapViewOfFile(fileData);
+    }
+
+    if (NULL != mapping)
+    {
+        CloseHandle(mapping);
+    }
+
+    if (!CloseHandle(file))
+    {
+        hr = HRESULT_FROM_WIN32(GetLastError());
+        PrintError(L"Unable to close file handle", true);
+    }
+
+    PrintVerbose(L"Leaving CFileRepServer::ReadAndSendDelta");
+    return hr;
+}
+
+// Computes the delta and serializes it into the reply message as it goes. Like ReadAndSendChunk
+// this does custom serialization so that literal data is written straight from the file mapping.
+// The reply starts at the requested delta position and ends once it holds chunkSize bytes of literal data
+// or DELTA_MAX_SEGMENTS segments, so that no reply is much larger than a file chunk.
+HRESULT CFileRepServer::SendDelta(
+    _In_ CRequest* request,
+    _In_ DeltaRequest* deltaRequest,
+    _In_reads_bytes_(fileLength) const BYTE* fileData,
+    _In_ LONGLONG fileLength)
+{
+    PrintVerbose(L"Entering CFileRepServer::SendDelta");
+
+    HRESULT hr = S_OK;
+    WS_XML_WRITER* writer = NULL;
+    WS_MESSAGE* replyMessage = request->GetReplyMessage();
+    WS_MESSAGE* requestMessage = request->GetRequestMessage();
+    WS_ERROR* error = request->GetError();
+    WS_CHANNEL* channel = request->GetChannel();
+
+    CSignatureIndex index;
+    CStrongHash strongHash;
+    CRollingChecksum checksum;
+
+    const BlockSignature* signatures = (const BlockSignature*)deltaRequest->signatures.bytes;
+    ULONG signatureCount = deltaRequest->signatures.length / sizeof(BlockSignature);
+    LONGLONG blockSize = deltaRequest->blockSize;
+
+    // Data not covered by a matching block yet starts here.
+    LONGLONG position = deltaRequest->deltaPosition;
+    LONGLONG literalStart = position;
+
+    // Adjacent matching blocks are coalesced into one segment.
+    LONGLONG copyPosition = 0;
+    LONGLONG copyLength = 0;
+
+    // What is left of the size limits of this reply.
+    LONGLONG literalBudget = chunkSize;
+    ULONG segmentCount = 0;
+    bool replyFull = false;
+
+    IfFailedExit(index.Initialize(signatures, signatureCount));
+    IfFailedExit(strongHash.Initialize());
+
+    IfFailedExit(WsInitializeMessage(replyMessage, WS_BLANK_MESSAGE, requestMessage, error));
+
+    // Add the action header
+    IfFailedExit(WsSetHeader(
+        replyMessage,
+        WS_ACTION_HEADER,
+        WS_XML_STRING_TYPE,
+        WS_WRITE_REQUIRED_VALUE,
+        &deltaReplyAction,
+        sizeof(deltaReplyAction),
+        error));
+
+    // Send the message headers
+    IfFailedExit(WsWriteMessageStart(channel, replyMessage, NULL, error));
+
+    // Get writer to serialize message body
+    IfFailedExit(WsGetMessageProperty(replyMessage, WS_MESSAGE_PROPERTY_BODY_WRITER, &writer, sizeof(writer), error));
+
+    // Write FileDelta start element.
+    IfFailedExit(WsWriteStartElement(writer, NULL, &fileDeltaLocalName, &fileDeltaNamespace, error));
+
+    // Write fileLength element
+    IfFailedExit(WsWriteStartElement(writer, NULL, &deltaFileLengthLocalName, &fileDeltaNamespace, error));
+    IfFailedExit(WsWriteValue(writer, WS_INT64_VALUE_TYPE, &fileLength, sizeof(fileLength), error));
+    IfFailedExit(WsWriteEndElement(writer, error));
+
+    if (0 < signatureCount && position + blockSize <= fileLength)
+    {
+        checksum.Reset(&fileData[position], (ULONG)blockSize);
+
+        while (position + blockSize <= fileLength)
+        {
+            if (position - literalStart >= literalBudget)
+            {
+                // No match within the rest of the budget. Send what fits and let the client ask for the rest.
+                if (0 != copyLength)
+                {
+                    IfFailedExit(WriteDeltaSegment(writer, copyPosition, copyLength, NULL, error));
+                    copyLength = 0;
+                }
+
+                IfFailedExit(WriteDeltaSegment(writer, DELTA_LITERAL_SEGMENT, literalBudget,
+                    &fileData[literalStart], error));
+
+                literalStart += literalBudget;
+                replyFull = true;
+                break;
+            }
+
+            ULONG match = DELTA_NO_BLOCK;
+            ULONG candidate = index.FindNext(checksum.GetValue(), DELTA_NO_BLOCK);
+
+            if (DELTA_NO_BLOCK != candidate)
+            {
+                // The weak checksum matched at least one block. Only now is it worth computing the strong hash.
+                BYTE hash[DELTA_STRONG_HASH_SIZE];
+                IfFailedExit(strongHash.Compute(&fileData[position], (ULONG)blockSize, hash));
+
+                while (DELTA_NO_BLOCK != candidate)
+                {
+                    if (0 == memcmp(index.GetSignature(candidate)->strongHash, hash, DELTA_STRONG_HASH_SIZE))
+                    {
+                        match = candidate;
+                        break;
+                    }
+
+                    candidate = index.FindNext(checksum.GetValue(), candidate);
+                }
+            }
+
+            if (DELTA_NO_BLOCK != match)
+            {
+                LONGLONG matchPosition = match * blockSize;
+
+                if (literalStart < position)
+                {
+                    if (0 != copyLength)
+                    {
+                        IfFailedExit(WriteDeltaSegment(writer, copyPosition, copyLength, NULL, error));
+                        copyLength = 0;
+                        segmentCount++;
+                    }
+
+                    IfFailedExit(WriteDeltaSegment(writer, DELTA_LITERAL_SEGMENT, position - literalStart,
+                        &fileData[literalStart], error));
+                    literalBudget -= position - literalStart;
+                    segmentCount++;
+                }
+
+                if (0 != copyLength && copyPosition + copyLength == matchPosition)
+                {
+                    copyLength += blockSize;
+                }
+                else
+                {
+                    if (0 != copyLength)
+                    {
+                        IfFailedExit(WriteDeltaSegment(writer, copyPosition, copyLength, NULL, error));
+                        segmentCount++;
+                    }
+
+                    copyPosition = matchPosition;
+                    copyLength = blockSize;
+                }
+
+                // Skip the matched block and start a fresh window behind it.
+                position += blockSize;
+                literalStart = position;
+
+                // Leave room for the copy segment that is still pending.
+                if (segmentCount + 1 >= DELTA_MAX_SEGMENTS)
+                {
+                    replyFull = true;
+                    break;
+                }
+
+                if (position + blockSize <= fileLength)
+                {
+                    checksum.Reset(&fileData[position], (ULONG)blockSize);
+                }
+            }
+            else
+            {
+                if (position + blockSize < fileLength)
+                {
+                    checksum.Roll(fileData[position], fileData[position + blockSize]);
+                }
+
+                position++;
+            }
+        }
+    }
+
+    if (0 != copyLength)
+    {
+        IfFailedExit(WriteDeltaSegment(writer, copyPosition, copyLength, NULL, error));
+    }
+
+    if (!replyFull && literalStart < fileLength)
+    {
+        LONGLONG literalLength = fileLength - literalStart;
+        if (literalBudget < literalLength)
+        {
+            literalLength = literalBudget;
+        }
+
+        IfFailedExit(WriteDeltaSegment(writer, DELTA_LITERAL_SEGMENT, literalLength, &fileData[literalStart], error));
+    }
+
+    // Write error element
+    IfFailedExit(WsWriteStartElement(writer, NULL, &deltaErrorLocalName, &fileDeltaNamespace, error));
+    const WCHAR* noError = GlobalStrings::noError;
+    IfFailedExit(WsWriteType(
+        writer,
+        WS_ELEMENT_TYPE_MAPPING,
+        WS_WSZ_TYPE,
+        NULL,
+        WS_WRITE_REQUIRED_POINTER,
+        &noError,
+        sizeof(noError),
+        error));
+
+    // Closing elements;
+    IfFailedExit(WsWriteEndElement(writer, error));
+    IfFailedExit(WsWriteEndElement(writer, error));
+    IfFailedExit(WsWriteMessageEnd(channel, replyMessage, NULL, error));
+
+    hr = WsResetMessage(replyMessage, NULL);
+
+    PrintVerbose(L"Leaving CFileRepServer::SendDelta");
+    return hr;
+
+
+    ERROR_EXIT
+
+    PrintError(L"CFileRepServer::SendDelta", true);
+    PrintError(hr, error, true);
+
+    WsResetMessage(replyMessage, NULL);
+
+    PrintVerbose(L"Leaving CFileRepServer::SendDelta");
+    return hr;
+}
+
+// Writes one DeltaSegment element. Literal segments carry their data, copy segments only reference the client file.
+HRESULT CFileRepServer::WriteDeltaSegment(
+    _In_ WS_XML_WRITER* writer,
+    _In_ LONGLONG sourcePosition,
+    _In_ LONGLONG length,
+    _In_reads_bytes_opt_(length) const BYTE* data,
+    _In_opt_ WS_ERROR* error)
+{
+    HRESULT hr = S_OK;
+
+    IfFailedExit(WsWriteStartElement(writer, NULL, &deltaSegmentLocalName, &fileDeltaNamespace, error));
+
+    IfFailedExit(WsWriteStartElement(writer, NULL, &sourcePositionLocalName, &fileDeltaNamespace, error));
+    IfFailedExit(WsWriteValue(writer, WS_INT64_VALUE_TYPE, &sourcePosition, sizeof(sourcePosition), error));
+    IfFailedExit(WsWriteEndElement(writer, error));
+
+    IfFailedExit(WsWriteStartElement(writer, NULL, &segmentLengthLocalName, &fileDeltaNamespace, error));
+    IfFailedExit(WsWriteValue(writer, WS_INT64_VALUE_TYPE, &length, sizeof(length), error));
+    IfFailedExit(WsWriteEndElement(writer, error));
+
+    IfFailedExit(WsWriteStartElement(writer, NULL, &segmentDataLocalName, &fileDeltaNamespace, error));
+
+    if (DELTA_LITERAL_SEGMENT == sourcePosition)
+    {
+        // WsWriteBytes takes a ULONG so large literal runs are written in pieces.
+        LONGLONG written = 0;
+        while (written < length)
+        {
+            ULONG bytesToWrite = FILE_CHUNK;
+            if (length - written < bytesToWrite)
+            {
+                bytesToWrite = (ULONG)(length - written);
+            }
+
+            IfFailedExit(WsWriteBytes(writer, &data[written], bytesToWrite, error));
+            written += bytesToWrite;
+        }
+    }
 
+    IfFailedExit(WsWriteEndElement(writer, error));
+
+    IfFailedExit(WsWriteEndElement(writer, error));
+
+    EXIT
+
+    return hr;
+}
+
+// Construct a delta reply containing no segments, only the error string.
+HRESULT CFileRepServer::SendDeltaError(
+    _In_ CRequest* request,
+    _In_z_ const WCHAR errorMessage[])
+{
+    PrintVerbose(L"Entering CFileRepServer::SendDeltaError");
+
+    HRESULT hr = S_OK;
+    WS_XML_WRITER* writer = NULL;
+    WS_MESSAGE* replyMessage = request->GetReplyMessage();
+    WS_MESSAGE* requestMessage = request->GetRequestMessage();
+    WS_ERROR* error = request->GetError();
+    WS_CHANNEL* channel = request->GetChannel();
+    LONGLONG fileLength = -1;
+
+    IfFailedExit(WsInitializeMessage(replyMessage, WS_BLANK_MESSAGE, requestMessage, error));
+
+    IfFailedExit(WsSetHeader(
+        replyMessage,
+        WS_ACTION_HEADER,
+        WS_XML_STRING_TYPE,
+        WS_WRITE_REQUIRED_VALUE,
+        &deltaReplyAction,
+        sizeof(deltaReplyAction),
+        error));
+
+    IfFailedExit(WsWriteMessageStart(channel, replyMessage, NULL, error));
+    IfFailedExit(WsGetMessageProperty(replyMessage, WS_MESSAGE_PROPERTY_BODY_WRITER, &writer, sizeof(writer), error));
+
+    IfFailedExit(WsWriteStartElement(writer, NULL, &fileDeltaLocalName, &fileDeltaNamespace, error));
+
+    IfFailedExit(WsWriteStartElement(writer, NULL, &deltaFileLengthLocalName, &fileDeltaNamespace, error));
+    IfFailedExit(WsWriteValue(writer, WS_INT64_VALUE_TYPE, &fileLength, sizeof(fileLength), error));
+    IfFailedExit(WsWriteEndElement(writer, error));
+
+    IfFailedExit(WsWriteStartElement(writer, NULL, &deltaErrorLocalName, &fileDeltaNamespace, error));
+    IfFailedExit(WsWriteType(
+        writer,
+        WS_ELEMENT_TYPE_MAPPING,
+        WS_WSZ_TYPE,
+        NULL,
+        WS_WRITE_REQUIRED_POINTER,
+        &errorMessage,
+        sizeof(errorMessage),
+        error));
+
+    IfFailedExit(WsWriteEndElement(writer, error));
+    IfFailedExit(WsWriteEndElement(writer, error));
+    IfFailedExit(WsWriteMessageEnd(channel, replyMessage, NULL, error));
+
+    EXIT
+
+    if (FAILED(hr))
+    {
+        PrintError(L"CFileRepServer::SendDeltaError\n", true);
+        PrintError(hr, error, true);
+    }
+
+    WsResetMessage(replyMessage, NULL);
+
+    PrintVerbose(L"Leaving CFileRepServer::SendDeltaError");
+
+    return hr;
+}
 
@@ -0,0 +1,197 @@
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved
+
+// This file contains the block matching helpers shared by the client and server side of delta transfers.
+// A delta transfer works like rsync: the client computes a weak and a strong hash for every block of the
+// file it already has and sends them to the server. The server slides a window over its version of the
+// file, looks up the weak checksum at every byte offset and replies with references to matching client
+// blocks plus the literal data that did not match anything.
+
+#include "Service.h"
+#include "assert.h"
+
+#ifndef NT_SUCCESS
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+#endif
+
+CStrongHash::CStrongHash()
+{
+    algorithm = NULL;
+    hashObject = NULL;
+    hashObjectLength = 0;
+}
+
+CStrongHash::~CStrongHash()
+{
+    if (NULL != hashObject)
+    {
+        HeapFree(GetProcessHeap(), 0, hashObject);
+    }
+
+    if (NULL != algorithm)
+    {
+        BCryptCloseAlgorithmProvider(algorithm, 0);
+    }
+}
+
+HRESULT CStrongHash::Initialize()
+{
+    assert(NULL == algorithm);
+
+    ULONG resultLength = 0;
+    NTSTATUS status = BCryptOpenAlgorithmProvider(&algorithm, BCRYPT_SHA256_ALGORITHM, NULL, 0);
+    if (!NT_SUCCESS(status))
+    {
+        algorithm = NULL;
+        return HRESULT_FROM_NT(status);
+    }
+
+    status = BCryptGetProperty(algorithm, BCRYPT_OBJECT_LENGTH, (PUCHAR)&hashObjectLength,
+        sizeof(hashObjectLength), &resultLength, 0);
+    if (!NT_SUCCESS(status))
+    {
+        return HRESULT_FROM_NT(status);
+    }
+
+    hashObject = (BYTE*)HeapAlloc(GetProcessHeap(), 0, hashObjectLength);
+    if (NULL == hashObject)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    return S_OK;
+}
+
+HRESULT CStrongHash::Compute(
+    _In_reads_bytes_(length) const BYTE* data,
+    _In_ ULONG length,
+    _Out_writes_bytes_(DELTA_STRONG_HASH_SIZE) BYTE* hash)
+{
+    BCRYPT_HASH_HANDLE hashHandle = NULL;
+    BYTE fullHash[32];
+
+    // The hash object memory is reused for every block, so creating the hash does not allocate.
+    NTSTATUS status = BCryptCreateHash(algorithm, &hashHandle, hashObject, hashObjectLength, NULL, 0, 0);
+    if (NT_SUCCESS(status))
+    {
+        status = BCryptHashData(hashHandle, (PUCHAR)data, length, 0);
+        if (NT_SUCCESS(status))
+        {
+            status = BCryptFinishHash(hashHandle, fullHash, sizeof(fullHash), 0);
+        }
+
+        BCryptDestroyHash(hashHandle);
+    }
+
+    if (!NT_SUCCESS(status))
+    {
+        return HRESULT_FROM_NT(status);
+    }
+
+    // A truncated SHA-256 is plenty to confirm a match that the weak checksum already found.
+    CopyMemory(hash, fullHash, DELTA_STRONG_HASH_SIZE);
+    return S_OK;
+}
+
+CSignatureIndex::CSignatureIndex()
+{
+    signatures = NULL;
+    buckets = NULL;
+    next = NULL;
+    bucketBits = 0;
+}
+
+CSignatureIndex::~CSignatureIndex()
+{
+    if (NULL != buckets)
+    {
+        HeapFree(GetProcessHeap(), 0, buckets);
+    }
+
+    if (NULL != next)
+    {
+        HeapFree(GetProcessHeap(), 0, next);
+    }
+}
+
+HRESULT CSignatureIndex::Initialize(
+    _In_reads_(signatureCount) const BlockSignature* signatures,
+    _In_ ULONG signatureCount)
+{
+    assert(NULL == buckets);
+
+    if (signatureCount > DELTA_MAX_BLOCKS)
+    {
+        return E_INVALIDARG;
+    }
+
+    this->signatures = signatures;
+
+    // Use at least as many buckets as signatures so that chains stay short.
+    bucketBits = 4;
+    while (((ULONG)1 << bucketBits) < signatureCount)
+    {
+        bucketBits++;
+    }
+
+    ULONG bucketCount = (ULONG)1 << bucketBits;
+
+    buckets = (ULONG*)HeapAlloc(GetProcessHeap(), 0, bucketCount * sizeof(ULONG));
+    if (NULL == buckets)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // Allocate at least one entry so that an empty signature list is not a special case.
+    next = (ULONG*)HeapAlloc(GetProcessHeap(), 0, (signatureCount + 1) * sizeof(ULONG));
+    if (NULL == next)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    FillMemory(buckets, bucketCount * sizeof(ULONG), 0xff);
+
+    // Insert in reverse so that each chain lists the blocks in file order. When the server file
+    // has the same content as several client blocks the earliest one is used.
+    for (ULONG i = signatureCount; i > 0; i--)
+    {
+        ULONG block = i - 1;
+        ULONG bucket = GetBucket(signatures[block].weakHash);
+        next[block] = buckets[bucket];
+        buckets[bucket] = block;
+    }
+
+    return S_OK;
+}
+
+ULONG CSignatureIndex::FindNext(
+    _In_ UINT32 weakHash,
+    _In_ ULONG previous)
+{
+    ULONG block = (DELTA_NO_BLOCK == previous) ? buckets[GetBucket(weakHash)] : next[previous];
+
+    while (DELTA_NO_BLOCK != block && signatures[block].weakHash != weakHash)
+    {
+        block = next[block];
+    }
+
+    return block;
+}
+
+DWORD ChooseDeltaBlockSize(
+    _In_ LONGLONG basisLength)
+{
+    DWORD blockSize = DELTA_MIN_BLOCK_SIZE;
+
+    // Bigger blocks mean fewer signatures to send but coarser matching around changes.
+    while (basisLength / blockSize > DELTA_MAX_BLOCKS)
+    {
+        blockSize *= 2;
+    }
+
+    return blockSize;
+}
@@ -16,12 +16,16 @@ HRESULT ParseCommandLine(
     _Out_ DWORD* chunkSize,
     _Out_ long* maxConnections,
     _Out_ REPORTING_LEVEL* reportingLevel,
+    _Out_ bool* deltaSync,
+    _Out_ long* transferWindow,
     _In_ bool server)
 {
     *messageEncoding = DEFAULT_ENCODING;
     *chunkSize = 32768;
     *maxConnections = 100;
     *reportingLevel = REPORT_ERROR;
+    *deltaSync = false;
+    *transferWindow = 1;
     bool reportingSet = false;
 
     // Parse the optional parameters.
@@ -115,6 +119,26 @@ HRESULT ParseCommandLine(
         {
             *maxConnections = wcstol(&arg[13], NULL, 10);
         }
+        else if (!_wcsicmp(arg, L"-delta") || !_wcsicmp(arg, L"/delta"))
+        {
+            if (server)
+            {
+                wprintf(L"Delta is not a legal setting on the server side.\n");
+                return E_FAIL;
+            }
+
+            *deltaSync = true;
+        }
+        else if (!_wcsnicmp(arg, L"-window:", 8) || !_wcsnicmp(arg, L"/window:", 8))
+        {
+            if (server)
+            {
+                wprintf(L"Window is not a legal setting on the server side.\n");
+                return E_FAIL;
+            }
+
+            *transferWindow = wcstol(&arg[8], NULL, 10);
+        }
         else
         {
             wprintf(L"Unrecognized parameter: %s.\n", arg);
@@ -138,7 +162,8 @@ int __cdecl wmain(
     if (argc < 3)
     {
         wprintf(L"Usage:\n FileRepService.exe <server/client> <Service Url> [/reporting:<error/verbose>] [/encoding:<text/binary/MTOM>]");
-        wprintf(L" [/connections:<number of connections>] [/chunk:<size of a the payload per message>]\n");
+        wprintf(L" [/connections:<number of connections>] [/chunk:<size of a the payload per message>] [/delta]");
+        wprintf(L" [/window:<number of chunk requests in flight>]\n");
 
         EXIT_FUNCTION
     }
@@ -160,10 +185,12 @@ int __cdecl wmain(
     DWORD chunkSize = 32768;
     long maxConnections = 100;
     REPORTING_LEVEL reportingLevel = REPORT_ERROR;
+    bool deltaSync = false;
+    long transferWindow = 1;
 
     if (argc > 3)
     {
-        if (FAILED(ParseCommandLine(argc - 3, &argv[3], &messageEncoding, &chunkSize, &maxConnections, &reportingLevel, server)))
+        if (FAILED(ParseCommandLine(argc - 3, &argv[3], &messageEncoding, &chunkSize, &maxConnections, &reportingLevel, &deltaSync, &transferWindow, server)))
         {
             EXIT_FUNCTION
         }
@@ -192,13 +219,19 @@ int __cdecl wmain(
         EXIT_FUNCTION
     }
 
+    if (transferWindow < 1 || transferWindow > MAX_TRANSFER_WINDOW)
+    {
+        wprintf(L"The window must be between 1 and %d.\n", MAX_TRANSFER_WINDOW);
+        EXIT_FUNCTION
+    }
+
     if (server)
     {
         fileRep = new(std::nothrow) CFileRepServer(reportingLevel, maxConnections, transport, securityMode, messageEncoding, chunkSize);
     }
     else
     {
-        fileRep = new(std::nothrow) CFileRepClient(reportingLevel, maxConnections, transport, securityMode, messageEncoding);
+        fileRep = new(std::nothrow) CFileRepClient(reportingLevel, maxConnections, transport, securityMode, messageEncoding, deltaSync, transferWindow);
     }
 
     if (fileRep == NULL)
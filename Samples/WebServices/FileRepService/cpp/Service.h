@@ -6,6 +6,7 @@
 // Copyright (c) Microsoft Corporation. All rights reserved
 
 #include "common.h"
+#include "bcrypt.h"
 
 // This header file contains all definitions used by both client and server services.
 
@@ -18,6 +19,19 @@
 
 #define DISCOVERY_REQUEST -1
 
+// Smallest block size used for delta transfers. The block size grows with the size of the existing
+// file so that the signature message never contains more than DELTA_MAX_BLOCKS signatures. That keeps
+// the delta request well within the default 64k message size limit of the server channels.
+#define DELTA_MIN_BLOCK_SIZE 2048
+#define DELTA_MAX_BLOCKS 1024
+
+// Upper bound for the number of segments in one delta reply. Together with the chunk size, which bounds
+// the literal data, this limits the size of a reply just like a file chunk.
+#define DELTA_MAX_SEGMENTS 1024
+
+// Upper bound for the number of chunk requests the client keeps in flight. Each one uses its own channel.
+#define MAX_TRANSFER_WINDOW 64
+
 // Error Uris used to transmit errors from server service to client service.
 namespace GlobalStrings
 {
@@ -28,6 +42,7 @@ namespace GlobalStrings
     static const WCHAR invalidRequest[] = L"http://tempuri.org/FileRep/InvalidRequest";
     static const WCHAR outOfRange[] = L"http://tempuri.org/FileRep/OutOfRange";
     static const WCHAR unableToSetFilePointer[] = L"http://tempuri.org/FileRep/UnableToSetFilePointer";
+    static const WCHAR unableToMapFile[] = L"http://tempuri.org/FileRep/UnableToMapFile";
 }
 
 class CChannelManager;
@@ -386,6 +401,117 @@ private:
 };
 
 
+// The weak checksum used to find candidate block matches at every byte offset of a file.
+// This is the rsync checksum: it can be moved forward by one byte in constant time.
+class CRollingChecksum
+{
+public:
+    CRollingChecksum()
+    {
+        a = 0;
+        b = 0;
+        length = 0;
+    }
+
+    void Reset(
+        _In_reads_(length) const BYTE* data,
+        _In_ ULONG length)
+    {
+        a = 0;
+        b = 0;
+        this->length = length;
+
+        for (ULONG i = 0; i < length; i++)
+        {
+            a += data[i];
+            b += (length - i) * data[i];
+        }
+    }
+
+    // Removes the byte leaving the window and adds the byte entering it.
+    inline void Roll(
+        _In_ BYTE outByte,
+        _In_ BYTE inByte)
+    {
+        a = a - outByte + inByte;
+        b = b - length * outByte + a;
+    }
+
+    inline UINT32 GetValue() { return (a & 0xffff) | (b << 16); }
+
+private:
+    UINT32 a;
+    UINT32 b;
+    ULONG length;
+};
+
+// Computes the strong block hash that confirms a weak checksum match. Holds on to the algorithm
+// provider and the hash object memory so that hashing many blocks does not allocate.
+class CStrongHash
+{
+public:
+    CStrongHash();
+
+    ~CStrongHash();
+
+    HRESULT Initialize();
+
+    HRESULT Compute(
+        _In_reads_bytes_(length) const BYTE* data,
+        _In_ ULONG length,
+        _Out_writes_bytes_(DELTA_STRONG_HASH_SIZE) BYTE* hash);
+
+private:
+    BCRYPT_ALG_HANDLE algorithm;
+    BYTE* hashObject;
+    ULONG hashObjectLength;
+};
+
+#define DELTA_NO_BLOCK ((ULONG)-1)
+
+// Maps weak checksums to the blocks of the client's file that have them.
+// This is a simple chained hash table over the signature array received from the client.
+class CSignatureIndex
+{
+public:
+    CSignatureIndex();
+
+    ~CSignatureIndex();
+
+    HRESULT Initialize(
+        _In_reads_(signatureCount) const BlockSignature* signatures,
+        _In_ ULONG signatureCount);
+
+    // Returns the first block with the given weak checksum at or after the given chain position,
+    // or DELTA_NO_BLOCK if there is none. Pass DELTA_NO_BLOCK as previous to start a new lookup.
+    ULONG FindNext(
+        _In_ UINT32 weakHash,
+        _In_ ULONG previous);
+
+    const BlockSignature* GetSignature(
+        _In_ ULONG block)
+    {
+        return &signatures[block];
+    }
+
+private:
+    inline ULONG GetBucket(
+        _In_ UINT32 weakHash)
+    {
+        // Multiplicative hashing spreads the weak checksums, whose low bits are just a byte sum.
+        return (weakHash * 2654435761U) >> (32 - bucketBits);
+    }
+
+    const BlockSignature* signatures;
+    ULONG* buckets;
+    ULONG* next;
+    ULONG bucketBits;
+};
+
+// Picks the block size for a delta transfer based on the size of the file the client already has.
+DWORD ChooseDeltaBlockSize(
+    _In_ LONGLONG basisLength);
+
 // Server service.
 class CFileRepServer : public CFileRep
 {
@@ -434,7 +560,52 @@ protected:
         _In_ LONGLONG chunkPosition,
         _In_ HANDLE file);
 
+    HRESULT ReadAndSendDelta(
+        _In_ CRequest* request,
+        _In_ DeltaRequest* deltaRequest,
+        _In_opt_ WS_ERROR* error);
+
+    HRESULT SendDelta(
+        _In_ CRequest* request,
+        _In_ DeltaRequest* deltaRequest,
+        _In_reads_bytes_(fileLength) const BYTE* fileData,
+        _In_ LONGLONG fileLength);
+
+    HRESULT SendDeltaError(
+        _In_ CRequest* request,
+        _In_z_ const WCHAR errorMessage[]);
+
+    HRESULT WriteDeltaSegment(
+        _In_ WS_XML_WRITER* writer,
+        _In_ LONGLONG sourcePosition,
+        _In_ LONGLONG length,
+        _In_reads_bytes_opt_(length) const BYTE* data,
+        _In_opt_ WS_ERROR* error);
+
+    long chunkSize;
+};
+
+class CFileRepClient;
+
+// State shared by all channels working on the same pipelined file transfer. Chunks are handed out
+// in file order from nextPosition, but may complete and be written in any order.
+struct ChunkTransfer
+{
+    CFileRepClient* client;
+    LPWSTR sourcePath;
+    LPWSTR serverUri;
+    TRANSPORT_MODE transportMode;
+    SECURITY_MODE securityMode;
+    MESSAGE_ENCODING encoding;
+    HANDLE file;
+    LONGLONG fileLength;
     long chunkSize;
+
+    volatile LONGLONG nextPosition;
+    volatile long activeWorkers;
+    volatile long openChannels; // Channels that requested chunks, including the calling thread's.
+    volatile HRESULT result; // First failure of any channel. Stops all channels.
+    HANDLE workersDone;
 };
 
 // Client service.
@@ -446,13 +617,17 @@ public:
         _In_ DWORD maxChannels,
         _In_ TRANSPORT_MODE transport,
         _In_ SECURITY_MODE security,
-        _In_ MESSAGE_ENCODING encoding) : CFileRep(
+        _In_ MESSAGE_ENCODING encoding,
+        _In_ bool deltaSync,
+        _In_ long transferWindow) : CFileRep(
             errorReporting,
             maxChannels,
             transport,
             security,
             encoding)
     {
+        this->deltaSync = deltaSync;
+        this->transferWindow = transferWindow;
     }
 
     HRESULT ProcessMessage(
@@ -485,6 +660,26 @@ protected:
         _In_ HANDLE file,
         _In_ LONGLONG length);
 
+    HRESULT TransferChunks(
+        _In_ ChunkTransfer* transfer,
+        _In_ WS_CHANNEL* channel,
+        _In_ WS_MESSAGE* requestMessage,
+        _In_ WS_MESSAGE* replyMessage,
+        _In_opt_ WS_ERROR* error);
+
+    HRESULT TransferChunksParallel(
+        _In_ ChunkTransfer* transfer,
+        _In_ WS_CHANNEL* channel,
+        _In_ WS_MESSAGE* requestMessage,
+        _In_ WS_MESSAGE* replyMessage,
+        _In_opt_ WS_ERROR* error);
+
+    static ULONG WINAPI TransferChunksWorkItem(
+        _In_ void* state);
+
+    void RunTransferChunksWorkItem(
+        _In_ ChunkTransfer* transfer);
+
     HRESULT ProcessChunk(
         _In_ long chunkSize,
         _In_ HANDLE file,
@@ -498,9 +693,38 @@ protected:
     HRESULT DeserializeAndWriteMessage(
         _In_ WS_MESSAGE* message,
         _In_ long chunkSize,
+        _In_ LONGLONG expectedPosition,
         _Out_ LONGLONG* chunkPosition,
         _Out_ long* contentLength,
         _In_ HANDLE file);
+
+    HRESULT TransferFileDelta(
+        _In_z_ const LPWSTR sourcePath,
+        _In_z_ const LPWSTR destinationPath,
+        _In_ LONGLONG fileLength,
+        _In_ WS_MESSAGE* requestMessage,
+        _In_ WS_MESSAGE* replyMessage,
+        _In_ WS_CHANNEL* channel,
+        _In_opt_ WS_ERROR* error,
+        _Out_ LONGLONG* literalBytes);
+
+    HRESULT ComputeSignatures(
+        _In_ HANDLE basisFile,
+        _In_ LONGLONG basisLength,
+        _In_ DWORD blockSize,
+        _Out_ WS_BYTES* signatures);
+
+    HRESULT DeserializeAndApplyDelta(
+        _In_ WS_MESSAGE* message,
+        _In_ HANDLE basisFile,
+        _In_ LONGLONG basisLength,
+        _In_ HANDLE file,
+        _In_ LONGLONG fileLength,
+        _Inout_ LONGLONG* filePosition,
+        _Inout_ LONGLONG* literalBytes);
+
+    bool deltaSync;
+    long transferWindow;
 };
 
 // Helper functions.
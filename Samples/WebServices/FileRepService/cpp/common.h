@@ -303,6 +303,200 @@ static WS_ELEMENT_DESCRIPTION fileChunkElement =
     &fileChunkType,
 };
 
+//
+// defines the delta request message and all related structures
+//
+
+// Size of the truncated strong hash that is sent for every block of the existing destination file.
+#define DELTA_STRONG_HASH_SIZE 16
+
+// The signature of one block of the file the client already has. The client sends these as one
+// packed byte array instead of a repeating element to keep the message compact.
+struct BlockSignature
+{
+    UINT32 weakHash; // Rolling checksum of the block. Cheap to compute at every byte offset.
+    BYTE strongHash[DELTA_STRONG_HASH_SIZE]; // Truncated SHA-256 of the block. Only checked when the weak hash matches.
+};
+
+struct DeltaRequest
+{
+    LPWSTR fileName; // Fully qualified local file name on the server machine
+    DWORD blockSize; // Size of the blocks the signatures were computed over. Only the last partial block is not signed.
+    LONGLONG basisLength; // Length of the file the client already has.
+    WS_BYTES signatures; // Array of BlockSignature structures, one per full block of the existing file.
+    LONGLONG deltaPosition; // Position in the server's file at which the requested part of the delta starts.
+};
+
+extern WS_XML_DICTIONARY deltaRequestDictionary;
+
+static WS_XML_STRING deltaRequestDictionaryStrings[] =
+{
+    WS_XML_STRING_DICTIONARY_VALUE("FileName", &deltaRequestDictionary, 0),
+    WS_XML_STRING_DICTIONARY_VALUE("BlockSize", &deltaRequestDictionary, 1),
+    WS_XML_STRING_DICTIONARY_VALUE("BasisLength", &deltaRequestDictionary, 2),
+    WS_XML_STRING_DICTIONARY_VALUE("Signatures", &deltaRequestDictionary, 3),
+    WS_XML_STRING_DICTIONARY_VALUE("DeltaRequest", &deltaRequestDictionary, 4),
+    WS_XML_STRING_DICTIONARY_VALUE("http://tempuri.org/FileRep", &deltaRequestDictionary, 5),
+    WS_XML_STRING_DICTIONARY_VALUE("DeltaRequest", &deltaRequestDictionary, 6),
+    WS_XML_STRING_DICTIONARY_VALUE("DeltaPosition", &deltaRequestDictionary, 7),
+};
+
+static WS_XML_DICTIONARY deltaRequestDictionary =
+{
+    { /* 5d0b3c1e-8f41-4a6e-9b53-2e7c4f1a9d06 */
+    0x5d0b3c1e,
+    0x8f41,
+    0x4a6e,
+    {0x9b, 0x53, 0x2e, 0x7c, 0x4f, 0x1a, 0x9d, 0x06}
+    },
+    deltaRequestDictionaryStrings,
+    WsCountOf(deltaRequestDictionaryStrings),
+    true,
+};
+
+#define deltaFileNameLocalName deltaRequestDictionaryStrings[0]
+#define blockSizeLocalName deltaRequestDictionaryStrings[1]
+#define basisLengthLocalName deltaRequestDictionaryStrings[2]
+#define signaturesLocalName deltaRequestDictionaryStrings[3]
+#define deltaRequestLocalName deltaRequestDictionaryStrings[4]
+#define deltaRequestNamespace deltaRequestDictionaryStrings[5]
+#define deltaRequestTypeName deltaRequestDictionaryStrings[6]
+#define deltaPositionLocalName deltaRequestDictionaryStrings[7]
+
+static WS_FIELD_DESCRIPTION deltaFileNameField = 
+{
+    WS_ELEMENT_FIELD_MAPPING,
+    &deltaFileNameLocalName,
+    &deltaRequestNamespace,
+    WS_WSZ_TYPE,
+    NULL,
+    WsOffsetOf(DeltaRequest, fileName),
+};
+
+static WS_FIELD_DESCRIPTION blockSizeField = 
+{
+    WS_ELEMENT_FIELD_MAPPING,
+    &blockSizeLocalName,
+    &deltaRequestNamespace,
+    WS_UINT32_TYPE,
+    NULL,
+    WsOffsetOf(DeltaRequest, blockSize),
+};
+
+static WS_FIELD_DESCRIPTION basisLengthField = 
+{
+    WS_ELEMENT_FIELD_MAPPING,
+    &basisLengthLocalName,
+    &deltaRequestNamespace,
+    WS_INT64_TYPE,
+    NULL,
+    WsOffsetOf(DeltaRequest, basisLength),
+};
+
+static WS_FIELD_DESCRIPTION signaturesField = 
+{
+    WS_ELEMENT_FIELD_MAPPING,
+    &signaturesLocalName,
+    &deltaRequestNamespace,
+    WS_BYTES_TYPE,
+    NULL,
+    WsOffsetOf(DeltaRequest, signatures),
+};
+
+static WS_FIELD_DESCRIPTION deltaPositionField = 
+{
+    WS_ELEMENT_FIELD_MAPPING,
+    &deltaPositionLocalName,
+    &deltaRequestNamespace,
+    WS_INT64_TYPE,
+    NULL,
+    WsOffsetOf(DeltaRequest, deltaPosition),
+};
+
+static WS_FIELD_DESCRIPTION* deltaRequestFields[] = 
+{ 
+    &deltaFileNameField,
+    &blockSizeField,
+    &basisLengthField,
+    &signaturesField,
+    &deltaPositionField,
+};
+
+static WS_STRUCT_DESCRIPTION deltaRequestType =
+{
+    sizeof(DeltaRequest),
+    __alignof(DeltaRequest),
+    deltaRequestFields,
+    WsCountOf(deltaRequestFields),
+    &deltaRequestTypeName,
+    &deltaRequestNamespace,
+};
+
+static WS_ELEMENT_DESCRIPTION deltaRequestElement = 
+{
+    &deltaRequestLocalName,
+    &deltaRequestNamespace,
+    WS_STRUCT_TYPE,
+    &deltaRequestType,
+};
+
+//
+// defines the delta reply message
+//
+// The delta reply is always serialized and deserialized manually, so there is no struct description for it.
+// Its layout is:
+// <FileDelta>
+//   <FileLength>length of the file on the server, -1 in the error case</FileLength>
+//   <DeltaSegment>
+//     <SourcePosition>offset in the client's existing file, or -1 if the data is included</SourcePosition>
+//     <Length>number of bytes the segment contributes to the file</Length>
+//     <Data>literal bytes. Empty if SourcePosition is not -1</Data>
+//   </DeltaSegment>
+//   ...
+//   <Error>http://tempuri.org/FileRep/NoError in the success case</Error>
+// </FileDelta>
+// Segments are in file order, so the client can reassemble the file with sequential writes.
+// A reply only covers the part of the file from DeltaPosition up to a limit on its literal data and segment
+// count. The client requests the next part starting where the segments of the previous reply ended.
+
+#define DELTA_LITERAL_SEGMENT -1
+
+extern WS_XML_DICTIONARY fileDeltaDictionary;
+
+static WS_XML_STRING fileDeltaDictionaryStrings[] =
+{
+    WS_XML_STRING_DICTIONARY_VALUE("FileLength", &fileDeltaDictionary, 0),
+    WS_XML_STRING_DICTIONARY_VALUE("DeltaSegment", &fileDeltaDictionary, 1),
+    WS_XML_STRING_DICTIONARY_VALUE("SourcePosition", &fileDeltaDictionary, 2),
+    WS_XML_STRING_DICTIONARY_VALUE("Length", &fileDeltaDictionary, 3),
+    WS_XML_STRING_DICTIONARY_VALUE("Data", &fileDeltaDictionary, 4),
+    WS_XML_STRING_DICTIONARY_VALUE("Error", &fileDeltaDictionary, 5),
+    WS_XML_STRING_DICTIONARY_VALUE("FileDelta", &fileDeltaDictionary, 6),
+    WS_XML_STRING_DICTIONARY_VALUE("http://tempuri.org/FileRep", &fileDeltaDictionary, 7),
+};
+
+static WS_XML_DICTIONARY fileDeltaDictionary =
+{
+    { /* b7e2a9d4-3c58-4f0b-a1e6-6d94c2f87b13 */
+    0xb7e2a9d4,
+    0x3c58,
+    0x4f0b,
+    {0xa1, 0xe6, 0x6d, 0x94, 0xc2, 0xf8, 0x7b, 0x13}
+    },
+    fileDeltaDictionaryStrings,
+    WsCountOf(fileDeltaDictionaryStrings),
+    true,
+};
+
+#define deltaFileLengthLocalName fileDeltaDictionaryStrings[0]
+#define deltaSegmentLocalName fileDeltaDictionaryStrings[1]
+#define sourcePositionLocalName fileDeltaDictionaryStrings[2]
+#define segmentLengthLocalName fileDeltaDictionaryStrings[3]
+#define segmentDataLocalName fileDeltaDictionaryStrings[4]
+#define deltaErrorLocalName fileDeltaDictionaryStrings[5]
+#define fileDeltaLocalName fileDeltaDictionaryStrings[6]
+#define fileDeltaNamespace fileDeltaDictionaryStrings[7]
+
 typedef enum
 {
     HTTP_TRANSPORT = 1,
@@ -573,6 +767,12 @@ static WS_XML_STRING fileReplyAction = WS_XML_STRING_VALUE("http://tempuri.org/F
 static WS_XML_STRING fileInfoAction = WS_XML_STRING_VALUE("http://tempuri.org/FileRep/fileinfo");
 
 
+// Set up the action value for the delta request message
+static WS_XML_STRING deltaRequestAction = WS_XML_STRING_VALUE("http://tempuri.org/FileRep/deltarequest");
+
+// Set up the action value for the delta reply message
+static WS_XML_STRING deltaReplyAction = WS_XML_STRING_VALUE("http://tempuri.org/FileRep/deltareply");
+
 // Set up the action value for the user request message
 static WS_XML_STRING userRequestAction = WS_XML_STRING_VALUE("http://tempuri.org/FileRep/userrequest");
 
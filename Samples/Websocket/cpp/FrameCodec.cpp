@@ -0,0 +1,482 @@
+#include <Windows.h>
+#include <Assert.h>
+#include "FrameCodec.h"
+
+#if defined(_M_IX86) || defined(_M_X64)
+#include <emmintrin.h>
+#define FRAME_CODEC_SSE2
+#endif
+
+Utf8Validator::Utf8Validator()
+{
+    Reset();
+}
+
+void Utf8Validator::Reset()
+{
+    this->remaining = 0;
+    this->lower = 0x80;
+    this->upper = 0xBF;
+}
+
+bool Utf8Validator::Validate(
+    _In_reads_bytes_(dataLength) const BYTE* data,
+    _In_ ULONG dataLength)
+{
+    ULONG i = 0;
+
+    while (i < dataLength)
+    {
+        if (this->remaining == 0)
+        {
+#ifdef FRAME_CODEC_SSE2
+            // Most text is ASCII. Skip 16 bytes at a time as long as none of them has the high bit set.
+            while (i + 16 <= dataLength)
+            {
+                __m128i block = _mm_loadu_si128((const __m128i*)(data + i));
+                if (_mm_movemask_epi8(block) != 0)
+                {
+                    break;
+                }
+
+                i += 16;
+            }
+
+            if (i == dataLength)
+            {
+                break;
+            }
+#endif
+            BYTE lead = data[i++];
+
+            if (lead < 0x80)
+            {
+                continue;
+            }
+
+            // Overlong forms, surrogates and code points above U+10FFFF are rejected through the
+            // range of the first continuation byte.
+            this->lower = 0x80;
+            this->upper = 0xBF;
+
+            if (lead >= 0xC2 && lead <= 0xDF)
+            {
+                this->remaining = 1;
+            }
+            else if (lead >= 0xE0 && lead <= 0xEF)
+            {
+                this->remaining = 2;
+                if (lead == 0xE0)
+                {
+                    this->lower = 0xA0;
+                }
+                else if (lead == 0xED)
+                {
+                    this->upper = 0x9F;
+                }
+            }
+            else if (lead >= 0xF0 && lead <= 0xF4)
+            {
+                this->remaining = 3;
+                if (lead == 0xF0)
+                {
+                    this->lower = 0x90;
+                }
+                else if (lead == 0xF4)
+                {
+                    this->upper = 0x8F;
+                }
+            }
+            else
+            {
+                return false;
+            }
+        }
+        else
+        {
+            BYTE continuation = data[i++];
+
+            if (continuation < this->lower || continuation > this->upper)
+            {
+                return false;
+            }
+
+            // Only the first continuation byte has a restricted range.
+            this->lower = 0x80;
+            this->upper = 0xBF;
+            this->remaining--;
+        }
+    }
+
+    return true;
+}
+
+bool Utf8Validator::IsComplete() const
+{
+    return this->remaining == 0;
+}
+
+FrameCodec::FrameCodec(
+    _In_ bool isServer)
+{
+    this->isServer = isServer;
+    this->perMessageDeflate = false;
+    Reset();
+}
+
+void FrameCodec::Reset()
+{
+    this->inMessage = false;
+    this->inTextMessage = false;
+    this->validator.Reset();
+}
+
+void FrameCodec::EnablePerMessageDeflate()
+{
+    this->perMessageDeflate = true;
+}
+
+HRESULT FrameCodec::DecodeFrame(
+    _Inout_updates_bytes_(dataLength) BYTE* data,
+    _In_ ULONG dataLength,
+    _Out_ WebSocketFrame* frame,
+    _Out_ ULONG* bytesConsumed)
+{
+    ULONG headerLength = 2;
+    ULONGLONG payloadLength = 0;
+    BYTE* maskKey = NULL;
+
+    *bytesConsumed = 0;
+    ZeroMemory(frame, sizeof(*frame));
+
+    if (dataLength < 2)
+    {
+        return S_FALSE;
+    }
+
+    BYTE opcode = data[0] & 0x0F;
+    bool fin = (data[0] & 0x80) != 0;
+    bool compressed = (data[0] & 0x40) != 0;
+    bool masked = (data[1] & 0x80) != 0;
+    BYTE length = data[1] & 0x7F;
+
+    // RSV1 marks a compressed message once permessage-deflate has been negotiated. RSV2 and RSV3 belong to
+    // extensions this codec does not implement.
+    if ((data[0] & 0x30) != 0 || (compressed && !this->perMessageDeflate))
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    // Frames from a client must be masked and frames from a server must not be.
+    if (masked != this->isServer)
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    bool control = (opcode & 0x8) != 0;
+    if (control)
+    {
+        if (opcode != FRAME_OPCODE_CLOSE && opcode != FRAME_OPCODE_PING && opcode != FRAME_OPCODE_PONG)
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+
+        // Control frames may appear in the middle of a fragmented message but are never fragmented or
+        // compressed themselves.
+        if (!fin || compressed || length > FRAME_MAX_CONTROL_PAYLOAD)
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+    }
+    else if (opcode == FRAME_OPCODE_CONTINUATION)
+    {
+        // Only the first frame of a message says whether it is compressed.
+        if (!this->inMessage || compressed)
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+    }
+    else if (opcode == FRAME_OPCODE_TEXT || opcode == FRAME_OPCODE_BINARY)
+    {
+        if (this->inMessage)
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+    }
+    else
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    if (length == 126)
+    {
+        headerLength += 2;
+        if (dataLength < headerLength)
+        {
+            return S_FALSE;
+        }
+
+        payloadLength = ((ULONGLONG)data[2] << 8) | data[3];
+
+        // The shortest encoding must be used.
+        if (payloadLength < 126)
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+    }
+    else if (length == 127)
+    {
+        headerLength += 8;
+        if (dataLength < headerLength)
+        {
+            return S_FALSE;
+        }
+
+        for (ULONG i = 0; i < 8; i++)
+        {
+            payloadLength = (payloadLength << 8) | data[2 + i];
+        }
+
+        if (payloadLength <= 0xFFFF || (payloadLength >> 63) != 0)
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+    }
+    else
+    {
+        payloadLength = length;
+    }
+
+    if (masked)
+    {
+        maskKey = data + headerLength;
+        headerLength += 4;
+    }
+
+    // Frames are decoded in place, so a frame must fit into a single buffer.
+    if (payloadLength > MAXULONG - headerLength)
+    {
+        return HRESULT_FROM_WIN32(ERROR_BUFFER_OVERFLOW);
+    }
+
+    if (dataLength < headerLength + payloadLength)
+    {
+        return S_FALSE;
+    }
+
+    BYTE* payload = data + headerLength;
+
+    if (masked)
+    {
+        ApplyMask(payload, (ULONG)payloadLength, maskKey, 0);
+    }
+
+    // Compressed text can only be validated once the whole message has been inflated.
+    if ((opcode == FRAME_OPCODE_TEXT && !compressed) ||
+        (opcode == FRAME_OPCODE_CONTINUATION && this->inTextMessage))
+    {
+        if (!this->validator.Validate(payload, (ULONG)payloadLength))
+        {
+            return E_FRAME_INVALID_UTF8;
+        }
+
+        if (fin && !this->validator.IsComplete())
+        {
+            return E_FRAME_INVALID_UTF8;
+        }
+    }
+    else if (opcode == FRAME_OPCODE_CLOSE && payloadLength != 0)
+    {
+        // A close frame either has no body or a two byte status code followed by a UTF-8 reason.
+        Utf8Validator reasonValidator;
+
+        if (payloadLength == 1 ||
+            !reasonValidator.Validate(payload + 2, (ULONG)payloadLength - 2) ||
+            !reasonValidator.IsComplete())
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+    }
+
+    if (!control)
+    {
+        if (opcode != FRAME_OPCODE_CONTINUATION)
+        {
+            this->inTextMessage = (opcode == FRAME_OPCODE_TEXT && !compressed);
+        }
+
+        this->inMessage = !fin;
+
+        if (fin)
+        {
+            this->inTextMessage = false;
+            this->validator.Reset();
+        }
+    }
+
+    frame->opcode = opcode;
+    frame->fin = fin;
+    frame->compressed = compressed;
+    frame->payload = payload;
+    frame->payloadLength = (ULONG)payloadLength;
+    *bytesConsumed = headerLength + (ULONG)payloadLength;
+
+    return S_OK;
+}
+
+HRESULT FrameCodec::EncodeFrame(
+    _In_ BYTE opcode,
+    _In_ bool fin,
+    _In_ bool compressed,
+    _In_reads_bytes_opt_(payloadLength) const BYTE* payload,
+    _In_ ULONG payloadLength,
+    _In_reads_bytes_opt_(4) const BYTE* maskKey,
+    _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+    _In_ ULONG outputLength,
+    _Out_ ULONG* bytesWritten)
+{
+    ULONG headerLength = 2;
+
+    *bytesWritten = 0;
+
+    if ((opcode & 0x8) != 0 && (!fin || payloadLength > FRAME_MAX_CONTROL_PAYLOAD))
+    {
+        return E_INVALIDARG;
+    }
+
+    if (compressed && opcode != FRAME_OPCODE_TEXT && opcode != FRAME_OPCODE_BINARY)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (payload == NULL && payloadLength != 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    if (payloadLength > 0xFFFF)
+    {
+        headerLength += 8;
+    }
+    else if (payloadLength >= 126)
+    {
+        headerLength += 2;
+    }
+
+    if (maskKey != NULL)
+    {
+        headerLength += 4;
+    }
+
+    if (outputLength < headerLength || outputLength - headerLength < payloadLength)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    output[0] = (fin ? 0x80 : 0x00) | (compressed ? 0x40 : 0x00) | (opcode & 0x0F);
+    output[1] = (maskKey != NULL) ? 0x80 : 0x00;
+
+    BYTE* next = output + 2;
+
+    if (payloadLength > 0xFFFF)
+    {
+        output[1] |= 127;
+        for (ULONG i = 0; i < 8; i++)
+        {
+            next[i] = (BYTE)((ULONGLONG)payloadLength >> (56 - 8 * i));
+        }
+
+        next += 8;
+    }
+    else if (payloadLength >= 126)
+    {
+        output[1] |= 126;
+        next[0] = (BYTE)(payloadLength >> 8);
+        next[1] = (BYTE)payloadLength;
+        next += 2;
+    }
+    else
+    {
+        output[1] |= (BYTE)payloadLength;
+    }
+
+    if (maskKey != NULL)
+    {
+        CopyMemory(next, maskKey, 4);
+        next += 4;
+
+        CopyWithMask(next, payload, payloadLength, maskKey, 0);
+    }
+    else if (payloadLength != 0)
+    {
+        CopyMemory(next, payload, payloadLength);
+    }
+
+    *bytesWritten = headerLength + payloadLength;
+    return S_OK;
+}
+
+void FrameCodec::ApplyMask(
+    _Inout_updates_bytes_(dataLength) BYTE* data,
+    _In_ ULONG dataLength,
+    _In_reads_bytes_(4) const BYTE* maskKey,
+    _In_ ULONG offset)
+{
+    CopyWithMask(data, data, dataLength, maskKey, offset);
+}
+
+void FrameCodec::CopyWithMask(
+    _Out_writes_bytes_all_(dataLength) BYTE* destination,
+    _In_reads_bytes_(dataLength) const BYTE* source,
+    _In_ ULONG dataLength,
+    _In_reads_bytes_(4) const BYTE* maskKey,
+    _In_ ULONG offset)
+{
+    ULONG i = 0;
+
+    // Rotate the key so that byte 0 of the rotated key applies to byte 0 of the data. Every block
+    // below is a multiple of 4 bytes long, so the key stays in phase for all of them.
+    BYTE rotatedKey[4];
+    for (ULONG k = 0; k < 4; k++)
+    {
+        rotatedKey[k] = maskKey[(offset + k) & 3];
+    }
+
+    UINT32 key32;
+    CopyMemory(&key32, rotatedKey, sizeof(key32));
+
+#ifdef FRAME_CODEC_SSE2
+    __m128i key128 = _mm_set1_epi32((int)key32);
+
+    for (; i + 64 <= dataLength; i += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(source + i));
+        __m128i b = _mm_loadu_si128((const __m128i*)(source + i + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(source + i + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(source + i + 48));
+        _mm_storeu_si128((__m128i*)(destination + i), _mm_xor_si128(a, key128));
+        _mm_storeu_si128((__m128i*)(destination + i + 16), _mm_xor_si128(b, key128));
+        _mm_storeu_si128((__m128i*)(destination + i + 32), _mm_xor_si128(c, key128));
+        _mm_storeu_si128((__m128i*)(destination + i + 48), _mm_xor_si128(d, key128));
+    }
+
+    for (; i + 16 <= dataLength; i += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(source + i));
+        _mm_storeu_si128((__m128i*)(destination + i), _mm_xor_si128(a, key128));
+    }
+#endif
+
+    for (; i + 4 <= dataLength; i += 4)
+    {
+        UINT32 value;
+        CopyMemory(&value, source + i, sizeof(value));
+        value ^= key32;
+        CopyMemory(destination + i, &value, sizeof(value));
+    }
+
+    for (; i < dataLength; i++)
+    {
+        destination[i] = source[i] ^ rotatedKey[i & 3];
+    }
+}
@@ -0,0 +1,117 @@
+#pragma once
+
+// RFC 6455 opcodes.
+#define FRAME_OPCODE_CONTINUATION 0x0
+#define FRAME_OPCODE_TEXT 0x1
+#define FRAME_OPCODE_BINARY 0x2
+#define FRAME_OPCODE_CLOSE 0x8
+#define FRAME_OPCODE_PING 0x9
+#define FRAME_OPCODE_PONG 0xA
+
+// Largest frame header: 2 bytes, 8 bytes of extended payload length and a 4 byte masking key.
+#define FRAME_MAX_HEADER_LENGTH 14
+
+// Largest payload of a control frame.
+#define FRAME_MAX_CONTROL_PAYLOAD 125
+
+// Returned for data that violates the protocol. The connection has to be failed with a close code of
+// 1002 (protocol error), or 1007 (invalid payload data) for text that is not valid UTF-8.
+#define E_FRAME_PROTOCOL_ERROR HRESULT_FROM_WIN32(ERROR_INVALID_DATA)
+#define E_FRAME_INVALID_UTF8 HRESULT_FROM_WIN32(ERROR_NO_UNICODE_TRANSLATION)
+
+// A frame decoded in place. The payload points into the buffer that was passed to the decoder and has
+// already been unmasked.
+struct WebSocketFrame
+{
+    BYTE opcode;
+    bool fin;
+    bool compressed;        // RSV1 on the first frame of a permessage-deflate message.
+    BYTE* payload;
+    ULONG payloadLength;
+};
+
+// Incremental UTF-8 validator. Text messages may be split across frames at any byte, so the validator
+// remembers a partial character between calls.
+class Utf8Validator
+{
+private:
+    // Number of continuation bytes the current character still needs and the allowed range of the next one.
+    ULONG remaining;
+    BYTE lower;
+    BYTE upper;
+
+public:
+    Utf8Validator();
+
+    void Reset();
+
+    // Returns false as soon as the data cannot be the prefix of valid UTF-8.
+    bool Validate(
+        _In_reads_bytes_(dataLength) const BYTE* data,
+        _In_ ULONG dataLength);
+
+    // True if the data so far did not end in the middle of a character.
+    bool IsComplete() const;
+};
+
+// Standalone RFC 6455 frame codec. The websocket protocol component handles framing for the rest of this
+// sample; this codec is for services that process many small messages and want to frame, mask and validate
+// whole buffers in a single pass without going through an action loop.
+//
+// One codec instance decodes the frames of one direction of one connection. With permessage-deflate the
+// codec only checks the RSV1 bit; the payload is inflated and validated by the caller (see PerMessageDeflate).
+class FrameCodec
+{
+private:
+    bool isServer;
+    bool perMessageDeflate;
+    bool inMessage;
+    bool inTextMessage;     // In an uncompressed text message, which is validated frame by frame.
+    Utf8Validator validator;
+
+public:
+    // A server expects masked frames from the client, a client expects unmasked frames from the server.
+    FrameCodec(
+        _In_ bool isServer);
+
+    void Reset();
+
+    // Allows RSV1 on the first frame of a message once permessage-deflate has been negotiated.
+    void EnablePerMessageDeflate();
+
+    // Decodes the frame at the start of the buffer. Returns S_FALSE and consumes nothing if the buffer does not
+    // hold the whole frame yet. The payload is unmasked and validated in place.
+    HRESULT DecodeFrame(
+        _Inout_updates_bytes_(dataLength) BYTE* data,
+        _In_ ULONG dataLength,
+        _Out_ WebSocketFrame* frame,
+        _Out_ ULONG* bytesConsumed);
+
+    // Writes a complete frame. If maskKey is not NULL the payload is masked while it is copied. Compressed
+    // is only valid for the first frame of a text or binary message.
+    static HRESULT EncodeFrame(
+        _In_ BYTE opcode,
+        _In_ bool fin,
+        _In_ bool compressed,
+        _In_reads_bytes_opt_(payloadLength) const BYTE* payload,
+        _In_ ULONG payloadLength,
+        _In_reads_bytes_opt_(4) const BYTE* maskKey,
+        _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+        _In_ ULONG outputLength,
+        _Out_ ULONG* bytesWritten);
+
+    // XORs the data with the masking key. The offset is the position of the data within the payload.
+    static void ApplyMask(
+        _Inout_updates_bytes_(dataLength) BYTE* data,
+        _In_ ULONG dataLength,
+        _In_reads_bytes_(4) const BYTE* maskKey,
+        _In_ ULONG offset);
+
+    // Same as ApplyMask, but reads from one buffer and writes to another.
+    static void CopyWithMask(
+        _Out_writes_bytes_all_(dataLength) BYTE* destination,
+        _In_reads_bytes_(dataLength) const BYTE* source,
+        _In_ ULONG dataLength,
+        _In_reads_bytes_(4) const BYTE* maskKey,
+        _In_ ULONG offset);
+};
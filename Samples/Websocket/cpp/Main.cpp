@@ -2,12 +2,39 @@
 #include <Websocket.h>
 #include <Assert.h>
 #include <StdIo.h>
+#include <StdArg.h>
+#include <StdLib.h>
 #include "Transport.h"
+#include "FrameCodec.h"
+#include "PerMessageDeflate.h"
+
+// Tracing is turned off while benchmarking, since printing every buffer would dominate the measurements.
+bool verbose = true;
+
+void Trace(
+    _In_z_ _Printf_format_string_ const wchar_t* format,
+    ...)
+{
+    if (!verbose)
+    {
+        return;
+    }
+
+    va_list args;
+    va_start(args, format);
+    vwprintf(format, args);
+    va_end(args);
+}
 
 void DumpHeaders(
     _In_reads_(headerCount) WEB_SOCKET_HTTP_HEADER* headers,
     _In_ ULONG headerCount)
 {
+    if (!verbose)
+    {
+        return;
+    }
+
     for (ULONG i = 0; i < headerCount; i++)
     {
         wprintf(L"%.*S: %.*S\n", headers[i].ulNameLength, headers[i].pcName, headers[i].ulValueLength, headers[i].pcValue);
@@ -18,7 +45,7 @@ void DumpData(
     _In_reads_bytes_opt_(dataLength) BYTE* data,
     _In_ ULONG dataLength)
 {
-    if (data == NULL)
+    if (data == NULL || !verbose)
     {
         return;
     }
@@ -126,7 +153,7 @@ HRESULT PerformHandshake(
     CopyMemory(clientHeaders, clientAdditionalHeaders, clientAdditionalHeaderCount * sizeof(WEB_SOCKET_HTTP_HEADER));
     clientHeaders[clientAdditionalHeaderCount] = host;
 
-    wprintf(L"-- Client side headers that need to be send with a request --\n");
+    Trace(L"-- Client side headers that need to be send with a request --\n");
     DumpHeaders(clientHeaders, clientHeaderCount);
 
     // Start a server side of the handshake. Production applications must parse the incoming
@@ -146,7 +173,7 @@ HRESULT PerformHandshake(
         goto quit;
     }
 
-    wprintf(L"\n-- Server side headers that need to be send with a response --\n");
+    Trace(L"\n-- Server side headers that need to be send with a response --\n");
     DumpHeaders(serverAdditionalHeaders, serverAdditionalHeaderCount);
 
     // Finish handshake. Once the client/server handshake is completed, memory allocated by
@@ -166,7 +193,7 @@ HRESULT PerformHandshake(
     hr = WebSocketEndServerHandshake(serverHandle);
     if (FAILED(hr))
     {
-        wprintf(L"4\n");
+        Trace(L"4\n");
         goto quit;
     }
 
@@ -183,7 +210,8 @@ quit:
 
 HRESULT RunLoop(
     _In_ WEB_SOCKET_HANDLE handle,
-    _In_ Transport* transport)
+    _In_ Transport* transport,
+    _Out_opt_ WEB_SOCKET_BUFFER_TYPE* receivedBufferType = NULL)
 {
     HRESULT hr = S_OK;
     WEB_SOCKET_BUFFER buffers[2] = {0};
@@ -224,7 +252,7 @@ HRESULT RunLoop(
 
             case WEB_SOCKET_RECEIVE_FROM_NETWORK_ACTION:
 
-                wprintf(L"Receiving data from a network:\n");
+                Trace(L"Receiving data from a network:\n");
 
                 assert(bufferCount >= 1);
                 for (ULONG i = 0; i < bufferCount; i++)
@@ -249,7 +277,7 @@ HRESULT RunLoop(
 
             case WEB_SOCKET_INDICATE_RECEIVE_COMPLETE_ACTION:
 
-                wprintf(L"Receive operation completed with a buffer:\n");
+                Trace(L"Receive operation completed with a buffer:\n");
 
                 if (bufferCount != 1)
                 {
@@ -260,11 +288,16 @@ HRESULT RunLoop(
 
                 DumpData(buffers[0].Data.pbBuffer, buffers[0].Data.ulBufferLength);
 
+                if (receivedBufferType != NULL)
+                {
+                    *receivedBufferType = bufferType;
+                }
+
                 break;
 
             case WEB_SOCKET_SEND_TO_NETWORK_ACTION:
 
-                wprintf(L"Sending data to a network:\n");
+                Trace(L"Sending data to a network:\n");
 
                 for (ULONG i = 0; i < bufferCount; i++)
                 {
@@ -284,7 +317,7 @@ HRESULT RunLoop(
 
             case WEB_SOCKET_INDICATE_SEND_COMPLETE_ACTION:
 
-                wprintf(L"Send operation completed\n");
+                Trace(L"Send operation completed\n");
                 break;
 
             default:
@@ -325,7 +358,7 @@ HRESULT PerformDataExchange(
     buffer.Data.pbBuffer = dataToSend;
     buffer.Data.ulBufferLength = ARRAYSIZE(dataToSend);
 
-    wprintf(L"\n-- Queueing a send with a buffer --\n");
+    Trace(L"\n-- Queueing a send with a buffer --\n");
     DumpData(buffer.Data.pbBuffer, buffer.Data.ulBufferLength);
 
     hr = WebSocketSend(clientHandle, WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE, &buffer, NULL);
@@ -340,7 +373,7 @@ HRESULT PerformDataExchange(
         goto quit;
     }
 
-    wprintf(L"\n-- Queueing a receive --\n");
+    Trace(L"\n-- Queueing a receive --\n");
 
     hr = WebSocketReceive(serverHandle, NULL, NULL);
     if (FAILED(hr))
@@ -359,13 +392,543 @@ quit:
     return hr;
 }
 
-int __cdecl wmain()
+// Sends one binary message from the client to the server and receives it completely. Messages larger
+// than the receive buffer of the server handle arrive as several fragments, each needing its own receive.
+HRESULT ExchangeMessage(
+    _In_ WEB_SOCKET_HANDLE clientHandle,
+    _In_ WEB_SOCKET_HANDLE serverHandle,
+    _In_ Transport* transport,
+    _In_reads_bytes_(dataLength) BYTE* data,
+    _In_ ULONG dataLength)
+{
+    HRESULT hr = S_OK;
+    WEB_SOCKET_BUFFER buffer;
+    WEB_SOCKET_BUFFER_TYPE bufferType;
+
+    buffer.Data.pbBuffer = data;
+    buffer.Data.ulBufferLength = dataLength;
+
+    hr = WebSocketSend(clientHandle, WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE, &buffer, NULL);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    hr = RunLoop(clientHandle, transport);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    do
+    {
+        bufferType = WEB_SOCKET_BINARY_FRAGMENT_BUFFER_TYPE;
+
+        hr = WebSocketReceive(serverHandle, NULL, NULL);
+        if (FAILED(hr))
+        {
+            goto quit;
+        }
+
+        hr = RunLoop(serverHandle, transport, &bufferType);
+        if (FAILED(hr))
+        {
+            goto quit;
+        }
+    }
+    while (bufferType == WEB_SOCKET_BINARY_FRAGMENT_BUFFER_TYPE);
+
+quit:
+
+    return hr;
+}
+
+// Measures the standalone frame codec: a client builds a masked text frame and a server unmasks, validates and
+// parses it, all within one buffer.
+HRESULT RunCodecBenchmark(
+    _In_ const ULONG* messageSizes,
+    _In_ ULONG messageSizeCount,
+    _In_ ULONGLONG bytesPerSize)
+{
+    HRESULT hr = S_OK;
+    BYTE* text = NULL;
+    BYTE* frame = NULL;
+    ULONG maxSize = messageSizes[messageSizeCount - 1];
+    const BYTE maskKey[4] = {0x12, 0x34, 0x56, 0x78};
+    FrameCodec decoder(true);
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER stop;
+
+    QueryPerformanceFrequency(&frequency);
+
+    text = new BYTE[maxSize];
+    frame = new BYTE[maxSize + FRAME_MAX_HEADER_LENGTH];
+    if (text == NULL || frame == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        goto quit;
+    }
+
+    // Text frames have to be valid UTF-8, so use printable ASCII.
+    for (ULONG i = 0; i < maxSize; i++)
+    {
+        text[i] = (BYTE)(' ' + rand() % 95);
+    }
+
+    for (ULONG size = 0; size < messageSizeCount; size++)
+    {
+        ULONG messageCount = (ULONG)(bytesPerSize / messageSizes[size]);
+        if (messageCount > 1000000)
+        {
+            messageCount = 1000000;
+        }
+
+        QueryPerformanceCounter(&start);
+
+        for (ULONG i = 0; i < messageCount; i++)
+        {
+            ULONG frameLength = 0;
+            ULONG bytesConsumed = 0;
+            WebSocketFrame decodedFrame;
+
+            hr = FrameCodec::EncodeFrame(FRAME_OPCODE_TEXT, true, false, text, messageSizes[size], maskKey, frame,
+                maxSize + FRAME_MAX_HEADER_LENGTH, &frameLength);
+            if (FAILED(hr))
+            {
+                goto quit;
+            }
+
+            hr = decoder.DecodeFrame(frame, frameLength, &decodedFrame, &bytesConsumed);
+            if (hr != S_OK)
+            {
+                hr = FAILED(hr) ? hr : E_FAIL;
+                goto quit;
+            }
+
+            assert(bytesConsumed == frameLength);
+            assert(decodedFrame.payloadLength == messageSizes[size]);
+        }
+
+        QueryPerformanceCounter(&stop);
+
+        double seconds = (double)(stop.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+        wprintf(L"Codec: %u frames of %u bytes: %.0f frames/s, %.1f MB/s\n",
+            messageCount,
+            messageSizes[size],
+            messageCount / seconds,
+            (double)messageCount * messageSizes[size] / seconds / (1024 * 1024));
+    }
+
+quit:
+
+    if (text != NULL)
+    {
+        delete[] text;
+        text = NULL;
+    }
+
+    if (frame != NULL)
+    {
+        delete[] frame;
+        frame = NULL;
+    }
+
+    return hr;
+}
+
+// Measures permessage-deflate on top of the frame codec: a client compresses and frames chat-like text, and a
+// server parses the frame, inflates the message and validates it. Both sides keep their context between
+// messages, as they do by default.
+HRESULT RunDeflateBenchmark(
+    _In_ const ULONG* messageSizes,
+    _In_ ULONG messageSizeCount,
+    _In_ ULONGLONG bytesPerSize)
+{
+    HRESULT hr = S_OK;
+    BYTE* text = NULL;
+    BYTE* compressed = NULL;
+    BYTE* frame = NULL;
+    BYTE* inflated = NULL;
+    PerMessageDeflate* client = NULL;
+    PerMessageDeflate* server = NULL;
+    ULONG maxSize = messageSizes[messageSizeCount - 1];
+    ULONG textLength = maxSize + 64 * 1024;
+    ULONG maxCompressedLength = DeflateCompressor::GetMaxCompressedLength(maxSize);
+    const BYTE maskKey[4] = {0x12, 0x34, 0x56, 0x78};
+    const char offer[] = "permessage-deflate; client_max_window_bits";
+    const char* const words[] =
+    {
+        "hello", "world", "the", "message", "is", "on", "its", "way", "see", "you", "at", "noon", "thanks",
+        "meeting", "room", "joined", "left", "typing", "ok", "sounds", "good", "tomorrow", "status", "update"
+    };
+    char response[128];
+    ULONG responseLength = 0;
+    PerMessageDeflateParameters offered;
+    PerMessageDeflateParameters accepted;
+    FrameCodec decoder(true);
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER stop;
+
+    QueryPerformanceFrequency(&frequency);
+
+    // The server picks the parameters from the client's offer, and the client applies the server's response.
+    hr = PerMessageDeflate::ParseExtension(offer, ARRAYSIZE(offer) - 1, false, &offered);
+    if (hr != S_OK)
+    {
+        hr = FAILED(hr) ? hr : E_FAIL;
+        goto quit;
+    }
+
+    hr = PerMessageDeflate::FormatResponse(&offered, response, ARRAYSIZE(response), &responseLength);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    hr = PerMessageDeflate::ParseExtension(response, responseLength, true, &accepted);
+    if (hr != S_OK)
+    {
+        hr = FAILED(hr) ? hr : E_FAIL;
+        goto quit;
+    }
+
+    text = new BYTE[textLength];
+    compressed = new BYTE[maxCompressedLength];
+    frame = new BYTE[maxCompressedLength + FRAME_MAX_HEADER_LENGTH];
+    inflated = new BYTE[maxSize];
+    client = new PerMessageDeflate();
+    server = new PerMessageDeflate();
+    if (text == NULL || compressed == NULL || frame == NULL || inflated == NULL || client == NULL || server == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        goto quit;
+    }
+
+    hr = client->Initialize(false, &accepted);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    hr = server->Initialize(true, &offered);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    decoder.EnablePerMessageDeflate();
+
+    // Random words compress about as well as chat messages. Messages start at different offsets so that they
+    // are not simply repeats of the previous one.
+    for (ULONG i = 0; i < textLength; )
+    {
+        const char* word = words[rand() % ARRAYSIZE(words)];
+
+        for (; *word != '\0' && i < textLength; word++)
+        {
+            text[i++] = (BYTE)*word;
+        }
+
+        if (i < textLength)
+        {
+            text[i++] = (rand() % 8 == 0) ? '.' : ' ';
+        }
+    }
+
+    for (ULONG size = 0; size < messageSizeCount; size++)
+    {
+        ULONG messageSize = messageSizes[size];
+        ULONGLONG compressedBytes = 0;
+
+        // Compression is far slower than framing, so each size moves less data than the codec benchmark.
+        ULONG messageCount = (ULONG)(bytesPerSize / 16 / messageSize);
+        if (messageCount > 100000)
+        {
+            messageCount = 100000;
+        }
+
+        QueryPerformanceCounter(&start);
+
+        for (ULONG i = 0; i < messageCount; i++)
+        {
+            const BYTE* message = text + (i * 7919) % (textLength - messageSize);
+            ULONG compressedLength = 0;
+            ULONG frameLength = 0;
+            ULONG bytesConsumed = 0;
+            ULONG inflatedLength = 0;
+            WebSocketFrame decodedFrame;
+            Utf8Validator validator;
+
+            hr = client->CompressMessage(message, messageSize, compressed, maxCompressedLength, &compressedLength);
+            if (FAILED(hr))
+            {
+                goto quit;
+            }
+
+            hr = FrameCodec::EncodeFrame(FRAME_OPCODE_TEXT, true, true, compressed, compressedLength, maskKey, frame,
+                maxCompressedLength + FRAME_MAX_HEADER_LENGTH, &frameLength);
+            if (FAILED(hr))
+            {
+                goto quit;
+            }
+
+            hr = decoder.DecodeFrame(frame, frameLength, &decodedFrame, &bytesConsumed);
+            if (hr != S_OK)
+            {
+                hr = FAILED(hr) ? hr : E_FAIL;
+                goto quit;
+            }
+
+            assert(decodedFrame.compressed);
+
+            hr = server->DecompressMessage(decodedFrame.payload, decodedFrame.payloadLength, inflated, maxSize,
+                &inflatedLength);
+            if (FAILED(hr))
+            {
+                goto quit;
+            }
+
+            if (!validator.Validate(inflated, inflatedLength) || !validator.IsComplete())
+            {
+                hr = E_FRAME_INVALID_UTF8;
+                goto quit;
+            }
+
+            if (inflatedLength != messageSize || memcmp(inflated, message, messageSize) != 0)
+            {
+                wprintf(L"Inflated message does not match the original\n");
+                hr = E_FAIL;
+                goto quit;
+            }
+
+            compressedBytes += compressedLength;
+        }
+
+        QueryPerformanceCounter(&stop);
+
+        double seconds = (double)(stop.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+        wprintf(L"Deflate: %u frames of %u bytes: %.0f frames/s, %.1f MB/s, compressed to %.0f%%\n",
+            messageCount,
+            messageSize,
+            messageCount / seconds,
+            (double)messageCount * messageSize / seconds / (1024 * 1024),
+            100.0 * compressedBytes / ((double)messageCount * messageSize));
+    }
+
+quit:
+
+    if (text != NULL)
+    {
+        delete[] text;
+        text = NULL;
+    }
+
+    if (compressed != NULL)
+    {
+        delete[] compressed;
+        compressed = NULL;
+    }
+
+    if (frame != NULL)
+    {
+        delete[] frame;
+        frame = NULL;
+    }
+
+    if (inflated != NULL)
+    {
+        delete[] inflated;
+        inflated = NULL;
+    }
+
+    if (client != NULL)
+    {
+        delete client;
+        client = NULL;
+    }
+
+    if (server != NULL)
+    {
+        delete server;
+        server = NULL;
+    }
+
+    return hr;
+}
+
+// Measures how many handshakes and messages per second the client/server pair can process over the transport.
+// This covers the websocket protocol component and the transport, without any real network in between.
+HRESULT RunBenchmark()
+{
+    HRESULT hr = S_OK;
+    WEB_SOCKET_HANDLE clientHandle = NULL;
+    WEB_SOCKET_HANDLE serverHandle = NULL;
+    Transport transport;
+    BYTE* data = NULL;
+    LARGE_INTEGER frequency;
+    LARGE_INTEGER start;
+    LARGE_INTEGER stop;
+
+    const ULONG handshakeCount = 1000;
+    const ULONG messageSizes[] = {16, 128, 1024, 16 * 1024, 256 * 1024};
+    const ULONGLONG bytesPerSize = 256 * 1024 * 1024;
+
+    verbose = false;
+    QueryPerformanceFrequency(&frequency);
+
+    hr = transport.Initialize(TRANSPORT_DEFAULT_CAPACITY);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    data = new BYTE[messageSizes[ARRAYSIZE(messageSizes) - 1]];
+    if (data == NULL)
+    {
+        hr = E_OUTOFMEMORY;
+        goto quit;
+    }
+
+    for (ULONG i = 0; i < messageSizes[ARRAYSIZE(messageSizes) - 1]; i++)
+    {
+        data[i] = (BYTE)rand();
+    }
+
+    // Handshakes, including creating and deleting the handles.
+    QueryPerformanceCounter(&start);
+
+    for (ULONG i = 0; i < handshakeCount; i++)
+    {
+        hr = Initialize(&clientHandle, &serverHandle);
+        if (FAILED(hr))
+        {
+            goto quit;
+        }
+
+        hr = PerformHandshake(clientHandle, serverHandle);
+        if (FAILED(hr))
+        {
+            goto quit;
+        }
+
+        WebSocketDeleteHandle(clientHandle);
+        clientHandle = NULL;
+        WebSocketDeleteHandle(serverHandle);
+        serverHandle = NULL;
+    }
+
+    QueryPerformanceCounter(&stop);
+
+    wprintf(L"%u handshakes: %.0f handshakes/s\n",
+        handshakeCount,
+        handshakeCount * (double)frequency.QuadPart / (stop.QuadPart - start.QuadPart));
+
+    hr = Initialize(&clientHandle, &serverHandle);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    hr = PerformHandshake(clientHandle, serverHandle);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    // Messages of increasing size. Each size moves the same amount of data.
+    for (ULONG size = 0; size < ARRAYSIZE(messageSizes); size++)
+    {
+        ULONG messageCount = (ULONG)(bytesPerSize / messageSizes[size]);
+        if (messageCount > 1000000)
+        {
+            messageCount = 1000000;
+        }
+
+        QueryPerformanceCounter(&start);
+
+        for (ULONG i = 0; i < messageCount; i++)
+        {
+            hr = ExchangeMessage(clientHandle, serverHandle, &transport, data, messageSizes[size]);
+            if (FAILED(hr))
+            {
+                goto quit;
+            }
+        }
+
+        QueryPerformanceCounter(&stop);
+
+        double seconds = (double)(stop.QuadPart - start.QuadPart) / frequency.QuadPart;
+
+        wprintf(L"%u messages of %u bytes: %.0f messages/s, %.1f MB/s\n",
+            messageCount,
+            messageSizes[size],
+            messageCount / seconds,
+            (double)messageCount * messageSizes[size] / seconds / (1024 * 1024));
+    }
+
+    hr = RunCodecBenchmark(messageSizes, ARRAYSIZE(messageSizes), bytesPerSize);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
+    hr = RunDeflateBenchmark(messageSizes, ARRAYSIZE(messageSizes), bytesPerSize);
+
+quit:
+
+    if (clientHandle != NULL)
+    {
+        WebSocketDeleteHandle(clientHandle);
+        clientHandle = NULL;
+    }
+
+    if (serverHandle != NULL)
+    {
+        WebSocketDeleteHandle(serverHandle);
+        serverHandle = NULL;
+    }
+
+    if (data != NULL)
+    {
+        delete[] data;
+        data = NULL;
+    }
+
+    return hr;
+}
+
+int __cdecl wmain(
+    _In_ int argc,
+    _In_reads_(argc) wchar_t** argv)
 {
     HRESULT hr = S_OK;
     WEB_SOCKET_HANDLE clientHandle = NULL;
     WEB_SOCKET_HANDLE serverHandle = NULL;
     Transport transport;
 
+    // "Websocket.exe -benchmark" measures throughput instead of walking through a single exchange.
+    if (argc > 1 && (_wcsicmp(argv[1], L"-benchmark") == 0 || _wcsicmp(argv[1], L"/benchmark") == 0))
+    {
+        hr = RunBenchmark();
+        if (FAILED(hr))
+        {
+            wprintf(L"Benchmark failed with error 0x%x\n", hr);
+            return 0;
+        }
+
+        return 1;
+    }
+
+    hr = transport.Initialize(TRANSPORT_DEFAULT_CAPACITY);
+    if (FAILED(hr))
+    {
+        goto quit;
+    }
+
     hr = Initialize(&clientHandle, &serverHandle);
     if (FAILED(hr))
     {
@@ -0,0 +1,1450 @@
+#include <Windows.h>
+#include <Assert.h>
+#include "FrameCodec.h"
+#include "PerMessageDeflate.h"
+#include <new>
+
+#define DEFLATE_WINDOW_MASK (DEFLATE_WINDOW_SIZE - 1)
+#define DEFLATE_HASH_BITS 15
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+
+// Hash chain search limits. Longer chains find slightly better matches at a high cost in speed.
+#define DEFLATE_MAX_CHAIN 32
+#define DEFLATE_NICE_MATCH 128
+
+// Base values and extra bits of the length codes 257..285 and the distance codes 0..29 (RFC 1951 3.2.5).
+static const USHORT lengthBase[29] =
+{
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227,
+    258
+};
+
+static const BYTE lengthExtra[29] =
+{
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+
+static const USHORT distanceBase[30] =
+{
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577
+};
+
+static const BYTE distanceExtra[30] =
+{
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+// The bytes that end every compressed message and that the sender leaves out (RFC 7692 7.2.1).
+static const BYTE messageTail[4] = { 0x00, 0x00, 0xFF, 0xFF };
+
+// Index of the last base that is not greater than the value.
+static ULONG FindBase(
+    _In_reads_(count) const USHORT* bases,
+    _In_ ULONG count,
+    _In_ ULONG value)
+{
+    ULONG low = 0;
+    ULONG high = count - 1;
+
+    while (low < high)
+    {
+        ULONG middle = (low + high + 1) / 2;
+        if (bases[middle] <= value)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle - 1;
+        }
+    }
+
+    return low;
+}
+
+// Huffman codes are defined most significant bit first but are written into the least significant end of
+// the bit stream.
+static ULONG ReverseBits(
+    _In_ ULONG code,
+    _In_ ULONG length)
+{
+    ULONG reversed = 0;
+
+    for (ULONG i = 0; i < length; i++)
+    {
+        reversed = (reversed << 1) | (code & 1);
+        code >>= 1;
+    }
+
+    return reversed;
+}
+
+static ULONG Hash(
+    _In_reads_bytes_(DEFLATE_MIN_MATCH) const BYTE* data)
+{
+    ULONG value = ((ULONG)data[0] << 16) | ((ULONG)data[1] << 8) | data[2];
+    return (value * 2654435761U) >> (32 - DEFLATE_HASH_BITS);
+}
+
+DeflateCompressor::DeflateCompressor()
+{
+    this->window = NULL;
+    this->head = NULL;
+    this->prev = NULL;
+    this->symbolValues = NULL;
+    this->symbolDistances = NULL;
+    this->windowEnd = 0;
+    this->hashed = 0;
+    this->historyStart = 0;
+    this->maxDistance = DEFLATE_WINDOW_SIZE;
+    this->output = NULL;
+    this->outputLength = 0;
+    this->outputPosition = 0;
+    this->bitBuffer = 0;
+    this->bitCount = 0;
+    this->overflow = false;
+}
+
+DeflateCompressor::~DeflateCompressor()
+{
+    delete[] this->window;
+    delete[] this->head;
+    delete[] this->prev;
+    delete[] this->symbolValues;
+    delete[] this->symbolDistances;
+}
+
+HRESULT DeflateCompressor::Initialize(
+    _In_ BYTE windowBits)
+{
+    assert(this->window == NULL);
+
+    if (windowBits < DEFLATE_MIN_WINDOW_BITS || windowBits > DEFLATE_MAX_WINDOW_BITS)
+    {
+        return E_INVALIDARG;
+    }
+
+    // The window holds the current data and the history before it. Data is moved down by half the window
+    // once it fills up.
+    this->window = new(std::nothrow) BYTE[2 * DEFLATE_WINDOW_SIZE];
+    this->head = new(std::nothrow) ULONG[DEFLATE_HASH_SIZE];
+    this->prev = new(std::nothrow) ULONG[DEFLATE_WINDOW_SIZE];
+    this->symbolValues = new(std::nothrow) USHORT[DEFLATE_WINDOW_SIZE];
+    this->symbolDistances = new(std::nothrow) USHORT[DEFLATE_WINDOW_SIZE];
+
+    if (this->window == NULL || this->head == NULL || this->prev == NULL || this->symbolValues == NULL ||
+        this->symbolDistances == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // The chains hold positions plus one, so zero ends a chain.
+    ZeroMemory(this->head, DEFLATE_HASH_SIZE * sizeof(ULONG));
+    ZeroMemory(this->prev, DEFLATE_WINDOW_SIZE * sizeof(ULONG));
+
+    this->maxDistance = 1UL << windowBits;
+    this->windowEnd = 0;
+    Reset();
+
+    return S_OK;
+}
+
+void DeflateCompressor::Reset()
+{
+    // Older positions stay in the chains, but the search stops at the first one before historyStart.
+    this->historyStart = this->windowEnd;
+    this->hashed = this->windowEnd;
+}
+
+void DeflateCompressor::Slide()
+{
+    MoveMemory(this->window, this->window + DEFLATE_WINDOW_SIZE, this->windowEnd - DEFLATE_WINDOW_SIZE);
+
+    for (ULONG i = 0; i < DEFLATE_HASH_SIZE; i++)
+    {
+        this->head[i] = (this->head[i] > DEFLATE_WINDOW_SIZE) ? this->head[i] - DEFLATE_WINDOW_SIZE : 0;
+    }
+
+    for (ULONG i = 0; i < DEFLATE_WINDOW_SIZE; i++)
+    {
+        this->prev[i] = (this->prev[i] > DEFLATE_WINDOW_SIZE) ? this->prev[i] - DEFLATE_WINDOW_SIZE : 0;
+    }
+
+    this->windowEnd -= DEFLATE_WINDOW_SIZE;
+    this->hashed -= DEFLATE_WINDOW_SIZE;
+    this->historyStart = (this->historyStart > DEFLATE_WINDOW_SIZE) ?
+        this->historyStart - DEFLATE_WINDOW_SIZE : 0;
+}
+
+void DeflateCompressor::InsertString(
+    _In_ ULONG position)
+{
+    // The last two bytes of the data are inserted once the next piece has arrived.
+    if (position + DEFLATE_MIN_MATCH > this->windowEnd)
+    {
+        return;
+    }
+
+    ULONG hash = Hash(this->window + position);
+    this->prev[position & DEFLATE_WINDOW_MASK] = this->head[hash];
+    this->head[hash] = position + 1;
+    this->hashed = position + 1;
+}
+
+ULONG DeflateCompressor::FindMatch(
+    _In_ ULONG position,
+    _Out_ ULONG* distance)
+{
+    *distance = 0;
+
+    ULONG available = this->windowEnd - position;
+    if (available < DEFLATE_MIN_MATCH)
+    {
+        return 0;
+    }
+
+    ULONG maxLength = __min(available, DEFLATE_MAX_MATCH);
+    const BYTE* scan = this->window + position;
+    ULONG candidate = this->head[Hash(scan)];
+    ULONG bestLength = DEFLATE_MIN_MATCH - 1;
+
+    for (ULONG chain = 0; candidate != 0 && chain < DEFLATE_MAX_CHAIN; chain++)
+    {
+        ULONG match = candidate - 1;
+
+        // The chains run from newer to older positions, so nothing further along is usable either.
+        if (match < this->historyStart || match >= position || position - match > this->maxDistance)
+        {
+            break;
+        }
+
+        const BYTE* matchData = this->window + match;
+
+        // Checking the byte that would make the match longer rules most candidates out early.
+        if (matchData[bestLength] == scan[bestLength] && matchData[0] == scan[0] && matchData[1] == scan[1])
+        {
+            ULONG length = 2;
+            while (length < maxLength && matchData[length] == scan[length])
+            {
+                length++;
+            }
+
+            if (length > bestLength)
+            {
+                bestLength = length;
+                *distance = position - match;
+
+                if (length >= DEFLATE_NICE_MATCH || length == maxLength)
+                {
+                    break;
+                }
+            }
+        }
+
+        // An entry that is not older than the candidate was overwritten by a newer position.
+        ULONG next = this->prev[match & DEFLATE_WINDOW_MASK];
+        if (next >= candidate)
+        {
+            break;
+        }
+
+        candidate = next;
+    }
+
+    return (bestLength >= DEFLATE_MIN_MATCH) ? bestLength : 0;
+}
+
+void DeflateCompressor::CompressPiece(
+    _In_ ULONG start)
+{
+    ULONG end = this->windowEnd;
+    ULONG symbolCount = 0;
+
+    // Block header and end of block code.
+    ULONG fixedBits = 3 + 7;
+
+    while (this->hashed < start && this->hashed + DEFLATE_MIN_MATCH <= end)
+    {
+        InsertString(this->hashed);
+    }
+
+    ULONG position = start;
+    while (position < end)
+    {
+        ULONG distance;
+        ULONG length = FindMatch(position, &distance);
+
+        InsertString(position);
+
+        if (length != 0)
+        {
+            ULONG lengthIndex = FindBase(lengthBase, ARRAYSIZE(lengthBase), length);
+            ULONG distanceIndex = FindBase(distanceBase, ARRAYSIZE(distanceBase), distance);
+
+            // Length codes 257..279 are 7 bits long, 280..285 are 8 bits. Distance codes are 5 bits.
+            fixedBits += ((lengthIndex < 23) ? 7 : 8) + lengthExtra[lengthIndex] + 5 + distanceExtra[distanceIndex];
+
+            this->symbolValues[symbolCount] = (USHORT)length;
+            this->symbolDistances[symbolCount] = (USHORT)distance;
+            symbolCount++;
+
+            for (ULONG i = 1; i < length; i++)
+            {
+                InsertString(position + i);
+            }
+
+            position += length;
+        }
+        else
+        {
+            BYTE literal = this->window[position];
+
+            fixedBits += (literal < 144) ? 8 : 9;
+
+            this->symbolValues[symbolCount] = literal;
+            this->symbolDistances[symbolCount] = 0;
+            symbolCount++;
+
+            position++;
+        }
+    }
+
+    // A stored block has a 3 bit header, padding to the next byte, the length and its complement.
+    ULONG pieceLength = end - start;
+    ULONG storedBits = 3 + ((8 - (this->bitCount + 3) % 8) % 8) + 32 + 8 * pieceLength;
+
+    if (fixedBits < storedBits)
+    {
+        // BFINAL is 0 and BTYPE is 01.
+        PutBits(2, 3);
+
+        for (ULONG i = 0; i < symbolCount; i++)
+        {
+            ULONG distance = this->symbolDistances[i];
+            ULONG value = this->symbolValues[i];
+
+            if (distance == 0)
+            {
+                PutFixedCode(value);
+                continue;
+            }
+
+            ULONG lengthIndex = FindBase(lengthBase, ARRAYSIZE(lengthBase), value);
+            PutFixedCode(257 + lengthIndex);
+            PutBits(value - lengthBase[lengthIndex], lengthExtra[lengthIndex]);
+
+            ULONG distanceIndex = FindBase(distanceBase, ARRAYSIZE(distanceBase), distance);
+            PutBits(ReverseBits(distanceIndex, 5), 5);
+            PutBits(distance - distanceBase[distanceIndex], distanceExtra[distanceIndex]);
+        }
+
+        PutFixedCode(256);
+    }
+    else
+    {
+        PutBits(0, 3);
+        AlignToByte();
+        PutBits(pieceLength, 16);
+        PutBits(~pieceLength & 0xFFFF, 16);
+
+        if (this->outputLength - this->outputPosition < pieceLength)
+        {
+            this->overflow = true;
+            return;
+        }
+
+        CopyMemory(this->output + this->outputPosition, this->window + start, pieceLength);
+        this->outputPosition += pieceLength;
+    }
+}
+
+void DeflateCompressor::PutFixedCode(
+    _In_ ULONG symbol)
+{
+    ULONG code;
+    ULONG length;
+
+    if (symbol < 144)
+    {
+        code = 0x30 + symbol;
+        length = 8;
+    }
+    else if (symbol < 256)
+    {
+        code = 0x190 + symbol - 144;
+        length = 9;
+    }
+    else if (symbol < 280)
+    {
+        code = symbol - 256;
+        length = 7;
+    }
+    else
+    {
+        code = 0xC0 + symbol - 280;
+        length = 8;
+    }
+
+    PutBits(ReverseBits(code, length), length);
+}
+
+void DeflateCompressor::PutBits(
+    _In_ ULONG value,
+    _In_ ULONG count)
+{
+    // Fewer than 8 bits are pending, so up to 24 bits can be added at once.
+    assert(count <= 24);
+
+    this->bitBuffer |= value << this->bitCount;
+    this->bitCount += count;
+
+    while (this->bitCount >= 8)
+    {
+        if (this->outputPosition < this->outputLength)
+        {
+            this->output[this->outputPosition++] = (BYTE)this->bitBuffer;
+        }
+        else
+        {
+            this->overflow = true;
+        }
+
+        this->bitBuffer >>= 8;
+        this->bitCount -= 8;
+    }
+}
+
+void DeflateCompressor::AlignToByte()
+{
+    if (this->bitCount != 0)
+    {
+        PutBits(0, 8 - this->bitCount);
+    }
+}
+
+HRESULT DeflateCompressor::Compress(
+    _In_reads_bytes_(dataLength) const BYTE* data,
+    _In_ ULONG dataLength,
+    _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+    _In_ ULONG outputLength,
+    _Out_ ULONG* bytesWritten)
+{
+    *bytesWritten = 0;
+
+    if (this->window == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+
+    this->output = output;
+    this->outputLength = outputLength;
+    this->outputPosition = 0;
+    this->bitBuffer = 0;
+    this->bitCount = 0;
+    this->overflow = false;
+
+    // The data is compressed in pieces of up to one window. Every piece is its own block.
+    ULONG consumed = 0;
+    while (consumed < dataLength)
+    {
+        ULONG wanted = __min(dataLength - consumed, DEFLATE_WINDOW_SIZE);
+
+        if (2 * DEFLATE_WINDOW_SIZE - this->windowEnd < wanted &&
+            this->windowEnd > DEFLATE_WINDOW_SIZE + DEFLATE_WINDOW_SIZE / 2)
+        {
+            Slide();
+        }
+
+        ULONG pieceLength = __min(wanted, 2 * DEFLATE_WINDOW_SIZE - this->windowEnd);
+        ULONG start = this->windowEnd;
+
+        CopyMemory(this->window + start, data + consumed, pieceLength);
+        this->windowEnd += pieceLength;
+        consumed += pieceLength;
+
+        CompressPiece(start);
+    }
+
+    // An empty stored block ends the message. Its length and complement are the 0x00 0x00 0xFF 0xFF that is
+    // left out.
+    PutBits(0, 3);
+    AlignToByte();
+
+    this->output = NULL;
+
+    if (this->overflow)
+    {
+        // The peer never sees this message, so later messages must not refer to it.
+        Reset();
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    *bytesWritten = this->outputPosition;
+    return S_OK;
+}
+
+ULONG DeflateCompressor::GetMaxCompressedLength(
+    _In_ ULONG dataLength)
+{
+    // A piece is at least half a window unless it is the last one, and a stored block adds at most 6 bytes.
+    ULONG overhead = 6 * (dataLength / (DEFLATE_WINDOW_SIZE / 2) + 2) + 2;
+
+    if (dataLength > MAXULONG - overhead)
+    {
+        return MAXULONG;
+    }
+
+    return dataLength + overhead;
+}
+
+DeflateDecompressor::DeflateDecompressor()
+{
+    this->history = NULL;
+    this->historyPosition = 0;
+    this->historyLength = 0;
+    this->input = NULL;
+    this->inputLength = 0;
+    this->inputPosition = 0;
+    this->bitBuffer = 0;
+    this->bitCount = 0;
+}
+
+DeflateDecompressor::~DeflateDecompressor()
+{
+    delete[] this->history;
+}
+
+HRESULT DeflateDecompressor::Initialize()
+{
+    assert(this->history == NULL);
+
+    this->history = new(std::nothrow) BYTE[DEFLATE_WINDOW_SIZE];
+    if (this->history == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    // The fixed codes of RFC 1951 3.2.6.
+    BYTE lengths[288];
+    ULONG symbol = 0;
+
+    for (; symbol < 144; symbol++)
+    {
+        lengths[symbol] = 8;
+    }
+
+    for (; symbol < 256; symbol++)
+    {
+        lengths[symbol] = 9;
+    }
+
+    for (; symbol < 280; symbol++)
+    {
+        lengths[symbol] = 7;
+    }
+
+    for (; symbol < 288; symbol++)
+    {
+        lengths[symbol] = 8;
+    }
+
+    BuildCode(&this->fixedLiteralCode, lengths, 288);
+
+    for (symbol = 0; symbol < 30; symbol++)
+    {
+        lengths[symbol] = 5;
+    }
+
+    BuildCode(&this->fixedDistanceCode, lengths, 30);
+
+    Reset();
+    return S_OK;
+}
+
+void DeflateDecompressor::Reset()
+{
+    this->historyPosition = 0;
+    this->historyLength = 0;
+}
+
+bool DeflateDecompressor::ReadBits(
+    _In_ ULONG count,
+    _Out_ ULONG* value)
+{
+    // Bytes are loaded one at a time, so no more than 7 bits are left over at the end of a block.
+    while (this->bitCount < count)
+    {
+        BYTE next;
+
+        if (this->inputPosition < this->inputLength)
+        {
+            next = this->input[this->inputPosition];
+        }
+        else if (this->inputPosition - this->inputLength < ARRAYSIZE(messageTail))
+        {
+            next = messageTail[this->inputPosition - this->inputLength];
+        }
+        else
+        {
+            *value = 0;
+            return false;
+        }
+
+        this->inputPosition++;
+        this->bitBuffer |= (ULONG)next << this->bitCount;
+        this->bitCount += 8;
+    }
+
+    *value = this->bitBuffer & ((1UL << count) - 1);
+    this->bitBuffer >>= count;
+    this->bitCount -= count;
+
+    return true;
+}
+
+bool DeflateDecompressor::Decode(
+    _In_ const HuffmanCode* code,
+    _Out_ ULONG* symbol)
+{
+    // Canonical codes of each length are consecutive, so a code is found by comparing it with the first code
+    // of its length.
+    int value = 0;
+    int first = 0;
+    int index = 0;
+
+    *symbol = 0;
+
+    for (ULONG length = 1; length < ARRAYSIZE(code->counts); length++)
+    {
+        ULONG bit;
+        if (!ReadBits(1, &bit))
+        {
+            return false;
+        }
+
+        value |= bit;
+
+        int count = code->counts[length];
+        if (value - count < first)
+        {
+            *symbol = code->symbols[index + (value - first)];
+            return true;
+        }
+
+        index += count;
+        first = (first + count) << 1;
+        value <<= 1;
+    }
+
+    return false;
+}
+
+int DeflateDecompressor::BuildCode(
+    _Out_ HuffmanCode* code,
+    _In_reads_(count) const BYTE* lengths,
+    _In_ ULONG count)
+{
+    USHORT offsets[16];
+
+    ZeroMemory(code->counts, sizeof(code->counts));
+
+    for (ULONG symbol = 0; symbol < count; symbol++)
+    {
+        code->counts[lengths[symbol]]++;
+    }
+
+    // A code without any symbols is complete, but nothing can be decoded with it.
+    if (code->counts[0] == count)
+    {
+        return 0;
+    }
+
+    // Returns the number of unused codes: negative if the lengths are over-subscribed, positive if the code
+    // is incomplete.
+    int left = 1;
+    for (ULONG length = 1; length < 16; length++)
+    {
+        left <<= 1;
+        left -= code->counts[length];
+        if (left < 0)
+        {
+            return left;
+        }
+    }
+
+    offsets[1] = 0;
+    for (ULONG length = 1; length < 15; length++)
+    {
+        offsets[length + 1] = offsets[length] + code->counts[length];
+    }
+
+    for (ULONG symbol = 0; symbol < count; symbol++)
+    {
+        if (lengths[symbol] != 0)
+        {
+            code->symbols[offsets[lengths[symbol]]++] = (USHORT)symbol;
+        }
+    }
+
+    return left;
+}
+
+HRESULT DeflateDecompressor::ReadDynamicCodes()
+{
+    // Order in which the code length code lengths are sent (RFC 1951 3.2.7).
+    static const BYTE order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+    BYTE lengths[286 + 30];
+    ULONG literalCount;
+    ULONG distanceCount;
+    ULONG codeCount;
+
+    if (!ReadBits(5, &literalCount) || !ReadBits(5, &distanceCount) || !ReadBits(4, &codeCount))
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    literalCount += 257;
+    distanceCount += 1;
+    codeCount += 4;
+
+    if (literalCount > 286 || distanceCount > 30)
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    for (ULONG i = 0; i < ARRAYSIZE(order); i++)
+    {
+        ULONG length = 0;
+        if (i < codeCount && !ReadBits(3, &length))
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+
+        lengths[order[i]] = (BYTE)length;
+    }
+
+    // The code length code has to be complete.
+    if (BuildCode(&this->literalCode, lengths, ARRAYSIZE(order)) != 0)
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    ULONG index = 0;
+    while (index < literalCount + distanceCount)
+    {
+        ULONG symbol;
+        if (!Decode(&this->literalCode, &symbol))
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+
+        if (symbol < 16)
+        {
+            lengths[index++] = (BYTE)symbol;
+            continue;
+        }
+
+        // 16 repeats the previous length 3..6 times, 17 and 18 repeat zero 3..10 and 11..138 times.
+        BYTE length = 0;
+        ULONG repeat;
+
+        if (symbol == 16)
+        {
+            if (index == 0 || !ReadBits(2, &repeat))
+            {
+                return E_FRAME_PROTOCOL_ERROR;
+            }
+
+            length = lengths[index - 1];
+            repeat += 3;
+        }
+        else if (symbol == 17)
+        {
+            if (!ReadBits(3, &repeat))
+            {
+                return E_FRAME_PROTOCOL_ERROR;
+            }
+
+            repeat += 3;
+        }
+        else
+        {
+            if (!ReadBits(7, &repeat))
+            {
+                return E_FRAME_PROTOCOL_ERROR;
+            }
+
+            repeat += 11;
+        }
+
+        if (repeat > literalCount + distanceCount - index)
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+
+        while (repeat-- > 0)
+        {
+            lengths[index++] = length;
+        }
+    }
+
+    // Without an end of block code the block could never end.
+    if (lengths[256] == 0)
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    // An incomplete code is only allowed if it has a single code of one bit.
+    int left = BuildCode(&this->literalCode, lengths, literalCount);
+    if (left < 0 || (left > 0 && literalCount != (ULONG)this->literalCode.counts[0] + this->literalCode.counts[1]))
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    left = BuildCode(&this->distanceCode, lengths + literalCount, distanceCount);
+    if (left < 0 ||
+        (left > 0 && distanceCount != (ULONG)this->distanceCode.counts[0] + this->distanceCode.counts[1]))
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    return S_OK;
+}
+
+HRESULT DeflateDecompressor::InflateStored(
+    _Out_writes_bytes_to_(outputLength, *outputPosition) BYTE* output,
+    _In_ ULONG outputLength,
+    _Inout_ ULONG* outputPosition)
+{
+    // Skip the rest of the current byte.
+    ULONG padding = this->bitCount & 7;
+    this->bitBuffer >>= padding;
+    this->bitCount -= padding;
+
+    ULONG length;
+    ULONG complement;
+
+    if (!ReadBits(16, &length) || !ReadBits(16, &complement) || length != (~complement & 0xFFFF))
+    {
+        return E_FRAME_PROTOCOL_ERROR;
+    }
+
+    if (length > outputLength - *outputPosition)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    // All loaded bits have been used, so the data can be copied straight from the input.
+    assert(this->bitCount == 0);
+
+    if (this->inputPosition < this->inputLength)
+    {
+        ULONG direct = __min(length, this->inputLength - this->inputPosition);
+
+        CopyMemory(output + *outputPosition, this->input + this->inputPosition, direct);
+        *outputPosition += direct;
+        this->inputPosition += direct;
+        length -= direct;
+    }
+
+    for (; length > 0; length--)
+    {
+        ULONG value;
+        if (!ReadBits(8, &value))
+        {
+            return E_FRAME_PROTOCOL_ERROR;
+        }
+
+        output[(*outputPosition)++] = (BYTE)value;
+    }
+
+    return S_OK;
+}
+
+HRESULT DeflateDecompressor::InflateCodes(
+    _In_ const HuffmanCode* lengthCode,
+    _In_ const HuffmanCode* offsetCode,
+    _Out_writes_bytes_to_(outputLength, *outputPosition) BYTE* output,
+    _In_ ULONG outputLength,
+    _Inout_ ULONG* outputPosition)
+{
+    ULONG position = *outputPosition;
+    HRESULT hr = S_OK;
+
+    for (;;)
+    {
+        ULONG symbol;
+        if (!Decode(lengthCode, &symbol))
+        {
+            hr = E_FRAME_PROTOCOL_ERROR;
+            break;
+        }
+
+        if (symbol < 256)
+        {
+            if (position >= outputLength)
+            {
+                hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+                break;
+            }
+
+            output[position++] = (BYTE)symbol;
+            continue;
+        }
+
+        if (symbol == 256)
+        {
+            break;
+        }
+
+        symbol -= 257;
+        if (symbol >= ARRAYSIZE(lengthBase))
+        {
+            hr = E_FRAME_PROTOCOL_ERROR;
+            break;
+        }
+
+        ULONG extra;
+        if (!ReadBits(lengthExtra[symbol], &extra))
+        {
+            hr = E_FRAME_PROTOCOL_ERROR;
+            break;
+        }
+
+        ULONG length = lengthBase[symbol] + extra;
+
+        if (!Decode(offsetCode, &symbol) || symbol >= ARRAYSIZE(distanceBase) ||
+            !ReadBits(distanceExtra[symbol], &extra))
+        {
+            hr = E_FRAME_PROTOCOL_ERROR;
+            break;
+        }
+
+        ULONG distance = distanceBase[symbol] + extra;
+
+        if (distance > position + this->historyLength)
+        {
+            hr = E_FRAME_PROTOCOL_ERROR;
+            break;
+        }
+
+        if (length > outputLength - position)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+            break;
+        }
+
+        // A match may start in the earlier messages and overlap the bytes it produces.
+        for (; length > 0; length--)
+        {
+            if (distance <= position)
+            {
+                output[position] = output[position - distance];
+            }
+            else
+            {
+                output[position] = this->history[(this->historyPosition - (distance - position)) & DEFLATE_WINDOW_MASK];
+            }
+
+            position++;
+        }
+    }
+
+    *outputPosition = position;
+    return hr;
+}
+
+HRESULT DeflateDecompressor::Decompress(
+    _In_reads_bytes_(dataLength) const BYTE* data,
+    _In_ ULONG dataLength,
+    _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+    _In_ ULONG outputLength,
+    _Out_ ULONG* bytesWritten)
+{
+    HRESULT hr = S_OK;
+    ULONG position = 0;
+
+    *bytesWritten = 0;
+
+    if (this->history == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+
+    this->input = data;
+    this->inputLength = dataLength;
+    this->inputPosition = 0;
+    this->bitBuffer = 0;
+    this->bitCount = 0;
+
+    for (;;)
+    {
+        // The message ends with the empty stored block whose length is the tail the sender left out.
+        if (this->inputPosition == this->inputLength + ARRAYSIZE(messageTail) && this->bitCount == 0)
+        {
+            break;
+        }
+
+        ULONG lastBlock;
+        ULONG type;
+
+        if (!ReadBits(1, &lastBlock) || !ReadBits(2, &type))
+        {
+            hr = E_FRAME_PROTOCOL_ERROR;
+            break;
+        }
+
+        if (type == 0)
+        {
+            hr = InflateStored(output, outputLength, &position);
+        }
+        else if (type == 1)
+        {
+            hr = InflateCodes(&this->fixedLiteralCode, &this->fixedDistanceCode, output, outputLength, &position);
+        }
+        else if (type == 2)
+        {
+            hr = ReadDynamicCodes();
+            if (SUCCEEDED(hr))
+            {
+                hr = InflateCodes(&this->literalCode, &this->distanceCode, output, outputLength, &position);
+            }
+        }
+        else
+        {
+            hr = E_FRAME_PROTOCOL_ERROR;
+        }
+
+        if (FAILED(hr) || lastBlock != 0)
+        {
+            break;
+        }
+    }
+
+    this->input = NULL;
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Keep the end of the message for the messages that follow.
+    ULONG keep = __min(position, DEFLATE_WINDOW_SIZE);
+    const BYTE* source = output + position - keep;
+    ULONG firstLength = __min(keep, DEFLATE_WINDOW_SIZE - this->historyPosition);
+
+    CopyMemory(this->history + this->historyPosition, source, firstLength);
+    CopyMemory(this->history, source + firstLength, keep - firstLength);
+
+    this->historyPosition = (this->historyPosition + keep) & DEFLATE_WINDOW_MASK;
+    this->historyLength = __min(this->historyLength + keep, DEFLATE_WINDOW_SIZE);
+
+    *bytesWritten = position;
+    return S_OK;
+}
+
+static bool IsTokenCharacter(
+    _In_ char c)
+{
+    if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9'))
+    {
+        return true;
+    }
+
+    switch (c)
+    {
+    case '!': case '#': case '$': case '%': case '&': case '\'': case '*': case '+': case '-': case '.':
+    case '^': case '_': case '`': case '|': case '~':
+        return true;
+    }
+
+    return false;
+}
+
+static void SkipWhitespace(
+    _In_reads_(headerLength) const char* header,
+    _In_ ULONG headerLength,
+    _Inout_ ULONG* position)
+{
+    while (*position < headerLength && (header[*position] == ' ' || header[*position] == '\t'))
+    {
+        (*position)++;
+    }
+}
+
+static ULONG ReadToken(
+    _In_reads_(headerLength) const char* header,
+    _In_ ULONG headerLength,
+    _Inout_ ULONG* position)
+{
+    ULONG start = *position;
+
+    while (*position < headerLength && IsTokenCharacter(header[*position]))
+    {
+        (*position)++;
+    }
+
+    return *position - start;
+}
+
+static bool TokenEquals(
+    _In_reads_(tokenLength) const char* token,
+    _In_ ULONG tokenLength,
+    _In_z_ const char* name)
+{
+    return strlen(name) == tokenLength && _strnicmp(token, name, tokenLength) == 0;
+}
+
+// Applies one extension parameter to the candidate. Returns false if the offer or response cannot be
+// accepted because of it.
+static bool ApplyParameter(
+    _In_reads_(nameLength) const char* name,
+    _In_ ULONG nameLength,
+    _In_reads_opt_(valueLength) const char* value,
+    _In_ ULONG valueLength,
+    _In_ bool isResponse,
+    _Inout_ PerMessageDeflateParameters* candidate,
+    _Inout_updates_(4) bool* seen)
+{
+    static const char* const names[4] =
+    {
+        "server_no_context_takeover",
+        "client_no_context_takeover",
+        "server_max_window_bits",
+        "client_max_window_bits"
+    };
+
+    ULONG index = 0;
+    while (index < ARRAYSIZE(names) && !TokenEquals(name, nameLength, names[index]))
+    {
+        index++;
+    }
+
+    // Unknown and repeated parameters make the whole offer invalid (RFC 7692 5.1).
+    if (index == ARRAYSIZE(names) || seen[index])
+    {
+        return false;
+    }
+
+    seen[index] = true;
+
+    if (index < 2)
+    {
+        if (value != NULL)
+        {
+            return false;
+        }
+
+        if (index == 0)
+        {
+            candidate->serverNoContextTakeover = true;
+        }
+        else
+        {
+            candidate->clientNoContextTakeover = true;
+        }
+
+        return true;
+    }
+
+    // In an offer client_max_window_bits may come without a value to say that the client supports it.
+    if (value == NULL)
+    {
+        return (index == 3 && !isResponse);
+    }
+
+    // The value is a number from 8 to 15 without leading zeros.
+    ULONG bits = 0;
+    for (ULONG i = 0; i < valueLength; i++)
+    {
+        if (value[i] < '0' || value[i] > '9' || (i == 0 && value[i] == '0') || i >= 2)
+        {
+            return false;
+        }
+
+        bits = bits * 10 + (value[i] - '0');
+    }
+
+    if (bits < DEFLATE_MIN_WINDOW_BITS || bits > DEFLATE_MAX_WINDOW_BITS)
+    {
+        return false;
+    }
+
+    if (index == 2)
+    {
+        candidate->serverMaxWindowBits = (BYTE)bits;
+    }
+    else
+    {
+        candidate->clientMaxWindowBits = (BYTE)bits;
+    }
+
+    return true;
+}
+
+static bool AppendString(
+    _Out_writes_(responseLength) char* response,
+    _In_ ULONG responseLength,
+    _Inout_ ULONG* position,
+    _In_z_ const char* text)
+{
+    ULONG textLength = (ULONG)strlen(text);
+
+    // Leave room for the terminating null.
+    if (textLength >= responseLength - *position)
+    {
+        return false;
+    }
+
+    CopyMemory(response + *position, text, textLength);
+    *position += textLength;
+    response[*position] = '\0';
+
+    return true;
+}
+
+static bool AppendWindowBits(
+    _Out_writes_(responseLength) char* response,
+    _In_ ULONG responseLength,
+    _Inout_ ULONG* position,
+    _In_z_ const char* name,
+    _In_ BYTE bits)
+{
+    char digits[3];
+
+    if (bits >= 10)
+    {
+        digits[0] = (char)('0' + bits / 10);
+        digits[1] = (char)('0' + bits % 10);
+        digits[2] = '\0';
+    }
+    else
+    {
+        digits[0] = (char)('0' + bits);
+        digits[1] = '\0';
+    }
+
+    return AppendString(response, responseLength, position, "; ") &&
+        AppendString(response, responseLength, position, name) &&
+        AppendString(response, responseLength, position, "=") &&
+        AppendString(response, responseLength, position, digits);
+}
+
+PerMessageDeflate::PerMessageDeflate()
+{
+    this->resetCompressor = false;
+    this->resetDecompressor = false;
+}
+
+HRESULT PerMessageDeflate::ParseExtension(
+    _In_reads_(headerLength) const char* header,
+    _In_ ULONG headerLength,
+    _In_ bool isResponse,
+    _Out_ PerMessageDeflateParameters* parameters)
+{
+    ULONG position = 0;
+
+    ZeroMemory(parameters, sizeof(*parameters));
+
+    for (;;)
+    {
+        SkipWhitespace(header, headerLength, &position);
+
+        const char* name = header + position;
+        ULONG nameLength = ReadToken(header, headerLength, &position);
+        if (nameLength == 0)
+        {
+            return E_INVALIDARG;
+        }
+
+        bool accept = TokenEquals(name, nameLength, "permessage-deflate");
+        bool seen[4] = { false, false, false, false };
+        PerMessageDeflateParameters candidate =
+        {
+            false, false, DEFLATE_MAX_WINDOW_BITS, DEFLATE_MAX_WINDOW_BITS
+        };
+
+        SkipWhitespace(header, headerLength, &position);
+
+        while (position < headerLength && header[position] == ';')
+        {
+            position++;
+            SkipWhitespace(header, headerLength, &position);
+
+            const char* parameter = header + position;
+            ULONG parameterLength = ReadToken(header, headerLength, &position);
+            if (parameterLength == 0)
+            {
+                return E_INVALIDARG;
+            }
+
+            SkipWhitespace(header, headerLength, &position);
+
+            const char* value = NULL;
+            ULONG valueLength = 0;
+
+            if (position < headerLength && header[position] == '=')
+            {
+                position++;
+                SkipWhitespace(header, headerLength, &position);
+
+                // A value is a token or a quoted string that holds a token.
+                bool quoted = (position < headerLength && header[position] == '"');
+                if (quoted)
+                {
+                    position++;
+                }
+
+                value = header + position;
+                valueLength = ReadToken(header, headerLength, &position);
+
+                if (quoted)
+                {
+                    if (position >= headerLength || header[position] != '"')
+                    {
+                        return E_INVALIDARG;
+                    }
+
+                    position++;
+                }
+
+                if (valueLength == 0)
+                {
+                    return E_INVALIDARG;
+                }
+
+                SkipWhitespace(header, headerLength, &position);
+            }
+
+            if (accept)
+            {
+                accept = ApplyParameter(parameter, parameterLength, value, valueLength, isResponse, &candidate, seen);
+            }
+        }
+
+        if (position < headerLength && header[position] != ',')
+        {
+            return E_INVALIDARG;
+        }
+
+        if (accept)
+        {
+            *parameters = candidate;
+            return S_OK;
+        }
+
+        if (position >= headerLength)
+        {
+            return S_FALSE;
+        }
+
+        // Skip the comma.
+        position++;
+    }
+}
+
+HRESULT PerMessageDeflate::FormatResponse(
+    _In_ const PerMessageDeflateParameters* parameters,
+    _Out_writes_to_(responseLength, *bytesWritten) char* response,
+    _In_ ULONG responseLength,
+    _Out_ ULONG* bytesWritten)
+{
+    ULONG position = 0;
+    bool fits = (responseLength > 0);
+
+    *bytesWritten = 0;
+
+    fits = fits && AppendString(response, responseLength, &position, "permessage-deflate");
+
+    if (parameters->serverNoContextTakeover)
+    {
+        fits = fits && AppendString(response, responseLength, &position, "; server_no_context_takeover");
+    }
+
+    if (parameters->clientNoContextTakeover)
+    {
+        fits = fits && AppendString(response, responseLength, &position, "; client_no_context_takeover");
+    }
+
+    // The default of 15 bits does not have to be repeated.
+    if (parameters->serverMaxWindowBits < DEFLATE_MAX_WINDOW_BITS)
+    {
+        fits = fits && AppendWindowBits(
+            response, responseLength, &position, "server_max_window_bits", parameters->serverMaxWindowBits);
+    }
+
+    if (parameters->clientMaxWindowBits < DEFLATE_MAX_WINDOW_BITS)
+    {
+        fits = fits && AppendWindowBits(
+            response, responseLength, &position, "client_max_window_bits", parameters->clientMaxWindowBits);
+    }
+
+    if (!fits)
+    {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+
+    *bytesWritten = position;
+    return S_OK;
+}
+
+HRESULT PerMessageDeflate::Initialize(
+    _In_ bool isServer,
+    _In_ const PerMessageDeflateParameters* parameters)
+{
+    HRESULT hr;
+
+    // Each side's parameters limit the compressor of that side.
+    BYTE windowBits = isServer ? parameters->serverMaxWindowBits : parameters->clientMaxWindowBits;
+
+    hr = this->compressor.Initialize(windowBits);
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    hr = this->decompressor.Initialize();
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    this->resetCompressor = isServer ? parameters->serverNoContextTakeover : parameters->clientNoContextTakeover;
+    this->resetDecompressor = isServer ? parameters->clientNoContextTakeover : parameters->serverNoContextTakeover;
+
+    return S_OK;
+}
+
+HRESULT PerMessageDeflate::CompressMessage(
+    _In_reads_bytes_(dataLength) const BYTE* data,
+    _In_ ULONG dataLength,
+    _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+    _In_ ULONG outputLength,
+    _Out_ ULONG* bytesWritten)
+{
+    if (this->resetCompressor)
+    {
+        this->compressor.Reset();
+    }
+
+    return this->compressor.Compress(data, dataLength, output, outputLength, bytesWritten);
+}
+
+HRESULT PerMessageDeflate::DecompressMessage(
+    _In_reads_bytes_(dataLength) const BYTE* data,
+    _In_ ULONG dataLength,
+    _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+    _In_ ULONG outputLength,
+    _Out_ ULONG* bytesWritten)
+{
+    if (this->resetDecompressor)
+    {
+        this->decompressor.Reset();
+    }
+
+    return this->decompressor.Decompress(data, dataLength, output, outputLength, bytesWritten);
+}
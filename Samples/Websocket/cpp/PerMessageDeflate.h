@@ -0,0 +1,217 @@
+#pragma once
+
+// DEFLATE history window. RFC 7692 lets each side limit the window of the other side's compressor to
+// 2^8..2^15 bytes.
+#define DEFLATE_WINDOW_SIZE 32768
+#define DEFLATE_MIN_WINDOW_BITS 8
+#define DEFLATE_MAX_WINDOW_BITS 15
+
+// Parameters of the permessage-deflate extension (RFC 7692), as negotiated in the Sec-WebSocket-Extensions
+// header.
+struct PerMessageDeflateParameters
+{
+    bool serverNoContextTakeover;
+    bool clientNoContextTakeover;
+    BYTE serverMaxWindowBits;
+    BYTE clientMaxWindowBits;
+};
+
+// Raw DEFLATE (RFC 1951) compressor for one direction of one connection. Its buffers are allocated once and
+// reused for every message, and it keeps the last window of data so a message can refer to earlier ones.
+//
+// Matches are found with a hash chain and written as fixed Huffman blocks. A dynamic Huffman block would
+// compress long text further, but for small messages its code tables cost more than they save. A block that
+// would not get smaller is stored instead.
+class DeflateCompressor
+{
+private:
+    BYTE* window;
+    ULONG* head;
+    ULONG* prev;
+    USHORT* symbolValues;
+    USHORT* symbolDistances;
+
+    ULONG windowEnd;
+    ULONG hashed;           // Every position before this one is in the hash chains.
+    ULONG historyStart;     // Matches may not start before this position.
+    ULONG maxDistance;
+
+    // Bit output.
+    BYTE* output;
+    ULONG outputLength;
+    ULONG outputPosition;
+    ULONG bitBuffer;
+    ULONG bitCount;
+    bool overflow;
+
+    void Slide();
+
+    void InsertString(
+        _In_ ULONG position);
+
+    ULONG FindMatch(
+        _In_ ULONG position,
+        _Out_ ULONG* distance);
+
+    void CompressPiece(
+        _In_ ULONG start);
+
+    void PutFixedCode(
+        _In_ ULONG symbol);
+
+    void PutBits(
+        _In_ ULONG value,
+        _In_ ULONG count);
+
+    void AlignToByte();
+
+public:
+    DeflateCompressor();
+
+    ~DeflateCompressor();
+
+    HRESULT Initialize(
+        _In_ BYTE windowBits);
+
+    // Forgets all earlier messages.
+    void Reset();
+
+    // Compresses a whole message and ends it with an empty stored block, leaving out the final
+    // 0x00 0x00 0xFF 0xFF as RFC 7692 requires. The message becomes part of the history even if the output
+    // buffer is too small, so a failed message must not be retried without a Reset.
+    HRESULT Compress(
+        _In_reads_bytes_(dataLength) const BYTE* data,
+        _In_ ULONG dataLength,
+        _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+        _In_ ULONG outputLength,
+        _Out_ ULONG* bytesWritten);
+
+    static ULONG GetMaxCompressedLength(
+        _In_ ULONG dataLength);
+};
+
+// Raw DEFLATE decompressor for one direction of one connection. It keeps the last 32 KB of output so that
+// a message can refer to earlier ones.
+class DeflateDecompressor
+{
+private:
+    BYTE* history;
+    ULONG historyPosition;
+    ULONG historyLength;
+
+    // Bit input. The input is followed by the 0x00 0x00 0xFF 0xFF that the sender left out.
+    const BYTE* input;
+    ULONG inputLength;
+    ULONG inputPosition;
+    ULONG bitBuffer;
+    ULONG bitCount;
+
+    // Canonical Huffman code: the number of codes of each length, and the symbols ordered by code.
+    struct HuffmanCode
+    {
+        USHORT counts[16];
+        USHORT symbols[288];
+    };
+
+    HuffmanCode fixedLiteralCode;
+    HuffmanCode fixedDistanceCode;
+    HuffmanCode literalCode;
+    HuffmanCode distanceCode;
+
+    bool ReadBits(
+        _In_ ULONG count,
+        _Out_ ULONG* value);
+
+    bool Decode(
+        _In_ const HuffmanCode* code,
+        _Out_ ULONG* symbol);
+
+    static int BuildCode(
+        _Out_ HuffmanCode* code,
+        _In_reads_(count) const BYTE* lengths,
+        _In_ ULONG count);
+
+    HRESULT ReadDynamicCodes();
+
+    HRESULT InflateStored(
+        _Out_writes_bytes_to_(outputLength, *outputPosition) BYTE* output,
+        _In_ ULONG outputLength,
+        _Inout_ ULONG* outputPosition);
+
+    HRESULT InflateCodes(
+        _In_ const HuffmanCode* lengthCode,
+        _In_ const HuffmanCode* offsetCode,
+        _Out_writes_bytes_to_(outputLength, *outputPosition) BYTE* output,
+        _In_ ULONG outputLength,
+        _Inout_ ULONG* outputPosition);
+
+public:
+    DeflateDecompressor();
+
+    ~DeflateDecompressor();
+
+    HRESULT Initialize();
+
+    // Forgets all earlier messages.
+    void Reset();
+
+    // Decompresses a whole message. Fails with ERROR_INSUFFICIENT_BUFFER if the message inflates to more than
+    // outputLength bytes, which is how a receiver limits the size of the messages it accepts.
+    HRESULT Decompress(
+        _In_reads_bytes_(dataLength) const BYTE* data,
+        _In_ ULONG dataLength,
+        _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+        _In_ ULONG outputLength,
+        _Out_ ULONG* bytesWritten);
+};
+
+// permessage-deflate for one endpoint of a connection: a compressor for the messages it sends and a
+// decompressor for the messages it receives, set up from the negotiated parameters.
+//
+// Frames of a compressed message carry RSV1 on the first frame (see FrameCodec). A fragmented message has to
+// be reassembled before it is decompressed, and a text message has to be validated as UTF-8 afterwards.
+class PerMessageDeflate
+{
+private:
+    DeflateCompressor compressor;
+    DeflateDecompressor decompressor;
+    bool resetCompressor;
+    bool resetDecompressor;
+
+public:
+    PerMessageDeflate();
+
+    // Finds the first permessage-deflate entry in a Sec-WebSocket-Extensions value that this implementation
+    // accepts. A server parses the client's offer, a client parses the server's response. Returns S_FALSE if
+    // there is none.
+    static HRESULT ParseExtension(
+        _In_reads_(headerLength) const char* header,
+        _In_ ULONG headerLength,
+        _In_ bool isResponse,
+        _Out_ PerMessageDeflateParameters* parameters);
+
+    // Writes the server's response to an accepted offer.
+    static HRESULT FormatResponse(
+        _In_ const PerMessageDeflateParameters* parameters,
+        _Out_writes_to_(responseLength, *bytesWritten) char* response,
+        _In_ ULONG responseLength,
+        _Out_ ULONG* bytesWritten);
+
+    HRESULT Initialize(
+        _In_ bool isServer,
+        _In_ const PerMessageDeflateParameters* parameters);
+
+    HRESULT CompressMessage(
+        _In_reads_bytes_(dataLength) const BYTE* data,
+        _In_ ULONG dataLength,
+        _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+        _In_ ULONG outputLength,
+        _Out_ ULONG* bytesWritten);
+
+    HRESULT DecompressMessage(
+        _In_reads_bytes_(dataLength) const BYTE* data,
+        _In_ ULONG dataLength,
+        _Out_writes_bytes_to_(outputLength, *bytesWritten) BYTE* output,
+        _In_ ULONG outputLength,
+        _Out_ ULONG* bytesWritten);
+};
@@ -0,0 +1,120 @@
+#include <Windows.h>
+#include <Assert.h>
+#include "RingBuffer.h"
+#include <new>
+
+RingBuffer::RingBuffer()
+{
+    this->buffer = NULL;
+    this->capacity = 0;
+    this->mask = 0;
+    this->readIndex = 0;
+    this->writeIndex = 0;
+}
+
+RingBuffer::~RingBuffer()
+{
+    if (this->buffer != NULL)
+    {
+        delete[] this->buffer;
+        this->buffer = NULL;
+    }
+}
+
+HRESULT RingBuffer::Initialize(
+    _In_ ULONG capacity)
+{
+    assert(this->buffer == NULL);
+
+    if (capacity == 0 || capacity > 0x80000000)
+    {
+        return E_INVALIDARG;
+    }
+
+    // A power of two capacity turns the wrap around into a mask.
+    ULONG roundedCapacity = 1;
+    while (roundedCapacity < capacity)
+    {
+        roundedCapacity <<= 1;
+    }
+
+    this->buffer = new(std::nothrow) BYTE[roundedCapacity];
+    if (this->buffer == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    this->capacity = roundedCapacity;
+    this->mask = roundedCapacity - 1;
+    this->readIndex = 0;
+    this->writeIndex = 0;
+
+    return S_OK;
+}
+
+ULONG RingBuffer::GetWriteSpans(
+    _Out_writes_(2) RingBufferSpan* spans)
+{
+    ULONG write = this->writeIndex;
+    ULONG read = this->readIndex;
+
+    // Make sure the consumer is done with the memory before the producer reuses it.
+    MemoryBarrier();
+
+    ULONG freeBytes = this->capacity - (write - read);
+    ULONG offset = write & this->mask;
+    ULONG firstLength = __min(freeBytes, this->capacity - offset);
+
+    spans[0].data = this->buffer + offset;
+    spans[0].length = firstLength;
+    spans[1].data = this->buffer;
+    spans[1].length = freeBytes - firstLength;
+
+    return freeBytes;
+}
+
+void RingBuffer::CommitWrite(
+    _In_ ULONG bytesWritten)
+{
+    assert(bytesWritten <= this->capacity - (this->writeIndex - this->readIndex));
+
+    // Publish the data before the consumer can see the new write index.
+    MemoryBarrier();
+    this->writeIndex = this->writeIndex + bytesWritten;
+}
+
+ULONG RingBuffer::GetReadSpans(
+    _Out_writes_(2) RingBufferSpan* spans)
+{
+    ULONG read = this->readIndex;
+    ULONG write = this->writeIndex;
+
+    // Make sure the data written by the producer is visible before it is read.
+    MemoryBarrier();
+
+    ULONG usedBytes = write - read;
+    ULONG offset = read & this->mask;
+    ULONG firstLength = __min(usedBytes, this->capacity - offset);
+
+    spans[0].data = this->buffer + offset;
+    spans[0].length = firstLength;
+    spans[1].data = this->buffer;
+    spans[1].length = usedBytes - firstLength;
+
+    return usedBytes;
+}
+
+void RingBuffer::CommitRead(
+    _In_ ULONG bytesRead)
+{
+    assert(bytesRead <= this->writeIndex - this->readIndex);
+
+    // Finish reading the data before the producer can overwrite it.
+    MemoryBarrier();
+    this->readIndex = this->readIndex + bytesRead;
+}
+
+ULONG RingBuffer::GetCapacity() const
+{
+    return this->capacity;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+// Contiguous piece of the ring buffer memory. A read or write may wrap around the end of the buffer,
+// so it is described by at most two spans.
+struct RingBufferSpan
+{
+    BYTE* data;
+    ULONG length;
+};
+
+// Fixed-capacity byte ring buffer for a single producer and a single consumer.
+// The producer only moves the write index and the consumer only moves the read index, so the two sides
+// never need a lock. Data is written and read in place through spans, so a buffer that wraps around the
+// end of the ring is copied in two pieces instead of going through a temporary buffer.
+class RingBuffer
+{
+private:
+    BYTE* buffer;
+    ULONG capacity;
+    ULONG mask;
+
+    // Both indexes only ever grow and wrap around at 2^32. Their difference is the number of buffered bytes.
+    volatile ULONG readIndex;
+    volatile ULONG writeIndex;
+
+public:
+    RingBuffer();
+
+    ~RingBuffer();
+
+    // The capacity is rounded up to a power of two.
+    HRESULT Initialize(
+        _In_ ULONG capacity);
+
+    // Producer side.
+    ULONG GetWriteSpans(
+        _Out_writes_(2) RingBufferSpan* spans);
+
+    void CommitWrite(
+        _In_ ULONG bytesWritten);
+
+    // Consumer side.
+    ULONG GetReadSpans(
+        _Out_writes_(2) RingBufferSpan* spans);
+
+    void CommitRead(
+        _In_ ULONG bytesRead);
+
+    ULONG GetCapacity() const;
+};
@@ -2,71 +2,47 @@
 #include <Assert.h>
 #include <stdlib.h>
 #include "Transport.h"
-#include <new>
 
 Transport::Transport()
 {
-    InitializeCriticalSection(&this->lock);
 }
 
 Transport::~Transport()
 {
-    DeleteCriticalSection(&this->lock);
+}
+
+HRESULT Transport::Initialize(
+    _In_ ULONG capacity)
+{
+    return this->ring.Initialize(capacity);
 }
 
 HRESULT Transport::WriteData(
     _In_reads_bytes_opt_(dataLength) BYTE* data,
     _In_ ULONG dataLength)
 {
-    HRESULT hr = S_OK;
-    ListEntry* entry = NULL;
-    BYTE* buffer = NULL;
+    RingBufferSpan spans[2];
 
     if (data == NULL)
     {
-        goto quit;
+        return S_OK;
     }
 
-    entry = new(std::nothrow) ListEntry();
-    if (entry == NULL)
+    // Data is never partially written - the peer would not be able to tell where the buffer ended.
+    ULONG freeBytes = this->ring.GetWriteSpans(spans);
+    if (freeBytes < dataLength)
     {
-        hr = E_OUTOFMEMORY;
-        goto quit;
-    }
-
-    buffer = new(std::nothrow) BYTE[dataLength];
-    if (buffer == NULL)
-    {
-        hr = E_OUTOFMEMORY;
-        goto quit;
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
     }
 
     // Copy application buffer to the transport buffer.
-    CopyMemory(buffer, data, dataLength);
-    entry->Attach(dataLength, buffer);
-    buffer = NULL;
-
-    // Add the entry to the list.
-    EnterCriticalSection(&this->lock);
-    list.AppendTail(entry);
-    entry = NULL;
-    LeaveCriticalSection(&this->lock);
-
-quit:
-
-    if (entry != NULL)
-    {
-        delete entry;
-        entry = NULL;
-    }
+    ULONG firstLength = __min(dataLength, spans[0].length);
+    CopyMemory(spans[0].data, data, firstLength);
+    CopyMemory(spans[1].data, data + firstLength, dataLength - firstLength);
 
-    if (buffer != NULL)
-    {
-        delete[] buffer;
-        buffer = NULL;
-    }
+    this->ring.CommitWrite(dataLength);
 
-    return hr;
+    return S_OK;
 }
 
 HRESULT Transport::ReadData(
@@ -74,36 +50,26 @@ HRESULT Transport::ReadData(
     _Inout_ ULONG* outputDataLength,
     _Inout_updates_bytes_to_opt_(dataLength, *outputDataLength) BYTE* data)
 {
+    RingBufferSpan spans[2];
     *outputDataLength = 0;
-    ULONG index = 0;
 
     if (data == NULL)
     {
         return E_FAIL;
     }
 
-    EnterCriticalSection(&this->lock);
-
     // Read as much data as possible from the transport.
-    while (index < dataLength && !this->list.IsEmpty())
-    {
-        ListEntry* first = list.Peek();
+    ULONG usedBytes = this->ring.GetReadSpans(spans);
+    ULONG bytesToRead = __min(dataLength, usedBytes);
 
-        // Copy data from the transport buffer to the application buffer.
-        ULONG copiedBytes = 0;
-        first->CopyTo(data + index, dataLength - index, &copiedBytes);
-        index += copiedBytes;
-
-        // Remove the entry if there are not more data to process.
-        if (first->DataLeft() == 0)
-        {
-            list.RemoveHead();
-        }
-    }
+    // Copy data from the transport buffer to the application buffer.
+    ULONG firstLength = __min(bytesToRead, spans[0].length);
+    CopyMemory(data, spans[0].data, firstLength);
+    CopyMemory(data + firstLength, spans[1].data, bytesToRead - firstLength);
 
-    LeaveCriticalSection(&this->lock);
+    this->ring.CommitRead(bytesToRead);
 
-    *outputDataLength = index;
+    *outputDataLength = bytesToRead;
     assert(*outputDataLength != 0);
     return S_OK;
 }
@@ -1,21 +1,29 @@
 #pragma once
 
-#include "List.h"
+#include "RingBuffer.h"
+
+// Default amount of data that can be in flight between the peers.
+#define TRANSPORT_DEFAULT_CAPACITY (1024 * 1024)
 
 // Abstract transport that allows writing and reading data. The goal here was to simplify sample's code,
 // so it does not have to take into the account all complications associated with using sockets or pipes.
 // However, it should be straightforward to replace this abstract transport with a concrete one list sockets/pipes/etc.
+//
+// Data is kept in a preallocated ring buffer, so writing and reading does not allocate memory. One peer writes
+// and the other one reads, which lets the ring buffer work without a lock.
 class Transport
 {
 private:
-    CRITICAL_SECTION lock;
-    List list;
+    RingBuffer ring;
 
 public:
     Transport();
 
     ~Transport();
 
+    HRESULT Initialize(
+        _In_ ULONG capacity);
+
     HRESULT WriteData(
         _In_reads_bytes_opt_(dataLength) BYTE* data,
         _In_ ULONG dataLength);
@@ -23,11 +23,14 @@
 // CMediaSample                Basic transport unit for IMemInputPin
 // CBaseAllocator              General list guff for most allocators
 //    CMemAllocator            Implements memory buffer allocation
+//       CPooledMemAllocator   Takes its buffers from CMemBufferPool
+// CMemBufferPool              Process wide pool of sample buffers
 //
 //=====================================================================
 //=====================================================================
 
 #include <streams.h>
+#include <malloc.h>
 #include <strsafe.h>
 
 #ifdef DXMPERF
@@ -5274,6 +5277,323 @@ CMemAllocator::~CMemAllocator()
     ReallyFree();
 }
 
+//=====================================================================
+//=====================================================================
+// Implements CMemBufferPool
+//=====================================================================
+//=====================================================================
+
+CMemBufferPool CMemBufferPool::m_Pool;
+
+CMemBufferPool::CMemBufferPool() :
+    m_llMaxPooledBytes(256 * 1024 * 1024)
+{
+    ZeroMemory(m_apFree, sizeof(m_apFree));
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+}
+
+CMemBufferPool::~CMemBufferPool()
+{
+    Trim();
+}
+
+// Size classes go 64, 80, 96, 112, 128, 160, 192, 224, 256, 320 ... so
+// that each power of 2 is split in four. The class index counts them.
+int
+CMemBufferPool::GetSizeClass(LONG lSize, __out LONG *plClassSize)
+{
+    ASSERT(lSize > 0);
+
+    DWORD dwSize = (DWORD)lSize;
+    if (dwSize < (1 << SMALLEST_CLASS_SHIFT)) {
+        dwSize = 1 << SMALLEST_CLASS_SHIFT;
+    }
+
+    // find the highest bit of dwSize - 1 and round up in quarter steps
+    int iShift = 0;
+    while ((DWORD)2 << iShift <= dwSize - 1) {
+        iShift++;
+    }
+    DWORD dwStep = iShift >= SMALLEST_CLASS_SHIFT ? (DWORD)1 << (iShift - 2) : 16;
+    DWORD dwClassSize = (dwSize + dwStep - 1) & ~(dwStep - 1);
+
+    // the rounding may have carried into the next power of 2
+    int iClassShift = iShift;
+    if (dwClassSize >= (DWORD)2 << iShift) {
+        iClassShift++;
+    }
+    int iQuarter = (int)(dwClassSize >> (iClassShift - 2)) & 3;
+
+    *plClassSize = (LONG)dwClassSize;
+    return (iClassShift - SMALLEST_CLASS_SHIFT) * 4 + iQuarter;
+}
+
+void
+CMemBufferPool::DeleteBuffer(__in LPBYTE pBuffer, LONG lClassSize)
+{
+    if (lClassSize >= LARGE_BUFFER_SIZE) {
+        EXECUTE_ASSERT(VirtualFree(pBuffer, 0, MEM_RELEASE));
+    } else {
+        _aligned_free(pBuffer);
+    }
+}
+
+LPBYTE
+CMemBufferPool::Allocate(LONG lSize, LONG lAlignment)
+{
+    if (lSize <= 0 || lAlignment <= 0) {
+        return NULL;
+    }
+
+    LONG lClassSize;
+    int iClass = GetSizeClass(lSize, &lClassSize);
+    if (lClassSize < lSize) {
+        // lSize was too close to 2GB to round up
+        return NULL;
+    }
+
+    {
+        CAutoLock lck(&m_Lock);
+
+        // take the first free buffer with the right alignment, normally
+        // the first one since a class is mostly used with one alignment
+        for (FREEBUFFER **ppSearch = &m_apFree[iClass];
+             *ppSearch != NULL;
+             ppSearch = &(*ppSearch)->pNext) {
+
+            if (((DWORD_PTR)*ppSearch & (lAlignment - 1)) == 0) {
+                LPBYTE pBuffer = (LPBYTE)*ppSearch;
+                *ppSearch = (*ppSearch)->pNext;
+                m_Stats.llReusedAllocations++;
+                m_Stats.llPooledBuffers--;
+                m_Stats.llPooledBytes -= lClassSize;
+                return pBuffer;
+            }
+        }
+        m_Stats.llFreshAllocations++;
+    }
+
+    // VirtualAlloc returns memory aligned to the allocation granularity,
+    // which SetProperties already checks cbAlign against
+    if (lClassSize >= LARGE_BUFFER_SIZE) {
+        return (LPBYTE)VirtualAlloc(NULL, lClassSize, MEM_COMMIT, PAGE_READWRITE);
+    }
+    return (LPBYTE)_aligned_malloc(lClassSize, max(lAlignment, 1 << SMALLEST_CLASS_SHIFT));
+}
+
+void
+CMemBufferPool::Release(__in LPBYTE pBuffer, LONG lSize)
+{
+    LONG lClassSize;
+    int iClass = GetSizeClass(lSize, &lClassSize);
+
+    {
+        CAutoLock lck(&m_Lock);
+        if (m_Stats.llPooledBytes + lClassSize <= m_llMaxPooledBytes) {
+            FREEBUFFER *pFree = (FREEBUFFER *)pBuffer;
+            pFree->pNext = m_apFree[iClass];
+            m_apFree[iClass] = pFree;
+            m_Stats.llPooledBuffers++;
+            m_Stats.llPooledBytes += lClassSize;
+            return;
+        }
+        m_Stats.llFreedBuffers++;
+    }
+
+    DeleteBuffer(pBuffer, lClassSize);
+}
+
+void
+CMemBufferPool::Trim()
+{
+    CAutoLock lck(&m_Lock);
+
+    for (int iClass = 0; iClass < CLASS_COUNT; iClass++) {
+
+        // the size of any member of the class gives its class size
+        LONG lClassSize = 0;
+        while (m_apFree[iClass] != NULL) {
+            FREEBUFFER *pFree = m_apFree[iClass];
+            m_apFree[iClass] = pFree->pNext;
+
+            if (lClassSize == 0) {
+                int iQuarter = iClass & 3;
+                int iShift = iClass / 4 + SMALLEST_CLASS_SHIFT;
+                lClassSize = (LONG)(((DWORD)4 + iQuarter) << (iShift - 2));
+            }
+            DeleteBuffer((LPBYTE)pFree, lClassSize);
+
+            m_Stats.llFreedBuffers++;
+            m_Stats.llPooledBuffers--;
+            m_Stats.llPooledBytes -= lClassSize;
+        }
+    }
+    ASSERT(m_Stats.llPooledBytes == 0);
+}
+
+void
+CMemBufferPool::SetLimit(LONGLONG llMaxPooledBytes)
+{
+    {
+        CAutoLock lck(&m_Lock);
+        m_llMaxPooledBytes = llMaxPooledBytes;
+        if (m_Stats.llPooledBytes <= llMaxPooledBytes) {
+            return;
+        }
+    }
+    Trim();
+}
+
+void
+CMemBufferPool::GetStatistics(__out MEM_POOL_STATS *pStats)
+{
+    ASSERT(pStats != NULL);
+    CAutoLock lck(&m_Lock);
+    *pStats = m_Stats;
+}
+
+//=====================================================================
+//=====================================================================
+// Implements CPooledMemAllocator
+//=====================================================================
+//=====================================================================
+
+/* This goes in the factory template table to create new instances */
+CUnknown *CPooledMemAllocator::CreateInstance(__inout_opt LPUNKNOWN pUnk, __inout HRESULT *phr)
+{
+    CUnknown *pUnkRet = new CPooledMemAllocator(NAME("CPooledMemAllocator"), pUnk, phr);
+    return pUnkRet;
+}
+
+CPooledMemAllocator::CPooledMemAllocator(
+    __in_opt LPCTSTR pName,
+    __inout_opt LPUNKNOWN pUnk,
+    __inout HRESULT *phr)
+    : CMemAllocator(pName, pUnk, phr),
+    m_lBufferSize(0)
+{
+}
+
+#ifdef UNICODE
+CPooledMemAllocator::CPooledMemAllocator(
+    __in_opt LPCSTR pName,
+    __inout_opt LPUNKNOWN pUnk,
+    __inout HRESULT *phr)
+    : CMemAllocator(pName, pUnk, phr),
+    m_lBufferSize(0)
+{
+}
+#endif
+
+// Called when Commit needs samples. Unlike CMemAllocator we have always
+// given everything back to the pool in Free, so the samples are created
+// every time - taking the memory from the pool is what makes this cheap.
+//
+// object locked by caller
+HRESULT
+CPooledMemAllocator::Alloc(void)
+{
+    CAutoLock lck(this);
+
+    /* Check he has called SetProperties */
+    HRESULT hr = CBaseAllocator::Alloc();
+    if (FAILED(hr)) {
+        return hr;
+    }
+    ASSERT(m_lAllocated == 0 && m_pBuffer == NULL);
+
+    /* Make sure we've got reasonable values */
+    if ( m_lSize < 0 || m_lPrefix < 0 || m_lCount < 0 ) {
+        return E_OUTOFMEMORY;
+    }
+
+    /* Compute the aligned size */
+    LONG lAlignedSize = m_lSize + m_lPrefix;
+
+    /*  Check overflow */
+    if (lAlignedSize < m_lSize) {
+        return E_OUTOFMEMORY;
+    }
+
+    if (m_lAlignment > 1) {
+        LONG lRemainder = lAlignedSize % m_lAlignment;
+        if (lRemainder != 0) {
+            LONG lNewSize = lAlignedSize + m_lAlignment - lRemainder;
+            if (lNewSize < lAlignedSize) {
+                return E_OUTOFMEMORY;
+            }
+            lAlignedSize = lNewSize;
+        }
+    }
+    m_lBufferSize = lAlignedSize;
+
+    CMemBufferPool *pPool = CMemBufferPool::GetPool();
+
+    for (; m_lAllocated < m_lCount; m_lAllocated++) {
+        LPBYTE pBuffer = pPool->Allocate(lAlignedSize, m_lAlignment);
+        if (pBuffer == NULL) {
+            Free();
+            return E_OUTOFMEMORY;
+        }
+
+        // As in CMemAllocator, GetPointer() returns the memory after the
+        // prefix
+        CMediaSample *pSample = new CMediaSample(
+                            NAME("Pooled memory media sample"),
+                            this,
+                            &hr,
+                            pBuffer + m_lPrefix,    // GetPointer() value
+                            m_lSize);               // not including prefix
+
+        ASSERT(SUCCEEDED(hr));
+        if (pSample == NULL) {
+            pPool->Release(pBuffer, lAlignedSize);
+            Free();
+            return E_OUTOFMEMORY;
+        }
+
+        // This CANNOT fail
+        m_lFree.Add(pSample);
+    }
+
+    m_bChanged = FALSE;
+    return NOERROR;
+}
+
+// called from the base class on Decommit when all buffers have been
+// returned to the free list, and from Alloc if it fails half way.
+//
+// caller has already locked the object.
+void
+CPooledMemAllocator::Free(void)
+{
+    ASSERT(m_lAllocated == m_lFree.GetCount());
+
+    CMemBufferPool *pPool = CMemBufferPool::GetPool();
+
+    CMediaSample *pSample;
+    for (;;) {
+        pSample = m_lFree.RemoveHead();
+        if (pSample == NULL) {
+            break;
+        }
+
+        BYTE *pData;
+        EXECUTE_ASSERT(SUCCEEDED(pSample->GetPointer(&pData)));
+        pPool->Release(pData - m_lPrefix, m_lBufferSize);
+        delete pSample;
+    }
+
+    m_lAllocated = 0;
+}
+
+/* Destructor gives our buffers back before CMemAllocator looks for its own */
+
+CPooledMemAllocator::~CPooledMemAllocator()
+{
+    Decommit();
+}
+
 // ------------------------------------------------------------------------
 // filter registration through IFilterMapper. used if IFilterMapper is
 // not found (Quartz 1.0 install)
@@ -23,6 +23,8 @@ class CBaseInputPin;        // Implements IMemInputPin interface
 class CMediaSample;         // Basic transport unit for IMemInputPin
 class CBaseAllocator;       // General list guff for most allocators
 class CMemAllocator;        // Implements memory buffer allocation
+class CMemBufferPool;       // Process wide pool of sample buffers
+class CPooledMemAllocator;  // Memory allocator using the buffer pool
 
 
 //=====================================================================
@@ -1567,6 +1569,114 @@ public:
     ~CMemAllocator();
 };
 
+
+//=====================================================================
+//=====================================================================
+// Defines CMemBufferPool
+//
+// A process wide pool of sample buffers, used by CPooledMemAllocator.
+// Buffers are rounded up to a size class (four classes per power of 2,
+// so at most 25% is wasted) and kept on a free list per class when they
+// are released, so the next allocator that needs the same sizes gets
+// memory that is already committed and paged in. Buffers below 64K come
+// from the heap aligned to a cache line, larger ones from VirtualAlloc.
+// Every buffer is also aligned to the cbAlign it was requested with.
+//
+// Pooled memory is bounded by a limit, buffers released above it are
+// freed straight away.
+//=====================================================================
+//=====================================================================
+
+typedef struct tagMEM_POOL_STATS {
+    LONGLONG llFreshAllocations;    // buffers allocated from the system
+    LONGLONG llReusedAllocations;   // buffers taken from the pool
+    LONGLONG llFreedBuffers;        // buffers given back to the system
+    LONGLONG llPooledBuffers;       // buffers in the pool now
+    LONGLONG llPooledBytes;         // bytes in the pool now
+} MEM_POOL_STATS;
+
+class CMemBufferPool
+{
+public:
+    // the process wide pool
+    static CMemBufferPool *GetPool() { return &m_Pool; }
+
+    // allocate a buffer of at least lSize bytes aligned to lAlignment
+    // (a power of 2), which must be released with the same lSize
+    LPBYTE Allocate(LONG lSize, LONG lAlignment);
+    void Release(__in LPBYTE pBuffer, LONG lSize);
+
+    // free all pooled buffers and set how many bytes may be pooled
+    void Trim();
+    void SetLimit(LONGLONG llMaxPooledBytes);
+
+    void GetStatistics(__out MEM_POOL_STATS *pStats);
+
+private:
+    CMemBufferPool();
+    ~CMemBufferPool();
+
+    enum {
+        SMALLEST_CLASS_SHIFT = 6,               // 64 bytes, one cache line
+        LARGE_BUFFER_SIZE = 64 * 1024,          // VirtualAlloc from here up
+        CLASS_COUNT = (31 - SMALLEST_CLASS_SHIFT + 1) * 4
+    };
+
+    // round lSize up to its size class, returns the class index
+    static int GetSizeClass(LONG lSize, __out LONG *plClassSize);
+
+    static void DeleteBuffer(__in LPBYTE pBuffer, LONG lClassSize);
+
+    // free buffers are chained through their first bytes
+    typedef struct tagFREEBUFFER {
+        struct tagFREEBUFFER *pNext;
+    } FREEBUFFER;
+
+    static CMemBufferPool m_Pool;
+
+    CCritSec m_Lock;
+    FREEBUFFER *m_apFree[CLASS_COUNT];
+    LONGLONG m_llMaxPooledBytes;
+    MEM_POOL_STATS m_Stats;
+};
+
+
+//=====================================================================
+//=====================================================================
+// Defines CPooledMemAllocator
+//
+// A CMemAllocator that takes its sample buffers from CMemBufferPool
+// instead of one contiguous VirtualAlloc block. The buffers go back to
+// the pool when a decommit completes, so graphs that are rebuilt or
+// renegotiate over and over reuse the same memory instead of
+// allocating, committing and faulting it in every time.
+//
+// To use it, create it in your output pin's InitAllocator (or
+// DecideAllocator) instead of calling CreateMemoryAllocator.
+//=====================================================================
+//=====================================================================
+
+class CPooledMemAllocator : public CMemAllocator
+{
+protected:
+    LONG m_lBufferSize;     // size each buffer was taken from the pool with
+
+    // give the buffers back to the pool when decommit completes
+    void Free(void);
+
+    // take the buffers from the pool when commit called
+    HRESULT Alloc(void);
+
+public:
+    static CUnknown *CreateInstance(__inout_opt LPUNKNOWN, __inout HRESULT *);
+
+    CPooledMemAllocator(__in_opt LPCTSTR , __inout_opt LPUNKNOWN, __inout HRESULT *);
+#ifdef UNICODE
+    CPooledMemAllocator(__in_opt LPCSTR , __inout_opt LPUNKNOWN, __inout HRESULT *);
+#endif
+    ~CPooledMemAllocator();
+};
+
 // helper used by IAMovieSetup implementation
 STDAPI
 AMovieSetupRegisterFilter( const AMOVIESETUP_FILTER * const psetupdata
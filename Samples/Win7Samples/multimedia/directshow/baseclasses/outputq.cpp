@@ -799,3 +799,627 @@ void COutputQueue::SetPopEvent(HANDLE hEvent)
 {
     m_hEventPop = hEvent;
 }
+
+
+//
+//  CBatchedOutputQueue Constructor :
+//
+//  Always creates a thread, there is no direct mode
+//
+//     pInputPin    - the downstream input pin we're queueing samples to
+//
+//     phr          - changed to a failure code if this function fails
+//                    (otherwise unchanges)
+//
+//     lBatchSize   - largest number of samples passed to ReceiveMultiple
+//
+//     dwMaxLatency - longest time in ms a sample waits for its batch to
+//                    fill up before the batch is sent anyway
+//
+//     lRingSize    - number of samples that can be queued before the
+//                    producer blocks
+//
+//     dwPriority   - set the thread's priority to this
+//
+CBatchedOutputQueue::CBatchedOutputQueue(
+             IPin         *pInputPin,          //  Pin to send stuff to
+             __inout HRESULT      *phr,        //  'Return code'
+             LONG          lBatchSize,         //  Largest batch
+             DWORD         dwMaxLatency,       //  Longest wait for a batch
+             LONG          lRingSize,          //  Ring capacity
+             DWORD         dwPriority,
+             bool          bFlushingOpt        // flushing optimization
+            ) : m_pPin(pInputPin),
+                m_pInputPin(NULL),
+                m_lBatchSize(lBatchSize),
+                m_dwMaxLatency(dwMaxLatency),
+                m_ppRing(NULL),
+                m_lRingMask(0),
+                m_lHead(0),
+                m_lTail(0),
+                m_lWaiting(0),
+                m_lSpaceWaiting(0),
+                m_hWork(NULL),
+                m_hSpace(NULL),
+                m_hThread(NULL),
+                m_evFlushComplete(FALSE, phr),
+                m_evResetComplete(FALSE, phr),
+                m_ppSamples(NULL),
+                m_nBatched(0),
+                m_lTargetBatch(lBatchSize),
+                m_dwFirstBatched(0),
+                m_bFlushing(FALSE),
+                m_lFlushRequest(0),
+                m_lFlushDone(0),
+                m_bFlushed(TRUE),
+                m_bFlushingOpt(bFlushingOpt),
+                m_bTerminate(FALSE),
+                m_hr(S_OK),
+                m_hEventPop(NULL),
+                m_llSamples(0),
+                m_llBatches(0),
+                m_lWakeups(0)
+{
+    ASSERT(m_lBatchSize > 0);
+
+    if (FAILED(*phr)) {
+        return;
+    }
+
+    //  A NEW_SEGMENT takes two entries so the ring needs at least that
+
+    if (m_lBatchSize <= 0 || lRingSize < 2 || lRingSize > 0x10000) {
+        *phr = E_INVALIDARG;
+        return;
+    }
+    LONG lSize = 2;
+    while (lSize < lRingSize) {
+        lSize *= 2;
+    }
+    m_lRingMask = lSize - 1;
+
+    //  Check the input pin is OK and cache its IMemInputPin interface
+
+    *phr = pInputPin->QueryInterface(IID_IMemInputPin, (void **)&m_pInputPin);
+    if (FAILED(*phr)) {
+        return;
+    }
+
+    m_ppSamples = new PMEDIASAMPLE[m_lBatchSize];
+    m_ppRing = new PMEDIASAMPLE[lSize];
+    if (m_ppSamples == NULL || m_ppRing == NULL) {
+        *phr = E_OUTOFMEMORY;
+        return;
+    }
+
+    m_hWork = CreateEvent(NULL, FALSE, FALSE, NULL);
+    m_hSpace = CreateEvent(NULL, FALSE, FALSE, NULL);
+    if (m_hWork == NULL || m_hSpace == NULL) {
+        DWORD dwError = GetLastError();
+        *phr = AmHresultFromWin32(dwError);
+        return;
+    }
+
+    DbgLog((LOG_TRACE, 2, TEXT("Creating batched queue thread for output pin")));
+    DWORD dwThreadId;
+    m_hThread = CreateThread(NULL,
+                             0,
+                             InitialThreadProc,
+                             (LPVOID)this,
+                             0,
+                             &dwThreadId);
+    if (m_hThread == NULL) {
+        DWORD dwError = GetLastError();
+        *phr = AmHresultFromWin32(dwError);
+        return;
+    }
+    SetThreadPriority(m_hThread, dwPriority);
+}
+
+//
+//  CBatchedOutputQueue Destructor :
+//
+//  Stop the thread, which frees the queued and batched samples
+//
+CBatchedOutputQueue::~CBatchedOutputQueue()
+{
+    DbgLog((LOG_TRACE, 3, TEXT("CBatchedOutputQueue::~CBatchedOutputQueue")));
+    if (m_hThread != NULL) {
+        m_hr = S_FALSE;
+        InterlockedExchange((LONG volatile *)&m_bTerminate, TRUE);
+        NotifyThread();
+        DbgWaitForSingleObject(m_hThread);
+        EXECUTE_ASSERT(CloseHandle(m_hThread));
+        ASSERT(m_lHead == m_lTail);
+    }
+    if (m_pInputPin != NULL) {
+        m_pInputPin->Release();
+    }
+    if (m_hWork != NULL) {
+        EXECUTE_ASSERT(CloseHandle(m_hWork));
+    }
+    if (m_hSpace != NULL) {
+        EXECUTE_ASSERT(CloseHandle(m_hSpace));
+    }
+    delete [] m_ppRing;
+    delete [] m_ppSamples;
+}
+
+//
+//  Call the real thread proc as a member function
+//
+DWORD WINAPI CBatchedOutputQueue::InitialThreadProc(__in LPVOID pv)
+{
+    HRESULT hrCoInit = CAMThread::CoInitializeHelper();
+
+    CBatchedOutputQueue *pSampleQueue = (CBatchedOutputQueue *)pv;
+    DWORD dwReturn = pSampleQueue->ThreadProc();
+
+    if(hrCoInit == S_OK) {
+        CoUninitialize();
+    }
+
+    return dwReturn;
+}
+
+//
+//  Thread sending the samples downstream :
+//
+//  Takes everything that is in the ring in one go, up to the current
+//  batch target.  Control packets end the batch, as in COutputQueue.
+//  When the ring is empty and the batch isn't full the thread sleeps
+//  until more samples arrive or the oldest batched sample has waited
+//  m_dwMaxLatency.
+//
+DWORD CBatchedOutputQueue::ThreadProc()
+{
+    while (TRUE) {
+        if (m_bTerminate) {
+            FreeSamples();
+            return 0;
+        }
+
+        //  Discard everything while flushing and acknowledge each request
+
+        LONG lFlushRequest = m_lFlushRequest;
+        if (m_bFlushing || lFlushRequest != m_lFlushDone) {
+            FreeSamples();
+            if (lFlushRequest != m_lFlushDone) {
+                InterlockedExchange(&m_lFlushDone, lFlushRequest);
+                SetEvent(m_evFlushComplete);
+            }
+            if (m_lHead == m_lTail) {
+                WaitForWork(INFINITE);
+            }
+            continue;
+        }
+
+        //  Take samples off the ring
+
+        LONG lHead = m_lHead;
+        LONG lTail = m_lTail;
+        IMediaSample *pControl = NULL;
+        NewSegmentPacket *ppacket = NULL;
+
+        while (lHead != lTail && m_nBatched < m_lTargetBatch) {
+            IMediaSample *pSample = m_ppRing[lHead & m_lRingMask];
+            lHead++;
+            if (IsSpecialSample(pSample)) {
+                pControl = pSample;
+                if (pSample == NEW_SEGMENT) {
+                    // the parameters were published together with NEW_SEGMENT
+                    ASSERT(lHead != lTail);
+                    ppacket = (NewSegmentPacket *)m_ppRing[lHead & m_lRingMask];
+                    lHead++;
+                }
+                break;
+            }
+            if (m_nBatched == 0) {
+                m_dwFirstBatched = timeGetTime();
+            }
+            m_ppSamples[m_nBatched++] = pSample;
+        }
+        BOOL bBacklog = (lHead != lTail);
+        if (lHead != m_lHead) {
+            AdvanceHead(lHead);
+        }
+
+        if (pControl != NULL) {
+
+            //  All control packets flush the batch first
+
+            SendBatch();
+
+            if (pControl == EOS_PACKET) {
+
+                //  Only pass end of stream on if everything went fine,
+                //  see COutputQueue::ThreadProc
+
+                if (m_hr == S_OK) {
+                    DbgLog((LOG_TRACE, 2, TEXT("CBatchedOutputQueue sending EndOfStream()")));
+                    HRESULT hr = m_pPin->EndOfStream();
+                    if (FAILED(hr)) {
+                        DbgLog((LOG_ERROR, 2, TEXT("CBatchedOutputQueue got code 0x%8.8X from EndOfStream()"), hr));
+                    }
+                }
+            } else if (pControl == RESET_PACKET) {
+                m_hr = S_OK;
+                SetEvent(m_evResetComplete);
+            } else if (pControl == NEW_SEGMENT) {
+                m_pPin->NewSegment(ppacket->tStart, ppacket->tStop, ppacket->dRate);
+                delete ppacket;
+            }
+            continue;
+        }
+
+        if (m_nBatched >= m_lTargetBatch) {
+
+            //  Samples are arriving faster than we deliver them, so
+            //  bigger batches save calls downstream
+
+            if (bBacklog && m_lTargetBatch < m_lBatchSize) {
+                m_lTargetBatch = min(m_lTargetBatch * 2, m_lBatchSize);
+            }
+            SendBatch();
+            continue;
+        }
+
+        //  The ring is empty and the batch isn't full - wait for more
+        //  samples, but not beyond the latency limit
+
+        DWORD dwTimeout = INFINITE;
+        if (m_nBatched != 0) {
+            DWORD dwWaited = timeGetTime() - m_dwFirstBatched;
+            if (dwWaited >= m_dwMaxLatency) {
+
+                //  The stream is too slow to fill batches this big
+
+                if (m_lTargetBatch > 1) {
+                    m_lTargetBatch /= 2;
+                }
+                SendBatch();
+                continue;
+            }
+            dwTimeout = m_dwMaxLatency - dwWaited;
+        }
+        WaitForWork(dwTimeout);
+    }
+}
+
+//
+//  Deliver the current batch and release it
+//
+void CBatchedOutputQueue::SendBatch()
+{
+    if (m_nBatched == 0) {
+        return;
+    }
+
+    if (m_hr == S_OK) {
+        ASSERT(!m_bFlushed);
+        long nProcessed;
+        HRESULT hr = m_pInputPin->ReceiveMultiple(m_ppSamples,
+                                                  m_nBatched,
+                                                  &nProcessed);
+        /*  Don't overwrite a flushing state HRESULT */
+        InterlockedCompareExchange((LONG volatile *)&m_hr, hr, S_OK);
+        if (m_hr != S_OK) {
+            DbgLog((LOG_ERROR, 2, TEXT("ReceiveMultiple returned %8.8X"),
+                   m_hr));
+        }
+        m_llSamples += m_nBatched;
+        m_llBatches++;
+    }
+
+    while (m_nBatched != 0) {
+        m_ppSamples[--m_nBatched]->Release();
+    }
+}
+
+//
+//  Sleep until the producer or a control call notifies us.  m_lWaiting
+//  is set before the final check so a notification can't be missed.
+//
+void CBatchedOutputQueue::WaitForWork(DWORD dwTimeout)
+{
+    InterlockedExchange(&m_lWaiting, 1);
+    if (m_lHead != m_lTail ||
+        m_bTerminate ||
+        m_lFlushRequest != m_lFlushDone) {
+        InterlockedExchange(&m_lWaiting, 0);
+        return;
+    }
+    WaitForSingleObject(m_hWork, dwTimeout);
+    InterlockedExchange(&m_lWaiting, 0);
+}
+
+//
+//  Give taken entries back to the producer
+//
+void CBatchedOutputQueue::AdvanceHead(LONG lHead)
+{
+    InterlockedExchange(&m_lHead, lHead);
+    if (m_lSpaceWaiting && InterlockedExchange(&m_lSpaceWaiting, 0)) {
+        SetEvent(m_hSpace);
+    }
+    // inform derived class we took something off the queue
+    if (m_hEventPop) {
+        SetEvent(m_hEventPop);
+    }
+}
+
+//
+//  Wait until the ring has room for lSlots entries.  Returns FALSE if
+//  the queue started flushing or failed while waiting and bAbortOnError
+//  is set.
+//
+BOOL CBatchedOutputQueue::WaitForSpace(LONG lSlots, BOOL bAbortOnError)
+{
+    while (TRUE) {
+        if (m_lRingMask + 1 - (m_lTail - m_lHead) >= lSlots) {
+            return TRUE;
+        }
+        if (m_bTerminate || (bAbortOnError && m_hr != S_OK)) {
+            return FALSE;
+        }
+        InterlockedExchange(&m_lSpaceWaiting, 1);
+        if (m_lRingMask + 1 - (m_lTail - m_lHead) >= lSlots ||
+            m_bTerminate || (bAbortOnError && m_hr != S_OK)) {
+            InterlockedExchange(&m_lSpaceWaiting, 0);
+            continue;
+        }
+        WaitForSingleObject(m_hSpace, INFINITE);
+    }
+}
+
+//
+//  Queue one or two control packets.  Both are published at once so the
+//  thread always sees a NEW_SEGMENT together with its parameters.
+//
+BOOL CBatchedOutputQueue::QueuePackets(IMediaSample *pPacket1, IMediaSample *pPacket2)
+{
+    LONG lSlots = pPacket2 == NULL ? 1 : 2;
+    if (!WaitForSpace(lSlots, pPacket1 != RESET_PACKET)) {
+        return FALSE;
+    }
+
+    LONG lTail = m_lTail;
+    m_ppRing[lTail++ & m_lRingMask] = pPacket1;
+    if (pPacket2 != NULL) {
+        m_ppRing[lTail++ & m_lRingMask] = pPacket2;
+    }
+    InterlockedExchange(&m_lTail, lTail);
+    NotifyThread();
+    return TRUE;
+}
+
+//  Send batched stuff now
+void CBatchedOutputQueue::SendAnyway()
+{
+    QueuePackets(SEND_PACKET);
+}
+
+void
+CBatchedOutputQueue::NewSegment(
+    REFERENCE_TIME tStart,
+    REFERENCE_TIME tStop,
+    double dRate)
+{
+    if (m_hr == S_OK) {
+        NewSegmentPacket * ppack = new NewSegmentPacket;
+        if (ppack == NULL) {
+            return;
+        }
+        ppack->tStart = tStart;
+        ppack->tStop = tStop;
+        ppack->dRate = dRate;
+
+        if (!QueuePackets(NEW_SEGMENT, (IMediaSample*) ppack)) {
+            delete ppack;
+        }
+    }
+}
+
+//
+//  End of Stream is queued to output device
+//
+void CBatchedOutputQueue::EOS()
+{
+    if (m_hr == S_OK) {
+        m_bFlushed = FALSE;
+        QueuePackets(EOS_PACKET);
+    }
+}
+
+//
+//  Flush all the samples in the queue
+//
+void CBatchedOutputQueue::BeginFlush()
+{
+    // block receives -- we assume this is done by the
+    // filter in which we are a component
+
+    m_bFlushing = TRUE;
+
+    //  Make sure we discard all samples from now on
+
+    InterlockedCompareExchange((LONG volatile *)&m_hr, S_FALSE, S_OK);
+
+    //  Let a producer blocked on a full ring see the new state
+
+    if (InterlockedExchange(&m_lSpaceWaiting, 0)) {
+        SetEvent(m_hSpace);
+    }
+
+    // Optimize so we don't keep calling downstream all the time
+
+    if (m_bFlushed && m_bFlushingOpt) {
+        return;
+    }
+
+    InterlockedIncrement(&m_lFlushRequest);
+    NotifyThread();
+
+    // pass this downstream
+
+    m_pPin->BeginFlush();
+}
+
+//
+// leave flush mode - pass this downstream
+void CBatchedOutputQueue::EndFlush()
+{
+    ASSERT(m_bFlushing);
+    if (m_bFlushingOpt && m_bFlushed) {
+        m_bFlushing = FALSE;
+        m_hr = S_OK;
+        return;
+    }
+
+    //  Have the thread discard anything that was queued since BeginFlush
+    //  and wait until it has.  The caller has guaranteed no samples will
+    //  arrive before EndFlush() returns.
+
+    LONG lRequest = InterlockedIncrement(&m_lFlushRequest);
+    NotifyThread();
+    while (m_lFlushDone - lRequest < 0) {
+        m_evFlushComplete.Wait();
+    }
+
+    m_bFlushing = FALSE;
+    m_bFlushed  = TRUE;
+
+    // call EndFlush on downstream pins
+
+    m_pPin->EndFlush();
+
+    m_hr = S_OK;
+}
+
+//
+//  CBatchedOutputQueue::Receive()
+//
+//  On return the sample will have been Release()'d
+//
+HRESULT CBatchedOutputQueue::Receive(IMediaSample *pSample)
+{
+    LONG nProcessed;
+    return ReceiveMultiple(&pSample, 1, &nProcessed);
+}
+
+//
+//  CBatchedOutputQueue::ReceiveMultiple()
+//
+//  Copies the samples into the ring, as many at a time as there is room
+//  for, and publishes each run with a single interlocked operation.
+//
+//  On return all samples will have been Release()'d
+//
+HRESULT CBatchedOutputQueue::ReceiveMultiple (
+    __in_ecount(nSamples) IMediaSample **ppSamples,
+    long nSamples,
+    __out long *nSamplesProcessed)
+{
+    if (nSamples < 0) {
+        return E_INVALIDARG;
+    }
+
+    long iDone = 0;
+    if (m_hr == S_OK) {
+        m_bFlushed = FALSE;
+        while (iDone < nSamples && WaitForSpace(1, TRUE)) {
+            LONG lTail = m_lTail;
+            LONG lFree = m_lRingMask + 1 - (lTail - m_lHead);
+            while (lFree-- > 0 && iDone < nSamples) {
+                m_ppRing[lTail++ & m_lRingMask] = ppSamples[iDone++];
+            }
+            InterlockedExchange(&m_lTail, lTail);
+            NotifyThread();
+        }
+    }
+
+    *nSamplesProcessed = iDone;
+    if (iDone < nSamples) {
+        DbgLog((LOG_TRACE, 3, TEXT("CBatchedOutputQueue : Discarding %d samples code 0x%8.8X"),
+                nSamples - iDone, m_hr));
+
+        //  We're supposed to Release() them anyway!
+        for (long i = iDone; i < nSamples; i++) {
+            ppSamples[i]->Release();
+        }
+        return m_hr == S_OK ? S_FALSE : m_hr;
+    }
+    return S_OK;
+}
+
+//  Get ready for new data - cancels sticky m_hr
+void CBatchedOutputQueue::Reset()
+{
+    if (QueuePackets(RESET_PACKET)) {
+        m_evResetComplete.Wait();
+    }
+}
+
+//  Remove and Release() all queued and batched samples
+//
+//  Only called on the thread, so the ring can't be read concurrently
+void CBatchedOutputQueue::FreeSamples()
+{
+    LONG lHead = m_lHead;
+    LONG lTail = m_lTail;
+    while (lHead != lTail) {
+        IMediaSample *pSample = m_ppRing[lHead++ & m_lRingMask];
+        if (!IsSpecialSample(pSample)) {
+            pSample->Release();
+        } else if (pSample == NEW_SEGMENT) {
+            //  Free NEW_SEGMENT packet
+            ASSERT(lHead != lTail);
+            delete (NewSegmentPacket *)m_ppRing[lHead++ & m_lRingMask];
+        } else if (pSample == RESET_PACKET) {
+            //  Reset() is waiting for this, the flush resets m_hr anyway
+            SetEvent(m_evResetComplete);
+        }
+    }
+    if (lHead != m_lHead) {
+        AdvanceHead(lHead);
+    }
+
+    while (m_nBatched != 0) {
+        m_ppSamples[--m_nBatched]->Release();
+    }
+}
+
+//  Notify the thread if it is waiting for something to do
+void CBatchedOutputQueue::NotifyThread()
+{
+    if (m_lWaiting && InterlockedExchange(&m_lWaiting, 0)) {
+        InterlockedIncrement(&m_lWakeups);
+        SetEvent(m_hWork);
+    }
+}
+
+//  See if there's any work to do
+//  Returns
+//      TRUE  if the thread is waiting, nothing is queued and nothing is
+//            batched
+//      FALSE otherwise
+//
+BOOL CBatchedOutputQueue::IsIdle()
+{
+    return m_lWaiting != 0 && m_lHead == m_lTail && m_nBatched == 0;
+}
+
+void CBatchedOutputQueue::SetPopEvent(HANDLE hEvent)
+{
+    m_hEventPop = hEvent;
+}
+
+void CBatchedOutputQueue::GetStatistics(
+    __out LONGLONG *pllSamples,
+    __out LONGLONG *pllBatches,
+    __out LONGLONG *pllWakeups)
+{
+    *pllSamples = m_llSamples;
+    *pllBatches = m_llBatches;
+    *pllWakeups = m_lWakeups;
+}
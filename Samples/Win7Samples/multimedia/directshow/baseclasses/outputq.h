@@ -135,3 +135,161 @@ protected:
     HANDLE m_hEventPop;
 };
 
+
+//
+//  CBatchedOutputQueue
+//
+//  A variant of COutputQueue for high sample rates.  Samples are passed
+//  to the thread through a bounded single producer / single consumer
+//  ring, so the streaming thread takes no lock and only signals the
+//  thread when it is actually waiting.  The thread delivers samples with
+//  ReceiveMultiple in batches of up to lBatchSize, but never holds a
+//  sample back longer than dwMaxLatency milliseconds.  The batch size it
+//  waits for adapts to the stream: it shrinks when batches have to be
+//  sent because of the latency limit and grows again when samples queue
+//  up faster than they are delivered.
+//
+//  Receive, ReceiveMultiple, EOS, NewSegment, SendAnyway and Reset are
+//  the producer side and must only be called from one thread at a time,
+//  which the streaming rules already require.  When the ring is full the
+//  producer blocks until there is room or the queue is flushed.
+//
+class CBatchedOutputQueue
+{
+public:
+    //  Constructor
+    CBatchedOutputQueue(IPin      *pInputPin,          //  Pin to send stuff to
+                        __inout HRESULT *phr,          //  'Return code'
+                        LONG       lBatchSize = 16,    //  Largest batch
+                        DWORD      dwMaxLatency = 10,  //  Longest time a sample is
+                                                       //  held back, in ms
+                        LONG       lRingSize = 256,    //  Ring capacity (rounded up
+                                                       //  to a power of 2)
+                        DWORD      dwPriority =        //  Priority of thread to create
+                                       THREAD_PRIORITY_NORMAL,
+                        bool       bFlushingOpt = false // flushing optimization
+                       );
+    ~CBatchedOutputQueue();
+
+    // enter flush state - discard all data
+    void BeginFlush();
+
+    // re-enable receives (pass this downstream)
+    void EndFlush();
+
+    void EOS();             // Call this on End of stream
+
+    void SendAnyway();      // Send the current batch now
+
+    void NewSegment(
+            REFERENCE_TIME tStart,
+            REFERENCE_TIME tStop,
+            double dRate);
+
+    HRESULT Receive(IMediaSample *pSample);
+
+    HRESULT ReceiveMultiple (
+        __in_ecount(nSamples) IMediaSample **pSamples,
+        long nSamples,
+        __out long *nSamplesProcessed);
+
+    void Reset();           // Reset m_hr ready for more data
+
+    //  See if its idle or not
+    BOOL IsIdle();
+
+    // give the class an event to fire after samples are removed from the queue
+    void SetPopEvent(HANDLE hEvent);
+
+    //  Delivery statistics since the queue was created
+    void GetStatistics(
+        __out LONGLONG *pllSamples,     //  Samples delivered
+        __out LONGLONG *pllBatches,     //  ReceiveMultiple calls
+        __out LONGLONG *pllWakeups);    //  Times the thread was signalled
+
+protected:
+    static DWORD WINAPI InitialThreadProc(__in LPVOID pv);
+    DWORD ThreadProc();
+
+    BOOL IsSpecialSample(IMediaSample *pSample)
+    {
+        return (DWORD_PTR)pSample > (DWORD_PTR)(LONG_PTR)(-16);
+    };
+
+    //  Producer side - wait for lSlots free entries and publish them
+    BOOL WaitForSpace(LONG lSlots, BOOL bAbortOnError);
+    BOOL QueuePackets(IMediaSample *pPacket1, IMediaSample *pPacket2 = NULL);
+
+    //  Thread side
+    void SendBatch();
+    void WaitForWork(DWORD dwTimeout);
+    void AdvanceHead(LONG lHead);
+
+    //  Remove and Release() queued and batched samples - thread side
+    void FreeSamples();
+
+    //  Notify the thread there is something to do
+    void NotifyThread();
+
+protected:
+    // new segment packet is always followed by one of these
+    struct NewSegmentPacket {
+        REFERENCE_TIME tStart;
+        REFERENCE_TIME tStop;
+        double dRate;
+    };
+
+    // Remember input stuff
+    IPin          * const m_pPin;
+    IMemInputPin  *       m_pInputPin;
+    LONG            const m_lBatchSize;
+    DWORD           const m_dwMaxLatency;
+
+    //  The ring.  m_lHead is only written by the thread and m_lTail only
+    //  by the producer, both count up and are masked to index the ring
+    __field_ecount_opt(m_lRingMask + 1) IMediaSample **m_ppRing;
+    LONG                  m_lRingMask;
+    LONG volatile         m_lHead;
+    LONG volatile         m_lTail;
+
+    //  Set by a side that is about to sleep, cleared by the side waking it
+    LONG volatile         m_lWaiting;
+    LONG volatile         m_lSpaceWaiting;
+    HANDLE                m_hWork;
+    HANDLE                m_hSpace;
+
+    HANDLE                m_hThread;
+    CAMEvent              m_evFlushComplete;
+    CAMEvent              m_evResetComplete;
+
+    //  Batch being built by the thread
+    __field_ecount_opt(m_lBatchSize) IMediaSample **m_ppSamples;
+    __range(0, m_lBatchSize)         LONG            m_nBatched;
+    LONG                  m_lTargetBatch;
+    DWORD                 m_dwFirstBatched;
+
+    //  Flush synchronization.  Every BeginFlush and EndFlush asks the
+    //  thread to discard what is queued, the thread acknowledges the
+    //  last request it has seen
+    BOOL volatile         m_bFlushing;
+    LONG volatile         m_lFlushRequest;
+    LONG volatile         m_lFlushDone;
+
+    // flushing optimization
+    BOOL                  m_bFlushed;
+    bool                  m_bFlushingOpt;
+
+    //  Terminate now
+    BOOL volatile         m_bTerminate;
+
+    //  Deferred 'return code'
+    HRESULT volatile      m_hr;
+
+    // an event that can be fired after samples are taken off the queue
+    HANDLE                m_hEventPop;
+
+    //  Statistics
+    LONGLONG              m_llSamples;
+    LONGLONG              m_llBatches;
+    LONG volatile         m_lWakeups;
+};
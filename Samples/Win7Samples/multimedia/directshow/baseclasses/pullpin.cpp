@@ -19,8 +19,16 @@
 CPullPin::CPullPin()
   : m_pReader(NULL),
     m_pAlloc(NULL),
-    m_State(TM_Exit)
+    m_State(TM_Exit),
+    m_cReadAhead(4),
+    m_cbReadAhead(256*1024)
 {
+    ZeroMemory(&m_Stats, sizeof(m_Stats));
+
+    LARGE_INTEGER liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    m_llFrequency = liFrequency.QuadPart;
+
 #ifdef DXMPERF
 	PERFLOG_CTOR( L"CPullPin", this );
 #endif // DXMPERF
@@ -99,6 +107,11 @@ CPullPin::Connect(IUnknown* pUnk, IMemAllocator* pAlloc, BOOL bSync)
 
     m_bSync = bSync;
 
+    {
+        CAutoLock lck(&m_StatsLock);
+        ZeroMemory(&m_Stats, sizeof(m_Stats));
+    }
+
 #ifdef DXMPERF
 	{
 	AM_MEDIA_TYPE *	pmt = NULL;
@@ -150,8 +163,9 @@ CPullPin::DecideAllocator(
     ALLOCATOR_PROPERTIES *pRequest;
     ALLOCATOR_PROPERTIES Request;
     if (pProps == NULL) {
-	Request.cBuffers = 3;
-	Request.cbBuffer = 64*1024;
+	// one buffer being processed downstream plus the read-ahead window
+	Request.cBuffers = m_cReadAhead + 1;
+	Request.cbBuffer = m_cbReadAhead ? m_cbReadAhead : 64*1024;
 	Request.cbAlign = 0;
 	Request.cbPrefix = 0;
 	pRequest = &Request;
@@ -213,6 +227,38 @@ CPullPin::Duration(__out REFERENCE_TIME* ptDuration)
     return S_OK;
 }
 
+HRESULT
+CPullPin::SetReadAhead(LONG cRequests, LONG cbRequest)
+{
+    CAutoLock lock(&m_AccessLock);
+
+    if (cRequests < 1 || cRequests > MAX_READ_AHEAD || cbRequest < 0) {
+	return E_INVALIDARG;
+    }
+
+    m_cReadAhead = cRequests;
+    m_cbReadAhead = cbRequest;
+    return S_OK;
+}
+
+void
+CPullPin::GetStatistics(__out PULLPIN_STATS* pStats)
+{
+    ASSERT(pStats);
+
+    CAutoLock lck(&m_StatsLock);
+    *pStats = m_Stats;
+}
+
+void
+CPullPin::CountRead(LONG lBytes, LONGLONG llWaitTicks)
+{
+    CAutoLock lck(&m_StatsLock);
+    m_Stats.llBytesRead += lBytes;
+    m_Stats.llRequests++;
+    m_Stats.rtReadWait += llMulDiv(llWaitTicks, UNITS, m_llFrequency, 0);
+}
+
 
 HRESULT
 CPullPin::StartThread()
@@ -315,8 +361,18 @@ CPullPin::ThreadProc(void)
 	    break;
 
 	case TM_Start:
-	    Reply(S_OK);
-	    Process();
+	    {
+		Reply(S_OK);
+
+		LARGE_INTEGER liStart, liStop;
+		QueryPerformanceCounter(&liStart);
+		Process();
+		QueryPerformanceCounter(&liStop);
+
+		CAutoLock lck(&m_StatsLock);
+		m_Stats.rtActive += llMulDiv(liStop.QuadPart - liStart.QuadPart,
+					     UNITS, m_llFrequency, 0);
+	    }
 	    break;
 	}
 
@@ -334,14 +390,16 @@ CPullPin::ThreadProc(void)
 
 HRESULT
 CPullPin::QueueSample(
+    IMemAllocator* pAlloc,
     __inout REFERENCE_TIME& tCurrent,
     REFERENCE_TIME tAlignStop,
-    BOOL bDiscontinuity
+    BOOL bDiscontinuity,
+    DWORD_PTR dwUser
     )
 {
     IMediaSample* pSample;
 
-    HRESULT hr = m_pAlloc->GetBuffer(&pSample, NULL, NULL, 0);
+    HRESULT hr = pAlloc->GetBuffer(&pSample, NULL, NULL, 0);
     if (FAILED(hr)) {
 	return hr;
     }
@@ -357,7 +415,7 @@ CPullPin::QueueSample(
 
     hr = m_pReader->Request(
 			pSample,
-			0);
+			dwUser);
     if (FAILED(hr)) {
 	pSample->Release();
 
@@ -368,29 +426,55 @@ CPullPin::QueueSample(
 }
 
 HRESULT
-CPullPin::CollectAndDeliver(
+CPullPin::DeliverBlock(
+    IMediaSample* pBlock,
     REFERENCE_TIME tStart,
-    REFERENCE_TIME tStop)
+    REFERENCE_TIME tStop,
+    __inout BOOL* pbDiscontinuity
+    )
 {
-    IMediaSample* pSample = NULL;   // better be sure pSample is set
-    DWORD_PTR dwUnused;
-    HRESULT hr = m_pReader->WaitForNext(
-			INFINITE,
-			&pSample,
-			&dwUnused);
-    if (FAILED(hr)) {
-	if (pSample) {
-	    pSample->Release();
+    REFERENCE_TIME tBlockStart, tBlockStop;
+    BYTE* pbBlock;
+    HRESULT hr = pBlock->GetTime(&tBlockStart, &tBlockStop);
+    if (SUCCEEDED(hr)) {
+	hr = pBlock->GetPointer(&pbBlock);
+    }
+    LONG lLength = pBlock->GetActualDataLength();
+
+    // stop at the real stop position, the end of the block may only be
+    // there for alignment
+    for (LONG lOffset = 0;
+	 SUCCEEDED(hr) && lOffset < lLength && tBlockStart + lOffset * UNITS < tStop; ) {
+
+	IMediaSample* pSample;
+	hr = m_pAlloc->GetBuffer(&pSample, NULL, NULL, 0);
+	if (FAILED(hr)) {
+	    break;
 	}
-    } else {
+
+	BYTE* pbData;
+	pSample->GetPointer(&pbData);
+	LONG lThis = min(pSample->GetSize(), lLength - lOffset);
+	CopyMemory(pbData, pbBlock + lOffset, lThis);
+	pSample->SetActualDataLength(lThis);
+
+	REFERENCE_TIME t1 = tBlockStart + lOffset * UNITS;
+	REFERENCE_TIME t2 = t1 + lThis * UNITS;
+	pSample->SetTime(&t1, &t2);
+
+	pSample->SetDiscontinuity(*pbDiscontinuity);
+	*pbDiscontinuity = FALSE;
+
+	lOffset += lThis;
+
 	hr = DeliverSample(pSample, tStart, tStop);
+	if (hr != S_OK) {
+	    break;
+	}
     }
-    if (FAILED(hr)) {
-	CleanupCancelled();
-	OnError(hr);
-    }
-    return hr;
 
+    pBlock->Release();
+    return hr;
 }
 
 HRESULT
@@ -424,11 +508,169 @@ CPullPin::DeliverSample(
 	}
 #endif
 
+    {
+        CAutoLock lck(&m_StatsLock);
+        m_Stats.llSamples++;
+    }
+
     HRESULT hr = Receive(pSample);
     pSample->Release();
     return hr;
 }
 
+HRESULT
+CPullPin::ProcessReadAhead(
+    REFERENCE_TIME tStart,
+    REFERENCE_TIME tAlignStop,
+    REFERENCE_TIME tStop,
+    const ALLOCATOR_PROPERTIES& Actual)
+{
+    // Read straight into the agreed allocator's samples if they are big
+    // enough, leaving one buffer for downstream to hold on to.  Otherwise
+    // read whole blocks into our own buffers and copy them out.
+    IMemAllocator* pReadAlloc = m_pAlloc;
+    LONG cWindow = min(m_cReadAhead, max(Actual.cBuffers - 1, 1));
+    HRESULT hr = S_OK;
+
+    if (m_cbReadAhead > Actual.cbBuffer) {
+	cWindow = m_cReadAhead;
+
+	CMemAllocator* pAlloc = new CMemAllocator(NAME("CPullPin read-ahead allocator"), NULL, &hr);
+	if (pAlloc == NULL) {
+	    hr = E_OUTOFMEMORY;
+	} else {
+	    pAlloc->AddRef();
+	    pReadAlloc = pAlloc;
+	}
+
+	ALLOCATOR_PROPERTIES Request, ReadActual;
+	Request.cBuffers = cWindow;
+	Request.cbBuffer = (LONG) AlignUp(m_cbReadAhead, Actual.cbAlign);
+	Request.cbAlign = Actual.cbAlign;
+	Request.cbPrefix = 0;
+	if (SUCCEEDED(hr)) {
+	    hr = pReadAlloc->SetProperties(&Request, &ReadActual);
+	}
+	if (SUCCEEDED(hr)) {
+	    hr = pReadAlloc->Commit();
+	}
+	if (FAILED(hr)) {
+	    if (pReadAlloc != m_pAlloc) {
+		pReadAlloc->Release();
+	    }
+	    OnError(hr);
+	    return hr;
+	}
+    } else {
+	pReadAlloc->AddRef();
+    }
+    const BOOL bCoalesce = (pReadAlloc != m_pAlloc);
+
+    // Reads may complete out of order.  Each one is tagged with its slot
+    // in the window and held there until everything before it has been
+    // delivered.
+    IMediaSample* apDone[MAX_READ_AHEAD];
+    ZeroMemory(apDone, sizeof(apDone));
+    LONGLONG llIssued = 0;
+    LONGLONG llDelivered = 0;
+    REFERENCE_TIME tCurrent = tStart;
+    BOOL bDiscontinuity = TRUE;
+    DWORD dwRequest;
+
+    while (hr == S_OK) {
+
+	// keep the window full
+	while (tCurrent < tAlignStop && llIssued - llDelivered < cWindow) {
+
+	    // Break out without calling EndOfStream if we're asked to
+	    // do something different
+	    if (CheckRequest(&dwRequest)) {
+		hr = S_FALSE;
+		break;
+	    }
+
+	    hr = QueueSample(pReadAlloc, tCurrent, tAlignStop,
+			     bDiscontinuity && !bCoalesce,
+			     (DWORD_PTR) (llIssued % cWindow));
+	    if (FAILED(hr)) {
+		break;
+	    }
+	    llIssued++;
+	    if (!bCoalesce) {
+		bDiscontinuity = FALSE;
+	    }
+	}
+	if (hr != S_OK || llIssued == llDelivered) {
+	    break;
+	}
+
+	// wait for any read to finish
+	IMediaSample* pSample = NULL;   // better be sure pSample is set
+	DWORD_PTR dwSlot;
+	LARGE_INTEGER liStart, liStop;
+	QueryPerformanceCounter(&liStart);
+	hr = m_pReader->WaitForNext(
+			INFINITE,
+			&pSample,
+			&dwSlot);
+	QueryPerformanceCounter(&liStop);
+	if (FAILED(hr)) {
+	    if (pSample) {
+		pSample->Release();
+	    }
+	    CleanupCancelled();
+	    OnError(hr);
+	    break;
+	}
+	CountRead(pSample->GetActualDataLength(), liStop.QuadPart - liStart.QuadPart);
+
+	ASSERT(dwSlot < (DWORD_PTR) cWindow && apDone[dwSlot] == NULL);
+	apDone[dwSlot] = pSample;
+
+	// deliver everything that is now in order
+	while (llDelivered < llIssued) {
+	    LONG lSlot = (LONG) (llDelivered % cWindow);
+	    pSample = apDone[lSlot];
+	    if (pSample == NULL) {
+		break;
+	    }
+	    apDone[lSlot] = NULL;
+	    llDelivered++;
+
+	    if (bCoalesce) {
+		hr = DeliverBlock(pSample, tStart, tStop, &bDiscontinuity);
+	    } else {
+		hr = DeliverSample(pSample, tStart, tStop);
+	    }
+	    if (hr != S_OK) {
+
+		// stop if error, or if downstream filter said
+		// to stop.
+		if (FAILED(hr)) {
+		    CleanupCancelled();
+		    OnError(hr);
+		}
+		break;
+	    }
+	}
+    }
+
+    // Reads that finished but were not delivered go back now.  Any still
+    // outstanding are collected by CleanupCancelled once ThreadProc has
+    // flushed the reader; each holds a reference on its allocator.
+    for (LONG i = 0; i < cWindow; i++) {
+	if (apDone[i]) {
+	    apDone[i]->Release();
+	}
+    }
+    if (bCoalesce) {
+	pReadAlloc->Decommit();
+    }
+    pReadAlloc->Release();
+
+    return hr;
+}
+
 void
 CPullPin::Process(void)
 {
@@ -440,9 +682,7 @@ CPullPin::Process(void)
 
     BOOL bDiscontinuity = TRUE;
 
-    // if there is more than one sample at the allocator,
-    // then try to queue 2 at once in order to overlap.
-    // -- get buffer count and required alignment
+    // get buffer count and required alignment
     ALLOCATOR_PROPERTIES Actual;
     HRESULT hr = m_pAlloc->GetProperties(&Actual);
 
@@ -464,54 +704,9 @@ CPullPin::Process(void)
 
     if (!m_bSync) {
 
-	//  Break out of the loop either if we get to the end or we're asked
-	//  to do something else
-	while (tCurrent < tAlignStop) {
-
-	    // Break out without calling EndOfStream if we're asked to
-	    // do something different
-	    if (CheckRequest(&dwRequest)) {
-		return;
-	    }
-
-	    // queue a first sample
-	    if (Actual.cBuffers > 1) {
-
-		hr = QueueSample(tCurrent, tAlignStop, TRUE);
-		bDiscontinuity = FALSE;
-
-		if (FAILED(hr)) {
-		    return;
-		}
-	    }
-
-
-
-	    // loop queueing second and waiting for first..
-	    while (tCurrent < tAlignStop) {
-
-		hr = QueueSample(tCurrent, tAlignStop, bDiscontinuity);
-		bDiscontinuity = FALSE;
-
-		if (FAILED(hr)) {
-		    return;
-		}
-
-		hr = CollectAndDeliver(tStart, tStop);
-		if (S_OK != hr) {
-
-		    // stop if error, or if downstream filter said
-		    // to stop.
-		    return;
-		}
-	    }
-
-	    if (Actual.cBuffers > 1) {
-		hr = CollectAndDeliver(tStart, tStop);
-		if (FAILED(hr)) {
-		    return;
-		}
-	    }
+	hr = ProcessReadAhead(tStart, tAlignStop, tStop, Actual);
+	if (hr != S_OK) {
+	    return;
 	}
     } else {
 
@@ -544,13 +739,17 @@ CPullPin::Process(void)
 		bDiscontinuity = FALSE;
 	    }
 
+	    LARGE_INTEGER liStart, liStop;
+	    QueryPerformanceCounter(&liStart);
 	    hr = m_pReader->SyncReadAligned(pSample);
+	    QueryPerformanceCounter(&liStop);
 
 	    if (FAILED(hr)) {
 		pSample->Release();
 		OnError(hr);
 		return;
 	    }
+	    CountRead(pSample->GetActualDataLength(), liStop.QuadPart - liStart.QuadPart);
 
 	    hr = DeliverSample(pSample, tStart, tStop);
 	    if (hr != S_OK) {
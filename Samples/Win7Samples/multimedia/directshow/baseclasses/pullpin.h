@@ -20,6 +20,22 @@
 // This is essentially for use in a MemInputPin when it finds itself
 // connected to an IAsyncReader pin instead of a pushing pin.
 //
+// In async mode several reads are kept outstanding on the reader (the
+// read-ahead window, see SetReadAhead) and delivered in file order.  If
+// the agreed allocator's buffers are smaller than the read-ahead block,
+// adjacent samples are read as one block into private buffers and copied
+// out, so the reader sees a few large aligned reads instead of many small
+// ones.
+//
+
+// Counters returned by CPullPin::GetStatistics, accumulated since Connect
+typedef struct tagPULLPIN_STATS {
+    LONGLONG        llBytesRead;    // Bytes returned by the reader
+    LONGLONG        llRequests;     // Reads issued to the reader
+    LONGLONG        llSamples;      // Samples passed to Receive
+    REFERENCE_TIME  rtReadWait;     // Time spent waiting for reads
+    REFERENCE_TIME  rtActive;       // Time spent pulling data
+} PULLPIN_STATS;
 
 class CPullPin : public CAMThread
 {
@@ -37,6 +53,18 @@ class CPullPin : public CAMThread
 
     ThreadMsg m_State;
 
+    enum { MAX_READ_AHEAD = 32 };
+
+    LONG                m_cReadAhead;   // Reads kept outstanding
+    LONG                m_cbReadAhead;  // Size of each read, 0 for the buffer size
+
+    CCritSec            m_StatsLock;
+    PULLPIN_STATS       m_Stats;
+    LONGLONG            m_llFrequency;  // QueryPerformanceFrequency
+
+    // add a completed read to the statistics
+    void CountRead(LONG lBytes, LONGLONG llWaitTicks);
+
     // override pure thread proc from CAMThread
     DWORD ThreadProc(void);
 
@@ -55,15 +83,29 @@ class CPullPin : public CAMThread
     // stop and close thread
     HRESULT StopThread();
 
-    // called from ProcessAsync to queue and collect requests
+    // async version of the pull loop, keeps the read-ahead window full.
+    // Returns S_OK at the end of the range, S_FALSE if asked to stop, or
+    // an error that has already been passed to OnError.
+    HRESULT ProcessReadAhead(
+		REFERENCE_TIME tStart,
+		REFERENCE_TIME tAlignStop,
+		REFERENCE_TIME tStop,
+		const ALLOCATOR_PROPERTIES& Actual);
+
+    // called from ProcessReadAhead to queue requests
     HRESULT QueueSample(
+		IMemAllocator* pAlloc,
 		__inout REFERENCE_TIME& tCurrent,
 		REFERENCE_TIME tAlignStop,
-		BOOL bDiscontinuity);
+		BOOL bDiscontinuity,
+		DWORD_PTR dwUser);
 
-    HRESULT CollectAndDeliver(
+    // split a coalesced read into samples from m_pAlloc and deliver them
+    HRESULT DeliverBlock(
+		IMediaSample* pBlock,
 		REFERENCE_TIME tStart,
-		REFERENCE_TIME tStop);
+		REFERENCE_TIME tStop,
+		__inout BOOL* pbDiscontinuity);
 
     HRESULT DeliverSample(
 		IMediaSample* pSample,
@@ -104,6 +146,15 @@ public:
     // return the total duration
     HRESULT Duration(__out REFERENCE_TIME* ptDuration);
 
+    // set the number of async reads kept outstanding and the size of
+    // each read.  cbRequest of 0 reads one allocator buffer at a time.
+    // Call before Connect so the default allocator is sized to match;
+    // takes effect the next time the thread starts pulling.
+    HRESULT SetReadAhead(LONG cRequests, LONG cbRequest);
+
+    // read the throughput counters
+    void GetStatistics(__out PULLPIN_STATS* pStats);
+
     // start pulling data
     HRESULT Active(void);
 
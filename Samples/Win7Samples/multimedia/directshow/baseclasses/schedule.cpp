@@ -19,12 +19,12 @@
 
 CAMSchedule::CAMSchedule( HANDLE ev )
 : CBaseObject(TEXT("CAMSchedule"))
-, head(&z, 0), z(0, MAX_TIME)
+, m_ppHeap(0), m_dwHeapSize(0)
+, m_ppCookieHash(0), m_dwHashSize(0)
 , m_dwNextCookie(0), m_dwAdviseCount(0)
 , m_pAdviseCache(0), m_dwCacheCount(0)
 , m_ev( ev )
 {
-    head.m_dwAdviseCookie = z.m_dwAdviseCookie = 0;
 }
 
 CAMSchedule::~CAMSchedule()
@@ -45,17 +45,14 @@ CAMSchedule::~CAMSchedule()
     if ( m_dwAdviseCount > 0 )
     {
         DumpLinkedList();
-        while ( !head.m_next->IsZ() )
+        while ( m_dwAdviseCount > 0 )
         {
-            head.DeleteNext();
-            --m_dwAdviseCount;
+            delete m_ppHeap[--m_dwAdviseCount];
         }
     }
 
-    // If, in the debug version, we assert twice, it means, not only
-    // did we have left over advises, but we have also let m_dwAdviseCount
-    // get out of sync. with the number of advises actually on the list.
-    ASSERT( m_dwAdviseCount == 0 );
+    delete [] m_ppHeap;
+    delete [] m_ppCookieHash;
 
     m_Serialize.Unlock();
 }
@@ -70,8 +67,8 @@ DWORD CAMSchedule::GetAdviseCount()
 
 REFERENCE_TIME CAMSchedule::GetNextAdviseTime()
 {
-    CAutoLock lck(&m_Serialize); // Need to stop the linked list from changing
-    return head.m_next->m_rtEventTime;
+    CAutoLock lck(&m_Serialize); // Need to stop the heap from changing
+    return m_dwAdviseCount > 0 ? m_ppHeap[0]->m_rtEventTime : MAX_TIME;
 }
 
 DWORD_PTR CAMSchedule::AddAdvisePacket
@@ -80,7 +77,7 @@ DWORD_PTR CAMSchedule::AddAdvisePacket
 , HANDLE h, BOOL periodic
 )
 {
-    // Since we use MAX_TIME as a sentry, we can't afford to
+    // Since we use MAX_TIME to mean "no advise", we can't afford to
     // schedule a notification at MAX_TIME
     ASSERT( time1 < MAX_TIME );
     DWORD_PTR Result;
@@ -88,7 +85,11 @@ DWORD_PTR CAMSchedule::AddAdvisePacket
 
     m_Serialize.Lock();
 
-    if (m_pAdviseCache)
+    if (!Reserve())
+    {
+        p = 0;
+    }
+    else if (m_pAdviseCache)
     {
         p = m_pAdviseCache;
         m_pAdviseCache = p->m_next;
@@ -114,28 +115,21 @@ DWORD_PTR CAMSchedule::AddAdvisePacket
 HRESULT CAMSchedule::Unadvise(DWORD_PTR dwAdviseCookie)
 {
     HRESULT hr = S_FALSE;
-    CAdvisePacket * p_prev = &head;
-    CAdvisePacket * p_n;
     m_Serialize.Lock();
-    while ( p_n = p_prev->Next() ) // The Next() method returns NULL when it hits z
+    if (m_dwHashSize > 0)
     {
-        if ( p_n->m_dwAdviseCookie == dwAdviseCookie )
+        CAdvisePacket * p_n = m_ppCookieHash[dwAdviseCookie & (m_dwHashSize - 1)];
+        while ( p_n && p_n->m_dwAdviseCookie != dwAdviseCookie )
+        {
+            p_n = p_n->m_next;
+        }
+        if ( p_n )
         {
-            Delete( p_prev->RemoveNext() );
-            --m_dwAdviseCount;
+            Remove( p_n );
+            Delete( p_n );
             hr = S_OK;
-	    // Having found one cookie that matches, there should be no more
-            #ifdef DEBUG
-	       while (p_n = p_prev->Next())
-               {
-                   ASSERT(p_n->m_dwAdviseCookie != dwAdviseCookie);
-                   p_prev = p_n;
-               }
-            #endif
-            break;
         }
-        p_prev = p_n;
-    };
+    }
     m_Serialize.Unlock();
     return hr;
 }
@@ -154,11 +148,21 @@ REFERENCE_TIME CAMSchedule::Advise( const REFERENCE_TIME & rtTime )
         if (DbgCheckModuleLevel(LOG_TIMING, 4)) DumpLinkedList();
     #endif
 
-    //  Note - DON'T cache the difference, it might overflow 
-    while ( rtTime >= (rtNextTime = (pAdvise=head.m_next)->m_rtEventTime) &&
-            !pAdvise->IsZ() )
+    for (;;)
     {
-        ASSERT(pAdvise->m_dwAdviseCookie); // If this is zero, its the head or the tail!!
+        if ( m_dwAdviseCount == 0 )
+        {
+            pAdvise = 0;
+            rtNextTime = MAX_TIME;
+            break;
+        }
+
+        //  Note - DON'T cache the difference, it might overflow 
+        pAdvise = m_ppHeap[0];
+        rtNextTime = pAdvise->m_rtEventTime;
+        if ( rtTime < rtNextTime ) break;
+
+        ASSERT(pAdvise->m_dwAdviseCookie);
 
         ASSERT(pAdvise->m_hNotify != INVALID_HANDLE_VALUE);
 
@@ -172,15 +176,15 @@ REFERENCE_TIME CAMSchedule::Advise( const REFERENCE_TIME & rtTime )
         {
             ASSERT( pAdvise->m_bPeriodic == FALSE );
             EXECUTE_ASSERT(SetEvent(pAdvise->m_hNotify));
-            --m_dwAdviseCount;
-            Delete( head.RemoveNext() );
+            Remove( pAdvise );
+            Delete( pAdvise );
         }
 
     }
 
     DbgLog((LOG_TIMING, 3,
             TEXT("CAMSchedule::Advise() Next time stamp: %lu ms, for advise %lu."),
-            DWORD(rtNextTime / (UNITS / MILLISECONDS)), pAdvise->m_dwAdviseCookie ));
+            DWORD(rtNextTime / (UNITS / MILLISECONDS)), pAdvise ? pAdvise->m_dwAdviseCookie : 0 ));
 
     return rtNextTime;
 }
@@ -191,29 +195,139 @@ DWORD_PTR CAMSchedule::AddAdvisePacket( __inout CAdvisePacket * pPacket )
 {
     ASSERT(pPacket->m_rtEventTime >= 0 && pPacket->m_rtEventTime < MAX_TIME);
     ASSERT(CritCheckIn(&m_Serialize));
-
-    CAdvisePacket * p_prev = &head;
-    CAdvisePacket * p_n;
+    ASSERT(m_dwAdviseCount < m_dwHeapSize && m_dwAdviseCount < m_dwHashSize);
 
     const DWORD_PTR Result = pPacket->m_dwAdviseCookie = ++m_dwNextCookie;
-    // This relies on the fact that z is a sentry with a maximal m_rtEventTime
-    for(;;p_prev = p_n)
-    {
-        p_n = p_prev->m_next;
-        if ( p_n->m_rtEventTime >= pPacket->m_rtEventTime ) break;
-    }
-    p_prev->InsertAfter( pPacket );
-    ++m_dwAdviseCount;
+
+    CAdvisePacket ** ppBucket = &m_ppCookieHash[Result & (m_dwHashSize - 1)];
+    pPacket->m_next = *ppBucket;
+    *ppBucket = pPacket;
+
+    const DWORD dwIndex = m_dwAdviseCount++;
+    m_ppHeap[dwIndex] = pPacket;
+    pPacket->m_dwHeapIndex = dwIndex;
+    SiftUp( dwIndex );
 
     DbgLog((LOG_TIMING, 2, TEXT("Added advise %lu, for thread 0x%02X, scheduled at %lu"),
     	pPacket->m_dwAdviseCookie, GetCurrentThreadId(), (pPacket->m_rtEventTime / (UNITS / MILLISECONDS)) ));
 
     // If packet added at the head, then clock needs to re-evaluate wait time.
-    if ( p_prev == &head ) SetEvent( m_ev );
+    if ( pPacket->m_dwHeapIndex == 0 ) SetEvent( m_ev );
 
     return Result;
 }
 
+BOOL CAMSchedule::Reserve()
+{
+    ASSERT(CritCheckIn(&m_Serialize));
+
+    if ( m_dwAdviseCount == m_dwHeapSize )
+    {
+        const DWORD dwNewSize = m_dwHeapSize ? m_dwHeapSize * 2 : 16;
+        CAdvisePacket ** ppHeap = new CAdvisePacket *[dwNewSize];
+        if (!ppHeap) return FALSE;
+        CopyMemory( ppHeap, m_ppHeap, m_dwAdviseCount * sizeof(CAdvisePacket *) );
+        delete [] m_ppHeap;
+        m_ppHeap = ppHeap;
+        m_dwHeapSize = dwNewSize;
+    }
+
+    // Keep the chains short by having at least as many buckets as packets
+    if ( m_dwAdviseCount == m_dwHashSize )
+    {
+        const DWORD dwNewSize = m_dwHashSize ? m_dwHashSize * 2 : 16;
+        CAdvisePacket ** ppHash = new CAdvisePacket *[dwNewSize];
+        if (!ppHash) return FALSE;
+        ZeroMemory( ppHash, dwNewSize * sizeof(CAdvisePacket *) );
+        for ( DWORD i = 0; i < m_dwHashSize; i++ )
+        {
+            CAdvisePacket * p = m_ppCookieHash[i];
+            while (p)
+            {
+                CAdvisePacket *const p_next = p->m_next;
+                CAdvisePacket ** ppBucket = &ppHash[p->m_dwAdviseCookie & (dwNewSize - 1)];
+                p->m_next = *ppBucket;
+                *ppBucket = p;
+                p = p_next;
+            }
+        }
+        delete [] m_ppCookieHash;
+        m_ppCookieHash = ppHash;
+        m_dwHashSize = dwNewSize;
+    }
+    return TRUE;
+}
+
+void CAMSchedule::SiftUp( DWORD dwIndex )
+{
+    CAdvisePacket *const pPacket = m_ppHeap[dwIndex];
+    while ( dwIndex > 0 )
+    {
+        const DWORD dwParent = (dwIndex - 1) / 2;
+        CAdvisePacket *const pParent = m_ppHeap[dwParent];
+        if ( pParent->m_rtEventTime <= pPacket->m_rtEventTime ) break;
+        m_ppHeap[dwIndex] = pParent;
+        pParent->m_dwHeapIndex = dwIndex;
+        dwIndex = dwParent;
+    }
+    m_ppHeap[dwIndex] = pPacket;
+    pPacket->m_dwHeapIndex = dwIndex;
+}
+
+void CAMSchedule::SiftDown( DWORD dwIndex )
+{
+    CAdvisePacket *const pPacket = m_ppHeap[dwIndex];
+    for (;;)
+    {
+        DWORD dwChild = 2 * dwIndex + 1;
+        if ( dwChild >= m_dwAdviseCount ) break;
+        if ( dwChild + 1 < m_dwAdviseCount &&
+             m_ppHeap[dwChild + 1]->m_rtEventTime < m_ppHeap[dwChild]->m_rtEventTime )
+        {
+            dwChild++;
+        }
+        CAdvisePacket *const pChild = m_ppHeap[dwChild];
+        if ( pPacket->m_rtEventTime <= pChild->m_rtEventTime ) break;
+        m_ppHeap[dwIndex] = pChild;
+        pChild->m_dwHeapIndex = dwIndex;
+        dwIndex = dwChild;
+    }
+    m_ppHeap[dwIndex] = pPacket;
+    pPacket->m_dwHeapIndex = dwIndex;
+}
+
+void CAMSchedule::Remove( __inout CAdvisePacket * pPacket )
+{
+    ASSERT(CritCheckIn(&m_Serialize));
+    ASSERT(m_ppHeap[pPacket->m_dwHeapIndex] == pPacket);
+
+    CAdvisePacket ** ppLink = &m_ppCookieHash[pPacket->m_dwAdviseCookie & (m_dwHashSize - 1)];
+    while ( *ppLink != pPacket )
+    {
+        ASSERT(*ppLink);
+        ppLink = &(*ppLink)->m_next;
+    }
+    *ppLink = pPacket->m_next;
+
+    // Fill the hole with the last packet and move that one into place
+    const DWORD dwIndex = pPacket->m_dwHeapIndex;
+    const DWORD dwLast = --m_dwAdviseCount;
+    if ( dwIndex != dwLast )
+    {
+        m_ppHeap[dwIndex] = m_ppHeap[dwLast];
+        m_ppHeap[dwIndex]->m_dwHeapIndex = dwIndex;
+        if ( dwIndex > 0 &&
+             m_ppHeap[dwIndex]->m_rtEventTime < m_ppHeap[(dwIndex - 1) / 2]->m_rtEventTime )
+        {
+            SiftUp( dwIndex );
+        }
+        else
+        {
+            SiftDown( dwIndex );
+        }
+    }
+}
+
 void CAMSchedule::Delete( __inout CAdvisePacket * pPacket )
 {
     if ( m_dwCacheCount >= dwCacheMax ) delete pPacket;
@@ -228,32 +342,17 @@ void CAMSchedule::Delete( __inout CAdvisePacket * pPacket )
 }
 
 
-// Takes the head of the list & repositions it
+// Takes the head of the heap & repositions it
 void CAMSchedule::ShuntHead()
 {
-    CAdvisePacket * p_prev = &head;
-    CAdvisePacket * p_n;
-
     m_Serialize.Lock();
-    CAdvisePacket *const pPacket = head.m_next;
+    CAdvisePacket *const pPacket = m_ppHeap[0];
 
-    // This will catch both an empty list,
-    // and if somehow a MAX_TIME time gets into the list
-    // (which would also break this method).
-    ASSERT( pPacket->m_rtEventTime < MAX_TIME );
+    // This will catch an empty heap and if somehow a MAX_TIME
+    // time gets into the heap.
+    ASSERT( m_dwAdviseCount > 0 && pPacket->m_rtEventTime < MAX_TIME );
 
-    // This relies on the fact that z is a sentry with a maximal m_rtEventTime
-    for(;;p_prev = p_n)
-    {
-        p_n = p_prev->m_next;
-        if ( p_n->m_rtEventTime > pPacket->m_rtEventTime ) break;
-    }
-    // If p_prev == pPacket then we're already in the right place
-    if (p_prev != pPacket)
-    {
-        head.m_next = pPacket->m_next;
-        (p_prev->m_next = pPacket)->m_next = p_n;
-    }
+    SiftDown( 0 );
     #ifdef DEBUG
         DbgLog((LOG_TIMING, 2, TEXT("Periodic advise %lu, shunted to %lu"),
     	    pPacket->m_dwAdviseCookie, (pPacket->m_rtEventTime / (UNITS / MILLISECONDS)) ));
@@ -263,17 +362,15 @@ void CAMSchedule::ShuntHead()
 
 
 #ifdef DEBUG
+// Dumps the heap in array order, the first entry is the next to fire
 void CAMSchedule::DumpLinkedList()
 {
     m_Serialize.Lock();
-    int i=0;
     DbgLog((LOG_TIMING, 1, TEXT("CAMSchedule::DumpLinkedList() this = 0x%p"), this));
-    for ( CAdvisePacket * p = &head
-        ; p
-        ; p = p->m_next         , i++
-        )	
+    for ( DWORD i = 0; i < m_dwAdviseCount; i++ )
     {
-        DbgLog((LOG_TIMING, 1, TEXT("Advise List # %lu, Cookie %d,  RefTime %lu"),
+        CAdvisePacket *const p = m_ppHeap[i];
+        DbgLog((LOG_TIMING, 1, TEXT("Advise Heap # %lu, Cookie %d,  RefTime %lu"),
             i,
 	    p->m_dwAdviseCookie,
 	    p->m_rtEventTime / (UNITS / MILLISECONDS)
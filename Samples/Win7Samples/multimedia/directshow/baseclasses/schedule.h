@@ -34,67 +34,40 @@ public:
     HANDLE GetEvent() const { return m_ev; }
 
 private:
-    // We define the nodes that will be used in our singly linked list
-    // of advise packets.  The list is ordered by time, with the
-    // elements that will expire first at the front.
+    // Advise packets are kept in a binary min-heap ordered by time, so
+    // adding, firing and rescheduling a packet costs O(log n) however
+    // many advises are outstanding.  A hash table on the cookie lets
+    // Unadvise find a packet without searching the heap.
     class CAdvisePacket
     {
     public:
         CAdvisePacket()
         {}
 
-        CAdvisePacket * m_next;
+        CAdvisePacket * m_next;             // Cookie hash chain, or advise cache
         DWORD_PTR       m_dwAdviseCookie;
         REFERENCE_TIME  m_rtEventTime;      // Time at which event should be set
         REFERENCE_TIME  m_rtPeriod;         // Periodic time
         HANDLE          m_hNotify;          // Handle to event or semephore
         BOOL            m_bPeriodic;        // TRUE => Periodic event
-
-        CAdvisePacket( __inout_opt CAdvisePacket * next, LONGLONG time ) : m_next(next), m_rtEventTime(time)
-        {}
-
-        void InsertAfter( __inout CAdvisePacket * p )
-        {
-            p->m_next = m_next;
-            m_next    = p;
-        }
-
-        int IsZ() const // That is, is it the node that represents the end of the list
-        { return m_next == 0; }
-
-        CAdvisePacket * RemoveNext()
-        {
-            CAdvisePacket *const next = m_next;
-            CAdvisePacket *const new_next = next->m_next;
-            m_next = new_next;
-            return next;
-        }
-
-        void DeleteNext()
-        {
-            delete RemoveNext();
-        }
-
-        CAdvisePacket * Next() const
-        {
-            CAdvisePacket * result = m_next;
-            if (result->IsZ()) result = 0;
-            return result;
-        }
+        DWORD           m_dwHeapIndex;      // Position in m_ppHeap
 
         DWORD_PTR Cookie() const
         { return m_dwAdviseCookie; }
     };
 
-    // Structure is:
-    // head -> elmt1 -> elmt2 -> z -> null
-    // So an empty list is:       head -> z -> null
-    // Having head & z as links makes insertaion,
-    // deletion and shunting much easier.
-    CAdvisePacket   head, z;            // z is both a tail and a sentry
+    // m_ppHeap[0] is the packet that will expire first.  The children of
+    // element i are 2i+1 and 2i+2.
+    CAdvisePacket ** m_ppHeap;
+    DWORD           m_dwHeapSize;       // Allocated size of m_ppHeap
+
+    // Buckets are indexed by the low bits of the cookie.  Cookies are
+    // handed out in sequence so they spread evenly over the buckets.
+    CAdvisePacket ** m_ppCookieHash;
+    DWORD           m_dwHashSize;       // Power of 2
 
     volatile DWORD_PTR  m_dwNextCookie;     // Strictly increasing
-    volatile DWORD  m_dwAdviseCount;    // Number of elements on list
+    volatile DWORD  m_dwAdviseCount;    // Number of elements in the heap
 
     CCritSec        m_Serialize;
 
@@ -103,9 +76,18 @@ private:
     // Event that we should set if the packed added above will be the next to fire.
     const HANDLE m_ev;
 
+    // Grow the heap and hash table so there is room for one more packet
+    BOOL Reserve();
+
+    // Move the packet at dwIndex up or down until the heap is in order again
+    void SiftUp( DWORD dwIndex );
+    void SiftDown( DWORD dwIndex );
+
+    // Take a packet out of the heap and the hash table
+    void Remove( __inout CAdvisePacket * pPacket );
+
     // A Shunt is where we have changed the first element in the
-    // list and want it re-evaluating (i.e. repositioned) in
-    // the list.
+    // heap and want it re-evaluating (i.e. repositioned).
     void ShuntHead();
 
     // Rather than delete advise packets, we cache them for future use
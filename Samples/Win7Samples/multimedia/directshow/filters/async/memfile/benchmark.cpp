@@ -0,0 +1,551 @@
+//------------------------------------------------------------------------------
+// File: Benchmark.cpp
+//
+// Desc: DirectShow sample code - benchmarks for the base classes used by
+//       the memfile application.  Run "memfile -benchmark <name>".
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+#include <streams.h>
+#include <tchar.h>
+#include <stdio.h>
+
+#include "asyncio.h"
+#include "asyncrdr.h"
+#include "memfile.h"
+
+
+//
+//  An input pin that accepts everything and throws it away, standing in
+//  for a renderer so the benchmarks only measure the upstream code
+//
+
+class CNullRendererPin : public CUnknown, public IPin, public IMemInputPin
+{
+public:
+    CNullRendererPin() :
+        CUnknown(NAME("Null renderer pin"), NULL),
+        m_llSamples(0),
+        m_llCalls(0)
+    {
+    }
+
+    DECLARE_IUNKNOWN
+
+    STDMETHODIMP NonDelegatingQueryInterface(REFIID riid, void **ppv)
+    {
+        if (riid == IID_IPin) {
+            return GetInterface((IPin *)this, ppv);
+        } else if (riid == IID_IMemInputPin) {
+            return GetInterface((IMemInputPin *)this, ppv);
+        }
+        return CUnknown::NonDelegatingQueryInterface(riid, ppv);
+    }
+
+    //  IPin - only the streaming methods are called
+
+    STDMETHODIMP Connect(IPin *, const AM_MEDIA_TYPE *) { return E_NOTIMPL; }
+    STDMETHODIMP ReceiveConnection(IPin *, const AM_MEDIA_TYPE *) { return E_NOTIMPL; }
+    STDMETHODIMP Disconnect() { return E_NOTIMPL; }
+    STDMETHODIMP ConnectedTo(IPin **) { return E_NOTIMPL; }
+    STDMETHODIMP ConnectionMediaType(AM_MEDIA_TYPE *) { return E_NOTIMPL; }
+    STDMETHODIMP QueryPinInfo(PIN_INFO *) { return E_NOTIMPL; }
+    STDMETHODIMP QueryId(LPWSTR *) { return E_NOTIMPL; }
+    STDMETHODIMP QueryAccept(const AM_MEDIA_TYPE *) { return S_OK; }
+    STDMETHODIMP EnumMediaTypes(IEnumMediaTypes **) { return E_NOTIMPL; }
+    STDMETHODIMP QueryInternalConnections(IPin **, ULONG *) { return E_NOTIMPL; }
+
+    STDMETHODIMP QueryDirection(PIN_DIRECTION *pPinDir)
+    {
+        CheckPointer(pPinDir, E_POINTER);
+        *pPinDir = PINDIR_INPUT;
+        return S_OK;
+    }
+
+    STDMETHODIMP EndOfStream()
+    {
+        m_evEndOfStream.Set();
+        return S_OK;
+    }
+
+    STDMETHODIMP BeginFlush() { return S_OK; }
+    STDMETHODIMP EndFlush() { return S_OK; }
+    STDMETHODIMP NewSegment(REFERENCE_TIME, REFERENCE_TIME, double) { return S_OK; }
+
+    //  IMemInputPin
+
+    STDMETHODIMP GetAllocator(IMemAllocator **) { return VFW_E_NO_ALLOCATOR; }
+    STDMETHODIMP NotifyAllocator(IMemAllocator *, BOOL) { return S_OK; }
+    STDMETHODIMP GetAllocatorRequirements(ALLOCATOR_PROPERTIES *) { return E_NOTIMPL; }
+    STDMETHODIMP ReceiveCanBlock() { return S_FALSE; }
+
+    STDMETHODIMP Receive(IMediaSample *pSample)
+    {
+        long nProcessed;
+        return ReceiveMultiple(&pSample, 1, &nProcessed);
+    }
+
+    STDMETHODIMP ReceiveMultiple(IMediaSample **pSamples, long nSamples, long *nSamplesProcessed)
+    {
+        //  Look at each sample the way a renderer would
+        for (long i = 0; i < nSamples; i++) {
+            BYTE *pbData;
+            pSamples[i]->GetPointer(&pbData);
+        }
+        m_llSamples += nSamples;
+        m_llCalls++;
+        *nSamplesProcessed = nSamples;
+        return S_OK;
+    }
+
+    void Reset()
+    {
+        m_llSamples = 0;
+        m_llCalls = 0;
+    }
+
+    BOOL WaitForEndOfStream(DWORD dwTimeout)
+    {
+        return m_evEndOfStream.Wait(dwTimeout);
+    }
+
+    LONGLONG GetSampleCount() { return m_llSamples; }
+    LONGLONG GetCallCount() { return m_llCalls; }
+
+private:
+    CAMEvent m_evEndOfStream;
+    LONGLONG m_llSamples;
+    LONGLONG m_llCalls;
+};
+
+
+//
+//  Helpers
+//
+
+static double ElapsedSeconds(const LARGE_INTEGER &liStart)
+{
+    LARGE_INTEGER liNow, liFrequency;
+    QueryPerformanceCounter(&liNow);
+    QueryPerformanceFrequency(&liFrequency);
+    return (double)(liNow.QuadPart - liStart.QuadPart) / (double)liFrequency.QuadPart;
+}
+
+static HRESULT CreateSampleAllocator(LONG cBuffers, LONG cbBuffer, IMemAllocator **ppAllocator)
+{
+    HRESULT hr = S_OK;
+    CMemAllocator *pAllocator = new CMemAllocator(NAME("Benchmark allocator"), NULL, &hr);
+    if (pAllocator == NULL) {
+        return E_OUTOFMEMORY;
+    }
+    pAllocator->AddRef();
+
+    ALLOCATOR_PROPERTIES Request, Actual;
+    Request.cBuffers = cBuffers;
+    Request.cbBuffer = cbBuffer;
+    Request.cbAlign = 1;
+    Request.cbPrefix = 0;
+
+    if (SUCCEEDED(hr)) {
+        hr = pAllocator->SetProperties(&Request, &Actual);
+    }
+    if (SUCCEEDED(hr)) {
+        hr = pAllocator->Commit();
+    }
+    if (FAILED(hr)) {
+        pAllocator->Release();
+        return hr;
+    }
+
+    *ppAllocator = pAllocator;
+    return S_OK;
+}
+
+
+//
+//  Output queue benchmark
+//
+//  Pushes small samples from this thread through an output queue to a
+//  null renderer and times how long it takes until end of stream comes
+//  out the other side.
+//
+
+const LONG QUEUE_BENCHMARK_SAMPLES = 1000000;
+const LONG QUEUE_BENCHMARK_SAMPLE_SIZE = 188;
+const LONG QUEUE_BENCHMARK_BUFFERS = 1024;
+
+template <class TQueue>
+static HRESULT PushSamples(TQueue *pQueue,
+                           IMemAllocator *pAllocator,
+                           CNullRendererPin *pPin,
+                           __out double *pdSeconds)
+{
+    pPin->Reset();
+
+    LARGE_INTEGER liStart;
+    QueryPerformanceCounter(&liStart);
+
+    for (LONG i = 0; i < QUEUE_BENCHMARK_SAMPLES; i++) {
+        IMediaSample *pSample;
+        HRESULT hr = pAllocator->GetBuffer(&pSample, NULL, NULL, 0);
+        if (FAILED(hr)) {
+            return hr;
+        }
+        pSample->SetActualDataLength(QUEUE_BENCHMARK_SAMPLE_SIZE);
+
+        //  The queue releases the sample once it has been delivered
+        hr = pQueue->Receive(pSample);
+        if (hr != S_OK) {
+            return FAILED(hr) ? hr : E_FAIL;
+        }
+    }
+
+    pQueue->EOS();
+    if (!pPin->WaitForEndOfStream(60000)) {
+        return VFW_E_TIMEOUT;
+    }
+
+    *pdSeconds = ElapsedSeconds(liStart);
+    return S_OK;
+}
+
+static void PrintQueueResult(LPCTSTR pszName, CNullRendererPin *pPin, double dSeconds)
+{
+    _tprintf(_T("%-36s %10.0f samples/s  %8I64d calls  %6.1f samples/call\n"),
+             pszName,
+             pPin->GetSampleCount() / dSeconds,
+             pPin->GetCallCount(),
+             (double)pPin->GetSampleCount() / (double)max(pPin->GetCallCount(), 1));
+}
+
+static HRESULT BenchmarkOutputQueue()
+{
+    _tprintf(_T("Output queue: %d samples of %d bytes\n"),
+             QUEUE_BENCHMARK_SAMPLES, QUEUE_BENCHMARK_SAMPLE_SIZE);
+
+    IMemAllocator *pAllocator;
+    HRESULT hr = CreateSampleAllocator(QUEUE_BENCHMARK_BUFFERS, QUEUE_BENCHMARK_SAMPLE_SIZE, &pAllocator);
+    if (FAILED(hr)) {
+        return hr;
+    }
+
+    CNullRendererPin *pPin = new CNullRendererPin;
+    if (pPin == NULL) {
+        pAllocator->Release();
+        return E_OUTOFMEMORY;
+    }
+    pPin->AddRef();
+
+    //  COutputQueue with one sample per call and with batches
+    static const LONG alBatchSizes[] = { 1, 16 };
+    for (size_t i = 0; SUCCEEDED(hr) && i < NUMELMS(alBatchSizes); i++) {
+        COutputQueue *pQueue = new COutputQueue(pPin, &hr, FALSE, TRUE, alBatchSizes[i]);
+        if (pQueue == NULL) {
+            hr = E_OUTOFMEMORY;
+        }
+
+        double dSeconds = 0;
+        if (SUCCEEDED(hr)) {
+            hr = PushSamples(pQueue, pAllocator, pPin, &dSeconds);
+        }
+        if (SUCCEEDED(hr)) {
+            TCHAR szName[64];
+            _stprintf_s(szName, NUMELMS(szName), _T("COutputQueue, batch %d"), alBatchSizes[i]);
+            PrintQueueResult(szName, pPin, dSeconds);
+        }
+        delete pQueue;
+    }
+
+    //  CBatchedOutputQueue with the default ring, batch and latency
+    if (SUCCEEDED(hr)) {
+        CBatchedOutputQueue *pQueue = new CBatchedOutputQueue(pPin, &hr);
+        if (pQueue == NULL) {
+            hr = E_OUTOFMEMORY;
+        }
+
+        double dSeconds = 0;
+        if (SUCCEEDED(hr)) {
+            hr = PushSamples(pQueue, pAllocator, pPin, &dSeconds);
+        }
+        if (SUCCEEDED(hr)) {
+            LONGLONG llSamples, llBatches, llWakeups;
+            pQueue->GetStatistics(&llSamples, &llBatches, &llWakeups);
+            PrintQueueResult(_T("CBatchedOutputQueue, batch 16"), pPin, dSeconds);
+            _tprintf(_T("%-36s %10I64d thread wakeups\n"), _T(""), llWakeups);
+        }
+        delete pQueue;
+    }
+
+    pPin->Release();
+    pAllocator->Decommit();
+    pAllocator->Release();
+
+    if (FAILED(hr)) {
+        _tprintf(_T("Output queue benchmark failed - HRESULT 0x%8.8X\n"), hr);
+    }
+    return hr;
+}
+
+
+//
+//  Allocator benchmark
+//
+//  Plays a sequence of short clips the way a media player does, building
+//  a new allocator for every clip.  Each allocator commits a set of large
+//  video frame buffers, every page is touched once as a decoder would,
+//  and the buffers are released again at the end of the clip.
+//
+
+const LONG ALLOCATOR_BENCHMARK_CLIPS = 20;
+const LONG ALLOCATOR_BENCHMARK_BUFFERS = 30;
+const LONG ALLOCATOR_BENCHMARK_BUFFER_SIZE = 1920 * 1080 * 3 / 2;
+
+template <class TAllocator>
+static HRESULT PlayClips(__out double *pdSeconds)
+{
+    LARGE_INTEGER liStart;
+    QueryPerformanceCounter(&liStart);
+
+    for (LONG lClip = 0; lClip < ALLOCATOR_BENCHMARK_CLIPS; lClip++) {
+        HRESULT hr = S_OK;
+        TAllocator *pAllocator = new TAllocator(NAME("Benchmark allocator"), NULL, &hr);
+        if (pAllocator == NULL) {
+            return E_OUTOFMEMORY;
+        }
+        pAllocator->AddRef();
+
+        ALLOCATOR_PROPERTIES Request, Actual;
+        Request.cBuffers = ALLOCATOR_BENCHMARK_BUFFERS;
+        Request.cbBuffer = ALLOCATOR_BENCHMARK_BUFFER_SIZE;
+        Request.cbAlign = 64;
+        Request.cbPrefix = 0;
+
+        if (SUCCEEDED(hr)) {
+            hr = pAllocator->SetProperties(&Request, &Actual);
+        }
+        if (SUCCEEDED(hr)) {
+            hr = pAllocator->Commit();
+        }
+
+        //  Take every buffer once and write to each page of it
+        IMediaSample *apSamples[ALLOCATOR_BENCHMARK_BUFFERS];
+        LONG cSamples = 0;
+        while (SUCCEEDED(hr) && cSamples < ALLOCATOR_BENCHMARK_BUFFERS) {
+            hr = pAllocator->GetBuffer(&apSamples[cSamples], NULL, NULL, 0);
+            if (SUCCEEDED(hr)) {
+                BYTE *pbData;
+                apSamples[cSamples]->GetPointer(&pbData);
+                for (LONG lOffset = 0; lOffset < ALLOCATOR_BENCHMARK_BUFFER_SIZE; lOffset += 4096) {
+                    pbData[lOffset] = (BYTE)lClip;
+                }
+                cSamples++;
+            }
+        }
+        while (cSamples > 0) {
+            apSamples[--cSamples]->Release();
+        }
+
+        pAllocator->Decommit();
+        pAllocator->Release();
+        if (FAILED(hr)) {
+            return hr;
+        }
+    }
+
+    *pdSeconds = ElapsedSeconds(liStart);
+    return S_OK;
+}
+
+static HRESULT BenchmarkAllocator()
+{
+    _tprintf(_T("Allocator: %d clips, %d buffers of %d bytes each\n"),
+             ALLOCATOR_BENCHMARK_CLIPS, ALLOCATOR_BENCHMARK_BUFFERS, ALLOCATOR_BENCHMARK_BUFFER_SIZE);
+
+    double dSeconds = 0;
+    HRESULT hr = PlayClips<CMemAllocator>(&dSeconds);
+    if (SUCCEEDED(hr)) {
+        _tprintf(_T("%-36s %8.2f ms/clip\n"), _T("CMemAllocator"),
+                 dSeconds * 1000.0 / ALLOCATOR_BENCHMARK_CLIPS);
+        hr = PlayClips<CPooledMemAllocator>(&dSeconds);
+    }
+    if (SUCCEEDED(hr)) {
+        MEM_POOL_STATS Stats;
+        CMemBufferPool::GetPool()->GetStatistics(&Stats);
+        _tprintf(_T("%-36s %8.2f ms/clip\n"), _T("CPooledMemAllocator"),
+                 dSeconds * 1000.0 / ALLOCATOR_BENCHMARK_CLIPS);
+        _tprintf(_T("%-36s %8I64d fresh  %8I64d reused  %8I64d MB pooled\n"), _T(""),
+                 Stats.llFreshAllocations, Stats.llReusedAllocations,
+                 Stats.llPooledBytes / (1024 * 1024));
+    }
+
+    CMemBufferPool::GetPool()->Trim();
+
+    if (FAILED(hr)) {
+        _tprintf(_T("Allocator benchmark failed - HRESULT 0x%8.8X\n"), hr);
+    }
+    return hr;
+}
+
+
+//
+//  Schedule benchmark
+//
+//  Drives a CAMSchedule the way a reference clock's advise thread does,
+//  with thousands of periodic advises outstanding (one per renderer or
+//  timer), while one-shot advises come and go in between.  Simulated
+//  time advances by 1ms per call to Advise.
+//
+
+const LONG SCHEDULE_BENCHMARK_TICKS = 10000;
+const LONG SCHEDULE_BENCHMARK_SEMAPHORES = 16;
+
+static HRESULT RunSchedule(LONG cPeriodic, __out double *pdSeconds, __out LONGLONG *pllFired)
+{
+    HANDLE hEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+    HANDLE ahSemaphores[SCHEDULE_BENCHMARK_SEMAPHORES];
+    HANDLE hOneShot = CreateEvent(NULL, FALSE, FALSE, NULL);
+    LONG cSemaphores = 0;
+    HRESULT hr = (hEvent && hOneShot) ? S_OK : E_OUTOFMEMORY;
+
+    while (SUCCEEDED(hr) && cSemaphores < SCHEDULE_BENCHMARK_SEMAPHORES) {
+        ahSemaphores[cSemaphores] = CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL);
+        if (ahSemaphores[cSemaphores] == NULL) {
+            hr = E_OUTOFMEMORY;
+        } else {
+            cSemaphores++;
+        }
+    }
+
+    CAMSchedule *pSchedule = NULL;
+    if (SUCCEEDED(hr)) {
+        pSchedule = new CAMSchedule(hEvent);
+        if (pSchedule == NULL) {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    //  Periods of 1 to 40ms with staggered start times
+    const REFERENCE_TIME rtMillisecond = UNITS / MILLISECONDS;
+    for (LONG i = 0; SUCCEEDED(hr) && i < cPeriodic; i++) {
+        REFERENCE_TIME rtPeriod = (1 + i % 40) * rtMillisecond;
+        REFERENCE_TIME rtStart = (i * 7919) % rtPeriod;
+        if (pSchedule->AddAdvisePacket(rtStart, rtPeriod,
+                                       ahSemaphores[i % SCHEDULE_BENCHMARK_SEMAPHORES], TRUE) == 0) {
+            hr = E_OUTOFMEMORY;
+        }
+    }
+
+    LONGLONG llFired = 0;
+    if (SUCCEEDED(hr)) {
+        LARGE_INTEGER liStart;
+        QueryPerformanceCounter(&liStart);
+
+        DWORD_PTR dwPending = 0;
+        for (LONG lTick = 0; SUCCEEDED(hr) && lTick < SCHEDULE_BENCHMARK_TICKS; lTick++) {
+            REFERENCE_TIME rtNow = lTick * rtMillisecond;
+
+            //  A renderer waiting for a frame, which is often cancelled
+            //  before it is due because the frame was dropped
+            if (dwPending != 0) {
+                pSchedule->Unadvise(dwPending);
+            }
+            dwPending = pSchedule->AddAdvisePacket(rtNow + 5 * rtMillisecond, 0, hOneShot, FALSE);
+            if (dwPending == 0) {
+                hr = E_OUTOFMEMORY;
+            }
+
+            DWORD dwBefore = pSchedule->GetAdviseCount();
+            pSchedule->Advise(rtNow);
+            llFired += dwBefore - pSchedule->GetAdviseCount();
+        }
+
+        *pdSeconds = ElapsedSeconds(liStart);
+    }
+
+    //  Periodic advises stay in the schedule, count how many times they
+    //  fired from the semaphores
+    for (LONG i = 0; i < cSemaphores; i++) {
+        LONG lCount = 0;
+        if (ReleaseSemaphore(ahSemaphores[i], 1, &lCount)) {
+            llFired += lCount;
+        }
+    }
+    *pllFired = llFired;
+
+    if (pSchedule) {
+        //  Cookies are handed out in sequence starting at 1
+        for (DWORD_PTR dwCookie = 1; pSchedule->GetAdviseCount() > 0; dwCookie++) {
+            pSchedule->Unadvise(dwCookie);
+        }
+        delete pSchedule;
+    }
+    while (cSemaphores > 0) {
+        CloseHandle(ahSemaphores[--cSemaphores]);
+    }
+    if (hOneShot) {
+        CloseHandle(hOneShot);
+    }
+    if (hEvent) {
+        CloseHandle(hEvent);
+    }
+    return hr;
+}
+
+static HRESULT BenchmarkSchedule()
+{
+    _tprintf(_T("Schedule: %d ticks of 1ms\n"), SCHEDULE_BENCHMARK_TICKS);
+
+    HRESULT hr = S_OK;
+    static const LONG alPeriodic[] = { 100, 1000, 10000 };
+    for (size_t i = 0; SUCCEEDED(hr) && i < NUMELMS(alPeriodic); i++) {
+        double dSeconds = 0;
+        LONGLONG llFired = 0;
+        hr = RunSchedule(alPeriodic[i], &dSeconds, &llFired);
+        if (SUCCEEDED(hr)) {
+            TCHAR szName[64];
+            _stprintf_s(szName, NUMELMS(szName), _T("%d periodic advises"), alPeriodic[i]);
+            _tprintf(_T("%-36s %10.0f advises fired/s  %8.2f us/tick\n"),
+                     szName,
+                     llFired / dSeconds,
+                     dSeconds * 1000000.0 / SCHEDULE_BENCHMARK_TICKS);
+        }
+    }
+
+    if (FAILED(hr)) {
+        _tprintf(_T("Schedule benchmark failed - HRESULT 0x%8.8X\n"), hr);
+    }
+    return hr;
+}
+
+
+//
+//  Run one benchmark by name, or all of them
+//
+int RunBenchmark(LPCTSTR pszName)
+{
+    BOOL bAll = (pszName == NULL);
+    BOOL bFound = FALSE;
+    HRESULT hr = S_OK;
+
+    if (bAll || lstrcmpi(pszName, TEXT("queue")) == 0) {
+        bFound = TRUE;
+        hr = BenchmarkOutputQueue();
+    }
+
+    if (SUCCEEDED(hr) && (bAll || lstrcmpi(pszName, TEXT("allocator")) == 0)) {
+        bFound = TRUE;
+        hr = BenchmarkAllocator();
+    }
+
+    if (SUCCEEDED(hr) && (bAll || lstrcmpi(pszName, TEXT("schedule")) == 0)) {
+        bFound = TRUE;
+        hr = BenchmarkSchedule();
+    }
+
+    if (!bFound) {
+        _tprintf(_T("Unknown benchmark: %s\n"), pszName);
+        return 1;
+    }
+    return FAILED(hr) ? 1 : 0;
+}
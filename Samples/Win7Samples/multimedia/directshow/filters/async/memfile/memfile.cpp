@@ -26,9 +26,16 @@ int __cdecl _tmain( int argc, TCHAR* argv[] )
     if(argc < 2 || argc > 3)
     {
         _tprintf(_T("Usage : memfile FileName <Kbytes per sec>\n"));
+        _tprintf(_T("        memfile -benchmark <queue|allocator|schedule>\n"));
         return 0;
     }
 
+    /*  Time the base classes instead of playing a file */
+    if(lstrcmpi(argv[1], TEXT("-benchmark")) == 0)
+    {
+        return RunBenchmark(argc == 3 ? argv[2] : NULL);
+    }
+
     DWORD dwKBPerSec = (argc == 2 ? INFINITE : _ttoi(argv[2]));
     LPTSTR lpType;
 
@@ -117,3 +117,11 @@ public:
         m_mt = *pmt;
     }
 };
+
+
+//
+//  Benchmarks for the base classes, see Benchmark.cpp.  Runs all of them
+//  if pszName is NULL and returns the process exit code.
+//
+
+int RunBenchmark(LPCTSTR pszName);
@@ -0,0 +1,758 @@
+//------------------------------------------------------------------------------
+// File: Effects.cpp
+//
+// Desc: DirectShow sample code - image effect kernels used by the special
+//       effects filter and by the ezbench frame rate benchmark.
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+//
+// Every effect works on one scanline at a time, so a frame can be split
+// into bands of scanlines and the bands done on different threads.
+//
+// The SSE2 and AVX2 versions treat a scanline as a string of bytes (blue,
+// green, red, blue, ...) and work on blocks of 16 or 32 whole pixels at a
+// time, so the byte at a given position in a block is always the same
+// colour. Whatever is left at the end of a scanline is done by the scalar
+// code. AVX2 needs Visual C++ 2012 or later to build.
+//
+
+#include <windows.h>
+#include <intrin.h>
+#include <emmintrin.h>
+
+#if (_MSC_VER >= 1700)
+#include <immintrin.h>
+#define EFFECT_AVX2
+#endif
+
+#include "effects.h"
+#include "resource.h"
+
+
+//
+// GetBestEffectIsa
+//
+// Checks the processor, and for AVX2 that the operating system saves the
+// YMM registers
+//
+EFFECT_ISA GetBestEffectIsa()
+{
+    int info[4];
+
+    __cpuid(info, 0);
+    int cIds = info[0];
+
+    __cpuid(info, 1);
+    BOOL bSSE2 = (info[3] & (1 << 26)) != 0;
+
+#ifdef EFFECT_AVX2
+    BOOL bOSXSAVE = (info[2] & (1 << 27)) != 0;
+    BOOL bAVX = (info[2] & (1 << 28)) != 0;
+
+    if (cIds >= 7 && bOSXSAVE && bAVX && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return EFFECT_ISA_AVX2;
+        }
+    }
+#endif
+
+    return bSSE2 ? EFFECT_ISA_SSE2 : EFFECT_ISA_SCALAR;
+
+} // GetBestEffectIsa
+
+
+//
+// EffectRowScalar
+//
+// The original per pixel loops, applied to pixels xFirst onwards of one
+// scanline. The SIMD versions use this for the ends of scanlines, passing
+// the grey value pixel xFirst - 1 had before it was embossed in greyLeft.
+//
+static void EffectRowScalar(int effect,
+                            BYTE *pRow,
+                            int xFirst,
+                            int cx,
+                            unsigned int greyLeft)
+{
+    RGBTRIPLE *prgb = (RGBTRIPLE *) pRow + xFirst;
+    unsigned int grey,grey2;
+    int temp,x;
+
+    switch (effect)
+    {
+        case IDC_RED:
+            for (x = xFirst; x < cx; x++, prgb++) {
+                prgb->rgbtGreen = 0;
+                prgb->rgbtBlue = 0;
+            }
+            break;
+
+        case IDC_GREEN:
+            for (x = xFirst; x < cx; x++, prgb++) {
+                prgb->rgbtRed = 0;
+                prgb->rgbtBlue = 0;
+            }
+            break;
+
+        case IDC_BLUE:
+            for (x = xFirst; x < cx; x++, prgb++) {
+                prgb->rgbtRed = 0;
+                prgb->rgbtGreen = 0;
+            }
+            break;
+
+        case IDC_DARKEN:
+            for (x = xFirst; x < cx; x++, prgb++) {
+                prgb->rgbtRed   = (BYTE) (prgb->rgbtRed >> 1);
+                prgb->rgbtGreen = (BYTE) (prgb->rgbtGreen >> 1);
+                prgb->rgbtBlue  = (BYTE) (prgb->rgbtBlue >> 1);
+            }
+            break;
+
+        case IDC_XOR:
+            for (x = xFirst; x < cx; x++, prgb++) {
+                prgb->rgbtRed   = (BYTE) (prgb->rgbtRed ^ 0xff);
+                prgb->rgbtGreen = (BYTE) (prgb->rgbtGreen ^ 0xff);
+                prgb->rgbtBlue  = (BYTE) (prgb->rgbtBlue ^ 0xff);
+            }
+            break;
+
+        case IDC_POSTERIZE:
+            for (x = xFirst; x < cx; x++, prgb++) {
+                prgb->rgbtRed   = (BYTE) (prgb->rgbtRed & 0xe0);
+                prgb->rgbtGreen = (BYTE) (prgb->rgbtGreen & 0xe0);
+                prgb->rgbtBlue  = (BYTE) (prgb->rgbtBlue & 0xe0);
+            }
+            break;
+
+        // The last two pixels have no neighbour two to the right and
+        // are left alone
+
+        case IDC_BLUR:
+            for (x = xFirst; x < cx - 2; x++, prgb++) {
+                prgb->rgbtRed   = (BYTE) ((prgb->rgbtRed + prgb[2].rgbtRed) >> 1);
+                prgb->rgbtGreen = (BYTE) ((prgb->rgbtGreen + prgb[2].rgbtGreen) >> 1);
+                prgb->rgbtBlue  = (BYTE) ((prgb->rgbtBlue + prgb[2].rgbtBlue) >> 1);
+            }
+            break;
+
+        case IDC_GREY:
+            for (x = xFirst; x < cx; x++, prgb++) {
+                grey = (prgb->rgbtRed + prgb->rgbtGreen) >> 1;
+                prgb->rgbtRed = prgb->rgbtGreen = prgb->rgbtBlue = (BYTE) grey;
+            }
+            break;
+
+        // The first pixel of a scanline has no neighbour to compare with
+        // and becomes mid grey
+
+        case IDC_EMBOSS:
+            if (xFirst == 0 && cx > 0) {
+                grey2 = (prgb->rgbtRed + prgb->rgbtGreen) >> 1;
+                prgb->rgbtRed = prgb->rgbtGreen = prgb->rgbtBlue = (BYTE) 128;
+                prgb++;
+                xFirst = 1;
+            } else {
+                grey2 = greyLeft;
+            }
+
+            for (x = xFirst; x < cx; x++, prgb++) {
+                grey = (prgb->rgbtRed + prgb->rgbtGreen) >> 1;
+                temp = grey - grey2;
+                if (temp > 127) temp = 127;
+                if (temp < -127) temp = -127;
+                temp += 128;
+                prgb->rgbtRed = prgb->rgbtGreen = prgb->rgbtBlue = (BYTE) temp;
+                grey2 = grey;
+            }
+            break;
+    }
+
+} // EffectRowScalar
+
+
+//
+// SSE2
+//
+
+// Bytes of a 16 byte chunk that hold colour iColour (0 blue, 1 green,
+// 2 red) when the chunk starts iFirstByte bytes into a block of pixels
+static __m128i ColourMaskSSE2(int iColour, int iFirstByte)
+{
+    BYTE ab[16];
+    for (int i = 0; i < 16; i++) {
+        ab[i] = (BYTE) (((iFirstByte + i) % 3 == iColour) ? 0xff : 0);
+    }
+    return _mm_loadu_si128((const __m128i *) ab);
+}
+
+// (a + b) >> 1 for each byte, pavgb on its own rounds up
+static __forceinline __m128i AverageDownSSE2(__m128i a, __m128i b)
+{
+    return _mm_sub_epi8(_mm_avg_epu8(a, b),
+                        _mm_and_si128(_mm_xor_si128(a, b), _mm_set1_epi8(1)));
+}
+
+// Sets all three bytes of each of the 16 pixels in v to (red + green) / 2.
+// Each byte finds the green and red of its own pixel one or two bytes
+// away, depending on which colour it is.
+static __forceinline void GreyBlockSSE2(const __m128i v[3],
+                                        const __m128i mColour[3][3],
+                                        __m128i grey[3])
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    for (int c = 0; c < 3; c++) {
+        __m128i prev = c > 0 ? v[c - 1] : zero;
+        __m128i next = c < 2 ? v[c + 1] : zero;
+
+        __m128i back1 = _mm_or_si128(_mm_slli_si128(v[c], 1), _mm_srli_si128(prev, 15));
+        __m128i ahead1 = _mm_or_si128(_mm_srli_si128(v[c], 1), _mm_slli_si128(next, 15));
+        __m128i ahead2 = _mm_or_si128(_mm_srli_si128(v[c], 2), _mm_slli_si128(next, 14));
+
+        __m128i green = _mm_or_si128(_mm_or_si128(
+                            _mm_and_si128(ahead1, mColour[c][0]),
+                            _mm_and_si128(v[c], mColour[c][1])),
+                            _mm_and_si128(back1, mColour[c][2]));
+        __m128i red = _mm_or_si128(_mm_or_si128(
+                            _mm_and_si128(ahead2, mColour[c][0]),
+                            _mm_and_si128(ahead1, mColour[c][1])),
+                            _mm_and_si128(v[c], mColour[c][2]));
+
+        grey[c] = AverageDownSSE2(green, red);
+    }
+}
+
+static void ApplyEffectToRowsSSE2(int effect,
+                                  BYTE *pBits,
+                                  LONG lStride,
+                                  int cx,
+                                  int yFirst,
+                                  int yLast)
+{
+    // A block is 16 pixels in three 16 byte chunks
+    __m128i mColour[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            mColour[c][k] = ColourMaskSSE2(k, 16 * c);
+        }
+    }
+
+    // The bits each byte keeps for the masking effects
+    __m128i mKeep[3];
+    for (int c = 0; c < 3; c++) {
+        switch (effect) {
+            case IDC_RED:       mKeep[c] = mColour[c][2]; break;
+            case IDC_GREEN:     mKeep[c] = mColour[c][1]; break;
+            case IDC_BLUE:      mKeep[c] = mColour[c][0]; break;
+            default:            mKeep[c] = _mm_set1_epi8((char) 0xe0); break;
+        }
+    }
+
+    const __m128i lowSeven = _mm_set1_epi8(0x7f);
+    const __m128i allOnes = _mm_set1_epi8((char) 0xff);
+    const __m128i midGrey = _mm_set1_epi8((char) 0x80);
+
+    for (int y = yFirst; y < yLast; y++) {
+
+        BYTE *pRow = pBits + y * lStride;
+        int x = 0;                      // First pixel left for the scalar code
+        unsigned int greyLeft = 0;      // Emboss only
+        int b;
+
+        switch (effect)
+        {
+            case IDC_RED:
+            case IDC_GREEN:
+            case IDC_BLUE:
+            case IDC_POSTERIZE:
+                for (b = 0; b < cx / 16; b++) {
+                    __m128i *p = (__m128i *) (pRow + 48 * b);
+                    for (int c = 0; c < 3; c++) {
+                        _mm_storeu_si128(p + c, _mm_and_si128(_mm_loadu_si128(p + c), mKeep[c]));
+                    }
+                }
+                x = b * 16;
+                break;
+
+            case IDC_DARKEN:
+                for (b = 0; b < cx / 16; b++) {
+                    __m128i *p = (__m128i *) (pRow + 48 * b);
+                    for (int c = 0; c < 3; c++) {
+                        __m128i v = _mm_loadu_si128(p + c);
+                        _mm_storeu_si128(p + c, _mm_and_si128(_mm_srli_epi16(v, 1), lowSeven));
+                    }
+                }
+                x = b * 16;
+                break;
+
+            case IDC_XOR:
+                for (b = 0; b < cx / 16; b++) {
+                    __m128i *p = (__m128i *) (pRow + 48 * b);
+                    for (int c = 0; c < 3; c++) {
+                        _mm_storeu_si128(p + c, _mm_xor_si128(_mm_loadu_si128(p + c), allOnes));
+                    }
+                }
+                x = b * 16;
+                break;
+
+            // Each byte is averaged with the one 6 bytes on. Every chunk
+            // reads its neighbour before anything at or beyond it is
+            // written, so this can be done in place.
+
+            case IDC_BLUR:
+                for (b = 0; 48 * (b + 1) <= (cx - 2) * 3; b++) {
+                    BYTE *p = pRow + 48 * b;
+                    for (int c = 0; c < 3; c++) {
+                        __m128i v = _mm_loadu_si128((const __m128i *) (p + 16 * c));
+                        __m128i right = _mm_loadu_si128((const __m128i *) (p + 16 * c + 6));
+                        _mm_storeu_si128((__m128i *) (p + 16 * c), AverageDownSSE2(v, right));
+                    }
+                }
+                x = b * 16;
+                break;
+
+            case IDC_GREY:
+                for (b = 0; b < cx / 16; b++) {
+                    __m128i *p = (__m128i *) (pRow + 48 * b);
+                    __m128i v[3], grey[3];
+                    for (int c = 0; c < 3; c++) {
+                        v[c] = _mm_loadu_si128(p + c);
+                    }
+                    GreyBlockSSE2(v, mColour, grey);
+                    for (int c = 0; c < 3; c++) {
+                        _mm_storeu_si128(p + c, grey[c]);
+                    }
+                }
+                x = b * 16;
+                break;
+
+            // Blocks start at the second pixel. The difference to the pixel
+            // on the left is split into its positive and negative parts so
+            // it can be done with unsigned saturating bytes.
+
+            case IDC_EMBOSS:
+                if (cx == 0) {
+                    break;
+                }
+                greyLeft = (pRow[1] + pRow[2]) >> 1;
+                pRow[0] = pRow[1] = pRow[2] = 128;
+                x = 1;
+
+                for (b = 0; b < (cx - 1) / 16; b++) {
+                    __m128i *p = (__m128i *) (pRow + 3 + 48 * b);
+                    __m128i v[3], grey[3];
+                    for (int c = 0; c < 3; c++) {
+                        v[c] = _mm_loadu_si128(p + c);
+                    }
+                    GreyBlockSSE2(v, mColour, grey);
+
+                    for (int c = 0; c < 3; c++) {
+                        __m128i prev = c > 0 ? grey[c - 1] : _mm_set1_epi8((char) greyLeft);
+                        __m128i left = _mm_or_si128(_mm_slli_si128(grey[c], 3), _mm_srli_si128(prev, 13));
+
+                        __m128i up = _mm_min_epu8(_mm_subs_epu8(grey[c], left), lowSeven);
+                        __m128i down = _mm_min_epu8(_mm_subs_epu8(left, grey[c]), lowSeven);
+                        _mm_storeu_si128(p + c, _mm_sub_epi8(_mm_add_epi8(up, midGrey), down));
+                    }
+                    greyLeft = _mm_extract_epi16(grey[2], 7) >> 8;
+                }
+                x = 1 + b * 16;
+                break;
+        }
+
+        EffectRowScalar(effect, pRow, x, cx, greyLeft);
+    }
+
+} // ApplyEffectToRowsSSE2
+
+
+#ifdef EFFECT_AVX2
+
+//
+// AVX2
+//
+// The same as the SSE2 code with 32 pixels to a block. Shifting bytes
+// between the two 128 bit halves of a register takes a permute, done by
+// these two macros.
+//
+
+// Bytes of a moved k places up, the first k coming from the top of prev
+#define SHIFT_UP_AVX2(a, prev, k) \
+    _mm256_alignr_epi8((a), _mm256_permute2x128_si256((prev), (a), 0x21), 16 - (k))
+
+// Bytes of a moved k places down, the last k coming from the bottom of next
+#define SHIFT_DOWN_AVX2(a, next, k) \
+    _mm256_alignr_epi8(_mm256_permute2x128_si256((a), (next), 0x21), (a), (k))
+
+static __m256i ColourMaskAVX2(int iColour, int iFirstByte)
+{
+    BYTE ab[32];
+    for (int i = 0; i < 32; i++) {
+        ab[i] = (BYTE) (((iFirstByte + i) % 3 == iColour) ? 0xff : 0);
+    }
+    return _mm256_loadu_si256((const __m256i *) ab);
+}
+
+static __forceinline __m256i AverageDownAVX2(__m256i a, __m256i b)
+{
+    return _mm256_sub_epi8(_mm256_avg_epu8(a, b),
+                           _mm256_and_si256(_mm256_xor_si256(a, b), _mm256_set1_epi8(1)));
+}
+
+static __forceinline void GreyBlockAVX2(const __m256i v[3],
+                                        const __m256i mColour[3][3],
+                                        __m256i grey[3])
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    for (int c = 0; c < 3; c++) {
+        __m256i prev = c > 0 ? v[c - 1] : zero;
+        __m256i next = c < 2 ? v[c + 1] : zero;
+
+        __m256i back1 = SHIFT_UP_AVX2(v[c], prev, 1);
+        __m256i ahead1 = SHIFT_DOWN_AVX2(v[c], next, 1);
+        __m256i ahead2 = SHIFT_DOWN_AVX2(v[c], next, 2);
+
+        __m256i green = _mm256_or_si256(_mm256_or_si256(
+                            _mm256_and_si256(ahead1, mColour[c][0]),
+                            _mm256_and_si256(v[c], mColour[c][1])),
+                            _mm256_and_si256(back1, mColour[c][2]));
+        __m256i red = _mm256_or_si256(_mm256_or_si256(
+                            _mm256_and_si256(ahead2, mColour[c][0]),
+                            _mm256_and_si256(ahead1, mColour[c][1])),
+                            _mm256_and_si256(v[c], mColour[c][2]));
+
+        grey[c] = AverageDownAVX2(green, red);
+    }
+}
+
+static void ApplyEffectToRowsAVX2(int effect,
+                                  BYTE *pBits,
+                                  LONG lStride,
+                                  int cx,
+                                  int yFirst,
+                                  int yLast)
+{
+    // A block is 32 pixels in three 32 byte chunks
+    __m256i mColour[3][3];
+    for (int c = 0; c < 3; c++) {
+        for (int k = 0; k < 3; k++) {
+            mColour[c][k] = ColourMaskAVX2(k, 32 * c);
+        }
+    }
+
+    __m256i mKeep[3];
+    for (int c = 0; c < 3; c++) {
+        switch (effect) {
+            case IDC_RED:       mKeep[c] = mColour[c][2]; break;
+            case IDC_GREEN:     mKeep[c] = mColour[c][1]; break;
+            case IDC_BLUE:      mKeep[c] = mColour[c][0]; break;
+            default:            mKeep[c] = _mm256_set1_epi8((char) 0xe0); break;
+        }
+    }
+
+    const __m256i lowSeven = _mm256_set1_epi8(0x7f);
+    const __m256i allOnes = _mm256_set1_epi8((char) 0xff);
+    const __m256i midGrey = _mm256_set1_epi8((char) 0x80);
+
+    for (int y = yFirst; y < yLast; y++) {
+
+        BYTE *pRow = pBits + y * lStride;
+        int x = 0;
+        unsigned int greyLeft = 0;
+        int b;
+
+        switch (effect)
+        {
+            case IDC_RED:
+            case IDC_GREEN:
+            case IDC_BLUE:
+            case IDC_POSTERIZE:
+                for (b = 0; b < cx / 32; b++) {
+                    __m256i *p = (__m256i *) (pRow + 96 * b);
+                    for (int c = 0; c < 3; c++) {
+                        _mm256_storeu_si256(p + c, _mm256_and_si256(_mm256_loadu_si256(p + c), mKeep[c]));
+                    }
+                }
+                x = b * 32;
+                break;
+
+            case IDC_DARKEN:
+                for (b = 0; b < cx / 32; b++) {
+                    __m256i *p = (__m256i *) (pRow + 96 * b);
+                    for (int c = 0; c < 3; c++) {
+                        __m256i v = _mm256_loadu_si256(p + c);
+                        _mm256_storeu_si256(p + c, _mm256_and_si256(_mm256_srli_epi16(v, 1), lowSeven));
+                    }
+                }
+                x = b * 32;
+                break;
+
+            case IDC_XOR:
+                for (b = 0; b < cx / 32; b++) {
+                    __m256i *p = (__m256i *) (pRow + 96 * b);
+                    for (int c = 0; c < 3; c++) {
+                        _mm256_storeu_si256(p + c, _mm256_xor_si256(_mm256_loadu_si256(p + c), allOnes));
+                    }
+                }
+                x = b * 32;
+                break;
+
+            case IDC_BLUR:
+                for (b = 0; 96 * (b + 1) <= (cx - 2) * 3; b++) {
+                    BYTE *p = pRow + 96 * b;
+                    for (int c = 0; c < 3; c++) {
+                        __m256i v = _mm256_loadu_si256((const __m256i *) (p + 32 * c));
+                        __m256i right = _mm256_loadu_si256((const __m256i *) (p + 32 * c + 6));
+                        _mm256_storeu_si256((__m256i *) (p + 32 * c), AverageDownAVX2(v, right));
+                    }
+                }
+                x = b * 32;
+                break;
+
+            case IDC_GREY:
+                for (b = 0; b < cx / 32; b++) {
+                    __m256i *p = (__m256i *) (pRow + 96 * b);
+                    __m256i v[3], grey[3];
+                    for (int c = 0; c < 3; c++) {
+                        v[c] = _mm256_loadu_si256(p + c);
+                    }
+                    GreyBlockAVX2(v, mColour, grey);
+                    for (int c = 0; c < 3; c++) {
+                        _mm256_storeu_si256(p + c, grey[c]);
+                    }
+                }
+                x = b * 32;
+                break;
+
+            case IDC_EMBOSS:
+                if (cx == 0) {
+                    break;
+                }
+                greyLeft = (pRow[1] + pRow[2]) >> 1;
+                pRow[0] = pRow[1] = pRow[2] = 128;
+                x = 1;
+
+                for (b = 0; b < (cx - 1) / 32; b++) {
+                    __m256i *p = (__m256i *) (pRow + 3 + 96 * b);
+                    __m256i v[3], grey[3];
+                    for (int c = 0; c < 3; c++) {
+                        v[c] = _mm256_loadu_si256(p + c);
+                    }
+                    GreyBlockAVX2(v, mColour, grey);
+
+                    for (int c = 0; c < 3; c++) {
+                        __m256i prev = c > 0 ? grey[c - 1] : _mm256_set1_epi8((char) greyLeft);
+                        __m256i left = SHIFT_UP_AVX2(grey[c], prev, 3);
+
+                        __m256i up = _mm256_min_epu8(_mm256_subs_epu8(grey[c], left), lowSeven);
+                        __m256i down = _mm256_min_epu8(_mm256_subs_epu8(left, grey[c]), lowSeven);
+                        _mm256_storeu_si256(p + c, _mm256_sub_epi8(_mm256_add_epi8(up, midGrey), down));
+                    }
+                    greyLeft = _mm_extract_epi16(_mm256_extracti128_si256(grey[2], 1), 7) >> 8;
+                }
+                x = 1 + b * 32;
+                break;
+        }
+
+        EffectRowScalar(effect, pRow, x, cx, greyLeft);
+    }
+
+    _mm256_zeroupper();
+
+} // ApplyEffectToRowsAVX2
+
+#endif // EFFECT_AVX2
+
+
+//
+// ApplyEffectToRows
+//
+void ApplyEffectToRows(int effect,
+                       BYTE *pBits,
+                       LONG lStride,
+                       int cx,
+                       int yFirst,
+                       int yLast,
+                       EFFECT_ISA isa)
+{
+    if (effect == IDC_NONE) {
+        return;
+    }
+
+    switch (isa)
+    {
+#ifdef EFFECT_AVX2
+        case EFFECT_ISA_AVX2:
+            ApplyEffectToRowsAVX2(effect, pBits, lStride, cx, yFirst, yLast);
+            break;
+#endif
+
+        case EFFECT_ISA_SSE2:
+            ApplyEffectToRowsSSE2(effect, pBits, lStride, cx, yFirst, yLast);
+            break;
+
+        default:
+            for (int y = yFirst; y < yLast; y++) {
+                EffectRowScalar(effect, pBits + y * lStride, 0, cx, 0);
+            }
+            break;
+    }
+
+} // ApplyEffectToRows
+
+
+//
+// CEffectBands
+//
+
+CEffectBands::CEffectBands() :
+    m_cThreads(0),
+    m_bExit(FALSE)
+{
+    ZeroMemory(m_Workers, sizeof(m_Workers));
+
+} // (Constructor)
+
+
+CEffectBands::~CEffectBands()
+{
+    Stop();
+
+} // (Destructor)
+
+
+//
+// Start
+//
+HRESULT CEffectBands::Start(int cThreads)
+{
+    Stop();
+
+    if (cThreads > MAX_THREADS) {
+        cThreads = MAX_THREADS;
+    }
+
+    m_bExit = FALSE;
+
+    for (int i = 0; i < cThreads; i++) {
+        WORKER *pWorker = &m_Workers[i];
+        pWorker->pOwner = this;
+        pWorker->iBand = i + 1;
+        pWorker->hThread = NULL;
+        pWorker->hGo = CreateEvent(NULL, FALSE, FALSE, NULL);
+        pWorker->hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+        if (pWorker->hGo && pWorker->hDone) {
+            pWorker->hThread = CreateThread(NULL, 0, WorkerThreadProc, pWorker, 0, NULL);
+        }
+
+        if (pWorker->hThread == NULL) {
+            HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+            if (pWorker->hGo) CloseHandle(pWorker->hGo);
+            if (pWorker->hDone) CloseHandle(pWorker->hDone);
+            Stop();
+            return FAILED(hr) ? hr : E_OUTOFMEMORY;
+        }
+
+        m_hDone[i] = pWorker->hDone;
+        m_cThreads++;
+    }
+    return NOERROR;
+
+} // Start
+
+
+//
+// Stop
+//
+void CEffectBands::Stop()
+{
+    m_bExit = TRUE;
+
+    for (int i = 0; i < m_cThreads; i++) {
+        SetEvent(m_Workers[i].hGo);
+    }
+
+    for (int i = 0; i < m_cThreads; i++) {
+        WaitForSingleObject(m_Workers[i].hThread, INFINITE);
+        CloseHandle(m_Workers[i].hThread);
+        CloseHandle(m_Workers[i].hGo);
+        CloseHandle(m_Workers[i].hDone);
+    }
+    m_cThreads = 0;
+
+} // Stop
+
+
+//
+// Apply
+//
+void CEffectBands::Apply(int effect,
+                         BYTE *pBits,
+                         LONG lStride,
+                         int cx,
+                         int cy,
+                         EFFECT_ISA isa)
+{
+    if (m_cThreads == 0 || cx * cy < MIN_BAND_PIXELS) {
+        ApplyEffectToRows(effect, pBits, lStride, cx, 0, cy, isa);
+        return;
+    }
+
+    m_effect = effect;
+    m_pBits = pBits;
+    m_lStride = lStride;
+    m_cx = cx;
+    m_cy = cy;
+    m_cBands = m_cThreads + 1;
+    m_isa = isa;
+
+    for (int i = 0; i < m_cThreads; i++) {
+        SetEvent(m_Workers[i].hGo);
+    }
+
+    DoBand(0);
+
+    WaitForMultipleObjects(m_cThreads, m_hDone, TRUE, INFINITE);
+
+} // Apply
+
+
+//
+// DoBand
+//
+void CEffectBands::DoBand(int iBand)
+{
+    int yFirst = m_cy * iBand / m_cBands;
+    int yLast = m_cy * (iBand + 1) / m_cBands;
+
+    ApplyEffectToRows(m_effect, m_pBits, m_lStride, m_cx, yFirst, yLast, m_isa);
+
+} // DoBand
+
+
+//
+// WorkerThreadProc
+//
+DWORD WINAPI CEffectBands::WorkerThreadProc(LPVOID pv)
+{
+    WORKER *pWorker = (WORKER *) pv;
+    CEffectBands *pThis = pWorker->pOwner;
+
+    for (;;) {
+        WaitForSingleObject(pWorker->hGo, INFINITE);
+        if (pThis->m_bExit) {
+            return 0;
+        }
+        pThis->DoBand(pWorker->iBand);
+        SetEvent(pWorker->hDone);
+    }
+
+} // WorkerThreadProc
+
@@ -0,0 +1,99 @@
+//------------------------------------------------------------------------------
+// File: Effects.h
+//
+// Desc: DirectShow sample code - image effect kernels used by the special
+//       effects filter and by the ezbench frame rate benchmark.
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+//
+// Which instructions the effect kernels may use. Every level produces
+// exactly the same pixels as the scalar code.
+//
+enum EFFECT_ISA
+{
+    EFFECT_ISA_SCALAR,
+    EFFECT_ISA_SSE2,
+    EFFECT_ISA_AVX2
+};
+
+// The fastest level this processor and compiler support
+EFFECT_ISA GetBestEffectIsa();
+
+//
+// Apply one of the IDC_ effects from resource.h to scanlines yFirst up to
+// (but not including) yLast of an RGB24 image. Each scanline is lStride
+// bytes and holds cx pixels. Scanlines are independent of each other, so
+// different ranges can be processed at the same time.
+//
+void ApplyEffectToRows(int effect,
+                       BYTE *pBits,
+                       LONG lStride,
+                       int cx,
+                       int yFirst,
+                       int yLast,
+                       EFFECT_ISA isa);
+
+
+//
+// CEffectBands
+//
+// Splits a frame into bands of scanlines and applies the effect to them
+// on a set of worker threads, the calling thread doing the first band.
+//
+class CEffectBands
+{
+
+public:
+
+    CEffectBands();
+    ~CEffectBands();
+
+    // Create cThreads worker threads (0 runs everything on the caller)
+    HRESULT Start(int cThreads);
+    void Stop();
+
+    // Frames smaller than this are not worth splitting up
+    enum { MIN_BAND_PIXELS = 1280 * 720 };
+
+    void Apply(int effect,
+               BYTE *pBits,
+               LONG lStride,
+               int cx,
+               int cy,
+               EFFECT_ISA isa);
+
+private:
+
+    enum { MAX_THREADS = 16 };
+
+    struct WORKER
+    {
+        CEffectBands *pOwner;
+        int         iBand;              // Band this thread does
+        HANDLE      hThread;
+        HANDLE      hGo;                // Set to start a band
+        HANDLE      hDone;              // Set when it is finished
+    };
+
+    static DWORD WINAPI WorkerThreadProc(LPVOID pv);
+    void DoBand(int iBand);
+
+    int         m_cThreads;
+    WORKER      m_Workers[MAX_THREADS];
+    HANDLE      m_hDone[MAX_THREADS];   // Copies of the hDone handles
+    volatile BOOL m_bExit;
+
+    // The frame being worked on, written before any hGo is set
+    int         m_effect;
+    BYTE       *m_pBits;
+    LONG        m_lStride;
+    int         m_cx;
+    int         m_cy;
+    int         m_cBands;
+    EFFECT_ISA  m_isa;
+
+}; // CEffectBands
+
@@ -0,0 +1,212 @@
+//------------------------------------------------------------------------------
+// File: EZBench.cpp
+//
+// Desc: DirectShow sample code - frame rate benchmark for the special
+//       effects filter. Feeds made up RGB24 frames through the effect code
+//       the filter uses, with the plain, SSE2 and AVX2 kernels on a single
+//       thread and with the frame split into bands over all processors.
+//
+//       Usage: ezbench [width height [frames]]
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tchar.h>
+
+#include "..\effects.h"
+#include "..\resource.h"
+
+
+struct EFFECT_NAME
+{
+    int     effect;
+    LPCTSTR pszName;
+};
+
+static const EFFECT_NAME g_Effects[] =
+{
+    { IDC_RED,       TEXT("Red") },
+    { IDC_GREEN,     TEXT("Green") },
+    { IDC_BLUE,      TEXT("Blue") },
+    { IDC_DARKEN,    TEXT("Darken") },
+    { IDC_XOR,       TEXT("X-ray") },
+    { IDC_POSTERIZE, TEXT("Posterize") },
+    { IDC_BLUR,      TEXT("Blur") },
+    { IDC_GREY,      TEXT("Grey") },
+    { IDC_EMBOSS,    TEXT("Emboss") },
+};
+
+static const LPCTSTR g_IsaNames[] = { TEXT("Scalar"), TEXT("SSE2"), TEXT("AVX2") };
+
+
+//
+// FillFrame
+//
+// Gradients with some noise on top, so neighbouring pixels differ the
+// way they do in real video
+//
+static void FillFrame(BYTE *pBits, LONG lStride, int cx, int cy)
+{
+    DWORD dwSeed = 12345;
+
+    for (int y = 0; y < cy; y++) {
+        RGBTRIPLE *prgb = (RGBTRIPLE *) (pBits + y * lStride);
+        for (int x = 0; x < cx; x++, prgb++) {
+            dwSeed = dwSeed * 1103515245 + 12345;
+            BYTE bNoise = (BYTE) ((dwSeed >> 16) & 0x1f);
+            prgb->rgbtRed   = (BYTE) (x * 255 / cx + bNoise);
+            prgb->rgbtGreen = (BYTE) (y * 255 / cy + bNoise);
+            prgb->rgbtBlue  = (BYTE) ((x + y) + bNoise);
+        }
+    }
+
+} // FillFrame
+
+
+//
+// TimeEffect
+//
+// Returns frames per second, or 0 if the output differs from the plain
+// code's output in pReference
+//
+static double TimeEffect(int effect,
+                         const BYTE *pSource,
+                         const BYTE *pReference,
+                         BYTE *pWork,
+                         LONG lStride,
+                         int cx,
+                         int cy,
+                         int cFrames,
+                         EFFECT_ISA isa,
+                         CEffectBands *pBands)
+{
+    const SIZE_T cbFrame = (SIZE_T) lStride * cy;
+
+    // Check this version does exactly what the plain one does
+
+    CopyMemory(pWork, pSource, cbFrame);
+    if (pBands) {
+        pBands->Apply(effect, pWork, lStride, cx, cy, isa);
+    } else {
+        ApplyEffectToRows(effect, pWork, lStride, cx, 0, cy, isa);
+    }
+    if (memcmp(pWork, pReference, cbFrame) != 0) {
+        return 0;
+    }
+
+    // The effects take the same time whatever is in the frame, so keep
+    // applying them to the same buffer
+
+    LARGE_INTEGER liStart, liStop, liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liStart);
+
+    for (int i = 0; i < cFrames; i++) {
+        if (pBands) {
+            pBands->Apply(effect, pWork, lStride, cx, cy, isa);
+        } else {
+            ApplyEffectToRows(effect, pWork, lStride, cx, 0, cy, isa);
+        }
+    }
+
+    QueryPerformanceCounter(&liStop);
+    double dSeconds = (double) (liStop.QuadPart - liStart.QuadPart) / (double) liFrequency.QuadPart;
+    return cFrames / max(dSeconds, 1e-9);
+
+} // TimeEffect
+
+
+int __cdecl _tmain(int argc, TCHAR *argv[])
+{
+    int cx = 1920;
+    int cy = 1080;
+    int cFrames = 200;
+
+    if (argc >= 3) {
+        cx = _ttoi(argv[1]);
+        cy = _ttoi(argv[2]);
+    }
+    if (argc >= 4) {
+        cFrames = _ttoi(argv[3]);
+    }
+    if (cx <= 0 || cy <= 0 || cFrames <= 0) {
+        _tprintf(TEXT("Usage: ezbench [width height [frames]]\n"));
+        return 1;
+    }
+
+    // Scanlines are padded to a DWORD like a DIB
+
+    LONG lStride = (cx * 3 + 3) & ~3;
+    SIZE_T cbFrame = (SIZE_T) lStride * cy;
+
+    BYTE *pSource = (BYTE *) VirtualAlloc(NULL, cbFrame, MEM_COMMIT, PAGE_READWRITE);
+    BYTE *pReference = (BYTE *) VirtualAlloc(NULL, cbFrame, MEM_COMMIT, PAGE_READWRITE);
+    BYTE *pWork = (BYTE *) VirtualAlloc(NULL, cbFrame, MEM_COMMIT, PAGE_READWRITE);
+    if (!pSource || !pReference || !pWork) {
+        _tprintf(TEXT("Out of memory\n"));
+        return 1;
+    }
+    FillFrame(pSource, lStride, cx, cy);
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+
+    CEffectBands Bands;
+    HRESULT hr = Bands.Start(si.dwNumberOfProcessors - 1);
+    if (FAILED(hr)) {
+        _tprintf(TEXT("Could not start the band threads - 0x%08X\n"), hr);
+        return 1;
+    }
+
+    EFFECT_ISA isaBest = GetBestEffectIsa();
+
+    _tprintf(TEXT("%d x %d RGB24, %d frames, %u processors%s\n\n"),
+             cx, cy, cFrames, si.dwNumberOfProcessors,
+             cx * cy < CEffectBands::MIN_BAND_PIXELS ? TEXT(" (too small to split into bands)") : TEXT(""));
+
+    _tprintf(TEXT("%-10s"), TEXT("fps"));
+    for (int isa = EFFECT_ISA_SCALAR; isa <= isaBest; isa++) {
+        _tprintf(TEXT("%10s"), g_IsaNames[isa]);
+    }
+    _tprintf(TEXT("%10s bands\n"), g_IsaNames[isaBest]);
+
+    int cFailed = 0;
+
+    for (int i = 0; i < sizeof(g_Effects) / sizeof(g_Effects[0]); i++) {
+
+        int effect = g_Effects[i].effect;
+
+        CopyMemory(pReference, pSource, cbFrame);
+        ApplyEffectToRows(effect, pReference, lStride, cx, 0, cy, EFFECT_ISA_SCALAR);
+
+        _tprintf(TEXT("%-10s"), g_Effects[i].pszName);
+
+        for (int isa = EFFECT_ISA_SCALAR; isa <= isaBest + 1; isa++) {
+            BOOL bBands = (isa > isaBest);
+            double dFps = TimeEffect(effect, pSource, pReference, pWork,
+                                     lStride, cx, cy, cFrames,
+                                     bBands ? isaBest : (EFFECT_ISA) isa,
+                                     bBands ? &Bands : NULL);
+            if (dFps == 0) {
+                _tprintf(TEXT("%10s"), TEXT("WRONG"));
+                cFailed++;
+            } else {
+                _tprintf(TEXT("%10.1f"), dFps);
+            }
+        }
+        _tprintf(TEXT("\n"));
+    }
+
+    Bands.Stop();
+
+    VirtualFree(pSource, 0, MEM_RELEASE);
+    VirtualFree(pReference, 0, MEM_RELEASE);
+    VirtualFree(pWork, 0, MEM_RELEASE);
+
+    return cFailed ? 1 : 0;
+}
+
@@ -18,6 +18,7 @@
 #include "resource.h"
 #include "EZuids.h"
 #include "iEZ.h"
+#include "Effects.h"
 #include "EZrgb24.h"
 #include "EZprop.h"
 
@@ -33,6 +33,8 @@ public:
     HRESULT DecideBufferSize(IMemAllocator *pAlloc,
                              ALLOCATOR_PROPERTIES *pProperties);
     HRESULT GetMediaType(int iPosition, CMediaType *pMediaType);
+    HRESULT StartStreaming();
+    HRESULT StopStreaming();
 
     // These implement the custom IIPEffect interface
 
@@ -60,6 +62,8 @@ private:
     CRefTime    m_effectStartTime;      // When the effect will begin
     CRefTime    m_effectTime;           // And how long it will last for
     const long m_lBufferRequest;        // The number of buffers to use
+    EFFECT_ISA  m_isa;                  // Fastest kernels this CPU can run
+    CEffectBands m_Bands;               // Threads for large frames
 
 }; // EZrgb24
 
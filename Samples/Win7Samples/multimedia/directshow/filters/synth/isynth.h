@@ -23,6 +23,13 @@ extern "C" {
 DEFINE_GUID(IID_ISynth2, 
 0x487a78, 0xd875, 0x44b0, 0xad, 0xbb, 0xde, 0xca, 0x9c, 0xdb, 0x51, 0xfc);
 
+//
+// ISynth3's GUID
+//
+// {6C1E0F3A-9B24-4D8E-A57C-2E90D43B18F6}
+DEFINE_GUID(IID_ISynth3, 
+0x6c1e0f3a, 0x9b24, 0x4d8e, 0xa5, 0x7c, 0x2e, 0x90, 0xd4, 0x3b, 0x18, 0xf6);
+
 enum SYNTH_OUTPUT_FORMAT
 {
     SYNTH_OF_PCM,
@@ -103,6 +110,24 @@ DECLARE_INTERFACE_(ISynth2, IUnknown) {
 };
 
 
+//
+// ISynth3
+//
+// Adds several voices playing the waveform at once, each detuned slightly
+// from the others
+//
+DECLARE_INTERFACE_(ISynth3, ISynth2) {
+
+    STDMETHOD(get_Voices) (THIS_
+                  int *Voices           /* [out] */   // the current number of voices
+             ) PURE;
+
+    STDMETHOD(put_Voices) (THIS_
+                  int    Voices         /* [in] */    // Change to this number of voices
+             ) PURE;
+};
+
+
 #ifdef __cplusplus
 }
 #endif
@@ -26,6 +26,7 @@
 
 #include "DynSrc.h"
 #include "isynth.h"
+#include "synthosc.h"
 #include "synth.h"
 #include "synthprp.h"
 
@@ -150,7 +151,10 @@ CSynthFilter::~CSynthFilter(void)
 
 STDMETHODIMP CSynthFilter::NonDelegatingQueryInterface(REFIID riid, void **ppv)
 {
-    if (riid == IID_ISynth2) {
+    if (riid == IID_ISynth3) {
+        return GetInterface((ISynth3 *) this, ppv);
+    }
+    else if (riid == IID_ISynth2) {
         return GetInterface((ISynth2 *) this, ppv);
     }
     else if (riid == IID_IPersistStream) {
@@ -203,7 +207,7 @@ STDMETHODIMP CSynthFilter::GetClassID(CLSID *pClsid)
 
 int CSynthFilter::SizeMax ()
 {
-    return sizeof (int) * 8;
+    return sizeof (int) * 10;
 }
 
 
@@ -239,6 +243,9 @@ HRESULT CSynthFilter::WriteToStream(IStream *pStream)
     get_OutputFormat((SYNTH_OUTPUT_FORMAT*)&i);
     WRITEOUT(i);
 
+    get_Voices (&i);
+    WRITEOUT(i);
+
     return hr;
 }
 
@@ -247,7 +254,8 @@ HRESULT CSynthFilter::ReadFromStream(IStream *pStream)
 {
     CheckPointer(pStream,E_POINTER);
 
-    if (GetSoftwareVersion() != mPS_dwFileVersion)
+    // Version 1 is the same without the number of voices
+    if (mPS_dwFileVersion != 1 && GetSoftwareVersion() != mPS_dwFileVersion)
         return E_FAIL;
 
     HRESULT hr;
@@ -278,13 +286,18 @@ HRESULT CSynthFilter::ReadFromStream(IStream *pStream)
     READIN(i);
     put_OutputFormat((SYNTH_OUTPUT_FORMAT)i);
 
+    if (mPS_dwFileVersion >= 2) {
+        READIN(i);
+        put_Voices (i);
+    }
+
     return hr;
 }
 
 
 DWORD CSynthFilter::GetSoftwareVersion(void)
 {
-    return 1;
+    return 2;
 }
 
 
@@ -539,6 +552,28 @@ STDMETHODIMP CSynthFilter::put_OutputFormat(SYNTH_OUTPUT_FORMAT ofOutputFormat)
 }
 
 
+// -------------------------------------------------------------------------
+// ISynth3
+// -------------------------------------------------------------------------
+
+//
+// get_Voices
+//
+STDMETHODIMP CSynthFilter::get_Voices(int *Voices) 
+{
+    return m_Synth->get_Voices(Voices);
+}
+
+
+//
+// put_Voices
+//
+STDMETHODIMP CSynthFilter::put_Voices(int Voices) 
+{
+    return m_Synth->put_Voices(Voices);
+}
+
+
 // -------------------------------------------------------------------------
 // CSynthStream, the output pin
 // -------------------------------------------------------------------------
@@ -832,7 +867,7 @@ HRESULT CSynthStream::CompleteConnect(IPin *pReceivePin)
 
     if(WAVE_FORMAT_PCM == pwfexCurrent->wFormatTag)
     {
-        hr = m_Synth->AllocWaveCache(*pwfexCurrent);
+        hr = m_Synth->InitOscillators(*pwfexCurrent);
         if(FAILED(hr))
         {
             return hr;
@@ -844,7 +879,7 @@ HRESULT CSynthStream::CompleteConnect(IPin *pReceivePin)
 
         DerivePCMFormatFromADPCMFormatStructure(*pwfexCurrent, &wfexSourceFormat);
 
-        hr = m_Synth->AllocWaveCache(wfexSourceFormat);
+        hr = m_Synth->InitOscillators(wfexSourceFormat);
         if(FAILED(hr))
         {
             return hr;
@@ -1050,9 +1085,7 @@ CAudioSynth::CAudioSynth(
                 int iSamplesPerSec,
                 int iAmplitude
                 )
-    : m_bWaveCache(NULL)
-    , m_wWaveCache(NULL)
-    , m_pStateLock(pStateLock)
+    : m_pStateLock(pStateLock)
 {
     ASSERT(Waveform >= WAVE_SINE);
     ASSERT(Waveform <  WAVE_LAST);
@@ -1060,6 +1093,7 @@ CAudioSynth::CAudioSynth(
     m_iFrequency = Frequency;
     m_iWaveform = Waveform;
     m_iAmplitude = iAmplitude;
+    m_iVoices = DefaultVoices;
     m_iSweepStart = DefaultSweepStart;
     m_iSweepEnd = DefaultSweepEnd;
 
@@ -1072,64 +1106,28 @@ CAudioSynth::CAudioSynth(
 
 CAudioSynth::~CAudioSynth()
 {
-    if(m_bWaveCache)
-    {
-        delete[] m_bWaveCache;
-    }
-
-    if(m_wWaveCache)
-    {
-        delete[] m_wWaveCache;
-    }
 }
 
 
 //
-// AllocWaveCache
+// InitOscillators
 //
 //
-HRESULT CAudioSynth::AllocWaveCache(const WAVEFORMATEX& wfex)
+HRESULT CAudioSynth::InitOscillators(const WAVEFORMATEX& wfex)
 {
     // The caller should hold the state lock because this
-    // function uses m_iWaveCacheCycles, m_iWaveCacheSize
-    // m_iFrequency, m_bWaveCache and m_wWaveCache.  The
-    // function should also hold the state lock because
-    // it calls CalcCache().
+    // function uses m_Oscillators.
     ASSERT(CritCheckIn(m_pStateLock));
 
-    m_iWaveCacheCycles = m_iFrequency;
-    m_iWaveCacheSize = (int) wfex.nSamplesPerSec;
-
-    if(m_bWaveCache)
-    {
-        delete[] m_bWaveCache;
-        m_bWaveCache = NULL;
-    }
-    if(m_wWaveCache)
-    {
-        delete[] m_wWaveCache;
-        m_wWaveCache = NULL;
-    }
-
-    // The wave cache always stores PCM audio data.
-    if(wfex.wBitsPerSample == 8)
-    {
-        m_bWaveCache = new BYTE [m_iWaveCacheSize];
-        if(NULL == m_bWaveCache)
-        {
-            return E_OUTOFMEMORY;
-        }
-    }
-    else
+    // Only the first call allocates the wavetables.  After
+    // that, format and parameter changes never allocate.
+    HRESULT hr = m_Oscillators.Init();
+    if(FAILED(hr))
     {
-        m_wWaveCache = new WORD [m_iWaveCacheSize];
-        if(NULL == m_wWaveCache)
-        {
-            return E_OUTOFMEMORY;
-        }
+        return hr;
     }
 
-    CalcCache(wfex);
+    m_Oscillators.SetFormat(wfex.nSamplesPerSec, wfex.wBitsPerSample, wfex.nChannels);
 
     return S_OK;
 }
@@ -1168,294 +1166,21 @@ void CAudioSynth::GetPCMFormatStructure(WAVEFORMATEX* pwfex)
 //
 void CAudioSynth::FillPCMAudioBuffer(const WAVEFORMATEX& wfex, BYTE pBuf[], int iSize)
 {
-    BOOL fCalcCache = FALSE;
-
     // The caller should always hold the state lock because this
-    // function uses m_iFrequency,  m_iFrequencyLast, m_iWaveform
-    // m_iWaveformLast, m_iAmplitude, m_iAmplitudeLast, m_iWaveCacheIndex
-    // m_iWaveCacheSize, m_bWaveCache and m_wWaveCache.  The caller should
-    // also hold the state lock because this function calls CalcCache().
+    // function uses m_iFrequency, m_iWaveform, m_iAmplitude,
+    // m_iVoices, m_iSweepStart, m_iSweepEnd and m_Oscillators.
     ASSERT(CritCheckIn(m_pStateLock));
 
-    // Only realloc the cache if the format has changed !
-    if(m_iFrequency != m_iFrequencyLast)
-    {
-        fCalcCache = TRUE;
-        m_iFrequencyLast = m_iFrequency;
-    }
-    if(m_iWaveform != m_iWaveformLast)
-    {
-        fCalcCache = TRUE;
-        m_iWaveformLast = m_iWaveform;
-    }
-    if(m_iAmplitude != m_iAmplitudeLast)
-    {
-        fCalcCache = TRUE;
-        m_iAmplitudeLast = m_iAmplitude;
-    }
-
-    if(fCalcCache)
-    {
-        CalcCache(wfex);
-    }
-
-    // Copy cache to output buffers
-    if(wfex.wBitsPerSample == 8 && wfex.nChannels == 1)
-    {
-        while(iSize--)
-        {
-            *pBuf++ = m_bWaveCache[m_iWaveCacheIndex++];
-            if(m_iWaveCacheIndex >= m_iWaveCacheSize)
-                m_iWaveCacheIndex = 0;
-        }
-    }
-    else if(wfex.wBitsPerSample == 8 && wfex.nChannels == 2)
-    {
-        iSize /= 2;
-
-        while(iSize--)
-        {
-            *pBuf++ = m_bWaveCache[m_iWaveCacheIndex];
-            *pBuf++ = m_bWaveCache[m_iWaveCacheIndex++];
-            if(m_iWaveCacheIndex >= m_iWaveCacheSize)
-                m_iWaveCacheIndex = 0;
-        }
-    }
-    else if(wfex.wBitsPerSample == 16 && wfex.nChannels == 1)
-    {
-        WORD * pW = (WORD *) pBuf;
-        iSize /= 2;
-
-        while(iSize--)
-        {
-            *pW++ = m_wWaveCache[m_iWaveCacheIndex++];
-            if(m_iWaveCacheIndex >= m_iWaveCacheSize)
-                m_iWaveCacheIndex = 0;
-        }
-    }
-    else if(wfex.wBitsPerSample == 16 && wfex.nChannels == 2)
-    {
-        WORD * pW = (WORD *) pBuf;
-        iSize /= 4;
+    // Passing the parameters on is cheap, so do it for every buffer.
+    // The oscillators keep their phase, so changes do not click.
+    m_Oscillators.SetFormat(wfex.nSamplesPerSec, wfex.wBitsPerSample, wfex.nChannels);
+    m_Oscillators.SetWaveform(m_iWaveform);
+    m_Oscillators.SetFrequency(m_iFrequency);
+    m_Oscillators.SetAmplitude(m_iAmplitude);
+    m_Oscillators.SetSweepRange(m_iSweepStart, m_iSweepEnd);
+    m_Oscillators.SetVoices(m_iVoices);
 
-        while(iSize--)
-        {
-            *pW++ = m_wWaveCache[m_iWaveCacheIndex];
-            *pW++ = m_wWaveCache[m_iWaveCacheIndex++];
-            if(m_iWaveCacheIndex >= m_iWaveCacheSize)
-                m_iWaveCacheIndex = 0;
-        }
-    }
-}
-
-
-void CAudioSynth::CalcCache(const WAVEFORMATEX& wfex)
-{
-    switch(m_iWaveform)
-    {
-        case WAVE_SINE:
-            CalcCacheSine(wfex);
-            break;
-
-        case WAVE_SQUARE:
-            CalcCacheSquare(wfex);
-            break;
-
-        case WAVE_SAWTOOTH:
-            CalcCacheSawtooth(wfex);
-            break;
-
-        case WAVE_SINESWEEP:
-            CalcCacheSweep(wfex);
-            break;
-    }
-}
-
-
-//
-// CalcCacheSine
-//
-//
-void CAudioSynth::CalcCacheSine(const WAVEFORMATEX& wfex)
-{
-    int i;
-    double d;
-    double amplitude;
-    double FTwoPIDivSpS;
-
-    amplitude = ((wfex.wBitsPerSample == 8) ? 127 : 32767 ) * m_iAmplitude / 100;
-
-    FTwoPIDivSpS = m_iFrequency * TWOPI / wfex.nSamplesPerSec;
-
-    m_iWaveCacheIndex = 0;
-    m_iCurrentSample = 0;
-
-    if(wfex.wBitsPerSample == 8)
-    {
-        BYTE * pB = m_bWaveCache;
-
-        for(i = 0; i < m_iWaveCacheSize; i++)
-        {
-            d = FTwoPIDivSpS * i;
-            *pB++ = (BYTE) ((sin(d) * amplitude) + 128);
-        }
-    }
-    else
-    {
-        PWORD pW = (PWORD) m_wWaveCache;
-
-        for(i = 0; i < m_iWaveCacheSize; i++)
-        {
-            d = FTwoPIDivSpS * i;
-            *pW++ = (WORD) (sin(d) * amplitude);
-        }
-    }
-}
-
-
-//
-// CalcCacheSquare
-//
-//
-void CAudioSynth::CalcCacheSquare(const WAVEFORMATEX& wfex)
-{
-    int i;
-    double d;
-    double FTwoPIDivSpS;
-    BYTE b0, b1;
-    WORD w0, w1;
-
-    b0 = (BYTE) (128 - (127 * m_iAmplitude / 100));
-    b1 = (BYTE) (128 + (127 * m_iAmplitude / 100));
-    w0 = (WORD) (32767. * m_iAmplitude / 100);
-    w1 = (WORD) - (32767. * m_iAmplitude / 100);
-
-    FTwoPIDivSpS = m_iFrequency * TWOPI / wfex.nSamplesPerSec;
-
-    m_iWaveCacheIndex = 0;
-    m_iCurrentSample = 0;
-
-    if(wfex.wBitsPerSample == 8)
-    {
-        BYTE * pB = m_bWaveCache;
-
-        for(i = 0; i < m_iWaveCacheSize; i++)
-        {
-            d = FTwoPIDivSpS * i;
-            *pB++ = (BYTE) ((sin(d) >= 0) ? b1 : b0);
-        }
-    }
-    else
-    {
-        PWORD pW = (PWORD) m_wWaveCache;
-
-        for(i = 0; i < m_iWaveCacheSize; i++)
-        {
-            d = FTwoPIDivSpS * i;
-            *pW++ = (WORD) ((sin(d) >= 0) ? w1 : w0);
-        }
-    }
-}
-
-
-//
-// CalcCacheSawtooth
-//
-void CAudioSynth::CalcCacheSawtooth(const WAVEFORMATEX& wfex)
-{
-    int i;
-    double d;
-    double amplitude;
-    double FTwoPIDivSpS;
-    double step;
-    double curstep=0;
-    BOOL fLastWasNeg = TRUE;
-    BOOL fPositive;
-
-    amplitude = ((wfex.wBitsPerSample == 8) ? 255 : 65535 )
-        * m_iAmplitude / 100;
-
-    FTwoPIDivSpS = m_iFrequency * TWOPI / wfex.nSamplesPerSec;
-    step = amplitude * m_iFrequency / wfex.nSamplesPerSec;
-
-    m_iWaveCacheIndex = 0;
-    m_iCurrentSample = 0;
-
-    BYTE * pB = m_bWaveCache;
-    PWORD pW = (PWORD) m_wWaveCache;
-
-    for(i = 0; i < m_iWaveCacheSize; i++)
-    {
-        d = FTwoPIDivSpS * i;
-
-        // OneShot triggered on positive zero crossing
-        fPositive = (sin(d) >= 0);
-
-        if(fLastWasNeg && fPositive)
-        {
-            if(wfex.wBitsPerSample == 8)
-                curstep = 128 - amplitude / 2;
-            else
-                curstep = 32768 - amplitude / 2;
-        }
-        fLastWasNeg = !fPositive;
-
-        if(wfex.wBitsPerSample == 8)
-            *pB++ = (BYTE) curstep;
-        else
-            *pW++ = (WORD) (-32767 + curstep);
-
-        curstep += step;
-    }
-}
-
-
-//
-// CalcCacheSweep
-//
-void CAudioSynth::CalcCacheSweep(const WAVEFORMATEX& wfex)
-{
-    int i;
-    double d;
-    double amplitude;
-    double FTwoPIDivSpS;
-    double CurrentFreq;
-    double DeltaFreq;
-
-    amplitude = ((wfex.wBitsPerSample == 8) ? 127 : 32767 ) * m_iAmplitude / 100;
-
-    DeltaFreq = ((double) m_iSweepEnd - m_iSweepStart) / m_iWaveCacheSize;
-    CurrentFreq = m_iSweepStart;
-
-    m_iWaveCacheIndex = 0;
-    m_iCurrentSample = 0;
-
-    if(wfex.wBitsPerSample == 8)
-    {
-        BYTE * pB = m_bWaveCache;
-        d = 0.0;
-
-        for(i = 0; i < m_iWaveCacheSize; i++)
-        {
-            FTwoPIDivSpS = (int) CurrentFreq * TWOPI / wfex.nSamplesPerSec;
-            CurrentFreq += DeltaFreq;
-            d += FTwoPIDivSpS;
-            *pB++ = (BYTE) ((sin(d) * amplitude) + 128);
-        }
-    }
-    else
-    {
-        PWORD pW = (PWORD) m_wWaveCache;
-        d = 0.0;
-
-        for(i = 0; i < m_iWaveCacheSize; i++)
-        {
-            FTwoPIDivSpS = (int) CurrentFreq * TWOPI / wfex.nSamplesPerSec;
-            CurrentFreq += DeltaFreq;
-            d += FTwoPIDivSpS;
-            *pW++ = (WORD) (sin(d) * amplitude);
-        }
-    }
+    m_Oscillators.Generate(pBuf, iSize);
 }
 
 
@@ -1724,6 +1449,37 @@ STDMETHODIMP CAudioSynth::put_OutputFormat(SYNTH_OUTPUT_FORMAT ofOutputFormat)
 }
 
 
+//
+// get_Voices
+//
+STDMETHODIMP CAudioSynth::get_Voices(int *pVoices)
+{
+    CheckPointer(pVoices,E_POINTER);
+
+    *pVoices = m_iVoices;
+
+    DbgLog((LOG_TRACE, 3, TEXT("get_Voices: %d"), *pVoices));
+    return NOERROR;
+}
+
+
+//
+// put_Voices
+//
+STDMETHODIMP CAudioSynth::put_Voices(int Voices)
+{
+    CAutoLock l(m_pStateLock);
+
+    if(Voices > MaxVoices || Voices < MinVoices)
+        return E_INVALIDARG;
+
+    m_iVoices = Voices;
+
+    DbgLog((LOG_TRACE, 3, TEXT("put_Voices: %d"), Voices));
+    return NOERROR;
+}
+
+
 ////////////////////////////////////////////////////////////////////////
 //
 // Exported entry points for registration and unregistration 
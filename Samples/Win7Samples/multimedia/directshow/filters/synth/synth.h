@@ -29,6 +29,9 @@ const int MaxAmplitude = 100;
 const int MinAmplitude = 0;
 const int DefaultSweepStart = DefaultFrequency;
 const int DefaultSweepEnd = 5000;
+const int MaxVoices = 64;               // Same as COscillatorBank::MAX_VOICES
+const int MinVoices = 1;
+const int DefaultVoices = 1;
 const int WaveBufferSize = 16*1024;     // Size of each allocated buffer
                                         // Originally used to be 2K, but at
                                         // 44khz/16bit/stereo you would get
@@ -73,8 +76,8 @@ public:
     // Load the buffer with the current waveform
     void FillPCMAudioBuffer(const WAVEFORMATEX& wfex, BYTE pBuf[], int iSize);
 
-    // Set the "current" format and allocate temporary memory
-    HRESULT AllocWaveCache(const WAVEFORMATEX& wfex);
+    // Set the "current" format and build the wavetables the first time
+    HRESULT InitOscillators(const WAVEFORMATEX& wfex);
 
     void GetPCMFormatStructure(WAVEFORMATEX* pwfex);
 
@@ -95,6 +98,8 @@ public:
     STDMETHODIMP put_SweepRange(int  SweepStart, int  SweepEnd);
     STDMETHODIMP get_OutputFormat(SYNTH_OUTPUT_FORMAT *pOutputFormat);
     STDMETHODIMP put_OutputFormat(SYNTH_OUTPUT_FORMAT ofOutputFormat);
+    STDMETHODIMP get_Voices(int *Voices);
+    STDMETHODIMP put_Voices(int  Voices);
 
 private:
     CCritSec* m_pStateLock;
@@ -108,27 +113,12 @@ private:
     int m_iWaveform;            // WAVE_SINE ...
     int m_iFrequency;           // if not using sweep, this is the frequency
     int m_iAmplitude;           // 0 to 100
-
-    int m_iWaveformLast;        // keep track of the last known format
-    int m_iFrequencyLast;       // so we can flush the cache if necessary
-    int m_iAmplitudeLast;
-    int m_iCurrentSample;       // 0 to iSamplesPerSec-1
-
-    BYTE * m_bWaveCache;        // Wave Cache as BYTEs.  This cache ALWAYS holds PCM audio data.
-    WORD * m_wWaveCache;        // Wave Cache as WORDs.  This cache ALWAYS holds PCM audio data.
-
-    int m_iWaveCacheSize;       // how big is the cache?
-    int m_iWaveCacheCycles;     // how many cycles are in the cache
-    int m_iWaveCacheIndex;
+    int m_iVoices;              // MinVoices to MaxVoices
 
     int m_iSweepStart;           // start of sweep
     int m_iSweepEnd;             // end of sweep
 
-    void CalcCache         (const WAVEFORMATEX& wfex);
-    void CalcCacheSine     (const WAVEFORMATEX& wfex);
-    void CalcCacheSquare   (const WAVEFORMATEX& wfex);
-    void CalcCacheSawtooth (const WAVEFORMATEX& wfex);
-    void CalcCacheSweep    (const WAVEFORMATEX& wfex);
+    COscillatorBank m_Oscillators;  // Generates the PCM audio data.
 
 };
 
@@ -139,7 +129,7 @@ private:
 // -------------------------------------------------------------------------
 // CSynthFilter manages filter level stuff
 
-class CSynthFilter :    public ISynth2,
+class CSynthFilter :    public ISynth3,
                         public CPersistStream,
                         public ISpecifyPropertyPages,
                         public CDynamicSource {
@@ -188,6 +178,13 @@ public:
     STDMETHODIMP get_OutputFormat(SYNTH_OUTPUT_FORMAT *pOutputFormat);
     STDMETHODIMP put_OutputFormat(SYNTH_OUTPUT_FORMAT ofOutputFormat);
 
+    //
+    // --- ISynth3 ---
+    //
+
+    STDMETHODIMP get_Voices(int *Voices);
+    STDMETHODIMP put_Voices(int Voices);
+
     CAudioSynth *m_Synth;           // the current synthesizer
 
 private:
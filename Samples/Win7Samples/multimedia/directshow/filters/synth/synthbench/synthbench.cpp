@@ -0,0 +1,197 @@
+//------------------------------------------------------------------------------
+// File: SynthBench.cpp
+//
+// Desc: DirectShow sample code - throughput benchmark for the oscillator
+//       bank of the audio synthesizer filter. Generates 16 bit stereo audio
+//       at 44.1 kHz with the plain, SSE2 and AVX2 oscillators and reports
+//       how many times faster than real time each one runs.
+//
+//       Usage: synthbench [voices [seconds]]
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tchar.h>
+
+#include "..\synth.h"
+#include "..\synthosc.h"
+
+
+struct WAVEFORM_NAME
+{
+    int     iWaveform;
+    LPCTSTR pszName;
+};
+
+static const WAVEFORM_NAME g_Waveforms[] =
+{
+    { WAVE_SINE,      TEXT("Sine") },
+    { WAVE_SQUARE,    TEXT("Square") },
+    { WAVE_SAWTOOTH,  TEXT("Sawtooth") },
+    { WAVE_SINESWEEP, TEXT("Sweep") },
+};
+
+static const LPCTSTR g_IsaNames[] = { TEXT("Scalar"), TEXT("SSE2"), TEXT("AVX2") };
+
+const DWORD SAMPLES_PER_SEC = 44100;
+const int   BUFFER_SIZE = WaveBufferSize;   // What the filter asks for
+
+
+//
+// SetupBank
+//
+static void SetupBank(COscillatorBank *pBank, int iWaveform, int cVoices,
+                      WORD wBitsPerSample, WORD wChannels, SYNTH_ISA isa)
+{
+    pBank->SetFormat(SAMPLES_PER_SEC, wBitsPerSample, wChannels);
+    pBank->SetWaveform(iWaveform);
+    pBank->SetFrequency(DefaultFrequency);
+    pBank->SetAmplitude(MaxAmplitude);
+    pBank->SetSweepRange(DefaultSweepStart, DefaultSweepEnd);
+    pBank->SetVoices(cVoices);
+    pBank->SetIsa(isa);
+}
+
+
+//
+// SameAsScalar
+//
+// Plays a few buffers in each output format, including buffer sizes that
+// are not a whole number of blocks, and compares them with the plain code
+//
+static BOOL SameAsScalar(int iWaveform, int cVoices, SYNTH_ISA isa)
+{
+    static const WORD awFormats[4][2] = { { 8, 1 }, { 8, 2 }, { 16, 1 }, { 16, 2 } };
+
+    BYTE abReference[4096];
+    BYTE abTest[4096];
+
+    for (int f = 0; f < 4; f++) {
+        COscillatorBank reference;
+        COscillatorBank test;
+
+        if (FAILED(reference.Init()) || FAILED(test.Init())) {
+            return FALSE;
+        }
+
+        SetupBank(&reference, iWaveform, cVoices, awFormats[f][0], awFormats[f][1], SYNTH_ISA_SCALAR);
+        SetupBank(&test, iWaveform, cVoices, awFormats[f][0], awFormats[f][1], isa);
+
+        for (int cb = 100; cb <= 4096; cb += 333) {
+            reference.Generate(abReference, cb);
+            test.Generate(abTest, cb);
+            if (memcmp(abReference, abTest, cb) != 0) {
+                return FALSE;
+            }
+        }
+    }
+
+    return TRUE;
+
+} // SameAsScalar
+
+
+//
+// TimeBank
+//
+// Returns how many times faster than real time the bank generates audio,
+// or 0 if the output differs from the plain code's output
+//
+static double TimeBank(int iWaveform, int cVoices, int cSeconds, SYNTH_ISA isa)
+{
+    if (!SameAsScalar(iWaveform, cVoices, isa)) {
+        return 0;
+    }
+
+    COscillatorBank bank;
+    if (FAILED(bank.Init())) {
+        return 0;
+    }
+    SetupBank(&bank, iWaveform, cVoices, 16, 2, isa);
+
+    BYTE *pBuf = new BYTE [BUFFER_SIZE];
+    if (pBuf == NULL) {
+        return 0;
+    }
+
+    const LONGLONG cbTotal = (LONGLONG) cSeconds * SAMPLES_PER_SEC * 4;
+
+    LARGE_INTEGER liStart, liStop, liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liStart);
+
+    for (LONGLONG cb = 0; cb < cbTotal; cb += BUFFER_SIZE) {
+        bank.Generate(pBuf, BUFFER_SIZE);
+    }
+
+    QueryPerformanceCounter(&liStop);
+    delete [] pBuf;
+
+    double dSeconds = (double) (liStop.QuadPart - liStart.QuadPart) / (double) liFrequency.QuadPart;
+    return cSeconds / max(dSeconds, 1e-9);
+
+} // TimeBank
+
+
+int __cdecl _tmain(int argc, TCHAR *argv[])
+{
+    static const int acVoices[] = { 1, 8, COscillatorBank::MAX_VOICES };
+
+    int cVoicesOnly = 0;
+    int cSeconds = 60;
+
+    if (argc >= 2) {
+        cVoicesOnly = _ttoi(argv[1]);
+    }
+    if (argc >= 3) {
+        cSeconds = _ttoi(argv[2]);
+    }
+    if (argc >= 2 && (cVoicesOnly < 1 || cVoicesOnly > COscillatorBank::MAX_VOICES || cSeconds <= 0)) {
+        _tprintf(TEXT("Usage: synthbench [voices [seconds]]\n"));
+        _tprintf(TEXT("voices is 1 to %d\n"), COscillatorBank::MAX_VOICES);
+        return 1;
+    }
+
+    SYNTH_ISA isaBest = GetBestSynthIsa();
+
+    _tprintf(TEXT("%d seconds of 16 bit stereo at %u Hz, times real time\n\n"), cSeconds, SAMPLES_PER_SEC);
+
+    _tprintf(TEXT("%-16s"), TEXT(""));
+    for (int isa = SYNTH_ISA_SCALAR; isa <= isaBest; isa++) {
+        _tprintf(TEXT("%10s"), g_IsaNames[isa]);
+    }
+    _tprintf(TEXT("\n"));
+
+    int cFailed = 0;
+
+    for (int v = 0; v < (int) ARRAYSIZE(acVoices); v++) {
+        int cVoices = cVoicesOnly ? cVoicesOnly : acVoices[v];
+
+        for (int w = 0; w < (int) ARRAYSIZE(g_Waveforms); w++) {
+            TCHAR szRow[32];
+            _stprintf_s(szRow, ARRAYSIZE(szRow), TEXT("%s x %d"), g_Waveforms[w].pszName, cVoices);
+            _tprintf(TEXT("%-16s"), szRow);
+
+            for (int isa = SYNTH_ISA_SCALAR; isa <= isaBest; isa++) {
+                double dSpeed = TimeBank(g_Waveforms[w].iWaveform, cVoices, cSeconds, (SYNTH_ISA) isa);
+                if (dSpeed == 0) {
+                    _tprintf(TEXT("%10s"), TEXT("WRONG"));
+                    cFailed++;
+                } else {
+                    _tprintf(TEXT("%10.1f"), dSpeed);
+                }
+            }
+            _tprintf(TEXT("\n"));
+        }
+
+        if (cVoicesOnly) {
+            break;
+        }
+    }
+
+    return cFailed ? 1 : 0;
+}
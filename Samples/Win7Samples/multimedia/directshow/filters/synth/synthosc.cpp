@@ -0,0 +1,593 @@
+//------------------------------------------------------------------------------
+// File: SynthOsc.cpp
+//
+// Desc: DirectShow sample code - wavetable oscillator bank used by the audio
+//       synthesizer filter and by the synthbench benchmark.
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+//
+// The oscillators use integer arithmetic only, so the SSE2 and AVX2 code
+// gives exactly the same samples as the scalar code whatever floating
+// point model the compiler uses.
+//
+// A table entry holds two 16 bit samples: sample i in the low word and
+// sample i + 1 in the high word. The top TABLE_BITS bits of a voice's
+// phase pick the entry and the next 14 bits say how far to go from one
+// sample to the next, so a single pmaddwd does the linear interpolation.
+// SSE2 has no gather, so it loads the four entries one at a time; AVX2
+// gathers eight. AVX2 needs Visual C++ 2012 or later to build.
+//
+
+#include <windows.h>
+#include <math.h>
+#include <intrin.h>
+#include <emmintrin.h>
+
+#if (_MSC_VER >= 1700)
+#include <immintrin.h>
+#define SYNTH_AVX2
+#endif
+
+#include "synth.h"
+#include "synthosc.h"
+
+
+// The top 11 bits of a phase (COscillatorBank::TABLE_BITS) are the table
+// index, and the next FRAC_BITS the position between two samples
+const int INDEX_SHIFT = 32 - 11;
+const int FRAC_BITS = 14;
+const int FRAC_SHIFT = INDEX_SHIFT - FRAC_BITS;
+const int FRAC_ONE = 1 << FRAC_BITS;
+
+// How far apart the highest and lowest voices are, in cents
+const double DETUNE_CENTS = 20.0;
+
+const double PI = 3.14159265358979323846;
+
+
+//
+// GetBestSynthIsa
+//
+// Checks the processor, and for AVX2 that the operating system saves the
+// YMM registers
+//
+SYNTH_ISA GetBestSynthIsa()
+{
+    int info[4];
+
+    __cpuid(info, 0);
+    int cIds = info[0];
+
+    __cpuid(info, 1);
+    BOOL bSSE2 = (info[3] & (1 << 26)) != 0;
+
+#ifdef SYNTH_AVX2
+    BOOL bOSXSAVE = (info[2] & (1 << 27)) != 0;
+    BOOL bAVX = (info[2] & (1 << 28)) != 0;
+
+    if (cIds >= 7 && bOSXSAVE && bAVX && (_xgetbv(0) & 6) == 6) {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5)) {
+            return SYNTH_ISA_AVX2;
+        }
+    }
+#endif
+
+    return bSSE2 ? SYNTH_ISA_SSE2 : SYNTH_ISA_SCALAR;
+
+} // GetBestSynthIsa
+
+
+//
+// OscillateScalar
+//
+// Adds cFrames samples of one voice, times iGain, to piMix
+//
+static void OscillateScalar(const int *piTable,
+                            DWORD *pdwPhase,
+                            DWORD dwStep,
+                            int iGain,
+                            int *piMix,
+                            int cFrames)
+{
+    DWORD dwPhase = *pdwPhase;
+
+    for (int i = 0; i < cFrames; i++) {
+        int iPair = piTable[dwPhase >> INDEX_SHIFT];
+        int iFrac = (dwPhase >> FRAC_SHIFT) & (FRAC_ONE - 1);
+        int iSample = ((short) iPair * (FRAC_ONE - iFrac) + (iPair >> 16) * iFrac) >> FRAC_BITS;
+        piMix[i] += iSample * iGain;
+        dwPhase += dwStep;
+    }
+
+    *pdwPhase = dwPhase;
+
+} // OscillateScalar
+
+
+//
+// SSE2
+//
+
+// Interpolation weights for four phases: 1 - frac in the low word of each
+// dword and frac in the high word
+static __forceinline __m128i WeightsSSE2(__m128i phase)
+{
+    __m128i frac = _mm_and_si128(_mm_srli_epi32(phase, FRAC_SHIFT),
+                                 _mm_set1_epi32(FRAC_ONE - 1));
+    return _mm_or_si128(_mm_sub_epi32(_mm_set1_epi32(FRAC_ONE), frac),
+                        _mm_slli_epi32(frac, 16));
+}
+
+static void OscillateSSE2(const int *piTable,
+                          DWORD *pdwPhase,
+                          DWORD dwStep,
+                          int iGain,
+                          int *piMix,
+                          int cFrames)
+{
+    DWORD dwPhase = *pdwPhase;
+
+    // The gain is at most 32767, so the high word of each dword is zero
+    // and pmaddwd multiplies the low word of each sample by it
+    const __m128i gain = _mm_set1_epi32(iGain);
+    const __m128i step4 = _mm_set1_epi32((int) (dwStep * 4));
+    __m128i phase = _mm_set_epi32((int) (dwPhase + dwStep * 3),
+                                  (int) (dwPhase + dwStep * 2),
+                                  (int) (dwPhase + dwStep),
+                                  (int) dwPhase);
+
+    int i = 0;
+    for (; i + 4 <= cFrames; i += 4) {
+        DWORD p0 = dwPhase;
+        DWORD p1 = p0 + dwStep;
+        DWORD p2 = p1 + dwStep;
+        DWORD p3 = p2 + dwStep;
+
+        __m128i pairs = _mm_set_epi32(piTable[p3 >> INDEX_SHIFT],
+                                      piTable[p2 >> INDEX_SHIFT],
+                                      piTable[p1 >> INDEX_SHIFT],
+                                      piTable[p0 >> INDEX_SHIFT]);
+
+        __m128i sample = _mm_srai_epi32(_mm_madd_epi16(pairs, WeightsSSE2(phase)), FRAC_BITS);
+        __m128i mix = _mm_loadu_si128((const __m128i *) (piMix + i));
+        mix = _mm_add_epi32(mix, _mm_madd_epi16(sample, gain));
+        _mm_storeu_si128((__m128i *) (piMix + i), mix);
+
+        phase = _mm_add_epi32(phase, step4);
+        dwPhase += dwStep * 4;
+    }
+
+    *pdwPhase = dwPhase;
+    OscillateScalar(piTable, pdwPhase, dwStep, iGain, piMix + i, cFrames - i);
+
+} // OscillateSSE2
+
+
+//
+// AVX2
+//
+
+#ifdef SYNTH_AVX2
+
+static void OscillateAVX2(const int *piTable,
+                          DWORD *pdwPhase,
+                          DWORD dwStep,
+                          int iGain,
+                          int *piMix,
+                          int cFrames)
+{
+    DWORD dwPhase = *pdwPhase;
+
+    const __m256i gain = _mm256_set1_epi32(iGain);
+    const __m256i step8 = _mm256_set1_epi32((int) (dwStep * 8));
+    const __m256i fracMask = _mm256_set1_epi32(FRAC_ONE - 1);
+    const __m256i one = _mm256_set1_epi32(FRAC_ONE);
+
+    __m256i phase = _mm256_mullo_epi32(_mm256_set_epi32(7, 6, 5, 4, 3, 2, 1, 0),
+                                       _mm256_set1_epi32((int) dwStep));
+    phase = _mm256_add_epi32(phase, _mm256_set1_epi32((int) dwPhase));
+
+    int i = 0;
+    for (; i + 8 <= cFrames; i += 8) {
+        __m256i pairs = _mm256_i32gather_epi32(piTable, _mm256_srli_epi32(phase, INDEX_SHIFT), 4);
+
+        __m256i frac = _mm256_and_si256(_mm256_srli_epi32(phase, FRAC_SHIFT), fracMask);
+        __m256i weights = _mm256_or_si256(_mm256_sub_epi32(one, frac),
+                                          _mm256_slli_epi32(frac, 16));
+
+        __m256i sample = _mm256_srai_epi32(_mm256_madd_epi16(pairs, weights), FRAC_BITS);
+        __m256i mix = _mm256_loadu_si256((const __m256i *) (piMix + i));
+        mix = _mm256_add_epi32(mix, _mm256_madd_epi16(sample, gain));
+        _mm256_storeu_si256((__m256i *) (piMix + i), mix);
+
+        phase = _mm256_add_epi32(phase, step8);
+    }
+
+    _mm256_zeroupper();
+
+    *pdwPhase = dwPhase + dwStep * i;
+    OscillateScalar(piTable, pdwPhase, dwStep, iGain, piMix + i, cFrames - i);
+
+} // OscillateAVX2
+
+#endif
+
+
+//
+// WriteScalar
+//
+// Converts the Q30 mix to 8 or 16 bit samples, copying each one to every
+// channel
+//
+static void WriteScalar(const int *piMix,
+                        BYTE *pBuf,
+                        int iFirst,
+                        int cFrames,
+                        WORD wBitsPerSample,
+                        WORD wChannels)
+{
+    for (int i = iFirst; i < cFrames; i++) {
+        int iSample = (piMix[i] + (1 << 14)) >> 15;
+        if (iSample > 32767) iSample = 32767;
+        if (iSample < -32768) iSample = -32768;
+
+        if (wBitsPerSample == 8) {
+            BYTE b = (BYTE) ((iSample >> 8) + 128);
+            for (int c = 0; c < wChannels; c++) {
+                pBuf[i * wChannels + c] = b;
+            }
+        } else {
+            short *ps = (short *) pBuf;
+            for (int c = 0; c < wChannels; c++) {
+                ps[i * wChannels + c] = (short) iSample;
+            }
+        }
+    }
+
+} // WriteScalar
+
+
+//
+// WriteSSE2
+//
+// Same for mono and stereo, eight samples at a time
+//
+static void WriteSSE2(const int *piMix,
+                      BYTE *pBuf,
+                      int cFrames,
+                      WORD wBitsPerSample,
+                      WORD wChannels)
+{
+    int i = 0;
+
+    if (wChannels <= 2) {
+        const __m128i round = _mm_set1_epi32(1 << 14);
+        const __m128i bias8 = _mm_set1_epi8((char) 0x80);
+
+        for (; i + 8 <= cFrames; i += 8) {
+            __m128i lo = _mm_loadu_si128((const __m128i *) (piMix + i));
+            __m128i hi = _mm_loadu_si128((const __m128i *) (piMix + i + 4));
+            lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 15);
+            hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 15);
+            __m128i w = _mm_packs_epi32(lo, hi);
+
+            if (wBitsPerSample == 8) {
+                // The high byte of each sample, offset to unsigned
+                __m128i b = _mm_xor_si128(_mm_packs_epi16(_mm_srai_epi16(w, 8), _mm_setzero_si128()), bias8);
+                if (wChannels == 1) {
+                    _mm_storel_epi64((__m128i *) (pBuf + i), b);
+                } else {
+                    _mm_storeu_si128((__m128i *) (pBuf + i * 2), _mm_unpacklo_epi8(b, b));
+                }
+            } else {
+                short *ps = (short *) pBuf;
+                if (wChannels == 1) {
+                    _mm_storeu_si128((__m128i *) (ps + i), w);
+                } else {
+                    _mm_storeu_si128((__m128i *) (ps + i * 2), _mm_unpacklo_epi16(w, w));
+                    _mm_storeu_si128((__m128i *) (ps + i * 2 + 8), _mm_unpackhi_epi16(w, w));
+                }
+            }
+        }
+    }
+
+    WriteScalar(piMix, pBuf, i, cFrames, wBitsPerSample, wChannels);
+
+} // WriteSSE2
+
+
+// -------------------------------------------------------------------------
+// COscillatorBank
+// -------------------------------------------------------------------------
+
+COscillatorBank::COscillatorBank()
+    : m_piTables(NULL)
+    , m_dwSamplesPerSec(11025)
+    , m_wBitsPerSample(8)
+    , m_wChannels(1)
+    , m_iWaveform(WAVE_SINE)
+    , m_iFrequency(DefaultFrequency)
+    , m_iAmplitude(MaxAmplitude)
+    , m_iSweepStart(DefaultSweepStart)
+    , m_iSweepEnd(DefaultSweepEnd)
+    , m_dwSweepSample(0)
+    , m_cVoices(0)
+    , m_iVoiceGain(0)
+    , m_isa(GetBestSynthIsa())
+{
+    SetVoices(1);
+}
+
+
+COscillatorBank::~COscillatorBank()
+{
+    delete [] m_piTables;
+}
+
+
+//
+// Init
+//
+// m_piTables holds 1 + 2 * LEVELS tables of TABLE_SIZE entries: the sine
+// wave, then the square waves, then the sawtooth waves. Table n of each
+// band limited waveform has TABLE_SIZE / 4 >> n harmonics.
+//
+HRESULT COscillatorBank::Init()
+{
+    if (m_piTables) {
+        return S_OK;
+    }
+
+    int *piTables = new int [(1 + 2 * LEVELS) * TABLE_SIZE];
+    double *pdSine = new double [TABLE_SIZE];
+    double *pdWave = new double [TABLE_SIZE];
+
+    if (!piTables || !pdSine || !pdWave) {
+        delete [] piTables;
+        delete [] pdSine;
+        delete [] pdWave;
+        return E_OUTOFMEMORY;
+    }
+
+    for (int i = 0; i < TABLE_SIZE; i++) {
+        pdSine[i] = sin(2 * PI * i / TABLE_SIZE);
+    }
+
+    int *piTable = piTables;
+
+    for (int iTable = 0; iTable < 1 + 2 * LEVELS; iTable++, piTable += TABLE_SIZE) {
+
+        // Add up the harmonics. The square wave has the odd ones at 1/k,
+        // the sawtooth all of them at 1/k with alternating signs, so it
+        // ramps up.
+
+        BOOL bSquare = (iTable >= 1 && iTable <= LEVELS);
+        int cHarmonics = (iTable == 0) ? 1 : (TABLE_SIZE / 4) >> ((iTable - 1) % LEVELS);
+
+        ZeroMemory(pdWave, TABLE_SIZE * sizeof(double));
+
+        for (int k = 1; k <= cHarmonics; k++) {
+            if (bSquare && (k % 2) == 0) {
+                continue;
+            }
+            double dAmplitude = ((k % 2) || bSquare) ? 1.0 / k : -1.0 / k;
+            for (int i = 0; i < TABLE_SIZE; i++) {
+                pdWave[i] += dAmplitude * pdSine[(k * i) & (TABLE_SIZE - 1)];
+            }
+        }
+
+        // Scale the peak to full scale, then store each sample with the
+        // one after it
+
+        double dPeak = 0;
+        for (int i = 0; i < TABLE_SIZE; i++) {
+            dPeak = max(dPeak, fabs(pdWave[i]));
+        }
+
+        for (int i = 0; i < TABLE_SIZE; i++) {
+            int iSample = (int) floor(pdWave[i] * 32767 / dPeak + 0.5);
+            int iNext = (int) floor(pdWave[(i + 1) & (TABLE_SIZE - 1)] * 32767 / dPeak + 0.5);
+            piTable[i] = (int) ((WORD) iSample | ((DWORD) (WORD) iNext << 16));
+        }
+    }
+
+    delete [] pdSine;
+    delete [] pdWave;
+
+    m_piTables = piTables;
+    return S_OK;
+
+} // Init
+
+
+void COscillatorBank::SetFormat(DWORD dwSamplesPerSec, WORD wBitsPerSample, WORD wChannels)
+{
+    m_dwSamplesPerSec = dwSamplesPerSec;
+    m_wBitsPerSample = wBitsPerSample;
+    m_wChannels = wChannels;
+
+    if (m_dwSweepSample >= m_dwSamplesPerSec) {
+        m_dwSweepSample = 0;
+    }
+}
+
+
+void COscillatorBank::SetWaveform(int iWaveform)
+{
+    m_iWaveform = iWaveform;
+}
+
+
+void COscillatorBank::SetFrequency(int iFrequency)
+{
+    m_iFrequency = iFrequency;
+}
+
+
+void COscillatorBank::SetAmplitude(int iAmplitude)
+{
+    if (iAmplitude != m_iAmplitude) {
+        m_iAmplitude = iAmplitude;
+        UpdateGain();
+    }
+}
+
+
+void COscillatorBank::SetSweepRange(int iSweepStart, int iSweepEnd)
+{
+    m_iSweepStart = iSweepStart;
+    m_iSweepEnd = iSweepEnd;
+}
+
+
+//
+// SetVoices
+//
+// The voices are spread evenly over DETUNE_CENTS. They start in phase
+// and drift apart, which gives the usual chorus sound. Spreading the
+// starting phases evenly instead would make them nearly cancel out.
+//
+void COscillatorBank::SetVoices(int cVoices)
+{
+    if (cVoices < 1) cVoices = 1;
+    if (cVoices > MAX_VOICES) cVoices = MAX_VOICES;
+
+    if (cVoices == m_cVoices) {
+        return;
+    }
+
+    for (int v = m_cVoices; v < cVoices; v++) {
+        m_adwPhase[v] = 0;
+    }
+
+    for (int v = 0; v < cVoices; v++) {
+        double dCents = (cVoices == 1) ? 0 : DETUNE_CENTS * ((double) v / (cVoices - 1) - 0.5);
+        m_adDetune[v] = pow(2.0, dCents / 1200);
+    }
+
+    m_cVoices = cVoices;
+    UpdateGain();
+}
+
+
+// Share full scale between the voices, so they cannot clip
+void COscillatorBank::UpdateGain()
+{
+    m_iVoiceGain = 32767 * m_iAmplitude / 100 / m_cVoices;
+}
+
+
+//
+// GetTable
+//
+// The table with the most harmonics that all stay below half the sample
+// rate. dCyclesPerSample is the voice frequency / the sample rate, folded
+// into 0 to 0.5.
+//
+const int *COscillatorBank::GetTable(double dCyclesPerSample) const
+{
+    if (m_iWaveform != WAVE_SQUARE && m_iWaveform != WAVE_SAWTOOTH) {
+        return m_piTables;
+    }
+
+    int iLevel = 0;
+    while (iLevel < LEVELS - 1 && ((TABLE_SIZE / 4) >> iLevel) * dCyclesPerSample > 0.5) {
+        iLevel++;
+    }
+
+    int iFirst = (m_iWaveform == WAVE_SQUARE) ? 1 : 1 + LEVELS;
+    return m_piTables + (iFirst + iLevel) * TABLE_SIZE;
+}
+
+
+//
+// MixBlock
+//
+// Adds up cFrames samples of every voice in m_aiMix
+//
+void COscillatorBank::MixBlock(double dFrequency, int cFrames)
+{
+    ZeroMemory(m_aiMix, cFrames * sizeof(int));
+
+    for (int v = 0; v < m_cVoices; v++) {
+
+        // Frequencies above half the sample rate alias, as they would
+        // with a real converter
+
+        double dCycles = dFrequency * m_adDetune[v] / m_dwSamplesPerSec;
+        dCycles -= floor(dCycles);
+
+        DWORD dwStep = (DWORD) (dCycles * 4294967296.0);
+        const int *piTable = GetTable(min(dCycles, 1 - dCycles));
+
+        switch (m_isa) {
+#ifdef SYNTH_AVX2
+            case SYNTH_ISA_AVX2:
+                OscillateAVX2(piTable, &m_adwPhase[v], dwStep, m_iVoiceGain, m_aiMix, cFrames);
+                break;
+#endif
+            case SYNTH_ISA_SSE2:
+                OscillateSSE2(piTable, &m_adwPhase[v], dwStep, m_iVoiceGain, m_aiMix, cFrames);
+                break;
+
+            default:
+                OscillateScalar(piTable, &m_adwPhase[v], dwStep, m_iVoiceGain, m_aiMix, cFrames);
+                break;
+        }
+    }
+}
+
+
+void COscillatorBank::WriteBlock(BYTE *pBuf, int cFrames)
+{
+    if (m_isa == SYNTH_ISA_SCALAR) {
+        WriteScalar(m_aiMix, pBuf, 0, cFrames, m_wBitsPerSample, m_wChannels);
+    } else {
+        WriteSSE2(m_aiMix, pBuf, cFrames, m_wBitsPerSample, m_wChannels);
+    }
+}
+
+
+//
+// Generate
+//
+// The sine sweep goes from m_iSweepStart to m_iSweepEnd once a second and
+// starts again. The frequency moves on once per block.
+//
+void COscillatorBank::Generate(BYTE *pBuf, int cb)
+{
+    int cbFrame = (m_wBitsPerSample / 8) * m_wChannels;
+    if (cbFrame == 0 || m_dwSamplesPerSec == 0) {
+        return;
+    }
+
+    int cFrames = cb / cbFrame;
+
+    if (m_piTables == NULL) {
+        FillMemory(pBuf, cFrames * cbFrame, (m_wBitsPerSample == 8) ? 0x80 : 0);
+        return;
+    }
+
+    while (cFrames > 0) {
+        int cBlock = min(cFrames, (int) BLOCK_FRAMES);
+        double dFrequency = m_iFrequency;
+
+        if (m_iWaveform == WAVE_SINESWEEP) {
+            cBlock = min(cBlock, (int) (m_dwSamplesPerSec - m_dwSweepSample));
+            dFrequency = m_iSweepStart +
+                         (double) (m_iSweepEnd - m_iSweepStart) * m_dwSweepSample / m_dwSamplesPerSec;
+            m_dwSweepSample = (m_dwSweepSample + cBlock) % m_dwSamplesPerSec;
+        }
+
+        MixBlock(dFrequency, cBlock);
+        WriteBlock(pBuf, cBlock);
+
+        pBuf += cBlock * cbFrame;
+        cFrames -= cBlock;
+    }
+
+} // Generate
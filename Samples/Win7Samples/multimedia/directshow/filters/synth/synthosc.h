@@ -0,0 +1,102 @@
+//------------------------------------------------------------------------------
+// File: SynthOsc.h
+//
+// Desc: DirectShow sample code - wavetable oscillator bank used by the audio
+//       synthesizer filter and by the synthbench benchmark.
+//
+// Copyright (c) Microsoft Corporation.  All rights reserved.
+//------------------------------------------------------------------------------
+
+
+//
+// Which instructions the oscillators may use. Every level produces exactly
+// the same samples as the scalar code.
+//
+enum SYNTH_ISA
+{
+    SYNTH_ISA_SCALAR,
+    SYNTH_ISA_SSE2,
+    SYNTH_ISA_AVX2
+};
+
+// The fastest level this processor and compiler support
+SYNTH_ISA GetBestSynthIsa();
+
+
+//
+// COscillatorBank
+//
+// Plays one of the WAVE_ waveforms from synth.h with up to MAX_VOICES
+// voices at once, each detuned slightly from the others, and writes PCM
+// audio straight into the caller's buffer.
+//
+// Each voice is a 32 bit phase accumulator reading a wavetable. Square and
+// sawtooth have one table per octave, each with only the harmonics that
+// fit below half the sample rate at the top of that octave, so high notes
+// do not alias. The tables are built once by Init; changing the format or
+// any of the parameters afterwards never allocates memory.
+//
+class COscillatorBank
+{
+
+public:
+
+    enum { MAX_VOICES = 64 };
+
+    COscillatorBank();
+    ~COscillatorBank();
+
+    // Build the wavetables. Only the first call does any work.
+    HRESULT Init();
+
+    // These can be called between any two calls to Generate
+    void SetFormat(DWORD dwSamplesPerSec, WORD wBitsPerSample, WORD wChannels);
+    void SetWaveform(int iWaveform);
+    void SetFrequency(int iFrequency);
+    void SetAmplitude(int iAmplitude);
+    void SetSweepRange(int iSweepStart, int iSweepEnd);
+    void SetVoices(int cVoices);
+    void SetIsa(SYNTH_ISA isa) { m_isa = isa; }
+
+    // Fill cb bytes with 8 or 16 bit PCM audio in the current format.
+    // Plays silence until Init has succeeded.
+    void Generate(BYTE *pBuf, int cb);
+
+private:
+
+    enum {
+        TABLE_BITS = 11,
+        TABLE_SIZE = 1 << TABLE_BITS,   // Samples in one cycle
+        LEVELS = 10,                    // Tables per band limited waveform
+        BLOCK_FRAMES = 256              // Samples mixed at a time
+    };
+
+    const int *GetTable(double dCyclesPerSample) const;
+    void MixBlock(double dFrequency, int cFrames);
+    void WriteBlock(BYTE *pBuf, int cFrames);
+    void UpdateGain();
+
+    int        *m_piTables;             // See Init for the layout
+
+    DWORD       m_dwSamplesPerSec;
+    WORD        m_wBitsPerSample;
+    WORD        m_wChannels;
+
+    int         m_iWaveform;
+    int         m_iFrequency;
+    int         m_iAmplitude;           // 0 to 100
+    int         m_iSweepStart;
+    int         m_iSweepEnd;
+    DWORD       m_dwSweepSample;        // 0 to m_dwSamplesPerSec - 1
+
+    int         m_cVoices;
+    int         m_iVoiceGain;           // Q15, the voices add up to at most 1
+    DWORD       m_adwPhase[MAX_VOICES];
+    double      m_adDetune[MAX_VOICES]; // Frequency of each voice / m_iFrequency
+
+    int         m_aiMix[BLOCK_FRAMES];  // Q30 sum of the voices
+
+    SYNTH_ISA   m_isa;
+
+}; // COscillatorBank
+
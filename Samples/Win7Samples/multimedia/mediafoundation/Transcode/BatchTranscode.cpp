@@ -0,0 +1,486 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BatchTranscode.cpp
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//
+// Transcodes a list of files, several at a time, in one process.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "BatchTranscode.h"
+
+#include <process.h>
+#include <stdlib.h>
+#include <wchar.h>
+
+// WaitForMultipleObjects limits the number of worker threads.
+const DWORD MAX_WORKER_THREADS = MAXIMUM_WAIT_OBJECTS;
+
+static double GetSeconds();
+static WCHAR* TrimSpace(WCHAR *s);
+static double RealtimeFactor(MFTIME hnsDuration, double dSeconds);
+
+//-------------------------------------------------------------------
+//  CBatchTranscoder constructor
+//-------------------------------------------------------------------
+
+CBatchTranscoder::CBatchTranscoder() :
+    m_iNextJob(0),
+    m_cJobsDone(0),
+    m_pProfile(NULL),
+    m_cThreads(0),
+    m_dSeconds(0)
+{
+    InitializeCriticalSection(&m_csOutput);
+}
+
+//-------------------------------------------------------------------
+//  CBatchTranscoder destructor
+//-------------------------------------------------------------------
+
+CBatchTranscoder::~CBatchTranscoder()
+{
+    SafeRelease(&m_pProfile);
+    DeleteCriticalSection(&m_csOutput);
+}
+
+
+//-------------------------------------------------------------------
+//  LoadJobList
+//
+//  Reads the job list. Each line holds an input file name and an
+//  output file name, separated by a '|' character, which cannot
+//  appear in a file name:
+//
+//      C:\Media\clip1.mp4 | D:\Out\clip1.wmv
+//
+//  Blank lines and lines that start with '#' are ignored.
+//-------------------------------------------------------------------
+
+HRESULT CBatchTranscoder::LoadJobList(const WCHAR *sJobFile)
+{
+    if (!sJobFile)
+    {
+        return E_INVALIDARG;
+    }
+
+    HRESULT hr = S_OK;
+    FILE *pFile = NULL;
+    DWORD iLine = 0;
+
+    WCHAR szLine[MAX_PATH * 2 + 16];
+
+    if (_wfopen_s(&pFile, sJobFile, L"rt, ccs=UTF-8") != 0)
+    {
+        wprintf_s(L"Could not open the job list %s.\n", sJobFile);
+        return HRESULT_FROM_WIN32(ERROR_FILE_NOT_FOUND);
+    }
+
+    m_Jobs.clear();
+
+    while (fgetws(szLine, ARRAYSIZE(szLine), pFile) != NULL)
+    {
+        iLine++;
+
+        WCHAR *sInput = TrimSpace(szLine);
+
+        if (*sInput == L'\0' || *sInput == L'#')
+        {
+            continue;
+        }
+
+        WCHAR *sSeparator = wcschr(sInput, L'|');
+
+        if (sSeparator == NULL)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            break;
+        }
+
+        *sSeparator = L'\0';
+
+        sInput = TrimSpace(sInput);
+        WCHAR *sOutput = TrimSpace(sSeparator + 1);
+
+        if (*sInput == L'\0' || *sOutput == L'\0' ||
+            wcslen(sInput) >= MAX_PATH || wcslen(sOutput) >= MAX_PATH)
+        {
+            hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+            break;
+        }
+
+        TranscodeJob job;
+        ZeroMemory(&job, sizeof(job));
+
+        wcscpy_s(job.szInput, ARRAYSIZE(job.szInput), sInput);
+        wcscpy_s(job.szOutput, ARRAYSIZE(job.szOutput), sOutput);
+        job.hr = S_FALSE;   // Not run yet.
+
+        m_Jobs.push_back(job);
+    }
+
+    fclose(pFile);
+
+    if (FAILED(hr))
+    {
+        wprintf_s(L"Line %d of the job list is not \"input_file | output_file\".\n", iLine);
+    }
+    else if (m_Jobs.empty())
+    {
+        wprintf_s(L"The job list %s is empty.\n", sJobFile);
+        hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA);
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+//  Run
+//
+//  Configures the transcode profile and runs all of the jobs.
+//
+//  cThreads: Number of transcodes to run at the same time. Zero
+//  means one per processor. Each job is timed separately; a failed
+//  job does not stop the others, and Run succeeds as long as the
+//  worker threads could be started.
+//-------------------------------------------------------------------
+
+HRESULT CBatchTranscoder::Run(DWORD cThreads)
+{
+    HRESULT hr = S_OK;
+
+    HANDLE hThreads[MAX_WORKER_THREADS];
+    DWORD cStarted = 0;
+
+    // Configure the profile once. Enumerating the audio encoder's
+    // output types is the slow part, so the jobs do not repeat it.
+    CTranscoder configurator;
+
+    hr = configurator.CreateProfile();
+
+    if (SUCCEEDED(hr))
+    {
+        hr = configurator.ConfigureAudioOutput();
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = configurator.ConfigureVideoOutput();
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = configurator.ConfigureContainer();
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        SafeRelease(&m_pProfile);
+        hr = configurator.GetProfile(&m_pProfile);
+    }
+
+    if (FAILED(hr))
+    {
+        return hr;
+    }
+
+    // Size the pool to the number of processors, but not more than
+    // the number of jobs.
+    if (cThreads == 0)
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+
+        cThreads = si.dwNumberOfProcessors;
+    }
+
+    cThreads = min(cThreads, (DWORD)m_Jobs.size());
+    cThreads = min(cThreads, MAX_WORKER_THREADS);
+    cThreads = max(cThreads, 1);
+
+    m_iNextJob = 0;
+    m_cJobsDone = 0;
+
+    wprintf_s(L"Transcoding %d files, %d at a time.\n", (DWORD)m_Jobs.size(), cThreads);
+
+    double dStart = GetSeconds();
+
+    for (DWORD i = 0; i < cThreads; i++)
+    {
+        // _beginthreadex reports failure through errno and _doserrno,
+        // not through GetLastError. _doserrno stays 0 if the CRT ran
+        // out of resources before it called CreateThread.
+        _set_doserrno(0);
+
+        hThreads[i] = (HANDLE)_beginthreadex(NULL, 0, WorkerThreadProc, this, 0, NULL);
+
+        if (hThreads[i] == NULL)
+        {
+            unsigned long dosError = 0;
+            _get_doserrno(&dosError);
+
+            hr = (dosError != 0) ? HRESULT_FROM_WIN32(dosError) : E_OUTOFMEMORY;
+            break;
+        }
+
+        cStarted++;
+    }
+
+    // If only some of the threads started, they still run all of the
+    // jobs. If none started, no job ran and the failure is returned.
+    if (cStarted > 0)
+    {
+        WaitForMultipleObjects(cStarted, hThreads, TRUE, INFINITE);
+        hr = S_OK;
+    }
+
+    m_dSeconds = GetSeconds() - dStart;
+    m_cThreads = cStarted;
+
+    for (DWORD i = 0; i < cStarted; i++)
+    {
+        CloseHandle(hThreads[i]);
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+//  PrintReport
+//
+//  Prints the result of each job and the totals for the batch.
+//
+//  The realtime factor is the duration of the media divided by the
+//  time it took to transcode, so 10x means that one minute of media
+//  took six seconds. For the batch, it is the total duration of the
+//  media that was transcoded divided by the wall clock time for the
+//  whole batch.
+//-------------------------------------------------------------------
+
+void CBatchTranscoder::PrintReport()
+{
+    DWORD cSucceeded = 0;
+    MFTIME hnsTotal = 0;
+
+    wprintf_s(L"\n  Job  Result       Media (s)  Time (s)  Realtime  Output\n");
+
+    for (size_t i = 0; i < m_Jobs.size(); i++)
+    {
+        const TranscodeJob& job = m_Jobs[i];
+
+        if (job.hr == S_OK)
+        {
+            cSucceeded++;
+            hnsTotal += job.hnsDuration;
+
+            wprintf_s(L"%5d  OK          %10.1f %9.1f %8.1fx  %s\n",
+                (DWORD)(i + 1),
+                job.hnsDuration / 10000000.0,
+                job.dSeconds,
+                RealtimeFactor(job.hnsDuration, job.dSeconds),
+                job.szOutput
+                );
+        }
+        else
+        {
+            wprintf_s(L"%5d  0x%08X  %10s %9.1f %9s  %s\n",
+                (DWORD)(i + 1),
+                job.hr,
+                L"-",
+                job.dSeconds,
+                L"-",
+                job.szOutput
+                );
+        }
+    }
+
+    wprintf_s(L"\n%d of %d jobs succeeded, %d at a time.\n", cSucceeded, (DWORD)m_Jobs.size(), m_cThreads);
+
+    wprintf_s(L"Transcoded %.1f s of media in %.1f s: %.1fx realtime, %.1fx per thread.\n",
+        hnsTotal / 10000000.0,
+        m_dSeconds,
+        RealtimeFactor(hnsTotal, m_dSeconds),
+        m_cThreads ? RealtimeFactor(hnsTotal, m_dSeconds) / m_cThreads : 0.0
+        );
+}
+
+
+//-------------------------------------------------------------------
+//  WorkerThreadProc
+//
+//  Thread procedure for the worker threads.
+//-------------------------------------------------------------------
+
+unsigned __stdcall CBatchTranscoder::WorkerThreadProc(void *pParam)
+{
+    CBatchTranscoder *pThis = (CBatchTranscoder*)pParam;
+
+    // The media session does not need an apartment with a message
+    // loop, because the events are read synchronously.
+    HRESULT hr = CoInitializeEx(NULL, COINIT_MULTITHREADED);
+
+    if (SUCCEEDED(hr))
+    {
+        pThis->RunJobs();
+        CoUninitialize();
+    }
+
+    return 0;
+}
+
+
+//-------------------------------------------------------------------
+//  RunJobs
+//
+//  Takes jobs from the list until there are none left.
+//-------------------------------------------------------------------
+
+void CBatchTranscoder::RunJobs()
+{
+    for (;;)
+    {
+        LONG iJob = InterlockedIncrement(&m_iNextJob) - 1;
+
+        if (iJob >= (LONG)m_Jobs.size())
+        {
+            break;
+        }
+
+        TranscodeJob *pJob = &m_Jobs[iJob];
+
+        RunJob(pJob);
+
+        LONG cDone = InterlockedIncrement(&m_cJobsDone);
+
+        EnterCriticalSection(&m_csOutput);
+
+        if (SUCCEEDED(pJob->hr))
+        {
+            wprintf_s(L"[%d/%d] %s: %.1fx realtime.\n", cDone, (DWORD)m_Jobs.size(),
+                pJob->szOutput, RealtimeFactor(pJob->hnsDuration, pJob->dSeconds));
+        }
+        else
+        {
+            wprintf_s(L"[%d/%d] %s: failed (0x%X).\n", cDone, (DWORD)m_Jobs.size(),
+                pJob->szInput, pJob->hr);
+        }
+
+        LeaveCriticalSection(&m_csOutput);
+    }
+}
+
+
+//-------------------------------------------------------------------
+//  RunJob
+//
+//  Transcodes one file with the shared profile.
+//-------------------------------------------------------------------
+
+void CBatchTranscoder::RunJob(TranscodeJob *pJob)
+{
+    HRESULT hr = S_OK;
+
+    double dStart = GetSeconds();
+
+    {
+        CTranscoder transcoder;
+
+        transcoder.SetQuiet(TRUE);
+
+        // Set the profile first, so that OpenFile does not create one.
+        hr = transcoder.SetProfile(m_pProfile);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = transcoder.OpenFile(pJob->szInput);
+        }
+
+        // Some sources do not know their duration. The job still
+        // runs, but its realtime factor cannot be computed.
+        if (SUCCEEDED(hr))
+        {
+            if (FAILED(transcoder.GetDuration(&pJob->hnsDuration)))
+            {
+                pJob->hnsDuration = 0;
+            }
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            hr = transcoder.EncodeToFile(pJob->szOutput);
+        }
+
+        // The transcoder shuts down the session and the source when
+        // it is destroyed, which is part of the time for the job.
+    }
+
+    pJob->dSeconds = GetSeconds() - dStart;
+    pJob->hr = SUCCEEDED(hr) ? S_OK : hr;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//  GetSeconds
+//
+//  Returns the performance counter, in seconds.
+///////////////////////////////////////////////////////////////////////
+
+static double GetSeconds()
+{
+    LARGE_INTEGER counter, frequency;
+
+    QueryPerformanceCounter(&counter);
+    QueryPerformanceFrequency(&frequency);
+
+    return (double)counter.QuadPart / (double)frequency.QuadPart;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//  TrimSpace
+//
+//  Removes white space, including the newline, from both ends of a
+//  string, in place.
+///////////////////////////////////////////////////////////////////////
+
+static WCHAR* TrimSpace(WCHAR *s)
+{
+    while (iswspace(*s))
+    {
+        s++;
+    }
+
+    size_t cch = wcslen(s);
+
+    while (cch > 0 && iswspace(s[cch - 1]))
+    {
+        s[--cch] = L'\0';
+    }
+
+    return s;
+}
+
+
+///////////////////////////////////////////////////////////////////////
+//  RealtimeFactor
+//
+//  Returns the media duration divided by the time to transcode it.
+///////////////////////////////////////////////////////////////////////
+
+static double RealtimeFactor(MFTIME hnsDuration, double dSeconds)
+{
+    if (dSeconds <= 0)
+    {
+        return 0;
+    }
+    return (hnsDuration / 10000000.0) / dSeconds;
+}
@@ -0,0 +1,71 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// BatchTranscode.h
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//
+// Transcodes a list of files, several at a time, in one process.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "Transcode.h"
+
+#include <vector>
+
+// One input file and the output file to create from it.
+struct TranscodeJob
+{
+    WCHAR   szInput[MAX_PATH];
+    WCHAR   szOutput[MAX_PATH];
+
+    HRESULT hr;             // Result of the transcode.
+    MFTIME  hnsDuration;    // Duration of the input file.
+    double  dSeconds;       // Wall clock time to open and transcode it.
+};
+
+
+//-------------------------------------------------------------------
+//  CBatchTranscoder
+//
+//  Runs the jobs in a job list on a pool of worker threads. Each
+//  worker runs one transcode at a time, with its own CTranscoder and
+//  media session, and takes the next job from the list when it is
+//  done. The transcode profile is configured once and shared by all
+//  of the jobs.
+//-------------------------------------------------------------------
+
+class CBatchTranscoder
+{
+public:
+    CBatchTranscoder();
+    ~CBatchTranscoder();
+
+    HRESULT LoadJobList(const WCHAR *sJobFile);
+    HRESULT Run(DWORD cThreads);
+    void    PrintReport();
+
+private:
+
+    static unsigned __stdcall WorkerThreadProc(void *pParam);
+
+    void    RunJobs();
+    void    RunJob(TranscodeJob *pJob);
+
+    std::vector<TranscodeJob>   m_Jobs;
+    volatile LONG               m_iNextJob;     // Index of the next job to start.
+    volatile LONG               m_cJobsDone;
+
+    IMFTranscodeProfile*        m_pProfile;     // Read-only while the jobs run.
+    CRITICAL_SECTION            m_csOutput;     // Keeps the progress messages whole.
+
+    DWORD                       m_cThreads;
+    double                      m_dSeconds;     // Wall clock time for the whole batch.
+};
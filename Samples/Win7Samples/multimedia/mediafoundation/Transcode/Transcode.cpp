@@ -28,7 +28,8 @@ CTranscoder::CTranscoder() :
     m_pSession(NULL),
     m_pSource(NULL),
     m_pTopology(NULL),
-    m_pProfile(NULL)
+    m_pProfile(NULL),
+    m_bQuiet(FALSE)
 {
 
 }
@@ -54,7 +55,7 @@ CTranscoder::~CTranscoder()
 //  1. Creates a media source for the caller specified URL.
 //  2. Creates the media session.
 //  3. Creates a transcode profile to hold the stream and 
-//     container attributes.
+//     container attributes, unless SetProfile was called.
 //
 //  sURL: Input file URL.
 //-------------------------------------------------------------------
@@ -78,10 +79,114 @@ HRESULT CTranscoder::OpenFile(const WCHAR *sURL)
     }    
 
     // Create an empty transcode profile.
+    if (SUCCEEDED(hr) && (m_pProfile == NULL))
+    {
+        hr = CreateProfile();
+    }
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+//  CreateProfile
+//        
+//  Creates an empty transcode profile, replacing the current one.
+//  OpenFile calls this. Call it directly to configure a profile 
+//  without opening a file, for example to share it with SetProfile.
+//-------------------------------------------------------------------
+
+HRESULT CTranscoder::CreateProfile()
+{
+    SafeRelease(&m_pProfile);
+
+    return MFCreateTranscodeProfile(&m_pProfile);
+}
+
+
+//-------------------------------------------------------------------
+//  GetProfile
+//        
+//  Returns the transcode profile, with the stream and container 
+//  attributes set by the Configure methods.
+//-------------------------------------------------------------------
+
+HRESULT CTranscoder::GetProfile(IMFTranscodeProfile **ppProfile)
+{
+    if (!ppProfile)
+    {
+        return E_POINTER;
+    }
+
+    if (!m_pProfile)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    *ppProfile = m_pProfile;
+    (*ppProfile)->AddRef();
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+//  SetProfile
+//        
+//  Uses a profile that is already configured, instead of calling 
+//  the Configure methods. The profile is only read when the topology
+//  is built, so the same profile can be set on several transcoders.
+//  Do not change it while any of them is in EncodeToFile.
+//-------------------------------------------------------------------
+
+HRESULT CTranscoder::SetProfile(IMFTranscodeProfile *pProfile)
+{
+    if (!pProfile)
+    {
+        return E_INVALIDARG;
+    }
+
+    SafeRelease(&m_pProfile);
+
+    m_pProfile = pProfile;
+    m_pProfile->AddRef();
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+//  GetDuration
+//        
+//  Returns the duration of the input file, in 100-nanosecond units.
+//-------------------------------------------------------------------
+
+HRESULT CTranscoder::GetDuration(MFTIME *phnsDuration)
+{
+    assert (m_pSource);
+
+    if (!phnsDuration)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+    UINT64 hnsDuration = 0;
+
+    IMFPresentationDescriptor *pPD = NULL;
+
+    hr = m_pSource->CreatePresentationDescriptor(&pPD);
+
     if (SUCCEEDED(hr))
     {
-        hr = MFCreateTranscodeProfile(&m_pProfile);
+        hr = pPD->GetUINT64(MF_PD_DURATION, &hnsDuration);
     }
+
+    if (SUCCEEDED(hr))
+    {
+        *phnsDuration = (MFTIME)hnsDuration;
+    }
+
+    SafeRelease(&pPD);
     return hr;
 }
 
@@ -380,26 +485,32 @@ HRESULT CTranscoder::Transcode()
         {
         case MESessionTopologySet:
             hr = Start();
-            if (SUCCEEDED(hr))
+            if (SUCCEEDED(hr) && !m_bQuiet)
             {
                 wprintf_s(L"Ready to start.\n");
             }
             break;
 
         case MESessionStarted:
-            wprintf_s(L"Started encoding...\n");
+            if (!m_bQuiet)
+            {
+                wprintf_s(L"Started encoding...\n");
+            }
             break;
 
         case MESessionEnded:
             hr = m_pSession->Close();
-            if (SUCCEEDED(hr))
+            if (SUCCEEDED(hr) && !m_bQuiet)
             {
                 wprintf_s(L"Finished encoding.\n");
             }
             break;
 
         case MESessionClosed:
-            wprintf_s(L"Output file created.\n");
+            if (!m_bQuiet)
+            {
+                wprintf_s(L"Output file created.\n");
+            }
             break;
         }
 
@@ -23,6 +23,7 @@
 #include <assert.h>
 #include <mfapi.h>
 #include <mfidl.h>
+#include <mferror.h>
 
 template <class T> void SafeRelease(T **ppT)
 {
@@ -46,6 +47,17 @@ public:
     HRESULT ConfigureContainer();
     HRESULT EncodeToFile(const WCHAR *sURL);
 
+    // Profile sharing. A profile configured once can be used by
+    // any number of transcoders, including on other threads.
+    HRESULT CreateProfile();
+    HRESULT GetProfile(IMFTranscodeProfile **ppProfile);
+    HRESULT SetProfile(IMFTranscodeProfile *pProfile);
+
+    HRESULT GetDuration(MFTIME *phnsDuration);
+
+    // Suppresses the progress messages, for running several at once.
+    void SetQuiet(BOOL bQuiet) { m_bQuiet = bQuiet; }
+
 private:
 
     HRESULT Shutdown();
@@ -56,4 +68,5 @@ private:
     IMFMediaSource*         m_pSource;
     IMFTopology*            m_pTopology;
     IMFTranscodeProfile*    m_pProfile;
+    BOOL                    m_bQuiet;
 };
\ No newline at end of file
@@ -15,14 +15,23 @@
 ////////////////////////////////////////////////////////////////////////// 
 
 #include "Transcode.h"
+#include "BatchTranscode.h"
+
+int RunBatch(const WCHAR *sJobFile, DWORD cThreads);
 
 int wmain(int argc, wchar_t* argv[])
 {
     (void)HeapSetInformation(NULL, HeapEnableTerminationOnCorruption, NULL, 0);
 
+    if (argc >= 3 && _wcsicmp(argv[1], L"-batch") == 0)
+    {
+        return RunBatch(argv[2], (argc >= 4) ? (DWORD)_wtoi(argv[3]) : 0);
+    }
+
     if (argc != 3)
     {
         wprintf_s(L"Usage: %s input_file output_file\n", argv[0]);
+        wprintf_s(L"       %s -batch job_list [threads]\n", argv[0]);
         return 0;
     }
 
@@ -87,3 +96,53 @@ int wmain(int argc, wchar_t* argv[])
     return 0;
 }
 
+
+//-------------------------------------------------------------------
+//  RunBatch
+//
+//  Transcodes every file in a job list, several at a time.
+//
+//  sJobFile: Job list. See CBatchTranscoder::LoadJobList.
+//  cThreads: Number of files to transcode at the same time, or zero 
+//            for one per processor.
+//-------------------------------------------------------------------
+
+int RunBatch(const WCHAR *sJobFile, DWORD cThreads)
+{
+    HRESULT hr = S_OK;
+
+    // The worker threads use the multithreaded apartment.
+    hr = CoInitializeEx(NULL, COINIT_MULTITHREADED | COINIT_DISABLE_OLE1DDE);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = MFStartup(MF_VERSION);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        CBatchTranscoder batch;
+
+        hr = batch.LoadJobList(sJobFile);
+
+        if (SUCCEEDED(hr))
+        {
+            hr = batch.Run(cThreads);
+        }
+
+        if (SUCCEEDED(hr))
+        {
+            batch.PrintReport();
+        }
+    }
+
+    MFShutdown();
+    CoUninitialize();
+
+    if (FAILED(hr))
+    {
+        wprintf_s(L"Could not run the batch (0x%X).\n", hr);
+    }
+
+    return 0;
+}
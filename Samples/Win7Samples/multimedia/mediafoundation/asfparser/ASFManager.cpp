@@ -132,7 +132,12 @@ HRESULT CASFManager::OpenASFFile(const WCHAR *sFileName)
 
     CHECK_HR(hr = CreateASFSplitter(pStream, &m_pSplitter));
 
-    CHECK_HR(hr = CreateASFIndexer(pStream, &m_pIndexer));
+    // The saved seek index replaces the ASF Index Object, so the index
+    // object is only read while the seek index is not ready.
+    if (OpenSeekIndex(sFileName) != S_OK)
+    {
+        CHECK_HR(hr = CreateASFIndexer(pStream, &m_pIndexer));
+    }
 
 done:
     
@@ -360,6 +365,72 @@ done:
     return hr;
 }
 
+/////////////////////////////////////////////////////////////////////
+// Name: OpenSeekIndex
+//
+// Opens the seek index that is saved next to the file, or starts 
+// building it in the background the first time the file is opened.
+// See CASFSeekIndex.
+//
+// sFileName: Path name of the file
+//
+// Returns S_OK if the seek index is ready, S_FALSE if it is being 
+// built. Failure is not fatal: seeking then works as before.
+/////////////////////////////////////////////////////////////////////
+
+HRESULT CASFManager::OpenSeekIndex(const WCHAR *sFileName)
+{
+    if (!m_pContentInfo)
+    {
+        return MF_E_NOT_INITIALIZED;
+    }
+
+    HRESULT hr = S_OK;
+
+    IMFPresentationDescriptor *pPD = NULL;
+
+    GUID guidFileID = GUID_NULL;
+    UINT32 cPackets = 0, cbMinPacketSize = 0, cbMaxPacketSize = 0;
+    UINT64 msPreroll = 0;
+
+    CHECK_HR(hr = m_pContentInfo->GeneratePresentationDescriptor(&pPD));
+
+    CHECK_HR(hr = pPD->GetGUID(MF_PD_ASF_FILEPROPERTIES_FILE_ID, &guidFileID));
+
+    CHECK_HR(hr = pPD->GetUINT32(MF_PD_ASF_FILEPROPERTIES_PACKETS, &cPackets));
+
+    CHECK_HR(hr = pPD->GetUINT32(MF_PD_ASF_FILEPROPERTIES_MIN_PACKET_SIZE, &cbMinPacketSize));
+
+    CHECK_HR(hr = pPD->GetUINT32(MF_PD_ASF_FILEPROPERTIES_MAX_PACKET_SIZE, &cbMaxPacketSize));
+
+    CHECK_HR(hr = pPD->GetUINT64(MF_PD_ASF_FILEPROPERTIES_PREROLL, &msPreroll));
+
+    //The index stores packet numbers, which are only offsets if all packets are the same size
+    if (cbMinPacketSize != cbMaxPacketSize)
+    {
+        CHECK_HR(hr = MF_E_ASF_INVALIDDATA);
+    }
+
+    //m_cbDataOffset and m_cbDataLength are set by CreateASFSplitter
+    CHECK_HR(hr = m_SeekIndex.Open(
+        sFileName, 
+        guidFileID, 
+        cbMinPacketSize, 
+        cPackets, 
+        m_cbDataOffset, 
+        m_cbDataLength, 
+        (MFTIME)msPreroll * 10000
+        ));
+
+done:
+
+    LOG_MSG_IF_FAILED(L"CASFManager::OpenSeekIndex failed.\n", hr);
+
+    SAFE_RELEASE(pPD);
+
+    return hr;
+}
+
 /////////////////////////////////////////////////////////////////////
 // Name: EnumerateStreams
 //
@@ -663,6 +734,31 @@ HRESULT CASFManager::GetSeekPosition (MFTIME* hnsSeekTime,
 {
     HRESULT hr = S_OK;
 
+    DWORD dwFlags = 0;
+
+    //once the seek index is ready, use it for any stream: it finds the
+    //packet for audio too, and works for files without an index object
+    if (m_SeekIndex.IsReady())
+    {
+        CHECK_HR(hr = m_pSplitter->GetFlags(&dwFlags));
+
+        hr = m_SeekIndex.GetSeekPosition(
+            m_CurrentStreamID,
+            *hnsSeekTime,
+            (m_guidCurrentMediaType == MFMediaType_Video),   // seek to key frames
+            (dwFlags & MFASF_SPLITTER_REVERSE),
+            pcbDataOffset,
+            phnsApproxSeekTime
+            );
+
+        if (SUCCEEDED(hr))
+        {
+            goto done;
+        }
+
+        //no entries for this stream, fall back
+        hr = S_OK;
+    }
 
     //if the media type is audio, or doesn't have an indexed data
     //calculate the offset manually
@@ -672,7 +768,7 @@ HRESULT CASFManager::GetSeekPosition (MFTIME* hnsSeekTime,
     }
 
     //if the type is video, get the position with the indexer
-    if (( m_guidCurrentMediaType == MFMediaType_Video))
+    else if (( m_guidCurrentMediaType == MFMediaType_Video))
     {
         CHECK_HR(hr =  GetSeekPositionWithIndexer(*hnsSeekTime, pcbDataOffset, phnsApproxSeekTime));        
     }
@@ -1440,6 +1536,8 @@ done:
 
 void CASFManager::Reset()
 {
+    m_SeekIndex.Close();
+
     SAFE_RELEASE( m_pContentInfo);
     SAFE_RELEASE( m_pDataBuffer);
     SAFE_RELEASE( m_pIndexer);
@@ -15,6 +15,7 @@
 
 #include "MF_ASFParser.h"
 #include "Decoder.h"
+#include "ASFSeekIndex.h"
 
 class CASFManager : public IUnknown
 {
@@ -106,6 +107,8 @@ protected:
 
     HRESULT CreateASFIndexer(IMFByteStream *pContentByteStream, IMFASFIndexer **ppIndexer);
 
+    HRESULT OpenSeekIndex(const WCHAR *sFileName);
+
     HRESULT ReadDataIntoBuffer(
         IMFByteStream *pStream,     
         DWORD cbOffset,             
@@ -177,6 +180,9 @@ protected:
     IMFASFIndexer*      m_pIndexer;
     IMFMediaBuffer*     m_pDataBuffer;
 
+    //Seek index saved next to the file
+    CASFSeekIndex       m_SeekIndex;
+
 
     // TEST!
     IMFByteStream*      m_pByteStream;
@@ -0,0 +1,1153 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ASFSeekIndex.cpp : CASFSeekIndex class implementation.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <new>
+#include <vector>
+#include <algorithm>
+#include <process.h>
+#include "ASFSeekIndex.h"
+
+//Constants
+#define SEEK_INDEX_READ_SIZE    (1024 * 1024)       // Bytes of packets per read while building.
+#define SEEK_INDEX_WRITE_SIZE   (64 * 1024 * 1024)  // Largest single write of the index file.
+
+// ----- Packet parsing ------------------------------------------------
+//////////////////////////////////////////////////////////////////////////
+//  CPacketReader
+//  Description: Reads the fields of an ASF data packet. Reading past the
+//  end of the packet returns zeros and sets the overrun flag, so the
+//  parser checks for a damaged packet once, instead of at every field.
+/////////////////////////////////////////////////////////////////////////
+
+class CPacketReader
+{
+public:
+    CPacketReader(const BYTE *pData, UINT32 cbData)
+        : m_p(pData), m_pEnd(pData + cbData), m_bOverrun(FALSE)
+    {
+    }
+
+    BOOL Overrun() const { return m_bOverrun; }
+
+    void Skip(UINT32 cb)
+    {
+        if ((UINT32)(m_pEnd - m_p) < cb)
+        {
+            m_p = m_pEnd;
+            m_bOverrun = TRUE;
+        }
+        else
+        {
+            m_p += cb;
+        }
+    }
+
+    // Reads a little-endian value of 0, 1, 2, or 4 bytes.
+    UINT32 Read(UINT32 cb)
+    {
+        UINT32 value = 0;
+
+        if ((UINT32)(m_pEnd - m_p) < cb)
+        {
+            m_p = m_pEnd;
+            m_bOverrun = TRUE;
+            return 0;
+        }
+
+        for (UINT32 i = 0; i < cb; i++)
+        {
+            value |= (UINT32)m_p[i] << (8 * i);
+        }
+
+        m_p += cb;
+        return value;
+    }
+
+    // Reads a field whose size is given by a 2-bit length type:
+    // 0 = not present, 1 = BYTE, 2 = WORD, 3 = DWORD.
+    UINT32 ReadField(UINT32 dwLengthType)
+    {
+        static const UINT32 s_cbField[4] = { 0, 1, 2, 4 };
+
+        return Read(s_cbField[dwLengthType & 3]);
+    }
+
+private:
+    const BYTE* m_p;
+    const BYTE* m_pEnd;
+    BOOL        m_bOverrun;
+};
+
+
+/////////////////////////////////////////////////////////////////////
+// Name: AddPacketEntry
+//
+// Records that a media object starts in the current packet. Each
+// stream gets one entry per packet: the first object that starts in
+// the packet, or the first key frame if a later object is one.
+/////////////////////////////////////////////////////////////////////
+
+static void AddPacketEntry(
+    SEEK_INDEX_ENTRY *pPacketEntries,
+    UINT32 *pcPacketEntries,
+    const SEEK_INDEX_ENTRY& entry
+    )
+{
+    for (UINT32 i = 0; i < *pcPacketEntries; i++)
+    {
+        if (pPacketEntries[i].wStreamNumber == entry.wStreamNumber)
+        {
+            if (!(pPacketEntries[i].wFlags & SEEK_INDEX_KEYFRAME) && (entry.wFlags & SEEK_INDEX_KEYFRAME))
+            {
+                pPacketEntries[i] = entry;
+            }
+            return;
+        }
+    }
+
+    if (*pcPacketEntries < MAX_ASF_STREAMS)
+    {
+        pPacketEntries[(*pcPacketEntries)++] = entry;
+    }
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Name: ParsePacket
+//
+// Parses the header and the payload headers of one ASF data packet
+// and returns an entry for each stream that has a media object
+// starting in the packet. See the ASF specification, section 5.2.
+//
+// Returns FALSE if the packet is damaged. The payload data itself is
+// not read.
+/////////////////////////////////////////////////////////////////////
+
+static BOOL ParsePacket(
+    const BYTE *pPacket,
+    UINT32 cbPacket,
+    UINT32 iPacket,
+    MFTIME hnsPreroll,
+    SEEK_INDEX_ENTRY *pPacketEntries,
+    UINT32 *pcPacketEntries
+    )
+{
+    CPacketReader reader(pPacket, cbPacket);
+
+    *pcPacketEntries = 0;
+
+    // Error correction data, if present, comes before the length type flags.
+    UINT32 bFlags = reader.Read(1);
+
+    if (bFlags & 0x80)
+    {
+        // Only the opaque error correction data type is defined.
+        if (bFlags & 0x70)
+        {
+            return FALSE;
+        }
+        reader.Skip(bFlags & 0x0F);
+
+        bFlags = reader.Read(1);
+    }
+
+    const UINT32 bLengthTypeFlags = bFlags;
+    const UINT32 bPropertyFlags = reader.Read(1);
+
+    const BOOL   bMultiplePayloads = (bLengthTypeFlags & 0x01);
+
+    reader.ReadField(bLengthTypeFlags >> 5);    // Packet length
+    reader.ReadField(bLengthTypeFlags >> 1);    // Sequence
+    reader.ReadField(bLengthTypeFlags >> 3);    // Padding length
+    reader.Skip(sizeof(DWORD) + sizeof(WORD));  // Send time and duration
+
+    const UINT32 dwReplicatedDataLengthType = bPropertyFlags;
+    const UINT32 dwOffsetLengthType = bPropertyFlags >> 2;
+    const UINT32 dwObjectNumberLengthType = bPropertyFlags >> 4;
+
+    // The stream number is always one byte.
+    if (((bPropertyFlags >> 6) & 3) != 1)
+    {
+        return FALSE;
+    }
+
+    UINT32 cPayloads = 1;
+    UINT32 dwPayloadLengthType = 0;
+
+    if (bMultiplePayloads)
+    {
+        UINT32 bPayloadFlags = reader.Read(1);
+
+        cPayloads = bPayloadFlags & 0x3F;
+        dwPayloadLengthType = (bPayloadFlags >> 6) & 3;
+
+        if (dwPayloadLengthType == 0)
+        {
+            return FALSE;
+        }
+    }
+
+    for (UINT32 i = 0; i < cPayloads; i++)
+    {
+        UINT32 bStreamNumber = reader.Read(1);
+
+        reader.ReadField(dwObjectNumberLengthType);
+
+        UINT32 dwOffsetIntoObject = reader.ReadField(dwOffsetLengthType);
+        UINT32 cbReplicatedData = reader.ReadField(dwReplicatedDataLengthType);
+
+        UINT32 msPresentationTime = 0;
+        BOOL   bObjectStart = FALSE;
+
+        if (cbReplicatedData == 1)
+        {
+            // Compressed payload: a group of whole media objects. The
+            // offset field holds the presentation time of the first one.
+            msPresentationTime = dwOffsetIntoObject;
+            bObjectStart = TRUE;
+
+            reader.Skip(1);     // Presentation time delta
+        }
+        else if (cbReplicatedData >= 8)
+        {
+            // The replicated data starts with the size of the media
+            // object and its presentation time.
+            reader.Skip(sizeof(DWORD));
+            msPresentationTime = reader.Read(sizeof(DWORD));
+            bObjectStart = (dwOffsetIntoObject == 0);
+
+            reader.Skip(cbReplicatedData - 8);
+        }
+        else
+        {
+            // No presentation time, so the payload cannot be indexed.
+            reader.Skip(cbReplicatedData);
+        }
+
+        if (bMultiplePayloads)
+        {
+            reader.Skip(reader.ReadField(dwPayloadLengthType));
+        }
+
+        if (reader.Overrun())
+        {
+            return FALSE;
+        }
+
+        if (bObjectStart)
+        {
+            SEEK_INDEX_ENTRY entry;
+
+            entry.hnsTime = max((MFTIME)msPresentationTime * 10000 - hnsPreroll, 0);
+            entry.iPacket = iPacket;
+            entry.wStreamNumber = (WORD)(bStreamNumber & 0x7F);
+            entry.wFlags = (bStreamNumber & 0x80) ? SEEK_INDEX_KEYFRAME : 0;
+
+            AddPacketEntry(pPacketEntries, pcPacketEntries, entry);
+        }
+    }
+
+    return TRUE;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: CompareEntries
+//  Description: Sort order of the index: by stream, then by time, then
+//  by position in the file.
+/////////////////////////////////////////////////////////////////////////
+
+static bool CompareEntries(const SEEK_INDEX_ENTRY& a, const SEEK_INDEX_ENTRY& b)
+{
+    if (a.wStreamNumber != b.wStreamNumber)
+    {
+        return a.wStreamNumber < b.wStreamNumber;
+    }
+    if (a.hnsTime != b.hnsTime)
+    {
+        return a.hnsTime < b.hnsTime;
+    }
+    return a.iPacket < b.iPacket;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: FindEntry
+//  Description: Returns the first entry, starting at iStart and moving
+//  forward or backward, that is a key frame (or any entry, if
+//  bKeyFramesOnly is FALSE). Returns cEntries if there is none.
+/////////////////////////////////////////////////////////////////////////
+
+static UINT32 FindEntry(
+    const SEEK_INDEX_ENTRY *pEntries,
+    UINT32 cEntries,
+    UINT32 iStart,
+    BOOL bForward,
+    BOOL bKeyFramesOnly
+    )
+{
+    if (bForward)
+    {
+        for (UINT32 i = iStart; i < cEntries; i++)
+        {
+            if (!bKeyFramesOnly || (pEntries[i].wFlags & SEEK_INDEX_KEYFRAME))
+            {
+                return i;
+            }
+        }
+    }
+    else
+    {
+        for (UINT32 i = min(iStart + 1, cEntries); i-- > 0; )
+        {
+            if (!bKeyFramesOnly || (pEntries[i].wFlags & SEEK_INDEX_KEYFRAME))
+            {
+                return i;
+            }
+        }
+    }
+    return cEntries;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: CountEntriesBefore
+//  Description: Binary search. Returns the number of entries with a time
+//  before hnsTime, or at or before hnsTime if bInclusive is TRUE.
+/////////////////////////////////////////////////////////////////////////
+
+static UINT32 CountEntriesBefore(
+    const SEEK_INDEX_ENTRY *pEntries,
+    UINT32 cEntries,
+    MFTIME hnsTime,
+    BOOL bInclusive
+    )
+{
+    UINT32 iLow = 0, iHigh = cEntries;
+
+    while (iLow < iHigh)
+    {
+        UINT32 iMid = iLow + (iHigh - iLow) / 2;
+
+        if (pEntries[iMid].hnsTime < hnsTime || (bInclusive && pEntries[iMid].hnsTime == hnsTime))
+        {
+            iLow = iMid + 1;
+        }
+        else
+        {
+            iHigh = iMid;
+        }
+    }
+    return iLow;
+}
+
+
+// ----- Public Methods -----------------------------------------------
+//////////////////////////////////////////////////////////////////////////
+//  Name: CASFSeekIndex
+//  Description: Constructor
+//
+/////////////////////////////////////////////////////////////////////////
+
+CASFSeekIndex::CASFSeekIndex()
+:   m_bSaveIndex(FALSE),
+    m_cbFirstPacket(0),
+    m_cbDataLength(0),
+    m_hnsPreroll(0),
+    m_hThread(NULL),
+    m_bCancel(FALSE),
+    m_pImage(NULL),
+    m_bMapped(FALSE),
+    m_pStreams(NULL),
+    m_pEntries(NULL)
+{
+    InitializeCriticalSection(&m_critSec);
+
+    m_szFileName[0] = L'\0';
+    m_szIndexFile[0] = L'\0';
+
+    ZeroMemory(&m_header, sizeof(m_header));
+}
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: ~CASFSeekIndex
+//  Description: Destructor
+//
+//  -Calls Close
+/////////////////////////////////////////////////////////////////////////
+
+CASFSeekIndex::~CASFSeekIndex()
+{
+    Close();
+
+    DeleteCriticalSection(&m_critSec);
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Name: Open
+//
+// Loads the seek index for a file, or starts building it.
+//
+// sFileName:     Path name of the ASF file.
+// guidFileID:    File ID from the File Properties Object.
+// cbPacketSize:  Size of each data packet.
+// cPackets:      Number of data packets.
+// cbFirstPacket: Offset of the first data packet from the start of
+//                the file.
+// cbDataLength:  Length of the data, as used by GetSeekPosition for
+//                reverse playback.
+// hnsPreroll:    Preroll, which is subtracted from the times.
+//
+// Returns S_OK if the saved index matches the file, so that it is
+// ready now, or S_FALSE if the index is being built. Until IsReady
+// returns TRUE, the caller must seek some other way.
+/////////////////////////////////////////////////////////////////////
+
+HRESULT CASFSeekIndex::Open(
+    const WCHAR *sFileName,
+    const GUID& guidFileID,
+    UINT32 cbPacketSize,
+    UINT32 cPackets,
+    UINT64 cbFirstPacket,
+    UINT64 cbDataLength,
+    MFTIME hnsPreroll
+    )
+{
+    if (!sFileName)
+    {
+        return E_INVALIDARG;
+    }
+
+    // Packet numbers can only be turned into offsets if all of the
+    // packets are the same size, which ASF requires.
+    if (cbPacketSize == 0 || cPackets == 0)
+    {
+        return MF_E_ASF_INVALIDDATA;
+    }
+
+    Close();
+
+    HRESULT hr = S_OK;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+
+    BY_HANDLE_FILE_INFORMATION info;
+
+    CHECK_HR(hr = StringCchCopy(m_szFileName, MAX_PATH, sFileName));
+
+    // Without room for the index file name, the index is only kept in memory.
+    m_bSaveIndex = SUCCEEDED(StringCchPrintf(
+        m_szIndexFile, MAX_PATH, L"%s%s", sFileName, SEEK_INDEX_EXTENSION));
+
+    // The size and the last write time tell whether the file has
+    // changed since the index was saved.
+    hFile = CreateFile(sFileName, FILE_READ_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_WRITE,
+        NULL, OPEN_EXISTING, 0, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    if (!GetFileInformationByHandle(hFile, &info))
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    m_header.dwMagic = SEEK_INDEX_MAGIC;
+    m_header.dwVersion = SEEK_INDEX_VERSION;
+    m_header.guidFileID = guidFileID;
+    m_header.cbFileSize = ((UINT64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+    m_header.ftLastWriteTime = info.ftLastWriteTime;
+    m_header.cbPacketSize = cbPacketSize;
+    m_header.cPackets = cPackets;
+    m_header.cStreams = 0;
+    m_header.cEntries = 0;
+
+    m_cbFirstPacket = cbFirstPacket;
+    m_cbDataLength = cbDataLength;
+    m_hnsPreroll = hnsPreroll;
+
+    // Use the saved index if there is one for this file.
+    if (m_bSaveIndex && SUCCEEDED(MapIndexFile()))
+    {
+        TRACE((L"Mapped the seek index.\n"));
+        goto done;
+    }
+
+    // Otherwise build it, without holding up the caller.
+    m_bCancel = FALSE;
+
+    m_hThread = (HANDLE)_beginthreadex(NULL, 0, BuildThreadProc, this, 0, NULL);
+
+    if (!m_hThread)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    (void)SetThreadPriority(m_hThread, THREAD_PRIORITY_BELOW_NORMAL);
+
+    TRACE((L"Building the seek index.\n"));
+
+    hr = S_FALSE;
+
+done:
+
+    LOG_MSG_IF_FAILED(L"CASFSeekIndex::Open failed.\n", hr);
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+    return hr;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: Close
+//  Description: Stops building the index and releases it.
+//
+/////////////////////////////////////////////////////////////////////////
+
+void CASFSeekIndex::Close()
+{
+    if (m_hThread)
+    {
+        InterlockedExchange(&m_bCancel, TRUE);
+
+        WaitForSingleObject(m_hThread, INFINITE);
+        CloseHandle(m_hThread);
+        m_hThread = NULL;
+    }
+
+    EnterCriticalSection(&m_critSec);
+    FreeImage();
+    LeaveCriticalSection(&m_critSec);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: IsReady
+//  Description: Returns TRUE once the index can be used for seeking.
+//
+/////////////////////////////////////////////////////////////////////////
+
+BOOL CASFSeekIndex::IsReady()
+{
+    EnterCriticalSection(&m_critSec);
+    BOOL bReady = (m_pImage != NULL);
+    LeaveCriticalSection(&m_critSec);
+
+    return bReady;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Name: GetSeekPosition
+//
+// Gets the offset from the first data packet at which to start
+// parsing, in the same way as CASFManager::GetSeekPosition.
+//
+// wStreamNumber:  Stream to seek in.
+// hnsSeekTime:    Presentation time in hns, without the preroll.
+// bKeyFramesOnly: Seek to a key frame (video) or to any media
+//                 object (audio).
+// bReverse:       Parsing goes backward. The offset is then counted
+//                 from the end of the data, and parsing back from it
+//                 reaches the media object at or before the seek time.
+//                 Otherwise parsing forward from the offset reaches
+//                 the media object at the seek time, or the first key
+//                 frame after it.
+// pcbDataOffset:  Receives the offset in bytes.
+// phnsApproxSeekTime: Receives the time of the media object that was
+//                 found. Can be NULL.
+/////////////////////////////////////////////////////////////////////
+
+HRESULT CASFSeekIndex::GetSeekPosition(
+    WORD wStreamNumber,
+    MFTIME hnsSeekTime,
+    BOOL bKeyFramesOnly,
+    BOOL bReverse,
+    QWORD *pcbDataOffset,
+    MFTIME *phnsApproxSeekTime
+    )
+{
+    if (!pcbDataOffset)
+    {
+        return E_POINTER;
+    }
+
+    HRESULT hr = S_OK;
+
+    const SEEK_INDEX_HEADER *pHeader = NULL;
+    const SEEK_INDEX_ENTRY *pEntries = NULL;
+
+    UINT32 cEntries = 0;
+    UINT32 iEntry = 0;
+    UINT32 iPacket = 0, iLastPacket = 0;
+    UINT64 cbEnd = 0;
+
+    EnterCriticalSection(&m_critSec);
+
+    if (!m_pImage)
+    {
+        CHECK_HR(hr = MF_E_NOT_INITIALIZED);
+    }
+
+    pHeader = (const SEEK_INDEX_HEADER*)m_pImage;
+
+    for (UINT32 i = 0; i < pHeader->cStreams; i++)
+    {
+        if (m_pStreams[i].wStreamNumber == wStreamNumber)
+        {
+            pEntries = m_pEntries + m_pStreams[i].iFirstEntry;
+            cEntries = m_pStreams[i].cEntries;
+            break;
+        }
+    }
+
+    if (cEntries == 0)
+    {
+        CHECK_HR(hr = MF_E_ASF_NOINDEX);
+    }
+
+    if (!bReverse && bKeyFramesOnly)
+    {
+        // The first key frame at or after the seek time, else the last one.
+        iEntry = FindEntry(pEntries, cEntries,
+            CountEntriesBefore(pEntries, cEntries, hnsSeekTime, FALSE), TRUE, TRUE);
+
+        if (iEntry == cEntries)
+        {
+            iEntry = FindEntry(pEntries, cEntries, cEntries - 1, FALSE, TRUE);
+        }
+    }
+    else
+    {
+        // The last entry at or before the seek time, else the first one.
+        UINT32 cBefore = CountEntriesBefore(pEntries, cEntries, hnsSeekTime, TRUE);
+
+        iEntry = (cBefore > 0) ? FindEntry(pEntries, cEntries, cBefore - 1, FALSE, bKeyFramesOnly) : cEntries;
+
+        if (iEntry == cEntries)
+        {
+            iEntry = FindEntry(pEntries, cEntries, 0, TRUE, bKeyFramesOnly);
+        }
+    }
+
+    if (iEntry == cEntries)
+    {
+        CHECK_HR(hr = MF_E_ASF_NOINDEX);
+    }
+
+    iPacket = min(pEntries[iEntry].iPacket, pHeader->cPackets - 1);
+
+    if (!bReverse)
+    {
+        *pcbDataOffset = (QWORD)iPacket * pHeader->cbPacketSize;
+    }
+    else
+    {
+        // The media object can continue in the packets after the one
+        // where it starts. It ends before the next object starts, so
+        // parsing back from the end of that packet gets all of it.
+        iLastPacket = pHeader->cPackets - 1;
+
+        if (iEntry + 1 < cEntries)
+        {
+            iLastPacket = min(max(pEntries[iEntry + 1].iPacket, iPacket), iLastPacket);
+        }
+
+        cbEnd = (UINT64)(iLastPacket + 1) * pHeader->cbPacketSize;
+
+        *pcbDataOffset = (m_cbDataLength > cbEnd) ? (m_cbDataLength - cbEnd) : 0;
+    }
+
+    if (phnsApproxSeekTime)
+    {
+        *phnsApproxSeekTime = pEntries[iEntry].hnsTime;
+    }
+
+    TRACE((L"Offset calculated through the seek index.\n"));
+
+done:
+
+    LeaveCriticalSection(&m_critSec);
+    return hr;
+}
+
+
+// ----- Private Methods -----------------------------------------------
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: BuildThreadProc
+//  Description: Builds the index, saves it, and makes it available.
+//
+/////////////////////////////////////////////////////////////////////////
+
+unsigned __stdcall CASFSeekIndex::BuildThreadProc(void *pParam)
+{
+    CASFSeekIndex *pThis = (CASFSeekIndex*)pParam;
+
+    BYTE *pImage = NULL;
+    UINT64 cbImage = 0;
+    BOOL bSet = FALSE;
+
+    HRESULT hr = pThis->BuildIndex(&pImage, &cbImage);
+
+    if (SUCCEEDED(hr))
+    {
+        // Save the index, then map the saved copy, so that it is used
+        // the same way now as the next time the file is opened.
+        if (pThis->m_bSaveIndex &&
+            SUCCEEDED(pThis->WriteIndexFile(pImage, cbImage)) &&
+            SUCCEEDED(pThis->MapIndexFile()))
+        {
+            TRACE((L"Saved the seek index.\n"));
+        }
+        else
+        {
+            // Could not save it, for example on a read-only share.
+            // Keep the copy in memory for as long as the file is open.
+            EnterCriticalSection(&pThis->m_critSec);
+            bSet = pThis->SetImage(pImage, cbImage, FALSE);
+            LeaveCriticalSection(&pThis->m_critSec);
+        }
+    }
+
+    if (!bSet)
+    {
+        delete [] pImage;
+    }
+
+    LOG_MSG_IF_FAILED(L"CASFSeekIndex::BuildThreadProc failed.\n", hr);
+
+    return 0;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Name: BuildIndex
+//
+// Reads every data packet and returns the index, in the same layout
+// as the index file.
+//
+// ppImage:  Receives the index. The caller must delete [] it.
+// pcbImage: Receives the size of the index.
+/////////////////////////////////////////////////////////////////////
+
+HRESULT CASFSeekIndex::BuildIndex(BYTE **ppImage, UINT64 *pcbImage)
+{
+    HRESULT hr = S_OK;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+
+    const UINT32 cbPacketSize = m_header.cbPacketSize;
+    const UINT32 cPacketsPerRead = max(SEEK_INDEX_READ_SIZE / cbPacketSize, 1);
+
+    BYTE *pBuffer = NULL;
+    BYTE *pImage = NULL;
+
+    std::vector<SEEK_INDEX_ENTRY> entries;
+
+    SEEK_INDEX_ENTRY packetEntries[MAX_ASF_STREAMS];
+    UINT32 cPacketEntries = 0;
+
+    SEEK_INDEX_HEADER *pHeader = NULL;
+    SEEK_INDEX_STREAM *pStreams = NULL;
+
+    UINT32 iPacket = 0, cStreams = 0, cEntries = 0, cDamaged = 0;
+    UINT64 cbImage = 0;
+    DWORD cbRead = 0;
+    LONG lOffsetHigh = (LONG)(m_cbFirstPacket >> 32);
+
+    pBuffer = new (std::nothrow) BYTE[cPacketsPerRead * cbPacketSize];
+
+    if (!pBuffer)
+    {
+        CHECK_HR(hr = E_OUTOFMEMORY);
+    }
+
+    hFile = CreateFile(m_szFileName, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    if (SetFilePointer(hFile, (LONG)(m_cbFirstPacket & 0xFFFFFFFF), &lOffsetHigh, FILE_BEGIN) == INVALID_SET_FILE_POINTER &&
+        GetLastError() != NO_ERROR)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    // Read the packets in large blocks. Only the packet and payload
+    // headers are parsed, so this is limited by the disk.
+    while (iPacket < m_header.cPackets)
+    {
+        if (m_bCancel)
+        {
+            CHECK_HR(hr = E_ABORT);
+        }
+
+        UINT32 cPacketsToRead = min(cPacketsPerRead, m_header.cPackets - iPacket);
+
+        if (!ReadFile(hFile, pBuffer, cPacketsToRead * cbPacketSize, &cbRead, NULL))
+        {
+            CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+        }
+
+        // The file is shorter than the header says.
+        if (cbRead < cbPacketSize)
+        {
+            break;
+        }
+
+        for (UINT32 i = 0; i < cbRead / cbPacketSize; i++, iPacket++)
+        {
+            if (!ParsePacket(pBuffer + i * cbPacketSize, cbPacketSize, iPacket, m_hnsPreroll,
+                packetEntries, &cPacketEntries))
+            {
+                // Skip a damaged packet. The entries before and after it
+                // still give a position close to the seek time.
+                cDamaged++;
+                continue;
+            }
+
+            try
+            {
+                entries.insert(entries.end(), packetEntries, packetEntries + cPacketEntries);
+            }
+            catch (std::bad_alloc&)
+            {
+                CHECK_HR(hr = E_OUTOFMEMORY);
+            }
+        }
+    }
+
+    if (cDamaged > 0)
+    {
+        TRACE((L"Skipped %d damaged packets.\n", cDamaged));
+    }
+
+    if (entries.empty() || entries.size() > MAXDWORD)
+    {
+        CHECK_HR(hr = MF_E_ASF_NOINDEX);
+    }
+
+    // Group the entries by stream, in time order.
+    std::sort(entries.begin(), entries.end(), CompareEntries);
+
+    cEntries = (UINT32)entries.size();
+
+    for (UINT32 i = 0; i < cEntries; i++)
+    {
+        if (i == 0 || entries[i].wStreamNumber != entries[i - 1].wStreamNumber)
+        {
+            cStreams++;
+        }
+    }
+
+    cbImage = sizeof(SEEK_INDEX_HEADER) +
+        (UINT64)cStreams * sizeof(SEEK_INDEX_STREAM) +
+        (UINT64)cEntries * sizeof(SEEK_INDEX_ENTRY);
+
+    if (cbImage != (SIZE_T)cbImage)
+    {
+        CHECK_HR(hr = E_OUTOFMEMORY);
+    }
+
+    pImage = new (std::nothrow) BYTE[(SIZE_T)cbImage];
+
+    if (!pImage)
+    {
+        CHECK_HR(hr = E_OUTOFMEMORY);
+    }
+
+    pHeader = (SEEK_INDEX_HEADER*)pImage;
+    pStreams = (SEEK_INDEX_STREAM*)(pHeader + 1);
+
+    *pHeader = m_header;
+    pHeader->cStreams = cStreams;
+    pHeader->cEntries = cEntries;
+
+    cStreams = 0;
+
+    for (UINT32 i = 0; i < cEntries; i++)
+    {
+        if (i == 0 || entries[i].wStreamNumber != entries[i - 1].wStreamNumber)
+        {
+            pStreams[cStreams].wStreamNumber = entries[i].wStreamNumber;
+            pStreams[cStreams].wReserved = 0;
+            pStreams[cStreams].iFirstEntry = i;
+            pStreams[cStreams].cEntries = 0;
+            pStreams[cStreams].dwReserved = 0;
+            cStreams++;
+        }
+        pStreams[cStreams - 1].cEntries++;
+    }
+
+    CopyMemory(pStreams + cStreams, &entries[0], cEntries * sizeof(SEEK_INDEX_ENTRY));
+
+    *ppImage = pImage;
+    *pcbImage = cbImage;
+    pImage = NULL;
+
+    TRACE((L"Built the seek index: %d entries in %d streams.\n", cEntries, cStreams));
+
+done:
+
+    LOG_MSG_IF_FAILED(L"CASFSeekIndex::BuildIndex failed.\n", hr);
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+
+    SAFE_ARRAY_DELETE(pBuffer);
+    SAFE_ARRAY_DELETE(pImage);
+
+    return hr;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Name: WriteIndexFile
+//
+// Saves the index next to the ASF file. The index is written to a
+// temporary file first and then renamed, so that a partly written
+// index is never used.
+/////////////////////////////////////////////////////////////////////
+
+HRESULT CASFSeekIndex::WriteIndexFile(const BYTE *pImage, UINT64 cbImage)
+{
+    HRESULT hr = S_OK;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+
+    WCHAR szTempFile[MAX_PATH];
+
+    UINT64 cbWritten = 0;
+    DWORD cbToWrite = 0, cb = 0;
+
+    CHECK_HR(hr = StringCchPrintf(szTempFile, MAX_PATH, L"%s.tmp", m_szIndexFile));
+
+    hFile = CreateFile(szTempFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    while (cbWritten < cbImage)
+    {
+        cbToWrite = (DWORD)min(cbImage - cbWritten, (UINT64)SEEK_INDEX_WRITE_SIZE);
+
+        if (!WriteFile(hFile, pImage + cbWritten, cbToWrite, &cb, NULL))
+        {
+            CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+        }
+
+        cbWritten += cb;
+    }
+
+    CloseHandle(hFile);
+    hFile = INVALID_HANDLE_VALUE;
+
+    if (!MoveFileEx(szTempFile, m_szIndexFile, MOVEFILE_REPLACE_EXISTING))
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+done:
+
+    LOG_MSG_IF_FAILED(L"CASFSeekIndex::WriteIndexFile failed.\n", hr);
+
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+
+    if (FAILED(hr))
+    {
+        (void)DeleteFile(szTempFile);
+    }
+    return hr;
+}
+
+
+/////////////////////////////////////////////////////////////////////
+// Name: MapIndexFile
+//
+// Maps the saved index into memory, if it matches the ASF file.
+/////////////////////////////////////////////////////////////////////
+
+HRESULT CASFSeekIndex::MapIndexFile()
+{
+    HRESULT hr = S_OK;
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    HANDLE hMapping = NULL;
+
+    const BYTE *pView = NULL;
+    UINT64 cbFile = 0;
+    BOOL bSet = FALSE;
+
+    BY_HANDLE_FILE_INFORMATION info;
+
+    hFile = CreateFile(m_szIndexFile, GENERIC_READ, FILE_SHARE_READ, NULL,
+        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    if (!GetFileInformationByHandle(hFile, &info))
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    cbFile = ((UINT64)info.nFileSizeHigh << 32) | info.nFileSizeLow;
+
+    if (cbFile < sizeof(SEEK_INDEX_HEADER) || cbFile != (SIZE_T)cbFile)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+
+    hMapping = CreateFileMapping(hFile, NULL, PAGE_READONLY, 0, 0, NULL);
+
+    if (!hMapping)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    pView = (const BYTE*)MapViewOfFile(hMapping, FILE_MAP_READ, 0, 0, 0);
+
+    if (!pView)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    EnterCriticalSection(&m_critSec);
+    bSet = SetImage(pView, cbFile, TRUE);
+    LeaveCriticalSection(&m_critSec);
+
+    if (!bSet)
+    {
+        // Built for another file, or for an older version of this one.
+        CHECK_HR(hr = HRESULT_FROM_WIN32(ERROR_INVALID_DATA));
+    }
+
+done:
+
+    if (FAILED(hr) && pView)
+    {
+        UnmapViewOfFile(pView);
+    }
+
+    // The view keeps the file mapped after the handles are closed.
+    if (hMapping)
+    {
+        CloseHandle(hMapping);
+    }
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+    return hr;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: SetImage
+//  Description: Checks that an index matches the ASF file and, if it
+//  does, makes it the current index. Returns FALSE if it does not match.
+//  The caller must hold the critical section.
+//
+//  pImage:  The index, in the layout of the index file.
+//  bMapped: TRUE if pImage is a mapped view, FALSE if it was allocated
+//           with new [].
+/////////////////////////////////////////////////////////////////////////
+
+BOOL CASFSeekIndex::SetImage(const BYTE *pImage, UINT64 cbImage, BOOL bMapped)
+{
+    if (cbImage < sizeof(SEEK_INDEX_HEADER))
+    {
+        return FALSE;
+    }
+
+    const SEEK_INDEX_HEADER *pHeader = (const SEEK_INDEX_HEADER*)pImage;
+    const SEEK_INDEX_STREAM *pStreams = (const SEEK_INDEX_STREAM*)(pHeader + 1);
+
+    if (pHeader->dwMagic != m_header.dwMagic ||
+        pHeader->dwVersion != m_header.dwVersion ||
+        pHeader->guidFileID != m_header.guidFileID ||
+        pHeader->cbFileSize != m_header.cbFileSize ||
+        CompareFileTime(&pHeader->ftLastWriteTime, &m_header.ftLastWriteTime) != 0 ||
+        pHeader->cbPacketSize != m_header.cbPacketSize ||
+        pHeader->cPackets != m_header.cPackets)
+    {
+        return FALSE;
+    }
+
+    if (pHeader->cStreams > MAX_ASF_STREAMS ||
+        cbImage != sizeof(SEEK_INDEX_HEADER) +
+            (UINT64)pHeader->cStreams * sizeof(SEEK_INDEX_STREAM) +
+            (UINT64)pHeader->cEntries * sizeof(SEEK_INDEX_ENTRY))
+    {
+        return FALSE;
+    }
+
+    for (UINT32 i = 0; i < pHeader->cStreams; i++)
+    {
+        if ((UINT64)pStreams[i].iFirstEntry + pStreams[i].cEntries > pHeader->cEntries)
+        {
+            return FALSE;
+        }
+    }
+
+    FreeImage();
+
+    m_pImage = pImage;
+    m_bMapped = bMapped;
+    m_pStreams = pStreams;
+    m_pEntries = (const SEEK_INDEX_ENTRY*)(pStreams + pHeader->cStreams);
+
+    return TRUE;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+//  Name: FreeImage
+//  Description: Releases the current index. The caller must hold the
+//  critical section.
+/////////////////////////////////////////////////////////////////////////
+
+void CASFSeekIndex::FreeImage()
+{
+    if (m_pImage)
+    {
+        if (m_bMapped)
+        {
+            UnmapViewOfFile(m_pImage);
+        }
+        else
+        {
+            delete [] m_pImage;
+        }
+    }
+
+    m_pImage = NULL;
+    m_bMapped = FALSE;
+    m_pStreams = NULL;
+    m_pEntries = NULL;
+}
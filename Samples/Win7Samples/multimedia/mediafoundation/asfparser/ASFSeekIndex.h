@@ -0,0 +1,140 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// ASFSeekIndex.h : CASFSeekIndex class declaration.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+#include "MF_ASFParser.h"
+
+#define SEEK_INDEX_EXTENSION    L".asfidx"
+#define SEEK_INDEX_MAGIC        MAKEFOURCC('A', 'S', 'I', 'X')
+#define SEEK_INDEX_VERSION      1
+#define SEEK_INDEX_KEYFRAME     0x0001
+#define MAX_ASF_STREAMS         128
+
+//////////////////////////////////////////////////////////////////////////
+//  Seek index file layout
+//
+//  SEEK_INDEX_HEADER
+//  SEEK_INDEX_STREAM[cStreams]
+//  SEEK_INDEX_ENTRY[cEntries]  -- grouped by stream, sorted by time
+//
+//  The header identifies the ASF file that the index was built from.
+//  If the file changes, the index no longer matches and is rebuilt.
+//////////////////////////////////////////////////////////////////////////
+
+struct SEEK_INDEX_HEADER
+{
+    DWORD       dwMagic;
+    DWORD       dwVersion;
+    GUID        guidFileID;         // File ID from the File Properties Object.
+    UINT64      cbFileSize;
+    FILETIME    ftLastWriteTime;
+    UINT32      cbPacketSize;
+    UINT32      cPackets;
+    UINT32      cStreams;
+    UINT32      cEntries;
+};
+
+struct SEEK_INDEX_STREAM
+{
+    WORD        wStreamNumber;
+    WORD        wReserved;
+    UINT32      iFirstEntry;
+    UINT32      cEntries;
+    UINT32      dwReserved;         // Keeps the entries 8-byte aligned.
+};
+
+// One entry for each packet in which a media object of the stream starts.
+struct SEEK_INDEX_ENTRY
+{
+    LONGLONG    hnsTime;            // Presentation time, without the preroll.
+    UINT32      iPacket;
+    WORD        wStreamNumber;
+    WORD        wFlags;             // SEEK_INDEX_KEYFRAME
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+//  CASFSeekIndex
+//
+//  Seek index for every stream in an ASF file, whether or not the file
+//  has an ASF Index Object.
+//
+//  The first time a file is opened, a worker thread reads the packet
+//  headers in the ASF Data Object and records where each media object
+//  starts. The result is saved next to the file (file name + .asfidx).
+//  After that, opening the file maps the saved index into memory, and
+//  each seek is a binary search.
+//////////////////////////////////////////////////////////////////////////
+
+class CASFSeekIndex
+{
+public:
+    CASFSeekIndex();
+    ~CASFSeekIndex();
+
+    HRESULT Open(
+        const WCHAR *sFileName,
+        const GUID& guidFileID,
+        UINT32 cbPacketSize,
+        UINT32 cPackets,
+        UINT64 cbFirstPacket,
+        UINT64 cbDataLength,
+        MFTIME hnsPreroll
+        );
+
+    void Close();
+
+    BOOL IsReady();
+
+    HRESULT GetSeekPosition(
+        WORD wStreamNumber,
+        MFTIME hnsSeekTime,
+        BOOL bKeyFramesOnly,
+        BOOL bReverse,
+        QWORD *pcbDataOffset,
+        MFTIME *phnsApproxSeekTime
+        );
+
+protected:
+
+    static unsigned __stdcall BuildThreadProc(void *pParam);
+
+    HRESULT BuildIndex(BYTE **ppImage, UINT64 *pcbImage);
+    HRESULT MapIndexFile();
+    HRESULT WriteIndexFile(const BYTE *pImage, UINT64 cbImage);
+    BOOL    SetImage(const BYTE *pImage, UINT64 cbImage, BOOL bMapped);
+    void    FreeImage();
+
+protected:
+
+    CRITICAL_SECTION    m_critSec;      // Protects the image while the thread builds it.
+
+    WCHAR               m_szFileName[MAX_PATH];
+    WCHAR               m_szIndexFile[MAX_PATH];
+    BOOL                m_bSaveIndex;   // FALSE if the index file name is too long.
+
+    SEEK_INDEX_HEADER   m_header;       // What the index must match.
+    UINT64              m_cbFirstPacket;
+    UINT64              m_cbDataLength;
+    MFTIME              m_hnsPreroll;
+
+    HANDLE              m_hThread;
+    volatile LONG       m_bCancel;
+
+    // The index, either mapped from the index file or built in memory.
+    const BYTE*                 m_pImage;
+    BOOL                        m_bMapped;
+    const SEEK_INDEX_STREAM*    m_pStreams;
+    const SEEK_INDEX_ENTRY*     m_pEntries;
+};
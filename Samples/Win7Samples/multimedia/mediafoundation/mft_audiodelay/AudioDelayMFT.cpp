@@ -75,9 +75,7 @@ CDelayMFT::CDelayMFT() :
     m_bValidTime(NULL),
     m_bInputTypeSet(FALSE),
     m_bOutputTypeSet(FALSE),
-    m_pbDelayBuffer(NULL),
-    m_cbDelayBuffer(0),
-    m_pbDelayPtr(NULL),
+    m_isa(GetBestDelayIsa()),
     m_dwDelay(DEFAULT_DELAY),
     m_bDraining(FALSE),
     m_cbTailSamples(0)
@@ -1171,7 +1169,7 @@ done:
 
 HRESULT CDelayMFT::AllocateStreamingResources()
 {
-    if (m_pbDelayBuffer != NULL)
+    if (m_DelayLine.IsAllocated())
     {
         return S_OK; // Already allocated. Nothing to do.
     }
@@ -1188,31 +1186,11 @@ HRESULT CDelayMFT::AllocateStreamingResources()
     CHECK_HR(hr = CreateAttributeStore());
 
     // Get the delay length. 
-    m_dwDelay = MFGetAttributeUINT32(m_pAttributes, MF_AUDIODELAY_DELAY_LENGTH, DEFAULT_DELAY);
+    m_dwDelay = GetDelayAttribute();
 
-    // A zero-length delay buffer will complicate things, so disallow zero.
-    // Use the default instead.
-    if (m_dwDelay == 0)
-    {
-        m_dwDelay = DEFAULT_DELAY;
-    }
-
-    // Make sure the delay buffer won't exceed MAXDWORD bytes.
-    m_dwDelay = min( m_dwDelay, MAXDWORD / (SamplesPerSec() * BlockAlign()) );
-
-
-    // Allocate the buffer that holds the delayed samples.
-    m_cbDelayBuffer = (m_dwDelay * SamplesPerSec() * BlockAlign()) / 1000;
-    m_pbDelayBuffer = (BYTE*)CoTaskMemAlloc(m_cbDelayBuffer);
-    
-    if (m_pbDelayBuffer == NULL)
-    {
-        CHECK_HR(hr = E_OUTOFMEMORY);
-    }
-    
-    FillBufferWithSilence(m_pbDelayBuffer, m_cbDelayBuffer);    
-    
-    m_pbDelayPtr = m_pbDelayBuffer;
+    // Allocate the buffer that holds the delayed samples. The buffer can 
+    // hold at least m_dwDelay msec of audio. 
+    CHECK_HR(hr = m_DelayLine.Init(DelayFormat(), NumChannels(), DelayFrames(m_dwDelay)));
 
 done:
     return hr;
@@ -1250,13 +1228,12 @@ void CDelayMFT::FreeStreamingResources(BOOL bFlush)
     if (bFlush)
     {
         // Fill the delay buffer with silence.
-        FillBufferWithSilence(m_pbDelayBuffer, m_cbDelayBuffer);
+        m_DelayLine.Clear();
     }
     else
     {
         // Free the delay buffer.
-        CoTaskMemFree(m_pbDelayBuffer);
-        m_pbDelayBuffer = m_pbDelayPtr = NULL;
+        m_DelayLine.Free();
     }
 
     m_bValidTime = FALSE;
@@ -1269,6 +1246,28 @@ void CDelayMFT::FreeStreamingResources(BOOL bFlush)
 }
 
 
+//-------------------------------------------------------------------
+// GetDelayAttribute
+// Returns the delay length in msec, from the attribute store.
+//-------------------------------------------------------------------
+
+DWORD CDelayMFT::GetDelayAttribute()
+{
+    assert(m_pAttributes);
+
+    DWORD dwDelay = MFGetAttributeUINT32(m_pAttributes, MF_AUDIODELAY_DELAY_LENGTH, DEFAULT_DELAY);
+
+    // A zero-length delay buffer will complicate things, so disallow zero.
+    // Use the default instead.
+    if (dwDelay == 0)
+    {
+        dwDelay = DEFAULT_DELAY;
+    }
+
+    return min(dwDelay, MAX_DELAY);
+}
+
+
 //-------------------------------------------------------------------
 // CreateAttributeStore
 // Creates the MFT's attribute store, if it does not exist yet.
@@ -1303,7 +1302,7 @@ done:
 
 HRESULT CDelayMFT::GetProposedType(DWORD dwTypeIndex, IMFMediaType **ppmt)
 {
-    if (dwTypeIndex > 1)
+    if (dwTypeIndex > 2)
     {
         return MF_E_NO_MORE_TYPES;
     }
@@ -1339,6 +1338,11 @@ HRESULT CDelayMFT::GetProposedType(DWORD dwTypeIndex, IMFMediaType **ppmt)
         CHECK_HR(hr = pType->SetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, BlockAlign * SamplesPerSec));
         CHECK_HR(hr = pType->SetUINT32(MF_MT_ALL_SAMPLES_INDEPENDENT, TRUE));
         break;
+
+    case 2:
+        // Partial type: Float audio
+        CHECK_HR(hr = pType->SetGUID(MF_MT_SUBTYPE, MFAudioFormat_Float));
+        break;
     }
 
     *ppmt = pType;
@@ -1489,10 +1493,13 @@ HRESULT CDelayMFT::OnSetMediaType(IMFMediaType *pType, StreamDirection dir)
 
 HRESULT CDelayMFT::OnDrain()
 {
-    if (m_cbDelayBuffer > 0)
+    if (m_DelayLine.IsAllocated())
     {
+        // The tail is one delay length.
+        ULONGLONG cbTail = (ULONGLONG)m_DelayLine.DelayFrames() * m_DelayLine.BytesPerFrame();
+
         m_bDraining = TRUE;
-        m_cbTailSamples = m_cbDelayBuffer;
+        m_cbTailSamples = (DWORD)min(cbTail, MAXDWORD - MAXDWORD % m_DelayLine.BytesPerFrame());
     }
     return S_OK;
 }
@@ -1512,84 +1519,31 @@ HRESULT CDelayMFT::OnDrain()
 
 HRESULT CDelayMFT::ProcessAudio(BYTE *pbDest, const BYTE *pbInputData, DWORD dwQuanta)
 {
-    assert(m_pbDelayBuffer);
+    assert(m_DelayLine.IsAllocated());
     assert(m_pAttributes);
 
-    int   nWet = 0;  // Wet portion of wet/dry mix
-    DWORD sample = 0, channel = 0, cChannels = 0;
-    
-    cChannels = NumChannels();
+    HRESULT hr = S_OK;
+    DWORD   dwWet = 0;  // Wet portion of wet/dry mix
+    DWORD   dwDelay = 0;
 
-    // Get the wet/dry mix.
-    nWet = (int)MFGetAttributeUINT32(m_pAttributes, MF_AUDIODELAY_WET_DRY_MIX, DEFAULT_WET_DRY_MIX);
-    // Clip the value to [0...100]
-    nWet = min(nWet, 100);
+    // Get the wet/dry mix. (CDelayLine clips the value to [0...100].)
+    dwWet = MFGetAttributeUINT32(m_pAttributes, MF_AUDIODELAY_WET_DRY_MIX, DEFAULT_WET_DRY_MIX);
 
-    if (Is8Bit())
+    // The client can change the delay length while streaming. A shorter
+    // delay, or one that fits in the current buffer, just moves the read 
+    // position in the delay buffer.
+    dwDelay = GetDelayAttribute();
+    if (dwDelay != m_dwDelay)
     {
-        for (sample = 0; sample < dwQuanta; ++sample)
-        {
-            for (channel = 0; channel < cChannels; ++channel)
-            {
-                // 8-bit sound is 0..255 with 128 == silence
-                
-                // Get the input sample and normalize to -128 .. 127
-                int i = pbInputData[sample * cChannels + channel] - 128;
-                
-                // Get the delay sample and normalize to -128 .. 127
-                int delay = m_pbDelayPtr[0] - 128;
-                
-                m_pbDelayPtr[0] = static_cast<BYTE>(i + 128);
-                IncrementDelayPtr(sizeof(unsigned char));
-                
-                i = (i * (100 - nWet)) / 100 + (delay * nWet) / 100;
-                
-                // Truncate
-                if (i > 127)
-                {
-                    i = 127;
-                }
-                else if (i < -128)
-                {
-                    i = -128;
-                }
-                
-                pbDest[sample * cChannels + channel] = (unsigned char)(i+128);
-                
-            }
-        }
-    }
-    else  // 16-bit
-    {
-        for (sample = 0; sample < dwQuanta; ++sample)
-        {
-            for (channel = 0; channel < cChannels; ++channel)
-            {
-                int i = ((short*)pbInputData)[sample * cChannels + channel];
-                
-                int delay = ((short*)m_pbDelayPtr)[0];
-
-                ((short*)m_pbDelayPtr)[0] = static_cast<short>(i);
-                IncrementDelayPtr(sizeof(short));
-                
-                i = (i * (100 - nWet)) / 100 + (delay * nWet) / 100;
-                
-                // Truncate
-                if (i > 32767)
-                {
-                    i = 32767;
-                }
-                else if (i < -32768)
-                {
-                    i = -32768;
-                }
-                
-                ((short*)pbDest)[sample * cChannels + channel] = (short)i;
-                
-            }
-        }
+        CHECK_HR(hr = m_DelayLine.SetDelay(DelayFrames(dwDelay)));
+        m_dwDelay = dwDelay;
     }
-    return S_OK;
+
+    // Mix all of the channels in one pass.
+    m_DelayLine.Process(pbDest, pbInputData, dwQuanta, dwWet, m_isa);
+
+done:
+    return hr;
 }
 
 
@@ -1621,7 +1575,7 @@ void CDelayMFT::FillBufferWithSilence(BYTE *pBuffer, DWORD cb)
 
 //-------------------------------------------------------------------
 // Name: ValidatePCMAudioType
-// Validate a PCM audio media type.
+// Validate a PCM or floating-point audio media type.
 //-------------------------------------------------------------------
 
 HRESULT ValidatePCMAudioType(IMFMediaType *pmt)
@@ -1649,12 +1603,27 @@ HRESULT ValidatePCMAudioType(IMFMediaType *pmt)
 
     // Validate the values. 
 
-    if (nChannels != 1 && nChannels != 2)
+    if (nChannels < 1 || nChannels > MAX_CHANNELS)
     {
         CHECK_HR(hr = MF_E_INVALIDMEDIATYPE);
     }
 
-    if (wBitsPerSample != 8 && wBitsPerSample != 16)
+    // Integer PCM is 8-bit or 16-bit. Floating-point audio is 32-bit.
+    if (subtype == MFAudioFormat_PCM)
+    {
+        if (wBitsPerSample != 8 && wBitsPerSample != 16)
+        {
+            CHECK_HR(hr = MF_E_INVALIDMEDIATYPE);
+        }
+    }
+    else if (subtype == MFAudioFormat_Float)
+    {
+        if (wBitsPerSample != 32)
+        {
+            CHECK_HR(hr = MF_E_INVALIDMEDIATYPE);
+        }
+    }
+    else
     {
         CHECK_HR(hr = MF_E_INVALIDMEDIATYPE);
     }
@@ -25,9 +25,13 @@
 #include "common.h"
 using namespace MediaFoundationSamples;
 
+#include "DelayKernels.h"
+
 const DWORD UNITS = 10000000;            // 1 sec = 1 * UNITS
 const DWORD DEFAULT_WET_DRY_MIX = 25;    // Percentage of "wet" (delay) audio in the mix.
 const DWORD DEFAULT_DELAY = 1000;        // Delay in msec
+const DWORD MAX_DELAY = 60000;           // Longest delay in msec
+const UINT32 MAX_CHANNELS = 8;           // Most channels in the audio format
 const UINT32 ATTRIBUTE_COUNT = 2;        // Initial size of our attribute store. 
 
 
@@ -138,9 +142,8 @@ private:
     BOOL                    m_bInputTypeSet;    // Is the input type set?
     BOOL                    m_bOutputTypeSet;   // Is the output type set?
 
-    BYTE                    *m_pbDelayBuffer;   // circular buffer for delay samples
-    DWORD                   m_cbDelayBuffer;    // size of the delay buffer
-    BYTE                    *m_pbDelayPtr;      // ptr to next delay sample
+    CDelayLine              m_DelayLine;        // circular buffer for delay samples
+    DELAY_ISA               m_isa;              // Instruction set used to mix the audio.
 
     BOOL                    m_bDraining;        // Is the MFT draining?
     DWORD                   m_cbTailSamples;    // How many bytes of "tail" samples left to produce.
@@ -159,16 +162,18 @@ private:
     UINT32 BitsPerSample() const {  assert(m_pMediaType);   return MFGetAttributeUINT32(m_pMediaType, MF_MT_AUDIO_BITS_PER_SAMPLE, 0); }
 
     BOOL Is8Bit() const { return (BitsPerSample() == 8); }
+    BOOL IsFloat() const { return (BitsPerSample() == 32); }
 
-    // IncrementDelayPtr: Moves the delay pointer around the circular buffer
-    void IncrementDelayPtr(size_t size) 
+    DELAY_FORMAT DelayFormat() const 
     {
-        m_pbDelayPtr += size;
-        if (m_pbDelayPtr + size > m_pbDelayBuffer + m_cbDelayBuffer)
-        {
-            m_pbDelayPtr = m_pbDelayBuffer;
-        }
-    }   
+        return Is8Bit() ? DELAY_FORMAT_PCM8 : (IsFloat() ? DELAY_FORMAT_FLOAT : DELAY_FORMAT_PCM16);
+    }
+
+    // DelayFrames: Converts a delay in msec to audio frames.
+    DWORD DelayFrames(DWORD dwDelay) const
+    {
+        return (DWORD)min(((ULONGLONG)dwDelay * SamplesPerSec()) / 1000, MAXDWORD);
+    }
 
     // IsValidInputStream: Returns TRUE if dwInputStreamID is a valid input stream identifier.
     BOOL IsValidInputStream(DWORD dwInputStreamID) const 
@@ -205,6 +210,7 @@ private:
 
     HRESULT AllocateStreamingResources();
     void    FreeStreamingResources(BOOL bFlush);  
+    DWORD   GetDelayAttribute();
     HRESULT CreateAttributeStore();
 
     HRESULT InternalProcessOutput(MFT_OUTPUT_DATA_BUFFER& OutputSample, DWORD *pdwStatus);
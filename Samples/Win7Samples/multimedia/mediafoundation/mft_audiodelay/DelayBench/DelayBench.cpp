@@ -0,0 +1,225 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// DelayBench.cpp: Throughput benchmark for the audio delay transform.
+//
+// Runs synthetic audio through the delay line of the audio delay MFT
+// in 10 msec blocks, as the pipeline would deliver it, for each sample
+// format, channel count and instruction set.
+//
+// Usage: DelayBench [delay_msec [seconds]]
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tchar.h>
+
+#include "..\DelayKernels.h"
+
+
+const DWORD SAMPLE_RATE = 48000;
+const DWORD BLOCK_FRAMES = SAMPLE_RATE / 100;      // 10 msec
+const DWORD WET_PERCENT = 25;
+
+// Describes one of the formats that the delay line supports.
+struct FormatInfo
+{
+    LPCTSTR         pszName;
+    DELAY_FORMAT    format;
+    DWORD           cbSample;
+};
+
+static const FormatInfo g_Formats[] =
+{
+    { TEXT("PCM16"), DELAY_FORMAT_PCM16, 2 },
+    { TEXT("Float"), DELAY_FORMAT_FLOAT, 4 },
+    { TEXT("PCM8"),  DELAY_FORMAT_PCM8,  1 },
+};
+
+static const DWORD g_Channels[] = { 1, 2, 6, 8 };
+
+static const LPCTSTR g_IsaNames[] = { TEXT("Scalar"), TEXT("SSE2"), TEXT("AVX2") };
+
+
+//-------------------------------------------------------------------
+// Name: FillAudio
+// Description: Fills a buffer with pseudo-random samples.
+//-------------------------------------------------------------------
+
+static void FillAudio(BYTE *pBuffer, SIZE_T cSamples, DELAY_FORMAT format)
+{
+    DWORD dwSeed = 12345;
+
+    for (SIZE_T i = 0; i < cSamples; i++)
+    {
+        dwSeed = dwSeed * 1103515245 + 12345;
+        short value = (short)(dwSeed >> 16);
+
+        switch (format)
+        {
+        case DELAY_FORMAT_PCM8:
+            pBuffer[i] = (BYTE)(value >> 8);
+            break;
+
+        case DELAY_FORMAT_PCM16:
+            ((short*)pBuffer)[i] = value;
+            break;
+
+        default:
+            ((float*)pBuffer)[i] = value / 32768.0f;
+            break;
+        }
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: RunDelay
+// Description: Processes the whole input in blocks with a new delay
+//              line, and returns the time taken in seconds, or a
+//              negative number on failure.
+//-------------------------------------------------------------------
+
+static double RunDelay(
+    const FormatInfo    *pFormat,
+    DWORD               cChannels,
+    DWORD               cDelayFrames,
+    const BYTE          *pSrc,
+    BYTE                *pDest,
+    DWORD               cFrames,
+    DELAY_ISA           isa
+    )
+{
+    CDelayLine delay;
+
+    if (FAILED(delay.Init(pFormat->format, cChannels, cDelayFrames)))
+    {
+        return -1;
+    }
+
+    const SIZE_T cbFrame = (SIZE_T)pFormat->cbSample * cChannels;
+
+    LARGE_INTEGER liStart, liStop, liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liStart);
+
+    for (DWORD iFrame = 0; iFrame < cFrames; iFrame += BLOCK_FRAMES)
+    {
+        DWORD cBlock = min(BLOCK_FRAMES, cFrames - iFrame);
+
+        delay.Process(pDest + iFrame * cbFrame, pSrc + iFrame * cbFrame, cBlock, WET_PERCENT, isa);
+    }
+
+    QueryPerformanceCounter(&liStop);
+
+    return (double)(liStop.QuadPart - liStart.QuadPart) / (double)liFrequency.QuadPart;
+}
+
+
+int __cdecl _tmain(int argc, TCHAR *argv[])
+{
+    int delayMsec = 250;
+    int seconds = 20;
+
+    if (argc >= 2)
+    {
+        delayMsec = _ttoi(argv[1]);
+    }
+    if (argc >= 3)
+    {
+        seconds = _ttoi(argv[2]);
+    }
+
+    if (delayMsec <= 0 || seconds <= 0 || seconds > 600)
+    {
+        _tprintf(TEXT("Usage: DelayBench [delay_msec [seconds]]\n"));
+        _tprintf(TEXT("seconds is the length of the test audio, up to 600.\n"));
+        return 1;
+    }
+
+    const DWORD cFrames = SAMPLE_RATE * (DWORD)seconds;
+    const DWORD cDelayFrames = (DWORD)(((ULONGLONG)delayMsec * SAMPLE_RATE) / 1000);
+
+    // Allocate for the largest format (8 channels of float).
+    const SIZE_T cbMax = (SIZE_T)cFrames * 8 * sizeof(float);
+
+    BYTE *pSrc = (BYTE*)VirtualAlloc(NULL, cbMax, MEM_COMMIT, PAGE_READWRITE);
+    BYTE *pReference = (BYTE*)VirtualAlloc(NULL, cbMax, MEM_COMMIT, PAGE_READWRITE);
+    BYTE *pDest = (BYTE*)VirtualAlloc(NULL, cbMax, MEM_COMMIT, PAGE_READWRITE);
+
+    if (!pSrc || !pReference || !pDest)
+    {
+        _tprintf(TEXT("Out of memory\n"));
+        return 1;
+    }
+
+    DELAY_ISA isaBest = GetBestDelayIsa();
+
+    _tprintf(TEXT("%d sec of %u Hz audio, %d msec delay, %u frame blocks\n\n"),
+        seconds, SAMPLE_RATE, delayMsec, BLOCK_FRAMES);
+
+    _tprintf(TEXT("%-14s"), TEXT("Msamples/sec"));
+    for (int isa = DELAY_ISA_SCALAR; isa <= isaBest; isa++)
+    {
+        _tprintf(TEXT("%10s"), g_IsaNames[isa]);
+    }
+    _tprintf(TEXT("\n"));
+
+    int cFailed = 0;
+
+    for (DWORD i = 0; i < ARRAYSIZE(g_Formats); i++)
+    {
+        const FormatInfo *pFormat = &g_Formats[i];
+
+        for (DWORD j = 0; j < ARRAYSIZE(g_Channels); j++)
+        {
+            const DWORD cChannels = g_Channels[j];
+            const SIZE_T cSamples = (SIZE_T)cFrames * cChannels;
+            const SIZE_T cb = cSamples * pFormat->cbSample;
+
+            FillAudio(pSrc, cSamples, pFormat->format);
+
+            if (RunDelay(pFormat, cChannels, cDelayFrames, pSrc, pReference, cFrames, DELAY_ISA_SCALAR) < 0)
+            {
+                _tprintf(TEXT("Could not allocate the delay line\n"));
+                return 1;
+            }
+
+            _tprintf(TEXT("%-6s %u ch   "), pFormat->pszName, cChannels);
+
+            for (int isa = DELAY_ISA_SCALAR; isa <= isaBest; isa++)
+            {
+                // Check this version does exactly what the scalar one does.
+
+                ZeroMemory(pDest, cb);
+
+                double dSeconds = RunDelay(pFormat, cChannels, cDelayFrames, pSrc, pDest, cFrames, (DELAY_ISA)isa);
+
+                if (dSeconds < 0 || memcmp(pDest, pReference, cb) != 0)
+                {
+                    _tprintf(TEXT("%10s"), TEXT("WRONG"));
+                    cFailed++;
+                }
+                else
+                {
+                    _tprintf(TEXT("%10.1f"), cSamples / max(dSeconds, 1e-9) / 1e6);
+                }
+            }
+            _tprintf(TEXT("\n"));
+        }
+    }
+
+    VirtualFree(pSrc, 0, MEM_RELEASE);
+    VirtualFree(pReference, 0, MEM_RELEASE);
+    VirtualFree(pDest, 0, MEM_RELEASE);
+
+    return cFailed ? 1 : 0;
+}
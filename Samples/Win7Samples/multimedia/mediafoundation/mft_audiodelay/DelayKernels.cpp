@@ -0,0 +1,659 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// DelayKernels.cpp: Delay line and mixing functions.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <intrin.h>
+#include <emmintrin.h>
+
+// The AVX2 versions need Visual C++ 2012 or later to build.
+#if (_MSC_VER >= 1700)
+#include <immintrin.h>
+#define DELAY_AVX2
+#endif
+
+#include "DelayKernels.h"
+
+
+// The mixing functions work on runs of samples that are contiguous in
+// the input buffer, in the output buffer, and at both the read and the
+// write position of the delay line. For each sample they:
+//
+// - Read the input sample and the delayed sample.
+// - Store the input sample in the delay line.
+// - Write (1 - wet) * input + wet * delayed to the output.
+//
+// PCM samples are mixed in fixed point, with weights in units of 1/16384
+// that add up to 16384, so that the SSE2 and AVX2 versions can use
+// pmaddwd on (input, delayed) pairs and still give the same result as
+// the scalar code. Float samples use the same multiplies and adds in the
+// same order at every level.
+//
+// 8-bit audio is uncommon and always uses the scalar code.
+
+const int MIX_SHIFT = 14;
+const int MIX_ONE = 1 << MIX_SHIFT;
+
+struct MixGains
+{
+    int     nDry;       // Weight of the input sample, 0..MIX_ONE
+    int     nWet;       // Weight of the delayed sample, MIX_ONE - nDry
+    float   fDry;
+    float   fWet;
+};
+
+typedef void (*MIX_FN)(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    );
+
+
+//-------------------------------------------------------------------
+// Name: GetBestDelayIsa
+// Description: Checks the processor, and for AVX2 that the operating
+//              system saves the YMM registers.
+//-------------------------------------------------------------------
+
+DELAY_ISA GetBestDelayIsa()
+{
+    int info[4];
+
+    __cpuid(info, 0);
+    int cIds = info[0];
+
+    __cpuid(info, 1);
+    BOOL bSSE2 = (info[3] & (1 << 26)) != 0;
+
+#ifdef DELAY_AVX2
+    BOOL bOSXSAVE = (info[2] & (1 << 27)) != 0;
+    BOOL bAVX = (info[2] & (1 << 28)) != 0;
+
+    if (cIds >= 7 && bOSXSAVE && bAVX && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+        {
+            return DELAY_ISA_AVX2;
+        }
+    }
+#endif
+
+    return bSSE2 ? DELAY_ISA_SSE2 : DELAY_ISA_SCALAR;
+}
+
+
+//-------------------------------------------------------------------
+// Name: MixPCM16_Scalar
+// Description: Mixes a run of 16-bit samples.
+//-------------------------------------------------------------------
+
+static void MixPCM16_Scalar(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    )
+{
+    short *pDest_Short = (short*)pDest;
+    const short *pSrc_Short = (const short*)pSrc;
+    short *pWrite_Short = (short*)pDelayWrite;
+    const short *pRead_Short = (const short*)pDelayRead;
+
+    for (SIZE_T i = 0; i < cSamples; i++)
+    {
+        int input = pSrc_Short[i];
+        int delay = pRead_Short[i];
+
+        pWrite_Short[i] = (short)input;
+
+        int mix = (input * gains.nDry + delay * gains.nWet + MIX_ONE / 2) >> MIX_SHIFT;
+
+        // Truncate
+        if (mix > 32767)
+        {
+            mix = 32767;
+        }
+        else if (mix < -32768)
+        {
+            mix = -32768;
+        }
+
+        pDest_Short[i] = (short)mix;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: MixPCM16_SSE2
+// Description: Mixes a run of 16-bit samples, 8 at a time.
+//-------------------------------------------------------------------
+
+static void MixPCM16_SSE2(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    )
+{
+    // Each 32-bit lane holds the weights for one (input, delayed) pair.
+    const __m128i weights = _mm_set1_epi32((gains.nWet << 16) | gains.nDry);
+    const __m128i round = _mm_set1_epi32(MIX_ONE / 2);
+
+    SIZE_T cb = cSamples * sizeof(short);
+    SIZE_T x = 0;
+
+    for (; x + 16 <= cb; x += 16)
+    {
+        __m128i input = _mm_loadu_si128((const __m128i*)(pSrc + x));
+        __m128i delay = _mm_loadu_si128((const __m128i*)(pDelayRead + x));
+
+        _mm_storeu_si128((__m128i*)(pDelayWrite + x), input);
+
+        __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(input, delay), weights);
+        __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(input, delay), weights);
+
+        lo = _mm_srai_epi32(_mm_add_epi32(lo, round), MIX_SHIFT);
+        hi = _mm_srai_epi32(_mm_add_epi32(hi, round), MIX_SHIFT);
+
+        _mm_storeu_si128((__m128i*)(pDest + x), _mm_packs_epi32(lo, hi));
+    }
+
+    MixPCM16_Scalar(pDest + x, pSrc + x, pDelayWrite + x, pDelayRead + x, (cb - x) / sizeof(short), gains);
+}
+
+
+//-------------------------------------------------------------------
+// Name: MixFloat_Scalar
+// Description: Mixes a run of float samples.
+//-------------------------------------------------------------------
+
+static void MixFloat_Scalar(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    )
+{
+    float *pDest_Float = (float*)pDest;
+    const float *pSrc_Float = (const float*)pSrc;
+    float *pWrite_Float = (float*)pDelayWrite;
+    const float *pRead_Float = (const float*)pDelayRead;
+
+    for (SIZE_T i = 0; i < cSamples; i++)
+    {
+        float input = pSrc_Float[i];
+        float delay = pRead_Float[i];
+
+        // Round each product to float before the sum, as the vector kernels
+        // do. A single expression can keep them in extended precision when
+        // it is compiled to x87 code.
+        float dry = input * gains.fDry;
+        float wet = delay * gains.fWet;
+
+        pWrite_Float[i] = input;
+        pDest_Float[i] = dry + wet;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: MixFloat_SSE2
+// Description: Mixes a run of float samples, 4 at a time.
+//-------------------------------------------------------------------
+
+static void MixFloat_SSE2(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    )
+{
+    const __m128 dry = _mm_set1_ps(gains.fDry);
+    const __m128 wet = _mm_set1_ps(gains.fWet);
+
+    SIZE_T cb = cSamples * sizeof(float);
+    SIZE_T x = 0;
+
+    for (; x + 16 <= cb; x += 16)
+    {
+        __m128 input = _mm_loadu_ps((const float*)(pSrc + x));
+        __m128 delay = _mm_loadu_ps((const float*)(pDelayRead + x));
+
+        _mm_storeu_ps((float*)(pDelayWrite + x), input);
+        _mm_storeu_ps((float*)(pDest + x), _mm_add_ps(_mm_mul_ps(input, dry), _mm_mul_ps(delay, wet)));
+    }
+
+    MixFloat_Scalar(pDest + x, pSrc + x, pDelayWrite + x, pDelayRead + x, (cb - x) / sizeof(float), gains);
+}
+
+
+#ifdef DELAY_AVX2
+
+//-------------------------------------------------------------------
+// Name: MixPCM16_AVX2
+// Description: Mixes a run of 16-bit samples, 16 at a time.
+//
+// The unpack and pack instructions work within each 128-bit half, so
+// the samples come back out in their original order.
+//-------------------------------------------------------------------
+
+static void MixPCM16_AVX2(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    )
+{
+    const __m256i weights = _mm256_set1_epi32((gains.nWet << 16) | gains.nDry);
+    const __m256i round = _mm256_set1_epi32(MIX_ONE / 2);
+
+    SIZE_T cb = cSamples * sizeof(short);
+    SIZE_T x = 0;
+
+    for (; x + 32 <= cb; x += 32)
+    {
+        __m256i input = _mm256_loadu_si256((const __m256i*)(pSrc + x));
+        __m256i delay = _mm256_loadu_si256((const __m256i*)(pDelayRead + x));
+
+        _mm256_storeu_si256((__m256i*)(pDelayWrite + x), input);
+
+        __m256i lo = _mm256_madd_epi16(_mm256_unpacklo_epi16(input, delay), weights);
+        __m256i hi = _mm256_madd_epi16(_mm256_unpackhi_epi16(input, delay), weights);
+
+        lo = _mm256_srai_epi32(_mm256_add_epi32(lo, round), MIX_SHIFT);
+        hi = _mm256_srai_epi32(_mm256_add_epi32(hi, round), MIX_SHIFT);
+
+        _mm256_storeu_si256((__m256i*)(pDest + x), _mm256_packs_epi32(lo, hi));
+    }
+
+    _mm256_zeroupper();
+
+    MixPCM16_SSE2(pDest + x, pSrc + x, pDelayWrite + x, pDelayRead + x, (cb - x) / sizeof(short), gains);
+}
+
+
+//-------------------------------------------------------------------
+// Name: MixFloat_AVX2
+// Description: Mixes a run of float samples, 8 at a time.
+//-------------------------------------------------------------------
+
+static void MixFloat_AVX2(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    )
+{
+    const __m256 dry = _mm256_set1_ps(gains.fDry);
+    const __m256 wet = _mm256_set1_ps(gains.fWet);
+
+    SIZE_T cb = cSamples * sizeof(float);
+    SIZE_T x = 0;
+
+    for (; x + 32 <= cb; x += 32)
+    {
+        __m256 input = _mm256_loadu_ps((const float*)(pSrc + x));
+        __m256 delay = _mm256_loadu_ps((const float*)(pDelayRead + x));
+
+        _mm256_storeu_ps((float*)(pDelayWrite + x), input);
+        _mm256_storeu_ps((float*)(pDest + x), _mm256_add_ps(_mm256_mul_ps(input, dry), _mm256_mul_ps(delay, wet)));
+    }
+
+    _mm256_zeroupper();
+
+    MixFloat_SSE2(pDest + x, pSrc + x, pDelayWrite + x, pDelayRead + x, (cb - x) / sizeof(float), gains);
+}
+
+#endif // DELAY_AVX2
+
+
+//-------------------------------------------------------------------
+// Name: MixPCM8_Scalar
+// Description: Mixes a run of 8-bit samples.
+//-------------------------------------------------------------------
+
+static void MixPCM8_Scalar(
+    BYTE*           pDest,
+    const BYTE*     pSrc,
+    BYTE*           pDelayWrite,
+    const BYTE*     pDelayRead,
+    SIZE_T          cSamples,
+    const MixGains& gains
+    )
+{
+    for (SIZE_T i = 0; i < cSamples; i++)
+    {
+        // 8-bit sound is 0..255 with 128 == silence.
+        // Normalize the input and delay samples to -128 .. 127
+        int input = pSrc[i] - 128;
+        int delay = pDelayRead[i] - 128;
+
+        pDelayWrite[i] = pSrc[i];
+
+        int mix = (input * gains.nDry + delay * gains.nWet + MIX_ONE / 2) >> MIX_SHIFT;
+
+        // Truncate
+        if (mix > 127)
+        {
+            mix = 127;
+        }
+        else if (mix < -128)
+        {
+            mix = -128;
+        }
+
+        pDest[i] = (BYTE)(mix + 128);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: GetMixFunction
+// Description: Returns the mixing function for a format and level.
+//-------------------------------------------------------------------
+
+static MIX_FN GetMixFunction(DELAY_FORMAT format, DELAY_ISA isa)
+{
+#ifndef DELAY_AVX2
+    if (isa == DELAY_ISA_AVX2)
+    {
+        isa = DELAY_ISA_SSE2;
+    }
+#endif
+
+    switch (format)
+    {
+    case DELAY_FORMAT_PCM16:
+        switch (isa)
+        {
+#ifdef DELAY_AVX2
+        case DELAY_ISA_AVX2:    return MixPCM16_AVX2;
+#endif
+        case DELAY_ISA_SSE2:    return MixPCM16_SSE2;
+        default:                return MixPCM16_Scalar;
+        }
+
+    case DELAY_FORMAT_FLOAT:
+        switch (isa)
+        {
+#ifdef DELAY_AVX2
+        case DELAY_ISA_AVX2:    return MixFloat_AVX2;
+#endif
+        case DELAY_ISA_SSE2:    return MixFloat_SSE2;
+        default:                return MixFloat_Scalar;
+        }
+
+    default:
+        return MixPCM8_Scalar;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// CDelayLine class
+//-------------------------------------------------------------------
+
+CDelayLine::CDelayLine() :
+    m_format(DELAY_FORMAT_PCM16),
+    m_cChannels(0),
+    m_cbSample(0),
+    m_bSilence(0),
+    m_pRing(NULL),
+    m_cRingSamples(0),
+    m_mask(0),
+    m_llWritePos(0),
+    m_cDelayFrames(0),
+    m_cDelaySamples(0)
+{
+}
+
+CDelayLine::~CDelayLine()
+{
+    Free();
+}
+
+
+//-------------------------------------------------------------------
+// Name: Init
+// Description: Allocates the buffer for a format and delay.
+//-------------------------------------------------------------------
+
+HRESULT CDelayLine::Init(DELAY_FORMAT format, DWORD cChannels, DWORD cDelayFrames)
+{
+    if (cChannels == 0)
+    {
+        return E_INVALIDARG;
+    }
+
+    Free();
+
+    m_format = format;
+    m_cChannels = cChannels;
+
+    switch (format)
+    {
+    case DELAY_FORMAT_PCM8:
+        m_cbSample = sizeof(BYTE);
+        m_bSilence = 0x80;
+        break;
+
+    case DELAY_FORMAT_PCM16:
+        m_cbSample = sizeof(short);
+        m_bSilence = 0;
+        break;
+
+    default:
+        m_cbSample = sizeof(float);
+        m_bSilence = 0;     // 0.0f is all zero bits.
+        break;
+    }
+
+    // A zero-length delay would read the samples it is writing.
+    m_cDelayFrames = max(cDelayFrames, 1);
+    m_cDelaySamples = (SIZE_T)m_cDelayFrames * m_cChannels;
+    m_llWritePos = 0;
+
+    return Allocate(m_cDelaySamples);
+}
+
+
+//-------------------------------------------------------------------
+// Name: Allocate
+// Description: Allocates a silent buffer of at least cSamples samples.
+//
+// On failure the current buffer is kept.
+//-------------------------------------------------------------------
+
+HRESULT CDelayLine::Allocate(SIZE_T cSamples)
+{
+    SIZE_T cRingSamples = MIN_RING_SAMPLES;
+
+    while (cRingSamples < cSamples)
+    {
+        if (cRingSamples > ((SIZE_T)-1 / 2) / m_cbSample)
+        {
+            return E_OUTOFMEMORY;
+        }
+        cRingSamples *= 2;
+    }
+
+    BYTE *pRing = (BYTE*)CoTaskMemAlloc(cRingSamples * m_cbSample);
+    if (pRing == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    FillMemory(pRing, cRingSamples * m_cbSample, m_bSilence);
+
+    m_pRing = pRing;
+    m_cRingSamples = cRingSamples;
+    m_mask = cRingSamples - 1;
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Name: Free
+// Description: Releases the buffer.
+//-------------------------------------------------------------------
+
+void CDelayLine::Free()
+{
+    CoTaskMemFree(m_pRing);
+
+    m_pRing = NULL;
+    m_cRingSamples = 0;
+    m_mask = 0;
+    m_llWritePos = 0;
+}
+
+
+//-------------------------------------------------------------------
+// Name: Clear
+// Description: Fills the buffer with silence.
+//-------------------------------------------------------------------
+
+void CDelayLine::Clear()
+{
+    if (m_pRing)
+    {
+        FillMemory(m_pRing, m_cRingSamples * m_cbSample, m_bSilence);
+    }
+    m_llWritePos = 0;
+}
+
+
+//-------------------------------------------------------------------
+// Name: SetDelay
+// Description: Changes the delay length.
+//
+// If the buffer is too small for the new delay, it is replaced by a
+// larger one and the samples in it are copied to the same positions
+// (modulo the new size), so the delayed audio carries on without a gap.
+//-------------------------------------------------------------------
+
+HRESULT CDelayLine::SetDelay(DWORD cDelayFrames)
+{
+    if (m_pRing == NULL)
+    {
+        return E_UNEXPECTED;
+    }
+
+    cDelayFrames = max(cDelayFrames, 1);
+
+    SIZE_T cDelaySamples = (SIZE_T)cDelayFrames * m_cChannels;
+
+    if (cDelaySamples > m_cRingSamples)
+    {
+        BYTE *pOldRing = m_pRing;
+        SIZE_T cOldRingSamples = m_cRingSamples;
+        SIZE_T oldMask = m_mask;
+
+        HRESULT hr = Allocate(cDelaySamples);
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+
+        // Copy the samples that are still in the old buffer.
+        ULONGLONG llPos = m_llWritePos - min(m_llWritePos, (ULONGLONG)cOldRingSamples);
+
+        while (llPos < m_llWritePos)
+        {
+            SIZE_T iOld = (SIZE_T)llPos & oldMask;
+            SIZE_T iNew = (SIZE_T)llPos & m_mask;
+
+            SIZE_T cRun = (SIZE_T)min(m_llWritePos - llPos, (ULONGLONG)(cOldRingSamples - iOld));
+            cRun = min(cRun, m_cRingSamples - iNew);
+
+            CopyMemory(m_pRing + iNew * m_cbSample, pOldRing + iOld * m_cbSample, cRun * m_cbSample);
+
+            llPos += cRun;
+        }
+
+        CoTaskMemFree(pOldRing);
+    }
+
+    m_cDelayFrames = cDelayFrames;
+    m_cDelaySamples = cDelaySamples;
+
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Name: Process
+// Description: Mixes a block of audio with the delay line.
+//-------------------------------------------------------------------
+
+void CDelayLine::Process(
+    BYTE*       pDest,
+    const BYTE* pSrc,
+    DWORD       cFrames,
+    DWORD       dwWetPercent,
+    DELAY_ISA   isa
+    )
+{
+    if (m_pRing == NULL)
+    {
+        return;
+    }
+
+    dwWetPercent = min(dwWetPercent, 100);
+
+    MixGains gains;
+    gains.nWet = (int)((dwWetPercent * MIX_ONE + 50) / 100);
+    gains.nDry = MIX_ONE - gains.nWet;
+    gains.fWet = (float)dwWetPercent / 100.0f;
+    gains.fDry = 1.0f - gains.fWet;
+
+    MIX_FN pMixFn = GetMixFunction(m_format, isa);
+
+    SIZE_T cRemaining = (SIZE_T)cFrames * m_cChannels;
+
+    while (cRemaining > 0)
+    {
+        SIZE_T iWrite = (SIZE_T)m_llWritePos & m_mask;
+        SIZE_T iRead = (SIZE_T)(m_llWritePos - m_cDelaySamples) & m_mask;
+
+        // Neither position can wrap in the middle of a run. A run also
+        // cannot be longer than the delay, or the mixing function would
+        // read back samples that it wrote earlier in the same run.
+        SIZE_T cRun = min(cRemaining, m_cDelaySamples);
+        cRun = min(cRun, m_cRingSamples - iWrite);
+        cRun = min(cRun, m_cRingSamples - iRead);
+
+        pMixFn(pDest, pSrc, m_pRing + iWrite * m_cbSample, m_pRing + iRead * m_cbSample, cRun, gains);
+
+        pDest += cRun * m_cbSample;
+        pSrc += cRun * m_cbSample;
+        m_llWritePos += cRun;
+        cRemaining -= cRun;
+    }
+}
@@ -0,0 +1,105 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// DelayKernels.h: Delay line used by the audio delay transform and by
+// the DelayBench throughput benchmark.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Instruction sets the mixing functions can use. Every level produces
+// exactly the same output.
+enum DELAY_ISA
+{
+    DELAY_ISA_SCALAR,
+    DELAY_ISA_SSE2,
+    DELAY_ISA_AVX2
+};
+
+// GetBestDelayIsa: Returns the fastest level that this processor and
+// compiler support.
+DELAY_ISA GetBestDelayIsa();
+
+
+// Sample formats the delay line can hold.
+enum DELAY_FORMAT
+{
+    DELAY_FORMAT_PCM8,      // Unsigned 8-bit PCM, 0x80 is silence.
+    DELAY_FORMAT_PCM16,     // Signed 16-bit PCM.
+    DELAY_FORMAT_FLOAT      // 32-bit IEEE float.
+};
+
+
+// CDelayLine class:
+// Circular buffer that holds the most recent input samples.
+//
+// The buffer size is a power of two, so positions wrap with a mask. The
+// channels of interleaved audio are not separated: a delay of N frames
+// is a delay of N * cChannels samples in the interleaved stream, so all
+// of the channels are mixed in one pass.
+//
+// The delay can be changed while streaming. If the new delay fits in the
+// buffer, only the read position moves. A longer delay grows the buffer
+// and keeps the history that is already in it.
+
+class CDelayLine
+{
+public:
+
+    CDelayLine();
+    ~CDelayLine();
+
+    // Init: Allocates the buffer and fills it with silence.
+    HRESULT Init(DELAY_FORMAT format, DWORD cChannels, DWORD cDelayFrames);
+    void    Free();
+
+    // Clear: Fills the buffer with silence.
+    void    Clear();
+
+    HRESULT SetDelay(DWORD cDelayFrames);
+
+    BOOL    IsAllocated() const { return m_pRing != NULL; }
+    DWORD   DelayFrames() const { return m_cDelayFrames; }
+    DWORD   BytesPerFrame() const { return m_cbSample * m_cChannels; }
+
+    // Process: Mixes cFrames frames of pSrc with the delayed samples and
+    // writes the result to pDest, then adds pSrc to the delay line.
+    //
+    // dwWetPercent is the percentage of delayed audio in the mix, 0 to
+    // 100. pDest can equal pSrc.
+    void Process(
+        BYTE*       pDest,
+        const BYTE* pSrc,
+        DWORD       cFrames,
+        DWORD       dwWetPercent,
+        DELAY_ISA   isa
+        );
+
+private:
+
+    // Smallest buffer, in samples. Short delays can then change without
+    // growing the buffer.
+    static const SIZE_T MIN_RING_SAMPLES = 4096;
+
+    HRESULT Allocate(SIZE_T cSamples);
+
+    DELAY_FORMAT    m_format;
+    DWORD           m_cChannels;
+    DWORD           m_cbSample;         // Bytes per sample.
+    BYTE            m_bSilence;         // Fill byte for silence.
+
+    BYTE            *m_pRing;           // The circular buffer.
+    SIZE_T          m_cRingSamples;     // Size of the buffer in samples (a power of two).
+    SIZE_T          m_mask;             // m_cRingSamples - 1
+
+    ULONGLONG       m_llWritePos;       // Samples written since Init or Clear.
+    DWORD           m_cDelayFrames;
+    SIZE_T          m_cDelaySamples;    // m_cDelayFrames * m_cChannels
+};
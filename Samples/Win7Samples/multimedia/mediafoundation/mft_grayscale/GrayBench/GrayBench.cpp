@@ -0,0 +1,237 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// GrayBench.cpp: Throughput benchmark for the grayscale transform.
+//
+// Calls the image transform functions of the grayscale MFT directly on
+// synthetic frames, with each instruction set on one thread and with
+// the frame split into bands over all of the processors.
+//
+// Usage: GrayBench [width height [frames]]
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <tchar.h>
+
+#include "..\GrayscaleKernels.h"
+
+
+// Describes one of the formats that the transform supports.
+struct FormatInfo
+{
+    LPCTSTR             pszName;
+    IMAGE_TRANSFORM_FN  pTransformFn;
+    DWORD               cbPerPixel;     // Bytes per pixel in the first plane.
+    BOOL                bPlanar420;     // Chroma planes add half the rows again.
+};
+
+static const FormatInfo g_Formats[] =
+{
+    { TEXT("YUY2"), TransformImage_YUY2, 2, FALSE },
+    { TEXT("UYVY"), TransformImage_UYVY, 2, FALSE },
+    { TEXT("NV12"), TransformImage_NV12, 1, TRUE },
+    { TEXT("I420"), TransformImage_I420, 1, TRUE },
+    { TEXT("P010"), TransformImage_P010, 2, TRUE },
+};
+
+static const LPCTSTR g_IsaNames[] = { TEXT("Scalar"), TEXT("SSE2"), TEXT("AVX2") };
+
+
+//-------------------------------------------------------------------
+// Name: FillFrame
+// Description: Fills a buffer with pseudo-random bytes.
+//-------------------------------------------------------------------
+
+static void FillFrame(BYTE *pBuffer, SIZE_T cb)
+{
+    DWORD dwSeed = 12345;
+
+    for (SIZE_T i = 0; i < cb; i++)
+    {
+        dwSeed = dwSeed * 1103515245 + 12345;
+        pBuffer[i] = (BYTE)(dwSeed >> 16);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: TimeTransform
+// Description: Returns frames per second, or 0 if the output differs
+//              from the scalar output in pReference.
+//-------------------------------------------------------------------
+
+static double TimeTransform(
+    const FormatInfo    *pFormat,
+    const BYTE          *pSrc,
+    const BYTE          *pReference,
+    BYTE                *pDest,
+    SIZE_T              cbFrame,
+    LONG                lStride,
+    DWORD               dwWidth,
+    DWORD               dwHeight,
+    DWORD               cFrames,
+    KERNEL_ISA          isa,
+    CTransformBands     *pBands
+    )
+{
+    // Check this version does exactly what the scalar one does.
+
+    ZeroMemory(pDest, cbFrame);
+    if (pBands)
+    {
+        pBands->Apply(pFormat->pTransformFn, pDest, lStride, pSrc, lStride, dwWidth, dwHeight, isa);
+    }
+    else
+    {
+        pFormat->pTransformFn(pDest, lStride, pSrc, lStride, dwWidth, dwHeight, 0, dwHeight, isa);
+    }
+    if (memcmp(pDest, pReference, cbFrame) != 0)
+    {
+        return 0;
+    }
+
+    LARGE_INTEGER liStart, liStop, liFrequency;
+    QueryPerformanceFrequency(&liFrequency);
+    QueryPerformanceCounter(&liStart);
+
+    for (DWORD i = 0; i < cFrames; i++)
+    {
+        if (pBands)
+        {
+            pBands->Apply(pFormat->pTransformFn, pDest, lStride, pSrc, lStride, dwWidth, dwHeight, isa);
+        }
+        else
+        {
+            pFormat->pTransformFn(pDest, lStride, pSrc, lStride, dwWidth, dwHeight, 0, dwHeight, isa);
+        }
+    }
+
+    QueryPerformanceCounter(&liStop);
+
+    double dSeconds = (double)(liStop.QuadPart - liStart.QuadPart) / (double)liFrequency.QuadPart;
+    return cFrames / max(dSeconds, 1e-9);
+}
+
+
+int __cdecl _tmain(int argc, TCHAR *argv[])
+{
+    int width = 3840;
+    int height = 2160;
+    int cFrames = 100;
+
+    if (argc >= 3)
+    {
+        width = _ttoi(argv[1]);
+        height = _ttoi(argv[2]);
+    }
+    if (argc >= 4)
+    {
+        cFrames = _ttoi(argv[3]);
+    }
+
+    // The 4:2:0 formats need an even width and height.
+    if (width <= 0 || height <= 0 || cFrames <= 0 || (width & 1) || (height & 1))
+    {
+        _tprintf(TEXT("Usage: GrayBench [width height [frames]]\n"));
+        _tprintf(TEXT("The width and height must be even.\n"));
+        return 1;
+    }
+
+    // Allocate for the largest format (P010: 2 bytes per pixel, 1.5 planes).
+    // Rows are padded to 64 bytes, as a video decoder would do.
+
+    const DWORD dwWidth = (DWORD)width;
+    const DWORD dwHeight = (DWORD)height;
+
+    const SIZE_T cbMax = (SIZE_T)((dwWidth * 2 + 63) & ~63) * (dwHeight + dwHeight / 2);
+
+    BYTE *pSrc = (BYTE*)VirtualAlloc(NULL, cbMax, MEM_COMMIT, PAGE_READWRITE);
+    BYTE *pReference = (BYTE*)VirtualAlloc(NULL, cbMax, MEM_COMMIT, PAGE_READWRITE);
+    BYTE *pDest = (BYTE*)VirtualAlloc(NULL, cbMax, MEM_COMMIT, PAGE_READWRITE);
+
+    if (!pSrc || !pReference || !pDest)
+    {
+        _tprintf(TEXT("Out of memory\n"));
+        return 1;
+    }
+
+    FillFrame(pSrc, cbMax);
+
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+
+    CTransformBands bands;
+    HRESULT hr = bands.Start(si.dwNumberOfProcessors - 1);
+    if (FAILED(hr))
+    {
+        _tprintf(TEXT("Could not start the band threads - 0x%08X\n"), hr);
+        return 1;
+    }
+
+    KERNEL_ISA isaBest = GetBestKernelIsa();
+
+    _tprintf(TEXT("%d x %d, %d frames, %u processors%s\n\n"),
+        width, height, cFrames, si.dwNumberOfProcessors,
+        dwWidth * dwHeight < CTransformBands::MIN_BAND_PIXELS ? TEXT(" (too small to split into bands)") : TEXT(""));
+
+    _tprintf(TEXT("%-8s"), TEXT("fps"));
+    for (int isa = KERNEL_ISA_SCALAR; isa <= isaBest; isa++)
+    {
+        _tprintf(TEXT("%10s"), g_IsaNames[isa]);
+    }
+    _tprintf(TEXT("%10s bands\n"), g_IsaNames[isaBest]);
+
+    int cFailed = 0;
+
+    for (DWORD i = 0; i < ARRAYSIZE(g_Formats); i++)
+    {
+        const FormatInfo *pFormat = &g_Formats[i];
+
+        LONG lStride = (LONG)((dwWidth * pFormat->cbPerPixel + 63) & ~63);
+        DWORD cRows = pFormat->bPlanar420 ? dwHeight + dwHeight / 2 : dwHeight;
+        SIZE_T cbFrame = (SIZE_T)lStride * cRows;
+
+        ZeroMemory(pReference, cbFrame);
+        pFormat->pTransformFn(pReference, lStride, pSrc, lStride, dwWidth, dwHeight, 0, dwHeight, KERNEL_ISA_SCALAR);
+
+        _tprintf(TEXT("%-8s"), pFormat->pszName);
+
+        for (int isa = KERNEL_ISA_SCALAR; isa <= isaBest + 1; isa++)
+        {
+            BOOL bBands = (isa > isaBest);
+
+            double fps = TimeTransform(pFormat, pSrc, pReference, pDest, cbFrame,
+                lStride, dwWidth, dwHeight, (DWORD)cFrames,
+                bBands ? isaBest : (KERNEL_ISA)isa,
+                bBands ? &bands : NULL);
+
+            if (fps == 0)
+            {
+                _tprintf(TEXT("%10s"), TEXT("WRONG"));
+                cFailed++;
+            }
+            else
+            {
+                _tprintf(TEXT("%10.1f"), fps);
+            }
+        }
+        _tprintf(TEXT("\n"));
+    }
+
+    bands.Stop();
+
+    VirtualFree(pSrc, 0, MEM_RELEASE);
+    VirtualFree(pReference, 0, MEM_RELEASE);
+    VirtualFree(pDest, 0, MEM_RELEASE);
+
+    return cFailed ? 1 : 0;
+}
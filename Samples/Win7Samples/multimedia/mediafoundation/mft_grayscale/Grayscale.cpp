@@ -14,6 +14,7 @@
 #define CHECK_HR(hr) if (FAILED(hr)) { goto done; }
 
 #include "MFT_Grayscale.h"
+#include "GrayscaleKernels.h"
 #include "Grayscale.h"
 #include "logmediatype.h"
 
@@ -25,11 +26,16 @@
 // This sample implements a Media Foundation transform (MFT) that 
 // converts YUV video frames to grayscale. The conversion is done
 // simply by setting all of the U and V bytes to zero (0x80).
+//
+// The conversion functions are in GrayscaleKernels.cpp. They work on
+// whole rows with SSE2 or AVX2 when the processor has them, and large
+// frames are split into bands of rows that are converted on several
+// threads at once.
 
 // NOTES:
 // 1-in, 1-out
 // Fixed streams
-// Formats: UYVY, YUY2, NV12
+// Formats: UYVY, YUY2, NV12, I420, P010
 
 // Assumptions:
 // 1. If the MFT is holding an input sample, SetInputType and SetOutputType 
@@ -47,13 +53,17 @@
 const FOURCC FOURCC_YUY2 = MAKEFOURCC('Y', 'U', 'Y', '2');
 const FOURCC FOURCC_UYVY = MAKEFOURCC('U', 'Y', 'V', 'Y');
 const FOURCC FOURCC_NV12 = MAKEFOURCC('N', 'V', '1', '2');
+const FOURCC FOURCC_I420 = MAKEFOURCC('I', '4', '2', '0');
+const FOURCC FOURCC_P010 = MAKEFOURCC('P', '0', '1', '0');
 
 // Static array of media types (preferred and accepted).
 const GUID* g_MediaSubtypes[] = 
 {
     & MEDIASUBTYPE_NV12,
     & MEDIASUBTYPE_YUY2,
-    & MEDIASUBTYPE_UYVY
+    & MEDIASUBTYPE_UYVY,
+    & MFVideoFormat_I420,
+    & MFVideoFormat_P010
 };
 
 // Number of media types in the aray.
@@ -62,119 +72,6 @@ DWORD g_cNumSubtypes = ARRAY_SIZE(g_MediaSubtypes);
 // GetImageSize: Returns the size of a video frame, in bytes.
 HRESULT GetImageSize(FOURCC fcc, UINT32 width, UINT32 height, DWORD* pcbImage);
 
-//-------------------------------------------------------------------
-// Name: TransformImage_UYVY
-// Description: Converts an image in UYVY format to grayscale.
-//
-// The image conversion functions take the following parameters:
-//
-// pDest:            Pointer to the destination buffer.
-// lDestStride:      Stride of the destination buffer, in bytes.
-// pSrc:             Pointer to the source buffer.
-// lSrcStride:       Stride of the source buffer, in bytes.
-// dwWidthInPixels:  Frame width in pixels.
-// dwHeightInPixels: Frame height, in pixels.
-//-------------------------------------------------------------------
-
-void TransformImage_UYVY(
-    BYTE*       pDest,
-    LONG        lDestStride,
-    const BYTE* pSrc,
-    LONG        lSrcStride,
-    DWORD       dwWidthInPixels,
-    DWORD       dwHeightInPixels
-    )
-{
-    for (DWORD y = 0; y < dwHeightInPixels; y++)
-    {
-        WORD *pSrc_Pixel = (WORD*)pSrc;
-        WORD *pDest_Pixel = (WORD*)pDest;
-        
-        for (DWORD x = 0; x < dwWidthInPixels; x++)
-        {
-            // Byte order is U0 Y0 V0 Y1
-            // Each WORD is a byte pair (U/V, Y)
-            // Windows is little-endian so the order appears reversed.
-            
-            WORD pixel = pSrc_Pixel[x] & 0xFF00;
-            pixel |= 0x0080;
-            pDest_Pixel[x] = pixel;
-        }
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-    }
-}
-
-
-//-------------------------------------------------------------------
-// Name: TransformImage_YUY2
-// Description: Converts an image in YUY2 format to grayscale.
-//-------------------------------------------------------------------
-
-void TransformImage_YUY2(
-    BYTE*       pDest,
-    LONG        lDestStride,
-    const BYTE* pSrc,
-    LONG        lSrcStride,
-    DWORD       dwWidthInPixels,
-    DWORD       dwHeightInPixels
-    )
-{
-    for (DWORD y = 0; y < dwHeightInPixels; y++)
-    {
-        WORD *pSrc_Pixel = (WORD*)pSrc;
-        WORD *pDest_Pixel = (WORD*)pDest;
-        
-        for (DWORD x = 0; x < dwWidthInPixels; x++)
-        {
-            // Byte order is Y0 U0 Y1 V0 
-            // Each WORD is a byte pair (Y, U/V)
-            // Windows is little-endian so the order appears reversed.
-            
-            WORD pixel = pSrc_Pixel[x] & 0x00FF;
-            pixel |= 0x8000;
-            pDest_Pixel[x] = pixel;
-        }
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-    }
-}
-
-
-
-//-------------------------------------------------------------------
-// Name: TransformImage_NV12
-// Description: Converts an image in NV12 format to grayscale.
-//-------------------------------------------------------------------
-
-void TransformImage_NV12(
-    BYTE*       pDest,
-    LONG        lDestStride,
-    const BYTE* pSrc,
-    LONG        lSrcStride,
-    DWORD       dwWidthInPixels,
-    DWORD       dwHeightInPixels
-    )
-{
-    // NV12 is planar: Y plane, followed by packed U-V plane.
-
-    // Y plane
-    for (DWORD y = 0; y < dwHeightInPixels; y++)
-    {
-        CopyMemory(pDest, pSrc, dwWidthInPixels);
-        pDest += lDestStride;
-        pSrc += lSrcStride;
-    }
-
-    // U-V plane
-    for (DWORD y = 0; y < dwHeightInPixels/2; y++)
-    {
-        FillMemory(pDest, dwWidthInPixels, 0x80);
-        pDest += lDestStride;
-    }
-}
-
-
 //-------------------------------------------------------------------
 // Name: CreateInstance
 // Description: Static method to create an instance of the source.
@@ -222,10 +119,12 @@ CGrayscale::CGrayscale(HRESULT& hr) :
     m_pInputType(NULL),
     m_pOutputType(NULL),
     m_pTransformFn(NULL),
+    m_isa(GetBestKernelIsa()),
     m_videoFOURCC(0),
     m_imageWidthInPixels(0),
     m_imageHeightInPixels(0),
-    m_cbImageSize(0)
+    m_cbImageSize(0),
+    m_bBandsTried(FALSE)
 {
 }
 
@@ -949,11 +848,21 @@ HRESULT CGrayscale::ProcessMessage(
         hr = E_NOTIMPL;
         break;
 
-    // The remaining messages do not require any action from this MFT.
-    case MFT_MESSAGE_NOTIFY_BEGIN_STREAMING:
     case MFT_MESSAGE_NOTIFY_END_STREAMING:
-    case MFT_MESSAGE_NOTIFY_END_OF_STREAM:
+        // Let the band threads go until streaming starts again. They
+        // are created by the first large frame (see OnProcessOutput).
+        m_bands.Stop();
+        m_bBandsTried = FALSE;
+        break;
+
+    case MFT_MESSAGE_NOTIFY_BEGIN_STREAMING:
     case MFT_MESSAGE_NOTIFY_START_OF_STREAM: 
+        // Give the band threads another chance if they failed to start.
+        m_bBandsTried = FALSE;
+        break;
+
+    // The remaining messages do not require any action from this MFT.
+    case MFT_MESSAGE_NOTIFY_END_OF_STREAM:
         break;
     }
 
@@ -1376,12 +1285,25 @@ HRESULT CGrayscale::OnProcessOutput(IMFMediaBuffer *pIn, IMFMediaBuffer *pOut)
     // Lock the output buffer.
     CHECK_HR(hr = outputLock.LockBuffer(lDefaultStride, m_imageHeightInPixels, &pDest, &lDestStride));
 
+    // Start the band threads the first time there is a frame big enough
+    // to split. If they cannot be started, convert on this thread, and
+    // do not try again until the stream starts again or is flushed.
+    if (!m_bands.IsStarted() && !m_bBandsTried &&
+        m_imageWidthInPixels * m_imageHeightInPixels >= CTransformBands::MIN_BAND_PIXELS)
+    {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+
+        m_bBandsTried = TRUE;
+        (void)m_bands.Start(si.dwNumberOfProcessors - 1);
+    }
+
     // Invoke the image transform function.
     assert (m_pTransformFn != NULL); 
     if (m_pTransformFn)
     {
-        (*m_pTransformFn)( pDest, lDestStride, pSrc, lSrcStride, 
-            m_imageWidthInPixels, m_imageHeightInPixels);
+        m_bands.Apply(m_pTransformFn, pDest, lDestStride, pSrc, lSrcStride, 
+            m_imageWidthInPixels, m_imageHeightInPixels, m_isa);
     }
     else
     {
@@ -1407,6 +1329,9 @@ HRESULT CGrayscale::OnFlush()
 {
     // For this MFT, flushing just means releasing the input sample.
     SAFE_RELEASE(m_pSample);
+
+    // If the band threads failed to start, try again with the next frame.
+    m_bBandsTried = FALSE;
     return S_OK;
 }
 
@@ -1452,6 +1377,14 @@ HRESULT CGrayscale::UpdateFormatInfo()
             m_pTransformFn = TransformImage_NV12;
             break;
 
+        case FOURCC_I420:
+            m_pTransformFn = TransformImage_I420;
+            break;
+
+        case FOURCC_P010:
+            m_pTransformFn = TransformImage_P010;
+            break;
+
         default:
             CHECK_HR(hr = E_UNEXPECTED);
         }
@@ -1503,6 +1436,7 @@ HRESULT GetImageSize(FOURCC fcc, UINT32 width, UINT32 height, DWORD* pcbImage)
         
 
     case FOURCC_NV12:
+    case FOURCC_I420:
         // check overflow
         if ((height/2 > MAXDWORD - height) ||
             ((height + height/2) > MAXDWORD / width))
@@ -1516,6 +1450,21 @@ HRESULT GetImageSize(FOURCC fcc, UINT32 width, UINT32 height, DWORD* pcbImage)
         }
         break;
 
+    case FOURCC_P010:
+        // check overflow
+        if ((height/2 > MAXDWORD - height) ||
+            (width > MAXDWORD / 2) ||
+            ((height + height/2) > MAXDWORD / (width * 2)))
+        {
+            hr = E_INVALIDARG;
+        }
+        else
+        {
+            // 24 bpp (16-bit samples, 4:2:0)
+            *pcbImage = width * 2 * (height + (height/2));
+        }
+        break;
+
     default:
         hr = E_FAIL;    // Unsupported type.
     }
@@ -13,16 +13,6 @@
 
 #pragma once
 
-// Function pointer for the function that transforms the image.
-typedef void (*IMAGE_TRANSFORM_FN)(
-    BYTE*       pDest,
-    LONG        lDestStride,
-    const BYTE* pSrc,
-    LONG        lSrcStride,
-    DWORD       dwWidthInPixels,
-    DWORD       dwHeightInPixels
-    );
-
 // CGrayscale class:
 // Implements a grayscale video effect.
 
@@ -207,4 +197,8 @@ private:
     // Image transform function. (Changes based on the media type.)
     IMAGE_TRANSFORM_FN          m_pTransformFn;
 
+    KERNEL_ISA                  m_isa;                      // Instruction set for m_pTransformFn.
+    CTransformBands             m_bands;                    // Splits large frames across threads.
+    BOOL                        m_bBandsTried;              // TRUE once m_bands.Start was called.
+
 };
\ No newline at end of file
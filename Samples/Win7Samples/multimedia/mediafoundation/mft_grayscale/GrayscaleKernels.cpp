@@ -0,0 +1,730 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// GrayscaleKernels.cpp: Image transform functions.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include <windows.h>
+#include <intrin.h>
+#include <emmintrin.h>
+
+// The AVX2 versions need Visual C++ 2012 or later to build.
+#if (_MSC_VER >= 1700)
+#include <immintrin.h>
+#define KERNEL_AVX2
+#endif
+
+#include "GrayscaleKernels.h"
+
+
+// Every format comes down to three operations on whole rows:
+//
+// - Luma rows of planar formats are copied. CopyMemory already uses
+//   the widest loads and stores the processor has.
+// - Chroma rows of planar formats are filled with the value for zero
+//   color (0x80, or 0x8000 for 16-bit samples).
+// - Packed formats keep the luma bytes of each macropixel and replace
+//   the chroma bytes.
+//
+// The SSE2 and AVX2 versions of the last two work on 16 or 32 bytes at
+// a time. Macropixels and 16-bit samples never straddle those blocks,
+// so the same 32-bit mask and fill pattern applies to every DWORD. The
+// bytes left at the end of a row are done by the scalar code.
+
+
+//-------------------------------------------------------------------
+// Name: GetBestKernelIsa
+// Description: Checks the processor, and for AVX2 that the operating
+//              system saves the YMM registers.
+//-------------------------------------------------------------------
+
+KERNEL_ISA GetBestKernelIsa()
+{
+    int info[4];
+
+    __cpuid(info, 0);
+    int cIds = info[0];
+
+    __cpuid(info, 1);
+    BOOL bSSE2 = (info[3] & (1 << 26)) != 0;
+
+#ifdef KERNEL_AVX2
+    BOOL bOSXSAVE = (info[2] & (1 << 27)) != 0;
+    BOOL bAVX = (info[2] & (1 << 28)) != 0;
+
+    if (cIds >= 7 && bOSXSAVE && bAVX && (_xgetbv(0) & 6) == 6)
+    {
+        __cpuidex(info, 7, 0);
+        if (info[1] & (1 << 5))
+        {
+            return KERNEL_ISA_AVX2;
+        }
+    }
+#endif
+
+    return bSSE2 ? KERNEL_ISA_SSE2 : KERNEL_ISA_SCALAR;
+}
+
+
+//-------------------------------------------------------------------
+// Name: MaskRow_Scalar
+// Description: Sets each DWORD of the row to (src & dwMask) | dwFill.
+//
+// cb is the length of the row in bytes. If it is not a multiple of
+// four, the last WORD uses the low half of the pattern.
+//-------------------------------------------------------------------
+
+static void MaskRow_Scalar(
+    BYTE*       pDest,
+    const BYTE* pSrc,
+    DWORD       cb,
+    DWORD       dwMask,
+    DWORD       dwFill
+    )
+{
+    DWORD *pDest_Dword = (DWORD*)pDest;
+    const DWORD *pSrc_Dword = (const DWORD*)pSrc;
+
+    for (DWORD x = 0; x < cb / 4; x++)
+    {
+        pDest_Dword[x] = (pSrc_Dword[x] & dwMask) | dwFill;
+    }
+
+    if (cb & 2)
+    {
+        WORD *pDest_Word = (WORD*)(pDest + (cb & ~3));
+        const WORD *pSrc_Word = (const WORD*)(pSrc + (cb & ~3));
+
+        *pDest_Word = (WORD)((*pSrc_Word & dwMask) | dwFill);
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: FillRow_Scalar
+// Description: Fills a row of cb bytes with a 32-bit pattern.
+//-------------------------------------------------------------------
+
+static void FillRow_Scalar(BYTE* pDest, DWORD cb, DWORD dwFill)
+{
+    DWORD *pDest_Dword = (DWORD*)pDest;
+
+    for (DWORD x = 0; x < cb / 4; x++)
+    {
+        pDest_Dword[x] = dwFill;
+    }
+
+    for (DWORD x = cb & ~3; x < cb; x++)
+    {
+        pDest[x] = (BYTE)(dwFill >> ((x & 3) * 8));
+    }
+}
+
+
+//-------------------------------------------------------------------
+// SSE2 versions
+//-------------------------------------------------------------------
+
+static void MaskRow_SSE2(
+    BYTE*       pDest,
+    const BYTE* pSrc,
+    DWORD       cb,
+    DWORD       dwMask,
+    DWORD       dwFill
+    )
+{
+    const __m128i mask = _mm_set1_epi32((int)dwMask);
+    const __m128i fill = _mm_set1_epi32((int)dwFill);
+
+    DWORD x = 0;
+
+    // Four blocks at a time, so the loads are not waiting on each other.
+    for (; x + 64 <= cb; x += 64)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pSrc + x));
+        __m128i b = _mm_loadu_si128((const __m128i*)(pSrc + x + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(pSrc + x + 32));
+        __m128i d = _mm_loadu_si128((const __m128i*)(pSrc + x + 48));
+
+        _mm_storeu_si128((__m128i*)(pDest + x),      _mm_or_si128(_mm_and_si128(a, mask), fill));
+        _mm_storeu_si128((__m128i*)(pDest + x + 16), _mm_or_si128(_mm_and_si128(b, mask), fill));
+        _mm_storeu_si128((__m128i*)(pDest + x + 32), _mm_or_si128(_mm_and_si128(c, mask), fill));
+        _mm_storeu_si128((__m128i*)(pDest + x + 48), _mm_or_si128(_mm_and_si128(d, mask), fill));
+    }
+
+    for (; x + 16 <= cb; x += 16)
+    {
+        __m128i a = _mm_loadu_si128((const __m128i*)(pSrc + x));
+        _mm_storeu_si128((__m128i*)(pDest + x), _mm_or_si128(_mm_and_si128(a, mask), fill));
+    }
+
+    MaskRow_Scalar(pDest + x, pSrc + x, cb - x, dwMask, dwFill);
+}
+
+
+static void FillRow_SSE2(BYTE* pDest, DWORD cb, DWORD dwFill)
+{
+    const __m128i fill = _mm_set1_epi32((int)dwFill);
+
+    DWORD x = 0;
+
+    for (; x + 64 <= cb; x += 64)
+    {
+        _mm_storeu_si128((__m128i*)(pDest + x),      fill);
+        _mm_storeu_si128((__m128i*)(pDest + x + 16), fill);
+        _mm_storeu_si128((__m128i*)(pDest + x + 32), fill);
+        _mm_storeu_si128((__m128i*)(pDest + x + 48), fill);
+    }
+
+    for (; x + 16 <= cb; x += 16)
+    {
+        _mm_storeu_si128((__m128i*)(pDest + x), fill);
+    }
+
+    FillRow_Scalar(pDest + x, cb - x, dwFill);
+}
+
+
+#ifdef KERNEL_AVX2
+
+//-------------------------------------------------------------------
+// AVX2 versions
+//
+// These clear the upper halves of the YMM registers before returning,
+// so that SSE code that runs afterwards is not slowed down.
+//-------------------------------------------------------------------
+
+static void MaskRow_AVX2(
+    BYTE*       pDest,
+    const BYTE* pSrc,
+    DWORD       cb,
+    DWORD       dwMask,
+    DWORD       dwFill
+    )
+{
+    const __m256i mask = _mm256_set1_epi32((int)dwMask);
+    const __m256i fill = _mm256_set1_epi32((int)dwFill);
+
+    DWORD x = 0;
+
+    for (; x + 128 <= cb; x += 128)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(pSrc + x));
+        __m256i b = _mm256_loadu_si256((const __m256i*)(pSrc + x + 32));
+        __m256i c = _mm256_loadu_si256((const __m256i*)(pSrc + x + 64));
+        __m256i d = _mm256_loadu_si256((const __m256i*)(pSrc + x + 96));
+
+        _mm256_storeu_si256((__m256i*)(pDest + x),      _mm256_or_si256(_mm256_and_si256(a, mask), fill));
+        _mm256_storeu_si256((__m256i*)(pDest + x + 32), _mm256_or_si256(_mm256_and_si256(b, mask), fill));
+        _mm256_storeu_si256((__m256i*)(pDest + x + 64), _mm256_or_si256(_mm256_and_si256(c, mask), fill));
+        _mm256_storeu_si256((__m256i*)(pDest + x + 96), _mm256_or_si256(_mm256_and_si256(d, mask), fill));
+    }
+
+    for (; x + 32 <= cb; x += 32)
+    {
+        __m256i a = _mm256_loadu_si256((const __m256i*)(pSrc + x));
+        _mm256_storeu_si256((__m256i*)(pDest + x), _mm256_or_si256(_mm256_and_si256(a, mask), fill));
+    }
+
+    _mm256_zeroupper();
+
+    MaskRow_Scalar(pDest + x, pSrc + x, cb - x, dwMask, dwFill);
+}
+
+
+static void FillRow_AVX2(BYTE* pDest, DWORD cb, DWORD dwFill)
+{
+    const __m256i fill = _mm256_set1_epi32((int)dwFill);
+
+    DWORD x = 0;
+
+    for (; x + 128 <= cb; x += 128)
+    {
+        _mm256_storeu_si256((__m256i*)(pDest + x),      fill);
+        _mm256_storeu_si256((__m256i*)(pDest + x + 32), fill);
+        _mm256_storeu_si256((__m256i*)(pDest + x + 64), fill);
+        _mm256_storeu_si256((__m256i*)(pDest + x + 96), fill);
+    }
+
+    for (; x + 32 <= cb; x += 32)
+    {
+        _mm256_storeu_si256((__m256i*)(pDest + x), fill);
+    }
+
+    _mm256_zeroupper();
+
+    FillRow_Scalar(pDest + x, cb - x, dwFill);
+}
+
+#endif // KERNEL_AVX2
+
+
+//-------------------------------------------------------------------
+// Name: MaskRows
+// Description: Runs MaskRow on rows dwFirstRow to dwLastRow - 1.
+//-------------------------------------------------------------------
+
+static void MaskRows(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       cbRow,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    DWORD       dwMask,
+    DWORD       dwFill,
+    KERNEL_ISA  isa
+    )
+{
+    pDest += (LONG)dwFirstRow * lDestStride;
+    pSrc += (LONG)dwFirstRow * lSrcStride;
+
+    for (DWORD y = dwFirstRow; y < dwLastRow; y++)
+    {
+        switch (isa)
+        {
+#ifdef KERNEL_AVX2
+        case KERNEL_ISA_AVX2:
+            MaskRow_AVX2(pDest, pSrc, cbRow, dwMask, dwFill);
+            break;
+#endif
+        case KERNEL_ISA_SSE2:
+            MaskRow_SSE2(pDest, pSrc, cbRow, dwMask, dwFill);
+            break;
+
+        default:
+            MaskRow_Scalar(pDest, pSrc, cbRow, dwMask, dwFill);
+            break;
+        }
+        pDest += lDestStride;
+        pSrc += lSrcStride;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: FillRows
+// Description: Runs FillRow on rows dwFirstRow to dwLastRow - 1.
+//-------------------------------------------------------------------
+
+static void FillRows(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    DWORD       cbRow,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    DWORD       dwFill,
+    KERNEL_ISA  isa
+    )
+{
+    pDest += (LONG)dwFirstRow * lDestStride;
+
+    for (DWORD y = dwFirstRow; y < dwLastRow; y++)
+    {
+        switch (isa)
+        {
+#ifdef KERNEL_AVX2
+        case KERNEL_ISA_AVX2:
+            FillRow_AVX2(pDest, cbRow, dwFill);
+            break;
+#endif
+        case KERNEL_ISA_SSE2:
+            FillRow_SSE2(pDest, cbRow, dwFill);
+            break;
+
+        default:
+            FillRow_Scalar(pDest, cbRow, dwFill);
+            break;
+        }
+        pDest += lDestStride;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: CopyRows
+// Description: Copies rows dwFirstRow to dwLastRow - 1.
+//-------------------------------------------------------------------
+
+static void CopyRows(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       cbRow,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow
+    )
+{
+    pDest += (LONG)dwFirstRow * lDestStride;
+    pSrc += (LONG)dwFirstRow * lSrcStride;
+
+    for (DWORD y = dwFirstRow; y < dwLastRow; y++)
+    {
+        CopyMemory(pDest, pSrc, cbRow);
+        pDest += lDestStride;
+        pSrc += lSrcStride;
+    }
+}
+
+
+//-------------------------------------------------------------------
+// Name: TransformImage_UYVY
+// Description: Converts an image in UYVY format to grayscale.
+//
+// The image conversion functions take the following parameters:
+//
+// pDest:            Pointer to the destination buffer.
+// lDestStride:      Stride of the destination buffer, in bytes.
+// pSrc:             Pointer to the source buffer.
+// lSrcStride:       Stride of the source buffer, in bytes.
+// dwWidthInPixels:  Frame width in pixels.
+// dwHeightInPixels: Frame height, in pixels.
+// dwFirstRow:       First luma row to convert.
+// dwLastRow:        One past the last luma row to convert.
+// isa:              Instruction set to use.
+//-------------------------------------------------------------------
+
+void TransformImage_UYVY(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       dwWidthInPixels,
+    DWORD       dwHeightInPixels,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    KERNEL_ISA  isa
+    )
+{
+    // Byte order is U0 Y0 V0 Y1
+    // Windows is little-endian so the order appears reversed in a DWORD.
+
+    MaskRows(pDest, lDestStride, pSrc, lSrcStride, dwWidthInPixels * 2,
+        dwFirstRow, dwLastRow, 0xFF00FF00, 0x00800080, isa);
+}
+
+
+//-------------------------------------------------------------------
+// Name: TransformImage_YUY2
+// Description: Converts an image in YUY2 format to grayscale.
+//-------------------------------------------------------------------
+
+void TransformImage_YUY2(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       dwWidthInPixels,
+    DWORD       dwHeightInPixels,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    KERNEL_ISA  isa
+    )
+{
+    // Byte order is Y0 U0 Y1 V0
+    // Windows is little-endian so the order appears reversed in a DWORD.
+
+    MaskRows(pDest, lDestStride, pSrc, lSrcStride, dwWidthInPixels * 2,
+        dwFirstRow, dwLastRow, 0x00FF00FF, 0x80008000, isa);
+}
+
+
+//-------------------------------------------------------------------
+// Name: TransformImage_NV12
+// Description: Converts an image in NV12 format to grayscale.
+//-------------------------------------------------------------------
+
+void TransformImage_NV12(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       dwWidthInPixels,
+    DWORD       dwHeightInPixels,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    KERNEL_ISA  isa
+    )
+{
+    // NV12 is planar: Y plane, followed by packed U-V plane.
+
+    // Y plane
+    CopyRows(pDest, lDestStride, pSrc, lSrcStride, dwWidthInPixels, dwFirstRow, dwLastRow);
+
+    // U-V plane
+    FillRows(pDest + (LONG)dwHeightInPixels * lDestStride, lDestStride, dwWidthInPixels,
+        dwFirstRow / 2, dwLastRow / 2, 0x80808080, isa);
+}
+
+
+//-------------------------------------------------------------------
+// Name: TransformImage_I420
+// Description: Converts an image in I420 format to grayscale.
+//-------------------------------------------------------------------
+
+void TransformImage_I420(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       dwWidthInPixels,
+    DWORD       dwHeightInPixels,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    KERNEL_ISA  isa
+    )
+{
+    // I420 is planar: Y plane, followed by a U plane and a V plane. The
+    // U and V planes have half the width, height, and stride of the Y plane.
+
+    LONG lChromaStride = lDestStride / 2;
+
+    BYTE *pDestU = pDest + (LONG)dwHeightInPixels * lDestStride;
+    BYTE *pDestV = pDestU + (LONG)(dwHeightInPixels / 2) * lChromaStride;
+
+    // Y plane
+    CopyRows(pDest, lDestStride, pSrc, lSrcStride, dwWidthInPixels, dwFirstRow, dwLastRow);
+
+    // U and V planes
+    FillRows(pDestU, lChromaStride, dwWidthInPixels / 2,
+        dwFirstRow / 2, dwLastRow / 2, 0x80808080, isa);
+
+    FillRows(pDestV, lChromaStride, dwWidthInPixels / 2,
+        dwFirstRow / 2, dwLastRow / 2, 0x80808080, isa);
+}
+
+
+//-------------------------------------------------------------------
+// Name: TransformImage_P010
+// Description: Converts an image in P010 format to grayscale.
+//-------------------------------------------------------------------
+
+void TransformImage_P010(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       dwWidthInPixels,
+    DWORD       dwHeightInPixels,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    KERNEL_ISA  isa
+    )
+{
+    // P010 has the same layout as NV12, but each sample is a WORD with
+    // the value in the upper 10 bits. Zero color is 0x8000.
+
+    // Y plane
+    CopyRows(pDest, lDestStride, pSrc, lSrcStride, dwWidthInPixels * 2, dwFirstRow, dwLastRow);
+
+    // U-V plane
+    FillRows(pDest + (LONG)dwHeightInPixels * lDestStride, lDestStride, dwWidthInPixels * 2,
+        dwFirstRow / 2, dwLastRow / 2, 0x80008000, isa);
+}
+
+
+//-------------------------------------------------------------------
+// CTransformBands class
+//-------------------------------------------------------------------
+
+CTransformBands::CTransformBands() :
+    m_bStarted(FALSE),
+    m_cThreads(0),
+    m_bExit(FALSE),
+    m_pTransformFn(NULL),
+    m_pDest(NULL),
+    m_lDestStride(0),
+    m_pSrc(NULL),
+    m_lSrcStride(0),
+    m_dwWidthInPixels(0),
+    m_dwHeightInPixels(0),
+    m_cBands(1),
+    m_isa(KERNEL_ISA_SCALAR)
+{
+    ZeroMemory(m_workers, sizeof(m_workers));
+}
+
+CTransformBands::~CTransformBands()
+{
+    Stop();
+}
+
+
+//-------------------------------------------------------------------
+// Name: Start
+// Description: Creates the worker threads.
+//-------------------------------------------------------------------
+
+HRESULT CTransformBands::Start(DWORD cThreads)
+{
+    Stop();
+
+    if (cThreads > MAX_THREADS)
+    {
+        cThreads = MAX_THREADS;
+    }
+
+    m_bExit = FALSE;
+
+    for (DWORD i = 0; i < cThreads; i++)
+    {
+        Worker *pWorker = &m_workers[i];
+
+        pWorker->pOwner = this;
+        pWorker->iBand = i + 1;
+        pWorker->hThread = NULL;
+        pWorker->hGo = CreateEvent(NULL, FALSE, FALSE, NULL);
+        pWorker->hDone = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+        if (pWorker->hGo && pWorker->hDone)
+        {
+            pWorker->hThread = CreateThread(NULL, 0, WorkerThreadProc, pWorker, 0, NULL);
+        }
+
+        if (pWorker->hThread == NULL)
+        {
+            HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+
+            if (pWorker->hGo)
+            {
+                CloseHandle(pWorker->hGo);
+            }
+            if (pWorker->hDone)
+            {
+                CloseHandle(pWorker->hDone);
+            }
+            Stop();
+            return FAILED(hr) ? hr : E_OUTOFMEMORY;
+        }
+
+        m_hDone[i] = pWorker->hDone;
+        m_cThreads++;
+    }
+
+    m_bStarted = TRUE;
+    return S_OK;
+}
+
+
+//-------------------------------------------------------------------
+// Name: Stop
+// Description: Waits for the worker threads to exit.
+//-------------------------------------------------------------------
+
+void CTransformBands::Stop()
+{
+    m_bExit = TRUE;
+
+    for (DWORD i = 0; i < m_cThreads; i++)
+    {
+        SetEvent(m_workers[i].hGo);
+    }
+
+    for (DWORD i = 0; i < m_cThreads; i++)
+    {
+        WaitForSingleObject(m_workers[i].hThread, INFINITE);
+        CloseHandle(m_workers[i].hThread);
+        CloseHandle(m_workers[i].hGo);
+        CloseHandle(m_workers[i].hDone);
+    }
+
+    m_cThreads = 0;
+    m_bStarted = FALSE;
+}
+
+
+//-------------------------------------------------------------------
+// Name: Apply
+// Description: Converts a whole frame, and returns when all of the
+//              bands are done.
+//-------------------------------------------------------------------
+
+void CTransformBands::Apply(
+    IMAGE_TRANSFORM_FN  pTransformFn,
+    BYTE*               pDest,
+    LONG                lDestStride,
+    const BYTE*         pSrc,
+    LONG                lSrcStride,
+    DWORD               dwWidthInPixels,
+    DWORD               dwHeightInPixels,
+    KERNEL_ISA          isa
+    )
+{
+    if (m_cThreads == 0 || dwWidthInPixels * dwHeightInPixels < MIN_BAND_PIXELS)
+    {
+        pTransformFn(pDest, lDestStride, pSrc, lSrcStride,
+            dwWidthInPixels, dwHeightInPixels, 0, dwHeightInPixels, isa);
+        return;
+    }
+
+    m_pTransformFn = pTransformFn;
+    m_pDest = pDest;
+    m_lDestStride = lDestStride;
+    m_pSrc = pSrc;
+    m_lSrcStride = lSrcStride;
+    m_dwWidthInPixels = dwWidthInPixels;
+    m_dwHeightInPixels = dwHeightInPixels;
+    m_cBands = m_cThreads + 1;
+    m_isa = isa;
+
+    for (DWORD i = 0; i < m_cThreads; i++)
+    {
+        SetEvent(m_workers[i].hGo);
+    }
+
+    DoBand(0);
+
+    WaitForMultipleObjects(m_cThreads, m_hDone, TRUE, INFINITE);
+}
+
+
+//-------------------------------------------------------------------
+// Name: DoBand
+// Description: Converts one band. Bands start on even rows so that
+//              4:2:0 chroma rows are not split between two bands.
+//-------------------------------------------------------------------
+
+void CTransformBands::DoBand(DWORD iBand)
+{
+    DWORD dwFirstRow = (m_dwHeightInPixels * iBand / m_cBands) & ~1;
+    DWORD dwLastRow = m_dwHeightInPixels;
+
+    if (iBand + 1 < m_cBands)
+    {
+        dwLastRow = (m_dwHeightInPixels * (iBand + 1) / m_cBands) & ~1;
+    }
+
+    m_pTransformFn(m_pDest, m_lDestStride, m_pSrc, m_lSrcStride,
+        m_dwWidthInPixels, m_dwHeightInPixels, dwFirstRow, dwLastRow, m_isa);
+}
+
+
+//-------------------------------------------------------------------
+// Name: WorkerThreadProc
+//-------------------------------------------------------------------
+
+DWORD WINAPI CTransformBands::WorkerThreadProc(LPVOID pv)
+{
+    Worker *pWorker = (Worker*)pv;
+    CTransformBands *pThis = pWorker->pOwner;
+
+    for (;;)
+    {
+        WaitForSingleObject(pWorker->hGo, INFINITE);
+        if (pThis->m_bExit)
+        {
+            return 0;
+        }
+        pThis->DoBand(pWorker->iBand);
+        SetEvent(pWorker->hDone);
+    }
+}
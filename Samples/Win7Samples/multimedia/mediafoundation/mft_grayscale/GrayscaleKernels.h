@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// GrayscaleKernels.h: Image transform functions used by the grayscale
+// transform and by the GrayBench throughput benchmark.
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#pragma once
+
+// Instruction sets the transform functions can use. Every level
+// produces exactly the same output.
+enum KERNEL_ISA
+{
+    KERNEL_ISA_SCALAR,
+    KERNEL_ISA_SSE2,
+    KERNEL_ISA_AVX2
+};
+
+// GetBestKernelIsa: Returns the fastest level that this processor
+// and compiler support.
+KERNEL_ISA GetBestKernelIsa();
+
+
+// Function pointer for the function that transforms the image.
+//
+// The function converts luma rows dwFirstRow up to (but not including)
+// dwLastRow, plus the chroma rows that go with them. For 4:2:0 formats
+// dwFirstRow must be even. Different row ranges can be converted at
+// the same time on different threads.
+typedef void (*IMAGE_TRANSFORM_FN)(
+    BYTE*       pDest,
+    LONG        lDestStride,
+    const BYTE* pSrc,
+    LONG        lSrcStride,
+    DWORD       dwWidthInPixels,
+    DWORD       dwHeightInPixels,
+    DWORD       dwFirstRow,
+    DWORD       dwLastRow,
+    KERNEL_ISA  isa
+    );
+
+void TransformImage_UYVY(BYTE*, LONG, const BYTE*, LONG, DWORD, DWORD, DWORD, DWORD, KERNEL_ISA);
+void TransformImage_YUY2(BYTE*, LONG, const BYTE*, LONG, DWORD, DWORD, DWORD, DWORD, KERNEL_ISA);
+void TransformImage_NV12(BYTE*, LONG, const BYTE*, LONG, DWORD, DWORD, DWORD, DWORD, KERNEL_ISA);
+void TransformImage_I420(BYTE*, LONG, const BYTE*, LONG, DWORD, DWORD, DWORD, DWORD, KERNEL_ISA);
+void TransformImage_P010(BYTE*, LONG, const BYTE*, LONG, DWORD, DWORD, DWORD, DWORD, KERNEL_ISA);
+
+
+// CTransformBands class:
+// Splits a frame into bands of rows and runs the transform function on
+// a set of worker threads. The calling thread converts the first band.
+
+class CTransformBands
+{
+public:
+
+    // Frames smaller than this are converted on the calling thread.
+    static const DWORD MIN_BAND_PIXELS = 1280 * 720;
+
+    CTransformBands();
+    ~CTransformBands();
+
+    // Start: Creates cThreads worker threads. (Zero is allowed.)
+    HRESULT Start(DWORD cThreads);
+    void    Stop();
+
+    BOOL    IsStarted() const { return m_bStarted; }
+
+    void Apply(
+        IMAGE_TRANSFORM_FN  pTransformFn,
+        BYTE*               pDest,
+        LONG                lDestStride,
+        const BYTE*         pSrc,
+        LONG                lSrcStride,
+        DWORD               dwWidthInPixels,
+        DWORD               dwHeightInPixels,
+        KERNEL_ISA          isa
+        );
+
+private:
+
+    static const DWORD MAX_THREADS = 16;
+
+    struct Worker
+    {
+        CTransformBands     *pOwner;
+        DWORD               iBand;          // Band this thread converts.
+        HANDLE              hThread;
+        HANDLE              hGo;            // Signaled to start a band.
+        HANDLE              hDone;          // Signaled when it is finished.
+    };
+
+    static DWORD WINAPI WorkerThreadProc(LPVOID pv);
+    void DoBand(DWORD iBand);
+
+    BOOL                        m_bStarted;
+    DWORD                       m_cThreads;
+    Worker                      m_workers[MAX_THREADS];
+    HANDLE                      m_hDone[MAX_THREADS];   // Copies of the hDone handles.
+    volatile BOOL               m_bExit;
+
+    // The frame being converted. Written before any hGo event is set.
+    IMAGE_TRANSFORM_FN          m_pTransformFn;
+    BYTE                        *m_pDest;
+    LONG                        m_lDestStride;
+    const BYTE                  *m_pSrc;
+    LONG                        m_lSrcStride;
+    DWORD                       m_dwWidthInPixels;
+    DWORD                       m_dwHeightInPixels;
+    DWORD                       m_cBands;
+    KERNEL_ISA                  m_isa;
+};
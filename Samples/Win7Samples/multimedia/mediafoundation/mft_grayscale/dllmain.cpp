@@ -21,6 +21,7 @@
 
 #include <assert.h>
 #include "MFT_Grayscale.h"
+#include "GrayscaleKernels.h"
 #include "Grayscale.h"
 #include "ClassFactory.h"   // Implements IClassFactory
 #include "registry.h"       // Helpers to register COM objects.
@@ -0,0 +1,366 @@
+//////////////////////////////////////////////////////////////////////////
+//
+// MPEG1Bench.cpp: Demux throughput benchmark for the MPEG-1 parser.
+//
+// Runs the parser of the MPEG-1 source over a program stream file,
+// without Media Foundation, and reports how fast it goes:
+//
+// - The start code scan, one byte at a time and with SSE2.
+// - The whole demux loop, reading the file in READ_SIZE chunks the way
+//   the source does, with each payload either held by reference to the
+//   read buffer (as the source delivers it) or copied out.
+//
+// Usage: MPEG1Bench file.mpg [passes]
+//
+// THIS CODE AND INFORMATION IS PROVIDED "AS IS" WITHOUT WARRANTY OF
+// ANY KIND, EITHER EXPRESSED OR IMPLIED, INCLUDING BUT NOT LIMITED TO
+// THE IMPLIED WARRANTIES OF MERCHANTABILITY AND/OR FITNESS FOR A
+// PARTICULAR PURPOSE.
+//
+// Copyright (c) Microsoft Corporation. All rights reserved.
+//
+//////////////////////////////////////////////////////////////////////////
+
+#include "MPEG1Source.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <tchar.h>
+
+
+// Number of payloads that are held at once, to stand in for the samples
+// that are queued on the streams and in the pipeline.
+const DWORD MAX_HELD_PAYLOADS = 8;
+
+typedef DWORD (*SCAN_FN)(const BYTE *pData, DWORD cbLen);
+
+
+//-------------------------------------------------------------------
+// Name: GetSeconds
+// Description: Returns the time from liStart to now.
+//-------------------------------------------------------------------
+
+static double GetSeconds(const LARGE_INTEGER& liStart)
+{
+    LARGE_INTEGER liStop, liFrequency;
+    QueryPerformanceCounter(&liStop);
+    QueryPerformanceFrequency(&liFrequency);
+
+    double dSeconds = (double)(liStop.QuadPart - liStart.QuadPart) / (double)liFrequency.QuadPart;
+    return max(dSeconds, 1e-9);
+}
+
+
+//-------------------------------------------------------------------
+// Name: LoadFile
+// Description: Reads the whole file into memory.
+//-------------------------------------------------------------------
+
+static HRESULT LoadFile(LPCTSTR pszFile, BYTE **ppData, DWORD *pcbData)
+{
+    HRESULT hr = S_OK;
+    BYTE *pData = NULL;
+    DWORD cbRead = 0;
+    LARGE_INTEGER liSize;
+
+    HANDLE hFile = CreateFile(pszFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    if (!GetFileSizeEx(hFile, &liSize))
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+    if (liSize.QuadPart > MAXLONG)
+    {
+        CHECK_HR(hr = E_OUTOFMEMORY);
+    }
+
+    pData = (BYTE*)VirtualAlloc(NULL, (SIZE_T)liSize.QuadPart + 1, MEM_COMMIT, PAGE_READWRITE);
+    if (pData == NULL)
+    {
+        CHECK_HR(hr = E_OUTOFMEMORY);
+    }
+
+    if (!ReadFile(hFile, pData, (DWORD)liSize.QuadPart, &cbRead, NULL))
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    *ppData = pData;
+    *pcbData = cbRead;
+    pData = NULL;
+
+done:
+    if (pData)
+    {
+        VirtualFree(pData, 0, MEM_RELEASE);
+    }
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Name: ScanFile
+// Description: Finds every start code prefix in the buffer. Returns 
+//              the number found.
+//-------------------------------------------------------------------
+
+static DWORD ScanFile(SCAN_FN pScanFn, const BYTE *pData, DWORD cbData)
+{
+    DWORD cFound = 0;
+    DWORD pos = 0;
+
+    while (pos < cbData)
+    {
+        pos += pScanFn(pData + pos, cbData - pos);
+        if (pos < cbData)
+        {
+            cFound++;
+            pos++;
+        }
+    }
+    return cFound;
+}
+
+
+//-------------------------------------------------------------------
+// Name: DemuxFile
+// Description: Demuxes the file with the same loop as 
+//              MPEG1Source::ParseData and MPEG1Source::ReadPayload.
+//
+// bCopy: If TRUE, copy each payload. Otherwise keep a reference on
+//        the read buffer block, as PayloadBuffer does.
+//-------------------------------------------------------------------
+
+static HRESULT DemuxFile(
+    LPCTSTR pszFile, 
+    BOOL bCopy, 
+    DWORD *pcPackets, 
+    ULONGLONG *pcbFile,
+    double *pdSeconds
+    )
+{
+    HRESULT hr = S_OK;
+
+    Parser  *pParser = NULL;
+    Buffer  readBuffer;
+    BYTE    *pCopy = NULL;
+    BufferBlock *held[MAX_HELD_PAYLOADS] = { 0 };
+
+    DWORD   cPackets = 0;
+    DWORD   cbNextRequest = 0;
+    ULONGLONG cbTotal = 0;
+    BOOL    bEndOfFile = FALSE;
+    LARGE_INTEGER liStart;
+
+    HANDLE hFile = CreateFile(pszFile, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (hFile == INVALID_HANDLE_VALUE)
+    {
+        CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+    }
+
+    pParser = new Parser();
+    pCopy = new BYTE[MPEG1_MAX_PACKET_SIZE];
+    if (pParser == NULL || pCopy == NULL)
+    {
+        CHECK_HR(hr = E_OUTOFMEMORY);
+    }
+
+    CHECK_HR(hr = readBuffer.Initalize(INITIAL_BUFFER_SIZE));
+
+    QueryPerformanceCounter(&liStart);
+
+    while (!pParser->IsEndOfStream())
+    {
+        DWORD cbAte = 0;
+        BOOL  bNeedMoreData = FALSE;
+
+        if (pParser->HasPacket())
+        {
+            DWORD cbPayload = pParser->PayloadSize();
+
+            if (cbPayload > readBuffer.DataSize())
+            {
+                cbNextRequest = cbPayload - readBuffer.DataSize();
+                bNeedMoreData = TRUE;
+            }
+            else
+            {
+                if (bCopy)
+                {
+                    CopyMemory(pCopy, readBuffer.DataPtr(), cbPayload);
+                }
+                else
+                {
+                    BufferBlock **ppSlot = &held[cPackets % MAX_HELD_PAYLOADS];
+                    SAFE_RELEASE(*ppSlot);
+                    *ppSlot = readBuffer.Block();
+                    (*ppSlot)->AddRef();
+                }
+
+                cPackets++;
+                cbAte = cbPayload;
+                pParser->ClearPacket();
+            }
+        }
+        else
+        {
+            CHECK_HR(hr = pParser->ParseBytes(readBuffer.DataPtr(), readBuffer.DataSize(), &cbAte));
+            if (hr == S_FALSE)
+            {
+                bNeedMoreData = TRUE;
+            }
+        }
+
+        CHECK_HR(hr = readBuffer.MoveStart(cbAte));
+
+        if (bNeedMoreData)
+        {
+            if (bEndOfFile)
+            {
+                break;
+            }
+
+            DWORD cbRequest = max(READ_SIZE, cbNextRequest);
+            DWORD cbRead = 0;
+
+            cbNextRequest = 0;
+
+            CHECK_HR(hr = readBuffer.Reserve(cbRequest));
+
+            if (!ReadFile(hFile, readBuffer.DataPtr() + readBuffer.DataSize(), cbRequest, &cbRead, NULL))
+            {
+                CHECK_HR(hr = HRESULT_FROM_WIN32(GetLastError()));
+            }
+            if (cbRead == 0)
+            {
+                bEndOfFile = TRUE;
+            }
+
+            CHECK_HR(hr = readBuffer.MoveEnd(cbRead));
+            cbTotal += cbRead;
+        }
+    }
+
+    *pdSeconds = GetSeconds(liStart);
+    *pcPackets = cPackets;
+    *pcbFile = cbTotal;
+
+done:
+    for (DWORD i = 0; i < MAX_HELD_PAYLOADS; i++)
+    {
+        SAFE_RELEASE(held[i]);
+    }
+    delete pParser;
+    delete [] pCopy;
+    if (hFile != INVALID_HANDLE_VALUE)
+    {
+        CloseHandle(hFile);
+    }
+    return hr;
+}
+
+
+int __cdecl _tmain(int argc, TCHAR *argv[])
+{
+    HRESULT hr = S_OK;
+    int cPasses = 5;
+
+    BYTE *pData = NULL;
+    DWORD cbData = 0;
+
+    if (argc < 2)
+    {
+        _tprintf(TEXT("Usage: MPEG1Bench file.mpg [passes]\n"));
+        return 1;
+    }
+    if (argc >= 3)
+    {
+        cPasses = _ttoi(argv[2]);
+    }
+    if (cPasses <= 0)
+    {
+        cPasses = 1;
+    }
+
+    hr = LoadFile(argv[1], &pData, &cbData);
+    if (FAILED(hr))
+    {
+        _tprintf(TEXT("Could not read %s - 0x%08X\n"), argv[1], hr);
+        return 1;
+    }
+
+    const double MB = 1024.0 * 1024.0;
+
+    _tprintf(TEXT("%s: %.1f MB, %d passes\n\n"), argv[1], cbData / MB, cPasses);
+
+    // Start code scan over the file in memory.
+
+    DWORD cFoundScalar = 0;
+    DWORD cFound = 0;
+    double dScalar = 1e9;
+    double dSSE2 = 1e9;
+
+    for (int i = 0; i < cPasses; i++)
+    {
+        LARGE_INTEGER liStart;
+
+        QueryPerformanceCounter(&liStart);
+        cFoundScalar = ScanFile(FindStartCodePrefix_Scalar, pData, cbData);
+        dScalar = min(dScalar, GetSeconds(liStart));
+
+        QueryPerformanceCounter(&liStart);
+        cFound = ScanFile(FindStartCodePrefix, pData, cbData);
+        dSSE2 = min(dSSE2, GetSeconds(liStart));
+    }
+
+    _tprintf(TEXT("Start code scan  %u prefixes\n"), cFound);
+    _tprintf(TEXT("  scalar      %10.1f MB/s\n"), cbData / MB / dScalar);
+    _tprintf(TEXT("  best        %10.1f MB/s\n"), cbData / MB / dSSE2);
+
+    VirtualFree(pData, 0, MEM_RELEASE);
+
+    if (cFound != cFoundScalar)
+    {
+        _tprintf(TEXT("WRONG: the scalar scan found %u prefixes\n"), cFoundScalar);
+        return 1;
+    }
+
+    // Demux from the file. The first pass also warms the file cache.
+
+    for (int iMode = 0; iMode < 2; iMode++)
+    {
+        BOOL bCopy = (iMode == 1);
+        DWORD cPackets = 0;
+        ULONGLONG cbFile = 0;
+        double dBest = 1e9;
+
+        for (int i = 0; i < cPasses; i++)
+        {
+            double dSeconds = 0;
+
+            hr = DemuxFile(argv[1], bCopy, &cPackets, &cbFile, &dSeconds);
+            if (FAILED(hr))
+            {
+                _tprintf(TEXT("Demux failed - 0x%08X\n"), hr);
+                return 1;
+            }
+            dBest = min(dBest, dSeconds);
+        }
+
+        if (iMode == 0)
+        {
+            _tprintf(TEXT("\nDemux  %u packets\n"), cPackets);
+        }
+        _tprintf(TEXT("  %-11s %10.1f MB/s\n"), bCopy ? TEXT("copy") : TEXT("zero-copy"), cbFile / MB / dBest);
+    }
+
+    return 0;
+}
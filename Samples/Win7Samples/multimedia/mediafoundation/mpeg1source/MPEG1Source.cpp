@@ -1540,7 +1540,6 @@ HRESULT MPEG1Source::DeliverPayload()
 
     IMFMediaBuffer      *pBuffer = NULL;
     IMFSample           *pSample = NULL;
-    BYTE                *pData = NULL;      // Pointer to the IMFMediaBuffer data.
 
     packetHdr = m_pParser->PacketHeader();
 
@@ -1560,16 +1559,14 @@ HRESULT MPEG1Source::DeliverPayload()
     assert(pStream != NULL);
 
 
-    // Create a media buffer for the payload.
-    CHECK_HR(hr = MFCreateMemoryBuffer(packetHdr.cbPayload, &pBuffer));
-
-    CHECK_HR(hr = pBuffer->Lock(&pData, NULL, NULL));
-
-    CopyMemory(pData, m_ReadBuffer.DataPtr(), packetHdr.cbPayload);
-
-    CHECK_HR(hr = pBuffer->Unlock());
-
-    CHECK_HR(hr = pBuffer->SetCurrentLength(packetHdr.cbPayload));
+    // Create a media buffer for the payload. The buffer points into the 
+    // read buffer, so the payload is not copied.
+    CHECK_HR(hr = PayloadBuffer::CreateInstance(
+        m_ReadBuffer.Block(), 
+        m_ReadBuffer.DataPtr(), 
+        packetHdr.cbPayload, 
+        &pBuffer
+        ));
 
     // Create a sample to hold the buffer.
     CHECK_HR(hr = MFCreateSample(&pSample));
@@ -1911,6 +1908,118 @@ HRESULT StartOp::GetPresentationDescriptor(IMFPresentationDescriptor **ppPD)
 }
 
 
+//-------------------------------------------------------------------
+// PayloadBuffer class
+//-------------------------------------------------------------------
+
+PayloadBuffer::PayloadBuffer(BufferBlock *pBlock, BYTE *pData, DWORD cbData) :
+    m_pBlock(pBlock),
+    m_pData(pData),
+    m_cbData(cbData),
+    m_cbCurrent(cbData)
+{
+    m_pBlock->AddRef();
+}
+
+PayloadBuffer::~PayloadBuffer()
+{
+    SAFE_RELEASE(m_pBlock);
+}
+
+
+//-------------------------------------------------------------------
+// CreateInstance
+// Creates a media buffer for cbData bytes at pData, which must be
+// inside pBlock.
+//-------------------------------------------------------------------
+
+HRESULT PayloadBuffer::CreateInstance(BufferBlock *pBlock, BYTE *pData, DWORD cbData, IMFMediaBuffer **ppBuffer)
+{
+    if (pBlock == NULL || pData == NULL || ppBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    assert(pData >= pBlock->Ptr() && cbData <= pBlock->Size() - (DWORD)(pData - pBlock->Ptr()));
+
+    PayloadBuffer *pBuffer = new PayloadBuffer(pBlock, pData, cbData);
+    if (pBuffer == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    *ppBuffer = pBuffer;
+    return S_OK;
+}
+
+HRESULT PayloadBuffer::QueryInterface(REFIID riid, void** ppv)
+{
+    static const QITAB qit[] = 
+    {
+        QITABENT(PayloadBuffer, IMFMediaBuffer),
+        { 0 }
+    };
+    return QISearch(this, qit, riid, ppv);
+}
+
+HRESULT PayloadBuffer::Lock(BYTE **ppbBuffer, DWORD *pcbMaxLength, DWORD *pcbCurrentLength)
+{
+    if (ppbBuffer == NULL)
+    {
+        return E_POINTER;
+    }
+
+    // The block is never moved or written while the buffer exists, so
+    // there is nothing to lock.
+    *ppbBuffer = m_pData;
+
+    if (pcbMaxLength)
+    {
+        *pcbMaxLength = m_cbData;
+    }
+    if (pcbCurrentLength)
+    {
+        *pcbCurrentLength = m_cbCurrent;
+    }
+    return S_OK;
+}
+
+HRESULT PayloadBuffer::Unlock()
+{
+    return S_OK;
+}
+
+HRESULT PayloadBuffer::GetCurrentLength(DWORD *pcbCurrentLength)
+{
+    if (pcbCurrentLength == NULL)
+    {
+        return E_POINTER;
+    }
+    *pcbCurrentLength = m_cbCurrent;
+    return S_OK;
+}
+
+HRESULT PayloadBuffer::SetCurrentLength(DWORD cbCurrentLength)
+{
+    if (cbCurrentLength > m_cbData)
+    {
+        return E_INVALIDARG;
+    }
+    m_cbCurrent = cbCurrentLength;
+    return S_OK;
+}
+
+HRESULT PayloadBuffer::GetMaxLength(DWORD *pcbMaxLength)
+{
+    if (pcbMaxLength == NULL)
+    {
+        return E_POINTER;
+    }
+    *pcbMaxLength = m_cbData;
+    return S_OK;
+}
+
+
 /*  Static functions */
 
 
@@ -82,8 +82,8 @@ enum SourceState
 
 // Constants
 
-const DWORD INITIAL_BUFFER_SIZE = 4 * 1024; // Initial size of the read buffer. (The buffer expands dynamically.)
-const DWORD READ_SIZE = 4 * 1024;           // Size of each read request.
+const DWORD INITIAL_BUFFER_SIZE = 256 * 1024;   // Initial size of the read buffer. (The buffer expands dynamically.)
+const DWORD READ_SIZE = 64 * 1024;              // Size of each read request.
 const DWORD SAMPLE_QUEUE = 2;               // How many samples does each stream try to hold in its queue?
 
 
@@ -136,6 +136,38 @@ protected:
 };
 
 
+// PayloadBuffer: Media buffer for one payload. 
+// Points into a block of the source's read buffer instead of holding a 
+// copy of the data, and keeps the block alive until it is released.
+// The data is read-only.
+class PayloadBuffer : RefCountedObject, public IMFMediaBuffer
+{
+public:
+    static HRESULT CreateInstance(BufferBlock *pBlock, BYTE *pData, DWORD cbData, IMFMediaBuffer **ppBuffer);
+
+    // IUnknown
+    STDMETHODIMP QueryInterface(REFIID iid, void** ppv);
+    STDMETHODIMP_(ULONG) AddRef() { return RefCountedObject::AddRef(); }
+    STDMETHODIMP_(ULONG) Release() { return RefCountedObject::Release(); }
+
+    // IMFMediaBuffer
+    STDMETHODIMP Lock(BYTE **ppbBuffer, DWORD *pcbMaxLength, DWORD *pcbCurrentLength);
+    STDMETHODIMP Unlock();
+    STDMETHODIMP GetCurrentLength(DWORD *pcbCurrentLength);
+    STDMETHODIMP SetCurrentLength(DWORD cbCurrentLength);
+    STDMETHODIMP GetMaxLength(DWORD *pcbMaxLength);
+
+private:
+    PayloadBuffer(BufferBlock *pBlock, BYTE *pData, DWORD cbData);
+    ~PayloadBuffer();
+
+    BufferBlock                 *m_pBlock;
+    BYTE                        *m_pData;
+    DWORD                       m_cbData;       // Size of the payload.
+    DWORD                       m_cbCurrent;    // Current length.
+};
+
+
 // MPEG1Source: The media source object.
 class MPEG1Source : BaseObject, RefCountedObject, public OpQueue<SourceOp>, public IMFMediaSource
 {
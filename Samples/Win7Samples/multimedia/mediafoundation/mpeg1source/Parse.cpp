@@ -15,6 +15,9 @@
 #include "MPEG1Source.h"
 #include "Parse.h"
 
+#include <intrin.h>
+#include <emmintrin.h>
+
 // HAS_FLAG: Test if 'b' contains a specified bit flag
 #define HAS_FLAG(b, flag) (((b) & (flag)) == (flag))
 
@@ -83,29 +86,76 @@ HRESULT GetAudioBitRate(MPEG1AudioLayer layer, BYTE index, DWORD *pdwBitRate);
 HRESULT GetSamplingFrequency(BYTE code, DWORD *pdwSamplesPerSec);
 
 
+//-------------------------------------------------------------------
+// BufferBlock class
+//-------------------------------------------------------------------
+
+BufferBlock::BufferBlock() : m_pData(NULL), m_cbSize(0)
+{
+}
+
+BufferBlock::~BufferBlock()
+{
+    delete [] m_pData;
+}
+
+
+//-------------------------------------------------------------------
+// Create
+// Allocates a block of cbSize bytes.
+//-------------------------------------------------------------------
+
+HRESULT BufferBlock::Create(DWORD cbSize, BufferBlock **ppBlock)
+{
+    BufferBlock *pBlock = new BufferBlock();
+    if (pBlock == NULL)
+    {
+        return E_OUTOFMEMORY;
+    }
+
+    pBlock->m_pData = new BYTE[cbSize];
+    if (pBlock->m_pData == NULL)
+    {
+        pBlock->Release();
+        return E_OUTOFMEMORY;
+    }
+    pBlock->m_cbSize = cbSize;
+
+    *ppBlock = pBlock;
+    return S_OK;
+}
+
+
 //-------------------------------------------------------------------
 // Buffer class
 //-------------------------------------------------------------------
 
 
-Buffer::Buffer() : m_begin(0), m_end(0)
+Buffer::Buffer() : m_pBlock(NULL), m_begin(0), m_end(0)
 {
 }
 
+Buffer::~Buffer()
+{
+    SAFE_RELEASE(m_pBlock);
+}
+
 
 //-------------------------------------------------------------------
 // Initalize
 // Sets the initial buffer size.
+//
+// This is also the smallest size of the blocks that the buffer moves
+// to when payloads still point into the current block.
 //-------------------------------------------------------------------
 
 HRESULT Buffer::Initalize(DWORD cbSize)
 {
-    HRESULT hr = SetSize(cbSize);
-    if (SUCCEEDED(hr))
-    {
-        ZeroMemory(Ptr(), cbSize);
-    }
-    return hr;
+    SAFE_RELEASE(m_pBlock);
+    m_begin = 0;
+    m_end = 0;
+
+    return BufferBlock::Create(cbSize, &m_pBlock);
 }
 
 
@@ -116,7 +166,7 @@ HRESULT Buffer::Initalize(DWORD cbSize)
 
 BYTE* Buffer::DataPtr()
 {
-    return Ptr() + m_begin;
+    return m_pBlock->Ptr() + m_begin;
 }
 
 
@@ -142,8 +192,8 @@ DWORD Buffer::DataSize() const
 //
 // This method does *not* increase the value returned by DataSize().
 //
-// After this method returns, the value of DataPtr() might change,
-// so do not cache the old value.
+// After this method returns, the values of DataPtr() and Block() might
+// change, so do not cache the old values.
 //-------------------------------------------------------------------
 
 HRESULT Buffer::Reserve(DWORD cb)
@@ -154,23 +204,32 @@ HRESULT Buffer::Reserve(DWORD cb)
     }
 
     HRESULT hr = S_OK;
+    BufferBlock *pBlock = NULL;
 
-    // If this would push the end position past the end of the array, 
-    // then we need to copy up the data to start of the array. We might 
-    // also need to realloc the array.
+    // If this would push the end position past the end of the block, 
+    // then we need to copy up the data to the start of the block, or
+    // to a new block.
 
-    if (cb > GetCount() - m_end)
+    if (cb > m_pBlock->Size() - m_end)
     {
-        // New end position would be past the end of the array.
-        // Check if we need to grow the array.
-
-        if (cb > CurrentFreeSize())
+        if (cb <= CurrentFreeSize() && !m_pBlock->IsShared())
         {
-            // Array needs to grow
-            CHECK_HR(hr = SetSize(DataSize() + cb));
+            // Nothing else points into the block, so the data can be
+            // moved to the front.
+            MoveMemory(m_pBlock->Ptr(), DataPtr(), DataSize());
+        }
+        else
+        {
+            // The block is too small, or payloads still point into it. 
+            // Copy the unparsed data to a new block. 
+            CHECK_HR(hr = BufferBlock::Create(max(m_pBlock->Size(), DataSize() + cb), &pBlock));
+
+            CopyMemory(pBlock->Ptr(), DataPtr(), DataSize());
+
+            m_pBlock->Release();
+            m_pBlock = pBlock;
+            pBlock = NULL;
         }
-        
-        MoveMemory(Ptr(), DataPtr(), DataSize());
 
         // Reset begin and end. 
         m_end = DataSize(); // Update m_end first before resetting m_begin!
@@ -180,6 +239,7 @@ HRESULT Buffer::Reserve(DWORD cb)
     assert(CurrentFreeSize() >= cb);
 
 done:
+    SAFE_RELEASE(pBlock);
     return hr;
 }
 
@@ -226,13 +286,13 @@ HRESULT Buffer::MoveEnd(DWORD cb)
 //-------------------------------------------------------------------
 // CurrentFreeSize (private)
 //
-// Returns the size of the array minus the size of the data.
+// Returns the size of the block minus the size of the data.
 //-------------------------------------------------------------------
 
 DWORD Buffer::CurrentFreeSize() const
 {
-    assert(GetCount() >= DataSize());
-    return GetCount() - DataSize();
+    assert(m_pBlock->Size() >= DataSize());
+    return m_pBlock->Size() - DataSize();
 }
 
 
@@ -354,6 +414,14 @@ HRESULT Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
     {
         *pAte = cbLengthToStartCode + cbParsed;
     }
+    else if (hr == S_FALSE && cbLengthToStartCode > 0)
+    {
+        // Either there is no start code yet, or there is not enough data
+        // after it. Consume the bytes in front of it anyway, so that they
+        // are not scanned again when more data arrives.
+        *pAte = cbLengthToStartCode;
+        hr = S_OK;
+    }
     return hr;
 };
 
@@ -366,28 +434,108 @@ HRESULT Parser::ParseBytes(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 // cbLen: Size of the buffer.
 // pAte: Receives the number of bytes *before* the start code.
 //
-// If no start code is found, the method returns S_FALSE.
+// If no complete start code is found, the method returns S_FALSE, and
+// pAte receives the number of bytes that cannot be part of one.
 //-------------------------------------------------------------------
 
 HRESULT Parser::FindNextStartCode(const BYTE *pData, DWORD cbLen, DWORD *pAte)
 {
-    HRESULT hr = S_FALSE;
+    DWORD cbSkip = FindStartCodePrefix(pData, cbLen);
 
-    DWORD cbLeft = cbLen;
+    // The start code is the 3-byte prefix plus one more byte.
+    if (cbSkip < cbLen && cbLen - cbSkip >= 4)
+    {
+        *pAte = cbSkip;
+        return S_OK;
+    }
+
+    // The last two bytes might be the start of a prefix.
+    *pAte = min(cbSkip, (cbLen > 2 ? cbLen - 2 : 0));
+    return S_FALSE;
+}
+
+
+//-------------------------------------------------------------------
+// FindStartCodePrefix_Scalar
+// Looks for 00 00 01 one byte at a time. 
+//-------------------------------------------------------------------
 
-    while (cbLeft > 4)
+DWORD FindStartCodePrefix_Scalar(const BYTE *pData, DWORD cbLen)
+{
+    for (DWORD i = 0; i + 3 <= cbLen; i++)
     {
-        if ( (MAKE_DWORD_HOSTORDER(pData) & 0x00FFFFFF) == 0x00010000 )
+        if (pData[i] == 0 && pData[i + 1] == 0 && pData[i + 2] == 1)
         {
-            hr = S_OK;
-            break;
+            return i;
         }
+    }
+    return cbLen;
+}
 
-        cbLeft -= 4;
-        pData += 4;
+
+//-------------------------------------------------------------------
+// FindStartCodePrefix_SSE2
+// Looks for 00 00 01 at 16 positions at a time.
+//
+// Compares three overlapping loads: the bytes at each position, the 
+// bytes after them, and the bytes after those. The 01 byte is the 
+// rarest of the three, so the other two loads are only done when some
+// position has one.
+//-------------------------------------------------------------------
+
+static DWORD FindStartCodePrefix_SSE2(const BYTE *pData, DWORD cbLen)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+
+    DWORD i = 0;
+
+    for (; i + 18 <= cbLen; i += 16)
+    {
+        __m128i third = _mm_loadu_si128((const __m128i*)(pData + i + 2));
+
+        int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(third, one));
+        if (mask == 0)
+        {
+            continue;
+        }
+
+        __m128i first = _mm_loadu_si128((const __m128i*)(pData + i));
+        __m128i second = _mm_loadu_si128((const __m128i*)(pData + i + 1));
+
+        mask &= _mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, zero), _mm_cmpeq_epi8(second, zero))
+            );
+
+        if (mask != 0)
+        {
+            unsigned long index = 0;
+            _BitScanForward(&index, (unsigned long)mask);
+            return i + index;
+        }
+    }
+
+    // Check the last few positions.
+    return i + FindStartCodePrefix_Scalar(pData + i, cbLen - i);
+}
+
+
+//-------------------------------------------------------------------
+// FindStartCodePrefix
+//-------------------------------------------------------------------
+
+static const BOOL g_bSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+
+DWORD FindStartCodePrefix(const BYTE *pData, DWORD cbLen)
+{
+    if (g_bSSE2)
+    {
+        return FindStartCodePrefix_SSE2(pData, cbLen);
+    }
+    else
+    {
+        return FindStartCodePrefix_Scalar(pData, cbLen);
     }
-    *pAte = (cbLen - cbLeft);
-    return hr;
 }
 
 
@@ -169,18 +169,54 @@ struct MPEG1AudioFrameHeader
     WORD                wFlags;    // bitwise OR of MPEG1AudioFlags
 };
 
+// BufferBlock class:
+// Reference-counted block of memory that holds data read from the stream.
+// The media source hands out payloads that point into the block, and each
+// one holds a reference, so the payload data does not have to be copied.
+
+class BufferBlock : public RefCountedObject
+{
+public:
+    static HRESULT Create(DWORD cbSize, BufferBlock **ppBlock);
+
+    BYTE*   Ptr() { return m_pData; }
+    DWORD   Size() const { return m_cbSize; }
+
+    // IsShared: Returns TRUE if anything besides the read buffer still
+    // references the block.
+    BOOL    IsShared() const { return m_refCount > 1; }
+
+private:
+    BufferBlock();
+    ~BufferBlock();
+
+    BYTE    *m_pData;
+    DWORD   m_cbSize;
+};
+
+
 // Buffer class:
 // Resizable buffer used to hold the MPEG-1 data.
+//
+// When the buffer runs out of room, it moves the unparsed data to the 
+// front of the block. If payloads still point into the block, it moves
+// the unparsed data to a new block instead, and the old block is freed
+// when the last payload is released.
 
-class Buffer : GrowableArray<BYTE>
+class Buffer
 {
 public:
     Buffer();
+    ~Buffer();
     HRESULT Initalize(DWORD cbSize);
 
     BYTE*   DataPtr();
     DWORD   DataSize() const;
 
+    // Block: Returns the block that holds the data. (Not AddRef'd.)
+    // The block can change when Reserve is called.
+    BufferBlock* Block() { return m_pBlock; }
+
     // Reserve: Reserves cb bytes of free data in the buffer.
     // The reserved bytes start at DataPtr() + DataSize().
     HRESULT Reserve(DWORD cb);
@@ -197,6 +233,7 @@ private:
     DWORD   CurrentFreeSize() const;
 
 private:
+    BufferBlock *m_pBlock;
     DWORD   m_begin;
     DWORD   m_end;  // 1 past the last element
 };
@@ -247,6 +284,15 @@ private:
 };
 
 
+// FindStartCodePrefix:
+// Returns the offset of the first 00 00 01 byte sequence in the buffer,
+// or cbLen if there is none. Uses SSE2 if the processor supports it.
+DWORD FindStartCodePrefix(const BYTE *pData, DWORD cbLen);
+
+// FindStartCodePrefix_Scalar: Same, one byte at a time.
+DWORD FindStartCodePrefix_Scalar(const BYTE *pData, DWORD cbLen);
+
+
 HRESULT ReadVideoSequenceHeader(const BYTE *pData, DWORD cbData, MPEG1VideoSeqHeader& seqHeader, DWORD *pAte);
 
 HRESULT ReadAudioFrameHeader(const BYTE *pData, DWORD cbData, MPEG1AudioFrameHeader& audioHeader, DWORD *pAte);
\ No newline at end of file
@@ -260,6 +260,9 @@ private:
 
     HRESULT     ProcessSamplesFromQueue(FlushState bFlushData);
     HRESULT     WriteSampleToFile(IMFSample *pSample);
+    HRESULT     BufferData(const BYTE *pData, DWORD cbData);
+    HRESULT     FlushWriteBuffer();
+    HRESULT     PreallocateFile();
     HRESULT     SendMarkerEvent(IMarker *pMarker, FlushState bFlushData);
 
 
@@ -275,6 +278,15 @@ private:
     MFTIME                      m_StartTime;                // Presentation time when the clock started.
     DWORD                       m_cbDataWritten;            // How many bytes we have written so far.
 
+    // Sample data is gathered into a staging buffer and written in large
+    // pieces that end on aligned file offsets. See BufferData.
+    BYTE                        *m_pWriteBuffer;            // Staging buffer.
+    DWORD                       m_cbWriteBuffer;            // Size of the staging buffer.
+    DWORD                       m_cbBuffered;               // Bytes in the staging buffer.
+    DWORD                       m_cbWriteTarget;            // Write the buffer when it holds this many bytes.
+    QWORD                       m_qwWritePosition;          // File offset of the next write.
+    QWORD                       m_qwPreallocated;           // File length set by PreallocateFile, or 0.
+
     CWavSink                    *m_pSink;                   // Parent media sink
 
     IMFMediaEventQueue          *m_pEventQueue;             // Event queue
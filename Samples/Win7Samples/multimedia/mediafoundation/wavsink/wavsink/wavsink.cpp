@@ -41,6 +41,11 @@ HRESULT CreateWavSink(IMFByteStream *pStream, IMFMediaSink **ppSink)
 // The stream ID of the one stream on the sink.
 const DWORD WAV_SINK_STREAM_ID = 1;
 
+// Sample data is gathered into writes of up to WAV_MAX_WRITE_SIZE bytes that
+// end on multiples of WAV_WRITE_ALIGNMENT in the file.
+const DWORD WAV_WRITE_ALIGNMENT = 64 * 1024;
+const DWORD WAV_MAX_WRITE_SIZE = 4 * 1024 * 1024;
+
 
 // WAV_FILE_HEADER
 // This structure contains the first part of the .wav file, up to the
@@ -764,6 +769,8 @@ CWavStream::CWavStream()
     m_pSink(NULL), m_pEventQueue(NULL), m_pByteStream(NULL), 
     m_pCurrentType(NULL), m_pFinalizeResult(NULL),
     m_StartTime(0), m_cbDataWritten(0), m_WorkQueueId(0), 
+    m_pWriteBuffer(NULL), m_cbWriteBuffer(0), m_cbBuffered(0), m_cbWriteTarget(0),
+    m_qwWritePosition(0), m_qwPreallocated(0),
     m_WorkQueueCB(this, &CWavStream::OnDispatchWorkItem)
 {
 
@@ -1394,6 +1401,11 @@ HRESULT CWavStream::Initialize(CWavSink *pParent, IMFByteStream *pByteStream)
         hr = pByteStream->SetCurrentPosition(sizeof(WAV_FILE_HEADER));
     }
 
+    if (SUCCEEDED(hr))
+    {
+        m_qwWritePosition = sizeof(WAV_FILE_HEADER);
+    }
+
     // Create the event queue helper.
     if (SUCCEEDED(hr))
     {
@@ -1623,6 +1635,12 @@ HRESULT CWavStream::Shutdown()
 
     m_SampleQueue.Clear();
 
+    if (m_pWriteBuffer)
+    {
+        VirtualFree(m_pWriteBuffer, 0, MEM_RELEASE);
+        m_pWriteBuffer = NULL;
+    }
+
     SAFE_RELEASE(m_pSink);
     SAFE_RELEASE(m_pEventQueue);
     SAFE_RELEASE(m_pByteStream);
@@ -1688,6 +1706,13 @@ HRESULT CWavStream::OnDispatchWorkItem(IMFAsyncResult* pAsyncResult)
         {
         case OpStart:
         case OpRestart:
+            // Allocate the file before the first sample is written. The file
+            // is written correctly without it, so ignore any failure.
+            if (op == OpStart)
+            {
+                (void)PreallocateFile();
+            }
+
             // Send MEStreamSinkStarted.
             hr = QueueEvent(MEStreamSinkStarted, GUID_NULL, hr, NULL);
             
@@ -1821,7 +1846,16 @@ HRESULT CWavStream::ProcessSamplesFromQueue(FlushState bFlushData)
         {
             if (pMarker)
             {
-                hr = SendMarkerEvent(pMarker, bFlushData);
+                // Make sure the samples before the marker are in the file
+                // before the marker event is sent.
+                if (bFlushData == WriteSamples)
+                {
+                    hr = FlushWriteBuffer();
+                }
+                if (SUCCEEDED(hr))
+                {
+                    hr = SendMarkerEvent(pMarker, bFlushData);
+                }
             }
             else 
             {
@@ -1865,7 +1899,6 @@ HRESULT CWavStream::WriteSampleToFile(IMFSample *pSample)
     DWORD cBufferCount = 0; // Number of buffers in the sample.
     BYTE *pData = NULL;
     DWORD cbData = 0;
-    DWORD cbWritten = 0;
 
     // Get the time stamp
     hr = pSample->GetSampleTime(&time);
@@ -1891,7 +1924,7 @@ HRESULT CWavStream::WriteSampleToFile(IMFSample *pSample)
 
             hr = pSample->GetBufferByIndex(iBuffer, &pBuffer);
 
-            // Lock the buffer and write the data to the file.
+            // Lock the buffer and copy the data to the staging buffer.
             if (SUCCEEDED(hr))
             {
                 hr = pBuffer->Lock(&pData, NULL, &cbData);
@@ -1899,7 +1932,7 @@ HRESULT CWavStream::WriteSampleToFile(IMFSample *pSample)
 
             if (SUCCEEDED(hr))
             {
-                hr = m_pByteStream->Write(pData, cbData, &cbWritten);
+                hr = BufferData(pData, cbData);
                 pBuffer->Unlock();
             }
 
@@ -1921,6 +1954,155 @@ HRESULT CWavStream::WriteSampleToFile(IMFSample *pSample)
     return hr;
 }
 
+
+//-------------------------------------------------------------------
+// Name: BufferData
+// Description: Copies audio data to the staging buffer, and writes
+//              the staging buffer to the file whenever it is full.
+//
+// Writing every sample as it arrives costs one call to the byte
+// stream per sample, which adds up for high-rate multichannel audio
+// with short samples. Instead, the data is gathered into writes of
+// about a quarter second each. The first write is shortened so that
+// it ends on a multiple of WAV_WRITE_ALIGNMENT in the file (after the
+// RIFF headers), so every later write is aligned.
+//-------------------------------------------------------------------
+
+HRESULT CWavStream::BufferData(const BYTE *pData, DWORD cbData)
+{
+    HRESULT hr = S_OK;
+
+    // Allocate the staging buffer the first time.
+    if (m_pWriteBuffer == NULL)
+    {
+        UINT32 cbAvgBytesPerSec = 0;
+        (void)m_pCurrentType->GetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, &cbAvgBytesPerSec);
+
+        DWORD cbBuffer = (cbAvgBytesPerSec / 4 + WAV_WRITE_ALIGNMENT - 1) / WAV_WRITE_ALIGNMENT * WAV_WRITE_ALIGNMENT;
+        cbBuffer = max(cbBuffer, WAV_WRITE_ALIGNMENT);
+        cbBuffer = min(cbBuffer, WAV_MAX_WRITE_SIZE);
+
+        // VirtualAlloc returns page-aligned memory.
+        m_pWriteBuffer = (BYTE*)VirtualAlloc(NULL, cbBuffer, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (m_pWriteBuffer == NULL)
+        {
+            return E_OUTOFMEMORY;
+        }
+
+        m_cbWriteBuffer = cbBuffer;
+        m_cbBuffered = 0;
+        m_cbWriteTarget = cbBuffer - (DWORD)(m_qwWritePosition % WAV_WRITE_ALIGNMENT);
+    }
+
+    while (SUCCEEDED(hr) && cbData > 0)
+    {
+        DWORD cbCopy = min(cbData, m_cbWriteTarget - m_cbBuffered);
+
+        CopyMemory(m_pWriteBuffer + m_cbBuffered, pData, cbCopy);
+        m_cbBuffered += cbCopy;
+        pData += cbCopy;
+        cbData -= cbCopy;
+
+        if (m_cbBuffered == m_cbWriteTarget)
+        {
+            hr = FlushWriteBuffer();
+        }
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Name: FlushWriteBuffer
+// Description: Writes the contents of the staging buffer to the file.
+//-------------------------------------------------------------------
+
+HRESULT CWavStream::FlushWriteBuffer()
+{
+    HRESULT hr = S_OK;
+    DWORD cbWritten = 0;
+
+    if (m_cbBuffered > 0)
+    {
+        hr = m_pByteStream->Write(m_pWriteBuffer, m_cbBuffered, &cbWritten);
+
+        if (SUCCEEDED(hr))
+        {
+            m_qwWritePosition += m_cbBuffered;
+            m_cbBuffered = 0;
+
+            // The next write ends on the next aligned file offset.
+            m_cbWriteTarget = m_cbWriteBuffer - (DWORD)(m_qwWritePosition % WAV_WRITE_ALIGNMENT);
+        }
+    }
+
+    return hr;
+}
+
+
+//-------------------------------------------------------------------
+// Name: PreallocateFile
+// Description: Sets the length of the file up front, from the
+//              duration declared on the byte stream.
+//
+// The application declares the duration by setting the
+// MF_BYTESTREAM_DURATION attribute on the byte stream. Setting the
+// length once keeps the file from growing (and fragmenting) one write
+// at a time. DispatchFinalize cuts the file back to the data that was
+// actually written.
+//-------------------------------------------------------------------
+
+HRESULT CWavStream::PreallocateFile()
+{
+    HRESULT hr = S_OK;
+
+    IMFAttributes *pAttributes = NULL;
+    UINT64 hnsDuration = 0;
+    UINT32 cbAvgBytesPerSec = 0;
+    QWORD cbFile = 0;
+
+    // Only before anything is written.
+    if (m_cbDataWritten != 0 || m_qwPreallocated != 0)
+    {
+        return S_OK;
+    }
+
+    hr = m_pByteStream->QueryInterface(IID_IMFAttributes, (void**)&pAttributes);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pAttributes->GetUINT64(MF_BYTESTREAM_DURATION, &hnsDuration);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        hr = m_pCurrentType->GetUINT32(MF_MT_AUDIO_AVG_BYTES_PER_SECOND, &cbAvgBytesPerSec);
+    }
+
+    if (SUCCEEDED(hr))
+    {
+        // Round up to a whole aligned block, but stay within the 4 GB
+        // limit of a RIFF file.
+        cbFile = sizeof(WAV_FILE_HEADER) + hnsDuration * cbAvgBytesPerSec / 10000000;
+        cbFile = (cbFile + WAV_WRITE_ALIGNMENT - 1) / WAV_WRITE_ALIGNMENT * WAV_WRITE_ALIGNMENT;
+        cbFile = min(cbFile, (QWORD)MAXDWORD);
+
+        hr = m_pByteStream->SetLength(cbFile);
+    }
+
+    // Setting the length might move the file pointer.
+    if (SUCCEEDED(hr))
+    {
+        m_qwPreallocated = cbFile;
+        hr = m_pByteStream->SetCurrentPosition(m_qwWritePosition);
+    }
+
+    SAFE_RELEASE(pAttributes);
+
+    return hr;
+}
+
 //-------------------------------------------------------------------
 // Name: SendMarkerEvent
 // Description: Saned a marker event.
@@ -1971,12 +2153,26 @@ HRESULT CWavStream::DispatchFinalize(CAsyncOperation* pOp)
     WAV_FILE_HEADER header;
     ZeroMemory(&header, sizeof(header));
 
-    DWORD cbFileSize = m_cbDataWritten + sizeof(WAV_FILE_HEADER) - sizeof(RIFFCHUNK);
-
-    // Write any samples left in the queue...
+    // Write any samples left in the queue, and then the rest of the
+    // staging buffer...
     hr = ProcessSamplesFromQueue(WriteSamples);
 
-    // Now we're done writing all of the audio data. 
+    if (SUCCEEDED(hr))
+    {
+        hr = FlushWriteBuffer();
+    }
+
+    // If the file was allocated up front, cut it back to the data that
+    // was written.
+    if (SUCCEEDED(hr) && m_qwPreallocated != 0)
+    {
+        hr = m_pByteStream->SetLength(m_qwWritePosition);
+    }
+
+    // Now we're done writing all of the audio data. The sizes in the
+    // RIFF headers are only known now, so the headers are written once,
+    // here.
+    DWORD cbFileSize = m_cbDataWritten + sizeof(WAV_FILE_HEADER) - sizeof(RIFFCHUNK);
 
     // Fill in the RIFF headers...
     if (SUCCEEDED(hr))
@@ -15,6 +15,8 @@ using namespace MediaFoundationSamples;
 
 HRESULT CreateWavFile(const WCHAR *sURL, const WCHAR *sOutputFile);
 
+HRESULT SetByteStreamDuration(IMFMediaSource *pSource, IMFByteStream *pStream);
+
 HRESULT CreateTopology(IMFMediaSource *pSource, IMFMediaSink *pSink, IMFTopology **ppTopology);
 
 HRESULT CreateTopologyBranch(
@@ -116,6 +118,13 @@ HRESULT CreateWavFile(const WCHAR *sURL, const WCHAR *sOutputFile)
         hr = CreateMediaSource(sURL, &pSource);
     }
 
+    // Tell the sink how long the file will be, so that it can allocate
+    // the whole file up front. Not every source knows its duration.
+    if (SUCCEEDED(hr))
+    {
+        (void)SetByteStreamDuration(pSource, pStream);
+    }
+
     // Create the topology.
     if (SUCCEEDED(hr))
     {
@@ -146,6 +155,42 @@ HRESULT CreateWavFile(const WCHAR *sURL, const WCHAR *sOutputFile)
 }
 
 
+///////////////////////////////////////////////////////////////////////
+//  Name: SetByteStreamDuration
+//  Description:  Copies the duration of the source to the
+//                MF_BYTESTREAM_DURATION attribute of the output byte
+//                stream.
+///////////////////////////////////////////////////////////////////////
+
+HRESULT SetByteStreamDuration(IMFMediaSource *pSource, IMFByteStream *pStream)
+{
+    IMFPresentationDescriptor *pPD = NULL;
+    IMFAttributes *pAttributes = NULL;
+
+    UINT64 hnsDuration = 0;
+
+    HRESULT hr = pSource->CreatePresentationDescriptor(&pPD);
+
+    if (SUCCEEDED(hr))
+    {
+        hr = pPD->GetUINT64(MF_PD_DURATION, &hnsDuration);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pStream->QueryInterface(IID_IMFAttributes, (void**)&pAttributes);
+    }
+    if (SUCCEEDED(hr))
+    {
+        hr = pAttributes->SetUINT64(MF_BYTESTREAM_DURATION, hnsDuration);
+    }
+
+    SAFE_RELEASE(pPD);
+    SAFE_RELEASE(pAttributes);
+
+    return hr;
+}
+
+
 ///////////////////////////////////////////////////////////////////////
 //  Name: RunMediaSession
 //  Description:  